@@ -10,15 +10,37 @@
  */
 
 #include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
 
 #include "configuration.h"
 
+/* Version of the cache format, increase when it changes */
+#define CACHE_VERSION 1
+
+#define CACHE_TYPE "(usa(sxx)asasa(sssu))"
+
+/* File or directory the configuration was read from and its state at the time */
+typedef struct
+{
+    gchar *path;
+    gint64 mtime;
+    gint64 size;
+} ConfigStamp;
+
 struct ConfigurationPrivate
 {
     gchar *dir;
     GKeyFile *key_file;
     GList *sources;
     GHashTable *key_sources;
+
+    /* Files and directories read, to check if a cache is out of date */
+    GPtrArray *stamps;
+
+    /* Messages from loading */
+    GList *messages;
+
     GHashTable *lightdm_keys;
     GHashTable *seat_keys;
     GHashTable *xdmcp_keys;
@@ -40,13 +62,53 @@ Configuration *
 config_get_instance (void)
 {
     if (!configuration_instance)
-        configuration_instance = g_object_new (CONFIGURATION_TYPE, NULL);
+        configuration_instance = config_new ();
     return configuration_instance;
 }
 
+Configuration *
+config_new (void)
+{
+    return g_object_new (CONFIGURATION_TYPE, NULL);
+}
+
+static void
+config_stamp_free (ConfigStamp *stamp)
+{
+    g_free (stamp->path);
+    g_free (stamp);
+}
+
+static void
+get_stamp (const gchar *path, gint64 *mtime, gint64 *size)
+{
+    GStatBuf buf;
+    if (g_stat (path, &buf) == 0)
+    {
+        *mtime = buf.st_mtime;
+        *size = buf.st_size;
+    }
+    else
+    {
+        *mtime = -1;
+        *size = -1;
+    }
+}
+
+static void
+add_stamp (Configuration *config, const gchar *path)
+{
+    ConfigStamp *stamp = g_new0 (ConfigStamp, 1);
+    stamp->path = g_strdup (path);
+    get_stamp (path, &stamp->mtime, &stamp->size);
+    g_ptr_array_add (config->priv->stamps, stamp);
+}
+
 gboolean
 config_load_from_file (Configuration *config, const gchar *path, GList **messages, GError **error)
 {
+    add_stamp (config, path);
+
     g_autoptr(GKeyFile) key_file = g_key_file_new ();
     if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, error))
         return FALSE;
@@ -129,8 +191,10 @@ compare_strings (gconstpointer a, gconstpointer b)
 }
 
 static void
-load_config_directory (const gchar *path, GList **messages)
+load_config_directory (Configuration *config, const gchar *path, GList **messages)
 {
+    add_stamp (config, path);
+
     /* Find configuration files */
     g_autoptr(GError) error = NULL;
     GDir *dir = g_dir_open (path, 0, &error);
@@ -157,7 +221,7 @@ load_config_directory (const gchar *path, GList **messages)
             if (messages)
                 *messages = g_list_append (*messages, g_strdup_printf ("Loading configuration from %s", conf_path));
             g_autoptr(GError) conf_error = NULL;
-            config_load_from_file (config_get_instance (), conf_path, messages, &conf_error);
+            config_load_from_file (config, conf_path, messages, &conf_error);
             if (conf_error && !g_error_matches (conf_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
                 g_printerr ("Failed to load configuration from %s: %s\n", filename, conf_error->message);
         }
@@ -168,7 +232,7 @@ load_config_directory (const gchar *path, GList **messages)
 }
 
 static void
-load_config_directories (const gchar * const *dirs, GList **messages)
+load_config_directories (Configuration *config, const gchar * const *dirs, GList **messages)
 {
     /* Load in reverse order, because XDG_* fields are preference-ordered and the directories in front should override directories in back. */
     for (gint i = g_strv_length ((gchar **)dirs) - 1; i >= 0; i--)
@@ -176,40 +240,48 @@ load_config_directories (const gchar * const *dirs, GList **messages)
         g_autofree gchar *full_dir = g_build_filename (dirs[i], "lightdm", "lightdm.conf.d", NULL);
         if (messages)
             *messages = g_list_append (*messages, g_strdup_printf ("Loading configuration dirs from %s", full_dir));
-        load_config_directory (full_dir, messages);
+        load_config_directory (config, full_dir, messages);
     }
 }
 
-gboolean
-config_load_from_standard_locations (Configuration *config, const gchar *config_path, GList **messages)
+static void
+get_standard_paths (const gchar *config_path, gchar **dir, gchar **config_d_dir, gchar **path)
 {
-    g_return_val_if_fail (config->priv->dir == NULL, FALSE);
-
-    load_config_directories (g_get_system_data_dirs (), messages);
-    load_config_directories (g_get_system_config_dirs (), messages);
-
-    g_autofree gchar *config_d_dir = NULL;
-    g_autofree gchar *path = NULL;
     if (config_path)
     {
-        path = g_strdup (config_path);
+        *path = g_strdup (config_path);
         g_autofree gchar *basename = g_path_get_basename (config_path);
-        config->priv->dir = path_make_absolute (basename);
+        *dir = path_make_absolute (basename);
+        *config_d_dir = NULL;
     }
     else
     {
-        config->priv->dir = g_strdup (CONFIG_DIR);
-        config_d_dir = g_build_filename (config->priv->dir, "lightdm.conf.d", NULL);
-        path = g_build_filename (config->priv->dir, "lightdm.conf", NULL);
+        *dir = g_strdup (CONFIG_DIR);
+        *config_d_dir = g_build_filename (*dir, "lightdm.conf.d", NULL);
+        *path = g_build_filename (*dir, "lightdm.conf", NULL);
     }
+}
+
+gboolean
+config_load_from_standard_locations (Configuration *config, const gchar *config_path, GList **messages)
+{
+    g_return_val_if_fail (config->priv->dir == NULL, FALSE);
+
+    GList *load_messages = NULL;
+    load_config_directories (config, g_get_system_data_dirs (), &load_messages);
+    load_config_directories (config, g_get_system_config_dirs (), &load_messages);
+
+    g_autofree gchar *config_d_dir = NULL;
+    g_autofree gchar *path = NULL;
+    get_standard_paths (config_path, &config->priv->dir, &config_d_dir, &path);
 
     if (config_d_dir)
-        load_config_directory (config_d_dir, messages);
+        load_config_directory (config, config_d_dir, &load_messages);
 
-    if (messages)
-        *messages = g_list_append (*messages, g_strdup_printf ("Loading configuration from %s", path));
+    load_messages = g_list_append (load_messages, g_strdup_printf ("Loading configuration from %s", path));
     g_autoptr(GError) error = NULL;
-    if (!config_load_from_file (config, path, messages, &error))
+    gboolean result = TRUE;
+    if (!config_load_from_file (config, path, &load_messages, &error))
     {
         gboolean is_empty = error && g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
 
@@ -217,13 +289,199 @@ config_load_from_standard_locations (Configuration *config, const gchar *config_
         {
             if (error)
                 g_printerr ("Failed to load configuration from %s: %s\n", path, error->message);
-            return FALSE;
+            result = FALSE;
+        }
+    }
+
+    /* Keep messages so they can be shown again when loaded from a cache */
+    for (GList *link = load_messages; link && messages; link = link->next)
+        *messages = g_list_append (*messages, g_strdup (link->data));
+    g_list_free_full (config->priv->messages, g_free);
+    config->priv->messages = load_messages;
+
+    return result;
+}
+
+/* Identifies the locations a configuration was loaded from */
+static gchar *
+get_cache_identity (const gchar *config_path)
+{
+    g_autofree gchar *data_dirs = g_strjoinv (":", (gchar **) g_get_system_data_dirs ());
+    g_autofree gchar *config_dirs = g_strjoinv (":", (gchar **) g_get_system_config_dirs ());
+    return g_strdup_printf ("%s\n%s\n%s", config_path ? config_path : "", data_dirs, config_dirs);
+}
+
+static GVariant *
+build_cache (Configuration *config, const gchar *config_path)
+{
+    g_autofree gchar *identity = get_cache_identity (config_path);
+
+    GVariantBuilder stamps;
+    g_variant_builder_init (&stamps, G_VARIANT_TYPE ("a(sxx)"));
+    for (guint i = 0; i < config->priv->stamps->len; i++)
+    {
+        ConfigStamp *stamp = config->priv->stamps->pdata[i];
+        g_variant_builder_add (&stamps, "(sxx)", stamp->path, stamp->mtime, stamp->size);
+    }
+
+    GVariantBuilder sources;
+    g_variant_builder_init (&sources, G_VARIANT_TYPE_STRING_ARRAY);
+    for (GList *link = config->priv->sources; link; link = link->next)
+        g_variant_builder_add (&sources, "s", link->data);
+
+    GVariantBuilder messages;
+    g_variant_builder_init (&messages, G_VARIANT_TYPE_STRING_ARRAY);
+    for (GList *link = config->priv->messages; link; link = link->next)
+        g_variant_builder_add (&messages, "s", link->data);
+
+    GVariantBuilder entries;
+    g_variant_builder_init (&entries, G_VARIANT_TYPE ("a(sssu)"));
+    g_auto(GStrv) groups = g_key_file_get_groups (config->priv->key_file, NULL);
+    for (gchar **group = groups; *group; group++)
+    {
+        g_auto(GStrv) keys = g_key_file_get_keys (config->priv->key_file, *group, NULL, NULL);
+        for (gint i = 0; keys && keys[i]; i++)
+        {
+            g_autofree gchar *value = g_key_file_get_value (config->priv->key_file, *group, keys[i], NULL);
+            gint source = g_list_index (config->priv->sources, config_get_source (config, *group, keys[i]));
+            g_variant_builder_add (&entries, "(sssu)", *group, keys[i], value, source >= 0 ? (guint32) source : G_MAXUINT32);
         }
     }
 
+    return g_variant_new (CACHE_TYPE, CACHE_VERSION, identity, &stamps, &sources, &messages, &entries);
+}
+
+/* Get the loaded configuration in a form that can be loaded again with config_load_from_snapshot () */
+GVariant *
+config_get_snapshot (Configuration *config, const gchar *config_path)
+{
+    return build_cache (config, config_path);
+}
+
+gboolean
+config_write_cache (Configuration *config, const gchar *cache_path, const gchar *config_path, GError **error)
+{
+    /* Modification times are only in seconds, so a file changed this second could change again unnoticed */
+    gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+    for (guint i = 0; i < config->priv->stamps->len; i++)
+    {
+        ConfigStamp *stamp = config->priv->stamps->pdata[i];
+        if (stamp->mtime >= now)
+            return TRUE;
+    }
+
+    g_autoptr(GVariant) cache = g_variant_ref_sink (build_cache (config, config_path));
+
+    g_autofree gchar *dir = g_path_get_dirname (cache_path);
+    if (g_mkdir_with_parents (dir, 0755) < 0)
+    {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "Failed to make directory %s: %s", dir, g_strerror (errno));
+        return FALSE;
+    }
+    return g_file_set_contents (cache_path, g_variant_get_data (cache), g_variant_get_size (cache), error);
+}
+
+/* Load a cache, if @check is TRUE only if it is for @config_path and the files haven't changed since */
+static gboolean
+load_cache (Configuration *config, GVariant *cache, const gchar *config_path, gboolean check)
+{
+    guint32 version;
+    const gchar *identity;
+    g_autoptr(GVariantIter) stamps = NULL;
+    g_autoptr(GVariantIter) sources = NULL;
+    g_autoptr(GVariantIter) cached_messages = NULL;
+    g_autoptr(GVariantIter) entries = NULL;
+    g_variant_get (cache, "(u&sa(sxx)asasa(sssu))", &version, &identity, &stamps, &sources, &cached_messages, &entries);
+
+    /* Check the cache is for these locations and nothing has changed since */
+    if (version != CACHE_VERSION)
+        return FALSE;
+    if (check)
+    {
+        g_autofree gchar *expected_identity = get_cache_identity (config_path);
+        if (strcmp (identity, expected_identity) != 0)
+            return FALSE;
+    }
+    const gchar *path;
+    gint64 mtime, size;
+    while (g_variant_iter_next (stamps, "(&sxx)", &path, &mtime, &size))
+    {
+        gint64 current_mtime, current_size;
+        get_stamp (path, &current_mtime, &current_size);
+        if (check && (current_mtime != mtime || current_size != size))
+            return FALSE;
+        add_stamp (config, path);
+    }
+
+    g_autofree gchar *config_d_dir = NULL;
+    g_autofree gchar *main_path = NULL;
+    get_standard_paths (config_path, &config->priv->dir, &config_d_dir, &main_path);
+
+    g_autoptr(GPtrArray) source_paths = g_ptr_array_new ();
+    const gchar *source;
+    while (g_variant_iter_next (sources, "&s", &source))
+    {
+        gchar *source_path = g_strdup (source);
+        config->priv->sources = g_list_append (config->priv->sources, source_path);
+        g_ptr_array_add (source_paths, source_path);
+    }
+
+    const gchar *message;
+    while (g_variant_iter_next (cached_messages, "&s", &message))
+        config->priv->messages = g_list_append (config->priv->messages, g_strdup (message));
+
+    const gchar *group, *key, *value;
+    guint32 source_index;
+    while (g_variant_iter_next (entries, "(&s&s&su)", &group, &key, &value, &source_index))
+    {
+        g_key_file_set_value (config->priv->key_file, group, key, value);
+        if (source_index < source_paths->len)
+            g_hash_table_insert (config->priv->key_sources, g_strdup_printf ("%s]%s", group, key), source_paths->pdata[source_index]);
+    }
+
+    return TRUE;
+}
+
+gboolean
+config_load_from_cache (Configuration *config, const gchar *cache_path, const gchar *config_path, GList **messages)
+{
+    g_return_val_if_fail (config->priv->dir == NULL, FALSE);
+
+    g_autoptr(GMappedFile) file = g_mapped_file_new (cache_path, FALSE, NULL);
+    if (!file)
+        return FALSE;
+    g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE));
+
+    if (!load_cache (config, cache, config_path, TRUE))
+        return FALSE;
+
+    for (GList *link = config->priv->messages; link && messages; link = link->next)
+        *messages = g_list_append (*messages, g_strdup (link->data));
+    if (messages)
+        *messages = g_list_append (*messages, g_strdup_printf ("Loaded configuration from cache %s", cache_path));
+
     return TRUE;
 }
 
+/* Load a configuration from config_get_snapshot (), as loaded by another process from wherever it was configured to */
+gboolean
+config_load_from_snapshot (Configuration *config, GVariant *snapshot)
+{
+    g_return_val_if_fail (config->priv->dir == NULL, FALSE);
+
+    if (!g_variant_is_of_type (snapshot, G_VARIANT_TYPE (CACHE_TYPE)))
+        return FALSE;
+
+    /* The configuration path is the first line of the identity */
+    const gchar *identity;
+    g_variant_get_child (snapshot, 1, "&s", &identity);
+    const gchar *end = strchr (identity, '\n');
+    g_autofree gchar *config_path = end ? g_strndup (identity, end - identity) : g_strdup (identity);
+
+    return load_cache (config, snapshot, config_path[0] != '\0' ? config_path : NULL, FALSE);
+}
+
 const gchar *
 config_get_directory (Configuration *config)
 {
@@ -261,6 +519,14 @@ config_get_source (Configuration *config, const gchar *section, const gchar *key
     return g_hash_table_lookup (config->priv->key_sources, k);
 }
 
+void
+config_remove_key (Configuration *config, const gchar *section, const gchar *key)
+{
+    g_key_file_remove_key (config->priv->key_file, section, key, NULL);
+    g_autofree gchar *k = g_strdup_printf ("%s]%s", section, key);
+    g_hash_table_remove (config->priv->key_sources, k);
+}
+
 void
 config_set_string (Configuration *config, const gchar *section, const gchar *key, const gchar *value)
 {
@@ -324,6 +590,7 @@ config_init (Configuration *config)
     config->priv = config_get_instance_private (config);
     config->priv->key_file = g_key_file_new ();
     config->priv->key_sources = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    config->priv->stamps = g_ptr_array_new_with_free_func ((GDestroyNotify) config_stamp_free);
     config->priv->lightdm_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
     config->priv->seat_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
     config->priv->xdmcp_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
@@ -332,11 +599,15 @@ config_init (Configuration *config)
     /* Build up tables of known keys */
     g_hash_table_insert (config->priv->lightdm_keys, "start-default-seat", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "greeter-user", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "shared-greeter-command", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "minimum-display-number", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "minimum-vt", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "lock-memory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "user-authority-in-system-dir", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "guest-account-script", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "guest-account-pool-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "guest-account-home-template", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "guest-account-home-size", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "logind-check-graphical", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "log-directory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "run-directory", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -345,7 +616,23 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->lightdm_keys, "remote-sessions-directory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "greeters-directory", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "backup-logs", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-max-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-max-files", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-compress", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-debug", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "log-trace", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "stall-threshold", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "event-buffer-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "metrics-socket", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "metrics-port", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "stop-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "dbus-service", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "interactive-nice", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "interactive-io-priority", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "interactive-cgroup", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "background-nice", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "background-io-priority", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->lightdm_keys, "background-cgroup", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->lightdm_keys, "logind-load-seats", GINT_TO_POINTER (KEY_DEPRECATED));
 
     g_hash_table_insert (config->priv->seat_keys, "type", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -359,8 +646,10 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->seat_keys, "xserver-layout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-allow-tcp", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-share", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "xserver-reuse-after-logout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-hostname", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xserver-display-number", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "xserver-connect-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdmcp-manager", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdmcp-port", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdmcp-key", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -371,6 +660,12 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->seat_keys, "greeter-allow-guest", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-show-manual-login", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-show-remote-login", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-standby", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-restart-on-crash", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-parallel-start", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-stop-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-idle-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "greeter-shared", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "user-session", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "allow-user-switching", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "allow-guest", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -379,6 +674,7 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->seat_keys, "greeter-wrapper", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "guest-wrapper", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "display-setup-script", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "script-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "display-stopped-script", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "greeter-setup-script", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "session-setup-script", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -387,7 +683,14 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->seat_keys, "autologin-user", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-user-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-in-background", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "autologin-parallel-start", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "autologin-session", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "background-users", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "background-session-limit", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "start-user-manager", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "crash-loop-limit", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "fallback-greeter-session", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->seat_keys, "fallback-xserver-command", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "exit-on-failure", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->seat_keys, "xdg-seat", GINT_TO_POINTER (KEY_DEPRECATED));
 
@@ -396,6 +699,14 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->xdmcp_keys, "listen-address", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->xdmcp_keys, "key", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->xdmcp_keys, "hostname", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "worker-threads", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "report-load", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "max-sessions", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "max-load", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "busy-delay", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "reattach-timeout", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "rate-limit", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->xdmcp_keys, "rate-limit-burst", GINT_TO_POINTER (KEY_SUPPORTED));
 
     g_hash_table_insert (config->priv->vnc_keys, "enabled", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->vnc_keys, "command", GINT_TO_POINTER (KEY_SUPPORTED));
@@ -404,6 +715,10 @@ config_init (Configuration *config)
     g_hash_table_insert (config->priv->vnc_keys, "width", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->vnc_keys, "height", GINT_TO_POINTER (KEY_SUPPORTED));
     g_hash_table_insert (config->priv->vnc_keys, "depth", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "pool-size", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "listen-backlog", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "max-seats", GINT_TO_POINTER (KEY_SUPPORTED));
+    g_hash_table_insert (config->priv->vnc_keys, "max-starts-per-second", GINT_TO_POINTER (KEY_SUPPORTED));
 }
 
 static void
@@ -415,6 +730,8 @@ config_finalize (GObject *object)
     g_clear_pointer (&self->priv->key_file, g_key_file_free);
     g_list_free_full (self->priv->sources, g_free);
     g_hash_table_destroy (self->priv->key_sources);
+    g_ptr_array_unref (self->priv->stamps);
+    g_list_free_full (self->priv->messages, g_free);
     g_hash_table_destroy (self->priv->lightdm_keys);
     g_hash_table_destroy (self->priv->seat_keys);
     g_hash_table_destroy (self->priv->xdmcp_keys);
@@ -32,14 +32,26 @@ typedef struct
     GObjectClass parent_class;
 } ConfigurationClass;
 
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Configuration, g_object_unref)
+
 GType config_get_type (void);
 
 Configuration *config_get_instance (void);
 
+Configuration *config_new (void);
+
 gboolean config_load_from_file (Configuration *config, const gchar *path, GList **messages, GError **error);
 
 gboolean config_load_from_standard_locations (Configuration *config, const gchar *config_path, GList **messages);
 
+gboolean config_load_from_cache (Configuration *config, const gchar *cache_path, const gchar *config_path, GList **messages);
+
+gboolean config_write_cache (Configuration *config, const gchar *cache_path, const gchar *config_path, GError **error);
+
+GVariant *config_get_snapshot (Configuration *config, const gchar *config_path);
+
+gboolean config_load_from_snapshot (Configuration *config, GVariant *snapshot);
+
 const gchar *config_get_directory (Configuration *config);
 
 gchar **config_get_groups (Configuration *config);
@@ -52,6 +64,8 @@ GList *config_get_sources (Configuration *config);
 
 const gchar *config_get_source (Configuration *config, const gchar *section, const gchar *key);
 
+void config_remove_key (Configuration *config, const gchar *section, const gchar *key);
+
 void config_set_string (Configuration *config, const gchar *section, const gchar *key, const gchar *value);
 
 gchar *config_get_string (Configuration *config, const gchar *section, const gchar *key);
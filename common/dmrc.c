@@ -10,61 +10,133 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "dmrc.h"
 #include "configuration.h"
 #include "privileges.h"
 #include "user-list.h"
 
+/* Largest .dmrc file we will read */
+#define MAX_DMRC_SIZE 65536
+
+gchar *
+dmrc_get_cache_path (const gchar *username)
+{
+    g_autofree gchar *filename = g_strdup_printf ("%s.dmrc", username);
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    return g_build_filename (cache_dir, "dmrc", filename, NULL);
+}
+
 GKeyFile *
-dmrc_load (CommonUser *user)
+dmrc_read (const gchar *home_directory, uid_t uid, gboolean check_owner)
+{
+    g_autofree gchar *path = g_build_filename (home_directory, ".dmrc", NULL);
+
+    /* Privileges can't be dropped here as they are shared by all threads, so
+     * guard against privilege escalation by only reading regular files owned
+     * by the user, not following symlinks */
+    int fd = open (path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat (fd, &info) < 0 || !S_ISREG (info.st_mode) || info.st_size > MAX_DMRC_SIZE ||
+        (check_owner && info.st_uid != uid))
+    {
+        close (fd);
+        return NULL;
+    }
+
+    g_autofree gchar *data = g_malloc (info.st_size + 1);
+    gsize length = 0;
+    while (length < (gsize) info.st_size)
+    {
+        ssize_t n_read = read (fd, data + length, info.st_size - length);
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        if (n_read <= 0)
+            break;
+        length += n_read;
+    }
+    close (fd);
+
+    g_autoptr(GKeyFile) dmrc_file = g_key_file_new ();
+    if (!g_key_file_load_from_data (dmrc_file, data, length, G_KEY_FILE_KEEP_COMMENTS, NULL))
+        return NULL;
+
+    return g_steal_pointer (&dmrc_file);
+}
+
+typedef enum
+{
+    DROPPED_NONE,
+    DROPPED_THREAD,
+    DROPPED_PROCESS
+} Dropped;
+
+/* Change to the user, only affecting this thread if possible so this is safe to use from a worker */
+static Dropped
+drop_privileges (uid_t uid, gid_t gid)
+{
+    if (geteuid () != 0)
+        return DROPPED_NONE;
+    if (privileges_drop_thread (uid, gid))
+        return DROPPED_THREAD;
+    privileges_drop (uid, gid);
+    return DROPPED_PROCESS;
+}
+
+static void
+reclaim_privileges (Dropped dropped)
+{
+    if (dropped == DROPPED_THREAD)
+        privileges_reclaim_thread ();
+    else if (dropped == DROPPED_PROCESS)
+        privileges_reclaim ();
+}
+
+static GKeyFile *
+load (const gchar *home_directory, const gchar *username, uid_t uid, gid_t gid)
 {
     g_autoptr(GKeyFile) dmrc_file = g_key_file_new ();
 
     /* Load from the user directory, if this fails (e.g. the user directory
      * is not yet mounted) then load from the cache */
-    g_autofree gchar *path = g_build_filename (common_user_get_home_directory (user), ".dmrc", NULL);
+    g_autofree gchar *path = g_build_filename (home_directory, ".dmrc", NULL);
 
     /* Guard against privilege escalation through symlinks, etc. */
-    gboolean drop_privileges = geteuid () == 0;
-    if (drop_privileges)
-        privileges_drop (common_user_get_uid (user), common_user_get_gid (user));
+    Dropped dropped = drop_privileges (uid, gid);
     gboolean have_dmrc = g_key_file_load_from_file (dmrc_file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
-    if (drop_privileges)
-        privileges_reclaim ();
+    reclaim_privileges (dropped);
 
     /* If no ~/.dmrc, then load from the cache */
     if (!have_dmrc)
     {
-        g_autofree gchar *filename = g_strdup_printf ("%s.dmrc", common_user_get_name (user));
-        g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
-        g_autofree gchar *cache_path = g_build_filename (cache_dir, "dmrc", filename, NULL);
-
+        g_autofree gchar *cache_path = dmrc_get_cache_path (username);
         g_key_file_load_from_file (dmrc_file, cache_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
     }
 
     return g_steal_pointer (&dmrc_file);
 }
 
-void
-dmrc_save (GKeyFile *dmrc_file, CommonUser *user)
+static void
+save (GKeyFile *dmrc_file, const gchar *home_directory, const gchar *username, uid_t uid, gid_t gid)
 {
     gsize length;
     g_autofree gchar *data = g_key_file_to_data (dmrc_file, &length, NULL);
 
     /* Update the users .dmrc */
-    g_autofree gchar *path = g_build_filename (common_user_get_home_directory (user), ".dmrc", NULL);
+    g_autofree gchar *path = g_build_filename (home_directory, ".dmrc", NULL);
 
     /* Guard against privilege escalation through symlinks, etc. */
-    gboolean drop_privileges = geteuid () == 0;
-    if (drop_privileges)
-        privileges_drop (common_user_get_uid (user), common_user_get_gid (user));
+    Dropped dropped = drop_privileges (uid, gid);
     g_debug ("Writing %s", path);
     g_file_set_contents (path, data, length, NULL);
-    if (drop_privileges)
-        privileges_reclaim ();
+    reclaim_privileges (dropped);
 
     /* Update the .dmrc cache */
     g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
@@ -72,7 +144,89 @@ dmrc_save (GKeyFile *dmrc_file, CommonUser *user)
     if (g_mkdir_with_parents (dmrc_cache_dir, 0700) < 0)
         g_warning ("Failed to make DMRC cache directory %s: %s", dmrc_cache_dir, strerror (errno));
 
-    g_autofree gchar *filename = g_strdup_printf ("%s.dmrc", common_user_get_name (user));
+    g_autofree gchar *filename = g_strdup_printf ("%s.dmrc", username);
     g_autofree gchar *cache_path = g_build_filename (dmrc_cache_dir, filename, NULL);
     g_file_set_contents (cache_path, data, length, NULL);
 }
+
+GKeyFile *
+dmrc_load (CommonUser *user)
+{
+    return load (common_user_get_home_directory (user), common_user_get_name (user), common_user_get_uid (user), common_user_get_gid (user));
+}
+
+void
+dmrc_save (GKeyFile *dmrc_file, CommonUser *user)
+{
+    save (dmrc_file, common_user_get_home_directory (user), common_user_get_name (user), common_user_get_uid (user), common_user_get_gid (user));
+}
+
+/* Lock on one user's .dmrc, so updates for different users can run at the same time */
+typedef struct
+{
+    GMutex mutex;
+    guint ref_count;
+} UserLock;
+
+static GMutex user_locks_mutex;
+static GHashTable *user_locks = NULL;
+
+static UserLock *
+lock_user (const gchar *username)
+{
+    g_mutex_lock (&user_locks_mutex);
+    if (!user_locks)
+        user_locks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    UserLock *lock = g_hash_table_lookup (user_locks, username);
+    if (!lock)
+    {
+        lock = g_new0 (UserLock, 1);
+        g_mutex_init (&lock->mutex);
+        g_hash_table_insert (user_locks, g_strdup (username), lock);
+    }
+    lock->ref_count++;
+    g_mutex_unlock (&user_locks_mutex);
+
+    g_mutex_lock (&lock->mutex);
+
+    return lock;
+}
+
+static void
+unlock_user (const gchar *username, UserLock *lock)
+{
+    g_mutex_unlock (&lock->mutex);
+
+    g_mutex_lock (&user_locks_mutex);
+    lock->ref_count--;
+    if (lock->ref_count == 0)
+    {
+        g_hash_table_remove (user_locks, username);
+        g_mutex_clear (&lock->mutex);
+        g_free (lock);
+    }
+    g_mutex_unlock (&user_locks_mutex);
+}
+
+void
+dmrc_update (const gchar *home_directory, const gchar *username, uid_t uid, gid_t gid, GKeyFile *changes)
+{
+    /* Stop two updates to the same file losing one of the changes */
+    UserLock *lock = lock_user (username);
+
+    /* All the changes are made with one read and write of the file */
+    g_autoptr(GKeyFile) dmrc_file = load (home_directory, username, uid, gid);
+    g_auto(GStrv) groups = g_key_file_get_groups (changes, NULL);
+    for (int i = 0; groups[i]; i++)
+    {
+        g_auto(GStrv) keys = g_key_file_get_keys (changes, groups[i], NULL, NULL);
+        for (int j = 0; keys && keys[j]; j++)
+        {
+            g_autofree gchar *value = g_key_file_get_string (changes, groups[i], keys[j], NULL);
+            g_key_file_set_string (dmrc_file, groups[i], keys[j], value);
+        }
+    }
+    save (dmrc_file, home_directory, username, uid, gid);
+
+    unlock_user (username, lock);
+}
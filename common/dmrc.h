@@ -12,6 +12,7 @@
 #ifndef DMRC_H_
 #define DMRC_H_
 
+#include <sys/types.h>
 #include <glib.h>
 #include "user-list.h"
 
@@ -19,8 +20,14 @@ G_BEGIN_DECLS
 
 GKeyFile *dmrc_load (CommonUser *user);
 
+GKeyFile *dmrc_read (const gchar *home_directory, uid_t uid, gboolean check_owner);
+
+gchar *dmrc_get_cache_path (const gchar *username);
+
 void dmrc_save (GKeyFile *dmrc_file, CommonUser *user);
 
+void dmrc_update (const gchar *home_directory, const gchar *username, uid_t uid, gid_t gid, GKeyFile *changes);
+
 G_END_DECLS
 
 #endif /* DMRC_H_ */
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include "greeter-protocol.h"
+
+#define GREETER_PROTOCOL_NAME(name) #name,
+
+static const gchar *greeter_message_names[N_GREETER_MESSAGES] =
+{
+    GREETER_PROTOCOL_GREETER_MESSAGES (GREETER_PROTOCOL_NAME)
+};
+
+static const gchar *server_message_names[N_SERVER_MESSAGES] =
+{
+    GREETER_PROTOCOL_SERVER_MESSAGES (GREETER_PROTOCOL_NAME)
+};
+
+const gchar *
+common_greeter_protocol_get_greeter_message_name (guint32 id)
+{
+    return id < N_GREETER_MESSAGES ? greeter_message_names[id] : "UNKNOWN";
+}
+
+const gchar *
+common_greeter_protocol_get_server_message_name (guint32 id)
+{
+    return id < N_SERVER_MESSAGES ? server_message_names[id] : "UNKNOWN";
+}
+
+/* Start a message with length octets of fields, the buffer is allocated to fit them exactly */
+GByteArray *
+common_greeter_protocol_start_message (guint32 id, guint32 length)
+{
+    GByteArray *message = g_byte_array_sized_new (GREETER_PROTOCOL_HEADER_SIZE + length);
+    common_greeter_protocol_write_int (message, id);
+    common_greeter_protocol_write_int (message, length);
+    return message;
+}
+
+void
+common_greeter_protocol_write_int (GByteArray *message, guint32 value)
+{
+    guint8 data[GREETER_PROTOCOL_INT_SIZE];
+    data[0] = value >> 24;
+    data[1] = (value >> 16) & 0xFF;
+    data[2] = (value >> 8) & 0xFF;
+    data[3] = value & 0xFF;
+    g_byte_array_append (message, data, GREETER_PROTOCOL_INT_SIZE);
+}
+
+guint32
+common_greeter_protocol_string_size (const gchar *value)
+{
+    return GREETER_PROTOCOL_STRING_SIZE (value ? strlen (value) : 0);
+}
+
+void
+common_greeter_protocol_write_string (GByteArray *message, const gchar *value)
+{
+    guint32 length = value ? strlen (value) : 0;
+    common_greeter_protocol_write_int (message, length);
+    if (length > 0)
+        g_byte_array_append (message, (const guint8 *) value, length);
+}
+
+void
+common_greeter_protocol_write_bytes (GByteArray *message, GBytes *value)
+{
+    gsize length;
+    const guint8 *data = g_bytes_get_data (value, &length);
+    common_greeter_protocol_write_int (message, length);
+    g_byte_array_append (message, data, length);
+}
+
+/* Length of the fields following a message header */
+guint32
+common_greeter_protocol_get_message_length (const guint8 *header)
+{
+    const guint8 *buffer = header + GREETER_PROTOCOL_INT_SIZE;
+    return (guint32) buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+}
+
+gboolean
+common_greeter_protocol_read_int (const guint8 *message, gsize message_length, gsize *offset, guint32 *value)
+{
+    if (message_length - *offset < GREETER_PROTOCOL_INT_SIZE)
+    {
+        g_warning ("Not enough space for int, need %d, got %zu", GREETER_PROTOCOL_INT_SIZE, message_length - *offset);
+        *value = 0;
+        return FALSE;
+    }
+
+    const guint8 *buffer = message + *offset;
+    *value = (guint32) buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+    *offset += GREETER_PROTOCOL_INT_SIZE;
+
+    return TRUE;
+}
+
+/* Returns the string in place in the message, it is not NUL terminated */
+const gchar *
+common_greeter_protocol_read_string (const guint8 *message, gsize message_length, gsize *offset, guint32 *length)
+{
+    if (!common_greeter_protocol_read_int (message, message_length, offset, length))
+        return NULL;
+    if (message_length - *offset < *length)
+    {
+        g_warning ("Not enough space for string, need %u, got %zu", *length, message_length - *offset);
+        *length = 0;
+        return NULL;
+    }
+
+    const gchar *value = (const gchar *) message + *offset;
+    *offset += *length;
+
+    return value;
+}
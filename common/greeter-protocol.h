@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_GREETER_PROTOCOL_H_
+#define COMMON_GREETER_PROTOCOL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The protocol between the daemon and greeters, used by both ends.
+ *
+ * Each message is a header of two integers (message ID and length of the
+ * rest) followed by its fields. Integers are 32 bit big-endian, strings and
+ * data are an integer length followed by that many octets (no terminator).
+ * The fields are listed after each message, new messages must only be added
+ * at the end of a list and new fields only at the end of a message, gated on
+ * the API version the other end sent.
+ */
+
+/* Newest API version, sent in CONNECT and returned (or the greeter's, if older) in CONNECTED_V2 */
+#define GREETER_PROTOCOL_API_VERSION 4
+
+/* API version that supports pre-authentication */
+#define GREETER_PROTOCOL_PREAUTHENTICATION_API_VERSION 2
+
+/* API version that has the user list sent with CONNECTED_V2 */
+#define GREETER_PROTOCOL_USER_LIST_API_VERSION 3
+
+/* API version that has user changes sent as only the fields that changed */
+#define GREETER_PROTOCOL_USER_CHANGES_API_VERSION 4
+
+#define GREETER_PROTOCOL_INT_SIZE 4
+#define GREETER_PROTOCOL_HEADER_SIZE (GREETER_PROTOCOL_INT_SIZE * 2)
+
+/* Size of a string or data field holding length octets */
+#define GREETER_PROTOCOL_STRING_SIZE(length) (GREETER_PROTOCOL_INT_SIZE + (length))
+
+/* Messages from the greeter to the server */
+#define GREETER_PROTOCOL_GREETER_MESSAGES(M) \
+    M (CONNECT)                    /* string version, int resettable, int api_version */ \
+    M (AUTHENTICATE)               /* int sequence_number, string username */ \
+    M (AUTHENTICATE_AS_GUEST)      /* int sequence_number */ \
+    M (CONTINUE_AUTHENTICATION)    /* int n_secrets, string secrets[n_secrets] */ \
+    M (START_SESSION)              /* string session */ \
+    M (CANCEL_AUTHENTICATION)      /* */ \
+    M (SET_LANGUAGE)               /* string language */ \
+    M (AUTHENTICATE_REMOTE)        /* int sequence_number, string session, string username */ \
+    M (ENSURE_SHARED_DIR)          /* string username */ \
+    M (PREAUTHENTICATE)            /* int sequence_number, string username */ \
+    M (CONTINUE_PREAUTHENTICATION) /* int sequence_number, int n_secrets, string secrets[n_secrets] */ \
+    M (CANCEL_PREAUTHENTICATION)   /* int sequence_number */ \
+    M (SELECT_PREAUTHENTICATION)   /* int sequence_number */
+
+/* Messages from the server to the greeter */
+#define GREETER_PROTOCOL_SERVER_MESSAGES(M) \
+    M (CONNECTED)                  /* string version, (string name, string value) until the end */ \
+    M (PROMPT_AUTHENTICATION)      /* int sequence_number, string username, int n_messages, (int style, string text)[n_messages] */ \
+    M (END_AUTHENTICATION)         /* int sequence_number, string username, int result */ \
+    M (SESSION_RESULT)             /* int result */ \
+    M (SHARED_DIR_RESULT)          /* string directory */ \
+    M (IDLE)                       /* */ \
+    M (RESET)                      /* (string name, string value) until the end */ \
+    M (CONNECTED_V2)               /* int api_version, string version, int n_hints, (string name, string value)[n_hints] */ \
+    M (USER_LIST)                  /* data snapshot */ \
+    M (USER_CHANGED)               /* data user */ \
+    M (USER_REMOVED)               /* string username */ \
+    M (USER_FIELDS_CHANGED)        /* data changes */
+
+#define GREETER_PROTOCOL_ENUM_GREETER(name) GREETER_MESSAGE_##name,
+#define GREETER_PROTOCOL_ENUM_SERVER(name) SERVER_MESSAGE_##name,
+
+typedef enum
+{
+    GREETER_PROTOCOL_GREETER_MESSAGES (GREETER_PROTOCOL_ENUM_GREETER)
+    N_GREETER_MESSAGES
+} GreeterMessage;
+
+typedef enum
+{
+    GREETER_PROTOCOL_SERVER_MESSAGES (GREETER_PROTOCOL_ENUM_SERVER)
+    N_SERVER_MESSAGES
+} ServerMessage;
+
+const gchar *common_greeter_protocol_get_greeter_message_name (guint32 id);
+
+const gchar *common_greeter_protocol_get_server_message_name (guint32 id);
+
+GByteArray *common_greeter_protocol_start_message (guint32 id, guint32 length);
+
+void common_greeter_protocol_write_int (GByteArray *message, guint32 value);
+
+guint32 common_greeter_protocol_string_size (const gchar *value);
+
+void common_greeter_protocol_write_string (GByteArray *message, const gchar *value);
+
+void common_greeter_protocol_write_bytes (GByteArray *message, GBytes *value);
+
+guint32 common_greeter_protocol_get_message_length (const guint8 *header);
+
+gboolean common_greeter_protocol_read_int (const guint8 *message, gsize message_length, gsize *offset, guint32 *value);
+
+const gchar *common_greeter_protocol_read_string (const guint8 *message, gsize message_length, gsize *offset, guint32 *length);
+
+G_END_DECLS
+
+#endif /* COMMON_GREETER_PROTOCOL_H_ */
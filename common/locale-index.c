@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+#include <locale.h>
+#include <langinfo.h>
+
+#include "locale-index.h"
+
+/* Magic number at the start of the locale archive */
+#define LOCALE_ARCHIVE_MAGIC 0xde020109
+
+/* Header of the locale archive, from glibc locarchive.h */
+typedef struct
+{
+    guint32 magic;
+    guint32 serial;
+    guint32 namehash_offset;
+    guint32 namehash_used;
+    guint32 namehash_size;
+} LocaleArchiveHeader;
+
+/* Entry in the locale archive name table */
+typedef struct
+{
+    guint32 hashval;
+    guint32 name_offset;
+    guint32 locrec_offset;
+} LocaleArchiveName;
+
+void
+common_locale_free (CommonLocale *locale)
+{
+    g_free (locale->name);
+    g_free (locale->language);
+    g_free (locale->territory);
+    g_free (locale);
+}
+
+static gboolean
+is_utf8 (const gchar *code)
+{
+    return g_strrstr (code, ".utf8") || g_strrstr (code, ".UTF-8");
+}
+
+/* Get the names of the locales in the locale archive, as 'locale -a' does */
+static void
+read_locale_archive (GHashTable *names)
+{
+    g_autoptr(GMappedFile) file = g_mapped_file_new (LOCALE_ARCHIVE, FALSE, NULL);
+    if (!file)
+        return;
+
+    const gchar *data = g_mapped_file_get_contents (file);
+    gsize length = g_mapped_file_get_length (file);
+    if (length < sizeof (LocaleArchiveHeader))
+        return;
+
+    LocaleArchiveHeader header;
+    memcpy (&header, data, sizeof (header));
+    if (header.magic != LOCALE_ARCHIVE_MAGIC ||
+        header.namehash_offset > length ||
+        header.namehash_size > (length - header.namehash_offset) / sizeof (LocaleArchiveName))
+    {
+        g_warning ("Ignoring invalid locale archive %s", LOCALE_ARCHIVE);
+        return;
+    }
+
+    for (guint32 i = 0; i < header.namehash_size; i++)
+    {
+        LocaleArchiveName entry;
+        memcpy (&entry, data + header.namehash_offset + i * sizeof (LocaleArchiveName), sizeof (entry));
+        if (entry.locrec_offset == 0 || entry.name_offset >= length)
+            continue;
+
+        const gchar *name = data + entry.name_offset;
+        gsize name_length = strnlen (name, length - entry.name_offset);
+        if (name_length < length - entry.name_offset)
+            g_hash_table_add (names, g_strndup (name, name_length));
+    }
+}
+
+/* Get the names of the locales installed as directories */
+static void
+read_locale_directories (GHashTable *names)
+{
+    g_autoptr(GDir) dir = g_dir_open (SYSTEM_LOCALE_DIR, 0, NULL);
+    if (!dir)
+        return;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        g_autofree gchar *path = g_build_filename (SYSTEM_LOCALE_DIR, name, "LC_IDENTIFICATION", NULL);
+        if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+            g_hash_table_add (names, g_strdup (name));
+    }
+}
+
+/* Get the names for each locale, only done for the UTF-8 locales that are shown */
+static void
+load_locale_identification (GPtrArray *locales)
+{
+    g_autofree gchar *current = g_strdup (setlocale (LC_IDENTIFICATION, NULL));
+    for (guint i = 0; i < locales->len; i++)
+    {
+        CommonLocale *locale = g_ptr_array_index (locales, i);
+        if (!is_utf8 (locale->name) || !setlocale (LC_IDENTIFICATION, locale->name))
+            continue;
+
+        locale->language = g_strdup (nl_langinfo (_NL_IDENTIFICATION_LANGUAGE));
+        locale->territory = g_strdup (nl_langinfo (_NL_IDENTIFICATION_TERRITORY));
+    }
+    setlocale (LC_IDENTIFICATION, current);
+}
+
+/* Find the installed locales, this replaces running 'locale -a' */
+GPtrArray *
+common_locale_index_scan (void)
+{
+    GPtrArray *locales = g_ptr_array_new_with_free_func ((GDestroyNotify) common_locale_free);
+
+    g_autoptr(GHashTable) names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    read_locale_archive (names);
+    read_locale_directories (names);
+
+    GHashTableIter iter;
+    gpointer name;
+    g_hash_table_iter_init (&iter, names);
+    while (g_hash_table_iter_next (&iter, &name, NULL))
+    {
+        CommonLocale *locale = g_malloc0 (sizeof (CommonLocale));
+        locale->name = g_strdup (name);
+        g_ptr_array_add (locales, locale);
+    }
+    load_locale_identification (locales);
+
+    return locales;
+}
+
+GVariant *
+common_locale_index_to_variant (GPtrArray *locales)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE (COMMON_LOCALE_INDEX_TYPE));
+    for (guint i = 0; i < locales->len; i++)
+    {
+        CommonLocale *locale = g_ptr_array_index (locales, i);
+        g_variant_builder_add (&builder, "(sss)", locale->name, locale->language ? locale->language : "", locale->territory ? locale->territory : "");
+    }
+
+    return g_variant_builder_end (&builder);
+}
+
+void
+common_locale_index_add_from_variant (GPtrArray *locales, GVariant *value)
+{
+    GVariantIter iter;
+    const gchar *name, *language, *territory;
+    g_variant_iter_init (&iter, value);
+    while (g_variant_iter_next (&iter, "(&s&s&s)", &name, &language, &territory))
+    {
+        CommonLocale *locale = g_malloc0 (sizeof (CommonLocale));
+        locale->name = g_strdup (name);
+        locale->language = g_strdup (language);
+        locale->territory = g_strdup (territory);
+        g_ptr_array_add (locales, locale);
+    }
+}
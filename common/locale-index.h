@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_LOCALE_INDEX_H_
+#define COMMON_LOCALE_INDEX_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Where glibc installs compiled locales */
+#define SYSTEM_LOCALE_DIR "/usr/lib/locale"
+#define LOCALE_ARCHIVE SYSTEM_LOCALE_DIR "/locale-archive"
+
+/* An installed locale */
+typedef struct
+{
+    gchar *name;
+
+    /* Untranslated language and territory names from LC_IDENTIFICATION */
+    gchar *language;
+    gchar *territory;
+} CommonLocale;
+
+#define COMMON_LOCALE_INDEX_TYPE "a(sss)"
+
+void common_locale_free (CommonLocale *locale);
+
+GPtrArray *common_locale_index_scan (void);
+
+GVariant *common_locale_index_to_variant (GPtrArray *locales);
+
+void common_locale_index_add_from_variant (GPtrArray *locales, GVariant *value);
+
+G_END_DECLS
+
+#endif /* COMMON_LOCALE_INDEX_H_ */
@@ -15,8 +15,48 @@
 #include <config.h>
 #include <glib.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include "privileges.h"
 
+#ifdef __linux__
+/* The C library versions of these change the credentials of every thread,
+ * using the system calls directly only changes the calling thread */
+#ifdef SYS_setresuid32
+#define SYS_SETRESUID SYS_setresuid32
+#define SYS_SETRESGID SYS_setresgid32
+#define SYS_SETGROUPS SYS_setgroups32
+#else
+#define SYS_SETRESUID SYS_setresuid
+#define SYS_SETRESGID SYS_setresgid
+#define SYS_SETGROUPS SYS_setgroups
+#endif
+
+/* Supplementary groups of the daemon, restored after a thread is done acting as a user */
+static gid_t *root_groups = NULL;
+static int n_root_groups = 0;
+
+static void
+load_root_groups (void)
+{
+    static gsize loaded = 0;
+    if (!g_once_init_enter (&loaded))
+        return;
+
+    int n_groups = getgroups (0, NULL);
+    if (n_groups > 0)
+    {
+        root_groups = g_new (gid_t, n_groups);
+        n_root_groups = getgroups (n_groups, root_groups);
+        if (n_root_groups < 0)
+            n_root_groups = 0;
+    }
+
+    g_once_init_leave (&loaded, 1);
+}
+#endif
+
 void
 privileges_drop (uid_t uid, gid_t gid)
 {
@@ -34,6 +74,52 @@ privileges_drop (uid_t uid, gid_t gid)
 #endif
 }
 
+/* Check if privileges can be dropped for a single thread, otherwise privileges_drop() has to be used */
+gboolean
+privileges_can_drop_thread (void)
+{
+#ifdef __linux__
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean
+privileges_drop_thread (uid_t uid, gid_t gid)
+{
+#ifdef __linux__
+    /* Drop the daemon's groups too, they might give access the user doesn't have */
+    load_root_groups ();
+    if (syscall (SYS_SETGROUPS, 1, &gid) != 0)
+        return FALSE;
+    if (syscall (SYS_SETRESGID, gid, gid, -1) != 0)
+    {
+        g_assert (syscall (SYS_SETGROUPS, n_root_groups, root_groups) == 0);
+        return FALSE;
+    }
+    if (syscall (SYS_SETRESUID, uid, uid, -1) != 0)
+    {
+        g_assert (syscall (SYS_SETRESGID, 0, 0, -1) == 0);
+        g_assert (syscall (SYS_SETGROUPS, n_root_groups, root_groups) == 0);
+        return FALSE;
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void
+privileges_reclaim_thread (void)
+{
+#ifdef __linux__
+    g_assert (syscall (SYS_SETRESUID, 0, 0, -1) == 0);
+    g_assert (syscall (SYS_SETRESGID, 0, 0, -1) == 0);
+    g_assert (syscall (SYS_SETGROUPS, n_root_groups, root_groups) == 0);
+#endif
+}
+
 void
 privileges_reclaim (void)
 {
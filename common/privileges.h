@@ -12,10 +12,17 @@
 #ifndef PRIVILEGES_H_
 #define PRIVILEGES_H_
 
+#include <glib.h>
 #include <sys/types.h>
 
 void privileges_drop (uid_t uid, gid_t gid);
 
 void privileges_reclaim (void);
 
+gboolean privileges_can_drop_thread (void);
+
+gboolean privileges_drop_thread (uid_t uid, gid_t gid);
+
+void privileges_reclaim_thread (void);
+
 #endif /* PRIVILEGES_H_ */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "resource-bundle.h"
+
+/*
+ * The daemon builds the data every greeter would otherwise load for itself
+ * (configuration, session files, locales) into one serialized GVariant
+ * dictionary. It is written into a sealed memfd that is passed to each
+ * greeter, which maps it read-only so all greeters share the same pages.
+ */
+
+/* Version of the bundle format, increase when it changes */
+#define BUNDLE_VERSION 1
+
+#define BUNDLE_TYPE "(ua{sv})"
+
+/* Bundle mapped from the daemon, loaded on first use */
+static GVariant *bundle = NULL;
+static gboolean have_bundle = FALSE;
+
+/* Returns a sealed file descriptor containing @contents (a{sv}, consumed if floating) or -1 on error */
+int
+common_resource_bundle_create (GVariant *contents, GError **error)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+    g_autoptr(GVariant) value = g_variant_ref_sink (g_variant_new ("(u@a{sv})", BUNDLE_VERSION, contents));
+    const guint8 *data = g_variant_get_data (value);
+    gsize size = g_variant_get_size (value);
+
+    int fd = memfd_create ("lightdm-resources", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+    {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "Failed to create resource bundle: %s", g_strerror (errno));
+        return -1;
+    }
+
+    for (gsize n_written = 0; n_written < size;)
+    {
+        ssize_t n = write (fd, data + n_written, size - n_written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "Failed to write resource bundle: %s", g_strerror (errno));
+            close (fd);
+            return -1;
+        }
+        n_written += n;
+    }
+
+    /* Greeters can't change what the others see */
+    if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "Failed to seal resource bundle: %s", g_strerror (errno));
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    g_variant_unref (g_variant_ref_sink (contents));
+    g_set_error_literal (error, G_FILE_ERROR, G_FILE_ERROR_NOSYS, "Sealed memory files not supported on this system");
+    return -1;
+#endif
+}
+
+static void
+load_bundle (void)
+{
+    if (have_bundle)
+        return;
+    have_bundle = TRUE;
+
+    const gchar *fd_string = g_getenv (RESOURCE_BUNDLE_FD_ENV);
+    if (!fd_string)
+        return;
+    int fd = atoi (fd_string);
+
+    /* Only use a bundle the daemon can no longer change */
+#ifdef F_GET_SEALS
+    int seals = fcntl (fd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) != (F_SEAL_WRITE | F_SEAL_SHRINK))
+    {
+        g_debug ("Ignoring unsealed resource bundle");
+        close (fd);
+        return;
+    }
+#endif
+
+    struct stat info;
+    if (fstat (fd, &info) < 0 || info.st_size == 0)
+    {
+        close (fd);
+        return;
+    }
+    gpointer address = mmap (NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (address == MAP_FAILED)
+    {
+        g_debug ("Failed to map resource bundle: %s", g_strerror (errno));
+        return;
+    }
+
+    /* The mapping is kept for the life of the process */
+    g_autoptr(GBytes) bytes = g_bytes_new_static (address, info.st_size);
+    g_autoptr(GVariant) value = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (BUNDLE_TYPE), bytes, FALSE));
+
+    guint32 version;
+    g_variant_get_child (value, 0, "u", &version);
+    if (version != BUNDLE_VERSION)
+    {
+        g_debug ("Ignoring resource bundle version %u", version);
+        return;
+    }
+    bundle = g_variant_get_child_value (value, 1);
+}
+
+/* Get an entry from the bundle the daemon passed us, or NULL if not available */
+GVariant *
+common_resource_bundle_lookup (const gchar *name, const GVariantType *type)
+{
+    load_bundle ();
+    if (!bundle)
+        return NULL;
+
+    return g_variant_lookup_value (bundle, name, type);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_RESOURCE_BUNDLE_H_
+#define COMMON_RESOURCE_BUNDLE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Environment variable with the file descriptor of the bundle passed to greeters */
+#define RESOURCE_BUNDLE_FD_ENV "LIGHTDM_RESOURCES_FD"
+
+int common_resource_bundle_create (GVariant *contents, GError **error);
+
+GVariant *common_resource_bundle_lookup (const gchar *name, const GVariantType *type);
+
+G_END_DECLS
+
+#endif /* COMMON_RESOURCE_BUNDLE_H_ */
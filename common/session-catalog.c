@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "session-catalog.h"
+
+enum
+{
+    CHANGED,
+    LAST_SIGNAL
+};
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* A directory containing session files */
+typedef struct
+{
+    CommonSessionCatalog *catalog;
+
+    /* Path to the directory */
+    gchar *path;
+
+    /* Session type for files that don't specify one */
+    const gchar *default_type;
+
+    /* TRUE once the directory has been scanned */
+    gboolean scanned;
+
+    /* Modification time when last scanned */
+    gint64 mtime;
+
+    /* Sessions in this directory, sorted by key */
+    GList *entries;
+
+    /* Monitor for changes to session files */
+    GFileMonitor *monitor;
+} CatalogDirectory;
+
+typedef struct
+{
+    /* Directories in order of precedence */
+    GPtrArray *directories;
+
+    /* Sessions from all directories, rebuilt when changed */
+    gboolean have_entries;
+    GList *entries;
+} CommonSessionCatalogPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (CommonSessionCatalog, common_session_catalog, G_TYPE_OBJECT)
+
+/* Catalogs indexed by their directories */
+static GHashTable *catalogs = NULL;
+
+void
+common_session_entry_free (CommonSessionEntry *entry)
+{
+    g_free (entry->key);
+    g_free (entry->path);
+    g_key_file_unref (entry->key_file);
+    if (entry->data_free)
+        entry->data_free (entry->data);
+    g_free (entry);
+}
+
+static gint
+compare_entry (gconstpointer a, gconstpointer b)
+{
+    const CommonSessionEntry *entry_a = a, *entry_b = b;
+    return strcmp (entry_a->key, entry_b->key);
+}
+
+static CommonSessionEntry *
+load_entry (CatalogDirectory *directory, const gchar *filename)
+{
+    g_autofree gchar *path = g_build_filename (directory->path, filename, NULL);
+
+    g_autoptr(GKeyFile) key_file = g_key_file_new ();
+    g_autoptr(GError) error = NULL;
+    if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error))
+    {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Failed to load session file %s: %s", path, error->message);
+        return NULL;
+    }
+
+    CommonSessionEntry *entry = g_malloc0 (sizeof (CommonSessionEntry));
+    entry->key = g_strndup (filename, strlen (filename) - strlen (".desktop"));
+    entry->path = g_steal_pointer (&path);
+    entry->default_type = directory->default_type;
+    entry->key_file = g_steal_pointer (&key_file);
+
+    return entry;
+}
+
+static gint64
+get_mtime (const gchar *path)
+{
+    GStatBuf info;
+    if (g_stat (path, &info) < 0)
+        return 0;
+    return info.st_mtime;
+}
+
+static void
+scan_directory (CatalogDirectory *directory)
+{
+    g_list_free_full (directory->entries, (GDestroyNotify) common_session_entry_free);
+    directory->entries = NULL;
+    directory->scanned = TRUE;
+    directory->mtime = get_mtime (directory->path);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GDir) dir = g_dir_open (directory->path, 0, &error);
+    if (error && !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Failed to open sessions directory: %s", error->message);
+    if (!dir)
+        return;
+
+    const gchar *filename;
+    while ((filename = g_dir_read_name (dir)))
+    {
+        if (!g_str_has_suffix (filename, ".desktop"))
+            continue;
+
+        CommonSessionEntry *entry = load_entry (directory, filename);
+        if (entry)
+            directory->entries = g_list_prepend (directory->entries, entry);
+    }
+    directory->entries = g_list_sort (directory->entries, compare_entry);
+}
+
+/* Reload a single session file that has changed */
+static void
+reload_entry (CatalogDirectory *directory, const gchar *filename)
+{
+    g_autofree gchar *key = g_strndup (filename, strlen (filename) - strlen (".desktop"));
+    for (GList *link = directory->entries; link; link = link->next)
+    {
+        CommonSessionEntry *entry = link->data;
+        if (strcmp (entry->key, key) == 0)
+        {
+            directory->entries = g_list_delete_link (directory->entries, link);
+            common_session_entry_free (entry);
+            break;
+        }
+    }
+
+    CommonSessionEntry *entry = load_entry (directory, filename);
+    if (entry)
+        directory->entries = g_list_insert_sorted (directory->entries, entry, compare_entry);
+}
+
+static void
+directory_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, CatalogDirectory *directory)
+{
+    if (event_type != G_FILE_MONITOR_EVENT_CREATED &&
+        event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+        event_type != G_FILE_MONITOR_EVENT_DELETED)
+        return;
+
+    g_autofree gchar *filename = g_file_get_basename (file);
+    if (!g_str_has_suffix (filename, ".desktop"))
+        return;
+
+    g_debug ("Session file %s/%s changed", directory->path, filename);
+    if (directory->scanned)
+        reload_entry (directory, filename);
+
+    CommonSessionCatalogPrivate *priv = common_session_catalog_get_instance_private (directory->catalog);
+    priv->have_entries = FALSE;
+    g_signal_emit (directory->catalog, signals[CHANGED], 0);
+}
+
+/**
+ * common_session_catalog_get_instance:
+ * @sessions_dirs: Colon separated list of directories to look for sessions in
+ *
+ * Get the sessions available in a set of directories.  The directories are
+ * scanned the first time they are requested and then monitored for changes,
+ * with the ::changed signal emitted when any session is added, removed or
+ * modified.
+ *
+ * Return value: (transfer none): the #CommonSessionCatalog for these directories
+ **/
+CommonSessionCatalog *
+common_session_catalog_get_instance (const gchar *sessions_dirs)
+{
+    g_return_val_if_fail (sessions_dirs != NULL, NULL);
+
+    if (!catalogs)
+        catalogs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+    CommonSessionCatalog *catalog = g_hash_table_lookup (catalogs, sessions_dirs);
+    if (catalog)
+        return catalog;
+
+    catalog = g_object_new (COMMON_TYPE_SESSION_CATALOG, NULL);
+    CommonSessionCatalogPrivate *priv = common_session_catalog_get_instance_private (catalog);
+
+    g_auto(GStrv) dirs = g_strsplit (sessions_dirs, ":", -1);
+    for (int i = 0; dirs[i]; i++)
+    {
+        CatalogDirectory *directory = g_malloc0 (sizeof (CatalogDirectory));
+        directory->catalog = catalog;
+        directory->path = g_strdup (dirs[i]);
+        directory->default_type = "x";
+        if (g_str_has_suffix (dirs[i], "/wayland-sessions"))
+            directory->default_type = "wayland";
+
+        g_autoptr(GFile) file = g_file_new_for_path (dirs[i]);
+        g_autoptr(GError) error = NULL;
+        directory->monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, &error);
+        if (directory->monitor)
+            g_signal_connect (directory->monitor, "changed", G_CALLBACK (directory_changed_cb), directory);
+        else
+            g_debug ("Not monitoring sessions directory %s: %s", dirs[i], error->message);
+
+        g_ptr_array_add (priv->directories, directory);
+    }
+
+    g_hash_table_insert (catalogs, g_strdup (sessions_dirs), catalog);
+
+    return catalog;
+}
+
+/**
+ * common_session_catalog_get_entries:
+ * @catalog: A #CommonSessionCatalog
+ *
+ * Get the session files, in order of directory precedence and then by key.
+ * There may be more than one entry for a key if it is in multiple directories.
+ *
+ * Return value: (element-type CommonSessionEntry) (transfer none): A list of #CommonSessionEntry, valid until the catalog next changes.
+ **/
+GList *
+common_session_catalog_get_entries (CommonSessionCatalog *catalog)
+{
+    g_return_val_if_fail (COMMON_IS_SESSION_CATALOG (catalog), NULL);
+
+    CommonSessionCatalogPrivate *priv = common_session_catalog_get_instance_private (catalog);
+
+    /* Without a monitor, check if the directory itself has changed */
+    for (guint i = 0; i < priv->directories->len; i++)
+    {
+        CatalogDirectory *directory = g_ptr_array_index (priv->directories, i);
+        if (!directory->scanned ||
+            (!directory->monitor && get_mtime (directory->path) != directory->mtime))
+        {
+            scan_directory (directory);
+            priv->have_entries = FALSE;
+        }
+    }
+
+    if (priv->have_entries)
+        return priv->entries;
+
+    g_list_free (priv->entries);
+    priv->entries = NULL;
+    for (guint i = priv->directories->len; i > 0; i--)
+    {
+        CatalogDirectory *directory = g_ptr_array_index (priv->directories, i - 1);
+        priv->entries = g_list_concat (g_list_copy (directory->entries), priv->entries);
+    }
+    priv->have_entries = TRUE;
+
+    return priv->entries;
+}
+
+/**
+ * common_session_catalog_to_variant:
+ * @catalog: A #CommonSessionCatalog
+ *
+ * Get the session files so they can be passed to another process.
+ *
+ * Return value: (transfer floating): the entries as an array of key, path, default type and file contents.
+ **/
+GVariant *
+common_session_catalog_to_variant (CommonSessionCatalog *catalog)
+{
+    g_return_val_if_fail (COMMON_IS_SESSION_CATALOG (catalog), NULL);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE (COMMON_SESSION_ENTRIES_TYPE));
+    for (GList *link = common_session_catalog_get_entries (catalog); link; link = link->next)
+    {
+        CommonSessionEntry *entry = link->data;
+        g_autofree gchar *data = g_key_file_to_data (entry->key_file, NULL, NULL);
+        g_variant_builder_add (&builder, "(ssss)", entry->key, entry->path, entry->default_type, data);
+    }
+
+    return g_variant_builder_end (&builder);
+}
+
+/**
+ * common_session_entries_from_variant:
+ * @value: Entries from common_session_catalog_to_variant()
+ *
+ * Get session entries passed from another process.
+ *
+ * Return value: (element-type CommonSessionEntry) (transfer full): A list of #CommonSessionEntry, free with common_session_entry_free().
+ **/
+GList *
+common_session_entries_from_variant (GVariant *value)
+{
+    GList *entries = NULL;
+
+    GVariantIter iter;
+    const gchar *key, *path, *default_type, *data;
+    g_variant_iter_init (&iter, value);
+    while (g_variant_iter_next (&iter, "(&s&s&s&s)", &key, &path, &default_type, &data))
+    {
+        g_autoptr(GKeyFile) key_file = g_key_file_new ();
+        if (!g_key_file_load_from_data (key_file, data, -1, G_KEY_FILE_NONE, NULL))
+            continue;
+
+        CommonSessionEntry *entry = g_malloc0 (sizeof (CommonSessionEntry));
+        entry->key = g_strdup (key);
+        entry->path = g_strdup (path);
+        entry->default_type = g_intern_string (default_type);
+        entry->key_file = g_steal_pointer (&key_file);
+        entries = g_list_prepend (entries, entry);
+    }
+
+    return g_list_reverse (entries);
+}
+
+static void
+directory_free (CatalogDirectory *directory)
+{
+    if (directory->monitor)
+        g_signal_handlers_disconnect_by_data (directory->monitor, directory);
+    g_clear_object (&directory->monitor);
+    g_list_free_full (directory->entries, (GDestroyNotify) common_session_entry_free);
+    g_free (directory->path);
+    g_free (directory);
+}
+
+static void
+common_session_catalog_init (CommonSessionCatalog *catalog)
+{
+    CommonSessionCatalogPrivate *priv = common_session_catalog_get_instance_private (catalog);
+    priv->directories = g_ptr_array_new_with_free_func ((GDestroyNotify) directory_free);
+}
+
+static void
+common_session_catalog_finalize (GObject *object)
+{
+    CommonSessionCatalog *self = COMMON_SESSION_CATALOG (object);
+    CommonSessionCatalogPrivate *priv = common_session_catalog_get_instance_private (self);
+
+    g_list_free (priv->entries);
+    g_ptr_array_unref (priv->directories);
+
+    G_OBJECT_CLASS (common_session_catalog_parent_class)->finalize (object);
+}
+
+static void
+common_session_catalog_class_init (CommonSessionCatalogClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = common_session_catalog_finalize;
+
+    signals[CHANGED] =
+        g_signal_new (SESSION_CATALOG_SIGNAL_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (CommonSessionCatalogClass, changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+}
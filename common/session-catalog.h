@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2010 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#ifndef COMMON_SESSION_CATALOG_H_
+#define COMMON_SESSION_CATALOG_H_
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define COMMON_TYPE_SESSION_CATALOG            (common_session_catalog_get_type())
+#define COMMON_SESSION_CATALOG(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), COMMON_TYPE_SESSION_CATALOG, CommonSessionCatalog))
+#define COMMON_SESSION_CATALOG_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), COMMON_TYPE_SESSION_CATALOG, CommonSessionCatalogClass))
+#define COMMON_IS_SESSION_CATALOG(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), COMMON_TYPE_SESSION_CATALOG))
+#define COMMON_IS_SESSION_CATALOG_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), COMMON_TYPE_SESSION_CATALOG))
+#define COMMON_SESSION_CATALOG_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), COMMON_TYPE_SESSION_CATALOG, CommonSessionCatalogClass))
+
+#define SESSION_CATALOG_SIGNAL_CHANGED "changed"
+
+/* Type of session entries passed between processes */
+#define COMMON_SESSION_ENTRIES_TYPE "a(ssss)"
+
+/* A session file */
+typedef struct
+{
+    /* Session key, the filename without the .desktop suffix */
+    gchar *key;
+
+    /* Path to the session file */
+    gchar *path;
+
+    /* Session type to use if the file doesn't specify one */
+    const gchar *default_type;
+
+    /* Contents of the session file */
+    GKeyFile *key_file;
+
+    /* Data derived from the session file by the user of the catalog, freed with the entry */
+    gpointer data;
+    GDestroyNotify data_free;
+} CommonSessionEntry;
+
+typedef struct
+{
+    GObject parent_instance;
+} CommonSessionCatalog;
+
+typedef struct
+{
+    GObjectClass parent_class;
+
+    void (*changed)(CommonSessionCatalog *catalog);
+} CommonSessionCatalogClass;
+
+GType common_session_catalog_get_type (void);
+
+CommonSessionCatalog *common_session_catalog_get_instance (const gchar *sessions_dirs);
+
+GList *common_session_catalog_get_entries (CommonSessionCatalog *catalog);
+
+GVariant *common_session_catalog_to_variant (CommonSessionCatalog *catalog);
+
+GList *common_session_entries_from_variant (GVariant *value);
+
+void common_session_entry_free (CommonSessionEntry *entry);
+
+G_END_DECLS
+
+#endif /* COMMON_SESSION_CATALOG_H_ */
@@ -17,10 +17,13 @@
 #include <string.h>
 #include <sys/utsname.h>
 #include <pwd.h>
+#include <unistd.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 
 #include "dmrc.h"
 #include "user-list.h"
+#include "worker.h"
 
 enum
 {
@@ -53,6 +56,7 @@ enum
     USER_ADDED,
     USER_CHANGED,
     USER_REMOVED,
+    LOADED,
     LAST_LIST_SIGNAL
 };
 static guint list_signals[LAST_LIST_SIGNAL] = { 0 };
@@ -65,6 +69,14 @@ enum
 };
 static guint user_signals[LAST_USER_SIGNAL] = { 0 };
 
+/* Users that are not shown, from users.conf */
+typedef struct
+{
+    gint minimum_uid;
+    gchar **hidden_users;
+    gchar **hidden_shells;
+} UserFilter;
+
 typedef struct
 {
     /* Bus connection being communicated on */
@@ -81,20 +93,95 @@ typedef struct
     /* File monitor for password file */
     GFileMonitor *passwd_monitor;
 
+    /* Timeout to coalesce changes to the password file */
+    guint passwd_reload_timeout;
+
+    /* TRUE while the password database is being read in a thread */
+    gboolean reading_passwd;
+
+    /* TRUE if the password file changed while it was being read */
+    gboolean passwd_reload_pending;
+
     /* TRUE if have scanned users */
     gboolean have_users;
 
+    /* TRUE while users are being loaded from the accounts service */
+    gboolean loading;
+
+    /* Context calls are being made from when loading synchronously */
+    GMainContext *load_context;
+
+    /* TRUE if users loaded should be signalled as added */
+    gboolean emit_load_signals;
+
+    /* Accounts service paths waiting to be loaded */
+    GQueue *pending_paths;
+
+    /* Number of users being loaded */
+    guint n_loading;
+
+    /* Users to fetch the display manager properties for in the background */
+    GQueue *extra_pending_users;
+    guint n_loading_extra;
+    guint extra_fill_idle;
+
+    /* Cancellable for outstanding loads */
+    GCancellable *load_cancellable;
+
+    /* Real time the user information was read, 0 if not yet */
+    gint64 update_time;
+
     /* List of users */
     GList *users;
 
-    /* List of sessions */
-    GList *sessions;
+    /* Users indexed by name and accounts service path */
+    GHashTable *users_by_name;
+    GHashTable *users_by_path;
+
+    /* Sessions indexed by path */
+    GHashTable *sessions;
+
+    /* Number of sessions each user has, indexed by name */
+    GHashTable *session_counts;
+
+    /* Recent password database lookups indexed by name */
+    GHashTable *lookup_cache;
+
+    /* Users not shown, from users.conf, and the accounts service paths found
+     * to be hidden so they are not fetched again */
+    UserFilter *filter;
+    GHashTable *hidden_paths;
+
+    /* Number of accounts service users skipped without being fetched in the current load */
+    guint n_skipped;
 } CommonUserListPrivate;
 
+/* A user looked up from the password database */
+typedef struct
+{
+    /* User found or NULL if no such user */
+    CommonUser *user;
+
+    /* Monotonic time the lookup was made */
+    gint64 time;
+} UserLookup;
+
 typedef struct
 {
     /* TRUE if have loaded the DMRC file */
-    gboolean loaded_dmrc;
+    guint loaded_dmrc : 1;
+
+    /* TRUE if this user has messages available */
+    guint has_messages : 1;
+
+    /* TRUE if this user is locked */
+    guint is_locked : 1;
+
+    /* TRUE if this user came from the cache and hasn't been loaded yet */
+    guint cached : 1;
+
+    /* TRUE if the display manager properties haven't been fetched from the accounts service yet */
+    guint extra_pending : 1;
 
     /* Bus we are listening for accounts service on */
     GDBusConnection *bus;
@@ -105,6 +192,10 @@ typedef struct
     /* Update signal from accounts service */
     guint changed_signal;
 
+    /* Collation key users are sorted by and the display name it was made from */
+    gchar *sort_key;
+    gchar *sort_key_name;
+
     /* Username */
     gchar *name;
 
@@ -114,35 +205,43 @@ typedef struct
     /* Home directory of user */
     gchar *home_directory;
 
-    /* Shell for user */
-    gchar *shell;
-
     /* Image for user */
     gchar *image;
 
-    /* Background image for users */
-    gchar *background;
-
-    /* TRUE if this user has messages available */
-    gboolean has_messages;
-
     /* UID of user */
     guint64 uid;
 
     /* GID of user */
     guint64 gid;
 
+    /* Shell for user, this and the fields below are interned */
+    const gchar *shell;
+
+    /* Background image for users */
+    const gchar *background;
+
     /* User chosen language */
-    gchar *language;
+    const gchar *language;
 
     /* User layout preferences */
-    gchar **layouts;
+    const gchar * const *layouts;
 
     /* User default session */
-    gchar *session;
+    const gchar *session;
 
-    /* TRUE if this user is locked */
-    gboolean is_locked;
+    /* DMRC file being read, if any */
+    gpointer dmrc_load;
+
+    /* Copy of this user last passed to another process, changes are worked out against it */
+    GVariant *sent_value;
+
+    /* Fields that changed in the last ::changed signal */
+    GBytes *changes;
+
+    /* Language and session set but not yet saved, and the timeout to save them */
+    gchar *pending_language;
+    gchar *pending_session;
+    guint save_timeout;
 } CommonUserPrivate;
 
 typedef struct
@@ -166,6 +265,81 @@ G_DEFINE_TYPE (CommonSession, common_session, G_TYPE_OBJECT)
 #define PASSWD_FILE      "/etc/passwd"
 #define USER_CONFIG_FILE "/etc/lightdm/users.conf"
 
+/* Time in milliseconds to wait for the password file to stop changing */
+#define PASSWD_RELOAD_DELAY 500
+
+/* Serialized form of a user: path, name, real name, home directory, shell,
+ * image, background, loaded DMRC, language, layouts, session, has messages,
+ * UID, GID, is locked */
+#define USER_VARIANT_TYPE "(sssssssbsassbttb)"
+#define USER_LIST_VARIANT_TYPE "a" USER_VARIANT_TYPE
+
+/* Names of the fields in a serialized user, used to send only the fields that
+ * changed as the name of the user and a dictionary of the new values */
+static const gchar *user_field_names[] =
+{
+    "path", "name", "real-name", "home-directory", "shell", "image", "background", "loaded-dmrc",
+    "language", "layouts", "session", "has-messages", "uid", "gid", "is-locked"
+};
+#define USER_CHANGES_VARIANT_TYPE "(sa{sv})"
+
+/* Time in microseconds to remember a user looked up directly from the password database */
+#define USER_LOOKUP_TTL (10 * G_USEC_PER_SEC)
+
+/* Maximum number of users to request from the accounts service at once */
+#define MAX_LOADING_USERS 16
+
+/* Maximum number of .dmrc files to read at once */
+#define MAX_DMRC_THREADS 8
+
+/* Time in milliseconds to wait for a .dmrc file before using the cached copy */
+#define DMRC_LOAD_TIMEOUT 2000
+
+/* A user being loaded from the accounts service */
+typedef struct
+{
+    CommonUserList *user_list;
+    CommonUser *user;
+
+    /* Number of property requests still to complete */
+    gint n_pending;
+
+    /* TRUE if the user can log in */
+    gboolean is_user;
+
+    /* Cancelled if the list has gone away */
+    GCancellable *cancellable;
+} UserLoad;
+
+/* A .dmrc file being read in the thread pool */
+typedef struct
+{
+    gint ref_count;
+
+    /* User being loaded, only used from the main context */
+    CommonUser *user;
+
+    /* Context to report the result in */
+    GMainContext *context;
+
+    /* Where to read from */
+    gchar *home_directory;
+    uid_t uid;
+    gboolean check_owner;
+    gchar *cache_path;
+
+    /* Result, protected by dmrc_mutex */
+    gboolean done;
+    GKeyFile *dmrc;
+
+    /* TRUE if the result has been applied to the user, or is no longer wanted */
+    gboolean applied;
+} DmrcLoad;
+
+static GThreadPool *dmrc_pool = NULL;
+static GMutex dmrc_mutex;
+static GCond dmrc_cond;
+
 static CommonUserList *singleton = NULL;
 
 /**
@@ -194,14 +368,9 @@ get_user_by_name (CommonUserList *user_list, const gchar *username)
 {
     CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
 
-    for (GList *link = priv->users; link; link = link->next)
-    {
-        CommonUser *user = link->data;
-        if (g_strcmp0 (common_user_get_name (user), username) == 0)
-            return user;
-    }
-
-    return NULL;
+    if (!username)
+        return NULL;
+    return g_hash_table_lookup (priv->users_by_name, username);
 }
 
 static CommonUser *
@@ -209,24 +378,142 @@ get_user_by_path (CommonUserList *user_list, const gchar *path)
 {
     CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
 
-    for (GList *link = priv->users; link; link = link->next)
+    if (!path)
+        return NULL;
+    return g_hash_table_lookup (priv->users_by_path, path);
+}
+
+/* Get the key to sort a user by, collating is slow so it is only redone when the display name changes */
+static const gchar *
+get_sort_key (CommonUser *user)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    const gchar *display_name = common_user_get_display_name (user);
+    if (!priv->sort_key || g_strcmp0 (priv->sort_key_name, display_name) != 0)
     {
-        CommonUser *user = link->data;
-        CommonUserPrivate *user_priv = common_user_get_instance_private (user);
-        if (g_strcmp0 (user_priv->path, path) == 0)
-            return user;
+        g_free (priv->sort_key);
+        g_free (priv->sort_key_name);
+        priv->sort_key_name = g_strdup (display_name);
+        priv->sort_key = g_utf8_collate_key (display_name ? display_name : "", -1);
     }
 
-    return NULL;
+    return priv->sort_key;
 }
 
 static gint
 compare_user (gconstpointer a, gconstpointer b)
 {
     CommonUser *user_a = (CommonUser *) a, *user_b = (CommonUser *) b;
+
+    gint result = strcmp (get_sort_key (user_a), get_sort_key (user_b));
+    if (result != 0)
+        return result;
+
+    /* Names that collate the same still have a fixed order */
     return g_strcmp0 (common_user_get_display_name (user_a), common_user_get_display_name (user_b));
 }
 
+static void
+index_user (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+
+    if (user_priv->name)
+        g_hash_table_insert (priv->users_by_name, g_strdup (user_priv->name), user);
+    if (user_priv->path)
+        g_hash_table_insert (priv->users_by_path, g_strdup (user_priv->path), user);
+}
+
+static void
+unindex_user (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+
+    if (user_priv->name && g_hash_table_lookup (priv->users_by_name, user_priv->name) == user)
+        g_hash_table_remove (priv->users_by_name, user_priv->name);
+    if (user_priv->path && g_hash_table_lookup (priv->users_by_path, user_priv->path) == user)
+        g_hash_table_remove (priv->users_by_path, user_priv->path);
+}
+
+static gboolean
+is_user (gpointer key, gpointer value, gpointer user)
+{
+    return value == user;
+}
+
+/* Update the name index if an accounts service user has been renamed */
+static void
+reindex_user_name (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+
+    if (!user_priv->path || g_hash_table_lookup (priv->users_by_path, user_priv->path) != user)
+        return;
+    if (user_priv->name && g_hash_table_lookup (priv->users_by_name, user_priv->name) == user)
+        return;
+
+    g_hash_table_foreach_remove (priv->users_by_name, is_user, user);
+    if (user_priv->name)
+        g_hash_table_insert (priv->users_by_name, g_strdup (user_priv->name), user);
+}
+
+/* Add a user to the list, taking ownership of it */
+static void
+insert_user (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    priv->users = g_list_insert_sorted (priv->users, user, compare_user);
+    index_user (user_list, user);
+}
+
+/* Remove a user from the list, the caller takes the reference */
+static void
+remove_user (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    priv->users = g_list_remove (priv->users, user);
+    unindex_user (user_list, user);
+}
+
+/* Move a user whose display name has changed to its new place in the list */
+static void
+resort_user (CommonUserList *user_list, CommonUser *user)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    GList *link = g_list_find (priv->users, user);
+    if (!link)
+        return;
+    if ((!link->prev || compare_user (link->prev->data, user) <= 0) &&
+        (!link->next || compare_user (user, link->next->data) <= 0))
+        return;
+
+    priv->users = g_list_delete_link (priv->users, link);
+    priv->users = g_list_insert_sorted (priv->users, user, compare_user);
+}
+
+/* Replace the list of users, returning the old list */
+static GList *
+set_users (CommonUserList *user_list, GList *users)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    GList *old_users = priv->users;
+    priv->users = users;
+    g_hash_table_remove_all (priv->users_by_name);
+    g_hash_table_remove_all (priv->users_by_path);
+    for (GList *link = users; link; link = link->next)
+        index_user (user_list, link->data);
+
+    return old_users;
+}
+
 static gboolean
 update_passwd_user (CommonUser *user, const gchar *real_name, const gchar *home_directory, const gchar *shell, const gchar *image)
 {
@@ -243,8 +530,7 @@ update_passwd_user (CommonUser *user, const gchar *real_name, const gchar *home_
     priv->real_name = g_strdup (real_name);
     g_free (priv->home_directory);
     priv->home_directory = g_strdup (home_directory);
-    g_free (priv->shell);
-    priv->shell = g_strdup (shell);
+    priv->shell = g_intern_string (shell);
     g_free (priv->image);
     priv->image = g_strdup (image);
 
@@ -263,66 +549,167 @@ get_logged_in_cb (CommonUser *user, CommonUserList *user_list)
     if (priv->session_added_signal == 0)
         load_sessions (user_list);
 
-    const gchar *username = user_priv->name;
-    for (GList *link = priv->sessions; link; link = link->next)
-    {
-        CommonSession *session = link->data;
-        if (strcmp (session->username, username) == 0)
-            return TRUE;
-    }
-
-    return FALSE;
+    return g_hash_table_contains (priv->session_counts, user_priv->name);
 }
 
+static void update_changes (CommonUser *user);
+
 static void
 user_changed_cb (CommonUser *user, CommonUserList *user_list)
 {
+    reindex_user_name (user_list, user);
+    resort_user (user_list, user);
+    update_changes (user);
     g_signal_emit (user_list, list_signals[USER_CHANGED], 0, user);
 }
 
-static CommonUser *
-make_passwd_user (CommonUserList *user_list, struct passwd *entry)
+/* Shells, sessions, languages, layouts and backgrounds are the same for many
+ * users, so they are interned and each distinct value is only stored once */
+static gboolean
+set_interned_string (const gchar **field, const gchar *value)
 {
-    CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
-    CommonUserPrivate *priv = common_user_get_instance_private (user);
+    if (value && value[0] == '\0')
+        value = NULL;
 
-    g_signal_connect (user, "get-logged-in", G_CALLBACK (get_logged_in_cb), user_list);
+    const gchar *interned = g_intern_string (value);
+    if (*field == interned)
+        return FALSE;
+
+    *field = interned;
+    return TRUE;
+}
+
+/* Lists of layouts are interned as a whole, indexed by the layouts joined with tabs */
+static GMutex layouts_mutex;
+static GHashTable *interned_layouts = NULL;
+
+static const gchar * const *
+intern_strv (const gchar **values)
+{
+    static const gchar *empty[] = { NULL };
+    if (!values || !values[0])
+        return empty;
+
+    g_autofree gchar *key = g_strjoinv ("\t", (gchar **) values);
+
+    g_mutex_lock (&layouts_mutex);
+    if (!interned_layouts)
+        interned_layouts = g_hash_table_new (g_str_hash, g_str_equal);
+    const gchar **interned = g_hash_table_lookup (interned_layouts, key);
+    if (!interned)
+    {
+        guint length = g_strv_length ((gchar **) values);
+        interned = g_new (const gchar *, length + 1);
+        for (guint i = 0; i < length; i++)
+            interned[i] = g_intern_string (values[i]);
+        interned[length] = NULL;
+        g_hash_table_insert (interned_layouts, (gpointer) g_intern_string (key), interned);
+    }
+    g_mutex_unlock (&layouts_mutex);
+
+    return interned;
+}
+
+static gboolean
+set_interned_strv (const gchar * const **field, const gchar **values)
+{
+    const gchar * const *interned = intern_strv (values);
+    if (*field == interned)
+        return FALSE;
 
-    g_auto(GStrv) tokens = g_strsplit (entry->pw_gecos, ",", -1);
+    *field = interned;
+    return TRUE;
+}
+
+/* A user read from the password database */
+typedef struct
+{
+    gchar *name;
     gchar *real_name;
+    gchar *home_directory;
+    const gchar *shell;
+    gchar *image;
+    uid_t uid;
+    gid_t gid;
+} PasswdEntry;
+
+static PasswdEntry *
+passwd_entry_new (struct passwd *entry)
+{
+    PasswdEntry *e = g_malloc0 (sizeof (PasswdEntry));
+
+    g_auto(GStrv) tokens = g_strsplit (entry->pw_gecos ? entry->pw_gecos : "", ",", -1);
     if (tokens[0] != NULL && tokens[0][0] != '\0')
-        real_name = g_strdup (tokens[0]);
+        e->real_name = g_strdup (tokens[0]);
     else
-        real_name = g_strdup ("");
+        e->real_name = g_strdup ("");
 
-    gchar *image = g_build_filename (entry->pw_dir, ".face", NULL);
-    if (!g_file_test (image, G_FILE_TEST_EXISTS))
+    /* Checking for the image can be slow on network home directories, so this
+     * is done here rather than when the user is displayed */
+    e->image = g_build_filename (entry->pw_dir, ".face", NULL);
+    if (!g_file_test (e->image, G_FILE_TEST_EXISTS))
     {
-        g_free (image);
-        image = g_build_filename (entry->pw_dir, ".face.icon", NULL);
-        if (!g_file_test (image, G_FILE_TEST_EXISTS))
-        {
-            g_free (image);
-            image = NULL;
-        }
+        g_free (e->image);
+        e->image = g_build_filename (entry->pw_dir, ".face.icon", NULL);
+        if (!g_file_test (e->image, G_FILE_TEST_EXISTS))
+            g_clear_pointer (&e->image, g_free);
     }
 
-    priv->name = g_strdup (entry->pw_name);
-    priv->real_name = real_name;
-    priv->home_directory = g_strdup (entry->pw_dir);
-    priv->shell = g_strdup (entry->pw_shell);
-    priv->image = image;
-    priv->uid = entry->pw_uid;
-    priv->gid = entry->pw_gid;
+    e->name = g_strdup (entry->pw_name);
+    e->home_directory = g_strdup (entry->pw_dir);
+    e->shell = g_intern_string (entry->pw_shell);
+    e->uid = entry->pw_uid;
+    e->gid = entry->pw_gid;
+
+    return e;
+}
+
+static void
+passwd_entry_free (PasswdEntry *entry)
+{
+    g_free (entry->name);
+    g_free (entry->real_name);
+    g_free (entry->home_directory);
+    g_free (entry->image);
+    g_free (entry);
+}
+
+static CommonUser *
+make_passwd_user (CommonUserList *user_list, PasswdEntry *entry)
+{
+    CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    g_signal_connect (user, "get-logged-in", G_CALLBACK (get_logged_in_cb), user_list);
+
+    priv->name = g_strdup (entry->name);
+    priv->real_name = g_strdup (entry->real_name);
+    priv->home_directory = g_strdup (entry->home_directory);
+    priv->shell = entry->shell;
+    priv->image = g_strdup (entry->image);
+    priv->uid = entry->uid;
+    priv->gid = entry->gid;
 
     return user;
 }
 
+/* Protects the password database enumeration, which is shared by the whole process */
+static GMutex passwd_mutex;
+
 static void
-load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
+user_filter_free (UserFilter *filter)
 {
-    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    g_strfreev (filter->hidden_users);
+    g_strfreev (filter->hidden_shells);
+    g_free (filter);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (UserFilter, user_filter_free)
 
+/* Read which users are not shown, safe to call from any thread */
+static UserFilter *
+user_filter_load (void)
+{
     g_debug ("Loading user config from %s", USER_CONFIG_FILE);
 
     g_autoptr(GKeyFile) config = g_key_file_new ();
@@ -331,84 +718,147 @@ load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
     if (error && !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
         g_warning ("Failed to load configuration from %s: %s", USER_CONFIG_FILE, error->message);
 
-    gint minimum_uid = 500;
+    UserFilter *filter = g_malloc0 (sizeof (UserFilter));
+
+    filter->minimum_uid = 500;
     if (g_key_file_has_key (config, "UserList", "minimum-uid", NULL))
-        minimum_uid = g_key_file_get_integer (config, "UserList", "minimum-uid", NULL);
+        filter->minimum_uid = g_key_file_get_integer (config, "UserList", "minimum-uid", NULL);
 
     g_autofree gchar *hidden_users_list = g_key_file_get_string (config, "UserList", "hidden-users", NULL);
     if (!hidden_users_list)
         hidden_users_list = g_strdup ("nobody nobody4 noaccess");
-    g_auto(GStrv) hidden_users = g_strsplit (hidden_users_list, " ", -1);
+    filter->hidden_users = g_strsplit (hidden_users_list, " ", -1);
 
     g_autofree gchar *hidden_shells_list = g_key_file_get_string (config, "UserList", "hidden-shells", NULL);
     if (!hidden_shells_list)
         hidden_shells_list = g_strdup ("/bin/false /usr/sbin/nologin");
-    g_auto(GStrv) hidden_shells = g_strsplit (hidden_shells_list, " ", -1);
+    filter->hidden_shells = g_strsplit (hidden_shells_list, " ", -1);
+
+    return filter;
+}
+
+/* TRUE if a user with this name or shell is not shown */
+static gboolean
+user_filter_hides (UserFilter *filter, const gchar *name, const gchar *shell)
+{
+    /* Ignore users disabled by shell */
+    if (shell && g_strv_contains ((const gchar * const *) filter->hidden_shells, shell))
+        return TRUE;
+
+    /* Ignore certain users */
+    return name && g_strv_contains ((const gchar * const *) filter->hidden_users, name);
+}
+
+/* Read the users that can log in from the password database.  This may block for
+ * a long time with network backends, and is safe to call from any thread */
+static GPtrArray *
+read_passwd_entries (void)
+{
+    g_autoptr(UserFilter) filter = user_filter_load ();
+
+    GPtrArray *entries = g_ptr_array_new_with_free_func ((GDestroyNotify) passwd_entry_free);
+    g_autoptr(GHashTable) loaded_users = g_hash_table_new (g_str_hash, g_str_equal);
 
+    g_mutex_lock (&passwd_mutex);
     setpwent ();
 
-    GList *users = NULL, *new_users = NULL, *changed_users = NULL;
+#ifdef HAVE_GETPWENT_R
+    gsize buffer_length = 1024;
+    g_autofree gchar *buffer = g_malloc (buffer_length);
+#endif
     while (TRUE)
     {
+        struct passwd *entry;
+#ifdef HAVE_GETPWENT_R
+        struct passwd pwd;
+        int result = getpwent_r (&pwd, buffer, buffer_length, &entry);
+        if (result == ERANGE)
+        {
+            buffer_length *= 2;
+            buffer = g_realloc (buffer, buffer_length);
+            continue;
+        }
+        if (result != 0 || !entry)
+        {
+            if (result != 0 && result != ENOENT)
+                g_warning ("Failed to read password database: %s", strerror (result));
+            break;
+        }
+#else
         errno = 0;
-        struct passwd *entry = getpwent ();
+        entry = getpwent ();
         if (!entry)
+        {
+            if (errno != 0)
+                g_warning ("Failed to read password database: %s", strerror (errno));
             break;
+        }
+#endif
 
         /* Ignore system users */
-        if (entry->pw_uid < minimum_uid)
+        if (entry->pw_uid < filter->minimum_uid)
             continue;
 
-        /* Ignore users disabled by shell */
-        if (entry->pw_shell)
-        {
-            int i;
-            for (i = 0; hidden_shells[i] && strcmp (entry->pw_shell, hidden_shells[i]) != 0; i++);
-            if (hidden_shells[i])
-                continue;
-        }
+        if (user_filter_hides (filter, entry->pw_name, entry->pw_shell))
+            continue;
 
-        /* Ignore certain users */
-        int i;
-        for (i = 0; hidden_users[i] && strcmp (entry->pw_name, hidden_users[i]) != 0; i++);
-        if (hidden_users[i])
+        /* Skip users listed more than once */
+        if (g_hash_table_contains (loaded_users, entry->pw_name))
             continue;
 
-        CommonUser *user = make_passwd_user (user_list, entry);
+        PasswdEntry *e = passwd_entry_new (entry);
+        g_ptr_array_add (entries, e);
+        g_hash_table_add (loaded_users, e->name);
+    }
+
+    endpwent ();
+    g_mutex_unlock (&passwd_mutex);
+
+    return entries;
+}
+
+/* Update the user list to match what was read from the password database */
+static void
+apply_passwd_entries (CommonUserList *user_list, GPtrArray *entries, gboolean emit_add_signal)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    priv->update_time = g_get_real_time ();
+
+    GList *users = NULL, *new_users = NULL, *changed_users = NULL;
+    for (guint i = 0; i < entries->len; i++)
+    {
+        PasswdEntry *entry = g_ptr_array_index (entries, i);
 
         /* Update existing users if have them */
-        GList *link;
-        for (link = priv->users; link; link = link->next)
+        CommonUser *user = get_user_by_name (user_list, entry->name);
+        if (user)
         {
-            CommonUser *info = link->data;
-            if (strcmp (common_user_get_name (info), common_user_get_name (user)) == 0)
-            {
-                if (update_passwd_user (info, common_user_get_real_name (user), common_user_get_home_directory (user), common_user_get_shell (user), common_user_get_image (user)))
-                    changed_users = g_list_insert_sorted (changed_users, info, compare_user);
-                g_object_unref (user);
-                user = info;
-                break;
-            }
+            if (update_passwd_user (user, entry->real_name, entry->home_directory, entry->shell, entry->image))
+                changed_users = g_list_prepend (changed_users, user);
         }
-        if (!link)
+        else
         {
+            user = make_passwd_user (user_list, entry);
+
             /* Only notify once we have loaded the user list */
             if (priv->have_users)
-                new_users = g_list_insert_sorted (new_users, user, compare_user);
+                new_users = g_list_prepend (new_users, user);
         }
-        users = g_list_insert_sorted (users, user, compare_user);
+        users = g_list_prepend (users, user);
     }
 
-    if (errno != 0)
-        g_warning ("Failed to read password database: %s", strerror (errno));
-
-    endpwent ();
-
     /* Use new user list */
-    GList *old_users = priv->users;
-    priv->users = users;
+    GList *old_users = set_users (user_list, g_list_sort (users, compare_user));
+    for (GList *link = priv->users; link; link = link->next)
+    {
+        CommonUserPrivate *user_priv = common_user_get_instance_private (link->data);
+        user_priv->cached = FALSE;
+    }
 
     /* Notify of changes */
+    new_users = g_list_sort (new_users, compare_user);
+    changed_users = g_list_sort (changed_users, compare_user);
     for (GList *link = new_users; link; link = link->next)
     {
         CommonUser *info = link->data;
@@ -428,16 +878,9 @@ load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
     for (GList *link = old_users; link; link = link->next)
     {
         /* See if this user is in the current list */
-        GList *new_link;
-        for (new_link = priv->users; new_link; new_link = new_link->next)
-        {
-            if (new_link->data == link->data)
-                break;
-        }
-
-        if (!new_link)
+        CommonUser *info = link->data;
+        if (get_user_by_name (user_list, common_user_get_name (info)) != info)
         {
-            CommonUser *info = link->data;
             g_debug ("User %s removed", common_user_get_name (info));
             g_signal_emit (user_list, list_signals[USER_REMOVED], 0, info);
             g_object_unref (info);
@@ -447,16 +890,91 @@ load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
 }
 
 static void
-passwd_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, CommonUserList *user_list)
+load_passwd_file (CommonUserList *user_list, gboolean emit_add_signal)
 {
-    if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
-    {
-        g_debug ("%s changed, reloading user list", g_file_get_path (file));
-        load_passwd_file (user_list, TRUE);
-    }
+    g_autoptr(GPtrArray) entries = read_passwd_entries ();
+    apply_passwd_entries (user_list, entries, emit_add_signal);
 }
 
-static gboolean load_accounts_user (CommonUser *user);
+static void
+read_passwd_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    g_task_return_pointer (task, read_passwd_entries (), (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void read_passwd_async (CommonUserList *user_list);
+
+static void
+read_passwd_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    CommonUserList *user_list = COMMON_USER_LIST (object);
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    priv->reading_passwd = FALSE;
+
+    /* Cancelled if we stopped monitoring while reading */
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) entries = g_task_propagate_pointer (G_TASK (result), &error);
+    if (!entries)
+        return;
+
+    apply_passwd_entries (user_list, entries, TRUE);
+
+    /* Read again if the file changed while we were reading it */
+    if (priv->passwd_reload_pending)
+    {
+        priv->passwd_reload_pending = FALSE;
+        read_passwd_async (user_list);
+    }
+}
+
+/* Read the password database in a thread so the main loop isn't blocked */
+static void
+read_passwd_async (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (priv->reading_passwd)
+    {
+        priv->passwd_reload_pending = TRUE;
+        return;
+    }
+
+    priv->reading_passwd = TRUE;
+    g_autoptr(GTask) task = g_task_new (user_list, priv->load_cancellable, read_passwd_cb, NULL);
+    g_task_run_in_thread (task, read_passwd_thread);
+}
+
+static gboolean
+passwd_reload_cb (gpointer data)
+{
+    CommonUserList *user_list = data;
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    priv->passwd_reload_timeout = 0;
+    read_passwd_async (user_list);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+passwd_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+        return;
+
+    /* Tools like useradd can change the file several times in a row, so wait for it to settle */
+    g_autofree gchar *path = g_file_get_path (file);
+    g_debug ("%s changed, reloading user list", path);
+    g_hash_table_remove_all (priv->lookup_cache);
+    if (priv->passwd_reload_timeout)
+        g_source_remove (priv->passwd_reload_timeout);
+    priv->passwd_reload_timeout = g_timeout_add (PASSWD_RELOAD_DELAY, passwd_reload_cb, user_list);
+}
+
+static gboolean load_accounts_user (CommonUser *user);
 
 static void
 accounts_user_changed_cb (GDBusConnection *connection,
@@ -478,12 +996,11 @@ accounts_user_changed_cb (GDBusConnection *connection,
         g_signal_emit (user, user_signals[CHANGED], 0);
 }
 
-static gboolean
-load_accounts_user (CommonUser *user)
+static void
+watch_accounts_user (CommonUser *user)
 {
     CommonUserPrivate *priv = common_user_get_instance_private (user);
 
-    /* Get the properties for this user */
     if (!priv->changed_signal)
         priv->changed_signal = g_dbus_connection_signal_subscribe (priv->bus,
                                                                    "org.freedesktop.Accounts",
@@ -495,25 +1012,14 @@ load_accounts_user (CommonUser *user)
                                                                    accounts_user_changed_cb,
                                                                    user,
                                                                    NULL);
+}
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
-                                                              "org.freedesktop.Accounts",
-                                                              priv->path,
-                                                              "org.freedesktop.DBus.Properties",
-                                                              "GetAll",
-                                                              g_variant_new ("(s)", "org.freedesktop.Accounts.User"),
-                                                              G_VARIANT_TYPE ("(a{sv})"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error updating user %s: %s", priv->path, error->message);
-    if (!result)
-        return FALSE;
+/* Store the properties we need from org.freedesktop.Accounts.User, returns FALSE for system accounts */
+static gboolean
+update_user_properties (CommonUser *user, GVariant *result)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
 
-    /* Store the properties we need */
     g_autoptr(GVariantIter) iter = NULL;
     g_variant_get (result, "(a{sv})", &iter);
     const gchar *name;
@@ -538,16 +1044,13 @@ load_accounts_user (CommonUser *user)
         }
         else if (strcmp (name, "Shell") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
-            g_free (priv->shell);
-            priv->shell = g_variant_dup_string (value, NULL);
+            priv->shell = g_intern_string (g_variant_get_string (value, NULL));
         }
         else if (strcmp (name, "SystemAccount") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
             system_account = g_variant_get_boolean (value);
         else if (strcmp (name, "Language") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
-            if (priv->language)
-                g_free (priv->language);
-            priv->language = g_variant_dup_string (value, NULL);
+            priv->language = g_intern_string (g_variant_get_string (value, NULL));
         }
         else if (strcmp (name, "IconFile") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
@@ -558,8 +1061,7 @@ load_accounts_user (CommonUser *user)
         }
         else if (strcmp (name, "XSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
         {
-            g_free (priv->session);
-            priv->session = g_variant_dup_string (value, NULL);
+            priv->session = g_intern_string (g_variant_get_string (value, NULL));
         }
         else if (strcmp (name, "Uid") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
             priv->uid = g_variant_get_uint64 (value);
@@ -567,6 +1069,112 @@ load_accounts_user (CommonUser *user)
             priv->is_locked = g_variant_get_boolean (value);
     }
 
+    return !system_account;
+}
+
+/* Store the properties we need from org.freedesktop.DisplayManager.AccountsService, returns TRUE if any changed */
+static gboolean
+update_user_extra_properties (CommonUser *user, GVariant *extra_result)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    /* These are interned so can be compared directly */
+    const gchar *old_background = priv->background;
+    const gchar * const *old_layouts = priv->layouts;
+    gboolean old_has_messages = priv->has_messages;
+
+    g_autoptr(GVariantIter) extra_iter = NULL;
+    const gchar *name;
+    GVariant *value;
+
+    g_variant_get (extra_result, "(a{sv})", &extra_iter);
+    while (g_variant_iter_loop (extra_iter, "{&sv}", &name, &value))
+    {
+        if (strcmp (name, "BackgroundFile") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
+        {
+            set_interned_string (&priv->background, g_variant_get_string (value, NULL));
+        }
+        else if (strcmp (name, "HasMessages") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+            priv->has_messages = g_variant_get_boolean (value);
+        else if (strcmp (name, "KeyboardLayouts") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
+        {
+            g_autofree const gchar **layouts = g_variant_get_strv (value, NULL);
+            priv->layouts = intern_strv (layouts);
+        }
+    }
+
+    return priv->background != old_background || priv->layouts != old_layouts || priv->has_messages != old_has_messages;
+}
+
+static gboolean
+emit_changed_idle_cb (gpointer data)
+{
+    CommonUser *user = data;
+    g_signal_emit (user, user_signals[CHANGED], 0);
+    return G_SOURCE_REMOVE;
+}
+
+/* Fetch the display manager properties now if they haven't been already */
+static void
+load_extra_properties (CommonUser *user)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    if (!priv->extra_pending)
+        return;
+    priv->extra_pending = FALSE;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
+                                                              "org.freedesktop.Accounts",
+                                                              priv->path,
+                                                              "org.freedesktop.DBus.Properties",
+                                                              "GetAll",
+                                                              g_variant_new ("(s)", "org.freedesktop.DisplayManager.AccountsService"),
+                                                              G_VARIANT_TYPE ("(a{sv})"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (error)
+        g_warning ("Error updating user %s: %s", priv->path, error->message);
+
+    /* Signal the change later, as we are in the middle of a getter */
+    if (result && update_user_extra_properties (user, result))
+        g_idle_add_full (G_PRIORITY_DEFAULT, emit_changed_idle_cb, g_object_ref (user), g_object_unref);
+}
+
+static gboolean
+load_accounts_user (CommonUser *user)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    /* Get the properties for this user */
+    watch_accounts_user (user);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
+                                                              "org.freedesktop.Accounts",
+                                                              priv->path,
+                                                              "org.freedesktop.DBus.Properties",
+                                                              "GetAll",
+                                                              g_variant_new ("(s)", "org.freedesktop.Accounts.User"),
+                                                              G_VARIANT_TYPE ("(a{sv})"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (error)
+        g_warning ("Error updating user %s: %s", priv->path, error->message);
+    if (!result)
+        return FALSE;
+
+    gboolean is_user = update_user_properties (user, result);
+
+    /* The rest are fetched when first needed */
+    if (priv->extra_pending)
+        return is_user;
+
     g_autoptr(GVariant) extra_result = g_dbus_connection_call_sync (priv->bus,
                                                                     "org.freedesktop.Accounts",
                                                                     priv->path,
@@ -580,224 +1188,540 @@ load_accounts_user (CommonUser *user)
                                                                     &error);
     if (error)
         g_warning ("Error updating user %s: %s", priv->path, error->message);
-    if (extra_result) {
-        g_autoptr(GVariantIter) extra_iter = NULL;
-
-        g_variant_get (extra_result, "(a{sv})", &extra_iter);
-        while (g_variant_iter_loop (extra_iter, "{&sv}", &name, &value))
-        {
-            if (strcmp (name, "BackgroundFile") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
-            {
-                g_free (priv->background);
-                priv->background = g_variant_dup_string (value, NULL);
-                if (strcmp (priv->background, "") == 0)
-                    g_clear_pointer (&priv->background, g_free);
-            }
-            else if (strcmp (name, "HasMessages") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
-                priv->has_messages = g_variant_get_boolean (value);
-            else if (strcmp (name, "KeyboardLayouts") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_STRING_ARRAY))
-            {
-                g_strfreev (priv->layouts);
-                priv->layouts = g_variant_dup_strv (value, NULL);
-                if (!priv->layouts)
-                {
-                    priv->layouts = g_malloc (sizeof (gchar *) * 1);
-                    priv->layouts[0] = NULL;
-                }
-            }
-        }
-    }
+    if (extra_result)
+        update_user_extra_properties (user, extra_result);
 
-    return !system_account;
+    return is_user;
 }
 
-static void
-add_accounts_user (CommonUserList *user_list, const gchar *path, gboolean emit_signal)
+static CommonUser *
+make_accounts_user (CommonUserList *user_list, const gchar *path)
 {
     CommonUserListPrivate *list_priv = common_user_list_get_instance_private (user_list);
 
     CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
     CommonUserPrivate *priv = common_user_get_instance_private (user);
 
-    g_debug ("User %s added", path);
     priv->bus = g_object_ref (list_priv->bus);
     priv->path = g_strdup (path);
     g_signal_connect (user, USER_SIGNAL_CHANGED, G_CALLBACK (user_changed_cb), user_list);
     g_signal_connect (user, "get-logged-in", G_CALLBACK (get_logged_in_cb), user_list);
-    if (load_accounts_user (user))
-    {
-        list_priv->users = g_list_insert_sorted (list_priv->users, user, compare_user);
-        if (emit_signal)
-            g_signal_emit (user_list, list_signals[USER_ADDED], 0, user);
-    }
-    else
-        g_object_unref (user);
+
+    return user;
 }
 
-static void
-accounts_user_added_cb (GDBusConnection *connection,
-                        const gchar *sender_name,
-                        const gchar *object_path,
-                        const gchar *interface_name,
-                        const gchar *signal_name,
-                        GVariant *parameters,
-                        gpointer data)
+/* Get the user ID from an accounts service path, which are of the form /org/freedesktop/Accounts/User1000 */
+static gboolean
+get_accounts_path_uid (const gchar *path, guint64 *uid)
 {
-    CommonUserList *user_list = data;
-
-    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
-    {
-        g_warning ("Got UserAccounts signal UserAdded with unknown parameters %s", g_variant_get_type_string (parameters));
-        return;
-    }
-
-    const gchar *path;
-    g_variant_get (parameters, "(&o)", &path);
+    const gchar *prefix = "/org/freedesktop/Accounts/User";
+    if (!g_str_has_prefix (path, prefix) || !g_ascii_isdigit (path[strlen (prefix)]))
+        return FALSE;
 
-    /* Add user if we haven't got them */
-    CommonUser *user = get_user_by_path (user_list, path);
-    if (!user)
-        add_accounts_user (user_list, path, TRUE);
+    gchar *end;
+    *uid = g_ascii_strtoull (path + strlen (prefix), &end, 10);
+    return *end == '\0';
 }
 
+/* Remember an accounts service user isn't shown so they don't get fetched again */
 static void
-accounts_user_deleted_cb (GDBusConnection *connection,
-                          const gchar *sender_name,
-                          const gchar *object_path,
-                          const gchar *interface_name,
-                          const gchar *signal_name,
-                          GVariant *parameters,
-                          gpointer data)
+add_hidden_path (CommonUserList *user_list, const gchar *path)
 {
-    CommonUserList *user_list = data;
     CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    g_hash_table_add (priv->hidden_paths, g_strdup (path));
+}
 
-    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
-    {
-        g_warning ("Got UserAccounts signal UserDeleted with unknown parameters %s", g_variant_get_type_string (parameters));
-        return;
-    }
+/* Check if an accounts service user can be skipped without fetching their properties */
+static gboolean
+is_hidden_accounts_path (CommonUserList *user_list, const gchar *path)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
 
-    const gchar *path;
-    g_variant_get (parameters, "(&o)", &path);
+    if (g_hash_table_contains (priv->hidden_paths, path))
+        return TRUE;
 
-    /* Delete user if we know of them */
-    CommonUser *user = get_user_by_path (user_list, path);
-    if (user)
+    guint64 uid;
+    if (priv->filter && get_accounts_path_uid (path, &uid) && uid < (guint64) MAX (priv->filter->minimum_uid, 0))
     {
-        g_debug ("User %s deleted", path);
-        priv->users = g_list_remove (priv->users, user);
-
-        g_signal_emit (user_list, list_signals[USER_REMOVED], 0, user);
-
-        g_object_unref (user);
+        add_hidden_path (user_list, path);
+        return TRUE;
     }
+
+    return FALSE;
 }
 
-static CommonSession *
-load_session (CommonUserList *user_list, const gchar *path)
+/* Check a loaded accounts service user against the hidden users and shells */
+static gboolean
+is_shown_accounts_user (CommonUserList *user_list, CommonUser *user)
 {
     CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    CommonUserPrivate *user_priv = common_user_get_instance_private (user);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
-                                                              "org.freedesktop.DisplayManager",
-                                                              path,
-                                                              "org.freedesktop.DBus.Properties",
-                                                              "Get",
-                                                              g_variant_new ("(ss)", "org.freedesktop.DisplayManager.Session", "UserName"),
-                                                              G_VARIANT_TYPE ("(v)"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error getting UserName from org.freedesktop.DisplayManager.Session: %s", error->message);
-    if (!result)
-        return NULL;
-
-    g_autoptr(GVariant) username = NULL;
-    g_variant_get (result, "(v)", &username);
-    if (!g_variant_is_of_type (username, G_VARIANT_TYPE_STRING))
-        return NULL;
-
-    const gchar *name;
-    g_variant_get (username, "&s", &name);
-
-    g_debug ("Loaded session %s (%s)", path, name);
-    CommonSession *session = g_object_new (common_session_get_type (), NULL);
-    session->username = g_strdup (name);
-    session->path = g_strdup (path);
-    priv->sessions = g_list_append (priv->sessions, session);
+    if (!priv->filter || !user_filter_hides (priv->filter, user_priv->name, user_priv->shell))
+        return TRUE;
 
-    return session;
+    add_hidden_path (user_list, user_priv->path);
+    return FALSE;
 }
 
 static void
-session_added_cb (GDBusConnection *connection,
-                  const gchar *sender_name,
-                  const gchar *object_path,
-                  const gchar *interface_name,
-                  const gchar *signal_name,
-                  GVariant *parameters,
-                  gpointer data)
+add_accounts_user (CommonUserList *user_list, const gchar *path, gboolean emit_signal)
 {
-    CommonUserList *user_list = data;
-
-    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
+    g_debug ("User %s added", path);
+    CommonUser *user = make_accounts_user (user_list, path);
+    if (load_accounts_user (user) && is_shown_accounts_user (user_list, user))
     {
-        g_warning ("Got DisplayManager signal SessionAdded with unknown parameters %s", g_variant_get_type_string (parameters));
-        return;
+        insert_user (user_list, user);
+        if (emit_signal)
+            g_signal_emit (user_list, list_signals[USER_ADDED], 0, user);
     }
+    else
+        g_object_unref (user);
+}
 
-    const gchar *path;
-    g_variant_get (parameters, "(&o)", &path);
-    CommonSession *session = load_session (user_list, path);
-    if (!session)
-        return;
+static void load_next_accounts_users (CommonUserList *user_list);
 
-    CommonUser *user = get_user_by_name (user_list, session->username);
-    if (user)
-        g_signal_emit (user, user_signals[CHANGED], 0);
-}
+static gboolean update_cached_user (CommonUserList *user_list, CommonUser *user, CommonUser *loaded_user);
 
+/* Remove cached users that no longer exist */
 static void
-session_removed_cb (GDBusConnection *connection,
-                    const gchar *sender_name,
-                    const gchar *object_path,
-                    const gchar *interface_name,
-                    const gchar *signal_name,
-                    GVariant *parameters,
-                    gpointer data)
+remove_cached_users (CommonUserList *user_list)
 {
-    CommonUserList *user_list = data;
     CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
 
+    GList *link = priv->users;
+    while (link)
+    {
+        CommonUser *user = link->data;
+        CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+        link = link->next;
+
+        if (user_priv->cached)
+        {
+            g_debug ("Cached user %s removed", user_priv->name);
+            remove_user (user_list, user);
+            g_signal_emit (user_list, list_signals[USER_REMOVED], 0, user);
+            g_object_unref (user);
+        }
+    }
+}
+
+static void load_next_extra_properties (CommonUserList *user_list);
+
+static void
+extra_properties_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    UserLoad *load = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) properties = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+
+    /* The list has gone away or stopped loading, so just clean up */
+    if (g_cancellable_is_cancelled (load->cancellable))
+    {
+        g_object_unref (load->user);
+        g_object_unref (load->cancellable);
+        g_free (load);
+        return;
+    }
+
+    CommonUserList *user_list = load->user_list;
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    CommonUserPrivate *user_priv = common_user_get_instance_private (load->user);
+
+    if (error)
+        g_warning ("Error updating user %s: %s", user_priv->path, error->message);
+
+    /* Skip if they were needed while we were waiting, or the user has been removed */
+    if (properties && user_priv->extra_pending && get_user_by_path (user_list, user_priv->path) == load->user)
+    {
+        user_priv->extra_pending = FALSE;
+        if (update_user_extra_properties (load->user, properties))
+            g_signal_emit (load->user, user_signals[CHANGED], 0);
+    }
+    g_object_unref (load->user);
+    g_object_unref (load->cancellable);
+    g_free (load);
+
+    priv->n_loading_extra--;
+    load_next_extra_properties (user_list);
+}
+
+/* Fetch display manager properties for waiting users, keeping a limited number of requests in flight */
+static void
+load_next_extra_properties (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    while (priv->n_loading_extra < MAX_LOADING_USERS && !g_queue_is_empty (priv->extra_pending_users))
+    {
+        CommonUser *user = g_queue_pop_head (priv->extra_pending_users);
+        CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+        if (!user_priv->extra_pending)
+        {
+            g_object_unref (user);
+            continue;
+        }
+
+        UserLoad *load = g_malloc0 (sizeof (UserLoad));
+        load->user_list = user_list;
+        load->user = user;
+        load->cancellable = g_object_ref (priv->load_cancellable);
+        priv->n_loading_extra++;
+
+        g_dbus_connection_call (user_priv->bus,
+                                "org.freedesktop.Accounts",
+                                user_priv->path,
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll",
+                                g_variant_new ("(s)", "org.freedesktop.DisplayManager.AccountsService"),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                priv->load_cancellable,
+                                extra_properties_cb,
+                                load);
+    }
+}
+
+static gboolean
+fill_extra_properties_cb (gpointer data)
+{
+    CommonUserList *user_list = data;
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    priv->extra_fill_idle = 0;
+    for (GList *link = priv->users; link; link = link->next)
+    {
+        CommonUserPrivate *user_priv = common_user_get_instance_private (link->data);
+        if (user_priv->extra_pending)
+            g_queue_push_tail (priv->extra_pending_users, g_object_ref (link->data));
+    }
+    load_next_extra_properties (user_list);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+finish_loading (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (!priv->loading || priv->n_loading > 0 || !g_queue_is_empty (priv->pending_paths))
+        return;
+
+    remove_cached_users (user_list);
+    priv->loading = FALSE;
+    priv->update_time = g_get_real_time ();
+    g_debug ("Loaded %u users, skipped %u hidden users", g_list_length (priv->users), priv->n_skipped);
+
+    /* Fill in the rest of the properties once the main loop is idle.
+     * This is run from the main context as we may be loading synchronously */
+    if (!priv->extra_fill_idle)
+        priv->extra_fill_idle = g_idle_add_full (G_PRIORITY_LOW, fill_extra_properties_cb, user_list, NULL);
+
+    g_signal_emit (user_list, list_signals[LOADED], 0);
+}
+
+static void
+user_load_complete (UserLoad *load)
+{
+    load->n_pending--;
+    if (load->n_pending > 0)
+        return;
+
+    /* The list has gone away, so just clean up */
+    if (g_cancellable_is_cancelled (load->cancellable))
+    {
+        g_object_unref (load->user);
+        g_object_unref (load->cancellable);
+        g_free (load);
+        return;
+    }
+
+    CommonUserList *user_list = load->user_list;
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    CommonUserPrivate *user_priv = common_user_get_instance_private (load->user);
+
+    CommonUser *existing_user = get_user_by_path (user_list, user_priv->path);
+    CommonUserPrivate *existing_priv = existing_user ? common_user_get_instance_private (existing_user) : NULL;
+    if (existing_priv && existing_priv->cached)
+    {
+        /* Replace what we had from the cache */
+        if (load->is_user)
+        {
+            if (!priv->load_context)
+                watch_accounts_user (existing_user);
+            if (update_cached_user (user_list, existing_user, load->user))
+                g_signal_emit (existing_user, user_signals[CHANGED], 0);
+        }
+    }
+    /* Skip if the accounts service told us about this user while we were loading it */
+    else if (load->is_user && !existing_user)
+    {
+        insert_user (user_list, g_object_ref (load->user));
+
+        /* Changes are watched for once loaded when loading synchronously, as signals are delivered to this context */
+        if (!priv->load_context)
+            watch_accounts_user (load->user);
+        if (priv->emit_load_signals)
+            g_signal_emit (user_list, list_signals[USER_ADDED], 0, load->user);
+    }
+    g_object_unref (load->user);
+    g_object_unref (load->cancellable);
+    g_free (load);
+
+    priv->n_loading--;
+    load_next_accounts_users (user_list);
+    finish_loading (user_list);
+}
+
+static void
+user_properties_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    UserLoad *load = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) properties = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+        CommonUserPrivate *priv = common_user_get_instance_private (load->user);
+        g_warning ("Error updating user %s: %s", priv->path, error->message);
+    }
+    if (properties && !g_cancellable_is_cancelled (load->cancellable))
+    {
+        load->is_user = update_user_properties (load->user, properties);
+
+        /* System accounts won't change, so don't fetch them again */
+        if (!load->is_user)
+            add_hidden_path (load->user_list, common_user_get_instance_private (load->user)->path);
+        else
+            load->is_user = is_shown_accounts_user (load->user_list, load->user);
+    }
+
+    user_load_complete (load);
+}
+
+/* Request properties for waiting users, keeping a limited number of requests in flight */
+static void
+load_next_accounts_users (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    while (priv->n_loading < MAX_LOADING_USERS && !g_queue_is_empty (priv->pending_paths))
+    {
+        g_autofree gchar *path = g_queue_pop_head (priv->pending_paths);
+
+        if (is_hidden_accounts_path (user_list, path))
+        {
+            priv->n_skipped++;
+            continue;
+        }
+
+        UserLoad *load = g_malloc0 (sizeof (UserLoad));
+        load->user_list = user_list;
+        load->user = make_accounts_user (user_list, path);
+        load->n_pending = 1;
+        load->cancellable = g_object_ref (priv->load_cancellable);
+        priv->n_loading++;
+
+        /* Only get the user's identity now, the display manager properties are fetched later */
+        CommonUserPrivate *user_priv = common_user_get_instance_private (load->user);
+        user_priv->extra_pending = TRUE;
+
+        g_dbus_connection_call (priv->bus,
+                                "org.freedesktop.Accounts",
+                                path,
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll",
+                                g_variant_new ("(s)", "org.freedesktop.Accounts.User"),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                priv->load_cancellable,
+                                user_properties_cb,
+                                load);
+    }
+}
+
+static void
+accounts_user_added_cb (GDBusConnection *connection,
+                        const gchar *sender_name,
+                        const gchar *object_path,
+                        const gchar *interface_name,
+                        const gchar *signal_name,
+                        GVariant *parameters,
+                        gpointer data)
+{
+    CommonUserList *user_list = data;
+
+    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
+    {
+        g_warning ("Got UserAccounts signal UserAdded with unknown parameters %s", g_variant_get_type_string (parameters));
+        return;
+    }
+
+    const gchar *path;
+    g_variant_get (parameters, "(&o)", &path);
+
+    /* A user we skipped may have changed, so only use what the path tells us */
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    g_hash_table_remove (priv->hidden_paths, path);
+    if (is_hidden_accounts_path (user_list, path))
+        return;
+
+    /* Add user if we haven't got them */
+    CommonUser *user = get_user_by_path (user_list, path);
+    if (!user)
+        add_accounts_user (user_list, path, TRUE);
+}
+
+static void
+accounts_user_deleted_cb (GDBusConnection *connection,
+                          const gchar *sender_name,
+                          const gchar *object_path,
+                          const gchar *interface_name,
+                          const gchar *signal_name,
+                          GVariant *parameters,
+                          gpointer data)
+{
+    CommonUserList *user_list = data;
+
     if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
     {
-        g_warning ("Got DisplayManager signal SessionRemoved with unknown parameters %s", g_variant_get_type_string (parameters));
+        g_warning ("Got UserAccounts signal UserDeleted with unknown parameters %s", g_variant_get_type_string (parameters));
         return;
     }
 
     const gchar *path;
     g_variant_get (parameters, "(&o)", &path);
 
-    for (GList *link = priv->sessions; link; link = link->next)
+    /* The path may be reused by a new user */
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    g_hash_table_remove (priv->hidden_paths, path);
+
+    /* Delete user if we know of them */
+    CommonUser *user = get_user_by_path (user_list, path);
+    if (user)
     {
-        CommonSession *session = link->data;
-        if (strcmp (session->path, path) == 0)
-        {
-            g_debug ("Session %s removed", path);
-            priv->sessions = g_list_delete_link (priv->sessions, link);
-            CommonUser *user = get_user_by_name (user_list, session->username);
-            if (user)
-                g_signal_emit (user, user_signals[CHANGED], 0);
-            g_object_unref (session);
-            break;
-        }
+        g_debug ("User %s deleted", path);
+        remove_user (user_list, user);
+
+        g_signal_emit (user_list, list_signals[USER_REMOVED], 0, user);
+
+        g_object_unref (user);
+    }
+}
+
+#define SESSION_INTERFACE_NAME "org.freedesktop.DisplayManager.Session"
+
+static gboolean
+add_session (CommonUserList *user_list, const gchar *path, const gchar *username)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (g_hash_table_contains (priv->sessions, path))
+        return FALSE;
+
+    g_debug ("Loaded session %s (%s)", path, username);
+    CommonSession *session = g_object_new (common_session_get_type (), NULL);
+    session->username = g_strdup (username);
+    session->path = g_strdup (path);
+    g_hash_table_insert (priv->sessions, session->path, session);
+
+    guint n_sessions = GPOINTER_TO_UINT (g_hash_table_lookup (priv->session_counts, username));
+    g_hash_table_insert (priv->session_counts, g_strdup (username), GUINT_TO_POINTER (n_sessions + 1));
+
+    return TRUE;
+}
+
+/* Add a session from its object manager interfaces, returns the user it is for or NULL */
+static const gchar *
+add_session_from_properties (CommonUserList *user_list, const gchar *path, GVariant *interfaces)
+{
+    g_autoptr(GVariant) properties = g_variant_lookup_value (interfaces, SESSION_INTERFACE_NAME, G_VARIANT_TYPE ("a{sv}"));
+    if (!properties)
+        return NULL;
+
+    const gchar *username;
+    if (!g_variant_lookup (properties, "UserName", "&s", &username) ||
+        !add_session (user_list, path, username))
+        return NULL;
+
+    return username;
+}
+
+static void
+interfaces_added_cb (GDBusConnection *connection,
+                     const gchar *sender_name,
+                     const gchar *object_path,
+                     const gchar *interface_name,
+                     const gchar *signal_name,
+                     GVariant *parameters,
+                     gpointer data)
+{
+    CommonUserList *user_list = data;
+
+    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(oa{sa{sv}})")))
+    {
+        g_warning ("Got DisplayManager signal InterfacesAdded with unknown parameters %s", g_variant_get_type_string (parameters));
+        return;
+    }
+
+    /* The session properties come with the signal so there's no need to ask for them */
+    const gchar *path;
+    g_autoptr(GVariant) interfaces = NULL;
+    g_variant_get (parameters, "(&o@a{sa{sv}})", &path, &interfaces);
+    const gchar *username = add_session_from_properties (user_list, path, interfaces);
+    if (!username)
+        return;
+
+    CommonUser *user = get_user_by_name (user_list, username);
+    if (user)
+        g_signal_emit (user, user_signals[CHANGED], 0);
+}
+
+static void
+interfaces_removed_cb (GDBusConnection *connection,
+                       const gchar *sender_name,
+                       const gchar *object_path,
+                       const gchar *interface_name,
+                       const gchar *signal_name,
+                       GVariant *parameters,
+                       gpointer data)
+{
+    CommonUserList *user_list = data;
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(oas)")))
+    {
+        g_warning ("Got DisplayManager signal InterfacesRemoved with unknown parameters %s", g_variant_get_type_string (parameters));
+        return;
     }
+
+    const gchar *path;
+    g_autofree const gchar **interface_names = NULL;
+    g_variant_get (parameters, "(&o^a&s)", &path, &interface_names);
+    if (!g_strv_contains (interface_names, SESSION_INTERFACE_NAME))
+        return;
+
+    CommonSession *session = g_hash_table_lookup (priv->sessions, path);
+    if (!session)
+        return;
+
+    g_debug ("Session %s removed", path);
+    guint n_sessions = GPOINTER_TO_UINT (g_hash_table_lookup (priv->session_counts, session->username));
+    if (n_sessions > 1)
+        g_hash_table_insert (priv->session_counts, g_strdup (session->username), GUINT_TO_POINTER (n_sessions - 1));
+    else
+        g_hash_table_remove (priv->session_counts, session->username);
+    CommonUser *user = get_user_by_name (user_list, session->username);
+    if (user)
+        g_signal_emit (user, user_signals[CHANGED], 0);
+    g_hash_table_remove (priv->sessions, path);
 }
 
+/* Get all the sessions and who they belong to in one call, then keep up to date from the object manager signals */
 static void
 load_sessions (CommonUserList *user_list)
 {
@@ -805,22 +1729,22 @@ load_sessions (CommonUserList *user_list)
 
     priv->session_added_signal = g_dbus_connection_signal_subscribe (priv->bus,
                                                                      "org.freedesktop.DisplayManager",
-                                                                     "org.freedesktop.DisplayManager",
-                                                                     "SessionAdded",
+                                                                     "org.freedesktop.DBus.ObjectManager",
+                                                                     "InterfacesAdded",
                                                                      "/org/freedesktop/DisplayManager",
                                                                      NULL,
                                                                      G_DBUS_SIGNAL_FLAGS_NONE,
-                                                                     session_added_cb,
+                                                                     interfaces_added_cb,
                                                                      user_list,
                                                                      NULL);
     priv->session_removed_signal = g_dbus_connection_signal_subscribe (priv->bus,
                                                                        "org.freedesktop.DisplayManager",
-                                                                       "org.freedesktop.DisplayManager",
-                                                                       "SessionRemoved",
+                                                                       "org.freedesktop.DBus.ObjectManager",
+                                                                       "InterfacesRemoved",
                                                                        "/org/freedesktop/DisplayManager",
                                                                        NULL,
                                                                        G_DBUS_SIGNAL_FLAGS_NONE,
-                                                                       session_removed_cb,
+                                                                       interfaces_removed_cb,
                                                                        user_list,
                                                                        NULL);
 
@@ -828,176 +1752,987 @@ load_sessions (CommonUserList *user_list)
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
                                                               "org.freedesktop.DisplayManager",
                                                               "/org/freedesktop/DisplayManager",
-                                                              "org.freedesktop.DBus.Properties",
-                                                              "Get",
-                                                              g_variant_new ("(ss)", "org.freedesktop.DisplayManager", "Sessions"),
-                                                              G_VARIANT_TYPE ("(v)"),
+                                                              "org.freedesktop.DBus.ObjectManager",
+                                                              "GetManagedObjects",
+                                                              NULL,
+                                                              G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
                                                               G_DBUS_CALL_FLAGS_NONE,
                                                               -1,
                                                               NULL,
                                                               &error);
     if (error)
         g_warning ("Error getting session list from org.freedesktop.DisplayManager: %s", error->message);
-    if (result)
-    {
-        if (g_variant_is_of_type (result, G_VARIANT_TYPE ("(v)")))
-        {
-            g_autoptr(GVariant) value = NULL;
-            g_variant_get (result, "(v)", &value);
-
-            g_debug ("Loading sessions from org.freedesktop.DisplayManager");
-            g_autoptr(GVariantIter) iter = NULL;
-            g_variant_get (value, "ao", &iter);
-            const gchar *path;
-            while (g_variant_iter_loop (iter, "&o", &path))
-                load_session (user_list, path);
-        }
-        else
-            g_warning ("Unexpected type from org.freedesktop.DisplayManager.Sessions: %s", g_variant_get_type_string (result));
-    }
+    if (!result)
+        return;
+
+    g_debug ("Loading sessions from org.freedesktop.DisplayManager");
+    g_autoptr(GVariantIter) iter = NULL;
+    g_variant_get (result, "(a{oa{sa{sv}}})", &iter);
+    const gchar *path;
+    GVariant *interfaces;
+    while (g_variant_iter_loop (iter, "{&o@a{sa{sv}}}", &path, &interfaces))
+        add_session_from_properties (user_list, path, interfaces);
 }
 
 static void
-load_users (CommonUserList *user_list)
+monitor_passwd_file (CommonUserList *user_list)
 {
     CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
 
-    if (priv->have_users)
+    /* Watch for changes to user list */
+    g_autoptr(GFile) passwd_file = g_file_new_for_path (PASSWD_FILE);
+    g_autoptr(GError) e = NULL;
+    priv->passwd_monitor = g_file_monitor (passwd_file, G_FILE_MONITOR_NONE, NULL, &e);
+    if (e)
+        g_warning ("Error monitoring %s: %s", PASSWD_FILE, e->message);
+    else
+        g_signal_connect (priv->passwd_monitor, "changed", G_CALLBACK (passwd_changed_cb), user_list);
+}
+
+static void
+load_passwd_users (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (priv->user_added_signal)
+        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_added_signal);
+    priv->user_added_signal = 0;
+    if (priv->user_removed_signal)
+        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_removed_signal);
+    priv->user_removed_signal = 0;
+
+    load_passwd_file (user_list, priv->emit_load_signals);
+
+    /* When loading synchronously the monitor is created afterwards, so events go to the main context */
+    if (!priv->load_context)
+        monitor_passwd_file (user_list);
+}
+
+static void
+list_cached_users_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
         return;
+
+    CommonUserList *user_list = data;
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (error)
+        g_warning ("Error getting user list from org.freedesktop.Accounts: %s", error->message);
+    if (result)
+    {
+        g_debug ("Loading users from org.freedesktop.Accounts");
+        g_autoptr(GVariantIter) iter = NULL;
+        g_variant_get (result, "(ao)", &iter);
+        const gchar *path;
+        while (g_variant_iter_loop (iter, "&o", &path))
+            g_queue_push_tail (priv->pending_paths, g_strdup (path));
+        load_next_accounts_users (user_list);
+    }
+    else
+        load_passwd_users (user_list);
+
+    finish_loading (user_list);
+}
+
+/* Start loading users, with results delivered to the load context if set */
+static void
+start_loading_users (CommonUserList *user_list, gboolean emit_signals)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
     priv->have_users = TRUE;
+    priv->loading = TRUE;
+    priv->emit_load_signals = emit_signals;
+    priv->n_skipped = 0;
+
+    if (!priv->bus)
+    {
+        load_passwd_users (user_list);
+        finish_loading (user_list);
+        return;
+    }
+
+    /* Users found to be hidden are remembered over loads, the filter is read again in case it changed */
+    g_clear_pointer (&priv->filter, user_filter_free);
+    priv->filter = user_filter_load ();
+
+    /* Get user list from accounts service and fall back to /etc/passwd if that fails */
+    priv->user_added_signal = g_dbus_connection_signal_subscribe (priv->bus,
+                                                                  "org.freedesktop.Accounts",
+                                                                  "org.freedesktop.Accounts",
+                                                                  "UserAdded",
+                                                                  "/org/freedesktop/Accounts",
+                                                                  NULL,
+                                                                  G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                  accounts_user_added_cb,
+                                                                  user_list,
+                                                                  NULL);
+    priv->user_removed_signal = g_dbus_connection_signal_subscribe (priv->bus,
+                                                                    "org.freedesktop.Accounts",
+                                                                    "org.freedesktop.Accounts",
+                                                                    "UserDeleted",
+                                                                    "/org/freedesktop/Accounts",
+                                                                    NULL,
+                                                                    G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                    accounts_user_deleted_cb,
+                                                                    user_list,
+                                                                    NULL);
+
+    if (priv->load_context)
+        g_main_context_push_thread_default (priv->load_context);
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.Accounts",
+                            "/org/freedesktop/Accounts",
+                            "org.freedesktop.Accounts",
+                            "ListCachedUsers",
+                            g_variant_new ("()"),
+                            G_VARIANT_TYPE ("(ao)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            priv->load_cancellable,
+                            list_cached_users_cb,
+                            user_list);
+    if (priv->load_context)
+        g_main_context_pop_thread_default (priv->load_context);
+}
+
+static void
+load_users (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (priv->have_users)
+        return;
+
+    /* Wait for the results on a private context so nothing else runs while
+     * loading, but still have the requests for each user in flight at once */
+    priv->load_context = g_main_context_new ();
+    start_loading_users (user_list, FALSE);
+    g_main_context_push_thread_default (priv->load_context);
+    while (priv->loading)
+        g_main_context_iteration (priv->load_context, TRUE);
+    g_main_context_pop_thread_default (priv->load_context);
+    g_clear_pointer (&priv->load_context, g_main_context_unref);
+
+    /* Now watch for changes from the main context */
+    if (priv->user_added_signal)
+    {
+        for (GList *link = priv->users; link; link = link->next)
+            watch_accounts_user (link->data);
+    }
+    else
+        monitor_passwd_file (user_list);
+}
+
+/**
+ * common_user_list_load_async:
+ * @user_list: A #CommonUserList
+ *
+ * Start loading users without blocking, if they are not already loaded.  Users
+ * are added to the list (with the ::user-added signal) as they are loaded and
+ * the ::loaded signal is emitted once complete.  Until then the list only
+ * contains the users loaded so far.
+ **/
+void
+common_user_list_load_async (CommonUserList *user_list)
+{
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (priv->have_users)
+        return;
+
+    start_loading_users (user_list, TRUE);
+}
+
+/**
+ * common_user_list_get_update_time:
+ * @user_list: A #CommonUserList
+ *
+ * Get when the user information was read. For users loaded from a cache this
+ * is when the cache was written.
+ *
+ * Return value: The time as returned by g_get_real_time() or 0 if no users have been loaded.
+ **/
+gint64
+common_user_list_get_update_time (CommonUserList *user_list)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), 0);
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    return priv->update_time;
+}
+
+/**
+ * common_user_list_get_is_loaded:
+ * @user_list: A #CommonUserList
+ *
+ * Check if all the users have been loaded.
+ *
+ * Return value: #TRUE if the users are loaded.
+ **/
+gboolean
+common_user_list_get_is_loaded (CommonUserList *user_list)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), FALSE);
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    return priv->have_users && !priv->loading;
+}
+
+/**
+ * common_user_list_get_length:
+ * @user_list: a #CommonUserList
+ *
+ * Return value: The number of users able to log in
+ **/
+gint
+common_user_list_get_length (CommonUserList *user_list)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), 0);
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    load_users (user_list);
+    return g_list_length (priv->users);
+}
+
+/**
+ * common_user_list_get_users:
+ * @user_list: A #CommonUserList
+ *
+ * Get a list of users to present to the user.  This list may be a subset of the
+ * available users and may be empty depending on the server configuration.
+ *
+ * Return value: (element-type CommonUser) (transfer none): A list of #CommonUser that should be presented to the user.
+ **/
+GList *
+common_user_list_get_users (CommonUserList *user_list)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    load_users (user_list);
+    return priv->users;
+}
+
+/* Load a user ahead of the other users still being loaded */
+static CommonUser *
+find_accounts_user (CommonUserList *user_list, const gchar *username)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
+                                                              "org.freedesktop.Accounts",
+                                                              "/org/freedesktop/Accounts",
+                                                              "org.freedesktop.Accounts",
+                                                              "FindUserByName",
+                                                              g_variant_new ("(s)", username),
+                                                              G_VARIANT_TYPE ("(o)"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (!result)
+        return NULL;
+
+    const gchar *path;
+    g_variant_get (result, "(&o)", &path);
+
+    CommonUser *user = get_user_by_path (user_list, path);
+    if (user)
+        return user;
+
+    GList *link = g_queue_find_custom (priv->pending_paths, path, (GCompareFunc) g_strcmp0);
+    if (link)
+    {
+        g_free (link->data);
+        g_queue_delete_link (priv->pending_paths, link);
+    }
+    add_accounts_user (user_list, path, priv->emit_load_signals);
+
+    return get_user_by_path (user_list, path);
+}
+
+static void
+user_lookup_free (UserLookup *lookup)
+{
+    g_clear_object (&lookup->user);
+    g_free (lookup);
+}
+
+/* Each login looks up the same user several times and with a network
+ * directory each lookup can be slow, so remember the result (including
+ * users that don't exist) for a short time */
+static CommonUser *
+lookup_passwd_user (CommonUserList *user_list, const gchar *username)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    gint64 now = g_get_monotonic_time ();
+    UserLookup *lookup = g_hash_table_lookup (priv->lookup_cache, username);
+    if (lookup && now - lookup->time < USER_LOOKUP_TTL)
+        return lookup->user ? g_object_ref (lookup->user) : NULL;
+
+    lookup = g_new0 (UserLookup, 1);
+    lookup->time = now;
+    struct passwd *entry = getpwnam (username);
+    if (entry != NULL)
+    {
+        PasswdEntry *e = passwd_entry_new (entry);
+        lookup->user = make_passwd_user (user_list, e);
+        passwd_entry_free (e);
+    }
+    g_hash_table_insert (priv->lookup_cache, g_strdup (username), lookup);
+
+    return lookup->user ? g_object_ref (lookup->user) : NULL;
+}
+
+/**
+ * common_user_list_get_user_by_name:
+ * @user_list: A #CommonUserList
+ * @username: Name of user to get.
+ *
+ * Get information about a given user or #NULL if this user doesn't exist.
+ * Includes hidden and system users, unlike the list from
+ * common_user_list_get_users.
+ *
+ * Return value: (transfer full): A #CommonUser entry for the given user.
+ **/
+CommonUser *
+common_user_list_get_user_by_name (CommonUserList *user_list, const gchar *username)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
+    g_return_val_if_fail (username != NULL, NULL);
+
+    load_users (user_list);
+
+    CommonUser *user = get_user_by_name (user_list, username);
+    if (user)
+        return g_object_ref (user);
+
+    /* The user may not have been loaded yet */
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+    if (priv->loading && priv->user_added_signal)
+    {
+        user = find_accounts_user (user_list, username);
+        if (user)
+            return g_object_ref (user);
+    }
+
+    /* Sometimes we need to look up users that aren't in AccountsService.
+       Notably we need to look up the user that the greeter runs as, which
+       is usually 'lightdm'. For such cases, we manually create a one-off
+       CommonUser object and pre-seed with passwd info. */
+    return lookup_passwd_user (user_list, username);
+}
+
+static const gchar *
+empty_if_null (const gchar *value)
+{
+    return value ? value : "";
+}
+
+static GVariant *
+user_to_variant (CommonUser *user)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    return g_variant_new ("(sssssssbs^assbttb)",
+                          empty_if_null (priv->path),
+                          empty_if_null (priv->name),
+                          empty_if_null (priv->real_name),
+                          empty_if_null (priv->home_directory),
+                          empty_if_null (priv->shell),
+                          empty_if_null (priv->image),
+                          empty_if_null (priv->background),
+                          priv->loaded_dmrc,
+                          empty_if_null (priv->language),
+                          (gchar **) priv->layouts,
+                          empty_if_null (priv->session),
+                          priv->has_messages,
+                          priv->uid,
+                          priv->gid,
+                          priv->is_locked);
+}
+
+static gboolean
+set_string (gchar **field, const gchar *value)
+{
+    if (value[0] == '\0')
+        value = NULL;
+
+    if (g_strcmp0 (*field, value) == 0)
+        return FALSE;
+
+    g_free (*field);
+    *field = g_strdup (value);
+    return TRUE;
+}
+
+
+/* Update a user from a serialized user, returns TRUE if anything changed */
+static gboolean
+update_user_from_variant (CommonUserList *user_list, CommonUser *user, GVariant *value)
+{
+    CommonUserListPrivate *list_priv = common_user_list_get_instance_private (user_list);
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    const gchar *path, *name, *real_name, *home_directory, *shell, *image, *background, *language, *session;
+    gboolean loaded_dmrc, has_messages, is_locked;
+    g_auto(GStrv) layouts = NULL;
+    guint64 uid, gid;
+    g_variant_get (value, "(&s&s&s&s&s&s&sb&s^as&sbttb)",
+                   &path, &name, &real_name, &home_directory, &shell, &image, &background,
+                   &loaded_dmrc, &language, &layouts, &session,
+                   &has_messages, &uid, &gid, &is_locked);
+
+    gboolean changed = FALSE;
+    if (set_string (&priv->path, path))
+    {
+        /* Keep the bus so changes can be written back to the accounts service */
+        if (priv->path && !priv->bus && list_priv->bus)
+            priv->bus = g_object_ref (list_priv->bus);
+        changed = TRUE;
+    }
+    changed |= set_string (&priv->name, name);
+    changed |= set_string (&priv->real_name, real_name);
+    changed |= set_string (&priv->home_directory, home_directory);
+    changed |= set_interned_string (&priv->shell, shell);
+    changed |= set_string (&priv->image, image);
+    changed |= set_interned_string (&priv->background, background);
+    /* Leave the DMRC to be loaded locally if the sender hasn't loaded it */
+    if (loaded_dmrc || priv->path)
+    {
+        priv->loaded_dmrc = TRUE;
+        changed |= set_interned_string (&priv->language, language);
+        changed |= set_interned_string (&priv->session, session);
+        changed |= set_interned_strv (&priv->layouts, (const gchar **) layouts);
+    }
+    if (priv->has_messages != has_messages)
+    {
+        priv->has_messages = has_messages;
+        changed = TRUE;
+    }
+    if (priv->uid != uid || priv->gid != gid || priv->is_locked != is_locked)
+    {
+        priv->uid = uid;
+        priv->gid = gid;
+        priv->is_locked = is_locked;
+        changed = TRUE;
+    }
+
+    return changed;
+}
+
+/* Update a user loaded from the cache with the current information, returns TRUE if anything changed */
+static gboolean
+update_cached_user (CommonUserList *user_list, CommonUser *user, CommonUser *loaded_user)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+    CommonUserPrivate *loaded_priv = common_user_get_instance_private (loaded_user);
+
+    /* Keep the cached values of properties still to be fetched */
+    if (loaded_priv->extra_pending)
+    {
+        loaded_priv->background = priv->background;
+        loaded_priv->layouts = priv->layouts;
+        loaded_priv->has_messages = priv->has_messages;
+    }
+
+    g_autoptr(GVariant) value = g_variant_ref_sink (user_to_variant (loaded_user));
+    priv->cached = FALSE;
+    priv->extra_pending = loaded_priv->extra_pending;
+    return update_user_from_variant (user_list, user, value);
+}
+
+static CommonUser *
+make_variant_user (CommonUserList *user_list, GVariant *value)
+{
+    CommonUser *user = g_object_new (COMMON_TYPE_USER, NULL);
+
+    update_user_from_variant (user_list, user, value);
+    g_signal_connect (user, USER_SIGNAL_CHANGED, G_CALLBACK (user_changed_cb), user_list);
+    g_signal_connect (user, "get-logged-in", G_CALLBACK (get_logged_in_cb), user_list);
+
+    return user;
+}
+
+/* Stop watching the accounts service and password file, the user list is being provided for us */
+static void
+stop_monitoring (CommonUserList *user_list)
+{
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (priv->user_added_signal)
+        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_added_signal);
+    priv->user_added_signal = 0;
+    if (priv->user_removed_signal)
+        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_removed_signal);
+    priv->user_removed_signal = 0;
+    g_clear_object (&priv->passwd_monitor);
+    if (priv->passwd_reload_timeout)
+        g_source_remove (priv->passwd_reload_timeout);
+    priv->passwd_reload_timeout = 0;
+    priv->passwd_reload_pending = FALSE;
+
+    /* Drop any users still being loaded */
+    g_cancellable_cancel (priv->load_cancellable);
+    g_object_unref (priv->load_cancellable);
+    priv->load_cancellable = g_cancellable_new ();
+    while (!g_queue_is_empty (priv->pending_paths))
+        g_free (g_queue_pop_head (priv->pending_paths));
+    priv->n_loading = 0;
+    priv->loading = FALSE;
+    while (!g_queue_is_empty (priv->extra_pending_users))
+        g_object_unref (g_queue_pop_head (priv->extra_pending_users));
+    priv->n_loading_extra = 0;
+    if (priv->extra_fill_idle)
+        g_source_remove (priv->extra_fill_idle);
+    priv->extra_fill_idle = 0;
+
+    for (GList *link = priv->users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+        if (user_priv->changed_signal)
+            g_dbus_connection_signal_unsubscribe (user_priv->bus, user_priv->changed_signal);
+        user_priv->changed_signal = 0;
+    }
+}
+
+static GBytes *
+variant_to_bytes (GVariant *value)
+{
+    g_autoptr(GVariant) v = g_variant_ref_sink (value);
+    return g_bytes_new (g_variant_get_data (v), g_variant_get_size (v));
+}
+
+static GVariant *
+bytes_to_variant (GBytes *data, const gchar *type)
+{
+    /* Data comes from another process so check it is valid */
+    return g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (type), data, FALSE));
+}
+
+static void
+set_sent_value (CommonUser *user, GVariant *value)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    g_clear_pointer (&priv->sent_value, g_variant_unref);
+    priv->sent_value = value;
+}
+
+/* Work out which fields have changed since the user was last passed to another process */
+static void
+update_changes (CommonUser *user)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    g_clear_pointer (&priv->changes, g_bytes_unref);
+    if (!priv->sent_value)
+        return;
+
+    GVariant *value = g_variant_ref_sink (user_to_variant (user));
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    gboolean changed = FALSE;
+    for (gsize i = 0; i < G_N_ELEMENTS (user_field_names); i++)
+    {
+        g_autoptr(GVariant) sent_field = g_variant_get_child_value (priv->sent_value, i);
+        g_autoptr(GVariant) field = g_variant_get_child_value (value, i);
+        if (g_variant_equal (sent_field, field))
+            continue;
+
+        g_variant_builder_add (&builder, "{sv}", user_field_names[i], field);
+        changed = TRUE;
+    }
+
+    /* The other process knows the user by the name it was sent */
+    if (changed)
+    {
+        const gchar *name;
+        g_variant_get_child (priv->sent_value, 1, "&s", &name);
+        priv->changes = variant_to_bytes (g_variant_new ("(s@a{sv})", name, g_variant_builder_end (&builder)));
+    }
+    else
+        g_variant_builder_clear (&builder);
+
+    set_sent_value (user, value);
+}
+
+/**
+ * common_user_list_get_snapshot:
+ * @user_list: A #CommonUserList
+ *
+ * Get a serialized copy of the users in this list, suitable for passing to
+ * common_user_list_load_snapshot() in another process.  Changes to the users
+ * from common_user_get_changes() are relative to this copy.
+ *
+ * Return value: (transfer full): The serialized user list.
+ **/
+GBytes *
+common_user_list_get_snapshot (CommonUserList *user_list)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    load_users (user_list);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE (USER_LIST_VARIANT_TYPE));
+    for (GList *link = priv->users; link; link = link->next)
+        g_variant_builder_add_value (&builder, user_to_variant (link->data));
+    g_autoptr(GVariant) users = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+    /* Serialize first so the copy each user keeps is part of the snapshot data */
+    GBytes *snapshot = g_variant_get_data_as_bytes (users);
+    gsize i = 0;
+    for (GList *link = priv->users; link; link = link->next, i++)
+        set_sent_value (link->data, g_variant_get_child_value (users, i));
+
+    return snapshot;
+}
+
+/**
+ * common_user_list_load_snapshot:
+ * @user_list: A #CommonUserList
+ * @snapshot: A user list from common_user_list_get_snapshot()
+ *
+ * Replace the users in this list with a serialized copy.  The accounts
+ * service and password file are no longer consulted; further changes are
+ * expected through common_user_list_update_user() and
+ * common_user_list_remove_user().
+ **/
+void
+common_user_list_load_snapshot (CommonUserList *user_list, GBytes *snapshot)
+{
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
+    g_return_if_fail (snapshot != NULL);
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    stop_monitoring (user_list);
+
+    /* Only notify if we had loaded the user list */
+    gboolean emit_signals = priv->have_users;
+    priv->have_users = TRUE;
+    priv->update_time = g_get_real_time ();
+
+    g_autoptr(GVariant) users_value = bytes_to_variant (snapshot, USER_LIST_VARIANT_TYPE);
+    g_debug ("Loading %zu users from snapshot", g_variant_n_children (users_value));
+
+    g_autoptr(GHashTable) loaded_users = g_hash_table_new (g_direct_hash, g_direct_equal);
+    GList *users = NULL, *new_users = NULL, *changed_users = NULL;
+    GVariantIter iter;
+    g_variant_iter_init (&iter, users_value);
+    GVariant *value;
+    while ((value = g_variant_iter_next_value (&iter)))
+    {
+        const gchar *name;
+        g_variant_get_child (value, 1, "&s", &name);
+
+        CommonUser *user = get_user_by_name (user_list, name);
+        if (user && !g_hash_table_contains (loaded_users, user))
+        {
+            g_hash_table_add (loaded_users, user);
+            if (update_user_from_variant (user_list, user, value))
+                changed_users = g_list_prepend (changed_users, user);
+        }
+        else
+        {
+            user = make_variant_user (user_list, value);
+            new_users = g_list_prepend (new_users, user);
+        }
+        users = g_list_prepend (users, user);
+        g_variant_unref (value);
+    }
+    GList *old_users = set_users (user_list, g_list_sort (users, compare_user));
+
+    /* Notify of changes */
+    for (GList *link = new_users; link; link = link->next)
+    {
+        CommonUser *info = link->data;
+        if (emit_signals)
+            g_signal_emit (user_list, list_signals[USER_ADDED], 0, info);
+    }
+    g_list_free (new_users);
+    for (GList *link = changed_users; link; link = link->next)
+    {
+        CommonUser *info = link->data;
+        if (emit_signals)
+            g_signal_emit (info, user_signals[CHANGED], 0);
+    }
+    g_list_free (changed_users);
+    for (GList *link = old_users; link; link = link->next)
+    {
+        CommonUser *info = link->data;
+        if (g_hash_table_contains (loaded_users, info))
+            continue;
+        g_debug ("User %s removed", common_user_get_name (info));
+        g_signal_emit (user_list, list_signals[USER_REMOVED], 0, info);
+        g_object_unref (info);
+    }
+    g_list_free (old_users);
+}
+
+/**
+ * common_user_list_load_cache:
+ * @user_list: A #CommonUserList
+ * @filename: File written with common_user_list_save_cache()
+ *
+ * Fill an empty list with the users saved in a cache file, to use until the
+ * users are loaded.  The file is mapped rather than read.  Once the users are
+ * loaded any cached users that no longer exist are removed.
+ *
+ * Return value: #TRUE if users were loaded from the cache.
+ **/
+gboolean
+common_user_list_load_cache (CommonUserList *user_list, const gchar *filename)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), FALSE);
+    g_return_val_if_fail (filename != NULL, FALSE);
+
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
+
+    if (priv->have_users || priv->users)
+        return FALSE;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMappedFile) file = g_mapped_file_new (filename, FALSE, &error);
+    if (error && !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Failed to load user cache %s: %s", filename, error->message);
+    if (!file)
+        return FALSE;
+
+    g_autoptr(GBytes) data = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) users_value = bytes_to_variant (data, USER_LIST_VARIANT_TYPE);
+    GList *users = NULL;
+    GVariantIter iter;
+    g_variant_iter_init (&iter, users_value);
+    GVariant *value;
+    while ((value = g_variant_iter_next_value (&iter)))
+    {
+        CommonUser *user = make_variant_user (user_list, value);
+        CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+        user_priv->cached = TRUE;
+        users = g_list_prepend (users, user);
+        g_variant_unref (value);
+    }
+    g_list_free (set_users (user_list, g_list_sort (users, compare_user)));
+
+    /* The users are as old as the cache */
+    GStatBuf info;
+    if (g_stat (filename, &info) == 0)
+        priv->update_time = (gint64) info.st_mtime * G_USEC_PER_SEC;
+
+    g_debug ("Loaded %u users from cache %s", g_list_length (priv->users), filename);
+
+    return priv->users != NULL;
+}
+
+/**
+ * common_user_list_save_cache:
+ * @user_list: A #CommonUserList
+ * @filename: File to write
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save the users to a file for use with common_user_list_load_cache().
+ *
+ * Return value: #TRUE if the cache was written.
+ **/
+gboolean
+common_user_list_save_cache (CommonUserList *user_list, const gchar *filename, GError **error)
+{
+    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), FALSE);
+    g_return_val_if_fail (filename != NULL, FALSE);
+
+    g_autoptr(GBytes) snapshot = common_user_list_get_snapshot (user_list);
+    gsize length;
+    const gchar *data = g_bytes_get_data (snapshot, &length);
+    return g_file_set_contents (filename, data, length, error);
+}
+
+/**
+ * common_user_serialize:
+ * @user: A #CommonUser
+ *
+ * Get a serialized copy of a user, suitable for passing to
+ * common_user_list_update_user() in another process.  Changes to the user
+ * from common_user_get_changes() are relative to this copy.
+ *
+ * Return value: (transfer full): The serialized user.
+ **/
+GBytes *
+common_user_serialize (CommonUser *user)
+{
+    g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+
+    GVariant *value = g_variant_ref_sink (user_to_variant (user));
+    GBytes *data = g_variant_get_data_as_bytes (value);
+    set_sent_value (user, value);
+
+    return data;
+}
+
+/**
+ * common_user_get_changes:
+ * @user: A #CommonUser
+ *
+ * Get the fields that changed in the last ::changed signal, suitable for
+ * passing to common_user_list_apply_changes() in another process that has
+ * the copy of this user from common_user_serialize() or
+ * common_user_list_get_snapshot().
+ *
+ * Return value: (transfer full): The serialized changes or %NULL if nothing changed or the user has not been serialized.
+ **/
+GBytes *
+common_user_get_changes (CommonUser *user)
+{
+    g_return_val_if_fail (COMMON_IS_USER (user), NULL);
+
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+    return priv->changes ? g_bytes_ref (priv->changes) : NULL;
+}
+
+/**
+ * common_user_list_update_user:
+ * @user_list: A #CommonUserList
+ * @data: A user from common_user_serialize()
+ *
+ * Add a serialized user to the list, or update the user of the same name.
+ **/
+void
+common_user_list_update_user (CommonUserList *user_list, GBytes *data)
+{
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
+    g_return_if_fail (data != NULL);
 
-    /* Get user list from accounts service and fall back to /etc/passwd if that fails */
-    priv->user_added_signal = g_dbus_connection_signal_subscribe (priv->bus,
-                                                                  "org.freedesktop.Accounts",
-                                                                  "org.freedesktop.Accounts",
-                                                                  "UserAdded",
-                                                                  "/org/freedesktop/Accounts",
-                                                                  NULL,
-                                                                  G_DBUS_SIGNAL_FLAGS_NONE,
-                                                                  accounts_user_added_cb,
-                                                                  user_list,
-                                                                  NULL);
-    priv->user_removed_signal = g_dbus_connection_signal_subscribe (priv->bus,
-                                                                    "org.freedesktop.Accounts",
-                                                                    "org.freedesktop.Accounts",
-                                                                    "UserDeleted",
-                                                                    "/org/freedesktop/Accounts",
-                                                                    NULL,
-                                                                    G_DBUS_SIGNAL_FLAGS_NONE,
-                                                                    accounts_user_deleted_cb,
-                                                                    user_list,
-                                                                    NULL);
+    g_autoptr(GVariant) value = bytes_to_variant (data, USER_VARIANT_TYPE);
+    const gchar *name;
+    g_variant_get_child (value, 1, "&s", &name);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->bus,
-                                                              "org.freedesktop.Accounts",
-                                                              "/org/freedesktop/Accounts",
-                                                              "org.freedesktop.Accounts",
-                                                              "ListCachedUsers",
-                                                              g_variant_new ("()"),
-                                                              G_VARIANT_TYPE ("(ao)"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error getting user list from org.freedesktop.Accounts: %s", error->message);
-    if (result)
+    CommonUser *user = get_user_by_name (user_list, name);
+    if (user)
     {
-        g_debug ("Loading users from org.freedesktop.Accounts");
-        g_autoptr(GVariantIter) iter = NULL;
-        g_variant_get (result, "(ao)", &iter);
-        const gchar *path;
-        while (g_variant_iter_loop (iter, "&o", &path))
-            add_accounts_user (user_list, path, FALSE);
+        if (update_user_from_variant (user_list, user, value))
+        {
+            g_debug ("User %s changed", name);
+            g_signal_emit (user, user_signals[CHANGED], 0);
+        }
     }
     else
     {
-        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_added_signal);
-        priv->user_added_signal = 0;
-        g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_removed_signal);
-        priv->user_removed_signal = 0;
-
-        load_passwd_file (user_list, FALSE);
-
-        /* Watch for changes to user list */
-        g_autoptr(GFile) passwd_file = g_file_new_for_path (PASSWD_FILE);
-        g_autoptr(GError) e = NULL;
-        priv->passwd_monitor = g_file_monitor (passwd_file, G_FILE_MONITOR_NONE, NULL, &e);
-        if (e)
-            g_warning ("Error monitoring %s: %s", PASSWD_FILE, e->message);
-        else
-            g_signal_connect (priv->passwd_monitor, "changed", G_CALLBACK (passwd_changed_cb), user_list);
+        g_debug ("User %s added", name);
+        user = make_variant_user (user_list, value);
+        insert_user (user_list, user);
+        g_signal_emit (user_list, list_signals[USER_ADDED], 0, user);
     }
 }
 
 /**
- * common_user_list_get_length:
- * @user_list: a #CommonUserList
+ * common_user_list_apply_changes:
+ * @user_list: A #CommonUserList
+ * @changes: Changes to a user from common_user_get_changes()
  *
- * Return value: The number of users able to log in
+ * Update a user in a list loaded with common_user_list_load_snapshot().
  **/
-gint
-common_user_list_get_length (CommonUserList *user_list)
+void
+common_user_list_apply_changes (CommonUserList *user_list, GBytes *changes)
 {
-    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), 0);
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
+    g_return_if_fail (changes != NULL);
 
-    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
-    load_users (user_list);
-    return g_list_length (priv->users);
+    g_autoptr(GVariant) value = bytes_to_variant (changes, USER_CHANGES_VARIANT_TYPE);
+    const gchar *name;
+    g_autoptr(GVariant) fields = NULL;
+    g_variant_get (value, "(&s@a{sv})", &name, &fields);
+
+    CommonUser *user = get_user_by_name (user_list, name);
+    if (!user)
+    {
+        g_debug ("Ignoring changes to unknown user %s", name);
+        return;
+    }
+
+    /* Replace the changed fields, ignoring any with the wrong type */
+    g_autoptr(GVariant) current = g_variant_ref_sink (user_to_variant (user));
+    GVariant *children[G_N_ELEMENTS (user_field_names)];
+    for (gsize i = 0; i < G_N_ELEMENTS (user_field_names); i++)
+    {
+        children[i] = g_variant_get_child_value (current, i);
+        GVariant *field = g_variant_lookup_value (fields, user_field_names[i], g_variant_get_type (children[i]));
+        if (field)
+        {
+            g_variant_unref (children[i]);
+            children[i] = field;
+        }
+    }
+    g_autoptr(GVariant) updated = g_variant_ref_sink (g_variant_new_tuple (children, G_N_ELEMENTS (children)));
+    for (gsize i = 0; i < G_N_ELEMENTS (children); i++)
+        g_variant_unref (children[i]);
+
+    if (update_user_from_variant (user_list, user, updated))
+    {
+        g_debug ("User %s changed", name);
+        g_signal_emit (user, user_signals[CHANGED], 0);
+    }
 }
 
 /**
- * common_user_list_get_users:
+ * common_user_list_remove_user:
  * @user_list: A #CommonUserList
+ * @username: Name of user to remove.
  *
- * Get a list of users to present to the user.  This list may be a subset of the
- * available users and may be empty depending on the server configuration.
- *
- * Return value: (element-type CommonUser) (transfer none): A list of #CommonUser that should be presented to the user.
+ * Remove a user from a list loaded with common_user_list_load_snapshot().
  **/
-GList *
-common_user_list_get_users (CommonUserList *user_list)
+void
+common_user_list_remove_user (CommonUserList *user_list, const gchar *username)
 {
-    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
+    g_return_if_fail (username != NULL);
 
-    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
-    load_users (user_list);
-    return priv->users;
+    CommonUser *user = get_user_by_name (user_list, username);
+    if (!user)
+        return;
+
+    g_debug ("User %s removed", username);
+    remove_user (user_list, user);
+    g_signal_emit (user_list, list_signals[USER_REMOVED], 0, user);
+    g_object_unref (user);
 }
 
+static DmrcLoad *start_dmrc_load (CommonUser *user);
+
 /**
- * common_user_list_get_user_by_name:
+ * common_user_list_prefetch_dmrc:
  * @user_list: A #CommonUserList
- * @username: Name of user to get.
- *
- * Get information about a given user or #NULL if this user doesn't exist.
- * Includes hidden and system users, unlike the list from
- * common_user_list_get_users.
  *
- * Return value: (transfer full): A #CommonUser entry for the given user.
+ * Start reading the .dmrc files for all users in the background, so their
+ * language, layout and session are ready when requested.  Users are updated
+ * (with the ::changed signal) as the files are read.  This has no effect on
+ * users from the accounts service.
  **/
-CommonUser *
-common_user_list_get_user_by_name (CommonUserList *user_list, const gchar *username)
+void
+common_user_list_prefetch_dmrc (CommonUserList *user_list)
 {
-    g_return_val_if_fail (COMMON_IS_USER_LIST (user_list), NULL);
-    g_return_val_if_fail (username != NULL, NULL);
-
-    load_users (user_list);
-
-    CommonUser *user = get_user_by_name (user_list, username);
-    if (user)
-        return g_object_ref (user);
+    g_return_if_fail (COMMON_IS_USER_LIST (user_list));
 
-    /* Sometimes we need to look up users that aren't in AccountsService.
-       Notably we need to look up the user that the greeter runs as, which
-       is usually 'lightdm'. For such cases, we manually create a one-off
-       CommonUser object and pre-seed with passwd info. */
-    struct passwd *entry = getpwnam (username);
-    if (entry != NULL)
-        return make_passwd_user (user_list, entry);
+    CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
 
-    return NULL;
+    for (GList *link = priv->users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        CommonUserPrivate *user_priv = common_user_get_instance_private (user);
+        if (!user_priv->path)
+            start_dmrc_load (user);
+    }
 }
 
 static void
@@ -1006,6 +2741,15 @@ common_user_list_init (CommonUserList *user_list)
     CommonUserListPrivate *priv = common_user_list_get_instance_private (user_list);
 
     priv->bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+    priv->users_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->users_by_path = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->sessions = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_object_unref);
+    priv->session_counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->lookup_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) user_lookup_free);
+    priv->hidden_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->pending_paths = g_queue_new ();
+    priv->extra_pending_users = g_queue_new ();
+    priv->load_cancellable = g_cancellable_new ();
 }
 
 static void
@@ -1042,9 +2786,23 @@ common_user_list_finalize (GObject *object)
     CommonUserList *self = COMMON_USER_LIST (object);
     CommonUserListPrivate *priv = common_user_list_get_instance_private (self);
 
+    /* Stop any loads in progress */
+    g_cancellable_cancel (priv->load_cancellable);
+    g_object_unref (priv->load_cancellable);
+    g_queue_free_full (priv->pending_paths, g_free);
+    g_queue_free_full (priv->extra_pending_users, g_object_unref);
+    if (priv->extra_fill_idle)
+        g_source_remove (priv->extra_fill_idle);
+
     /* Remove children first, they might access us */
+    g_hash_table_unref (priv->users_by_name);
+    g_hash_table_unref (priv->users_by_path);
+    g_hash_table_unref (priv->lookup_cache);
+    g_hash_table_unref (priv->hidden_paths);
+    g_clear_pointer (&priv->filter, user_filter_free);
     g_list_free_full (priv->users, g_object_unref);
-    g_list_free_full (priv->sessions, g_object_unref);
+    g_hash_table_unref (priv->sessions);
+    g_hash_table_unref (priv->session_counts);
 
     if (priv->user_added_signal)
         g_dbus_connection_signal_unsubscribe (priv->bus, priv->user_added_signal);
@@ -1056,6 +2814,8 @@ common_user_list_finalize (GObject *object)
         g_dbus_connection_signal_unsubscribe (priv->bus, priv->session_removed_signal);
     g_object_unref (priv->bus);
     g_clear_object (&priv->passwd_monitor);
+    if (priv->passwd_reload_timeout)
+        g_source_remove (priv->passwd_reload_timeout);
 
     G_OBJECT_CLASS (common_user_list_parent_class)->finalize (object);
 }
@@ -1123,45 +2883,277 @@ common_user_list_class_init (CommonUserListClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 1, COMMON_TYPE_USER);
+
+    /**
+     * CommonUserList::loaded:
+     * @user_list: A #CommonUserList
+     *
+     * The ::loaded signal gets emitted when users started loading with
+     * common_user_list_load_async() have all been loaded.
+     **/
+    list_signals[LOADED] =
+        g_signal_new (USER_LIST_SIGNAL_LOADED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (CommonUserListClass, loaded),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
 }
 
-static gboolean
-call_method (CommonUser *user, const gchar *method, GVariant *args,
-             const gchar *expected, GVariant **result)
+static void
+call_method_cb (GObject *object, GAsyncResult *result, gpointer data)
 {
-    CommonUserPrivate *priv = common_user_get_instance_private (user);
+    g_autofree gchar *method = data;
 
     g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) answer = g_dbus_connection_call_sync (priv->bus,
-                                                              "org.freedesktop.Accounts",
-                                                              priv->path,
-                                                              "org.freedesktop.Accounts.User",
-                                                              method,
-                                                              args,
-                                                              G_VARIANT_TYPE (expected),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
+    g_autoptr(GVariant) answer = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
     if (error)
         g_warning ("Could not call %s: %s", method, error->message);
+}
 
-    if (!answer)
-        return FALSE;
+/* Call a method on the accounts service without waiting for the result */
+static void
+call_method (CommonUser *user, const gchar *method, GVariant *args)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
 
-    if (result)
-        *result = g_steal_pointer (&answer);
+    if (!priv->bus || !priv->path)
+    {
+        g_variant_unref (g_variant_ref_sink (args));
+        return;
+    }
+
+    g_dbus_connection_call (priv->bus,
+                            "org.freedesktop.Accounts",
+                            priv->path,
+                            "org.freedesktop.Accounts.User",
+                            method,
+                            args,
+                            G_VARIANT_TYPE ("()"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            call_method_cb,
+                            g_strdup (method));
+}
+
+typedef struct
+{
+    gchar *home_directory;
+    gchar *username;
+    uid_t uid;
+    gid_t gid;
+    GKeyFile *changes;
+} DmrcUpdate;
+
+static void
+dmrc_update_free (DmrcUpdate *update)
+{
+    g_free (update->home_directory);
+    g_free (update->username);
+    g_key_file_unref (update->changes);
+    g_free (update);
+}
 
+static gboolean
+dmrc_update_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    DmrcUpdate *update = data;
+    dmrc_update (update->home_directory, update->username, update->uid, update->gid, update->changes);
     return TRUE;
 }
 
+/* Changes are held for this many seconds if nobody asks for them to be saved sooner */
+#define SAVE_TIMEOUT 5
+
+static gboolean
+save_timeout_cb (gpointer data)
+{
+    CommonUser *user = data;
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    priv->save_timeout = 0;
+    common_user_save_changes (user);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_save (CommonUser *user)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    if (priv->save_timeout == 0)
+        priv->save_timeout = g_timeout_add_seconds (SAVE_TIMEOUT, save_timeout_cb, user);
+}
+
+/**
+ * common_user_save_changes:
+ * @user: A #CommonUser
+ *
+ * Start writing the language and session set on this user to the accounts
+ * service and the DMRC file. Changes are held until this is called so that
+ * several are written together, and are saved after a short time otherwise.
+ **/
+void
+common_user_save_changes (CommonUser *user)
+{
+    g_return_if_fail (COMMON_IS_USER (user));
+
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    if (priv->save_timeout)
+        g_source_remove (priv->save_timeout);
+    priv->save_timeout = 0;
+
+    if (!priv->pending_language && !priv->pending_session)
+        return;
+
+    DmrcUpdate *update = g_new0 (DmrcUpdate, 1);
+    update->home_directory = g_strdup (common_user_get_home_directory (user));
+    update->username = g_strdup (common_user_get_name (user));
+    update->uid = common_user_get_uid (user);
+    update->gid = common_user_get_gid (user);
+    update->changes = g_key_file_new ();
+
+    if (priv->pending_language)
+    {
+        call_method (user, "SetLanguage", g_variant_new ("(s)", priv->pending_language));
+        g_key_file_set_string (update->changes, "Desktop", "Language", priv->pending_language);
+    }
+    if (priv->pending_session)
+    {
+        call_method (user, "SetXSession", g_variant_new ("(s)", priv->pending_session));
+        g_key_file_set_string (update->changes, "Desktop", "Session", priv->pending_session);
+    }
+
+    g_clear_pointer (&priv->pending_language, g_free);
+    g_clear_pointer (&priv->pending_session, g_free);
+
+    /* Writing to the home directory can block (e.g. NFS), so do it in the background */
+    worker_run (dmrc_update_thread, update, (GDestroyNotify) dmrc_update_free, NULL, NULL, NULL);
+}
+
+static DmrcLoad *
+dmrc_load_ref (DmrcLoad *load)
+{
+    g_atomic_int_inc (&load->ref_count);
+    return load;
+}
+
+static void
+dmrc_load_unref (DmrcLoad *load)
+{
+    if (!g_atomic_int_dec_and_test (&load->ref_count))
+        return;
+
+    g_object_unref (load->user);
+    g_main_context_unref (load->context);
+    g_free (load->home_directory);
+    g_free (load->cache_path);
+    if (load->dmrc)
+        g_key_file_unref (load->dmrc);
+    g_free (load);
+}
+
+/* Set language/layout/session info from a .dmrc, returns TRUE if anything changed */
+static gboolean
+apply_dmrc (CommonUser *user, GKeyFile *dmrc)
+{
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    gboolean changed = FALSE;
+
+    /* The Language field contains the locale */
+    g_autofree gchar *language = g_key_file_get_string (dmrc, "Desktop", "Language", NULL);
+    changed |= set_interned_string (&priv->language, language);
+
+    if (g_key_file_has_key (dmrc, "Desktop", "Layout", NULL))
+    {
+        g_autofree gchar *layout = g_key_file_get_string (dmrc, "Desktop", "Layout", NULL);
+        const gchar *layouts[] = { layout, NULL };
+        changed |= set_interned_strv (&priv->layouts, layouts);
+    }
+
+    g_autofree gchar *session = g_key_file_get_string (dmrc, "Desktop", "Session", NULL);
+    changed |= set_interned_string (&priv->session, session);
+
+    return changed;
+}
+
+static gboolean
+dmrc_load_done_cb (gpointer data)
+{
+    DmrcLoad *load = data;
+    CommonUserPrivate *priv = common_user_get_instance_private (load->user);
+
+    if (priv->dmrc_load == load)
+        priv->dmrc_load = NULL;
+
+    /* Update the user if this arrived after we stopped waiting for it */
+    if (!load->applied && load->dmrc)
+    {
+        priv->loaded_dmrc = TRUE;
+        if (apply_dmrc (load->user, load->dmrc))
+            g_signal_emit (load->user, user_signals[CHANGED], 0);
+    }
+    load->applied = TRUE;
+
+    return G_SOURCE_REMOVE;
+}
+
 static void
-save_string_to_dmrc (CommonUser *user, const gchar *group,
-                     const gchar *key, const gchar *value)
+dmrc_thread_func (gpointer data, gpointer user_data)
+{
+    DmrcLoad *load = data;
+
+    /* This may block for a long time if the home directory is on a slow network
+     * share, so fall back to the cached copy if it can't be read */
+    GKeyFile *dmrc = dmrc_read (load->home_directory, load->uid, load->check_owner);
+    if (!dmrc)
+    {
+        dmrc = g_key_file_new ();
+        if (!g_key_file_load_from_file (dmrc, load->cache_path, G_KEY_FILE_KEEP_COMMENTS, NULL))
+            g_clear_pointer (&dmrc, g_key_file_unref);
+    }
+
+    g_mutex_lock (&dmrc_mutex);
+    load->dmrc = dmrc;
+    load->done = TRUE;
+    g_cond_broadcast (&dmrc_cond);
+    g_mutex_unlock (&dmrc_mutex);
+
+    g_main_context_invoke_full (load->context, G_PRIORITY_DEFAULT, dmrc_load_done_cb, load, (GDestroyNotify) dmrc_load_unref);
+}
+
+/* Start reading the .dmrc for a user in the background */
+static DmrcLoad *
+start_dmrc_load (CommonUser *user)
 {
-    g_autoptr(GKeyFile) dmrc = dmrc_load (user);
-    g_key_file_set_string (dmrc, group, key, value);
-    dmrc_save (dmrc, user);
+    CommonUserPrivate *priv = common_user_get_instance_private (user);
+
+    if (priv->dmrc_load)
+        return priv->dmrc_load;
+
+    if (!dmrc_pool)
+        dmrc_pool = g_thread_pool_new (dmrc_thread_func, NULL, MAX_DMRC_THREADS, FALSE, NULL);
+
+    DmrcLoad *load = g_malloc0 (sizeof (DmrcLoad));
+    load->ref_count = 1;
+    load->user = g_object_ref (user);
+    load->context = g_main_context_ref_thread_default ();
+    load->home_directory = g_strdup (priv->home_directory);
+    load->uid = priv->uid;
+    /* Checked here as the main thread may drop privileges while the file is read */
+    load->check_owner = geteuid () == 0;
+    load->cache_path = dmrc_get_cache_path (priv->name);
+    priv->dmrc_load = load;
+
+    /* The thread holds the reference until the result has been reported */
+    g_thread_pool_push (dmrc_pool, load, NULL);
+
+    return load;
 }
 
 /* Loads language/layout/session info for user */
@@ -1177,24 +3169,35 @@ load_dmrc (CommonUser *user)
     if (priv->loaded_dmrc)
         return;
     priv->loaded_dmrc = TRUE;
-    g_autoptr(GKeyFile) dmrc = dmrc_load (user);
 
     // FIXME: Watch for changes
 
-    /* The Language field contains the locale */
-    g_free (priv->language);
-    priv->language = g_key_file_get_string (dmrc, "Desktop", "Language", NULL);
-
-    if (g_key_file_has_key (dmrc, "Desktop", "Layout", NULL))
+    /* Wait for the file to be read, but don't let an unresponsive home directory hold us up */
+    DmrcLoad *load = dmrc_load_ref (start_dmrc_load (user));
+    gint64 end_time = g_get_monotonic_time () + DMRC_LOAD_TIMEOUT * G_TIME_SPAN_MILLISECOND;
+    g_mutex_lock (&dmrc_mutex);
+    while (!load->done)
     {
-        g_strfreev (priv->layouts);
-        priv->layouts = g_malloc (sizeof (gchar *) * 2);
-        priv->layouts[0] = g_key_file_get_string (dmrc, "Desktop", "Layout", NULL);
-        priv->layouts[1] = NULL;
+        if (!g_cond_wait_until (&dmrc_cond, &dmrc_mutex, end_time))
+            break;
     }
+    gboolean done = load->done;
+    g_mutex_unlock (&dmrc_mutex);
 
-    g_free (priv->session);
-    priv->session = g_key_file_get_string (dmrc, "Desktop", "Session", NULL);
+    if (done)
+    {
+        if (load->dmrc)
+            apply_dmrc (user, load->dmrc);
+        load->applied = TRUE;
+    }
+    else
+    {
+        g_debug ("Timed out reading .dmrc for user %s, using cached copy", priv->name);
+        g_autoptr(GKeyFile) dmrc = g_key_file_new ();
+        if (g_key_file_load_from_file (dmrc, load->cache_path, G_KEY_FILE_KEEP_COMMENTS, NULL))
+            apply_dmrc (user, dmrc);
+    }
+    dmrc_load_unref (load);
 }
 
 /**
@@ -1316,6 +3319,7 @@ common_user_get_background (CommonUser *user)
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
 
     CommonUserPrivate *priv = common_user_get_instance_private (user);
+    load_extra_properties (user);
     return priv->background;
 }
 
@@ -1333,6 +3337,8 @@ common_user_get_language (CommonUser *user)
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
 
     CommonUserPrivate *priv = common_user_get_instance_private (user);
+    if (priv->pending_language)
+        return priv->pending_language[0] == 0 ? NULL : priv->pending_language;
     load_dmrc (user);
     const gchar *language = priv->language;
     return (language && language[0] == 0) ? NULL : language; /* Treat "" as NULL */
@@ -1351,8 +3357,10 @@ common_user_set_language (CommonUser *user, const gchar *language)
     g_return_if_fail (COMMON_IS_USER (user));
     if (g_strcmp0 (common_user_get_language (user), language) != 0)
     {
-        call_method (user, "SetLanguage", g_variant_new ("(s)", language), "()", NULL);
-        save_string_to_dmrc (user, "Desktop", "Language", language);
+        CommonUserPrivate *priv = common_user_get_instance_private (user);
+        g_free (priv->pending_language);
+        priv->pending_language = g_strdup (language);
+        schedule_save (user);
     }
 }
 
@@ -1371,6 +3379,7 @@ common_user_get_layout (CommonUser *user)
 
     CommonUserPrivate *priv = common_user_get_instance_private (user);
     load_dmrc (user);
+    load_extra_properties (user);
     return priv->layouts[0];
 }
 
@@ -1389,7 +3398,8 @@ common_user_get_layouts (CommonUser *user)
 
     CommonUserPrivate *priv = common_user_get_instance_private (user);
     load_dmrc (user);
-    return (const gchar * const *) priv->layouts;
+    load_extra_properties (user);
+    return priv->layouts;
 }
 
 /**
@@ -1406,6 +3416,8 @@ common_user_get_session (CommonUser *user)
     g_return_val_if_fail (COMMON_IS_USER (user), NULL);
 
     CommonUserPrivate *priv = common_user_get_instance_private (user);
+    if (priv->pending_session)
+        return priv->pending_session[0] == 0 ? NULL : priv->pending_session;
     load_dmrc (user);
     const gchar *session = priv->session;
     return (session && session[0] == 0) ? NULL : session; /* Treat "" as NULL */
@@ -1424,8 +3436,10 @@ common_user_set_session (CommonUser *user, const gchar *session)
     g_return_if_fail (COMMON_IS_USER (user));
     if (g_strcmp0 (common_user_get_session (user), session) != 0)
     {
-        call_method (user, "SetXSession", g_variant_new ("(s)", session), "()", NULL);
-        save_string_to_dmrc (user, "Desktop", "Session", session);
+        CommonUserPrivate *priv = common_user_get_instance_private (user);
+        g_free (priv->pending_session);
+        priv->pending_session = g_strdup (session);
+        schedule_save (user);
     }
 }
 
@@ -1462,6 +3476,7 @@ common_user_get_has_messages (CommonUser *user)
     g_return_val_if_fail (COMMON_IS_USER (user), FALSE);
 
     CommonUserPrivate *priv = common_user_get_instance_private (user);
+    load_extra_properties (user);
     return priv->has_messages;
 }
 
@@ -1528,8 +3543,7 @@ static void
 common_user_init (CommonUser *user)
 {
     CommonUserPrivate *priv = common_user_get_instance_private (user);
-    priv->layouts = g_malloc (sizeof (gchar *) * 1);
-    priv->layouts[0] = NULL;
+    priv->layouts = intern_strv (NULL);
 }
 
 static void
@@ -1611,19 +3625,21 @@ common_user_finalize (GObject *object)
     CommonUser *self = COMMON_USER (object);
     CommonUserPrivate *priv = common_user_get_instance_private (self);
 
+    /* Don't lose changes that are waiting to be saved */
+    common_user_save_changes (self);
+
     g_clear_pointer (&priv->path, g_free);
     if (priv->changed_signal)
         g_dbus_connection_signal_unsubscribe (priv->bus, priv->changed_signal);
     g_clear_object (&priv->bus);
     g_clear_pointer (&priv->name, g_free);
     g_clear_pointer (&priv->real_name, g_free);
+    g_clear_pointer (&priv->sort_key, g_free);
+    g_clear_pointer (&priv->sort_key_name, g_free);
     g_clear_pointer (&priv->home_directory, g_free);
-    g_clear_pointer (&priv->shell, g_free);
     g_clear_pointer (&priv->image, g_free);
-    g_clear_pointer (&priv->background, g_free);
-    g_clear_pointer (&priv->language, g_free);
-    g_clear_pointer (&priv->layouts, g_strfreev);
-    g_clear_pointer (&priv->session, g_free);
+    g_clear_pointer (&priv->sent_value, g_variant_unref);
+    g_clear_pointer (&priv->changes, g_bytes_unref);
 }
 
 static void
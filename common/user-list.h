@@ -35,6 +35,7 @@ G_BEGIN_DECLS
 #define USER_LIST_SIGNAL_USER_ADDED   "user-added"
 #define USER_LIST_SIGNAL_USER_CHANGED "user-changed"
 #define USER_LIST_SIGNAL_USER_REMOVED "user-removed"
+#define USER_LIST_SIGNAL_LOADED       "loaded"
 
 #define USER_SIGNAL_CHANGED "changed"
 
@@ -62,6 +63,7 @@ typedef struct
     void (*user_added)(CommonUserList *user_list, CommonUser *user);
     void (*user_changed)(CommonUserList *user_list, CommonUser *user);
     void (*user_removed)(CommonUserList *user_list, CommonUser *user);
+    void (*loaded)(CommonUserList *user_list);
 } CommonUserListClass;
 
 GType common_user_list_get_type (void);
@@ -72,12 +74,38 @@ CommonUserList *common_user_list_get_instance (void);
 
 void common_user_list_cleanup (void);
 
+void common_user_list_load_async (CommonUserList *user_list);
+
+gboolean common_user_list_get_is_loaded (CommonUserList *user_list);
+
+gint64 common_user_list_get_update_time (CommonUserList *user_list);
+
+void common_user_list_prefetch_dmrc (CommonUserList *user_list);
+
 gint common_user_list_get_length (CommonUserList *user_list);
 
 CommonUser *common_user_list_get_user_by_name (CommonUserList *user_list, const gchar *username);
 
 GList *common_user_list_get_users (CommonUserList *user_list);
 
+GBytes *common_user_list_get_snapshot (CommonUserList *user_list);
+
+void common_user_list_load_snapshot (CommonUserList *user_list, GBytes *snapshot);
+
+void common_user_list_update_user (CommonUserList *user_list, GBytes *data);
+
+void common_user_list_apply_changes (CommonUserList *user_list, GBytes *changes);
+
+void common_user_list_remove_user (CommonUserList *user_list, const gchar *username);
+
+gboolean common_user_list_load_cache (CommonUserList *user_list, const gchar *filename);
+
+gboolean common_user_list_save_cache (CommonUserList *user_list, const gchar *filename, GError **error);
+
+GBytes *common_user_serialize (CommonUser *user);
+
+GBytes *common_user_get_changes (CommonUser *user);
+
 const gchar *common_user_get_name (CommonUser *user);
 
 const gchar *common_user_get_real_name (CommonUser *user);
@@ -104,6 +132,8 @@ const gchar *common_user_get_session (CommonUser *user);
 
 void common_user_set_session (CommonUser *user, const gchar *session);
 
+void common_user_save_changes (CommonUser *user);
+
 gboolean common_user_get_logged_in (CommonUser *user);
 
 gboolean common_user_get_has_messages (CommonUser *user);
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <unistd.h>
+
+#include "worker.h"
+#include "privileges.h"
+
+/*
+ * Work that would block the main loop is run in a shared pool of threads,
+ * with the result delivered back to the calling thread's main context as a
+ * GTask. Work that needs to run as a user drops privileges for just that
+ * thread, where the system doesn't support that it is run in the calling
+ * thread with privileges dropped for the whole process instead.
+ */
+
+/* Maximum number of threads doing work at once */
+#define MAX_WORKER_THREADS 4
+
+typedef struct
+{
+    WorkerFunc func;
+    gpointer data;
+    GDestroyNotify data_free;
+
+    /* User to run as */
+    gboolean drop_privileges;
+    uid_t uid;
+    gid_t gid;
+} WorkerJob;
+
+static GThreadPool *pool = NULL;
+
+static void
+job_free (WorkerJob *job)
+{
+    if (job->data_free)
+        job->data_free (job->data);
+    g_free (job);
+}
+
+static void
+run_job (GTask *task)
+{
+    WorkerJob *job = g_task_get_task_data (task);
+
+    if (g_task_return_error_if_cancelled (task))
+        return;
+
+    g_autoptr(GError) error = NULL;
+    gboolean result = job->func (job->data, g_task_get_cancellable (task), &error);
+    if (error)
+        g_task_return_error (task, g_steal_pointer (&error));
+    else
+        g_task_return_boolean (task, result);
+}
+
+/* Run a job as its user by changing the credentials of the whole process */
+static void
+run_job_in_process (GTask *task)
+{
+    WorkerJob *job = g_task_get_task_data (task);
+
+    privileges_drop (job->uid, job->gid);
+    run_job (task);
+    privileges_reclaim ();
+}
+
+static void
+worker_thread_func (gpointer data, gpointer user_data)
+{
+    g_autoptr(GTask) task = data;
+    WorkerJob *job = g_task_get_task_data (task);
+
+    if (job->drop_privileges && !privileges_drop_thread (job->uid, job->gid))
+    {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED, "Failed to drop privileges to user %d", job->uid);
+        return;
+    }
+    run_job (task);
+    if (job->drop_privileges)
+        privileges_reclaim_thread ();
+}
+
+static void
+push_job (WorkerJob *job, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_task_data (task, job, (GDestroyNotify) job_free);
+
+    /* Can't change the credentials of one thread, so do it here for the whole process */
+    if (job->drop_privileges && !privileges_can_drop_thread ())
+    {
+        run_job_in_process (task);
+        g_object_unref (task);
+        return;
+    }
+
+    if (!pool)
+        pool = g_thread_pool_new (worker_thread_func, NULL, MAX_WORKER_THREADS, FALSE, NULL);
+    g_thread_pool_push (pool, task, NULL);
+}
+
+void
+worker_run (WorkerFunc func, gpointer data, GDestroyNotify data_free, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    WorkerJob *job = g_new0 (WorkerJob, 1);
+    job->func = func;
+    job->data = data;
+    job->data_free = data_free;
+    push_job (job, cancellable, callback, user_data);
+}
+
+void
+worker_run_as_user (uid_t uid, gid_t gid, WorkerFunc func, gpointer data, GDestroyNotify data_free, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    WorkerJob *job = g_new0 (WorkerJob, 1);
+    job->func = func;
+    job->data = data;
+    job->data_free = data_free;
+    /* Only root can change user */
+    job->drop_privileges = geteuid () == 0 && uid != 0;
+    job->uid = uid;
+    job->gid = gid;
+    push_job (job, cancellable, callback, user_data);
+}
+
+gpointer
+worker_get_data (GAsyncResult *result)
+{
+    WorkerJob *job = g_task_get_task_data (G_TASK (result));
+    return job->data;
+}
+
+gboolean
+worker_run_finish (GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef WORKER_H_
+#define WORKER_H_
+
+#include <gio/gio.h>
+#include <sys/types.h>
+
+G_BEGIN_DECLS
+
+/* Blocking work to run in a worker thread. Results are returned in data */
+typedef gboolean (*WorkerFunc) (gpointer data, GCancellable *cancellable, GError **error);
+
+void worker_run (WorkerFunc func, gpointer data, GDestroyNotify data_free, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+void worker_run_as_user (uid_t uid, gid_t gid, WorkerFunc func, gpointer data, GDestroyNotify data_free, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gpointer worker_get_data (GAsyncResult *result);
+
+gboolean worker_run_finish (GAsyncResult *result, GError **error);
+
+G_END_DECLS
+
+#endif /* WORKER_H_ */
@@ -77,6 +77,13 @@ add_account ()
     }
   fi
 
+  # the display manager mounts the home directory from a template
+  if [ -n "${GUEST_HOME_TEMPLATE}" ]; then
+    mkdir -p -m 700 ${GUEST_HOME}
+    echo ${GUEST_USER}
+    return
+  fi
+
   dist_gs=/usr/share/lightdm/guest-session
   site_gs=/etc/guest-session
 
@@ -12,11 +12,16 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <gio/gio.h>
 #include <gio/gunixsocketaddress.h>
 #include <security/pam_appl.h>
 
 #include "lightdm/greeter.h"
+#include "user-list.h"
+#include "greeter-protocol.h"
 
 /**
  * SECTION:greeter
@@ -87,6 +92,24 @@
 
 G_DEFINE_QUARK (lightdm_greeter_error, lightdm_greeter_error)
 
+/* Well known hints, parsed once when received so they are cheap to read.
+ * Strings point into the hint table they were parsed from */
+typedef struct
+{
+    const gchar *default_session;
+    const gchar *select_user;
+    const gchar *autologin_user;
+    const gchar *autologin_session;
+    gint autologin_timeout;
+    gboolean hide_users;
+    gboolean show_manual_login;
+    gboolean show_remote_login;
+    gboolean lock;
+    gboolean has_guest_account;
+    gboolean select_guest;
+    gboolean autologin_guest;
+} ParsedHints;
+
 enum {
     PROP_DEFAULT_SESSION_HINT = 1,
     PROP_HIDE_USERS_HINT,
@@ -112,6 +135,9 @@ enum {
     AUTOLOGIN_TIMER_EXPIRED,
     IDLE,
     RESET,
+    SHOW_PREAUTHENTICATION_PROMPT,
+    SHOW_PREAUTHENTICATION_MESSAGE,
+    PREAUTHENTICATION_COMPLETE,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -134,6 +160,13 @@ typedef struct
     GIOChannel *from_server_channel;
     guint from_server_watch;
 
+    /* TRUE if the caller reads from the daemon with lightdm_greeter_dispatch() */
+    gboolean external_dispatch;
+
+    /* Requests completed in lightdm_greeter_dispatch(), to call back before it returns */
+    gboolean dispatching;
+    GList *dispatched_requests;
+
     /* Data read from the daemon */
     guint8 *read_buffer;
     gsize n_read;
@@ -153,8 +186,9 @@ typedef struct
     /* Pending ensure shared data dir requests */
     GList *ensure_shared_data_dir_requests;
 
-    /* Hints provided by the daemon */
+    /* Hints provided by the daemon, and the well known ones parsed from them */
     GHashTable *hints;
+    ParsedHints parsed_hints;
 
     /* Timeout source to notify greeter to autologin */
     guint autologin_timeout;
@@ -164,40 +198,31 @@ typedef struct
     gboolean is_authenticated;
     guint32 authenticate_sequence_number;
     gboolean cancelling_authentication;
+
+    /* Last sequence number used for an authentication */
+    guint32 last_sequence_number;
+
+    /* Authentications running alongside the current one, keyed by sequence number */
+    GHashTable *preauthentications;
+
+    /* Thread reading user images ahead of the greeter drawing them */
+    GThreadPool *prefetch_pool;
+
+    /* Image paths already given to the prefetch thread */
+    GHashTable *prefetched_images;
 } LightDMGreeterPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (LightDMGreeter, lightdm_greeter, G_TYPE_OBJECT)
 
-#define HEADER_SIZE 8
-#define MAX_MESSAGE_LENGTH 1024
-#define API_VERSION 1
-
-/* Messages from the greeter to the server */
-typedef enum
-{
-    GREETER_MESSAGE_CONNECT = 0,
-    GREETER_MESSAGE_AUTHENTICATE,
-    GREETER_MESSAGE_AUTHENTICATE_AS_GUEST,
-    GREETER_MESSAGE_CONTINUE_AUTHENTICATION,
-    GREETER_MESSAGE_START_SESSION,
-    GREETER_MESSAGE_CANCEL_AUTHENTICATION,
-    GREETER_MESSAGE_SET_LANGUAGE,
-    GREETER_MESSAGE_AUTHENTICATE_REMOTE,
-    GREETER_MESSAGE_ENSURE_SHARED_DIR,
-} GreeterMessage;
-
-/* Messages from the server to the greeter */
-typedef enum
-{
-    SERVER_MESSAGE_CONNECTED = 0,
-    SERVER_MESSAGE_PROMPT_AUTHENTICATION,
-    SERVER_MESSAGE_END_AUTHENTICATION,
-    SERVER_MESSAGE_SESSION_RESULT,
-    SERVER_MESSAGE_SHARED_DIR_RESULT,
-    SERVER_MESSAGE_IDLE,
-    SERVER_MESSAGE_RESET,
-    SERVER_MESSAGE_CONNECTED_V2,
-} ServerMessage;
+/* An authentication started ahead of being needed */
+typedef struct
+{
+    gchar *username;
+    gsize n_responses_waiting;
+    GList *responses_received;
+    gboolean complete;
+    gboolean is_authenticated;
+} PreAuthentication;
 
 /* Request sent to server */
 typedef struct
@@ -327,7 +352,9 @@ static gboolean
 request_callback_cb (gpointer data)
 {
     Request *request = data;
-    if (request->callback)
+
+    /* Cancellation may have happened after the request completed */
+    if (request->callback && !(request->cancellable && g_cancellable_is_cancelled (request->cancellable)))
         request->callback (G_OBJECT (request->greeter), G_ASYNC_RESULT (request), request->user_data);
     g_object_unref (request);
     return G_SOURCE_REMOVE;
@@ -336,6 +363,8 @@ request_callback_cb (gpointer data)
 static void
 request_complete (Request *request)
 {
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (request->greeter);
+
     request->complete = TRUE;
 
     if (!request->callback)
@@ -344,7 +373,11 @@ request_complete (Request *request)
     if (request->cancellable && g_cancellable_is_cancelled (request->cancellable))
         return;
 
-    g_idle_add (request_callback_cb, g_object_ref (request));
+    /* Don't rely on the GLib main context if the caller runs its own loop */
+    if (priv->dispatching)
+        priv->dispatched_requests = g_list_append (priv->dispatched_requests, g_object_ref (request));
+    else
+        g_idle_add (request_callback_cb, g_object_ref (request));
 }
 
 static gboolean
@@ -359,106 +392,60 @@ timed_login_cb (gpointer data)
     return FALSE;
 }
 
-static guint32
-int_length (void)
-{
-    return 4;
-}
-
-static gboolean
-write_int (guint8 *buffer, gint buffer_length, guint32 value, gsize *offset, GError **error)
-{
-    if (*offset + 4 >= buffer_length)
-    {
-        g_set_error_literal (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_COMMUNICATION_ERROR,
-                             "Not enough buffer space to write integer");
-        return FALSE;
-    }
-    buffer[*offset] = value >> 24;
-    buffer[*offset+1] = (value >> 16) & 0xFF;
-    buffer[*offset+2] = (value >> 8) & 0xFF;
-    buffer[*offset+3] = value & 0xFF;
-    *offset += 4;
-
-    return TRUE;
-}
-
-static gboolean
-write_string (guint8 *buffer, gint buffer_length, const gchar *value, gsize *offset, GError **error)
-{
-    gint length = 0;
-    if (value)
-        length = strlen (value);
-    if (!write_int (buffer, buffer_length, length, offset, error))
-        return FALSE;
-    if (*offset + length >= buffer_length)
-    {
-        g_set_error (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_COMMUNICATION_ERROR,
-                     "Not enough buffer space to write string of length %d octets", length);
-        return FALSE;
-    }
-    if (value)
-        memcpy (buffer + *offset, value, length);
-    *offset += length;
-
-    return TRUE;
-}
-
 static guint32
 read_int (guint8 *message, gsize message_length, gsize *offset)
 {
-    if (message_length - *offset < int_length ())
-    {
-        g_warning ("Not enough space for int, need %i, got %zi", int_length (), message_length - *offset);
-        return 0;
-    }
-
-    const guint8 *buffer = message + *offset;
-    guint32 value = buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
-    *offset += int_length ();
-
+    guint32 value;
+    common_greeter_protocol_read_int (message, message_length, offset, &value);
     return value;
 }
 
 static gchar *
 read_string (guint8 *message, gsize message_length, gsize *offset)
 {
-    guint32 length = read_int (message, message_length, offset);
-    if (message_length - *offset < length)
-    {
-        g_warning ("Not enough space for string, need %u, got %zu", length, message_length - *offset);
+    guint32 length;
+    const gchar *value = common_greeter_protocol_read_string (message, message_length, offset, &length);
+    if (!value)
         return g_strdup ("");
-    }
 
-    gchar *value = g_malloc (sizeof (gchar) * (length + 1));
-    memcpy (value, message + *offset, length);
-    value[length] = '\0';
-    *offset += length;
-
-    return value;
+    return g_strndup (value, length);
 }
 
-static guint32
-string_length (const gchar *value)
+static GBytes *
+read_bytes (guint8 *message, gsize message_length, gsize *offset)
 {
-    if (value)
-        return int_length () + strlen (value);
-    else
-        return int_length ();
+    guint32 length;
+    const gchar *value = common_greeter_protocol_read_string (message, message_length, offset, &length);
+    if (!value)
+        return NULL;
+
+    return g_bytes_new (value, length);
 }
 
-static gboolean
-write_header (guint8 *buffer, gint buffer_length, guint32 id, guint32 length, gsize *offset, GError **error)
+static void
+write_responses (GByteArray *message, GList *responses)
 {
-    return write_int (buffer, buffer_length, id, offset, error) &&
-           write_int (buffer, buffer_length, length, offset, error);
+    common_greeter_protocol_write_int (message, g_list_length (responses));
+    for (GList *iter = responses; iter; iter = iter->next)
+        common_greeter_protocol_write_string (message, (gchar *)iter->data);
 }
 
 static guint32
-get_message_length (guint8 *message, gsize message_length)
+responses_length (GList *responses)
+{
+    guint32 length = GREETER_PROTOCOL_INT_SIZE;
+    for (GList *iter = responses; iter; iter = iter->next)
+        length += common_greeter_protocol_string_size ((gchar *)iter->data);
+    return length;
+}
+
+/* Responses can be passwords, so don't leave them in freed memory */
+static void
+wipe_message (GByteArray *message)
 {
-    gsize offset = 4;
-    return read_int (message, message_length, &offset);
+    volatile guint8 *data = message->data;
+    for (guint i = 0; i < message->len; i++)
+        data[i] = 0;
 }
 
 static gboolean
@@ -498,7 +485,8 @@ connect_to_daemon (LightDMGreeter *greeter, GError **error)
         return FALSE;
     }
 
-    priv->from_server_watch = g_io_add_watch (priv->from_server_channel, G_IO_IN, from_server_cb, greeter);
+    if (!priv->external_dispatch)
+        priv->from_server_watch = g_io_add_watch (priv->from_server_channel, G_IO_IN, from_server_cb, greeter);
 
     if (!g_io_channel_set_encoding (priv->to_server_channel, NULL, error) ||
         !g_io_channel_set_encoding (priv->from_server_channel, NULL, error))
@@ -508,7 +496,7 @@ connect_to_daemon (LightDMGreeter *greeter, GError **error)
 }
 
 static gboolean
-send_message (LightDMGreeter *greeter, guint8 *message, gsize message_length, GError **error)
+send_message (LightDMGreeter *greeter, GByteArray *message, GError **error)
 {
     LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
 
@@ -520,17 +508,17 @@ send_message (LightDMGreeter *greeter, guint8 *message, gsize message_length, GE
        rest.  If we say we're sending less than we do, we confuse the heck out
        of lightdm, as it starts reading headers from the middle of our
        messages. */
-    guint32 stated_length = HEADER_SIZE + get_message_length (message, message_length);
-    if (stated_length != message_length)
+    guint32 stated_length = GREETER_PROTOCOL_HEADER_SIZE + common_greeter_protocol_get_message_length (message->data);
+    if (stated_length != message->len)
     {
         g_set_error (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_COMMUNICATION_ERROR,
-                     "Refusing to write malformed packet to daemon: declared size is %u, but actual size is %zu",
-                     stated_length, message_length);
+                     "Refusing to write malformed packet to daemon: declared size is %u, but actual size is %u",
+                     stated_length, message->len);
         return FALSE;
     }
 
-    gchar *data = (gchar *) message;
-    gsize data_length = message_length;
+    gchar *data = (gchar *) message->data;
+    gsize data_length = message->len;
     while (data_length > 0)
     {
         gsize n_written;
@@ -541,7 +529,11 @@ send_message (LightDMGreeter *greeter, guint8 *message, gsize message_length, GE
                          "Failed to write to daemon: %s",
                          write_error->message);
         if (status == G_IO_STATUS_AGAIN)
+        {
+            GPollFD poll_fd = { g_io_channel_unix_get_fd (priv->to_server_channel), G_IO_OUT, 0 };
+            g_poll (&poll_fd, 1, -1);
             continue;
+        }
         if (status != G_IO_STATUS_NORMAL)
             return FALSE;
         data_length -= n_written;
@@ -561,6 +553,60 @@ send_message (LightDMGreeter *greeter, guint8 *message, gsize message_length, GE
     return TRUE;
 }
 
+static gboolean
+get_boolean_hint (GHashTable *hints, const gchar *name)
+{
+    return g_strcmp0 (g_hash_table_lookup (hints, name), "true") == 0;
+}
+
+static void
+parse_hints (GHashTable *hints, ParsedHints *parsed)
+{
+    parsed->default_session = g_hash_table_lookup (hints, "default-session");
+    parsed->select_user = g_hash_table_lookup (hints, "select-user");
+    parsed->autologin_user = g_hash_table_lookup (hints, "autologin-user");
+    parsed->autologin_session = g_hash_table_lookup (hints, "autologin-session");
+    const gchar *timeout = g_hash_table_lookup (hints, "autologin-timeout");
+    parsed->autologin_timeout = timeout ? MAX (atoi (timeout), 0) : 0;
+    parsed->hide_users = get_boolean_hint (hints, "hide-users");
+    parsed->show_manual_login = get_boolean_hint (hints, "show-manual-login");
+    parsed->show_remote_login = get_boolean_hint (hints, "show-remote-login");
+    parsed->lock = get_boolean_hint (hints, "lock-screen");
+    parsed->has_guest_account = get_boolean_hint (hints, "has-guest-account");
+    parsed->select_guest = get_boolean_hint (hints, "select-guest");
+    parsed->autologin_guest = get_boolean_hint (hints, "autologin-guest");
+}
+
+/* Notify the hint properties that differ between two sets of hints */
+static void
+notify_hint_changes (LightDMGreeter *greeter, const ParsedHints *old_hints, const ParsedHints *new_hints)
+{
+    if (g_strcmp0 (old_hints->default_session, new_hints->default_session) != 0)
+        g_object_notify (G_OBJECT (greeter), "default-session-hint");
+    if (old_hints->hide_users != new_hints->hide_users)
+        g_object_notify (G_OBJECT (greeter), "hide-users-hint");
+    if (old_hints->show_manual_login != new_hints->show_manual_login)
+        g_object_notify (G_OBJECT (greeter), "show-manual-login-hint");
+    if (old_hints->show_remote_login != new_hints->show_remote_login)
+        g_object_notify (G_OBJECT (greeter), "show-remote-login-hint");
+    if (old_hints->lock != new_hints->lock)
+        g_object_notify (G_OBJECT (greeter), "lock-hint");
+    if (old_hints->has_guest_account != new_hints->has_guest_account)
+        g_object_notify (G_OBJECT (greeter), "has-guest-account-hint");
+    if (g_strcmp0 (old_hints->select_user, new_hints->select_user) != 0)
+        g_object_notify (G_OBJECT (greeter), "select-user-hint");
+    if (old_hints->select_guest != new_hints->select_guest)
+        g_object_notify (G_OBJECT (greeter), "select-guest-hint");
+    if (g_strcmp0 (old_hints->autologin_user, new_hints->autologin_user) != 0)
+        g_object_notify (G_OBJECT (greeter), "autologin-user-hint");
+    if (g_strcmp0 (old_hints->autologin_session, new_hints->autologin_session) != 0)
+        g_object_notify (G_OBJECT (greeter), "autologin-session-hint");
+    if (old_hints->autologin_guest != new_hints->autologin_guest)
+        g_object_notify (G_OBJECT (greeter), "autologin-guest-hint");
+    if (old_hints->autologin_timeout != new_hints->autologin_timeout)
+        g_object_notify (G_OBJECT (greeter), "autologin-timeout-hint");
+}
+
 static void
 handle_connected (LightDMGreeter *greeter, gboolean v2, guint8 *message, gsize message_length, gsize *offset)
 {
@@ -598,6 +644,8 @@ handle_connected (LightDMGreeter *greeter, gboolean v2, guint8 *message, gsize m
         }
     }
 
+    parse_hints (priv->hints, &priv->parsed_hints);
+
     priv->connected = TRUE;
     g_debug ("%s", debug_string->str);
 
@@ -620,6 +668,78 @@ handle_connected (LightDMGreeter *greeter, gboolean v2, guint8 *message, gsize m
     }
 }
 
+static void
+preauthentication_free (PreAuthentication *preauthentication)
+{
+    g_free (preauthentication->username);
+    g_list_free_full (preauthentication->responses_received, g_free);
+    g_free (preauthentication);
+}
+
+static void
+handle_prompt_preauthentication (LightDMGreeter *greeter, guint32 sequence_number, PreAuthentication *preauthentication, guint8 *message, gsize message_length, gsize *offset)
+{
+    /* Update username */
+    g_autofree gchar *username = read_string (message, message_length, offset);
+    if (strcmp (username, "") == 0)
+    {
+        g_free (username);
+        username = NULL;
+    }
+    g_free (preauthentication->username);
+    preauthentication->username = g_steal_pointer (&username);
+
+    g_list_free_full (preauthentication->responses_received, g_free);
+    preauthentication->responses_received = NULL;
+    preauthentication->n_responses_waiting = 0;
+
+    guint32 n_messages = read_int (message, message_length, offset);
+    g_debug ("Prompt pre-authentication %u with %d message(s)", sequence_number, n_messages);
+
+    for (guint32 i = 0; i < n_messages; i++)
+    {
+        int style = read_int (message, message_length, offset);
+        g_autofree gchar *text = read_string (message, message_length, offset);
+
+        switch (style)
+        {
+        case PAM_PROMPT_ECHO_OFF:
+            preauthentication->n_responses_waiting++;
+            g_signal_emit (G_OBJECT (greeter), signals[SHOW_PREAUTHENTICATION_PROMPT], 0, sequence_number, text, LIGHTDM_PROMPT_TYPE_SECRET);
+            break;
+        case PAM_PROMPT_ECHO_ON:
+            preauthentication->n_responses_waiting++;
+            g_signal_emit (G_OBJECT (greeter), signals[SHOW_PREAUTHENTICATION_PROMPT], 0, sequence_number, text, LIGHTDM_PROMPT_TYPE_QUESTION);
+            break;
+        case PAM_ERROR_MSG:
+            g_signal_emit (G_OBJECT (greeter), signals[SHOW_PREAUTHENTICATION_MESSAGE], 0, sequence_number, text, LIGHTDM_MESSAGE_TYPE_ERROR);
+            break;
+        case PAM_TEXT_INFO:
+            g_signal_emit (G_OBJECT (greeter), signals[SHOW_PREAUTHENTICATION_MESSAGE], 0, sequence_number, text, LIGHTDM_MESSAGE_TYPE_INFO);
+            break;
+        }
+    }
+}
+
+static void
+handle_end_preauthentication (LightDMGreeter *greeter, guint32 sequence_number, PreAuthentication *preauthentication, guint8 *message, gsize message_length, gsize *offset)
+{
+    g_autofree gchar *username = read_string (message, message_length, offset);
+    guint32 return_code = read_int (message, message_length, offset);
+
+    g_debug ("Pre-authentication %u complete for user %s with return code %d", sequence_number, username, return_code);
+
+    if (strcmp (username, "") != 0)
+    {
+        g_free (preauthentication->username);
+        preauthentication->username = g_steal_pointer (&username);
+    }
+    preauthentication->complete = TRUE;
+    preauthentication->is_authenticated = (return_code == 0);
+
+    g_signal_emit (G_OBJECT (greeter), signals[PREAUTHENTICATION_COMPLETE], 0, sequence_number, preauthentication->is_authenticated);
+}
+
 static void
 handle_prompt_authentication (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
 {
@@ -628,7 +748,11 @@ handle_prompt_authentication (LightDMGreeter *greeter, guint8 *message, gsize me
     guint32 sequence_number = read_int (message, message_length, offset);
     if (sequence_number != priv->authenticate_sequence_number)
     {
-        g_debug ("Ignoring prompt authentication with invalid sequence number %d", sequence_number);
+        PreAuthentication *preauthentication = g_hash_table_lookup (priv->preauthentications, GUINT_TO_POINTER (sequence_number));
+        if (preauthentication)
+            handle_prompt_preauthentication (greeter, sequence_number, preauthentication, message, message_length, offset);
+        else
+            g_debug ("Ignoring prompt authentication with invalid sequence number %d", sequence_number);
         return;
     }
 
@@ -689,7 +813,11 @@ handle_end_authentication (LightDMGreeter *greeter, guint8 *message, gsize messa
     guint32 sequence_number = read_int (message, message_length, offset);
     if (sequence_number != priv->authenticate_sequence_number)
     {
-        g_debug ("Ignoring end authentication with invalid sequence number %d", sequence_number);
+        PreAuthentication *preauthentication = g_hash_table_lookup (priv->preauthentications, GUINT_TO_POINTER (sequence_number));
+        if (preauthentication)
+            handle_end_preauthentication (greeter, sequence_number, preauthentication, message, message_length, offset);
+        else
+            g_debug ("Ignoring end authentication with invalid sequence number %d", sequence_number);
         return;
     }
 
@@ -725,22 +853,121 @@ handle_reset (LightDMGreeter *greeter, guint8 *message, gsize message_length, gs
 {
     LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
 
-    g_hash_table_remove_all (priv->hints);
-
+    GHashTable *hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
     g_autoptr(GString) hint_string = g_string_new ("");
     while (*offset < message_length)
     {
         gchar *name = read_string (message, message_length, offset);
         gchar *value = read_string (message, message_length, offset);
-        g_hash_table_insert (priv->hints, name, value);
+        g_hash_table_insert (hints, name, value);
         g_string_append_printf (hint_string, " %s=%s", name, value);
     }
 
     g_debug ("Reset%s", hint_string->str);
 
+    /* Swap in the new hints, keeping the old ones until they have been compared */
+    g_autoptr(GHashTable) old_hints = priv->hints;
+    ParsedHints old_parsed_hints = priv->parsed_hints;
+    priv->hints = hints;
+    parse_hints (priv->hints, &priv->parsed_hints);
+    g_object_freeze_notify (G_OBJECT (greeter));
+    notify_hint_changes (greeter, &old_parsed_hints, &priv->parsed_hints);
+    g_object_thaw_notify (G_OBJECT (greeter));
+
     g_signal_emit (G_OBJECT (greeter), signals[RESET], 0);
 }
 
+/* Don't push very large pictures into the page cache, they're not likely to be shown as is */
+#define MAX_PREFETCH_SIZE (32 * 1024 * 1024)
+
+/* Runs in the prefetch thread, so the main loop never waits on the disk */
+static void
+prefetch_image_cb (gpointer data, gpointer user_data)
+{
+    g_autofree gchar *path = data;
+
+    /* Non-blocking so a FIFO in place of a picture can't hold the thread */
+    int fd = open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (fstat (fd, &info) == 0 && S_ISREG (info.st_mode) && info.st_size <= MAX_PREFETCH_SIZE)
+        posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+    close (fd);
+}
+
+static void
+prefetch_image (LightDMGreeter *greeter, const gchar *path)
+{
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    if (!path || !g_path_is_absolute (path) || g_hash_table_contains (priv->prefetched_images, path))
+        return;
+    g_hash_table_add (priv->prefetched_images, g_strdup (path));
+
+    if (!priv->prefetch_pool)
+        priv->prefetch_pool = g_thread_pool_new (prefetch_image_cb, NULL, 1, FALSE, NULL);
+    g_thread_pool_push (priv->prefetch_pool, g_strdup (path), NULL);
+}
+
+/* Start reading the avatar and wallpaper of each user before the greeter asks for them.
+ * This only uses values that have been sent by the daemon, so it never causes a D-Bus lookup. */
+static void
+prefetch_user_images (LightDMGreeter *greeter, CommonUser *user)
+{
+    prefetch_image (greeter, common_user_get_image (user));
+    prefetch_image (greeter, common_user_get_background (user));
+}
+
+static void
+prefetch_user_cb (CommonUserList *user_list, CommonUser *user, LightDMGreeter *greeter)
+{
+    prefetch_user_images (greeter, user);
+}
+
+static void
+handle_user_list (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
+{
+    g_autoptr(GBytes) snapshot = read_bytes (message, message_length, offset);
+    if (!snapshot)
+        return;
+
+    CommonUserList *user_list = common_user_list_get_instance ();
+    common_user_list_load_snapshot (user_list, snapshot);
+
+    for (GList *link = common_user_list_get_users (user_list); link; link = link->next)
+        prefetch_user_images (greeter, link->data);
+
+    /* Users that arrive or change later are prefetched as their details are updated */
+    g_signal_handlers_disconnect_by_func (user_list, prefetch_user_cb, greeter);
+    g_signal_connect_object (user_list, USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (prefetch_user_cb), greeter, 0);
+    g_signal_connect_object (user_list, USER_LIST_SIGNAL_USER_CHANGED, G_CALLBACK (prefetch_user_cb), greeter, 0);
+}
+
+static void
+handle_user_changed (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
+{
+    g_autoptr(GBytes) data = read_bytes (message, message_length, offset);
+    if (data)
+        common_user_list_update_user (common_user_list_get_instance (), data);
+}
+
+static void
+handle_user_fields_changed (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
+{
+    g_autoptr(GBytes) changes = read_bytes (message, message_length, offset);
+    if (changes)
+        common_user_list_apply_changes (common_user_list_get_instance (), changes);
+}
+
+static void
+handle_user_removed (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
+{
+    g_autofree gchar *username = read_string (message, message_length, offset);
+    common_user_list_remove_user (common_user_list_get_instance (), username);
+}
+
 static void
 handle_session_result (LightDMGreeter *greeter, guint8 *message, gsize message_length, gsize *offset)
 {
@@ -818,6 +1045,18 @@ handle_message (LightDMGreeter *greeter, guint8 *message, gsize message_length)
     case SERVER_MESSAGE_CONNECTED_V2:
         handle_connected (greeter, TRUE, message, message_length, &offset);
         break;
+    case SERVER_MESSAGE_USER_LIST:
+        handle_user_list (greeter, message, message_length, &offset);
+        break;
+    case SERVER_MESSAGE_USER_CHANGED:
+        handle_user_changed (greeter, message, message_length, &offset);
+        break;
+    case SERVER_MESSAGE_USER_REMOVED:
+        handle_user_removed (greeter, message, message_length, &offset);
+        break;
+    case SERVER_MESSAGE_USER_FIELDS_CHANGED:
+        handle_user_fields_changed (greeter, message, message_length, &offset);
+        break;
     default:
         g_warning ("Unknown message from server: %d", id);
         break;
@@ -833,9 +1072,9 @@ recv_message (LightDMGreeter *greeter, gboolean block, guint8 **message, gsize *
         return FALSE;
 
     /* Read the header, or the whole message if we already have that */
-    gsize n_to_read = HEADER_SIZE;
-    if (priv->n_read >= HEADER_SIZE)
-        n_to_read += get_message_length (priv->read_buffer, priv->n_read);
+    gsize n_to_read = GREETER_PROTOCOL_HEADER_SIZE;
+    if (priv->n_read >= GREETER_PROTOCOL_HEADER_SIZE)
+        n_to_read += common_greeter_protocol_get_message_length (priv->read_buffer);
 
     do
     {
@@ -848,8 +1087,13 @@ recv_message (LightDMGreeter *greeter, gboolean block, guint8 **message, gsize *
                                           &read_error);
         if (status == G_IO_STATUS_AGAIN)
         {
+            /* Wait for more data rather than spinning on a non-blocking socket */
             if (block)
+            {
+                GPollFD poll_fd = { g_io_channel_unix_get_fd (priv->from_server_channel), G_IO_IN, 0 };
+                g_poll (&poll_fd, 1, -1);
                 continue;
+            }
         }
         else if (status != G_IO_STATUS_NORMAL)
         {
@@ -875,12 +1119,12 @@ recv_message (LightDMGreeter *greeter, gboolean block, guint8 **message, gsize *
     }
 
     /* If have header, rerun for content */
-    if (priv->n_read == HEADER_SIZE)
+    if (priv->n_read == GREETER_PROTOCOL_HEADER_SIZE)
     {
-        n_to_read = get_message_length (priv->read_buffer, priv->n_read);
+        n_to_read = common_greeter_protocol_get_message_length (priv->read_buffer);
         if (n_to_read > 0)
         {
-            priv->read_buffer = g_realloc (priv->read_buffer, HEADER_SIZE + n_to_read);
+            priv->read_buffer = g_realloc (priv->read_buffer, GREETER_PROTOCOL_HEADER_SIZE + n_to_read);
             return recv_message (greeter, block, message, length, error);
         }
     }
@@ -920,17 +1164,117 @@ from_server_cb (GIOChannel *source, GIOCondition condition, gpointer data)
     return G_SOURCE_CONTINUE;
 }
 
+/**
+ * lightdm_greeter_set_external_dispatch:
+ * @greeter: A #LightDMGreeter
+ * @external_dispatch: %TRUE if the caller will read messages from the daemon
+ *
+ * Set whether messages from the daemon are read by the GLib main context or by
+ * the caller. When %TRUE the caller must watch the file descriptor returned by
+ * lightdm_greeter_get_daemon_fd() and call lightdm_greeter_dispatch() when it
+ * is readable. This allows greeters to use an event loop that doesn't run GLib.
+ **/
+void
+lightdm_greeter_set_external_dispatch (LightDMGreeter *greeter, gboolean external_dispatch)
+{
+    g_return_if_fail (LIGHTDM_IS_GREETER (greeter));
+
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    priv->external_dispatch = external_dispatch;
+    if (external_dispatch)
+        g_clear_handle_id (&priv->from_server_watch, g_source_remove);
+    else if (priv->from_server_channel && priv->from_server_watch == 0)
+        priv->from_server_watch = g_io_add_watch (priv->from_server_channel, G_IO_IN, from_server_cb, greeter);
+}
+
+/**
+ * lightdm_greeter_get_daemon_fd:
+ * @greeter: A #LightDMGreeter
+ *
+ * Get the file descriptor messages from the daemon are read from. This is
+ * only available once lightdm_greeter_connect_to_daemon() or
+ * lightdm_greeter_connect_to_daemon_sync() has been called.
+ *
+ * Return value: A file descriptor or -1 if not connected.
+ **/
+gint
+lightdm_greeter_get_daemon_fd (LightDMGreeter *greeter)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), -1);
+
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    if (!priv->from_server_channel)
+        return -1;
+
+    return g_io_channel_unix_get_fd (priv->from_server_channel);
+}
+
+/**
+ * lightdm_greeter_dispatch:
+ * @greeter: A #LightDMGreeter
+ * @error: return location for a #GError, or %NULL
+ *
+ * Handle the messages waiting from the daemon, emitting signals and completing
+ * requests before returning. Call this when the file descriptor returned by
+ * lightdm_greeter_get_daemon_fd() is readable if
+ * lightdm_greeter_set_external_dispatch() has been used.
+ *
+ * Return value: #TRUE if messages were read, #FALSE if the connection failed.
+ **/
+gboolean
+lightdm_greeter_dispatch (LightDMGreeter *greeter, GError **error)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
+
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    g_return_val_if_fail (!priv->dispatching, FALSE);
+
+    g_object_ref (greeter);
+    priv->dispatching = TRUE;
+    gboolean result = TRUE;
+    while (TRUE)
+    {
+        g_autofree guint8 *message = NULL;
+        gsize message_length;
+        if (!recv_message (greeter, FALSE, &message, &message_length, error))
+        {
+            result = FALSE;
+            break;
+        }
+        if (message)
+            handle_message (greeter, message, message_length);
+
+        /* Stop once everything that has arrived is handled */
+        GPollFD poll_fd = { lightdm_greeter_get_daemon_fd (greeter), G_IO_IN, 0 };
+        if (poll_fd.fd < 0 || g_poll (&poll_fd, 1, 0) <= 0)
+            break;
+    }
+    priv->dispatching = FALSE;
+
+    /* Call back requests now rather than from the GLib main context */
+    while (priv->dispatched_requests)
+    {
+        Request *request = priv->dispatched_requests->data;
+        priv->dispatched_requests = g_list_delete_link (priv->dispatched_requests, priv->dispatched_requests);
+        request_callback_cb (request);
+    }
+    g_object_unref (greeter);
+
+    return result;
+}
+
 static gboolean
 send_connect (LightDMGreeter *greeter, gboolean resettable, GError **error)
 {
     g_debug ("Connecting to display manager...");
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_CONNECT, string_length (VERSION) + int_length () * 2, &offset, error) &&
-           write_string (message, MAX_MESSAGE_LENGTH, VERSION, &offset, error) &&
-           write_int (message, MAX_MESSAGE_LENGTH, resettable ? 1 : 0, &offset, error) &&
-           write_int (message, MAX_MESSAGE_LENGTH, API_VERSION, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_CONNECT, common_greeter_protocol_string_size (VERSION) + GREETER_PROTOCOL_INT_SIZE * 2);
+    common_greeter_protocol_write_string (message, VERSION);
+    common_greeter_protocol_write_int (message, resettable ? 1 : 0);
+    common_greeter_protocol_write_int (message, GREETER_PROTOCOL_API_VERSION);
+    return send_message (greeter, message, error);
 }
 
 static gboolean
@@ -941,11 +1285,9 @@ send_start_session (LightDMGreeter *greeter, const gchar *session, GError **erro
     else
         g_debug ("Starting default session");
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_START_SESSION, string_length (session), &offset, error) &&
-           write_string (message, MAX_MESSAGE_LENGTH, session, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_START_SESSION, common_greeter_protocol_string_size (session));
+    common_greeter_protocol_write_string (message, session);
+    return send_message (greeter, message, error);
 }
 
 static gboolean
@@ -953,11 +1295,9 @@ send_ensure_shared_data_dir (LightDMGreeter *greeter, const gchar *username, GEr
 {
     g_debug ("Ensuring data directory for user %s", username);
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_ENSURE_SHARED_DIR, string_length (username), &offset, error) &&
-           write_string (message, MAX_MESSAGE_LENGTH, username, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_ENSURE_SHARED_DIR, common_greeter_protocol_string_size (username));
+    common_greeter_protocol_write_string (message, username);
+    return send_message (greeter, message, error);
 }
 
 /**
@@ -1093,14 +1433,8 @@ const gchar *
 lightdm_greeter_get_default_session_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "default-session");
-}
-
-static gboolean
-get_boolean_hint (LightDMGreeter *greeter, const gchar *name)
-{
-    const gchar *value = lightdm_greeter_get_hint (greeter, name);
-    return g_strcmp0 (value, "true") == 0;
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.default_session;
 }
 
 /**
@@ -1121,7 +1455,8 @@ gboolean
 lightdm_greeter_get_hide_users_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "hide-users");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.hide_users;
 }
 
 /**
@@ -1139,7 +1474,8 @@ gboolean
 lightdm_greeter_get_show_manual_login_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "show-manual-login");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.show_manual_login;
 }
 
 /**
@@ -1155,7 +1491,8 @@ gboolean
 lightdm_greeter_get_show_remote_login_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "show-remote-login");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.show_remote_login;
 }
 
 /**
@@ -1170,7 +1507,8 @@ gboolean
 lightdm_greeter_get_lock_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "lock-screen");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.lock;
 }
 
 /**
@@ -1184,12 +1522,9 @@ lightdm_greeter_get_lock_hint (LightDMGreeter *greeter)
 gboolean
 lightdm_greeter_get_has_guest_account_hint (LightDMGreeter *greeter)
 {
-    const gchar *value;
-
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    value = lightdm_greeter_get_hint (greeter, "has-guest-account");
-
-    return g_strcmp0 (value, "true") == 0;
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.has_guest_account;
 }
 
 /**
@@ -1204,7 +1539,8 @@ const gchar *
 lightdm_greeter_get_select_user_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "select-user");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.select_user;
 }
 
 /**
@@ -1219,7 +1555,8 @@ gboolean
 lightdm_greeter_get_select_guest_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "select-guest");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.select_guest;
 }
 
 /**
@@ -1234,7 +1571,8 @@ const gchar *
 lightdm_greeter_get_autologin_user_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "autologin-user");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.autologin_user;
 }
 
 /**
@@ -1249,7 +1587,8 @@ const gchar *
 lightdm_greeter_get_autologin_session_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), NULL);
-    return lightdm_greeter_get_hint (greeter, "autologin-session");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.autologin_session;
 }
 
 /**
@@ -1264,7 +1603,8 @@ gboolean
 lightdm_greeter_get_autologin_guest_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-    return get_boolean_hint (greeter, "autologin-guest");
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.autologin_guest;
 }
 
 /**
@@ -1279,15 +1619,8 @@ gint
 lightdm_greeter_get_autologin_timeout_hint (LightDMGreeter *greeter)
 {
     g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
-
-    const gchar *value = lightdm_greeter_get_hint (greeter, "autologin-timeout");
-    gint timeout = 0;
-    if (value)
-        timeout = atoi (value);
-    if (timeout < 0)
-        timeout = 0;
-
-    return timeout;
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+    return priv->parsed_hints.autologin_timeout;
 }
 
 /**
@@ -1328,7 +1661,7 @@ lightdm_greeter_authenticate (LightDMGreeter *greeter, const gchar *username, GE
     g_return_val_if_fail (priv->connected, FALSE);
 
     priv->cancelling_authentication = FALSE;
-    priv->authenticate_sequence_number++;
+    priv->authenticate_sequence_number = ++priv->last_sequence_number;
     priv->in_authentication = TRUE;
     priv->is_authenticated = FALSE;
     if (username != priv->authentication_user)
@@ -1338,12 +1671,10 @@ lightdm_greeter_authenticate (LightDMGreeter *greeter, const gchar *username, GE
     }
 
     g_debug ("Starting authentication for user %s...", username);
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_AUTHENTICATE, int_length () + string_length (username), &offset, error) &&
-           write_int (message, MAX_MESSAGE_LENGTH, priv->authenticate_sequence_number, &offset, error) &&
-           write_string (message, MAX_MESSAGE_LENGTH, username, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_AUTHENTICATE, GREETER_PROTOCOL_INT_SIZE + common_greeter_protocol_string_size (username));
+    common_greeter_protocol_write_int (message, priv->authenticate_sequence_number);
+    common_greeter_protocol_write_string (message, username);
+    return send_message (greeter, message, error);
 }
 
 /**
@@ -1365,18 +1696,16 @@ lightdm_greeter_authenticate_as_guest (LightDMGreeter *greeter, GError **error)
     g_return_val_if_fail (priv->connected, FALSE);
 
     priv->cancelling_authentication = FALSE;
-    priv->authenticate_sequence_number++;
+    priv->authenticate_sequence_number = ++priv->last_sequence_number;
     priv->in_authentication = TRUE;
     priv->is_authenticated = FALSE;
     g_free (priv->authentication_user);
     priv->authentication_user = NULL;
 
     g_debug ("Starting authentication for guest account...");
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_AUTHENTICATE_AS_GUEST, int_length (), &offset, error) &&
-           write_int (message, MAX_MESSAGE_LENGTH, priv->authenticate_sequence_number, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_AUTHENTICATE_AS_GUEST, GREETER_PROTOCOL_INT_SIZE);
+    common_greeter_protocol_write_int (message, priv->authenticate_sequence_number);
+    return send_message (greeter, message, error);
 }
 
 /**
@@ -1425,7 +1754,7 @@ lightdm_greeter_authenticate_remote (LightDMGreeter *greeter, const gchar *sessi
     g_return_val_if_fail (priv->connected, FALSE);
 
     priv->cancelling_authentication = FALSE;
-    priv->authenticate_sequence_number++;
+    priv->authenticate_sequence_number = ++priv->last_sequence_number;
     priv->in_authentication = TRUE;
     priv->is_authenticated = FALSE;
     g_free (priv->authentication_user);
@@ -1436,13 +1765,11 @@ lightdm_greeter_authenticate_remote (LightDMGreeter *greeter, const gchar *sessi
     else
         g_debug ("Starting authentication for remote session %s...", session);
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_AUTHENTICATE_REMOTE, int_length () + string_length (session) + string_length (username), &offset, error) &&
-           write_int (message, MAX_MESSAGE_LENGTH, priv->authenticate_sequence_number, &offset, error) &&
-           write_string (message, MAX_MESSAGE_LENGTH, session, &offset, error) &&
-           write_string (message, MAX_MESSAGE_LENGTH, username, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_AUTHENTICATE_REMOTE, GREETER_PROTOCOL_INT_SIZE + common_greeter_protocol_string_size (session) + common_greeter_protocol_string_size (username));
+    common_greeter_protocol_write_int (message, priv->authenticate_sequence_number);
+    common_greeter_protocol_write_string (message, session);
+    common_greeter_protocol_write_string (message, username);
+    return send_message (greeter, message, error);
 }
 
 /**
@@ -1469,25 +1796,15 @@ lightdm_greeter_respond (LightDMGreeter *greeter, const gchar *response, GError
     priv->n_responses_waiting--;
     priv->responses_received = g_list_append (priv->responses_received, g_strdup (response));
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
     if (priv->n_responses_waiting == 0)
     {
         g_debug ("Providing response to display manager");
 
-        guint32 msg_length = int_length ();
-        for (GList *iter = priv->responses_received; iter; iter = iter->next)
-            msg_length += string_length ((gchar *)iter->data);
-
-        if (!write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_CONTINUE_AUTHENTICATION, msg_length, &offset, error) ||
-            !write_int (message, MAX_MESSAGE_LENGTH, g_list_length (priv->responses_received), &offset, error))
-            return FALSE;
-        for (GList *iter = priv->responses_received; iter; iter = iter->next)
-        {
-            if (!write_string (message, MAX_MESSAGE_LENGTH, (gchar *)iter->data, &offset, error))
-                return FALSE;
-        }
-        if (!send_message (greeter, message, offset, error))
+        g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_CONTINUE_AUTHENTICATION, responses_length (priv->responses_received));
+        write_responses (message, priv->responses_received);
+        gboolean result = send_message (greeter, message, error);
+        wipe_message (message);
+        if (!result)
             return FALSE;
 
         g_list_free_full (priv->responses_received, g_free);
@@ -1516,10 +1833,194 @@ lightdm_greeter_cancel_authentication (LightDMGreeter *greeter, GError **error)
     g_return_val_if_fail (priv->connected, FALSE);
 
     priv->cancelling_authentication = TRUE;
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_CANCEL_AUTHENTICATION, 0, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_CANCEL_AUTHENTICATION, 0);
+    return send_message (greeter, message, error);
+}
+
+static PreAuthentication *
+get_preauthentication (LightDMGreeter *greeter, guint id, GError **error)
+{
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    PreAuthentication *preauthentication = g_hash_table_lookup (priv->preauthentications, GUINT_TO_POINTER (id));
+    if (!preauthentication)
+        g_set_error (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_INVALID_USER,
+                     "No pre-authentication with ID %u", id);
+
+    return preauthentication;
+}
+
+/**
+ * lightdm_greeter_preauthenticate:
+ * @greeter: A #LightDMGreeter
+ * @username: (allow-none): A username or #NULL to prompt for a username.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Starts authenticating a user while leaving the current authentication
+ * running so a likely next user can be authenticated ahead of time.  Prompts
+ * and messages are reported with the #LightDMGreeter::show-preauthentication-prompt
+ * and #LightDMGreeter::show-preauthentication-message signals and the result
+ * with #LightDMGreeter::preauthentication-complete.  Use
+ * lightdm_greeter_select_preauthentication() to make it the current
+ * authentication.
+ *
+ * Return value: An ID for the pre-authentication or 0 if the request could not be sent.
+ **/
+guint
+lightdm_greeter_preauthenticate (LightDMGreeter *greeter, const gchar *username, GError **error)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), 0);
+
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    g_return_val_if_fail (priv->connected, 0);
+
+    if (priv->api_version < GREETER_PROTOCOL_PREAUTHENTICATION_API_VERSION)
+    {
+        g_set_error_literal (error, LIGHTDM_GREETER_ERROR, LIGHTDM_GREETER_ERROR_COMMUNICATION_ERROR,
+                             "Daemon does not support pre-authentication");
+        return 0;
+    }
+
+    guint32 sequence_number = ++priv->last_sequence_number;
+
+    g_debug ("Starting pre-authentication %u for user %s...", sequence_number, username);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_PREAUTHENTICATE, GREETER_PROTOCOL_INT_SIZE + common_greeter_protocol_string_size (username));
+    common_greeter_protocol_write_int (message, sequence_number);
+    common_greeter_protocol_write_string (message, username);
+    if (!send_message (greeter, message, error))
+        return 0;
+
+    PreAuthentication *preauthentication = g_malloc0 (sizeof (PreAuthentication));
+    preauthentication->username = g_strdup (username);
+    g_hash_table_insert (priv->preauthentications, GUINT_TO_POINTER (sequence_number), preauthentication);
+
+    return sequence_number;
+}
+
+/**
+ * lightdm_greeter_respond_preauthentication:
+ * @greeter: A #LightDMGreeter
+ * @id: ID returned from lightdm_greeter_preauthenticate()
+ * @response: Response to a prompt
+ * @error: return location for a #GError, or %NULL
+ *
+ * Provide response to a pre-authentication prompt.  May be one in a series.
+ *
+ * Return value: #TRUE if response sent.
+ **/
+gboolean
+lightdm_greeter_respond_preauthentication (LightDMGreeter *greeter, guint id, const gchar *response, GError **error)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
+    g_return_val_if_fail (response != NULL, FALSE);
+
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    g_return_val_if_fail (priv->connected, FALSE);
+
+    PreAuthentication *preauthentication = get_preauthentication (greeter, id, error);
+    if (!preauthentication)
+        return FALSE;
+    g_return_val_if_fail (preauthentication->n_responses_waiting > 0, FALSE);
+
+    preauthentication->n_responses_waiting--;
+    preauthentication->responses_received = g_list_append (preauthentication->responses_received, g_strdup (response));
+
+    if (preauthentication->n_responses_waiting == 0)
+    {
+        g_debug ("Providing pre-authentication %u response to display manager", id);
+
+        g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_CONTINUE_PREAUTHENTICATION, GREETER_PROTOCOL_INT_SIZE + responses_length (preauthentication->responses_received));
+        common_greeter_protocol_write_int (message, id);
+        write_responses (message, preauthentication->responses_received);
+        gboolean result = send_message (greeter, message, error);
+        wipe_message (message);
+        if (!result)
+            return FALSE;
+
+        g_list_free_full (preauthentication->responses_received, g_free);
+        preauthentication->responses_received = NULL;
+    }
+
+    return TRUE;
+}
+
+/**
+ * lightdm_greeter_cancel_preauthentication:
+ * @greeter: A #LightDMGreeter
+ * @id: ID returned from lightdm_greeter_preauthenticate()
+ * @error: return location for a #GError, or %NULL
+ *
+ * Cancel a pre-authentication.  No further signals will be emitted for it.
+ *
+ * Return value: #TRUE if cancel request sent.
+ **/
+gboolean
+lightdm_greeter_cancel_preauthentication (LightDMGreeter *greeter, guint id, GError **error)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
+
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    g_return_val_if_fail (priv->connected, FALSE);
+
+    if (!get_preauthentication (greeter, id, error))
+        return FALSE;
+    g_hash_table_remove (priv->preauthentications, GUINT_TO_POINTER (id));
+
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_CANCEL_PREAUTHENTICATION, GREETER_PROTOCOL_INT_SIZE);
+    common_greeter_protocol_write_int (message, id);
+    return send_message (greeter, message, error);
+}
+
+/**
+ * lightdm_greeter_select_preauthentication:
+ * @greeter: A #LightDMGreeter
+ * @id: ID returned from lightdm_greeter_preauthenticate()
+ * @error: return location for a #GError, or %NULL
+ *
+ * Make a pre-authentication the current authentication, replacing any
+ * authentication in progress.  If the pre-authentication has already
+ * completed successfully lightdm_greeter_start_session() can be called
+ * immediately, otherwise remaining prompts are answered with
+ * lightdm_greeter_respond() and completion is reported with
+ * #LightDMGreeter::authentication-complete.
+ *
+ * Return value: #TRUE if select request sent.
+ **/
+gboolean
+lightdm_greeter_select_preauthentication (LightDMGreeter *greeter, guint id, GError **error)
+{
+    g_return_val_if_fail (LIGHTDM_IS_GREETER (greeter), FALSE);
+
+    LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
+
+    g_return_val_if_fail (priv->connected, FALSE);
+
+    PreAuthentication *preauthentication = get_preauthentication (greeter, id, error);
+    if (!preauthentication)
+        return FALSE;
+
+    g_debug ("Selecting pre-authentication %u for user %s", id, preauthentication->username);
+
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_SELECT_PREAUTHENTICATION, GREETER_PROTOCOL_INT_SIZE);
+    common_greeter_protocol_write_int (message, id);
+    if (!send_message (greeter, message, error))
+        return FALSE;
+
+    priv->cancelling_authentication = FALSE;
+    priv->authenticate_sequence_number = id;
+    priv->in_authentication = !preauthentication->complete;
+    priv->is_authenticated = preauthentication->is_authenticated;
+    g_free (priv->authentication_user);
+    priv->authentication_user = g_steal_pointer (&preauthentication->username);
+    g_list_free_full (priv->responses_received, g_free);
+    priv->responses_received = g_steal_pointer (&preauthentication->responses_received);
+    priv->n_responses_waiting = preauthentication->n_responses_waiting;
+    g_hash_table_remove (priv->preauthentications, GUINT_TO_POINTER (id));
+
+    return TRUE;
 }
 
 /**
@@ -1592,11 +2093,9 @@ lightdm_greeter_set_language (LightDMGreeter *greeter, const gchar *language, GE
 
     g_return_val_if_fail (priv->connected, FALSE);
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    return write_header (message, MAX_MESSAGE_LENGTH, GREETER_MESSAGE_SET_LANGUAGE, string_length (language), &offset, error) &&
-           write_string (message, MAX_MESSAGE_LENGTH, language, &offset, error) &&
-           send_message (greeter, message, offset, error);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (GREETER_MESSAGE_SET_LANGUAGE, common_greeter_protocol_string_size (language));
+    common_greeter_protocol_write_string (message, language);
+    return send_message (greeter, message, error);
 }
 
 /**
@@ -1795,8 +2294,10 @@ lightdm_greeter_init (LightDMGreeter *greeter)
 {
     LightDMGreeterPrivate *priv = lightdm_greeter_get_instance_private (greeter);
 
-    priv->read_buffer = g_malloc (HEADER_SIZE);
+    priv->read_buffer = g_malloc (GREETER_PROTOCOL_HEADER_SIZE);
     priv->hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->preauthentications = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) preauthentication_free);
+    priv->prefetched_images = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
@@ -1894,6 +2395,14 @@ lightdm_greeter_finalize (GObject *object)
     g_clear_pointer (&priv->authentication_user, g_free);
     g_hash_table_unref (priv->hints);
     priv->hints = NULL;
+    g_hash_table_unref (priv->preauthentications);
+    priv->preauthentications = NULL;
+    /* Drop anything not yet read, but wait for the current file so the thread is gone */
+    if (priv->prefetch_pool)
+        g_thread_pool_free (priv->prefetch_pool, TRUE, TRUE);
+    priv->prefetch_pool = NULL;
+    g_hash_table_unref (priv->prefetched_images);
+    priv->prefetched_images = NULL;
 
     G_OBJECT_CLASS (lightdm_greeter_parent_class)->finalize (object);
 }
@@ -2137,6 +2646,66 @@ lightdm_greeter_class_init (LightDMGreeterClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 0);
+
+    /**
+     * LightDMGreeter::show-preauthentication-prompt:
+     * @greeter: A #LightDMGreeter
+     * @id: Pre-authentication ID
+     * @text: Prompt text
+     * @type: Prompt type
+     *
+     * The ::show-preauthentication-prompt signal gets emitted when a
+     * pre-authentication started with lightdm_greeter_preauthenticate()
+     * needs a response.
+     *
+     * Call lightdm_greeter_respond_preauthentication() with the resultant input or
+     * lightdm_greeter_cancel_preauthentication() to abort the pre-authentication.
+     **/
+    signals[SHOW_PREAUTHENTICATION_PROMPT] =
+        g_signal_new (LIGHTDM_GREETER_SIGNAL_SHOW_PREAUTHENTICATION_PROMPT,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMGreeterClass, show_preauthentication_prompt),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_STRING, lightdm_prompt_type_get_type ());
+
+    /**
+     * LightDMGreeter::show-preauthentication-message:
+     * @greeter: A #LightDMGreeter
+     * @id: Pre-authentication ID
+     * @text: Message text
+     * @type: Message type
+     *
+     * The ::show-preauthentication-message signal gets emitted when a
+     * pre-authentication has a message to show to the user.
+     **/
+    signals[SHOW_PREAUTHENTICATION_MESSAGE] =
+        g_signal_new (LIGHTDM_GREETER_SIGNAL_SHOW_PREAUTHENTICATION_MESSAGE,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMGreeterClass, show_preauthentication_message),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_STRING, lightdm_message_type_get_type ());
+
+    /**
+     * LightDMGreeter::preauthentication-complete:
+     * @greeter: A #LightDMGreeter
+     * @id: Pre-authentication ID
+     * @is_authenticated: #TRUE if the user was authenticated
+     *
+     * The ::preauthentication-complete signal gets emitted when a
+     * pre-authentication has completed.
+     **/
+    signals[PREAUTHENTICATION_COMPLETE] =
+        g_signal_new (LIGHTDM_GREETER_SIGNAL_PREAUTHENTICATION_COMPLETE,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMGreeterClass, preauthentication_complete),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_BOOLEAN);
 }
 
 static void
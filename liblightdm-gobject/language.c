@@ -8,13 +8,16 @@
  * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
  */
 
+#include <errno.h>
 #include <string.h>
 #include <locale.h>
-#include <langinfo.h>
 #include <stdio.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include "lightdm/language.h"
+#include "locale-index.h"
+#include "resource-bundle.h"
 
 /**
  * SECTION:language
@@ -55,55 +58,164 @@ G_DEFINE_TYPE_WITH_PRIVATE (LightDMLanguage, lightdm_language, G_TYPE_OBJECT)
 static gboolean have_languages = FALSE;
 static GList *languages = NULL;
 
+/* Installed locales, sorted by name */
+static GPtrArray *locales = NULL;
+static GHashTable *locales_by_name = NULL;
+
+static gboolean
+is_utf8 (const gchar *code)
+{
+    return g_strrstr (code, ".utf8") || g_strrstr (code, ".UTF-8");
+}
+
+static gint64
+get_mtime (const gchar *path)
+{
+    GStatBuf info;
+    if (g_stat (path, &info) < 0)
+        return 0;
+    return info.st_mtime;
+}
+
+static gchar *
+get_locale_cache_path (void)
+{
+    return g_build_filename (g_get_user_cache_dir (), "lightdm", "locales", NULL);
+}
+
+/* Load the locales saved from last time, if the installed locales haven't changed since */
+static gboolean
+load_locale_cache (gint64 archive_mtime, gint64 dir_mtime)
+{
+    g_autofree gchar *path = get_locale_cache_path ();
+    g_autoptr(GKeyFile) cache = g_key_file_new ();
+    if (!g_key_file_load_from_file (cache, path, G_KEY_FILE_NONE, NULL))
+        return FALSE;
+
+    if (g_key_file_get_int64 (cache, "Locales", "ArchiveTime", NULL) != archive_mtime ||
+        g_key_file_get_int64 (cache, "Locales", "DirectoryTime", NULL) != dir_mtime)
+        return FALSE;
+
+    g_auto(GStrv) groups = g_key_file_get_groups (cache, NULL);
+    for (gint i = 0; groups[i]; i++)
+    {
+        if (strcmp (groups[i], "Locales") == 0)
+            continue;
+
+        CommonLocale *info = g_malloc0 (sizeof (CommonLocale));
+        info->name = g_strdup (groups[i]);
+        info->language = g_key_file_get_string (cache, groups[i], "Language", NULL);
+        info->territory = g_key_file_get_string (cache, groups[i], "Territory", NULL);
+        g_ptr_array_add (locales, info);
+    }
+
+    return TRUE;
+}
+
+static void
+save_locale_cache (gint64 archive_mtime, gint64 dir_mtime)
+{
+    g_autoptr(GKeyFile) cache = g_key_file_new ();
+    g_key_file_set_int64 (cache, "Locales", "ArchiveTime", archive_mtime);
+    g_key_file_set_int64 (cache, "Locales", "DirectoryTime", dir_mtime);
+    for (guint i = 0; i < locales->len; i++)
+    {
+        CommonLocale *info = g_ptr_array_index (locales, i);
+        g_key_file_set_string (cache, info->name, "Language", info->language ? info->language : "");
+        g_key_file_set_string (cache, info->name, "Territory", info->territory ? info->territory : "");
+    }
+
+    g_autofree gchar *path = get_locale_cache_path ();
+    g_autofree gchar *dir = g_path_get_dirname (path);
+    g_autoptr(GError) error = NULL;
+    gsize length;
+    g_autofree gchar *data = g_key_file_to_data (cache, &length, NULL);
+    if (g_mkdir_with_parents (dir, 0700) < 0 || !g_file_set_contents (path, data, length, &error))
+        g_debug ("Failed to save locale cache %s: %s", path, error ? error->message : g_strerror (errno));
+}
+
+static gint
+compare_locale (gconstpointer a, gconstpointer b)
+{
+    const CommonLocale *info_a = *((const CommonLocale **) a), *info_b = *((const CommonLocale **) b);
+    return strcmp (info_a->name, info_b->name);
+}
+
+/* Build the index of installed locales, this replaces running 'locale -a' */
+static void
+update_locales (void)
+{
+    if (locales)
+        return;
+
+    locales = g_ptr_array_new_with_free_func ((GDestroyNotify) common_locale_free);
+    locales_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
+    /* Use the locales the daemon found if it passed them to us */
+    g_autoptr(GVariant) bundled_locales = common_resource_bundle_lookup ("locales", G_VARIANT_TYPE (COMMON_LOCALE_INDEX_TYPE));
+    if (bundled_locales)
+        common_locale_index_add_from_variant (locales, bundled_locales);
+    else
+    {
+        gint64 archive_mtime = get_mtime (LOCALE_ARCHIVE);
+        gint64 dir_mtime = get_mtime (SYSTEM_LOCALE_DIR);
+        if (!load_locale_cache (archive_mtime, dir_mtime))
+        {
+            g_ptr_array_unref (locales);
+            locales = common_locale_index_scan ();
+            save_locale_cache (archive_mtime, dir_mtime);
+        }
+    }
+
+    g_ptr_array_sort (locales, compare_locale);
+    for (guint i = 0; i < locales->len; i++)
+    {
+        CommonLocale *info = g_ptr_array_index (locales, i);
+        g_hash_table_insert (locales_by_name, info->name, info);
+    }
+}
+
 static void
 update_languages (void)
 {
     if (have_languages)
         return;
 
-    const gchar *command = "locale -a";
-    g_autofree gchar *stdout_text = NULL;
-    g_autofree gchar *stderr_text = NULL;
-    gint exit_status;
-    g_autoptr(GError) error = NULL;
-    gboolean result = g_spawn_command_line_sync (command, &stdout_text, &stderr_text, &exit_status, &error);
-    if (error)
-        g_warning ("Failed to run '%s': %s", command, error->message);
-    else if (exit_status != 0)
-        g_warning ("Failed to get languages, '%s' returned %d", command, exit_status);
-    else if (result)
+    update_locales ();
+    for (guint i = 0; i < locales->len; i++)
     {
-        g_auto(GStrv) tokens = g_strsplit_set (stdout_text, "\n\r", -1);
-        for (int i = 0; tokens[i]; i++)
-        {
-            const gchar *code = g_strchug (tokens[i]);
-            if (code[0] == '\0')
-                continue;
+        CommonLocale *info = g_ptr_array_index (locales, i);
 
-            /* Ignore the non-interesting languages */
-            if (strcmp (command, "locale -a") == 0 && !g_strrstr (code, ".utf8"))
-                continue;
+        /* Ignore the non-interesting languages */
+        if (!g_strrstr (info->name, ".utf8"))
+            continue;
 
-            LightDMLanguage *language = g_object_new (LIGHTDM_TYPE_LANGUAGE, "code", code, NULL);
-            languages = g_list_append (languages, language);
-        }
+        LightDMLanguage *language = g_object_new (LIGHTDM_TYPE_LANGUAGE, "code", info->name, NULL);
+        languages = g_list_append (languages, language);
     }
 
     have_languages = TRUE;
 }
 
-static gboolean
-is_utf8 (const gchar *code)
+/* Get the installed locale for a language code, so we can get language and country names. */
+static CommonLocale *
+get_locale (const gchar *code)
 {
-    return g_strrstr (code, ".utf8") || g_strrstr (code, ".UTF-8");
-}
+    update_locales ();
 
-/* Get a valid locale name that can be passed to setlocale(), so we always can use nl_langinfo() to get language and country names. */
-static gchar *
-get_locale_name (const gchar *code)
-{
     if (is_utf8 (code))
-        return g_strdup (code);
+    {
+        /* Locales are installed with the codeset normalized, e.g. 'de_DE.UTF-8' is 'de_DE.utf8' */
+        g_autoptr(GString) name = g_string_new ("");
+        const gchar *c = code;
+        for (; *c && *c != '.'; c++)
+            g_string_append_c (name, *c);
+        g_string_append (name, ".utf8");
+        const gchar *at = strchr (c, '@');
+        if (at)
+            g_string_append (name, at);
+        return g_hash_table_lookup (locales_by_name, name->str);
+    }
 
     g_autofree gchar *language = NULL;
     const char *at = strchr (code, '@');
@@ -112,32 +224,29 @@ get_locale_name (const gchar *code)
     else
         language = g_strdup (code);
 
-    static gchar **avail_locales;
-    if (!avail_locales)
+    for (guint i = 0; i < locales->len; i++)
     {
-        g_autofree gchar *locales = NULL;
-        g_autoptr(GError) error = NULL;
-        if (g_spawn_command_line_sync ("locale -a", &locales, NULL, NULL, &error))
-            avail_locales = g_strsplit (g_strchomp (locales), "\n", -1);
-        else
-            g_warning ("Failed to run 'locale -a': %s", error->message);
-    }
-
-    if (!avail_locales)
-        return NULL;
-
-    for (gint i = 0; avail_locales[i]; i++)
-    {
-        const gchar *loc = avail_locales[i];
-        if (!g_strrstr (loc, ".utf8"))
+        CommonLocale *info = g_ptr_array_index (locales, i);
+        if (!g_strrstr (info->name, ".utf8"))
             continue;
-        if (g_str_has_prefix (loc, language))
-            return g_strdup (loc);
+        if (g_str_has_prefix (info->name, language))
+            return info;
     }
 
     return NULL;
 }
 
+/* Translate a name into the language of the user's environment */
+static gchar *
+translate_name (const gchar *domain, const gchar *name)
+{
+    g_autofree gchar *current = g_strdup (setlocale (LC_MESSAGES, NULL));
+    setlocale (LC_MESSAGES, "");
+    gchar *translated = g_strdup (dgettext (domain, name));
+    setlocale (LC_MESSAGES, current);
+    return translated;
+}
+
 /**
  * lightdm_get_language:
  *
@@ -176,6 +285,39 @@ lightdm_get_languages (void)
     return languages;
 }
 
+/**
+ * lightdm_get_languages_variant:
+ *
+ * Get the fields of the languages returned by lightdm_get_languages() in one
+ * value, so greeters using language bindings can fill their language list in
+ * one call.  The value is an array of dictionaries (type aa{sv}) with the keys
+ * "code", "name" and "territory".
+ *
+ * Return value: (transfer full): A #GVariant with the language fields.
+ **/
+GVariant *
+lightdm_get_languages_variant (void)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+    for (GList *link = lightdm_get_languages (); link; link = link->next)
+    {
+        LightDMLanguage *language = link->data;
+
+        g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&builder, "{sv}", "code", g_variant_new_string (lightdm_language_get_code (language)));
+        const gchar *name = lightdm_language_get_name (language);
+        if (name)
+            g_variant_builder_add (&builder, "{sv}", "name", g_variant_new_string (name));
+        const gchar *territory = lightdm_language_get_territory (language);
+        if (territory)
+            g_variant_builder_add (&builder, "{sv}", "territory", g_variant_new_string (territory));
+        g_variant_builder_close (&builder);
+    }
+
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 /**
  * lightdm_language_get_code:
  * @language: A #LightDMLanguage
@@ -210,19 +352,9 @@ lightdm_language_get_name (LightDMLanguage *language)
 
     if (!priv->name)
     {
-        g_autofree gchar *locale = get_locale_name (priv->code);
-        if (locale)
-        {
-            const gchar *current = setlocale (LC_ALL, NULL);
-            setlocale (LC_IDENTIFICATION, locale);
-            setlocale (LC_MESSAGES, "");
-
-            const gchar *language_en = nl_langinfo (_NL_IDENTIFICATION_LANGUAGE);
-            if (language_en && strlen (language_en) > 0)
-                priv->name = g_strdup (dgettext ("iso_639_3", language_en));
-
-            setlocale (LC_ALL, current);
-        }
+        CommonLocale *locale = get_locale (priv->code);
+        if (locale && locale->language && strlen (locale->language) > 0)
+            priv->name = translate_name ("iso_639_3", locale->language);
         if (!priv->name)
         {
             g_auto(GStrv) tokens = g_strsplit_set (priv->code, "_.@", 2);
@@ -250,19 +382,9 @@ lightdm_language_get_territory (LightDMLanguage *language)
 
     if (!priv->territory && strchr (priv->code, '_'))
     {
-        g_autofree gchar *locale = get_locale_name (priv->code);
-        if (locale)
-        {
-            gchar *current = setlocale (LC_ALL, NULL);
-            setlocale (LC_IDENTIFICATION, locale);
-            setlocale (LC_MESSAGES, "");
-
-            gchar *country_en = nl_langinfo (_NL_IDENTIFICATION_TERRITORY);
-            if (country_en && strlen (country_en) > 0 && g_strcmp0 (country_en, "ISO") != 0)
-                priv->territory = g_strdup (dgettext ("iso_3166", country_en));
-
-            setlocale (LC_ALL, current);
-        }
+        CommonLocale *locale = get_locale (priv->code);
+        if (locale && locale->territory && strlen (locale->territory) > 0 && g_strcmp0 (locale->territory, "ISO") != 0)
+            priv->territory = translate_name ("iso_3166", locale->territory);
         if (!priv->territory)
         {
             g_auto(GStrv) tokens = g_strsplit_set (priv->code, "_.@", 3);
@@ -9,6 +9,10 @@
  * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
  */
 
+#include <errno.h>
+#include <locale.h>
+#include <string.h>
+#include <glib/gstdio.h>
 #include <libxklavier/xklavier.h>
 
 #include "lightdm/layout.h"
@@ -56,6 +60,21 @@ static XklConfigRec *xkl_config = NULL;
 static GList *layouts = NULL;
 static LightDMLayout *default_layout = NULL;
 
+/* Where the XKB rules the registry is loaded from are installed */
+#ifndef XKB_RULES_DIR
+#define XKB_RULES_DIR "/usr/share/X11/xkb/rules"
+#endif
+
+/* Cached registry: key, then the name, short description and description of each layout */
+#define LAYOUT_CACHE_TYPE "(sa(sss))"
+
+/* Table of layouts, either read from the registry or mapped from the cache */
+static GMappedFile *layout_cache = NULL;
+static GVariant *layout_table = NULL;
+
+/* Layout objects, created as they are requested */
+static GHashTable *layout_objects = NULL;
+
 static gchar *
 make_layout_string (const gchar *layout, const gchar *variant)
 {
@@ -85,14 +104,40 @@ parse_layout_string (const gchar *name, gchar **layout, gchar **variant)
     }
 }
 
+static gboolean
+load_xkl_config (void)
+{
+    if (xkl_config)
+        return TRUE;
+
+    if (!display)
+        display = XOpenDisplay (NULL);
+    if (display == NULL)
+        return FALSE;
+
+    xkl_engine = xkl_engine_get_instance (display);
+    xkl_config = xkl_config_rec_new ();
+    if (!xkl_config_rec_get_from_server (xkl_config, xkl_engine))
+        g_warning ("Failed to get Xkl configuration from server");
+
+    return TRUE;
+}
+
+/* State while reading layouts from the registry */
+typedef struct
+{
+    GVariantBuilder *builder;
+    const gchar *layout_name;
+} RegistryReader;
+
 static void
 variant_cb (XklConfigRegistry *config,
            const XklConfigItem *item,
            gpointer data)
 {
-    g_autofree gchar *full_name = make_layout_string (data, item->name);
-    LightDMLayout *layout = g_object_new (LIGHTDM_TYPE_LAYOUT, "name", full_name, "short-description", item->short_description, "description", item->description, NULL);
-    layouts = g_list_append (layouts, layout);
+    RegistryReader *reader = data;
+    g_autofree gchar *full_name = make_layout_string (reader->layout_name, item->name);
+    g_variant_builder_add (reader->builder, "(sss)", full_name, item->short_description, item->description);
 }
 
 static void
@@ -100,10 +145,155 @@ layout_cb (XklConfigRegistry *config,
            const XklConfigItem *item,
            gpointer data)
 {
-    LightDMLayout *layout = g_object_new (LIGHTDM_TYPE_LAYOUT, "name", item->name, "short-description", item->short_description, "description", item->description, NULL);
-    layouts = g_list_append (layouts, layout);
+    RegistryReader *reader = data;
+    g_variant_builder_add (reader->builder, "(sss)", item->name, item->short_description, item->description);
+
+    reader->layout_name = item->name;
+    xkl_config_registry_foreach_layout_variant (config, item->name, variant_cb, reader);
+}
+
+/* The registry changes when the rules are updated, and has descriptions in the current language */
+static gchar *
+get_layout_cache_key (void)
+{
+    gint64 mtime = 0;
+    g_autoptr(GDir) dir = g_dir_open (XKB_RULES_DIR, 0, NULL);
+    const gchar *name;
+    while (dir && (name = g_dir_read_name (dir)))
+    {
+        if (!g_str_has_suffix (name, ".xml"))
+            continue;
+
+        g_autofree gchar *path = g_build_filename (XKB_RULES_DIR, name, NULL);
+        GStatBuf info;
+        if (g_stat (path, &info) == 0)
+            mtime = MAX (mtime, info.st_mtime);
+    }
+
+    return g_strdup_printf ("%" G_GINT64_FORMAT " %s %s", mtime, setlocale (LC_MESSAGES, NULL), g_getenv ("LANGUAGE") ? g_getenv ("LANGUAGE") : "");
+}
+
+static gchar *
+get_layout_cache_path (void)
+{
+    return g_build_filename (g_get_user_cache_dir (), "lightdm", "layouts", NULL);
+}
+
+static gboolean
+load_layout_cache (const gchar *key)
+{
+    g_autofree gchar *path = get_layout_cache_path ();
+    g_autoptr(GMappedFile) file = g_mapped_file_new (path, FALSE, NULL);
+    if (!file)
+        return FALSE;
+
+    g_autoptr(GBytes) data = g_mapped_file_get_bytes (file);
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (LAYOUT_CACHE_TYPE), data, FALSE));
+    const gchar *cache_key;
+    GVariant *table;
+    g_variant_get (cache, "(&s@a(sss))", &cache_key, &table);
+    if (strcmp (cache_key, key) != 0)
+    {
+        g_variant_unref (table);
+        return FALSE;
+    }
 
-    xkl_config_registry_foreach_layout_variant (config, item->name, variant_cb, (gpointer) item->name);
+    layout_cache = g_steal_pointer (&file);
+    layout_table = table;
+
+    return TRUE;
+}
+
+static void
+save_layout_cache (const gchar *key)
+{
+    g_autoptr(GVariant) cache = g_variant_ref_sink (g_variant_new ("(s@a(sss))", key, layout_table));
+
+    g_autofree gchar *path = get_layout_cache_path ();
+    g_autofree gchar *dir = g_path_get_dirname (path);
+    g_autoptr(GError) error = NULL;
+    if (g_mkdir_with_parents (dir, 0700) < 0 ||
+        !g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), &error))
+        g_debug ("Failed to save layout cache %s: %s", path, error ? error->message : g_strerror (errno));
+}
+
+/* Get the table of available layouts, only parsing the registry if it has changed since last time */
+static gboolean
+load_layout_table (void)
+{
+    if (layout_table)
+        return TRUE;
+
+    g_autofree gchar *key = get_layout_cache_key ();
+    if (load_layout_cache (key))
+        return TRUE;
+
+    if (!load_xkl_config ())
+        return FALSE;
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sss)"));
+    RegistryReader reader = { &builder, NULL };
+    XklConfigRegistry *registry = xkl_config_registry_get_instance (xkl_engine);
+    xkl_config_registry_load (registry, FALSE);
+    xkl_config_registry_foreach_layout (registry, layout_cb, &reader);
+    g_object_unref (registry);
+    layout_table = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+    save_layout_cache (key);
+
+    return TRUE;
+}
+
+/* Get the object for an entry in the layout table */
+static LightDMLayout *
+get_layout_object (GVariant *entry)
+{
+    const gchar *name, *short_description, *description;
+    g_variant_get (entry, "(&s&s&s)", &name, &short_description, &description);
+
+    if (!layout_objects)
+        layout_objects = g_hash_table_new (g_str_hash, g_str_equal);
+
+    LightDMLayout *layout = g_hash_table_lookup (layout_objects, name);
+    if (!layout)
+    {
+        layout = g_object_new (LIGHTDM_TYPE_LAYOUT, "name", name, "short-description", short_description, "description", description, NULL);
+        g_hash_table_insert (layout_objects, (gpointer) lightdm_layout_get_name (layout), layout);
+    }
+
+    return layout;
+}
+
+static LightDMLayout *
+find_layout (const gchar *name)
+{
+    if (!name || !load_layout_table ())
+        return NULL;
+
+    if (layout_objects)
+    {
+        LightDMLayout *layout = g_hash_table_lookup (layout_objects, name);
+        if (layout)
+            return layout;
+    }
+
+    GVariantIter iter;
+    g_variant_iter_init (&iter, layout_table);
+    GVariant *entry;
+    while ((entry = g_variant_iter_next_value (&iter)))
+    {
+        const gchar *entry_name;
+        g_variant_get_child (entry, 0, "&s", &entry_name);
+        LightDMLayout *layout = NULL;
+        if (strcmp (entry_name, name) == 0)
+            layout = get_layout_object (entry);
+        g_variant_unref (entry);
+        if (layout)
+            return layout;
+    }
+
+    return NULL;
 }
 
 /**
@@ -119,19 +309,18 @@ lightdm_get_layouts (void)
     if (have_layouts)
         return layouts;
 
-    display = XOpenDisplay (NULL);
-    if (display == NULL)
+    if (!load_layout_table ())
         return NULL;
 
-    xkl_engine = xkl_engine_get_instance (display);
-    xkl_config = xkl_config_rec_new ();
-    if (!xkl_config_rec_get_from_server (xkl_config, xkl_engine))
-        g_warning ("Failed to get Xkl configuration from server");
-
-    XklConfigRegistry *registry = xkl_config_registry_get_instance (xkl_engine);
-    xkl_config_registry_load (registry, FALSE);
-    xkl_config_registry_foreach_layout (registry, layout_cb, NULL);
-    g_object_unref (registry);
+    GVariantIter iter;
+    g_variant_iter_init (&iter, layout_table);
+    GVariant *entry;
+    while ((entry = g_variant_iter_next_value (&iter)))
+    {
+        layouts = g_list_prepend (layouts, get_layout_object (entry));
+        g_variant_unref (entry);
+    }
+    layouts = g_list_reverse (layouts);
 
     have_layouts = TRUE;
 
@@ -148,7 +337,8 @@ void
 lightdm_set_layout (LightDMLayout *dmlayout)
 {
     g_return_if_fail (dmlayout != NULL);
-    lightdm_get_layouts();
+    if (!load_xkl_config ())
+        return;
 
     g_debug ("Setting keyboard layout to '%s'", lightdm_layout_get_name (dmlayout));
 
@@ -156,14 +346,11 @@ lightdm_set_layout (LightDMLayout *dmlayout)
     g_autofree gchar *variant = NULL;
     parse_layout_string (lightdm_layout_get_name (dmlayout), &layout, &variant);
 
-    if (layouts && xkl_config)
-    {
-        xkl_config->layouts[0] = g_steal_pointer(&layout);
-        xkl_config->layouts[1] = NULL;
-        xkl_config->variants[0] = g_steal_pointer(&variant);
-        xkl_config->variants[1] = NULL;
-        default_layout = dmlayout;
-    }
+    xkl_config->layouts[0] = g_steal_pointer(&layout);
+    xkl_config->layouts[1] = NULL;
+    xkl_config->variants[0] = g_steal_pointer(&variant);
+    xkl_config->variants[1] = NULL;
+    default_layout = dmlayout;
     if (!xkl_config_rec_activate (xkl_config, xkl_engine))
         g_warning ("Failed to activate XKL config");
 }
@@ -178,22 +365,11 @@ lightdm_set_layout (LightDMLayout *dmlayout)
 LightDMLayout *
 lightdm_get_layout (void)
 {
-    lightdm_get_layouts ();
-
-    if (layouts && xkl_config && !default_layout)
+    if (!default_layout && load_xkl_config ())
     {
         g_autofree gchar *full_name = make_layout_string (xkl_config->layouts ? xkl_config->layouts[0] : NULL,
                                                           xkl_config->variants ? xkl_config->variants[0] : NULL);
-
-        for (GList *item = layouts; item; item = item->next)
-        {
-            LightDMLayout *iter_layout = (LightDMLayout *) item->data;
-            if (g_strcmp0 (lightdm_layout_get_name (iter_layout), full_name) == 0)
-            {
-                default_layout = iter_layout;
-                break;
-            }
-        }
+        default_layout = find_layout (full_name);
     }
 
     return default_layout;
@@ -34,6 +34,9 @@ typedef struct _LightDMGreeterClass     LightDMGreeterClass;
 #define LIGHTDM_GREETER_SIGNAL_AUTOLOGIN_TIMER_EXPIRED "autologin-timer-expired"
 #define LIGHTDM_GREETER_SIGNAL_IDLE                    "idle"
 #define LIGHTDM_GREETER_SIGNAL_RESET                   "reset"
+#define LIGHTDM_GREETER_SIGNAL_SHOW_PREAUTHENTICATION_PROMPT  "show-preauthentication-prompt"
+#define LIGHTDM_GREETER_SIGNAL_SHOW_PREAUTHENTICATION_MESSAGE "show-preauthentication-message"
+#define LIGHTDM_GREETER_SIGNAL_PREAUTHENTICATION_COMPLETE     "preauthentication-complete"
 
 /**
  * LightDMPromptType:
@@ -79,11 +82,11 @@ struct _LightDMGreeterClass
     void (*autologin_timer_expired)(LightDMGreeter *greeter);
     void (*idle)(LightDMGreeter *greeter);
     void (*reset)(LightDMGreeter *greeter);
+    void (*show_preauthentication_prompt)(LightDMGreeter *greeter, guint id, const gchar *text, LightDMPromptType type);
+    void (*show_preauthentication_message)(LightDMGreeter *greeter, guint id, const gchar *text, LightDMMessageType type);
+    void (*preauthentication_complete)(LightDMGreeter *greeter, guint id, gboolean is_authenticated);
 
     /* Reserved */
-    void (*reserved1) (void);
-    void (*reserved2) (void);
-    void (*reserved3) (void);
     void (*reserved4) (void);
 };
 
@@ -130,6 +133,12 @@ gboolean lightdm_greeter_connect_to_daemon_finish (LightDMGreeter *greeter, GAsy
 
 gboolean lightdm_greeter_connect_to_daemon_sync (LightDMGreeter *greeter, GError **error);
 
+void lightdm_greeter_set_external_dispatch (LightDMGreeter *greeter, gboolean external_dispatch);
+
+gint lightdm_greeter_get_daemon_fd (LightDMGreeter *greeter);
+
+gboolean lightdm_greeter_dispatch (LightDMGreeter *greeter, GError **error);
+
 const gchar *lightdm_greeter_get_hint (LightDMGreeter *greeter, const gchar *name);
 
 const gchar *lightdm_greeter_get_default_session_hint (LightDMGreeter *greeter);
@@ -170,6 +179,14 @@ gboolean lightdm_greeter_respond (LightDMGreeter *greeter, const gchar *response
 
 gboolean lightdm_greeter_cancel_authentication (LightDMGreeter *greeter, GError **error);
 
+guint lightdm_greeter_preauthenticate (LightDMGreeter *greeter, const gchar *username, GError **error);
+
+gboolean lightdm_greeter_respond_preauthentication (LightDMGreeter *greeter, guint id, const gchar *response, GError **error);
+
+gboolean lightdm_greeter_cancel_preauthentication (LightDMGreeter *greeter, guint id, GError **error);
+
+gboolean lightdm_greeter_select_preauthentication (LightDMGreeter *greeter, guint id, GError **error);
+
 gboolean lightdm_greeter_get_in_authentication (LightDMGreeter *greeter);
 
 gboolean lightdm_greeter_get_is_authenticated (LightDMGreeter *greeter);
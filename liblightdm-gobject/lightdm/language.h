@@ -56,6 +56,8 @@ GType lightdm_language_get_type (void);
 
 GList *lightdm_get_languages (void);
 
+GVariant *lightdm_get_languages_variant (void);
+
 LightDMLanguage *lightdm_get_language (void);
 
 const gchar *lightdm_language_get_code (LightDMLanguage *language);
@@ -11,22 +11,83 @@
 #ifndef LIGHTDM_POWER_H_
 #define LIGHTDM_POWER_H_
 
+#include <gio/gio.h>
+
 G_BEGIN_DECLS
 
+#define LIGHTDM_TYPE_POWER            (lightdm_power_get_type())
+#define LIGHTDM_POWER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), LIGHTDM_TYPE_POWER, LightDMPower))
+#define LIGHTDM_POWER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), LIGHTDM_TYPE_POWER, LightDMPowerClass))
+#define LIGHTDM_IS_POWER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), LIGHTDM_TYPE_POWER))
+#define LIGHTDM_IS_POWER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), LIGHTDM_TYPE_POWER))
+#define LIGHTDM_POWER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), LIGHTDM_TYPE_POWER, LightDMPowerClass))
+
+typedef struct _LightDMPower       LightDMPower;
+typedef struct _LightDMPowerClass  LightDMPowerClass;
+
+#define LIGHTDM_POWER_SIGNAL_CHANGED "changed"
+
+struct _LightDMPower
+{
+    GObject parent_instance;
+};
+
+struct _LightDMPowerClass
+{
+    /*< private >*/
+    GObjectClass parent_class;
+
+    void (*changed)(LightDMPower *power);
+
+    /* Reserved */
+    void (*reserved1) (void);
+    void (*reserved2) (void);
+    void (*reserved3) (void);
+    void (*reserved4) (void);
+};
+
+#ifdef GLIB_VERSION_2_44
+typedef LightDMPower *LightDMPower_autoptr;
+static inline void glib_autoptr_cleanup_LightDMPower (LightDMPower **_ptr)
+{
+    glib_autoptr_cleanup_GObject ((GObject **) _ptr);
+}
+#endif
+
+GType lightdm_power_get_type (void);
+
+LightDMPower *lightdm_power_get_instance (void);
+
 gboolean lightdm_get_can_suspend (void);
 
+void lightdm_get_can_suspend_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_suspend_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_suspend (GError **error);
 
 gboolean lightdm_get_can_hibernate (void);
 
+void lightdm_get_can_hibernate_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_hibernate_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_hibernate (GError **error);
 
 gboolean lightdm_get_can_restart (void);
 
+void lightdm_get_can_restart_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_restart_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_restart (GError **error);
 
 gboolean lightdm_get_can_shutdown (void);
 
+void lightdm_get_can_shutdown_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+gboolean lightdm_get_can_shutdown_finish (GAsyncResult *result, GError **error);
+
 gboolean lightdm_shutdown (GError **error);
 
 G_END_DECLS
@@ -22,8 +22,20 @@ G_BEGIN_DECLS
 #define LIGHTDM_IS_SESSION_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), LIGHTDM_TYPE_SESSION))
 #define LIGHTDM_SESSION_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), LIGHTDM_TYPE_SESSION, LightDMSessionClass))
 
+#define LIGHTDM_TYPE_SESSION_LIST            (lightdm_session_list_get_type())
+#define LIGHTDM_SESSION_LIST(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), LIGHTDM_TYPE_SESSION_LIST, LightDMSessionList))
+#define LIGHTDM_SESSION_LIST_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), LIGHTDM_TYPE_SESSION_LIST, LightDMSessionListClass))
+#define LIGHTDM_IS_SESSION_LIST(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), LIGHTDM_TYPE_SESSION_LIST))
+#define LIGHTDM_IS_SESSION_LIST_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), LIGHTDM_TYPE_SESSION_LIST))
+#define LIGHTDM_SESSION_LIST_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), LIGHTDM_TYPE_SESSION_LIST, LightDMSessionListClass))
+
+#define LIGHTDM_SESSION_LIST_SIGNAL_SESSION_ADDED   "session-added"
+#define LIGHTDM_SESSION_LIST_SIGNAL_SESSION_REMOVED "session-removed"
+
 typedef struct _LightDMSession          LightDMSession;
 typedef struct _LightDMSessionClass     LightDMSessionClass;
+typedef struct _LightDMSessionList      LightDMSessionList;
+typedef struct _LightDMSessionListClass LightDMSessionListClass;
 
 struct _LightDMSession
 {
@@ -44,6 +56,34 @@ struct _LightDMSessionClass
     void (*reserved6) (void);
 };
 
+struct _LightDMSessionList
+{
+    GObject parent_instance;
+};
+
+struct _LightDMSessionListClass
+{
+    /*< private >*/
+    GObjectClass parent_class;
+
+    void (*session_added)(LightDMSessionList *session_list, LightDMSession *session);
+    void (*session_removed)(LightDMSessionList *session_list, LightDMSession *session);
+
+    /* Reserved */
+    void (*reserved1) (void);
+    void (*reserved2) (void);
+    void (*reserved3) (void);
+    void (*reserved4) (void);
+};
+
+#ifdef GLIB_VERSION_2_44
+typedef LightDMSessionList *LightDMSessionList_autoptr;
+static inline void glib_autoptr_cleanup_LightDMSessionList (LightDMSessionList **_ptr)
+{
+    glib_autoptr_cleanup_GObject ((GObject **) _ptr);
+}
+#endif
+
 #ifdef GLIB_VERSION_2_44
 typedef LightDMSession *LightDMSession_autoptr;
 static inline void glib_autoptr_cleanup_LightDMSession (LightDMSession **_ptr)
@@ -52,12 +92,20 @@ static inline void glib_autoptr_cleanup_LightDMSession (LightDMSession **_ptr)
 }
 #endif
 
+GType lightdm_session_list_get_type (void);
+
 GType lightdm_session_get_type (void);
 
+LightDMSessionList *lightdm_session_list_get_instance (void);
+
 GList *lightdm_get_sessions (void);
 
 GList *lightdm_get_remote_sessions (void);
 
+GVariant *lightdm_get_sessions_variant (void);
+
+GVariant *lightdm_get_remote_sessions_variant (void);
+
 const gchar *lightdm_session_get_key (LightDMSession *session);
 
 const gchar *lightdm_session_get_session_type (LightDMSession *session);
@@ -38,6 +38,7 @@ typedef struct _LightDMUserClass     LightDMUserClass;
 #define LIGHTDM_USER_LIST_SIGNAL_USER_ADDED   "user-added"
 #define LIGHTDM_USER_LIST_SIGNAL_USER_CHANGED "user-changed"
 #define LIGHTDM_USER_LIST_SIGNAL_USER_REMOVED "user-removed"
+#define LIGHTDM_USER_LIST_SIGNAL_USERS_CHANGED "users-changed"
 
 #define LIGHTDM_SIGNAL_USER_CHANGED "changed"
 
@@ -75,9 +76,9 @@ struct _LightDMUserListClass
     void (*user_added)(LightDMUserList *user_list, LightDMUser *user);
     void (*user_changed)(LightDMUserList *user_list, LightDMUser *user);
     void (*user_removed)(LightDMUserList *user_list, LightDMUser *user);
+    void (*users_changed)(LightDMUserList *user_list, GPtrArray *added, GPtrArray *changed, GPtrArray *removed);
 
     /* Reserved */
-    void (*reserved1) (void);
     void (*reserved2) (void);
     void (*reserved3) (void);
     void (*reserved4) (void);
@@ -110,6 +111,12 @@ LightDMUser *lightdm_user_list_get_user_by_name (LightDMUserList *user_list, con
 
 GList *lightdm_user_list_get_users (LightDMUserList *user_list);
 
+GList *lightdm_user_list_get_users_range (LightDMUserList *user_list, gint offset, gint n_users);
+
+GPtrArray *lightdm_user_list_get_users_array (LightDMUserList *user_list);
+
+GVariant *lightdm_user_list_get_users_variant (LightDMUserList *user_list);
+
 const gchar *lightdm_user_get_name (LightDMUser *user);
 
 const gchar *lightdm_user_get_real_name (LightDMUser *user);
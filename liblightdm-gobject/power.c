@@ -22,6 +22,8 @@
  * @include: lightdm.h
  *
  * Helper functions to perform power management operations.
+ *
+ * The capability checks are cached, #LightDMPower reports when they change.
  */
 
 static GDBusProxy *upower_proxy = NULL;
@@ -106,45 +108,493 @@ ck_call_function (const gchar *function, GVariant *parameters, GError **error)
                                    error);
 }
 
+enum {
+    CHANGED,
+    LAST_SIGNAL
+};
+static guint power_signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (LightDMPower, lightdm_power, G_TYPE_OBJECT)
+
+static LightDMPower *singleton = NULL;
+
+/* A D-Bus method that reports if a power operation is allowed */
+typedef struct
+{
+    const gchar *name;
+    const gchar *path;
+    const gchar *interface;
+    const gchar *method;
+
+    /* Reply type, "(s)" for a yes/no/challenge string or "(b)" for a boolean */
+    const gchar *reply_type;
+} PowerQuery;
+
+#define LOGIN1_SERVICE "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager"
+#define CK_SERVICE "org.freedesktop.ConsoleKit", "/org/freedesktop/ConsoleKit/Manager", "org.freedesktop.ConsoleKit.Manager"
+#define UPOWER_SERVICE "org.freedesktop.UPower", "/org/freedesktop/UPower", "org.freedesktop.UPower"
+
+static const PowerQuery suspend_queries[] =
+{
+    { LOGIN1_SERVICE, "CanSuspend", "(s)" },
+    { CK_SERVICE, "CanSuspend", "(s)" },
+    { UPOWER_SERVICE, "SuspendAllowed", "(b)" },
+    { NULL }
+};
+
+static const PowerQuery hibernate_queries[] =
+{
+    { LOGIN1_SERVICE, "CanHibernate", "(s)" },
+    { CK_SERVICE, "CanHibernate", "(s)" },
+    { UPOWER_SERVICE, "HibernateAllowed", "(b)" },
+    { NULL }
+};
+
+static const PowerQuery restart_queries[] =
+{
+    { LOGIN1_SERVICE, "CanReboot", "(s)" },
+    { CK_SERVICE, "CanRestart", "(b)" },
+    { NULL }
+};
+
+static const PowerQuery shutdown_queries[] =
+{
+    { LOGIN1_SERVICE, "CanPowerOff", "(s)" },
+    { CK_SERVICE, "CanStop", "(b)" },
+    { NULL }
+};
+
+typedef enum
+{
+    POWER_CAPABILITY_SUSPEND,
+    POWER_CAPABILITY_HIBERNATE,
+    POWER_CAPABILITY_RESTART,
+    POWER_CAPABILITY_SHUTDOWN,
+    N_POWER_CAPABILITIES
+} PowerCapabilityType;
+
+typedef struct
+{
+    /* Backends to try, in order of preference */
+    const PowerQuery *queries;
+
+    /* Last answer received from a backend */
+    gboolean have_value;
+    gboolean value;
+
+    /* Asynchronous requests waiting for the current query */
+    GList *tasks;
+
+    /* TRUE while a query is in progress and the backend being tried */
+    gboolean querying;
+    guint query_index;
+
+    /* TRUE if the value should be checked again when the current query completes */
+    gboolean refresh_pending;
+} PowerCapability;
+
+static PowerCapability capabilities[N_POWER_CAPABILITIES] =
+{
+    { suspend_queries },
+    { hibernate_queries },
+    { restart_queries },
+    { shutdown_queries }
+};
+
+static GDBusConnection *system_bus = NULL;
+
+static void query_capability (PowerCapabilityType type);
+
+static gboolean
+parse_query_result (const PowerQuery *query, GVariant *result)
+{
+    if (!g_variant_is_of_type (result, G_VARIANT_TYPE (query->reply_type)))
+        return FALSE;
+
+    if (strcmp (query->reply_type, "(s)") == 0)
+    {
+        const gchar *value;
+        g_variant_get (result, "(&s)", &value);
+        return g_strcmp0 (value, "yes") == 0;
+    }
+    else
+    {
+        gboolean value;
+        g_variant_get (result, "(b)", &value);
+        return value;
+    }
+}
+
+static void
+set_capability (PowerCapabilityType type, gboolean value)
+{
+    PowerCapability *capability = &capabilities[type];
+
+    gboolean changed = capability->have_value && capability->value != value;
+    capability->have_value = TRUE;
+    capability->value = value;
+
+    if (changed && singleton)
+        g_signal_emit (singleton, power_signals[CHANGED], 0);
+}
+
+static gboolean
+get_capability_sync (PowerCapabilityType type)
+{
+    PowerCapability *capability = &capabilities[type];
+
+    if (capability->have_value)
+        return capability->value;
+
+    if (!system_bus)
+        system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+    if (!system_bus)
+        return FALSE;
+
+    for (const PowerQuery *query = capability->queries; query->method; query++)
+    {
+        g_autoptr(GVariant) result = g_dbus_connection_call_sync (system_bus,
+                                                                  query->name,
+                                                                  query->path,
+                                                                  query->interface,
+                                                                  query->method,
+                                                                  NULL,
+                                                                  NULL,
+                                                                  G_DBUS_CALL_FLAGS_NONE,
+                                                                  -1,
+                                                                  NULL,
+                                                                  NULL);
+        if (result)
+        {
+            set_capability (type, parse_query_result (query, result));
+            return capability->value;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+complete_query (PowerCapabilityType type, gboolean value)
+{
+    PowerCapability *capability = &capabilities[type];
+
+    capability->querying = FALSE;
+
+    GList *tasks = capability->tasks;
+    capability->tasks = NULL;
+    for (GList *link = tasks; link; link = link->next)
+    {
+        GTask *task = link->data;
+        g_task_return_boolean (task, value);
+        g_object_unref (task);
+    }
+    g_list_free (tasks);
+
+    if (capability->refresh_pending)
+    {
+        capability->refresh_pending = FALSE;
+        query_capability (type);
+    }
+}
+
+static void query_next (PowerCapabilityType type);
+
+static void
+query_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    PowerCapabilityType type = GPOINTER_TO_INT (data);
+    PowerCapability *capability = &capabilities[type];
+    const PowerQuery *query = &capability->queries[capability->query_index];
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) r = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (r)
+    {
+        set_capability (type, parse_query_result (query, r));
+        complete_query (type, capability->value);
+        return;
+    }
+
+    g_debug ("Failed to call %s.%s: %s", query->interface, query->method, error->message);
+    capability->query_index++;
+    query_next (type);
+}
+
+static void
+query_next (PowerCapabilityType type)
+{
+    PowerCapability *capability = &capabilities[type];
+    const PowerQuery *query = &capability->queries[capability->query_index];
+
+    /* No backend answered, keep the previous answer if there was one */
+    if (!query->method)
+    {
+        complete_query (type, capability->have_value ? capability->value : FALSE);
+        return;
+    }
+
+    g_dbus_connection_call (system_bus,
+                            query->name,
+                            query->path,
+                            query->interface,
+                            query->method,
+                            NULL,
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            query_cb,
+                            GINT_TO_POINTER (type));
+}
+
+static void
+query_bus_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    PowerCapabilityType type = GPOINTER_TO_INT (data);
+
+    g_autoptr(GError) error = NULL;
+    GDBusConnection *bus = g_bus_get_finish (result, &error);
+    if (!bus)
+    {
+        g_debug ("Failed to get system bus: %s", error->message);
+        complete_query (type, FALSE);
+        return;
+    }
+
+    if (!system_bus)
+        system_bus = bus;
+    else
+        g_object_unref (bus);
+
+    query_next (type);
+}
+
+static void
+query_capability (PowerCapabilityType type)
+{
+    PowerCapability *capability = &capabilities[type];
+
+    if (capability->querying)
+    {
+        capability->refresh_pending = TRUE;
+        return;
+    }
+
+    capability->querying = TRUE;
+    capability->query_index = 0;
+    if (system_bus)
+        query_next (type);
+    else
+        g_bus_get (G_BUS_TYPE_SYSTEM, NULL, query_bus_cb, GINT_TO_POINTER (type));
+}
+
+static void
+get_capability_async (PowerCapabilityType type, gpointer source_tag, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    PowerCapability *capability = &capabilities[type];
+
+    GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_source_tag (task, source_tag);
+
+    if (capability->have_value && !capability->querying)
+    {
+        g_task_return_boolean (task, capability->value);
+        g_object_unref (task);
+        return;
+    }
+
+    /* Share a single query between all requests */
+    capability->tasks = g_list_append (capability->tasks, task);
+    if (!capability->querying)
+        query_capability (type);
+}
+
+static gboolean
+get_capability_finish (gpointer source_tag, GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+    g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == source_tag, FALSE);
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+refresh_capabilities (void)
+{
+    for (int i = 0; i < N_POWER_CAPABILITIES; i++)
+        if (capabilities[i].have_value || capabilities[i].querying)
+            query_capability (i);
+}
+
+static void
+power_signal_cb (GDBusConnection *connection,
+                 const gchar *sender_name,
+                 const gchar *object_path,
+                 const gchar *interface_name,
+                 const gchar *signal_name,
+                 GVariant *parameters,
+                 gpointer data)
+{
+    /* Power policy may have changed when a backend restarts or the system resumes */
+    if (strcmp (signal_name, "NameOwnerChanged") == 0)
+    {
+        const gchar *name;
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sss)")))
+            return;
+        g_variant_get (parameters, "(&sss)", &name, NULL, NULL);
+        if (strcmp (name, "org.freedesktop.login1") != 0 &&
+            strcmp (name, "org.freedesktop.ConsoleKit") != 0 &&
+            strcmp (name, "org.freedesktop.UPower") != 0)
+            return;
+    }
+    else
+    {
+        gboolean start;
+        if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(b)")))
+            return;
+        g_variant_get (parameters, "(b)", &start);
+        if (start)
+            return;
+    }
+
+    g_debug ("Power capabilities may have changed, checking again");
+    refresh_capabilities ();
+}
+
+static void
+subscribe_power_signals (void)
+{
+    g_dbus_connection_signal_subscribe (system_bus,
+                                        "org.freedesktop.DBus",
+                                        "org.freedesktop.DBus",
+                                        "NameOwnerChanged",
+                                        "/org/freedesktop/DBus",
+                                        NULL,
+                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                        power_signal_cb,
+                                        NULL,
+                                        NULL);
+    g_dbus_connection_signal_subscribe (system_bus,
+                                        "org.freedesktop.login1",
+                                        "org.freedesktop.login1.Manager",
+                                        "PrepareForSleep",
+                                        "/org/freedesktop/login1",
+                                        NULL,
+                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                        power_signal_cb,
+                                        NULL,
+                                        NULL);
+}
+
+static void
+subscribe_bus_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    GDBusConnection *bus = g_bus_get_finish (result, &error);
+    if (!bus)
+    {
+        g_debug ("Failed to get system bus: %s", error->message);
+        return;
+    }
+
+    if (!system_bus)
+        system_bus = bus;
+    else
+        g_object_unref (bus);
+
+    subscribe_power_signals ();
+}
+
+/**
+ * lightdm_power_get_instance:
+ *
+ * Get the object that reports changes to the power management capabilities.
+ *
+ * Return value: (transfer none): the #LightDMPower
+ **/
+LightDMPower *
+lightdm_power_get_instance (void)
+{
+    if (!singleton)
+        singleton = g_object_new (LIGHTDM_TYPE_POWER, NULL);
+    return singleton;
+}
+
+static void
+lightdm_power_init (LightDMPower *power)
+{
+    if (system_bus)
+        subscribe_power_signals ();
+    else
+        g_bus_get (G_BUS_TYPE_SYSTEM, NULL, subscribe_bus_cb, NULL);
+}
+
+static void
+lightdm_power_class_init (LightDMPowerClass *klass)
+{
+    /**
+     * LightDMPower::changed:
+     * @power: A #LightDMPower
+     *
+     * The ::changed signal gets emitted when the result of lightdm_get_can_suspend(),
+     * lightdm_get_can_hibernate(), lightdm_get_can_restart() or lightdm_get_can_shutdown()
+     * changes.
+     **/
+    power_signals[CHANGED] =
+        g_signal_new (LIGHTDM_POWER_SIGNAL_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMPowerClass, changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+}
+
 /**
  * lightdm_get_can_suspend:
  *
  * Checks if authorized to do a system suspend.
  *
+ * The result is cached after the first check, use lightdm_get_can_suspend_async() to
+ * avoid blocking and connect to #LightDMPower::changed to be notified of changes.
+ *
  * Return value: #TRUE if can suspend the system
  **/
 gboolean
 lightdm_get_can_suspend (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanSuspend", NULL, NULL);
-    gboolean can_suspend = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_suspend = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        const gchar *result;
-        r = ck_call_function ("CanSuspend", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_suspend = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        r = upower_call_function ("SuspendAllowed", NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_suspend);
-    }
+    return get_capability_sync (POWER_CAPABILITY_SUSPEND);
+}
+
+/**
+ * lightdm_get_can_suspend_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when completed or %NULL.
+ * @user_data: data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to suspend the system.
+ * When the check is complete @callback is called with the result; then call
+ * lightdm_get_can_suspend_finish() to get the value.
+ **/
+void
+lightdm_get_can_suspend_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    get_capability_async (POWER_CAPABILITY_SUSPEND, lightdm_get_can_suspend_async, cancellable, callback, user_data);
+}
 
-    return can_suspend;
+/**
+ * lightdm_get_can_suspend_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish a check started with lightdm_get_can_suspend_async().
+ *
+ * Return value: #TRUE if can suspend the system
+ **/
+gboolean
+lightdm_get_can_suspend_finish (GAsyncResult *result, GError **error)
+{
+    return get_capability_finish (lightdm_get_can_suspend_async, result, error);
 }
 
 /**
@@ -181,40 +631,46 @@ lightdm_suspend (GError **error)
  *
  * Checks if is authorized to do a system hibernate.
  *
+ * The result is cached after the first check, use lightdm_get_can_hibernate_async() to
+ * avoid blocking and connect to #LightDMPower::changed to be notified of changes.
+ *
  * Return value: #TRUE if can hibernate the system
  **/
 gboolean
 lightdm_get_can_hibernate (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanHibernate", NULL, NULL);
-    gboolean can_hibernate = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_hibernate = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        const gchar *result;
-        r = ck_call_function ("CanHibernate", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_hibernate = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    if (!r)
-    {
-        r = upower_call_function ("HibernateAllowed", NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_hibernate);
-    }
+    return get_capability_sync (POWER_CAPABILITY_HIBERNATE);
+}
+
+/**
+ * lightdm_get_can_hibernate_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when completed or %NULL.
+ * @user_data: data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to hibernate the system.
+ * When the check is complete @callback is called with the result; then call
+ * lightdm_get_can_hibernate_finish() to get the value.
+ **/
+void
+lightdm_get_can_hibernate_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    get_capability_async (POWER_CAPABILITY_HIBERNATE, lightdm_get_can_hibernate_async, cancellable, callback, user_data);
+}
 
-    return can_hibernate;
+/**
+ * lightdm_get_can_hibernate_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish a check started with lightdm_get_can_hibernate_async().
+ *
+ * Return value: #TRUE if can hibernate the system
+ **/
+gboolean
+lightdm_get_can_hibernate_finish (GAsyncResult *result, GError **error)
+{
+    return get_capability_finish (lightdm_get_can_hibernate_async, result, error);
 }
 
 /**
@@ -251,30 +707,46 @@ lightdm_hibernate (GError **error)
  *
  * Checks if is authorized to do a system restart.
  *
+ * The result is cached after the first check, use lightdm_get_can_restart_async() to
+ * avoid blocking and connect to #LightDMPower::changed to be notified of changes.
+ *
  * Return value: #TRUE if can restart the system
  **/
 gboolean
 lightdm_get_can_restart (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanReboot", NULL, NULL);
-    gboolean can_restart = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_restart = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    else
-    {
-        r = ck_call_function ("CanRestart", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_restart);
-    }
+    return get_capability_sync (POWER_CAPABILITY_RESTART);
+}
 
-    return can_restart;
+/**
+ * lightdm_get_can_restart_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when completed or %NULL.
+ * @user_data: data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to restart the system.
+ * When the check is complete @callback is called with the result; then call
+ * lightdm_get_can_restart_finish() to get the value.
+ **/
+void
+lightdm_get_can_restart_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    get_capability_async (POWER_CAPABILITY_RESTART, lightdm_get_can_restart_async, cancellable, callback, user_data);
+}
+
+/**
+ * lightdm_get_can_restart_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish a check started with lightdm_get_can_restart_async().
+ *
+ * Return value: #TRUE if can restart the system
+ **/
+gboolean
+lightdm_get_can_restart_finish (GAsyncResult *result, GError **error)
+{
+    return get_capability_finish (lightdm_get_can_restart_async, result, error);
 }
 
 /**
@@ -302,30 +774,46 @@ lightdm_restart (GError **error)
  *
  * Checks if is authorized to do a system shutdown.
  *
+ * The result is cached after the first check, use lightdm_get_can_shutdown_async() to
+ * avoid blocking and connect to #LightDMPower::changed to be notified of changes.
+ *
  * Return value: #TRUE if can shutdown the system
  **/
 gboolean
 lightdm_get_can_shutdown (void)
 {
-    g_autoptr(GVariant) r = login1_call_function ("CanPowerOff", NULL, NULL);
-    gboolean can_shutdown = FALSE;
-    if (r)
-    {
-        const gchar *result;
-        if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)")))
-        {
-            g_variant_get (r, "(&s)", &result);
-            can_shutdown = g_strcmp0 (result, "yes") == 0;
-        }
-    }
-    else
-    {
-        r = ck_call_function ("CanStop", NULL, NULL);
-        if (r && g_variant_is_of_type (r, G_VARIANT_TYPE ("(b)")))
-            g_variant_get (r, "(b)", &can_shutdown);
-    }
+    return get_capability_sync (POWER_CAPABILITY_SHUTDOWN);
+}
+
+/**
+ * lightdm_get_can_shutdown_async:
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: (allow-none): A #GAsyncReadyCallback to call when completed or %NULL.
+ * @user_data: data to pass to the @callback or %NULL.
+ *
+ * Asynchronously checks if authorized to shutdown the system.
+ * When the check is complete @callback is called with the result; then call
+ * lightdm_get_can_shutdown_finish() to get the value.
+ **/
+void
+lightdm_get_can_shutdown_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    get_capability_async (POWER_CAPABILITY_SHUTDOWN, lightdm_get_can_shutdown_async, cancellable, callback, user_data);
+}
 
-    return can_shutdown;
+/**
+ * lightdm_get_can_shutdown_finish:
+ * @result: A #GAsyncResult.
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish a check started with lightdm_get_can_shutdown_async().
+ *
+ * Return value: #TRUE if can shutdown the system
+ **/
+gboolean
+lightdm_get_can_shutdown_finish (GAsyncResult *result, GError **error)
+{
+    return get_capability_finish (lightdm_get_can_shutdown_async, result, error);
 }
 
 /**
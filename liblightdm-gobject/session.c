@@ -12,6 +12,8 @@
 #include <gio/gdesktopappinfo.h>
 
 #include "configuration.h"
+#include "resource-bundle.h"
+#include "session-catalog.h"
 #include "lightdm/session.h"
 
 /**
@@ -20,6 +22,21 @@
  * @include: lightdm.h
  *
  * Object containing information about a session type. #LightDMSession objects are not created by the user, but provided by the #LightDMGreeter object.
+ *
+ * #LightDMSessionList reports when sessions are installed or removed while the greeter is running.
+ */
+
+/**
+ * LightDMSessionList:
+ *
+ * #LightDMSessionList is an opaque data structure and can only be accessed
+ * using the provided functions.
+ */
+
+/**
+ * LightDMSessionListClass:
+ *
+ * Class structure for #LightDMSessionList.
  */
 
 /**
@@ -49,12 +66,32 @@ typedef struct
     gchar *comment;
 } LightDMSessionPrivate;
 
+enum
+{
+    SESSION_ADDED,
+    SESSION_REMOVED,
+    LAST_LIST_SIGNAL
+};
+static guint list_signals[LAST_LIST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (LightDMSessionList, lightdm_session_list, G_TYPE_OBJECT)
 G_DEFINE_TYPE_WITH_PRIVATE (LightDMSession, lightdm_session, G_TYPE_OBJECT)
 
+static LightDMSessionList *singleton = NULL;
+
 static gboolean have_sessions = FALSE;
+static gchar *local_sessions_dir = NULL;
+static gchar *remote_sessions_dir = NULL;
 static GList *local_sessions = NULL;
 static GList *remote_sessions = NULL;
 
+/* TRUE if the session files have changed since the lists were made */
+static gboolean local_sessions_changed = FALSE;
+static gboolean remote_sessions_changed = FALSE;
+
+/* Session lists that have been replaced */
+static GList *old_sessions = NULL;
+
 static gint
 compare_session (gconstpointer a, gconstpointer b)
 {
@@ -113,100 +150,227 @@ load_session (GKeyFile *key_file, const gchar *key, const gchar *default_type)
 }
 
 static GList *
-load_sessions_dir (GList *sessions, const gchar *sessions_dir, const gchar *default_type)
+load_session_entries (GList *entries)
 {
-    g_autoptr(GError) error = NULL;
-    GDir *directory = g_dir_open (sessions_dir, 0, &error);
-    if (error && !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
-        g_warning ("Failed to open sessions directory: %s", error->message);
-    if (!directory)
-        return sessions;
-
-    while (TRUE)
+    GList *sessions = NULL;
+    for (GList *link = entries; link; link = link->next)
     {
-        const gchar *filename = g_dir_read_name (directory);
-        if (filename == NULL)
-            break;
+        CommonSessionEntry *entry = link->data;
+        LightDMSession *session = load_session (entry->key_file, entry->key, entry->default_type);
+        if (session)
+        {
+            LightDMSessionPrivate *priv = lightdm_session_get_instance_private (session);
+            g_debug ("Loaded session %s (%s, %s)", entry->path, priv->name, priv->comment);
+            sessions = g_list_insert_sorted (sessions, session, compare_session);
+        }
+        else
+            g_debug ("Ignoring session %s", entry->path);
+    }
 
-        if (!g_str_has_suffix (filename, ".desktop"))
-            continue;
+    return sessions;
+}
 
-        g_autofree gchar *path = g_build_filename (sessions_dir, filename, NULL);
+static GList *
+load_sessions (const gchar *sessions_dir)
+{
+    CommonSessionCatalog *catalog = common_session_catalog_get_instance (sessions_dir);
+    return load_session_entries (common_session_catalog_get_entries (catalog));
+}
+
+/* Load the sessions the daemon passed us, these are used until the directories change */
+static GList *
+load_bundled_sessions (const gchar *sessions_dir)
+{
+    g_autoptr(GVariant) bundled_sessions = common_resource_bundle_lookup ("sessions", G_VARIANT_TYPE ("a{s" COMMON_SESSION_ENTRIES_TYPE "}"));
+    g_autoptr(GVariant) value = bundled_sessions ? g_variant_lookup_value (bundled_sessions, sessions_dir, G_VARIANT_TYPE (COMMON_SESSION_ENTRIES_TYPE)) : NULL;
+    if (!value)
+        return load_sessions (sessions_dir);
+
+    GList *entries = common_session_entries_from_variant (value);
+    GList *sessions = load_session_entries (entries);
+    g_list_free_full (entries, (GDestroyNotify) common_session_entry_free);
 
-        g_autoptr(GKeyFile) key_file = g_key_file_new ();
-        g_autoptr(GError) e = NULL;
-        gboolean result = g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &e);
-        if (e)
-            g_warning ("Failed to load session file %s: %s:", path, e->message);
+    return sessions;
+}
+
+static gboolean
+session_equal (LightDMSession *a, LightDMSession *b)
+{
+    LightDMSessionPrivate *a_priv = lightdm_session_get_instance_private (a);
+    LightDMSessionPrivate *b_priv = lightdm_session_get_instance_private (b);
+
+    return g_strcmp0 (a_priv->key, b_priv->key) == 0 &&
+           g_strcmp0 (a_priv->type, b_priv->type) == 0 &&
+           g_strcmp0 (a_priv->name, b_priv->name) == 0 &&
+           g_strcmp0 (a_priv->comment, b_priv->comment) == 0;
+}
 
-        if (result)
+/* Reload a session list, keeping the existing objects for sessions that haven't changed */
+static void
+reload_sessions (GList **sessions_list, const gchar *sessions_dir, GQuark detail)
+{
+    GList *sessions = *sessions_list;
+    GList *new_sessions = load_sessions (sessions_dir);
+    for (GList *link = new_sessions; link; link = link->next)
+    {
+        for (GList *old_link = sessions; old_link; old_link = old_link->next)
         {
-            g_autofree gchar *key = g_strndup (filename, strlen (filename) - strlen (".desktop"));
-            LightDMSession *session = load_session (key_file, key, default_type);
-            LightDMSessionPrivate *priv = lightdm_session_get_instance_private (session);
-            if (session)
+            if (session_equal (link->data, old_link->data))
             {
-                g_debug ("Loaded session %s (%s, %s)", path, priv->name, priv->comment);
-                sessions = g_list_insert_sorted (sessions, session, compare_session);
+                g_object_unref (link->data);
+                link->data = g_object_ref (old_link->data);
+                break;
             }
-            else
-                g_debug ("Ignoring session %s", path);
         }
     }
 
-    g_dir_close (directory);
+    /* Replaced lists are kept, as the sessions in them may still be in use */
+    old_sessions = g_list_prepend (old_sessions, sessions);
+    *sessions_list = new_sessions;
 
-    return sessions;
+    if (singleton)
+    {
+        for (GList *link = sessions; link; link = link->next)
+            if (!g_list_find (new_sessions, link->data))
+                g_signal_emit (singleton, list_signals[SESSION_REMOVED], detail, link->data);
+        for (GList *link = new_sessions; link; link = link->next)
+            if (!g_list_find (sessions, link->data))
+                g_signal_emit (singleton, list_signals[SESSION_ADDED], detail, link->data);
+    }
 }
 
-static GList *
-load_sessions (const gchar *sessions_dir)
+static void update_sessions (void);
+
+static void
+local_sessions_changed_cb (CommonSessionCatalog *catalog)
 {
-    g_auto(GStrv) dirs = g_strsplit (sessions_dir, ":", -1);
-    GList *sessions = NULL;
-    for (int i = 0; dirs[i]; i++)
-    {
-        const gchar *default_type = "x";
+    local_sessions_changed = TRUE;
 
-        if (dirs[i] != NULL && g_str_has_suffix (dirs[i], "/wayland-sessions") == TRUE)
-            default_type = "wayland";
+    /* Only reload straight away if someone is listening for changes */
+    if (singleton)
+        update_sessions ();
+}
 
-        sessions = load_sessions_dir (sessions, dirs[i], default_type);
-    }
+static void
+remote_sessions_changed_cb (CommonSessionCatalog *catalog)
+{
+    remote_sessions_changed = TRUE;
 
-    return sessions;
+    if (singleton)
+        update_sessions ();
 }
 
 static void
 update_sessions (void)
 {
-    if (have_sessions)
-        return;
+    if (!have_sessions)
+    {
+        local_sessions_dir = g_strdup (SESSIONS_DIR);
+        remote_sessions_dir = g_strdup (REMOTE_SESSIONS_DIR);
+
+        /* Use session directory from configuration, the daemon passes it to us or keeps a cache of it */
+        g_autoptr(GVariant) bundled_config = common_resource_bundle_lookup ("config", NULL);
+        g_autofree gchar *cache_path = g_build_filename (CACHE_DIR, "config.cache", NULL);
+        if (!(bundled_config && config_load_from_snapshot (config_get_instance (), bundled_config)) &&
+            !config_load_from_cache (config_get_instance (), cache_path, NULL, NULL))
+            config_load_from_standard_locations (config_get_instance (), NULL, NULL);
+
+        gchar *value = config_get_string (config_get_instance (), "LightDM", "sessions-directory");
+        if (value)
+        {
+            g_free (local_sessions_dir);
+            local_sessions_dir = value;
+        }
+
+        value = config_get_string (config_get_instance (), "LightDM", "remote-sessions-directory");
+        if (value)
+        {
+            g_free (remote_sessions_dir);
+            remote_sessions_dir = value;
+        }
 
-    g_autofree gchar *sessions_dir = g_strdup (SESSIONS_DIR);
-    g_autofree gchar *remote_sessions_dir = g_strdup (REMOTE_SESSIONS_DIR);
+        /* Pick up sessions installed while we are running */
+        g_signal_connect (common_session_catalog_get_instance (local_sessions_dir), SESSION_CATALOG_SIGNAL_CHANGED, G_CALLBACK (local_sessions_changed_cb), NULL);
+        g_signal_connect (common_session_catalog_get_instance (remote_sessions_dir), SESSION_CATALOG_SIGNAL_CHANGED, G_CALLBACK (remote_sessions_changed_cb), NULL);
 
-    /* Use session directory from configuration */
-    config_load_from_standard_locations (config_get_instance (), NULL, NULL);
+        local_sessions = load_bundled_sessions (local_sessions_dir);
+        remote_sessions = load_bundled_sessions (remote_sessions_dir);
 
-    gchar *value = config_get_string (config_get_instance (), "LightDM", "sessions-directory");
-    if (value)
+        have_sessions = TRUE;
+    }
+
+    if (local_sessions_changed)
+    {
+        local_sessions_changed = FALSE;
+        reload_sessions (&local_sessions, local_sessions_dir, g_quark_from_static_string ("local"));
+    }
+    if (remote_sessions_changed)
     {
-        g_free (sessions_dir);
-        sessions_dir = value;
+        remote_sessions_changed = FALSE;
+        reload_sessions (&remote_sessions, remote_sessions_dir, g_quark_from_static_string ("remote"));
     }
+}
 
-    value = config_get_string (config_get_instance (), "LightDM", "remote-sessions-directory");
-    if (value)
+/**
+ * lightdm_session_list_get_instance:
+ *
+ * Get the object that reports changes to the available sessions.
+ *
+ * Return value: (transfer none): the #LightDMSessionList
+ **/
+LightDMSessionList *
+lightdm_session_list_get_instance (void)
+{
+    if (!singleton)
     {
-        g_free (remote_sessions_dir);
-        remote_sessions_dir = value;
+        singleton = g_object_new (LIGHTDM_TYPE_SESSION_LIST, NULL);
+        update_sessions ();
     }
+    return singleton;
+}
 
-    local_sessions = load_sessions (sessions_dir);
-    remote_sessions = load_sessions (remote_sessions_dir);
+static void
+lightdm_session_list_init (LightDMSessionList *session_list)
+{
+}
 
-    have_sessions = TRUE;
+static void
+lightdm_session_list_class_init (LightDMSessionListClass *klass)
+{
+    /**
+     * LightDMSessionList::session-added:
+     * @session_list: A #LightDMSessionList
+     * @session: The #LightDMSession that has been added.
+     *
+     * The ::session-added signal gets emitted when a session is installed.
+     * The signal detail is "local" for sessions returned by lightdm_get_sessions()
+     * and "remote" for sessions returned by lightdm_get_remote_sessions().
+     **/
+    list_signals[SESSION_ADDED] =
+        g_signal_new (LIGHTDM_SESSION_LIST_SIGNAL_SESSION_ADDED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                      G_STRUCT_OFFSET (LightDMSessionListClass, session_added),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, LIGHTDM_TYPE_SESSION);
+
+    /**
+     * LightDMSessionList::session-removed:
+     * @session_list: A #LightDMSessionList
+     * @session: The #LightDMSession that has been removed.
+     *
+     * The ::session-removed signal gets emitted when a session is removed or replaced.
+     * The signal detail is "local" or "remote", as for #LightDMSessionList::session-added.
+     **/
+    list_signals[SESSION_REMOVED] =
+        g_signal_new (LIGHTDM_SESSION_LIST_SIGNAL_SESSION_REMOVED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                      G_STRUCT_OFFSET (LightDMSessionListClass, session_removed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, LIGHTDM_TYPE_SESSION);
 }
 
 /**
@@ -237,6 +401,59 @@ lightdm_get_remote_sessions (void)
     return remote_sessions;
 }
 
+static GVariant *
+sessions_to_variant (GList *sessions)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+    for (GList *link = sessions; link; link = link->next)
+    {
+        LightDMSessionPrivate *priv = lightdm_session_get_instance_private (link->data);
+
+        g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&builder, "{sv}", "key", g_variant_new_string (priv->key));
+        if (priv->type)
+            g_variant_builder_add (&builder, "{sv}", "type", g_variant_new_string (priv->type));
+        if (priv->name)
+            g_variant_builder_add (&builder, "{sv}", "name", g_variant_new_string (priv->name));
+        if (priv->comment)
+            g_variant_builder_add (&builder, "{sv}", "comment", g_variant_new_string (priv->comment));
+        g_variant_builder_close (&builder);
+    }
+
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/**
+ * lightdm_get_sessions_variant:
+ *
+ * Get the fields of the sessions returned by lightdm_get_sessions() in one
+ * value, so greeters using language bindings can fill their session list in
+ * one call.  The value is an array of dictionaries (type aa{sv}) with the keys
+ * "key", "type", "name" and "comment".
+ *
+ * Return value: (transfer full): A #GVariant with the session fields.
+ **/
+GVariant *
+lightdm_get_sessions_variant (void)
+{
+    return sessions_to_variant (lightdm_get_sessions ());
+}
+
+/**
+ * lightdm_get_remote_sessions_variant:
+ *
+ * Get the fields of the sessions returned by lightdm_get_remote_sessions() in
+ * one value, as with lightdm_get_sessions_variant().
+ *
+ * Return value: (transfer full): A #GVariant with the session fields.
+ **/
+GVariant *
+lightdm_get_remote_sessions_variant (void)
+{
+    return sessions_to_variant (lightdm_get_remote_sessions ());
+}
+
 /**
  * lightdm_session_get_key:
  * @session: A #LightDMSession
@@ -89,6 +89,7 @@ enum
     USER_ADDED,
     USER_CHANGED,
     USER_REMOVED,
+    USERS_CHANGED,
     LAST_LIST_SIGNAL
 };
 static guint list_signals[LAST_LIST_SIGNAL] = { 0 };
@@ -104,8 +105,21 @@ typedef struct
 {
     gboolean initialized;
 
+    /* Common users, in the same order as the common list */
+    GPtrArray *common_users;
+
+    /* Wrappers for each common user, created the first time they are requested */
+    GPtrArray *lightdm_users;
+
     /* Wrapper list, kept locally to preserve transfer-none promises */
+    gboolean have_lightdm_list;
     GList *lightdm_list;
+
+    /* Changes to report together in ::users-changed, and the idle they are sent from */
+    GPtrArray *added_users;
+    GPtrArray *changed_users;
+    GPtrArray *removed_users;
+    guint users_changed_idle;
 } LightDMUserListPrivate;
 
 typedef struct
@@ -147,23 +161,110 @@ wrap_common_user (CommonUser *user)
     return lightdm_user;
 }
 
+static gint
+find_common_user (LightDMUserList *user_list, CommonUser *common_user)
+{
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+
+    for (guint i = 0; i < priv->common_users->len; i++)
+        if (g_ptr_array_index (priv->common_users, i) == common_user)
+            return i;
+
+    return -1;
+}
+
+static LightDMUser *
+get_lightdm_user (LightDMUserList *user_list, guint index)
+{
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+
+    LightDMUser *lightdm_user = g_ptr_array_index (priv->lightdm_users, index);
+    if (!lightdm_user)
+    {
+        lightdm_user = wrap_common_user (g_ptr_array_index (priv->common_users, index));
+        g_ptr_array_index (priv->lightdm_users, index) = lightdm_user;
+    }
+
+    return lightdm_user;
+}
+
+static gboolean
+users_changed_cb (gpointer data)
+{
+    LightDMUserList *user_list = data;
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+
+    priv->users_changed_idle = 0;
+
+    g_autoptr(GPtrArray) added = g_steal_pointer (&priv->added_users);
+    g_autoptr(GPtrArray) changed = g_steal_pointer (&priv->changed_users);
+    g_autoptr(GPtrArray) removed = g_steal_pointer (&priv->removed_users);
+    g_signal_emit (user_list, list_signals[USERS_CHANGED], 0, added, changed, removed);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Collect a change for ::users-changed, only done if anyone is listening so
+ * greeters using the per-user signals don't hold on to extra references */
+static void
+queue_users_changed (LightDMUserList *user_list, LightDMUser *user, GPtrArray **changes)
+{
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+
+    if (!g_signal_has_handler_pending (user_list, list_signals[USERS_CHANGED], 0, TRUE))
+        return;
+
+    if (!priv->added_users)
+    {
+        priv->added_users = g_ptr_array_new_with_free_func (g_object_unref);
+        priv->changed_users = g_ptr_array_new_with_free_func (g_object_unref);
+        priv->removed_users = g_ptr_array_new_with_free_func (g_object_unref);
+    }
+
+    /* A user is only reported once, as its state at the end of the batch */
+    if (changes == &priv->changed_users)
+    {
+        if (g_ptr_array_find (priv->added_users, user, NULL) || g_ptr_array_find (priv->changed_users, user, NULL))
+            return;
+    }
+    else if (changes == &priv->removed_users)
+    {
+        g_ptr_array_remove (priv->changed_users, user);
+        if (g_ptr_array_remove (priv->added_users, user))
+            return;
+    }
+    g_ptr_array_add (*changes, g_object_ref (user));
+
+    if (priv->users_changed_idle == 0)
+        priv->users_changed_idle = g_idle_add (users_changed_cb, user_list);
+}
+
 static void
 user_list_added_cb (CommonUserList *common_list, CommonUser *common_user, LightDMUserList *user_list)
 {
     LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
     GList *common_users = common_user_list_get_users (common_list);
+    gint index = g_list_index (common_users, common_user);
     LightDMUser *lightdm_user = wrap_common_user (common_user);
-    priv->lightdm_list = g_list_insert (priv->lightdm_list, lightdm_user, g_list_index (common_users, common_user));
+    g_ptr_array_insert (priv->common_users, index, g_object_ref (common_user));
+    g_ptr_array_insert (priv->lightdm_users, index, lightdm_user);
+    if (priv->have_lightdm_list)
+        priv->lightdm_list = g_list_insert (priv->lightdm_list, lightdm_user, index);
     g_signal_emit (user_list, list_signals[USER_ADDED], 0, lightdm_user);
+    queue_users_changed (user_list, lightdm_user, &priv->added_users);
 }
 
 static void
 user_list_changed_cb (CommonUserList *common_list, CommonUser *common_user, LightDMUserList *user_list)
 {
     LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
-    GList *common_users = common_user_list_get_users (common_list);
-    LightDMUser *lightdm_user = g_list_nth_data (priv->lightdm_list, g_list_index (common_users, common_user));
+
+    gint index = find_common_user (user_list, common_user);
+    if (index < 0)
+        return;
+    LightDMUser *lightdm_user = get_lightdm_user (user_list, index);
     g_signal_emit (user_list, list_signals[USER_CHANGED], 0, lightdm_user);
+    queue_users_changed (user_list, lightdm_user, &priv->changed_users);
 }
 
 static void
@@ -171,18 +272,18 @@ user_list_removed_cb (CommonUserList *common_list, CommonUser *common_user, Ligh
 {
     LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
 
-    for (GList *link = priv->lightdm_list; link; link = link->next)
-    {
-        LightDMUser *lightdm_user = link->data;
-        LightDMUserPrivate *user_priv = lightdm_user_get_instance_private (lightdm_user);
-        if (user_priv->common_user == common_user)
-        {
-            priv->lightdm_list = g_list_delete_link (priv->lightdm_list, link);
-            g_signal_emit (user_list, list_signals[USER_REMOVED], 0, lightdm_user);
-            g_object_unref (lightdm_user);
-            break;
-        }
-    }
+    gint index = find_common_user (user_list, common_user);
+    if (index < 0)
+        return;
+
+    LightDMUser *lightdm_user = get_lightdm_user (user_list, index);
+    g_ptr_array_remove_index (priv->lightdm_users, index);
+    g_ptr_array_remove_index (priv->common_users, index);
+    if (priv->have_lightdm_list)
+        priv->lightdm_list = g_list_remove (priv->lightdm_list, lightdm_user);
+    g_signal_emit (user_list, list_signals[USER_REMOVED], 0, lightdm_user);
+    queue_users_changed (user_list, lightdm_user, &priv->removed_users);
+    g_object_unref (lightdm_user);
 }
 
 static void
@@ -193,16 +294,13 @@ initialize_user_list_if_needed (LightDMUserList *user_list)
     if (priv->initialized)
         return;
 
-    GList *common_users = common_user_list_get_users (common_user_list_get_instance ());
-    for (GList *link = common_users; link; link = link->next)
-    {
-        CommonUser *user = link->data;
-        LightDMUser *lightdm_user = wrap_common_user (user);
-        priv->lightdm_list = g_list_prepend (priv->lightdm_list, lightdm_user);
-    }
-    priv->lightdm_list = g_list_reverse (priv->lightdm_list);
-
+    /* Only the common users are tracked here, wrappers are made on demand so
+     * greeters showing a few rows of a large directory don't pay for the rest */
     CommonUserList *common_list = common_user_list_get_instance ();
+    for (GList *link = common_user_list_get_users (common_list); link; link = link->next)
+        g_ptr_array_add (priv->common_users, g_object_ref (link->data));
+    g_ptr_array_set_size (priv->lightdm_users, priv->common_users->len);
+
     g_signal_connect (common_list, USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (user_list_added_cb), user_list);
     g_signal_connect (common_list, USER_LIST_SIGNAL_USER_CHANGED, G_CALLBACK (user_list_changed_cb), user_list);
     g_signal_connect (common_list, USER_LIST_SIGNAL_USER_REMOVED, G_CALLBACK (user_list_removed_cb), user_list);
@@ -223,7 +321,7 @@ lightdm_user_list_get_length (LightDMUserList *user_list)
 
     LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
     initialize_user_list_if_needed (user_list);
-    return g_list_length (priv->lightdm_list);
+    return priv->common_users->len;
 }
 
 /**
@@ -233,6 +331,9 @@ lightdm_user_list_get_length (LightDMUserList *user_list)
  * Get a list of users to present to the user.  This list may be a subset of the
  * available users and may be empty depending on the server configuration.
  *
+ * For large user lists consider using lightdm_user_list_get_users_range() to
+ * only get the users that are being shown.
+ *
  * Return value: (element-type LightDMUser) (transfer none): A list of #LightDMUser that should be presented to the user.
  **/
 GList *
@@ -242,9 +343,135 @@ lightdm_user_list_get_users (LightDMUserList *user_list)
 
     LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
     initialize_user_list_if_needed (user_list);
+
+    if (!priv->have_lightdm_list)
+    {
+        for (guint i = priv->common_users->len; i > 0; i--)
+            priv->lightdm_list = g_list_prepend (priv->lightdm_list, get_lightdm_user (user_list, i - 1));
+        priv->have_lightdm_list = TRUE;
+    }
+
     return priv->lightdm_list;
 }
 
+/**
+ * lightdm_user_list_get_users_range:
+ * @user_list: A #LightDMUserList
+ * @offset: Index of the first user to get.
+ * @n_users: Maximum number of users to get.
+ *
+ * Get the users in positions @offset to @offset + @n_users - 1 of the list
+ * returned by lightdm_user_list_get_users().  Only the requested users are
+ * loaded, so this can be used to page through a large list of users.
+ *
+ * Return value: (element-type LightDMUser) (transfer container): A list of #LightDMUser, which may be shorter than @n_users if the end of the list is reached.
+ **/
+GList *
+lightdm_user_list_get_users_range (LightDMUserList *user_list, gint offset, gint n_users)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), NULL);
+    g_return_val_if_fail (offset >= 0, NULL);
+    g_return_val_if_fail (n_users >= 0, NULL);
+
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+    initialize_user_list_if_needed (user_list);
+
+    if ((guint) offset >= priv->common_users->len)
+        return NULL;
+
+    guint end = MIN ((guint) offset + n_users, priv->common_users->len);
+    GList *users = NULL;
+    for (guint i = end; i > (guint) offset; i--)
+        users = g_list_prepend (users, get_lightdm_user (user_list, i - 1));
+
+    return users;
+}
+
+/**
+ * lightdm_user_list_get_users_array:
+ * @user_list: A #LightDMUserList
+ *
+ * Get the users returned by lightdm_user_list_get_users() as an array, which
+ * is quicker to index and to load into a model in one go.
+ *
+ * Return value: (element-type LightDMUser) (transfer container): An array of #LightDMUser.
+ **/
+GPtrArray *
+lightdm_user_list_get_users_array (LightDMUserList *user_list)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), NULL);
+
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+    initialize_user_list_if_needed (user_list);
+
+    GPtrArray *users = g_ptr_array_sized_new (priv->common_users->len);
+    for (guint i = 0; i < priv->common_users->len; i++)
+        g_ptr_array_add (users, get_lightdm_user (user_list, i));
+
+    return users;
+}
+
+static void
+add_string (GVariantBuilder *builder, const gchar *name, const gchar *value)
+{
+    if (value)
+        g_variant_builder_add (builder, "{sv}", name, g_variant_new_string (value));
+}
+
+/**
+ * lightdm_user_list_get_users_variant:
+ * @user_list: A #LightDMUserList
+ *
+ * Get the fields shown for each user returned by lightdm_user_list_get_users()
+ * in one value, so greeters using language bindings can fill their user list
+ * without a call for each field of each user.
+ *
+ * The value is an array of dictionaries (type aa{sv}) with the keys "name",
+ * "real-name", "display-name", "home-directory", "image", "background",
+ * "language", "layout", "layouts", "session", "logged-in", "has-messages",
+ * "uid" and "is-locked", matching the #LightDMUser properties.  Keys for
+ * fields that are not set are left out.
+ *
+ * Return value: (transfer full): A #GVariant with the user fields.
+ **/
+GVariant *
+lightdm_user_list_get_users_variant (LightDMUserList *user_list)
+{
+    g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), NULL);
+
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+    initialize_user_list_if_needed (user_list);
+
+    /* Read the common users directly so no wrappers are made */
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+    for (guint i = 0; i < priv->common_users->len; i++)
+    {
+        CommonUser *user = g_ptr_array_index (priv->common_users, i);
+
+        g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+        add_string (&builder, "name", common_user_get_name (user));
+        add_string (&builder, "real-name", common_user_get_real_name (user));
+        add_string (&builder, "display-name", common_user_get_display_name (user));
+        add_string (&builder, "home-directory", common_user_get_home_directory (user));
+        add_string (&builder, "image", common_user_get_image (user));
+        add_string (&builder, "background", common_user_get_background (user));
+        add_string (&builder, "language", common_user_get_language (user));
+        add_string (&builder, "layout", common_user_get_layout (user));
+        const gchar * const *layouts = common_user_get_layouts (user);
+        if (layouts)
+            g_variant_builder_add (&builder, "{sv}", "layouts", g_variant_new_strv (layouts, -1));
+        add_string (&builder, "session", common_user_get_session (user));
+        g_variant_builder_add (&builder, "{sv}", "logged-in", g_variant_new_boolean (common_user_get_logged_in (user)));
+        g_variant_builder_add (&builder, "{sv}", "has-messages", g_variant_new_boolean (common_user_get_has_messages (user)));
+        g_variant_builder_add (&builder, "{sv}", "uid", g_variant_new_uint64 (common_user_get_uid (user)));
+        g_variant_builder_add (&builder, "{sv}", "is-locked", g_variant_new_boolean (common_user_get_is_locked (user)));
+        g_variant_builder_close (&builder);
+    }
+
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 /**
  * lightdm_user_list_get_user_by_name:
  * @user_list: A #LightDMUserList
@@ -260,23 +487,27 @@ lightdm_user_list_get_user_by_name (LightDMUserList *user_list, const gchar *use
     g_return_val_if_fail (LIGHTDM_IS_USER_LIST (user_list), NULL);
     g_return_val_if_fail (username != NULL, NULL);
 
-    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
-
     initialize_user_list_if_needed (user_list);
 
-    for (GList *link = priv->lightdm_list; link; link = link->next)
-    {
-        LightDMUser *user = link->data;
-        if (g_strcmp0 (lightdm_user_get_name (user), username) == 0)
-            return user;
-    }
+    CommonUser *common_user = common_user_list_get_user_by_name (common_user_list_get_instance (), username);
+    if (!common_user)
+        return NULL;
+
+    gint index = find_common_user (user_list, common_user);
+    g_object_unref (common_user);
+    if (index < 0)
+        return NULL;
 
-    return NULL;
+    return get_lightdm_user (user_list, index);
 }
 
 static void
 lightdm_user_list_init (LightDMUserList *user_list)
 {
+    LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (user_list);
+
+    priv->common_users = g_ptr_array_new_with_free_func (g_object_unref);
+    priv->lightdm_users = g_ptr_array_new ();
 }
 
 static void
@@ -314,7 +545,15 @@ lightdm_user_list_finalize (GObject *object)
     LightDMUserList *self = LIGHTDM_USER_LIST (object);
     LightDMUserListPrivate *priv = lightdm_user_list_get_instance_private (self);
 
-    g_list_free_full (priv->lightdm_list, g_object_unref);
+    g_list_free (priv->lightdm_list);
+    g_clear_handle_id (&priv->users_changed_idle, g_source_remove);
+    g_clear_pointer (&priv->added_users, g_ptr_array_unref);
+    g_clear_pointer (&priv->changed_users, g_ptr_array_unref);
+    g_clear_pointer (&priv->removed_users, g_ptr_array_unref);
+    for (guint i = 0; i < priv->lightdm_users->len; i++)
+        g_clear_object (&g_ptr_array_index (priv->lightdm_users, i));
+    g_ptr_array_unref (priv->lightdm_users);
+    g_ptr_array_unref (priv->common_users);
 
     G_OBJECT_CLASS (lightdm_user_list_parent_class)->finalize (object);
 }
@@ -398,6 +637,28 @@ lightdm_user_list_class_init (LightDMUserListClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 1, LIGHTDM_TYPE_USER);
+
+    /**
+     * LightDMUserList::users-changed:
+     * @user_list: A #LightDMUserList
+     * @added: (element-type LightDMUser): The #LightDMUser that have been added.
+     * @changed: (element-type LightDMUser): The #LightDMUser that have been changed.
+     * @removed: (element-type LightDMUser): The #LightDMUser that have been removed.
+     *
+     * The ::users-changed signal gets emitted once for all the changes made
+     * to the list at the same time, such as when it is first loaded. Each
+     * user appears in at most one of the arrays. It is emitted after the
+     * ::user-added, ::user-changed and ::user-removed signals for the same
+     * changes, so greeters that update in bulk only need to listen to this.
+     **/
+    list_signals[USERS_CHANGED] =
+        g_signal_new (LIGHTDM_USER_LIST_SIGNAL_USERS_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (LightDMUserListClass, users_changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 3, G_TYPE_PTR_ARRAY, G_TYPE_PTR_ARRAY, G_TYPE_PTR_ARRAY);
 }
 
 /**
@@ -84,6 +84,7 @@ public:
 public Q_SLOTS:
     bool connectToDaemonSync();
     bool connectSync();
+    void connectToDaemon();
     void authenticate(const QString &username=QString());
     void authenticateAsGuest();
     void authenticateAutologin();
@@ -94,7 +95,9 @@ public Q_SLOTS:
     void setLanguage (const QString &language);
     void setResettable (bool resettable);
     bool startSessionSync(const QString &session=QString());
+    void startSession(const QString &session=QString());
     QString ensureSharedDataDirSync(const QString &username);
+    void ensureSharedDataDir(const QString &username);
 
 Q_SIGNALS:
     void showMessage(QString text, QLightDM::Greeter::MessageType type);
@@ -103,6 +106,9 @@ Q_SIGNALS:
     void autologinTimerExpired();
     void idle();
     void reset();
+    void connectToDaemonFinished(bool success);
+    void startSessionFinished(bool success);
+    void ensureSharedDataDirFinished(const QString &username, const QString &dir);
 
 private:
     GreeterPrivate *d_ptr;
@@ -39,7 +39,9 @@ public:
                          ImagePathRole,
                          BackgroundPathRole,
                          UidRole,
-                         IsLockedRole
+                         IsLockedRole,
+                         ThumbnailRole,
+                         BackgroundImageRole
     };
 
     QHash<int, QByteArray> roleNames() const;
@@ -52,6 +54,7 @@ private:
     UsersModelPrivate * const d_ptr;
 
     Q_DECLARE_PRIVATE(UsersModel)
+    Q_PRIVATE_SLOT(d_func(), void _q_imageLoaded(const QString &path, const QImage &image, bool thumbnail))
 
 };
 
@@ -16,6 +16,8 @@
 #include <QtCore/QDir>
 #include <QtCore/QVariant>
 #include <QtCore/QSettings>
+#include <QtCore/QSocketNotifier>
+#include <QtCore/QStringList>
 
 #include <lightdm.h>
 
@@ -25,7 +27,20 @@ class QLightDM::GreeterPrivate
 {
 public:
     GreeterPrivate(Greeter *parent);
+    ~GreeterPrivate();
     LightDMGreeter *ldmGreeter;
+
+    /* Cancelled on destruction so pending requests don't call back into us */
+    GCancellable *cancellable;
+
+    /* Users waiting for a shared data directory, in the order they were requested */
+    QStringList sharedDataDirUsers;
+
+    /* Reads messages from the daemon in the Qt event loop */
+    QSocketNotifier *daemonNotifier;
+
+    void watchDaemon();
+    void dispatch();
 protected:
     Greeter* q_ptr;
 
@@ -35,18 +50,26 @@ protected:
     static void cb_autoLoginExpired(LightDMGreeter *greeter, gpointer data);
     static void cb_idle(LightDMGreeter *greeter, gpointer data);
     static void cb_reset(LightDMGreeter *greeter, gpointer data);
+    static void cb_connectToDaemon(GObject *object, GAsyncResult *result, gpointer data);
+    static void cb_startSession(GObject *object, GAsyncResult *result, gpointer data);
+    static void cb_ensureSharedDataDir(GObject *object, GAsyncResult *result, gpointer data);
 
 private:
     Q_DECLARE_PUBLIC(Greeter)
 };
 
 GreeterPrivate::GreeterPrivate(Greeter *parent) :
+    daemonNotifier(NULL),
     q_ptr(parent)
 {
 #if !defined(GLIB_VERSION_2_36)
     g_type_init();
 #endif
     ldmGreeter = lightdm_greeter_new();
+    cancellable = g_cancellable_new();
+
+    /* Handle daemon messages as soon as they arrive, even if Qt isn't running GLib */
+    lightdm_greeter_set_external_dispatch(ldmGreeter, TRUE);
 
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_SHOW_PROMPT, G_CALLBACK (cb_showPrompt), this);
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_SHOW_MESSAGE, G_CALLBACK (cb_showMessage), this);
@@ -56,6 +79,35 @@ GreeterPrivate::GreeterPrivate(Greeter *parent) :
     g_signal_connect (ldmGreeter, LIGHTDM_GREETER_SIGNAL_RESET, G_CALLBACK (cb_reset), this);
 }
 
+GreeterPrivate::~GreeterPrivate()
+{
+    delete daemonNotifier;
+    g_signal_handlers_disconnect_by_data(ldmGreeter, this);
+    g_cancellable_cancel(cancellable);
+    g_object_unref(cancellable);
+}
+
+void GreeterPrivate::watchDaemon()
+{
+    int fd = lightdm_greeter_get_daemon_fd(ldmGreeter);
+    if (daemonNotifier || fd < 0)
+        return;
+
+    daemonNotifier = new QSocketNotifier(fd, QSocketNotifier::Read);
+    QObject::connect(daemonNotifier, &QSocketNotifier::activated, q_ptr, [this]() { dispatch(); });
+}
+
+void GreeterPrivate::dispatch()
+{
+    GError *error = NULL;
+    if (!lightdm_greeter_dispatch(ldmGreeter, &error))
+    {
+        qWarning() << "Failed to read from daemon:" << error->message;
+        g_clear_error(&error);
+        daemonNotifier->setEnabled(false);
+    }
+}
+
 void GreeterPrivate::cb_showPrompt(LightDMGreeter *greeter, const gchar *text, LightDMPromptType type, gpointer data)
 {
     Q_UNUSED(greeter);
@@ -106,6 +158,30 @@ void GreeterPrivate::cb_reset(LightDMGreeter *greeter, gpointer data)
     Q_EMIT that->q_func()->reset();
 }
 
+void GreeterPrivate::cb_connectToDaemon(GObject *object, GAsyncResult *result, gpointer data)
+{
+    GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    bool success = lightdm_greeter_connect_to_daemon_finish(LIGHTDM_GREETER(object), result, NULL);
+    Q_EMIT that->q_func()->connectToDaemonFinished(success);
+}
+
+void GreeterPrivate::cb_startSession(GObject *object, GAsyncResult *result, gpointer data)
+{
+    GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    bool success = lightdm_greeter_start_session_finish(LIGHTDM_GREETER(object), result, NULL);
+    Q_EMIT that->q_func()->startSessionFinished(success);
+}
+
+void GreeterPrivate::cb_ensureSharedDataDir(GObject *object, GAsyncResult *result, gpointer data)
+{
+    GreeterPrivate *that = static_cast<GreeterPrivate*>(data);
+    gchar *dir = lightdm_greeter_ensure_shared_data_dir_finish(LIGHTDM_GREETER(object), result, NULL);
+    QString username = that->sharedDataDirUsers.isEmpty() ? QString() : that->sharedDataDirUsers.takeFirst();
+    QString path = QString::fromUtf8(dir);
+    g_free(dir);
+    Q_EMIT that->q_func()->ensureSharedDataDirFinished(username, path);
+}
+
 Greeter::Greeter(QObject *parent) :
     QObject(parent),
     d_ptr(new GreeterPrivate(this))
@@ -121,13 +197,24 @@ Greeter::~Greeter()
 bool Greeter::connectToDaemonSync()
 {
     Q_D(Greeter);
-    return lightdm_greeter_connect_to_daemon_sync(d->ldmGreeter, NULL);
+    bool result = lightdm_greeter_connect_to_daemon_sync(d->ldmGreeter, NULL);
+    d->watchDaemon();
+    return result;
 }
 
 bool Greeter::connectSync()
 {
     Q_D(Greeter);
-    return lightdm_greeter_connect_to_daemon_sync(d->ldmGreeter, NULL);
+    bool result = lightdm_greeter_connect_to_daemon_sync(d->ldmGreeter, NULL);
+    d->watchDaemon();
+    return result;
+}
+
+void Greeter::connectToDaemon()
+{
+    Q_D(Greeter);
+    lightdm_greeter_connect_to_daemon(d->ldmGreeter, d->cancellable, GreeterPrivate::cb_connectToDaemon, d);
+    d->watchDaemon();
 }
 
 void Greeter::authenticate(const QString &username)
@@ -208,12 +295,25 @@ bool Greeter::startSessionSync(const QString &session)
     return lightdm_greeter_start_session_sync(d->ldmGreeter, session.toLocal8Bit().constData(), NULL);
 }
 
+void Greeter::startSession(const QString &session)
+{
+    Q_D(Greeter);
+    lightdm_greeter_start_session(d->ldmGreeter, session.toLocal8Bit().constData(), d->cancellable, GreeterPrivate::cb_startSession, d);
+}
+
 QString Greeter::ensureSharedDataDirSync(const QString &username)
 {
     Q_D(Greeter);
     return QString::fromUtf8(lightdm_greeter_ensure_shared_data_dir_sync(d->ldmGreeter, username.toLocal8Bit().constData(), NULL));
 }
 
+void Greeter::ensureSharedDataDir(const QString &username)
+{
+    Q_D(Greeter);
+    d->sharedDataDirUsers.append(username);
+    lightdm_greeter_ensure_shared_data_dir(d->ldmGreeter, username.toLocal8Bit().constData(), d->cancellable, GreeterPrivate::cb_ensureSharedDataDir, d);
+}
+
 
 QString Greeter::getHint(const QString &name) const
 {
@@ -19,17 +19,152 @@ using namespace QLightDM;
 class PowerInterface::PowerInterfacePrivate
 {
 public:
-    PowerInterfacePrivate();
+    PowerInterfacePrivate(PowerInterface *parent);
+    ~PowerInterfacePrivate();
+    void update();
+
+    PowerInterface * const q_ptr;
+
+    /* Cancelled when the interface is destroyed so pending checks don't use it */
+    GCancellable *cancellable;
+
+    bool haveCanSuspend;
+    bool canSuspend;
+    bool haveCanHibernate;
+    bool canHibernate;
+    bool haveCanShutdown;
+    bool canShutdown;
+    bool haveCanRestart;
+    bool canRestart;
+
+    static void cb_changed(LightDMPower *power, gpointer data);
+    static void cb_canSuspend(GObject *object, GAsyncResult *result, gpointer data);
+    static void cb_canHibernate(GObject *object, GAsyncResult *result, gpointer data);
+    static void cb_canShutdown(GObject *object, GAsyncResult *result, gpointer data);
+    static void cb_canRestart(GObject *object, GAsyncResult *result, gpointer data);
+
+private:
+    Q_DECLARE_PUBLIC(PowerInterface)
 };
 
-PowerInterface::PowerInterfacePrivate::PowerInterfacePrivate()
+PowerInterface::PowerInterfacePrivate::PowerInterfacePrivate(PowerInterface *parent) :
+    q_ptr(parent),
+    cancellable(g_cancellable_new()),
+    haveCanSuspend(false),
+    canSuspend(false),
+    haveCanHibernate(false),
+    canHibernate(false),
+    haveCanShutdown(false),
+    canShutdown(false),
+    haveCanRestart(false),
+    canRestart(false)
 {
+    g_signal_connect(lightdm_power_get_instance(), LIGHTDM_POWER_SIGNAL_CHANGED, G_CALLBACK (cb_changed), this);
+}
+
+PowerInterface::PowerInterfacePrivate::~PowerInterfacePrivate()
+{
+    g_signal_handlers_disconnect_by_data(lightdm_power_get_instance(), this);
+    g_cancellable_cancel(cancellable);
+    g_object_unref(cancellable);
+}
+
+void PowerInterface::PowerInterfacePrivate::update()
+{
+    lightdm_get_can_suspend_async(cancellable, cb_canSuspend, this);
+    lightdm_get_can_hibernate_async(cancellable, cb_canHibernate, this);
+    lightdm_get_can_shutdown_async(cancellable, cb_canShutdown, this);
+    lightdm_get_can_restart_async(cancellable, cb_canRestart, this);
+}
+
+void PowerInterface::PowerInterfacePrivate::cb_changed(LightDMPower *power, gpointer data)
+{
+    Q_UNUSED(power);
+
+    PowerInterfacePrivate *that = static_cast<PowerInterfacePrivate*>(data);
+    that->update();
+}
+
+void PowerInterface::PowerInterfacePrivate::cb_canSuspend(GObject *object, GAsyncResult *result, gpointer data)
+{
+    Q_UNUSED(object);
+
+    GError *error = NULL;
+    bool value = lightdm_get_can_suspend_finish(result, &error);
+    if (error) {
+        g_error_free(error);
+        return;
+    }
+
+    PowerInterfacePrivate *that = static_cast<PowerInterfacePrivate*>(data);
+    bool changed = that->haveCanSuspend && that->canSuspend != value;
+    that->haveCanSuspend = true;
+    that->canSuspend = value;
+    if (changed)
+        Q_EMIT that->q_func()->canSuspendChanged();
+}
+
+void PowerInterface::PowerInterfacePrivate::cb_canHibernate(GObject *object, GAsyncResult *result, gpointer data)
+{
+    Q_UNUSED(object);
+
+    GError *error = NULL;
+    bool value = lightdm_get_can_hibernate_finish(result, &error);
+    if (error) {
+        g_error_free(error);
+        return;
+    }
+
+    PowerInterfacePrivate *that = static_cast<PowerInterfacePrivate*>(data);
+    bool changed = that->haveCanHibernate && that->canHibernate != value;
+    that->haveCanHibernate = true;
+    that->canHibernate = value;
+    if (changed)
+        Q_EMIT that->q_func()->canHibernateChanged();
+}
+
+void PowerInterface::PowerInterfacePrivate::cb_canShutdown(GObject *object, GAsyncResult *result, gpointer data)
+{
+    Q_UNUSED(object);
+
+    GError *error = NULL;
+    bool value = lightdm_get_can_shutdown_finish(result, &error);
+    if (error) {
+        g_error_free(error);
+        return;
+    }
+
+    PowerInterfacePrivate *that = static_cast<PowerInterfacePrivate*>(data);
+    bool changed = that->haveCanShutdown && that->canShutdown != value;
+    that->haveCanShutdown = true;
+    that->canShutdown = value;
+    if (changed)
+        Q_EMIT that->q_func()->canShutdownChanged();
+}
+
+void PowerInterface::PowerInterfacePrivate::cb_canRestart(GObject *object, GAsyncResult *result, gpointer data)
+{
+    Q_UNUSED(object);
+
+    GError *error = NULL;
+    bool value = lightdm_get_can_restart_finish(result, &error);
+    if (error) {
+        g_error_free(error);
+        return;
+    }
+
+    PowerInterfacePrivate *that = static_cast<PowerInterfacePrivate*>(data);
+    bool changed = that->haveCanRestart && that->canRestart != value;
+    that->haveCanRestart = true;
+    that->canRestart = value;
+    if (changed)
+        Q_EMIT that->q_func()->canRestartChanged();
 }
 
 
 PowerInterface::PowerInterface(QObject *parent)
     : QObject(parent),
-      d(new PowerInterfacePrivate)
+      d(new PowerInterfacePrivate(this))
 {
 }
 
@@ -40,7 +175,11 @@ PowerInterface::~PowerInterface()
 
 bool PowerInterface::canSuspend()
 {
-    return lightdm_get_can_suspend ();
+    if (!d->haveCanSuspend) {
+        d->canSuspend = lightdm_get_can_suspend ();
+        d->haveCanSuspend = true;
+    }
+    return d->canSuspend;
 }
 
 bool PowerInterface::suspend()
@@ -50,7 +189,11 @@ bool PowerInterface::suspend()
 
 bool PowerInterface::canHibernate()
 {
-    return lightdm_get_can_hibernate ();
+    if (!d->haveCanHibernate) {
+        d->canHibernate = lightdm_get_can_hibernate ();
+        d->haveCanHibernate = true;
+    }
+    return d->canHibernate;
 }
 
 bool PowerInterface::hibernate()
@@ -60,7 +203,11 @@ bool PowerInterface::hibernate()
 
 bool PowerInterface::canShutdown()
 {
-    return lightdm_get_can_shutdown ();
+    if (!d->haveCanShutdown) {
+        d->canShutdown = lightdm_get_can_shutdown ();
+        d->haveCanShutdown = true;
+    }
+    return d->canShutdown;
 }
 
 bool PowerInterface::shutdown()
@@ -70,7 +217,11 @@ bool PowerInterface::shutdown()
 
 bool PowerInterface::canRestart()
 {
-    return lightdm_get_can_restart ();
+    if (!d->haveCanRestart) {
+        d->canRestart = lightdm_get_can_restart ();
+        d->haveCanRestart = true;
+    }
+    return d->canRestart;
 }
 
 bool PowerInterface::restart()
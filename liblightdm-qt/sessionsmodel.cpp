@@ -17,27 +17,23 @@
 
 using namespace QLightDM;
 
-class SessionItem
-{
-public:
-    QString key;
-    QString type;
-    QString name;
-    QString comment;
-};
-
-
 class SessionsModelPrivate
 {
 public:
     SessionsModelPrivate(SessionsModel *parent);
-    QList<SessionItem> items;
+    ~SessionsModelPrivate();
+
+    /* Sessions are shared with liblightdm-gobject, which only parses the session files once per process */
+    QList<LightDMSession*> sessions;
 
     void loadSessions(SessionsModel::SessionType sessionType);
 
 protected:
     SessionsModel* q_ptr;
 
+    static void cb_sessionAdded(LightDMSessionList *session_list, LightDMSession *session, gpointer data);
+    static void cb_sessionRemoved(LightDMSessionList *session_list, LightDMSession *session, gpointer data);
+
 private:
     Q_DECLARE_PUBLIC(SessionsModel)
 
@@ -51,18 +47,29 @@ SessionsModelPrivate::SessionsModelPrivate(SessionsModel *parent) :
 #endif
 }
 
+SessionsModelPrivate::~SessionsModelPrivate()
+{
+    g_signal_handlers_disconnect_by_data(lightdm_session_list_get_instance(), this);
+    for (int i = 0; i < sessions.size(); i++) {
+        g_object_unref(sessions[i]);
+    }
+}
+
 void SessionsModelPrivate::loadSessions(SessionsModel::SessionType sessionType)
 {
     GList *ldmSessions;
+    const char *detail;
 
     switch (sessionType) {
     case SessionsModel::RemoteSessions:
         ldmSessions = lightdm_get_remote_sessions();
+        detail = "remote";
         break;
     case SessionsModel::LocalSessions:
         /* Fall through*/
     default:
         ldmSessions = lightdm_get_sessions();
+        detail = "local";
         break;
     }
 
@@ -70,16 +77,43 @@ void SessionsModelPrivate::loadSessions(SessionsModel::SessionType sessionType)
        LightDMSession *ldmSession = static_cast<LightDMSession*>(item->data);
        Q_ASSERT(ldmSession);
 
-       SessionItem session;
-       session.key = QString::fromUtf8(lightdm_session_get_key(ldmSession));
-       session.type = QString::fromUtf8(lightdm_session_get_session_type(ldmSession));
-       session.name = QString::fromUtf8(lightdm_session_get_name(ldmSession));
-       session.comment = QString::fromUtf8(lightdm_session_get_comment(ldmSession));
-
-       items.append(session);
+       sessions.append(static_cast<LightDMSession*>(g_object_ref(ldmSession)));
    }
 
    //this happens in the constructor so we don't need beginInsertRows() etc.
+
+    QByteArray addedSignal = QByteArray(LIGHTDM_SESSION_LIST_SIGNAL_SESSION_ADDED "::") + detail;
+    QByteArray removedSignal = QByteArray(LIGHTDM_SESSION_LIST_SIGNAL_SESSION_REMOVED "::") + detail;
+    g_signal_connect(lightdm_session_list_get_instance(), addedSignal.constData(), G_CALLBACK (cb_sessionAdded), this);
+    g_signal_connect(lightdm_session_list_get_instance(), removedSignal.constData(), G_CALLBACK (cb_sessionRemoved), this);
+}
+
+void SessionsModelPrivate::cb_sessionAdded(LightDMSessionList *session_list, LightDMSession *session, gpointer data)
+{
+    Q_UNUSED(session_list)
+    SessionsModelPrivate *that = static_cast<SessionsModelPrivate*>(data);
+
+    /* Keep the same order as the session list */
+    int row = 0;
+    while (row < that->sessions.size() && qstrcmp(lightdm_session_get_name(that->sessions[row]), lightdm_session_get_name(session)) <= 0)
+        row++;
+
+    that->q_func()->beginInsertRows(QModelIndex(), row, row);
+    that->sessions.insert(row, static_cast<LightDMSession*>(g_object_ref(session)));
+    that->q_func()->endInsertRows();
+}
+
+void SessionsModelPrivate::cb_sessionRemoved(LightDMSessionList *session_list, LightDMSession *session, gpointer data)
+{
+    Q_UNUSED(session_list)
+    SessionsModelPrivate *that = static_cast<SessionsModelPrivate*>(data);
+
+    int row = that->sessions.indexOf(session);
+    if (row >= 0) {
+        that->q_func()->beginRemoveRows(QModelIndex(), row, row);
+        g_object_unref(that->sessions.takeAt(row));
+        that->q_func()->endRemoveRows();
+    }
 }
 
 
@@ -121,7 +155,7 @@ int SessionsModel::rowCount(const QModelIndex &parent) const
     Q_D(const SessionsModel);
 
     if (parent == QModelIndex()) { //if top level
-        return d->items.size();
+        return d->sessions.size();
     } else {
         return 0; // no child elements.
     }
@@ -137,15 +171,16 @@ QVariant SessionsModel::data(const QModelIndex &index, int role) const
 
     int row = index.row();
 
+    LightDMSession *session = d->sessions[row];
     switch (role) {
     case SessionsModel::KeyRole:
-        return d->items[row].key;
+        return QString::fromUtf8(lightdm_session_get_key(session));
     case SessionsModel::TypeRole:
-        return d->items[row].type;
+        return QString::fromUtf8(lightdm_session_get_session_type(session));
     case Qt::DisplayRole:
-        return d->items[row].name;
+        return QString::fromUtf8(lightdm_session_get_name(session));
     case Qt::ToolTipRole:
-        return d->items[row].comment;
+        return QString::fromUtf8(lightdm_session_get_comment(session));
 
     }
     return QVariant();
@@ -11,50 +11,152 @@
 #include "QLightDM/usersmodel.h"
 
 #include <QtCore/QString>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
 #include <QtCore/QDebug>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
 #include <QtGui/QIcon>
+#include <QtGui/QImage>
+#include <QtGui/QImageReader>
+
+#include <stdio.h>
 
 #include <lightdm.h>
 
 using namespace QLightDM;
 
-class UserItem
-{
+/* Size of the user images returned by ThumbnailRole */
+#define THUMBNAIL_SIZE 256
+
+namespace QLightDM {
+/* Decodes an image on a worker thread and passes it back to the model */
+class ImageLoader : public QRunnable {
 public:
-    QString name;
-    QString realName;
-    QString homeDirectory;
-    QString image;
-    QString background;
-    QString session;
-    bool isLoggedIn;
-    bool hasMessages;
-    quint64 uid;
-    QString displayName() const;
-    bool isLocked;
+    ImageLoader(UsersModel *model, QAtomicInt *cancelled, const QString &path, bool thumbnail) :
+        model(model), cancelled(cancelled), path(path), thumbnail(thumbnail) {}
+    void run();
+
+private:
+    QImage loadThumbnail();
+
+    UsersModel *model;
+    QAtomicInt *cancelled;
+    QString path;
+    bool thumbnail;
 };
 
-QString UserItem::displayName() const {
-    if (realName.isEmpty()){
-        return name;
-    }
-    else {
-        return realName;
+/* Thumbnails are stored in the greeter's cache, keyed by the source path and modification time */
+static QString getThumbnailCachePath(const QString &path)
+{
+    QString cacheDir = QString::fromUtf8(g_get_user_cache_dir()) + QLatin1String("/lightdm/thumbnails");
+    QByteArray hash = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return cacheDir + QLatin1Char('/') + QString::fromLatin1(hash) + QLatin1String(".png");
+}
+
+QImage ImageLoader::loadThumbnail()
+{
+    QFileInfo source(path);
+    if (!source.exists())
+        return QImage();
+    QString mtime = QString::number(source.lastModified().toMSecsSinceEpoch());
+
+    QString cachePath = getThumbnailCachePath(path);
+    QImageReader cacheReader(cachePath);
+    if (cacheReader.canRead() && cacheReader.text(QLatin1String("Source-MTime")) == mtime) {
+        QImage image = cacheReader.read();
+        if (!image.isNull())
+            return image;
     }
+
+    /* Let the decoder scale as it reads, this avoids decoding large photos at full size */
+    QImageReader reader(path);
+    QSize size = reader.size();
+    if (size.isValid() && (size.width() > THUMBNAIL_SIZE || size.height() > THUMBNAIL_SIZE))
+        reader.setScaledSize(size.scaled(THUMBNAIL_SIZE, THUMBNAIL_SIZE, Qt::KeepAspectRatio));
+    QImage image = reader.read();
+    if (image.isNull())
+        return image;
+    if (image.width() > THUMBNAIL_SIZE || image.height() > THUMBNAIL_SIZE)
+        image = image.scaled(THUMBNAIL_SIZE, THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    QDir().mkpath(QFileInfo(cachePath).path());
+    image.setText(QLatin1String("Source-MTime"), mtime);
+    QString tempPath = cachePath + QLatin1String(".tmp");
+    if (image.save(tempPath, "PNG"))
+        rename(tempPath.toLocal8Bit().constData(), cachePath.toLocal8Bit().constData());
+
+    return image;
 }
 
-namespace QLightDM {
+void ImageLoader::run()
+{
+    if (cancelled->load())
+        return;
+
+    QImage image = thumbnail ? loadThumbnail() : QImage(path);
+
+    if (!cancelled->load())
+        QMetaObject::invokeMethod(model, "_q_imageLoaded", Qt::QueuedConnection,
+                                  Q_ARG(QString, path), Q_ARG(QImage, image), Q_ARG(bool, thumbnail));
+}
+
+/* Values of a user as last reported to views, used to work out what changed */
+struct UserState {
+    QByteArray name;
+    QByteArray realName;
+    QByteArray session;
+    QByteArray image;
+    QByteArray background;
+    QDateTime imageMTime;
+    bool loggedIn;
+    bool hasMessages;
+    bool isLocked;
+    quint64 uid;
+
+    QByteArray displayName() const { return realName.isEmpty() ? name : realName; }
+};
+
 class UsersModelPrivate {
 public:
     UsersModelPrivate(UsersModel *parent);
     virtual ~UsersModelPrivate();
-    QList<UserItem> users;
+    /* Users are referenced rather than copied, values are only converted when they are displayed */
+    QList<LightDMUser*> users;
+
+    /* State of each row, in the same order as users */
+    QList<UserState> states;
+
+    /* Row of each user */
+    QHash<LightDMUser*, int> rows;
+
+    /* Decoded images by path, and the paths still being loaded */
+    QHash<QString, QImage> thumbnails;
+    QHash<QString, QImage> backgrounds;
+    QSet<QString> loadingThumbnails;
+    QSet<QString> loadingBackgrounds;
+
+    /* Worker threads for image loading, cancelled on destruction */
+    QThreadPool imagePool;
+    QAtomicInt imagesCancelled;
+
+    QImage getImage(const QString &path, bool thumbnail);
+    void _q_imageLoaded(const QString &path, const QImage &image, bool thumbnail);
 
     protected:
         UsersModel * const q_ptr;
 
         void loadUsers();
+        int findRow(const QByteArray &displayName, int skip = -1) const;
+        void updateRows(int from, int to);
 
+        static UserState getState(LightDMUser *user);
         static void cb_userAdded(LightDMUserList *user_list, LightDMUser *user, gpointer data);
         static void cb_userChanged(LightDMUserList *user_list, LightDMUser *user, gpointer data);
         static void cb_userRemoved(LightDMUserList *user_list, LightDMUser *user, gpointer data);
@@ -73,7 +175,104 @@ UsersModelPrivate::UsersModelPrivate(UsersModel* parent) :
 
 UsersModelPrivate::~UsersModelPrivate()
 {
+    imagesCancelled.store(1);
+    imagePool.clear();
+    imagePool.waitForDone();
+
     g_signal_handlers_disconnect_by_data(lightdm_user_list_get_instance(), this);
+    for (int i=0;i<users.size();i++) {
+        g_object_unref(users[i]);
+    }
+}
+
+UserState UsersModelPrivate::getState(LightDMUser *user)
+{
+    UserState state;
+    state.name = lightdm_user_get_name(user);
+    state.realName = lightdm_user_get_real_name(user);
+    state.session = lightdm_user_get_session(user);
+    state.image = lightdm_user_get_image(user);
+    state.background = lightdm_user_get_background(user);
+    if (!state.image.isEmpty())
+        state.imageMTime = QFileInfo(QString::fromUtf8(state.image)).lastModified();
+    state.loggedIn = lightdm_user_get_logged_in(user);
+    state.hasMessages = lightdm_user_get_has_messages(user);
+    state.isLocked = lightdm_user_get_is_locked(user);
+    state.uid = lightdm_user_get_uid(user);
+    return state;
+}
+
+/* Find where a user belongs in the list, sorted by display name as the user list is.
+ * If skip is set that row is ignored, and the result is the row after it is taken out. */
+int UsersModelPrivate::findRow(const QByteArray &displayName, int skip) const
+{
+    int low = 0, high = states.size();
+    if (skip >= 0)
+        high--;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        int row = skip >= 0 && middle >= skip ? middle + 1 : middle;
+        if (qstrcmp(states[row].displayName(), displayName) <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+QImage UsersModelPrivate::getImage(const QString &path, bool thumbnail)
+{
+    Q_Q(UsersModel);
+
+    if (path.isEmpty())
+        return QImage();
+
+    QHash<QString, QImage> &images = thumbnail ? thumbnails : backgrounds;
+    QHash<QString, QImage>::const_iterator i = images.constFind(path);
+    if (i != images.constEnd())
+        return i.value();
+
+    /* Return nothing until the image is ready, views are told when it is */
+    QSet<QString> &loading = thumbnail ? loadingThumbnails : loadingBackgrounds;
+    if (!loading.contains(path)) {
+        loading.insert(path);
+        imagePool.start(new ImageLoader(q, &imagesCancelled, path, thumbnail));
+    }
+
+    return QImage();
+}
+
+void UsersModelPrivate::_q_imageLoaded(const QString &path, const QImage &image, bool thumbnail)
+{
+    Q_Q(UsersModel);
+
+    if (thumbnail) {
+        loadingThumbnails.remove(path);
+        thumbnails.insert(path, image);
+    } else {
+        loadingBackgrounds.remove(path);
+        backgrounds.insert(path, image);
+    }
+
+    QVector<int> roles;
+    roles << (thumbnail ? UsersModel::ThumbnailRole : UsersModel::BackgroundImageRole);
+    QByteArray source = path.toUtf8();
+    for (int i = 0; i < states.size(); i++) {
+        if ((thumbnail ? states[i].image : states[i].background) != source)
+            continue;
+        QModelIndex index = q->createIndex(i, 0);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+        q->dataChanged(index, index, roles);
+#else
+        q->dataChanged(index, index);
+#endif
+    }
+}
+
+void UsersModelPrivate::updateRows(int from, int to)
+{
+    for (int i = from; i <= to && i < users.size(); i++)
+        rows[users[i]] = i;
 }
 
 void UsersModelPrivate::loadUsers()
@@ -87,24 +286,17 @@ void UsersModelPrivate::loadUsers()
     } else {
         q->beginInsertRows(QModelIndex(), 0, rowCount-1);
 
-        const GList *items, *item;
-        items = lightdm_user_list_get_users(lightdm_user_list_get_instance());
-        for (item = items; item; item = item->next) {
-            LightDMUser *ldmUser = static_cast<LightDMUser*>(item->data);
-
-            UserItem user;
-            user.name = QString::fromUtf8(lightdm_user_get_name(ldmUser));
-            user.homeDirectory = QString::fromUtf8(lightdm_user_get_home_directory(ldmUser));
-            user.realName = QString::fromUtf8(lightdm_user_get_real_name(ldmUser));
-            user.image = QString::fromUtf8(lightdm_user_get_image(ldmUser));
-            user.background = QString::fromUtf8(lightdm_user_get_background(ldmUser));
-            user.session = QString::fromUtf8(lightdm_user_get_session(ldmUser));
-            user.isLoggedIn = lightdm_user_get_logged_in(ldmUser);
-            user.hasMessages = lightdm_user_get_has_messages(ldmUser);
-            user.uid = (quint64)lightdm_user_get_uid(ldmUser);
-            user.isLocked = lightdm_user_get_is_locked(ldmUser);
+        users.reserve(rowCount);
+        states.reserve(rowCount);
+        rows.reserve(rowCount);
+        GList *items = lightdm_user_list_get_users_range(lightdm_user_list_get_instance(), 0, rowCount);
+        for (GList *item = items; item; item = item->next) {
+            LightDMUser *user = static_cast<LightDMUser*>(g_object_ref(item->data));
+            rows.insert(user, users.size());
             users.append(user);
+            states.append(getState(user));
         }
+        g_list_free(items);
 
         q->endInsertRows();
     }
@@ -118,22 +310,17 @@ void UsersModelPrivate::cb_userAdded(LightDMUserList *user_list, LightDMUser *ld
     Q_UNUSED(user_list)
     UsersModelPrivate *that = static_cast<UsersModelPrivate*>(data);
 
-    that->q_func()->beginInsertRows(QModelIndex(), that->users.size(), that->users.size());
+    if (that->rows.contains(ldmUser))
+        return;
 
-    UserItem user;
-    user.name = QString::fromUtf8(lightdm_user_get_name(ldmUser));
-    user.homeDirectory = QString::fromUtf8(lightdm_user_get_home_directory(ldmUser));
-    user.realName = QString::fromUtf8(lightdm_user_get_real_name(ldmUser));
-    user.image = QString::fromUtf8(lightdm_user_get_image(ldmUser));
-    user.background = QString::fromUtf8(lightdm_user_get_background(ldmUser));
-    user.isLoggedIn = lightdm_user_get_logged_in(ldmUser);
-    user.hasMessages = lightdm_user_get_has_messages(ldmUser);
-    user.uid = (quint64)lightdm_user_get_uid(ldmUser);
-    user.isLocked = lightdm_user_get_is_locked(ldmUser);
-    that->users.append(user);
+    UserState state = getState(ldmUser);
+    int row = that->findRow(state.displayName());
 
+    that->q_func()->beginInsertRows(QModelIndex(), row, row);
+    that->users.insert(row, static_cast<LightDMUser*>(g_object_ref(ldmUser)));
+    that->states.insert(row, state);
+    that->updateRows(row, that->users.size() - 1);
     that->q_func()->endInsertRows();
-
 }
 
 void UsersModelPrivate::cb_userChanged(LightDMUserList *user_list, LightDMUser *ldmUser, gpointer data)
@@ -141,25 +328,69 @@ void UsersModelPrivate::cb_userChanged(LightDMUserList *user_list, LightDMUser *
     Q_UNUSED(user_list)
     UsersModelPrivate *that = static_cast<UsersModelPrivate*>(data);
 
-    QString userToChange = QString::fromUtf8(lightdm_user_get_name(ldmUser));
-
-    for (int i=0;i<that->users.size();i++) {
-        if (that->users[i].name == userToChange) {
+    int i = that->rows.value(ldmUser, -1);
+    if (i < 0)
+        return;
 
-            that->users[i].homeDirectory = QString::fromUtf8(lightdm_user_get_home_directory(ldmUser));
-            that->users[i].realName = QString::fromUtf8(lightdm_user_get_real_name(ldmUser));
-            that->users[i].image = QString::fromUtf8(lightdm_user_get_image(ldmUser));
-            that->users[i].background = QString::fromUtf8(lightdm_user_get_background(ldmUser));
-            that->users[i].isLoggedIn = lightdm_user_get_logged_in(ldmUser);
-            that->users[i].hasMessages = lightdm_user_get_has_messages(ldmUser);
-            that->users[i].uid = (quint64)lightdm_user_get_uid(ldmUser);
-            that->users[i].isLocked = lightdm_user_get_is_locked(ldmUser);
+    UserState state = getState(ldmUser);
+    const UserState &old = that->states[i];
+
+    /* Only report the roles that changed so views don't redraw the whole row */
+    QVector<int> roles;
+    if (state.displayName() != old.displayName())
+        roles << Qt::DisplayRole;
+    if (state.name != old.name)
+        roles << UsersModel::NameRole;
+    if (state.realName != old.realName)
+        roles << UsersModel::RealNameRole;
+    if (state.session != old.session)
+        roles << UsersModel::SessionRole;
+    if (state.image != old.image)
+        roles << Qt::DecorationRole << UsersModel::ImagePathRole << UsersModel::ThumbnailRole;
+    else if (!state.image.isEmpty()) {
+        /* AccountsService replaces images in place, so check if the file changed */
+        QString path = QString::fromUtf8(state.image);
+        QDateTime mtime = QFileInfo(path).lastModified();
+        if (mtime != old.imageMTime) {
+            that->thumbnails.remove(path);
+            roles << Qt::DecorationRole << UsersModel::ThumbnailRole;
+        }
+    }
+    if (state.background != old.background)
+        roles << UsersModel::BackgroundRole << UsersModel::BackgroundPathRole << UsersModel::BackgroundImageRole;
+    if (state.loggedIn != old.loggedIn)
+        roles << UsersModel::LoggedInRole;
+    if (state.hasMessages != old.hasMessages)
+        roles << UsersModel::HasMessagesRole;
+    if (state.isLocked != old.isLocked)
+        roles << UsersModel::IsLockedRole;
+    if (state.uid != old.uid)
+        roles << UsersModel::UidRole;
+    if (roles.isEmpty())
+        return;
 
-            QModelIndex index = that->q_ptr->createIndex(i, 0);
-            that->q_ptr->dataChanged(index, index);
-            break;
+    bool displayNameChanged = roles.contains(Qt::DisplayRole);
+    that->states[i] = state;
+
+    /* Keep the list sorted if the display name changed */
+    if (displayNameChanged) {
+        int row = that->findRow(state.displayName(), i);
+        if (row != i) {
+            that->q_ptr->beginMoveRows(QModelIndex(), i, i, QModelIndex(), row > i ? row + 1 : row);
+            that->users.move(i, row);
+            that->states.move(i, row);
+            that->updateRows(qMin(i, row), qMax(i, row));
+            that->q_ptr->endMoveRows();
+            i = row;
         }
     }
+
+    QModelIndex index = that->q_ptr->createIndex(i, 0);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    that->q_ptr->dataChanged(index, index, roles);
+#else
+    that->q_ptr->dataChanged(index, index);
+#endif
 }
 
 
@@ -168,15 +399,14 @@ void UsersModelPrivate::cb_userRemoved(LightDMUserList *user_list, LightDMUser *
     Q_UNUSED(user_list)
 
     UsersModelPrivate *that = static_cast<UsersModelPrivate*>(data);
-    QString userToRemove = QString::fromUtf8(lightdm_user_get_name(ldmUser));
-
-    for (int i=0;i<that->users.size();i++) {
-        if (that->users[i].name == userToRemove) {
-            that->q_ptr->beginRemoveRows(QModelIndex(), i, i);
-            that->users.removeAt(i);
-            that->q_ptr->endRemoveRows();
-            break;
-        }
+    int i = that->rows.value(ldmUser, -1);
+    if (i >= 0) {
+        that->q_ptr->beginRemoveRows(QModelIndex(), i, i);
+        that->rows.remove(ldmUser);
+        that->states.removeAt(i);
+        g_object_unref(that->users.takeAt(i));
+        that->updateRows(i, that->users.size() - 1);
+        that->q_ptr->endRemoveRows();
     }
 }
 
@@ -209,6 +439,8 @@ QHash<int, QByteArray> UsersModel::roleNames() const
     roles[ImagePathRole] = "imagePath";
     roles[UidRole] = "uid";
     roles[IsLockedRole] = "isLocked";
+    roles[ThumbnailRole] = "thumbnail";
+    roles[BackgroundImageRole] = "backgroundImage";
 
     return roles;
 }
@@ -231,32 +463,41 @@ QVariant UsersModel::data(const QModelIndex &index, int role) const
         return QVariant();
     }
 
-    int row = index.row();
+    LightDMUser *user = d->users[index.row()];
     switch (role) {
-    case Qt::DisplayRole:
-        return d->users[row].displayName();
+    case Qt::DisplayRole: {
+        const gchar *realName = lightdm_user_get_real_name(user);
+        if (realName && realName[0] != '\0') {
+            return QString::fromUtf8(realName);
+        }
+        return QString::fromUtf8(lightdm_user_get_name(user));
+    }
     case Qt::DecorationRole:
-        return QIcon(d->users[row].image);
+        return QIcon(QString::fromUtf8(lightdm_user_get_image(user)));
     case UsersModel::NameRole:
-        return d->users[row].name;
+        return QString::fromUtf8(lightdm_user_get_name(user));
     case UsersModel::RealNameRole:
-        return d->users[row].realName;
+        return QString::fromUtf8(lightdm_user_get_real_name(user));
     case UsersModel::SessionRole:
-        return d->users[row].session;
+        return QString::fromUtf8(lightdm_user_get_session(user));
     case UsersModel::LoggedInRole:
-        return d->users[row].isLoggedIn;
+        return (bool)lightdm_user_get_logged_in(user);
     case UsersModel::BackgroundRole:
-        return QPixmap(d->users[row].background);
+        return QPixmap(QString::fromUtf8(lightdm_user_get_background(user)));
     case UsersModel::BackgroundPathRole:
-        return d->users[row].background;
+        return QString::fromUtf8(lightdm_user_get_background(user));
     case UsersModel::HasMessagesRole:
-        return d->users[row].hasMessages;
+        return (bool)lightdm_user_get_has_messages(user);
     case UsersModel::ImagePathRole:
-        return d->users[row].image;
+        return QString::fromUtf8(lightdm_user_get_image(user));
     case UsersModel::UidRole:
-        return d->users[row].uid;
+        return (quint64)lightdm_user_get_uid(user);
     case UsersModel::IsLockedRole:
-        return d->users[row].isLocked;
+        return (bool)lightdm_user_get_is_locked(user);
+    case UsersModel::ThumbnailRole:
+        return const_cast<UsersModelPrivate*>(d)->getImage(QString::fromUtf8(lightdm_user_get_image(user)), true);
+    case UsersModel::BackgroundImageRole:
+        return const_cast<UsersModelPrivate*>(d)->getImage(QString::fromUtf8(lightdm_user_get_background(user)), false);
     }
 
     return QVariant();
@@ -113,6 +113,14 @@ user_set_xsession (User *user, const gchar *xsession)
     common_user_set_session (priv->common_user, xsession);
 }
 
+void
+user_save_changes (User *user)
+{
+    UserPrivate *priv = user_get_instance_private (user);
+    g_return_if_fail (user != NULL);
+    common_user_save_changes (priv->common_user);
+}
+
 const gchar *
 user_get_xsession (User *user)
 {
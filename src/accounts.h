@@ -53,6 +53,8 @@ const gchar *user_get_xsession (User *user);
 
 void user_set_xsession (User *user, const gchar *session);
 
+void user_save_changes (User *user);
+
 const gchar *user_get_language (User *user);
 
 void user_set_language (User *user, const gchar *language);
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+
+#include "bitmap.h"
+
+#define BITS_PER_WORD 32
+
+gboolean
+bitmap_get (const Bitmap *bitmap, guint number)
+{
+    guint word = number / BITS_PER_WORD;
+    if (word >= bitmap->n_words)
+        return FALSE;
+
+    return (bitmap->words[word] & (1u << (number % BITS_PER_WORD))) != 0;
+}
+
+void
+bitmap_set (Bitmap *bitmap, guint number)
+{
+    guint word = number / BITS_PER_WORD;
+    if (word >= bitmap->n_words)
+    {
+        guint n_words = MAX (bitmap->n_words * 2, word + 1);
+        bitmap->words = g_renew (guint32, bitmap->words, n_words);
+        memset (bitmap->words + bitmap->n_words, 0, (n_words - bitmap->n_words) * sizeof (guint32));
+        bitmap->n_words = n_words;
+    }
+
+    bitmap->words[word] |= 1u << (number % BITS_PER_WORD);
+    if (number == bitmap->hint)
+        bitmap->hint = bitmap_find_unset (bitmap, number + 1);
+}
+
+void
+bitmap_clear (Bitmap *bitmap, guint number)
+{
+    guint word = number / BITS_PER_WORD;
+    if (word >= bitmap->n_words)
+        return;
+
+    bitmap->words[word] &= ~(1u << (number % BITS_PER_WORD));
+    if (number < bitmap->hint)
+        bitmap->hint = number;
+}
+
+/* Get the lowest number >= start that is not set */
+guint
+bitmap_find_unset (const Bitmap *bitmap, guint start)
+{
+    /* Everything below the hint is known to be set */
+    guint number = MAX (start, bitmap->hint);
+
+    /* Check the remainder of this word, then skip over full words */
+    guint word = number / BITS_PER_WORD;
+    while (word < bitmap->n_words)
+    {
+        guint32 free_bits = ~bitmap->words[word];
+        if (number > word * BITS_PER_WORD)
+            free_bits &= ~0u << (number % BITS_PER_WORD);
+        if (free_bits != 0)
+            return word * BITS_PER_WORD + g_bit_nth_lsf (free_bits, -1);
+        word++;
+        number = word * BITS_PER_WORD;
+    }
+
+    return number;
+}
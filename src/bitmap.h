@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef BITMAP_H_
+#define BITMAP_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Set of small non-negative numbers, used for allocating display numbers and VTs */
+typedef struct
+{
+    /* Bits, grown as required */
+    guint32 *words;
+    guint n_words;
+
+    /* All numbers below this are set */
+    guint hint;
+} Bitmap;
+
+gboolean bitmap_get (const Bitmap *bitmap, guint number);
+
+void bitmap_set (Bitmap *bitmap, guint number);
+
+void bitmap_clear (Bitmap *bitmap, guint number);
+
+guint bitmap_find_unset (const Bitmap *bitmap, guint start);
+
+G_END_DECLS
+
+#endif /* BITMAP_H_ */
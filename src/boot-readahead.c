@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "boot-readahead.h"
+#include "configuration.h"
+#include "worker.h"
+
+/*
+ * Starting the first greeter reads the X server, the greeter and the
+ * libraries, fonts and themes they use from disk. On slow disks this is most
+ * of the time taken to get to a greeter, while the disk is mostly idle during
+ * the boot splash before it. The files the X server and greeter have mapped
+ * or open once the greeter connects are recorded in the cache directory, and on the
+ * next start they are read ahead in the background before any seat starts.
+ */
+
+/* File in the cache directory the files to read are recorded in */
+#define READAHEAD_FILE "boot-readahead"
+
+/* Most files recorded, to bound the amount read ahead */
+#define MAX_FILES 4096
+
+/* TRUE once files have been recorded this run */
+static gboolean recorded = FALSE;
+
+typedef struct
+{
+    /* Processes to record the files of, their children are also recorded */
+    GArray *pids;
+
+    /* Other files to record */
+    GStrv paths;
+
+    /* File to write the list to */
+    gchar *filename;
+} Recording;
+
+static gchar *
+get_readahead_filename (void)
+{
+    g_autofree gchar *cache_dir = config_get_string (config_get_instance (), "LightDM", "cache-directory");
+    return g_build_filename (cache_dir, READAHEAD_FILE, NULL);
+}
+
+static gboolean
+readahead_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    const gchar *filename = data;
+
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (filename, &contents, NULL, NULL))
+        return TRUE;
+
+    g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+    int n_files = 0;
+    for (int i = 0; lines[i] && n_files < MAX_FILES; i++)
+    {
+        if (lines[i][0] != '/')
+            continue;
+
+        int fd = open (lines[i], O_RDONLY | O_CLOEXEC | O_NOCTTY);
+        if (fd < 0)
+            continue;
+        posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+        close (fd);
+        n_files++;
+    }
+
+    return TRUE;
+}
+
+static void
+readahead_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    worker_run_finish (result, NULL);
+}
+
+/* Read ahead the files recorded on the last start */
+void
+boot_readahead_start (void)
+{
+    g_autofree gchar *filename = get_readahead_filename ();
+    if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+        return;
+
+    g_debug ("Reading ahead files listed in %s", filename);
+    worker_run (readahead_thread, g_steal_pointer (&filename), g_free, NULL, readahead_cb, NULL);
+}
+
+static void
+recording_free (Recording *recording)
+{
+    g_array_unref (recording->pids);
+    g_strfreev (recording->paths);
+    g_free (recording->filename);
+    g_free (recording);
+}
+
+/* Add the children of the processes, as the greeter is run by the session child */
+static void
+add_child_processes (GArray *pids)
+{
+    g_autoptr(GDir) dir = g_dir_open ("/proc", 0, NULL);
+    if (!dir)
+        return;
+
+    g_autoptr(GHashTable) parents = g_hash_table_new (g_direct_hash, g_direct_equal);
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        if (!g_ascii_isdigit (name[0]))
+            continue;
+
+        g_autofree gchar *stat_path = g_build_filename ("/proc", name, "stat", NULL);
+        g_autofree gchar *stat = NULL;
+        if (!g_file_get_contents (stat_path, &stat, NULL, NULL))
+            continue;
+
+        /* The command name can contain spaces, the fields after it don't */
+        const gchar *fields = strrchr (stat, ')');
+        char state;
+        int ppid;
+        if (!fields || sscanf (fields, ") %c %d", &state, &ppid) != 2)
+            continue;
+        g_hash_table_insert (parents, GINT_TO_POINTER (atoi (name)), GINT_TO_POINTER (ppid));
+    }
+
+    /* Processes are only a few levels deep, so repeat until no more are found */
+    gboolean changed = TRUE;
+    while (changed)
+    {
+        changed = FALSE;
+
+        GHashTableIter iter;
+        g_hash_table_iter_init (&iter, parents);
+        gpointer key, value;
+        while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+            for (guint i = 0; i < pids->len; i++)
+            {
+                if (g_array_index (pids, GPid, i) == GPOINTER_TO_INT (value))
+                {
+                    GPid pid = GPOINTER_TO_INT (key);
+                    g_array_append_val (pids, pid);
+                    g_hash_table_iter_remove (&iter);
+                    changed = TRUE;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void
+add_file (GHashTable *files, GPtrArray *order, const gchar *path)
+{
+    if (path[0] != '/' ||
+        g_str_has_prefix (path, "/dev/") ||
+        g_str_has_prefix (path, "/proc/") ||
+        g_str_has_prefix (path, "/sys/") ||
+        g_str_has_prefix (path, "/memfd:") ||
+        g_str_has_suffix (path, " (deleted)") ||
+        g_hash_table_contains (files, path) ||
+        order->len >= MAX_FILES)
+        return;
+
+    gchar *p = g_strdup (path);
+    g_hash_table_add (files, p);
+    g_ptr_array_add (order, p);
+}
+
+/* Add the files a process has mapped, which are its program, libraries and any mapped data files,
+ * and the files it has open */
+static void
+add_process_files (GHashTable *files, GPtrArray *order, GPid pid)
+{
+    g_autofree gchar *maps_path = g_strdup_printf ("/proc/%d/maps", pid);
+    g_autofree gchar *maps = NULL;
+    if (!g_file_get_contents (maps_path, &maps, NULL, NULL))
+        return;
+
+    g_auto(GStrv) lines = g_strsplit (maps, "\n", -1);
+    for (int i = 0; lines[i]; i++)
+    {
+        /* The path is the sixth field and may contain spaces */
+        const gchar *path = strchr (lines[i], '/');
+        if (path)
+            add_file (files, order, path);
+    }
+
+    g_autofree gchar *fd_path = g_strdup_printf ("/proc/%d/fd", pid);
+    g_autoptr(GDir) dir = g_dir_open (fd_path, 0, NULL);
+    if (!dir)
+        return;
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        g_autofree gchar *link_path = g_build_filename (fd_path, name, NULL);
+        g_autofree gchar *path = g_file_read_link (link_path, NULL);
+        if (path && g_file_test (path, G_FILE_TEST_IS_REGULAR))
+            add_file (files, order, path);
+    }
+}
+
+static gboolean
+record_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    Recording *recording = data;
+
+    add_child_processes (recording->pids);
+
+    /* Keep the order files were found in, the programs come before their libraries */
+    g_autoptr(GHashTable) files = g_hash_table_new (g_str_hash, g_str_equal);
+    g_autoptr(GPtrArray) order = g_ptr_array_new_with_free_func (g_free);
+    for (int i = 0; recording->paths && recording->paths[i]; i++)
+        add_file (files, order, recording->paths[i]);
+    for (guint i = 0; i < recording->pids->len; i++)
+        add_process_files (files, order, g_array_index (recording->pids, GPid, i));
+
+    g_autoptr(GString) contents = g_string_new ("");
+    for (guint i = 0; i < order->len; i++)
+        g_string_append_printf (contents, "%s\n", (const gchar *) order->pdata[i]);
+
+    return g_file_set_contents (recording->filename, contents->str, contents->len, error);
+}
+
+static void
+record_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    if (!worker_run_finish (result, &error))
+        g_warning ("Failed to record files to read ahead: %s", error->message);
+}
+
+/* Record the files used by the processes showing the first greeter, to read ahead on the next start */
+void
+boot_readahead_record (const GPid *pids, gsize n_pids, const gchar * const *paths)
+{
+    if (recorded)
+        return;
+    recorded = TRUE;
+
+    Recording *recording = g_new0 (Recording, 1);
+    recording->pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+    for (gsize i = 0; i < n_pids; i++)
+        if (pids[i] > 0)
+            g_array_append_val (recording->pids, pids[i]);
+    recording->paths = g_strdupv ((gchar **) paths);
+    recording->filename = get_readahead_filename ();
+
+    g_debug ("Recording files to read ahead in %s", recording->filename);
+    worker_run (record_thread, recording, (GDestroyNotify) recording_free, NULL, record_cb, NULL);
+}
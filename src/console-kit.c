@@ -14,44 +14,97 @@
 
 #include "console-kit.h"
 
-gchar *
-ck_open_session (GVariantBuilder *parameters)
+/* Session object paths keyed by cookie */
+static GHashTable *session_paths = NULL;
+
+static GDBusConnection *
+get_bus (void)
 {
-    g_return_val_if_fail (parameters != NULL, NULL);
+    static GDBusConnection *bus = NULL;
+
+    if (bus)
+        return bus;
 
     g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+    bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
     if (error)
         g_warning ("Failed to get system bus: %s", error->message);
+
+    return bus;
+}
+
+void
+ck_open_session_async (GVariantBuilder *parameters, GAsyncReadyCallback callback, gpointer user_data)
+{
+    g_return_if_fail (parameters != NULL);
+
+    GDBusConnection *bus = get_bus ();
     if (!bus)
-        return NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
-                                                              "org.freedesktop.ConsoleKit",
-                                                              "/org/freedesktop/ConsoleKit/Manager",
-                                                              "org.freedesktop.ConsoleKit.Manager",
-                                                              "OpenSessionWithParameters",
-                                                              g_variant_new ("(a(sv))", parameters),
-                                                              G_VARIANT_TYPE ("(s)"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
+    {
+        g_autoptr(GTask) task = g_task_new (NULL, NULL, callback, user_data);
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED, "No system bus");
+        return;
+    }
+
+    g_dbus_connection_call (bus,
+                            "org.freedesktop.ConsoleKit",
+                            "/org/freedesktop/ConsoleKit/Manager",
+                            "org.freedesktop.ConsoleKit.Manager",
+                            "OpenSessionWithParameters",
+                            g_variant_new ("(a(sv))", parameters),
+                            G_VARIANT_TYPE ("(s)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            callback,
+                            user_data);
+}
+
+gchar *
+ck_open_session_finish (GAsyncResult *result)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) r = NULL;
+    if (G_IS_TASK (result))
+        g_task_propagate_pointer (G_TASK (result), &error);
+    else
+        r = g_dbus_connection_call_finish (get_bus (), result, &error);
 
     if (error)
         g_warning ("Failed to open CK session: %s", error->message);
-    if (!result)
+    if (!r)
         return NULL;
 
     g_autofree gchar *cookie = NULL;
-    g_variant_get (result, "(s)", &cookie);
+    g_variant_get (r, "(s)", &cookie);
     g_debug ("Opened ConsoleKit session %s", cookie);
 
     return g_steal_pointer (&cookie);
 }
 
+static const gchar *
+lookup_ck_session (const gchar *cookie)
+{
+    if (!session_paths)
+        return NULL;
+    return g_hash_table_lookup (session_paths, cookie);
+}
+
+static void
+cache_ck_session (const gchar *cookie, const gchar *session_path)
+{
+    if (!session_paths)
+        session_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    g_hash_table_insert (session_paths, g_strdup (cookie), g_strdup (session_path));
+}
+
 static gchar *
 get_ck_session (GDBusConnection *bus, const gchar *cookie)
 {
+    const gchar *cached_path = lookup_ck_session (cookie);
+    if (cached_path)
+        return g_strdup (cached_path);
+
     g_autoptr(GError) error = NULL;
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
                                                               "org.freedesktop.ConsoleKit",
@@ -71,41 +124,119 @@ get_ck_session (GDBusConnection *bus, const gchar *cookie)
 
     g_autofree gchar *session_path = NULL;
     g_variant_get (result, "(o)", &session_path);
+    cache_ck_session (cookie, session_path);
 
     return g_steal_pointer (&session_path);
 }
 
-void
-ck_lock_session (const gchar *cookie)
+typedef struct
 {
-    g_return_if_fail (cookie != NULL);
+    gchar *cookie;
+    gchar *method;
+    const gchar *description;
+} SessionCall;
 
-    g_debug ("Locking ConsoleKit session %s", cookie);
+static void
+session_call_free (SessionCall *call)
+{
+    g_free (call->cookie);
+    g_free (call->method);
+    g_free (call);
+}
+
+static void
+session_method_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    SessionCall *call = data;
 
     g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
     if (error)
-        g_warning ("Failed to get system bus: %s", error->message);
+        g_warning ("Error %s ConsoleKit session: %s", call->description, error->message);
+
+    session_call_free (call);
+}
+
+static void
+call_session_method (GDBusConnection *bus, const gchar *session_path, SessionCall *call)
+{
+    g_dbus_connection_call (bus,
+                            "org.freedesktop.ConsoleKit",
+                            session_path,
+                            "org.freedesktop.ConsoleKit.Session",
+                            call->method,
+                            g_variant_new ("()"),
+                            G_VARIANT_TYPE ("()"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            session_method_cb,
+                            call);
+}
+
+static void
+get_session_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    SessionCall *call = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (error)
+        g_warning ("Error getting ConsoleKit session: %s", error->message);
+    if (!result)
+    {
+        session_call_free (call);
+        return;
+    }
+
+    const gchar *session_path;
+    g_variant_get (result, "(&o)", &session_path);
+    cache_ck_session (call->cookie, session_path);
+    call_session_method (G_DBUS_CONNECTION (object), session_path, call);
+}
+
+/* Call a method on a session without waiting for the result, looking up the session first if we haven't already */
+static void
+session_method (const gchar *cookie, const gchar *method, const gchar *description)
+{
+    GDBusConnection *bus = get_bus ();
     if (!bus)
         return;
 
-    g_autofree gchar *session_path = get_ck_session (bus, cookie);
-    if (!session_path)
+    SessionCall *call = g_new0 (SessionCall, 1);
+    call->cookie = g_strdup (cookie);
+    call->method = g_strdup (method);
+    call->description = description;
+
+    const gchar *session_path = lookup_ck_session (cookie);
+    if (session_path)
+    {
+        call_session_method (bus, session_path, call);
         return;
+    }
+
+    g_dbus_connection_call (bus,
+                            "org.freedesktop.ConsoleKit",
+                            "/org/freedesktop/ConsoleKit/Manager",
+                            "org.freedesktop.ConsoleKit.Manager",
+                            "GetSessionForCookie",
+                            g_variant_new ("(s)", cookie),
+                            G_VARIANT_TYPE ("(o)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            get_session_cb,
+                            call);
+}
 
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
-                                                              "org.freedesktop.ConsoleKit",
-                                                              session_path,
-                                                              "org.freedesktop.ConsoleKit.Session",
-                                                              "Lock",
-                                                              g_variant_new ("()"),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error locking ConsoleKit session: %s", error->message);
+void
+ck_lock_session (const gchar *cookie)
+{
+    g_return_if_fail (cookie != NULL);
+
+    g_debug ("Locking ConsoleKit session %s", cookie);
+
+    session_method (cookie, "Lock", "locking");
 }
 
 void
@@ -115,30 +246,7 @@ ck_unlock_session (const gchar *cookie)
 
     g_debug ("Unlocking ConsoleKit session %s", cookie);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-    if (error)
-        g_warning ("Failed to get system bus: %s", error->message);
-    if (!bus)
-        return;
-
-    g_autofree gchar *session_path = get_ck_session (bus, cookie);
-    if (!session_path)
-        return;
-
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
-                                                              "org.freedesktop.ConsoleKit",
-                                                              session_path,
-                                                              "org.freedesktop.ConsoleKit.Session",
-                                                              "Unlock",
-                                                              g_variant_new ("()"),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error unlocking ConsoleKit session: %s", error->message);
+    session_method (cookie, "Unlock", "unlocking");
 }
 
 void
@@ -148,30 +256,7 @@ ck_activate_session (const gchar *cookie)
 
     g_debug ("Activating ConsoleKit session %s", cookie);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-    if (error)
-        g_warning ("Failed to get system bus: %s", error->message);
-    if (!bus)
-        return;
-
-    g_autofree gchar *session_path = get_ck_session (bus, cookie);
-    if (!session_path)
-        return;
-
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
-                                                              "org.freedesktop.ConsoleKit",
-                                                              session_path,
-                                                              "org.freedesktop.ConsoleKit.Session",
-                                                              "Activate",
-                                                              g_variant_new ("()"),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error activating ConsoleKit session: %s", error->message);
+    session_method (cookie, "Activate", "activating");
 }
 
 void
@@ -181,12 +266,14 @@ ck_close_session (const gchar *cookie)
 
     g_debug ("Ending ConsoleKit session %s", cookie);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-    if (error)
-        g_warning ("Failed to get system bus: %s", error->message);
+    if (session_paths)
+        g_hash_table_remove (session_paths, cookie);
+
+    GDBusConnection *bus = get_bus ();
     if (!bus)
         return;
+
+    g_autoptr(GError) error = NULL;
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
                                                               "org.freedesktop.ConsoleKit",
                                                               "/org/freedesktop/ConsoleKit/Manager",
@@ -217,10 +304,7 @@ ck_get_xdg_runtime_dir (const gchar *cookie)
 
     g_debug ("Getting XDG_RUNTIME_DIR from ConsoleKit for session %s", cookie);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-    if (error)
-        g_warning ("Failed to get system bus: %s", error->message);
+    GDBusConnection *bus = get_bus ();
     if (!bus)
         return NULL;
 
@@ -228,6 +312,8 @@ ck_get_xdg_runtime_dir (const gchar *cookie)
     if (!session_path)
         return NULL;
 
+    g_autoptr(GError) error = NULL;
+
     g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
                                                               "org.freedesktop.ConsoleKit",
                                                               session_path,
@@ -12,11 +12,13 @@
 #ifndef CONSOLE_KIT_H_
 #define CONSOLE_KIT_H_
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
-gchar *ck_open_session (GVariantBuilder *parameters);
+void ck_open_session_async (GVariantBuilder *parameters, GAsyncReadyCallback callback, gpointer user_data);
+
+gchar *ck_open_session_finish (GAsyncResult *result);
 
 void ck_lock_session (const gchar *cookie);
 
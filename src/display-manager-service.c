@@ -9,8 +9,17 @@
  */
 
 #include <config.h>
+#include <string.h>
 
 #include "display-manager-service.h"
+#include "greeter.h"
+#include "memory-usage.h"
+#include "watchdog.h"
+#include "vnc-server.h"
+#include "xdmcp-server.h"
+#include "trace.h"
+#include "resource-usage.h"
+#include "user-list.h"
 
 enum {
     READY,
@@ -34,6 +43,12 @@ typedef struct
     /* Handle for display manager D-Bus object */
     guint reg_id;
 
+    /* Handle for statistics D-Bus interface */
+    guint statistics_reg_id;
+
+    /* Handle for object manager D-Bus interface */
+    guint object_manager_reg_id;
+
     /* D-Bus interface information */
     GDBusNodeInfo *seat_info;
     GDBusNodeInfo *session_info;
@@ -45,6 +60,17 @@ typedef struct
     /* Bus entries for seats / session */
     GHashTable *seat_bus_entries;
     GHashTable *session_bus_entries;
+
+    /* Session entries in the order they were added */
+    GPtrArray *sessions;
+
+    /* Cached values of the Seats and Sessions properties or NULL if they need rebuilding */
+    GVariant *seat_list;
+    GVariant *session_list;
+
+    /* Property changes waiting to be signalled */
+    GPtrArray *pending_changes;
+    guint pending_changes_idle;
 } DisplayManagerServicePrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (DisplayManagerService, display_manager_service, G_TYPE_OBJECT)
@@ -55,6 +81,10 @@ typedef struct
     Seat *seat;
     gchar *path;
     guint bus_id;
+    GPtrArray *sessions;
+    GVariant *session_list;
+    /* Switch requests waiting for their session to become active */
+    GList *pending_switches;
 } SeatBusEntry;
 typedef struct
 {
@@ -64,9 +94,36 @@ typedef struct
     gchar *seat_path;
     guint bus_id;
 } SessionBusEntry;
+typedef struct
+{
+    gchar *path;
+    gchar *interface_name;
+    GVariantDict properties;
+} PropertiesChange;
+
+typedef enum
+{
+    SWITCH_TARGET_GREETER,
+    SWITCH_TARGET_USER,
+    SWITCH_TARGET_GUEST
+} SwitchTarget;
+
+/* A switch request that is replied to once the session it asked for is active */
+typedef struct
+{
+    SeatBusEntry *seat_entry;
+    GDBusMethodInvocation *invocation;
+    SwitchTarget target;
+    gchar *username;
+    gint64 start_time;
+    guint timeout_id;
+} PendingSwitch;
 
 #define LIGHTDM_BUS_NAME "org.freedesktop.DisplayManager"
 
+/* Time to wait for a switch if the caller doesn't give one */
+#define DEFAULT_SWITCH_TIMEOUT_MS 30000
+
 DisplayManagerService *
 display_manager_service_new (DisplayManager *manager)
 {
@@ -85,6 +142,7 @@ seat_bus_entry_new (DisplayManagerService *service, Seat *seat, const gchar *pat
     entry->service = service;
     entry->seat = seat;
     entry->path = g_strdup (path);
+    entry->sessions = g_ptr_array_new ();
 
     return entry;
 }
@@ -102,28 +160,130 @@ session_bus_entry_new (DisplayManagerService *service, Session *session, const g
 }
 
 static void
-emit_object_value_changed (GDBusConnection *bus, const gchar *path, const gchar *interface_name, const gchar *property_name, GVariant *property_value)
+properties_change_free (gpointer data)
 {
-    GVariantBuilder builder;
-    g_variant_builder_init (&builder, G_VARIANT_TYPE_ARRAY);
-    g_variant_builder_add (&builder, "{sv}", property_name, property_value);
+    PropertiesChange *change = data;
+
+    g_free (change->path);
+    g_free (change->interface_name);
+    g_variant_dict_clear (&change->properties);
+    g_free (change);
+}
+
+static void
+emit_properties_changed (DisplayManagerService *service, PropertiesChange *change)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
     g_autoptr(GError) error = NULL;
-    if (!g_dbus_connection_emit_signal (bus,
+    if (!g_dbus_connection_emit_signal (priv->bus,
                                         NULL,
-                                        path,
+                                        change->path,
                                         "org.freedesktop.DBus.Properties",
                                         "PropertiesChanged",
-                                        g_variant_new ("(sa{sv}as)", interface_name, &builder, NULL),
+                                        g_variant_new ("(s@a{sv}as)", change->interface_name, g_variant_dict_end (&change->properties), NULL),
                                         &error))
         g_warning ("Failed to emit PropertiesChanged signal: %s", error->message);
 }
 
+/* Signal changes to an object now, so they are seen before other signals from that object */
 static void
-emit_object_signal (GDBusConnection *bus, const gchar *path, const gchar *signal_name, const gchar *object_path)
+flush_object_value_changes (DisplayManagerService *service, const gchar *path)
 {
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    for (guint i = 0; i < priv->pending_changes->len; )
+    {
+        PropertiesChange *change = g_ptr_array_index (priv->pending_changes, i);
+        if (strcmp (change->path, path) == 0)
+        {
+            emit_properties_changed (service, change);
+            g_ptr_array_remove_index (priv->pending_changes, i);
+        }
+        else
+            i++;
+    }
+}
+
+static gboolean
+pending_changes_cb (gpointer data)
+{
+    DisplayManagerService *service = data;
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    priv->pending_changes_idle = 0;
+
+    g_autoptr(GPtrArray) changes = priv->pending_changes;
+    priv->pending_changes = g_ptr_array_new_with_free_func (properties_change_free);
+    for (guint i = 0; i < changes->len; i++)
+        emit_properties_changed (service, g_ptr_array_index (changes, i));
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Queue a PropertiesChanged signal, changes to the same object in one main loop iteration are sent together */
+static void
+emit_object_value_changed (DisplayManagerService *service, const gchar *path, const gchar *interface_name, const gchar *property_name, GVariant *property_value)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    /* Nothing to tell until the objects are on the bus */
+    if (!priv->bus)
+    {
+        g_variant_unref (g_variant_ref_sink (property_value));
+        return;
+    }
+
+    PropertiesChange *change = NULL;
+    for (guint i = 0; i < priv->pending_changes->len && change == NULL; i++)
+    {
+        PropertiesChange *c = g_ptr_array_index (priv->pending_changes, i);
+        if (strcmp (c->path, path) == 0 && strcmp (c->interface_name, interface_name) == 0)
+            change = c;
+    }
+    if (!change)
+    {
+        change = g_malloc0 (sizeof (PropertiesChange));
+        change->path = g_strdup (path);
+        change->interface_name = g_strdup (interface_name);
+        g_variant_dict_init (&change->properties, NULL);
+        g_ptr_array_add (priv->pending_changes, change);
+    }
+    g_variant_dict_insert_value (&change->properties, property_name, property_value);
+    g_variant_unref (property_value);
+
+    if (priv->pending_changes_idle == 0)
+        priv->pending_changes_idle = g_idle_add_full (G_PRIORITY_DEFAULT, pending_changes_cb, service, NULL);
+}
+
+/* Drop changes to an object that is going away */
+static void
+discard_object_value_changes (DisplayManagerService *service, const gchar *path)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    for (guint i = 0; i < priv->pending_changes->len; )
+    {
+        PropertiesChange *change = g_ptr_array_index (priv->pending_changes, i);
+        if (strcmp (change->path, path) == 0)
+            g_ptr_array_remove_index (priv->pending_changes, i);
+        else
+            i++;
+    }
+}
+
+static void
+emit_object_signal (DisplayManagerService *service, const gchar *path, const gchar *signal_name, const gchar *object_path)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    if (!priv->bus)
+        return;
+
+    flush_object_value_changes (service, path);
+
     g_autoptr(GError) error = NULL;
-    if (!g_dbus_connection_emit_signal (bus,
+    if (!g_dbus_connection_emit_signal (priv->bus,
                                         NULL,
                                         path,
                                         "org.freedesktop.DisplayManager",
@@ -133,12 +293,44 @@ emit_object_signal (GDBusConnection *bus, const gchar *path, const gchar *signal
         g_warning ("Failed to emit %s signal on %s: %s", signal_name, path, error->message);
 }
 
+static void
+pending_switch_free (PendingSwitch *pending)
+{
+    g_clear_handle_id (&pending->timeout_id, g_source_remove);
+    g_clear_object (&pending->invocation);
+    g_free (pending->username);
+    g_free (pending);
+}
+
+/* Reply to a switch request and forget it */
+static void
+pending_switch_complete (PendingSwitch *pending, GDBusError error_code, const gchar *error_message)
+{
+    SeatBusEntry *seat_entry = pending->seat_entry;
+    seat_entry->pending_switches = g_list_remove (seat_entry->pending_switches, pending);
+
+    if (error_message)
+        g_dbus_method_invocation_return_error_literal (g_steal_pointer (&pending->invocation), G_DBUS_ERROR, error_code, error_message);
+    else
+    {
+        guint64 duration = g_get_monotonic_time () - pending->start_time;
+        g_debug ("Switch on %s completed in %.3fs", seat_entry->path, duration / 1000000.0);
+        g_dbus_method_invocation_return_value (g_steal_pointer (&pending->invocation), g_variant_new ("(t)", duration));
+    }
+    pending_switch_free (pending);
+}
+
 static void
 seat_bus_entry_free (gpointer data)
 {
     SeatBusEntry *entry = data;
 
+    while (entry->pending_switches)
+        pending_switch_complete (entry->pending_switches->data, G_DBUS_ERROR_FAILED, "Seat removed");
     g_free (entry->path);
+    g_ptr_array_unref (entry->sessions);
+    if (entry->session_list)
+        g_variant_unref (entry->session_list);
     g_free (entry);
 }
 
@@ -157,37 +349,73 @@ get_seat_list (DisplayManagerService *service)
 {
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
-    GVariantBuilder builder;
-    g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
-
-    GHashTableIter iter;
-    g_hash_table_iter_init (&iter, priv->seat_bus_entries);
-    gpointer value;
-    while (g_hash_table_iter_next (&iter, NULL, &value))
+    if (!priv->seat_list)
     {
-        SeatBusEntry *entry = value;
-        g_variant_builder_add_value (&builder, g_variant_new_object_path (entry->path));
+        GVariantBuilder builder;
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+
+        GHashTableIter iter;
+        g_hash_table_iter_init (&iter, priv->seat_bus_entries);
+        gpointer value;
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+            SeatBusEntry *entry = value;
+            g_variant_builder_add_value (&builder, g_variant_new_object_path (entry->path));
+        }
+
+        priv->seat_list = g_variant_ref_sink (g_variant_builder_end (&builder));
     }
 
-    return g_variant_builder_end (&builder);
+    return g_variant_ref (priv->seat_list);
 }
 
+/* Get the sessions on a seat, or all sessions if seat_entry is NULL */
 static GVariant *
-get_session_list (DisplayManagerService *service, const gchar *seat_path)
+get_session_list (DisplayManagerService *service, SeatBusEntry *seat_entry)
 {
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
-    GVariantBuilder builder;
-    g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
-
-    GHashTableIter iter;
-    g_hash_table_iter_init (&iter, priv->session_bus_entries);
-    gpointer value;
-    while (g_hash_table_iter_next (&iter, NULL, &value))
+    GVariant **session_list = seat_entry ? &seat_entry->session_list : &priv->session_list;
+    if (!*session_list)
     {
-        SessionBusEntry *entry = value;
-        if (seat_path == NULL || g_strcmp0 (entry->seat_path, seat_path) == 0)
+        GPtrArray *sessions = seat_entry ? seat_entry->sessions : priv->sessions;
+
+        GVariantBuilder builder;
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+        for (guint i = 0; i < sessions->len; i++)
+        {
+            SessionBusEntry *entry = g_ptr_array_index (sessions, i);
             g_variant_builder_add_value (&builder, g_variant_new_object_path (entry->path));
+        }
+
+        *session_list = g_variant_ref_sink (g_variant_builder_end (&builder));
+    }
+
+    return g_variant_ref (*session_list);
+}
+
+static void
+clear_variant (GVariant **value)
+{
+    if (*value)
+        g_variant_unref (*value);
+    *value = NULL;
+}
+
+/* Get all the properties of an object's interface */
+static GVariant *
+get_interface_properties (GDBusInterfaceInfo *info, GDBusInterfaceGetPropertyFunc get_property, gpointer user_data)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+    for (gint i = 0; info->properties && info->properties[i]; i++)
+    {
+        g_autoptr(GVariant) value = get_property (NULL, NULL, NULL, info->name, info->properties[i]->name, NULL, user_data);
+        if (value)
+        {
+            g_variant_take_ref (value);
+            g_variant_builder_add (&builder, "{sv}", info->properties[i]->name, value);
+        }
     }
 
     return g_variant_builder_end (&builder);
@@ -212,6 +440,117 @@ handle_display_manager_get_property (GDBusConnection       *connection,
     return NULL;
 }
 
+static GVariant *handle_seat_get_property (GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                                           const gchar *interface_name, const gchar *property_name, GError **error, gpointer user_data);
+static GVariant *handle_session_get_property (GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                                              const gchar *interface_name, const gchar *property_name, GError **error, gpointer user_data);
+
+static GVariant *
+get_seat_interfaces (SeatBusEntry *entry)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (entry->service);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+    g_variant_builder_add (&builder, "{s@a{sv}}", priv->seat_info->interfaces[0]->name,
+                           get_interface_properties (priv->seat_info->interfaces[0], handle_seat_get_property, entry));
+
+    return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+get_session_interfaces (SessionBusEntry *entry)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (entry->service);
+
+    GVariantBuilder builder;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+    g_variant_builder_add (&builder, "{s@a{sv}}", priv->session_info->interfaces[0]->name,
+                           get_interface_properties (priv->session_info->interfaces[0], handle_session_get_property, entry));
+
+    return g_variant_builder_end (&builder);
+}
+
+static void
+emit_interfaces_added (DisplayManagerService *service, const gchar *path, GVariant *interfaces)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    if (!priv->bus)
+    {
+        g_variant_unref (g_variant_ref_sink (interfaces));
+        return;
+    }
+
+    g_autoptr(GError) error = NULL;
+    if (!g_dbus_connection_emit_signal (priv->bus,
+                                        NULL,
+                                        "/org/freedesktop/DisplayManager",
+                                        "org.freedesktop.DBus.ObjectManager",
+                                        "InterfacesAdded",
+                                        g_variant_new ("(o@a{sa{sv}})", path, interfaces),
+                                        &error))
+        g_warning ("Failed to emit InterfacesAdded signal: %s", error->message);
+}
+
+static void
+emit_interfaces_removed (DisplayManagerService *service, const gchar *path, const gchar *interface_name)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    if (!priv->bus)
+        return;
+
+    const gchar *interface_names[] = { interface_name, NULL };
+    g_autoptr(GError) error = NULL;
+    if (!g_dbus_connection_emit_signal (priv->bus,
+                                        NULL,
+                                        "/org/freedesktop/DisplayManager",
+                                        "org.freedesktop.DBus.ObjectManager",
+                                        "InterfacesRemoved",
+                                        g_variant_new ("(o^as)", path, interface_names),
+                                        &error))
+        g_warning ("Failed to emit InterfacesRemoved signal: %s", error->message);
+}
+
+static void
+handle_object_manager_call (GDBusConnection       *connection,
+                            const gchar           *sender,
+                            const gchar           *object_path,
+                            const gchar           *interface_name,
+                            const gchar           *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               user_data)
+{
+    DisplayManagerService *service = user_data;
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    if (g_strcmp0 (method_name, "GetManagedObjects") == 0)
+    {
+        GVariantBuilder builder;
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{oa{sa{sv}}}"));
+
+        GHashTableIter iter;
+        g_hash_table_iter_init (&iter, priv->seat_bus_entries);
+        gpointer value;
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+            SeatBusEntry *entry = value;
+            g_variant_builder_add (&builder, "{o@a{sa{sv}}}", entry->path, get_seat_interfaces (entry));
+        }
+        for (guint i = 0; i < priv->sessions->len; i++)
+        {
+            SessionBusEntry *entry = g_ptr_array_index (priv->sessions, i);
+            g_variant_builder_add (&builder, "{o@a{sa{sv}}}", entry->path, get_session_interfaces (entry));
+        }
+
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@a{oa{sa{sv}}})", g_variant_builder_end (&builder)));
+    }
+    else
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
+}
+
 static void
 handle_display_manager_call (GDBusConnection       *connection,
                              const gchar           *sender,
@@ -253,6 +592,89 @@ handle_display_manager_call (GDBusConnection       *connection,
         g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
 }
 
+/* Get a summary of all the statistics */
+static GVariant *
+get_statistics (DisplayManagerService *service)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    GVariantDict statistics;
+    g_variant_dict_init (&statistics, NULL);
+
+    g_variant_dict_insert (&statistics, "seats", "u", g_hash_table_size (priv->seat_bus_entries));
+    g_variant_dict_insert (&statistics, "sessions", "u", priv->sessions->len);
+
+    guint64 n_started, n_succeeded, n_failed;
+    g_variant_get (session_get_statistics (), "(ttt)", &n_started, &n_succeeded, &n_failed);
+    g_variant_dict_insert (&statistics, "authentications-started", "t", n_started);
+    g_variant_dict_insert (&statistics, "authentications-succeeded", "t", n_succeeded);
+    g_variant_dict_insert (&statistics, "authentications-failed", "t", n_failed);
+
+    /* Recent and total display server and greeter crashes on each seat, and if it has fallen back */
+    GVariantBuilder crashes;
+    g_variant_builder_init (&crashes, G_VARIANT_TYPE ("a(sttb)"));
+    for (GList *link = display_manager_get_seats (priv->manager); link; link = link->next)
+    {
+        Seat *seat = link->data;
+        guint64 n_recent, n_total;
+        gboolean fallback;
+        g_variant_get (seat_get_crash_statistics (seat), "(ttb)", &n_recent, &n_total, &fallback);
+        g_variant_builder_add (&crashes, "(sttb)", seat_get_name (seat), n_recent, n_total, fallback);
+    }
+    g_variant_dict_insert_value (&statistics, "crashes", g_variant_builder_end (&crashes));
+
+    /* greeter-start, authentication, pam-authenticate, session-run, vt-switch etc */
+    g_variant_dict_insert_value (&statistics, "latencies", trace_get_statistics ());
+
+    g_variant_dict_insert_value (&statistics, "xdmcp", xdmcp_server_get_statistics ());
+    g_variant_dict_insert_value (&statistics, "vnc", vnc_server_get_statistics ());
+    g_variant_dict_insert_value (&statistics, "main-loop-stalls", watchdog_get_statistics ());
+    g_variant_dict_insert_value (&statistics, "memory", memory_usage_get_statistics ());
+
+    gint64 update_time = common_user_list_get_update_time (common_user_list_get_instance ());
+    gint64 age = update_time > 0 ? (g_get_real_time () - update_time) / G_USEC_PER_SEC : -1;
+    g_variant_dict_insert (&statistics, "user-cache-age", "x", age);
+
+    return g_variant_new ("(@a{sv})", g_variant_dict_end (&statistics));
+}
+
+static void
+handle_statistics_call (GDBusConnection       *connection,
+                        const gchar           *sender,
+                        const gchar           *object_path,
+                        const gchar           *interface_name,
+                        const gchar           *method_name,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation,
+                        gpointer               user_data)
+{
+    DisplayManagerService *service = user_data;
+
+    if (g_strcmp0 (method_name, "GetStatistics") == 0)
+        g_dbus_method_invocation_return_value (invocation, get_statistics (service));
+    else if (g_strcmp0 (method_name, "GetGreeterStatistics") == 0)
+        g_dbus_method_invocation_return_value (invocation, greeter_get_statistics ());
+    else if (g_strcmp0 (method_name, "GetMainLoopStalls") == 0)
+        g_dbus_method_invocation_return_value (invocation, watchdog_get_statistics ());
+    else if (g_strcmp0 (method_name, "GetVNCStatistics") == 0)
+        g_dbus_method_invocation_return_value (invocation, vnc_server_get_statistics ());
+    else
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
+}
+
+static GPid
+get_greeter_pid (Seat *seat)
+{
+    for (GList *link = seat_get_sessions (seat); link; link = link->next)
+    {
+        Session *session = link->data;
+        if (IS_GREETER_SESSION (session) && !session_get_is_stopping (session))
+            return session_get_pid (session);
+    }
+
+    return 0;
+}
+
 static GVariant *
 handle_seat_get_property (GDBusConnection       *connection,
                           const gchar           *sender,
@@ -269,11 +691,81 @@ handle_seat_get_property (GDBusConnection       *connection,
     if (g_strcmp0 (property_name, "HasGuestAccount") == 0)
         return g_variant_new_boolean (seat_get_allow_guest (entry->seat));
     else if (g_strcmp0 (property_name, "Sessions") == 0)
-        return get_session_list (entry->service, entry->path);
+        return get_session_list (entry->service, entry);
+    else if (g_strcmp0 (property_name, "GreeterResources") == 0)
+        return resource_usage_get (get_greeter_pid (entry->seat));
 
     return NULL;
 }
 
+/* Check if a session is the one a switch request is waiting for */
+static gboolean
+is_switch_target (PendingSwitch *pending, Session *session)
+{
+    if (session == NULL)
+        return FALSE;
+
+    switch (pending->target)
+    {
+    case SWITCH_TARGET_GREETER:
+        return IS_GREETER_SESSION (session);
+    case SWITCH_TARGET_USER:
+        return !IS_GREETER_SESSION (session) && g_strcmp0 (session_get_username (session), pending->username) == 0;
+    case SWITCH_TARGET_GUEST:
+        return !IS_GREETER_SESSION (session) && session_get_is_guest (session);
+    }
+
+    return FALSE;
+}
+
+static gboolean
+pending_switch_timeout_cb (gpointer data)
+{
+    PendingSwitch *pending = data;
+    pending->timeout_id = 0;
+    pending_switch_complete (pending, G_DBUS_ERROR_TIMEOUT, "Timed out waiting for session to become active");
+    return G_SOURCE_REMOVE;
+}
+
+/* Reply once the switch completes, or now if the session was already active */
+static void
+wait_for_switch (SeatBusEntry *entry, GDBusMethodInvocation *invocation, SwitchTarget target, const gchar *username, guint32 timeout, gint64 start_time)
+{
+    PendingSwitch *pending = g_new0 (PendingSwitch, 1);
+    pending->seat_entry = entry;
+    pending->invocation = g_object_ref (invocation);
+    pending->target = target;
+    pending->username = g_strdup (username);
+    pending->start_time = start_time;
+    entry->pending_switches = g_list_append (entry->pending_switches, pending);
+
+    if (is_switch_target (pending, seat_get_expected_active_session (entry->seat)))
+    {
+        pending_switch_complete (pending, 0, NULL);
+        return;
+    }
+
+    pending->timeout_id = g_timeout_add (timeout > 0 ? timeout : DEFAULT_SWITCH_TIMEOUT_MS, pending_switch_timeout_cb, pending);
+}
+
+static void
+active_session_changed_cb (Seat *seat, Session *session, DisplayManagerService *service)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
+
+    SeatBusEntry *entry = g_hash_table_lookup (priv->seat_bus_entries, seat);
+    if (!entry)
+        return;
+
+    for (GList *link = entry->pending_switches; link; )
+    {
+        PendingSwitch *pending = link->data;
+        link = link->next;
+        if (is_switch_target (pending, session))
+            pending_switch_complete (pending, 0, NULL);
+    }
+}
+
 static void
 handle_seat_call (GDBusConnection       *connection,
                   const gchar           *sender,
@@ -337,6 +829,63 @@ handle_seat_call (GDBusConnection       *connection,
         else// FIXME: Need to make proper error
             g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "Failed to lock seat");
     }
+    else if (g_strcmp0 (method_name, "SwitchToGreeterAndWait") == 0 ||
+             g_strcmp0 (method_name, "SwitchToUserAndWait") == 0 ||
+             g_strcmp0 (method_name, "SwitchToGuestAndWait") == 0 ||
+             g_strcmp0 (method_name, "LockAndWait") == 0)
+    {
+        gint64 start_time = g_get_monotonic_time ();
+        const gchar *username = NULL, *session_name = NULL;
+        guint32 timeout;
+        SwitchTarget target;
+        gboolean result;
+        if (g_strcmp0 (method_name, "SwitchToUserAndWait") == 0)
+        {
+            if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(ssu)")))
+            {
+                g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+                return;
+            }
+            g_variant_get (parameters, "(&s&su)", &username, &session_name, &timeout);
+            target = SWITCH_TARGET_USER;
+        }
+        else if (g_strcmp0 (method_name, "SwitchToGuestAndWait") == 0)
+        {
+            if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(su)")))
+            {
+                g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+                return;
+            }
+            g_variant_get (parameters, "(&su)", &session_name, &timeout);
+            target = SWITCH_TARGET_GUEST;
+        }
+        else
+        {
+            if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(u)")))
+            {
+                g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Invalid arguments");
+                return;
+            }
+            g_variant_get (parameters, "(u)", &timeout);
+            target = SWITCH_TARGET_GREETER;
+        }
+        if (g_strcmp0 (session_name, "") == 0)
+            session_name = NULL;
+
+        if (g_strcmp0 (method_name, "SwitchToUserAndWait") == 0)
+            result = seat_switch_to_user (entry->seat, username, session_name);
+        else if (g_strcmp0 (method_name, "SwitchToGuestAndWait") == 0)
+            result = seat_switch_to_guest (entry->seat, session_name);
+        else if (g_strcmp0 (method_name, "LockAndWait") == 0)
+            result = seat_lock (entry->seat, NULL);
+        else
+            result = seat_switch_to_greeter (entry->seat);
+
+        if (result)
+            wait_for_switch (entry, invocation, target, username, timeout, start_time);
+        else
+            g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "Failed to switch");
+    }
     else
         g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
 }
@@ -377,6 +926,13 @@ handle_session_get_property (GDBusConnection       *connection,
         return g_variant_new_object_path (entry->seat_path);
     else if (g_strcmp0 (property_name, "UserName") == 0)
         return g_variant_new_string (session_get_username (entry->session));
+    else if (g_strcmp0 (property_name, "Resources") == 0)
+        return resource_usage_get (session_get_pid (entry->session));
+    else if (g_strcmp0 (property_name, "DisplayServerResources") == 0)
+    {
+        DisplayServer *display_server = session_get_display_server (entry->session);
+        return resource_usage_get (display_server ? display_server_get_pid (display_server) : 0);
+    }
 
     return NULL;
 }
@@ -407,6 +963,8 @@ handle_session_call (GDBusConnection       *connection,
         g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method");
 }
 
+static void register_session (DisplayManagerService *service, SeatBusEntry *seat_entry, SessionBusEntry *session_entry);
+
 static void
 running_user_session_cb (Seat *seat, Session *session, DisplayManagerService *service)
 {
@@ -422,6 +980,20 @@ running_user_session_cb (Seat *seat, Session *session, DisplayManagerService *se
 
     SessionBusEntry *session_entry = session_bus_entry_new (service, session, g_object_get_data (G_OBJECT (session), "XDG_SESSION_PATH"), seat_entry ? seat_entry->path : NULL);
     g_hash_table_insert (priv->session_bus_entries, g_object_ref (session), session_entry);
+    g_ptr_array_add (priv->sessions, session_entry);
+    clear_variant (&priv->session_list);
+    g_ptr_array_add (seat_entry->sessions, session_entry);
+    clear_variant (&seat_entry->session_list);
+
+    if (priv->bus)
+        register_session (service, seat_entry, session_entry);
+}
+
+/* Put a session on the bus and announce it */
+static void
+register_session (DisplayManagerService *service, SeatBusEntry *seat_entry, SessionBusEntry *session_entry)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
     g_debug ("Registering session with bus path %s", session_entry->path);
 
@@ -440,11 +1012,13 @@ running_user_session_cb (Seat *seat, Session *session, DisplayManagerService *se
     if (session_entry->bus_id == 0)
         g_warning ("Failed to register user session: %s", error->message);
 
-    emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Sessions", get_session_list (service, NULL));
-    emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SessionAdded", session_entry->path);
+    emit_interfaces_added (service, session_entry->path, get_session_interfaces (session_entry));
+
+    emit_object_value_changed (service, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Sessions", get_session_list (service, NULL));
+    emit_object_signal (service, "/org/freedesktop/DisplayManager", "SessionAdded", session_entry->path);
 
-    emit_object_value_changed (priv->bus, seat_entry->path, "org.freedesktop.DisplayManager.Seat", "Sessions", get_session_list (service, session_entry->seat_path));
-    emit_object_signal (priv->bus, seat_entry->path, "SessionAdded", session_entry->path);
+    emit_object_value_changed (service, seat_entry->path, "org.freedesktop.DisplayManager.Seat", "Sessions", get_session_list (service, seat_entry));
+    emit_object_signal (service, seat_entry->path, "SessionAdded", session_entry->path);
 }
 
 static void
@@ -455,24 +1029,32 @@ session_removed_cb (Seat *seat, Session *session, DisplayManagerService *service
     g_signal_handlers_disconnect_matched (session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
 
     SessionBusEntry *entry = g_hash_table_lookup (priv->session_bus_entries, session);
-    g_autofree gchar *seat_path = NULL;
-    if (entry)
-    {
-        g_dbus_connection_unregister_object (priv->bus, entry->bus_id);
-        emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SessionRemoved", entry->path);
-        emit_object_signal (priv->bus, entry->seat_path, "SessionRemoved", entry->path);
-        seat_path = g_strdup (entry->seat_path);
-    }
+    if (!entry)
+        return;
 
-    g_hash_table_remove (priv->session_bus_entries, session);
+    if (entry->bus_id != 0)
+        g_dbus_connection_unregister_object (priv->bus, entry->bus_id);
+    emit_object_signal (service, "/org/freedesktop/DisplayManager", "SessionRemoved", entry->path);
+    emit_object_signal (service, entry->seat_path, "SessionRemoved", entry->path);
+    emit_interfaces_removed (service, entry->path, priv->session_info->interfaces[0]->name);
 
-    if (seat_path)
+    SeatBusEntry *seat_entry = g_hash_table_lookup (priv->seat_bus_entries, seat);
+    g_ptr_array_remove (priv->sessions, entry);
+    clear_variant (&priv->session_list);
+    if (seat_entry)
     {
-        emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Sessions", get_session_list (service, NULL));
-        emit_object_value_changed (priv->bus, seat_path, "org.freedesktop.DisplayManager.Seat", "Sessions", get_session_list (service, seat_path));
+        g_ptr_array_remove (seat_entry->sessions, entry);
+        clear_variant (&seat_entry->session_list);
     }
+    g_hash_table_remove (priv->session_bus_entries, session);
+
+    emit_object_value_changed (service, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Sessions", get_session_list (service, NULL));
+    if (seat_entry)
+        emit_object_value_changed (service, seat_entry->path, "org.freedesktop.DisplayManager.Seat", "Sessions", get_session_list (service, seat_entry));
 }
 
+static void register_seat (DisplayManagerService *service, SeatBusEntry *entry);
+
 static void
 seat_added_cb (DisplayManager *display_manager, Seat *seat, DisplayManagerService *service)
 {
@@ -483,6 +1065,21 @@ seat_added_cb (DisplayManager *display_manager, Seat *seat, DisplayManagerServic
 
     SeatBusEntry *entry = seat_bus_entry_new (service, seat, path);
     g_hash_table_insert (priv->seat_bus_entries, g_object_ref (seat), entry);
+    clear_variant (&priv->seat_list);
+
+    g_signal_connect (seat, SEAT_SIGNAL_RUNNING_USER_SESSION, G_CALLBACK (running_user_session_cb), service);
+    g_signal_connect (seat, SEAT_SIGNAL_SESSION_REMOVED, G_CALLBACK (session_removed_cb), service);
+    g_signal_connect (seat, SEAT_SIGNAL_ACTIVE_SESSION_CHANGED, G_CALLBACK (active_session_changed_cb), service);
+
+    if (priv->bus)
+        register_seat (service, entry);
+}
+
+/* Put a seat on the bus and announce it */
+static void
+register_seat (DisplayManagerService *service, SeatBusEntry *entry)
+{
+    DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
 
     g_debug ("Registering seat with bus path %s", entry->path);
 
@@ -501,11 +1098,10 @@ seat_added_cb (DisplayManager *display_manager, Seat *seat, DisplayManagerServic
     if (entry->bus_id == 0)
         g_warning ("Failed to register seat: %s", error->message);
 
-    emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Seats", get_seat_list (service));
-    emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SeatAdded", entry->path);
+    emit_interfaces_added (service, entry->path, get_seat_interfaces (entry));
 
-    g_signal_connect (seat, SEAT_SIGNAL_RUNNING_USER_SESSION, G_CALLBACK (running_user_session_cb), service);
-    g_signal_connect (seat, SEAT_SIGNAL_SESSION_REMOVED, G_CALLBACK (session_removed_cb), service);
+    emit_object_value_changed (service, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Seats", get_seat_list (service));
+    emit_object_signal (service, "/org/freedesktop/DisplayManager", "SeatAdded", entry->path);
 }
 
 static void
@@ -516,13 +1112,17 @@ seat_removed_cb (DisplayManager *display_manager, Seat *seat, DisplayManagerServ
     SeatBusEntry *entry = g_hash_table_lookup (priv->seat_bus_entries, seat);
     if (entry)
     {
-        g_dbus_connection_unregister_object (priv->bus, entry->bus_id);
-        emit_object_signal (priv->bus, "/org/freedesktop/DisplayManager", "SeatRemoved", entry->path);
+        if (entry->bus_id != 0)
+            g_dbus_connection_unregister_object (priv->bus, entry->bus_id);
+        discard_object_value_changes (service, entry->path);
+        emit_object_signal (service, "/org/freedesktop/DisplayManager", "SeatRemoved", entry->path);
+        emit_interfaces_removed (service, entry->path, priv->seat_info->interfaces[0]->name);
     }
 
     g_hash_table_remove (priv->seat_bus_entries, seat);
+    clear_variant (&priv->seat_list);
 
-    emit_object_value_changed (priv->bus, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Seats", get_seat_list (service));
+    emit_object_value_changed (service, "/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "Seats", get_seat_list (service));
 }
 
 static void
@@ -574,6 +1174,7 @@ bus_acquired_cb (GDBusConnection *connection,
         "    <property name='CanSwitch' type='b' access='read'/>"
         "    <property name='HasGuestAccount' type='b' access='read'/>"
         "    <property name='Sessions' type='ao' access='read'/>"
+        "    <property name='GreeterResources' type='a{sv}' access='read'/>"
         "    <method name='SwitchToGreeter'/>"
         "    <method name='SwitchToUser'>"
         "      <arg name='username' direction='in' type='s'/>"
@@ -583,6 +1184,25 @@ bus_acquired_cb (GDBusConnection *connection,
         "      <arg name='session-name' direction='in' type='s'/>"
         "    </method>"
         "    <method name='Lock'/>"
+        "    <method name='SwitchToGreeterAndWait'>"
+        "      <arg name='timeout' direction='in' type='u'/>"
+        "      <arg name='duration' direction='out' type='t'/>"
+        "    </method>"
+        "    <method name='SwitchToUserAndWait'>"
+        "      <arg name='username' direction='in' type='s'/>"
+        "      <arg name='session-name' direction='in' type='s'/>"
+        "      <arg name='timeout' direction='in' type='u'/>"
+        "      <arg name='duration' direction='out' type='t'/>"
+        "    </method>"
+        "    <method name='SwitchToGuestAndWait'>"
+        "      <arg name='session-name' direction='in' type='s'/>"
+        "      <arg name='timeout' direction='in' type='u'/>"
+        "      <arg name='duration' direction='out' type='t'/>"
+        "    </method>"
+        "    <method name='LockAndWait'>"
+        "      <arg name='timeout' direction='in' type='u'/>"
+        "      <arg name='duration' direction='out' type='t'/>"
+        "    </method>"
         "    <signal name='SessionAdded'>"
         "      <arg name='session' type='o'/>"
         "    </signal>"
@@ -599,12 +1219,60 @@ bus_acquired_cb (GDBusConnection *connection,
         "  <interface name='org.freedesktop.DisplayManager.Session'>"
         "    <property name='Seat' type='o' access='read'/>"
         "    <property name='UserName' type='s' access='read'/>"
+        "    <property name='Resources' type='a{sv}' access='read'/>"
+        "    <property name='DisplayServerResources' type='a{sv}' access='read'/>"
         "    <method name='Lock'/>"
         "  </interface>"
         "</node>";
     priv->session_info = g_dbus_node_info_new_for_xml (session_interface, NULL);
     g_assert (priv->session_info != NULL);
 
+    const gchar *statistics_interface =
+        "<node>"
+        "  <interface name='org.freedesktop.DisplayManager.Statistics'>"
+        "    <method name='GetStatistics'>"
+        "      <arg name='statistics' direction='out' type='a{sv}'/>"
+        "    </method>"
+        "    <method name='GetGreeterStatistics'>"
+        "      <arg name='bucket-bounds' direction='out' type='at'/>"
+        "      <arg name='messages' direction='out' type='a(sstttat)'/>"
+        "    </method>"
+        "    <method name='GetMainLoopStalls'>"
+        "      <arg name='bucket-bounds' direction='out' type='at'/>"
+        "      <arg name='counts' direction='out' type='at'/>"
+        "      <arg name='max' direction='out' type='t'/>"
+        "    </method>"
+        "    <method name='GetVNCStatistics'>"
+        "      <arg name='listeners' direction='out' type='a(stt)'/>"
+        "      <arg name='started' direction='out' type='t'/>"
+        "      <arg name='queued' direction='out' type='t'/>"
+        "      <arg name='waiting' direction='out' type='u'/>"
+        "      <arg name='active' direction='out' type='u'/>"
+        "    </method>"
+        "  </interface>"
+        "</node>";
+    GDBusNodeInfo *statistics_info = g_dbus_node_info_new_for_xml (statistics_interface, NULL);
+    g_assert (statistics_info != NULL);
+
+    const gchar *object_manager_interface =
+        "<node>"
+        "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+        "    <method name='GetManagedObjects'>"
+        "      <arg name='objects' direction='out' type='a{oa{sa{sv}}}'/>"
+        "    </method>"
+        "    <signal name='InterfacesAdded'>"
+        "      <arg name='object' type='o'/>"
+        "      <arg name='interfaces' type='a{sa{sv}}'/>"
+        "    </signal>"
+        "    <signal name='InterfacesRemoved'>"
+        "      <arg name='object' type='o'/>"
+        "      <arg name='interfaces' type='as'/>"
+        "    </signal>"
+        "  </interface>"
+        "</node>";
+    GDBusNodeInfo *object_manager_info = g_dbus_node_info_new_for_xml (object_manager_interface, NULL);
+    g_assert (object_manager_info != NULL);
+
     static const GDBusInterfaceVTable display_manager_vtable =
     {
         handle_display_manager_call,
@@ -621,11 +1289,47 @@ bus_acquired_cb (GDBusConnection *connection,
         g_warning ("Failed to register display manager: %s", error->message);
     g_dbus_node_info_unref (display_manager_info);
 
-    /* Add objects for existing seats and listen to new ones */
-    g_signal_connect (priv->manager, DISPLAY_MANAGER_SIGNAL_SEAT_ADDED, G_CALLBACK (seat_added_cb), service);
-    g_signal_connect (priv->manager, DISPLAY_MANAGER_SIGNAL_SEAT_REMOVED, G_CALLBACK (seat_removed_cb), service);
+    static const GDBusInterfaceVTable statistics_vtable =
+    {
+        handle_statistics_call
+    };
+    g_clear_error (&error);
+    priv->statistics_reg_id = g_dbus_connection_register_object (connection,
+                                                                 "/org/freedesktop/DisplayManager",
+                                                                 statistics_info->interfaces[0],
+                                                                 &statistics_vtable,
+                                                                 service, NULL,
+                                                                 &error);
+    if (priv->statistics_reg_id == 0)
+        g_warning ("Failed to register display manager statistics: %s", error->message);
+    g_dbus_node_info_unref (statistics_info);
+
+    static const GDBusInterfaceVTable object_manager_vtable =
+    {
+        handle_object_manager_call
+    };
+    g_clear_error (&error);
+    priv->object_manager_reg_id = g_dbus_connection_register_object (connection,
+                                                                     "/org/freedesktop/DisplayManager",
+                                                                     object_manager_info->interfaces[0],
+                                                                     &object_manager_vtable,
+                                                                     service, NULL,
+                                                                     &error);
+    if (priv->object_manager_reg_id == 0)
+        g_warning ("Failed to register display manager object manager: %s", error->message);
+    g_dbus_node_info_unref (object_manager_info);
+
+    /* Add objects for the seats and sessions that started while acquiring the name */
     for (GList *link = display_manager_get_seats (priv->manager); link; link = link->next)
-        seat_added_cb (priv->manager, (Seat *) link->data, service);
+    {
+        SeatBusEntry *entry = g_hash_table_lookup (priv->seat_bus_entries, link->data);
+        if (!entry)
+            continue;
+
+        register_seat (service, entry);
+        for (guint i = 0; i < entry->sessions->len; i++)
+            register_session (service, entry, g_ptr_array_index (entry->sessions, i));
+    }
 
     g_signal_emit (service, signals[READY], 0);
 }
@@ -652,6 +1356,12 @@ display_manager_service_start (DisplayManagerService *service)
 
     g_return_if_fail (service != NULL);
 
+    /* Track seats and sessions from now so they can start before the bus name is acquired */
+    g_signal_connect (priv->manager, DISPLAY_MANAGER_SIGNAL_SEAT_ADDED, G_CALLBACK (seat_added_cb), service);
+    g_signal_connect (priv->manager, DISPLAY_MANAGER_SIGNAL_SEAT_REMOVED, G_CALLBACK (seat_removed_cb), service);
+    for (GList *link = display_manager_get_seats (priv->manager); link; link = link->next)
+        seat_added_cb (priv->manager, (Seat *) link->data, service);
+
     g_debug ("Using D-Bus name %s", LIGHTDM_BUS_NAME);
     priv->bus_id = g_bus_own_name (getuid () == 0 ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION,
                                    LIGHTDM_BUS_NAME,
@@ -669,6 +1379,8 @@ display_manager_service_init (DisplayManagerService *service)
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (service);
     priv->seat_bus_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, seat_bus_entry_free);
     priv->session_bus_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, g_object_unref, session_bus_entry_free);
+    priv->sessions = g_ptr_array_new ();
+    priv->pending_changes = g_ptr_array_new_with_free_func (properties_change_free);
 }
 
 static void
@@ -677,7 +1389,14 @@ display_manager_service_finalize (GObject *object)
     DisplayManagerService *self = DISPLAY_MANAGER_SERVICE (object);
     DisplayManagerServicePrivate *priv = display_manager_service_get_instance_private (self);
 
-    g_dbus_connection_unregister_object (priv->bus, priv->reg_id);
+    if (priv->reg_id != 0)
+        g_dbus_connection_unregister_object (priv->bus, priv->reg_id);
+    if (priv->statistics_reg_id != 0)
+        g_dbus_connection_unregister_object (priv->bus, priv->statistics_reg_id);
+    if (priv->object_manager_reg_id != 0)
+        g_dbus_connection_unregister_object (priv->bus, priv->object_manager_reg_id);
+    if (priv->pending_changes_idle != 0)
+        g_source_remove (priv->pending_changes_idle);
     g_bus_unown_name (priv->bus_id);
     if (priv->seat_info)
         g_dbus_node_info_unref (priv->seat_info);
@@ -685,7 +1404,11 @@ display_manager_service_finalize (GObject *object)
         g_dbus_node_info_unref (priv->session_info);
     g_hash_table_unref (priv->seat_bus_entries);
     g_hash_table_unref (priv->session_bus_entries);
-    g_object_unref (priv->bus);
+    g_ptr_array_unref (priv->sessions);
+    g_ptr_array_unref (priv->pending_changes);
+    clear_variant (&priv->seat_list);
+    clear_variant (&priv->session_list);
+    g_clear_object (&priv->bus);
     g_clear_object (&priv->manager);
 
     G_OBJECT_CLASS (display_manager_service_parent_class)->finalize (object);
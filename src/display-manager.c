@@ -39,6 +39,9 @@ typedef struct
 
     /* TRUE if stopped */
     gboolean stopped;
+
+    /* Timeout to kill everything that hasn't stopped */
+    guint stop_timeout;
 } DisplayManagerPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (DisplayManager, display_manager, G_TYPE_OBJECT)
@@ -82,6 +85,9 @@ check_stopped (DisplayManager *manager)
         g_list_length (priv->seats) == 0)
     {
         priv->stopped = TRUE;
+        if (priv->stop_timeout != 0)
+            g_source_remove (priv->stop_timeout);
+        priv->stop_timeout = 0;
         g_debug ("Display manager stopped");
         g_signal_emit (manager, signals[STOPPED], 0);
     }
@@ -100,6 +106,9 @@ seat_stopped_cb (Seat *seat, DisplayManager *manager)
 
     g_object_unref (seat);
 
+    if (priv->stopping && priv->seats != NULL)
+        g_debug ("Waiting for %d seats and %u processes to stop", g_list_length (priv->seats), process_get_count ());
+
     check_stopped (manager);
 }
 
@@ -134,6 +143,26 @@ display_manager_start (DisplayManager *manager)
     }
 }
 
+static gboolean
+stop_timeout_cb (gpointer data)
+{
+    DisplayManager *manager = data;
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+
+    priv->stop_timeout = 0;
+
+    g_warning ("%d seats have not stopped in time, killing remaining processes", g_list_length (priv->seats));
+    for (GList *seat_link = priv->seats; seat_link; seat_link = seat_link->next)
+    {
+        Seat *seat = seat_link->data;
+        for (GList *link = seat_get_sessions (seat); link; link = link->next)
+            session_kill (SESSION (link->data));
+    }
+    process_kill_all ();
+
+    return G_SOURCE_REMOVE;
+}
+
 void
 display_manager_stop (DisplayManager *manager)
 {
@@ -148,6 +177,11 @@ display_manager_stop (DisplayManager *manager)
 
     priv->stopping = TRUE;
 
+    /* Don't let a stuck script or process hold up shutdown forever */
+    gint timeout = config_get_integer (config_get_instance (), "LightDM", "stop-timeout");
+    if (timeout > 0)
+        priv->stop_timeout = g_timeout_add_seconds (timeout, stop_timeout_cb, manager);
+
     /* Stop all the seats. Copy the list as it might be modified if a seat stops during this loop */
     GList *seats = g_list_copy (priv->seats);
     for (GList *link = seats; link; link = link->next)
@@ -160,6 +194,14 @@ display_manager_stop (DisplayManager *manager)
     check_stopped (manager);
 }
 
+gboolean
+display_manager_get_is_stopping (DisplayManager *manager)
+{
+    DisplayManagerPrivate *priv = display_manager_get_instance_private (manager);
+    g_return_val_if_fail (manager != NULL, FALSE);
+    return priv->stopping;
+}
+
 static void
 display_manager_init (DisplayManager *manager)
 {
@@ -180,6 +222,8 @@ display_manager_finalize (GObject *object)
         g_signal_handlers_disconnect_matched (seat, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
     }
     g_list_free_full (priv->seats, g_object_unref);
+    if (priv->stop_timeout != 0)
+        g_source_remove (priv->stop_timeout);
 
     G_OBJECT_CLASS (display_manager_parent_class)->finalize (object);
 }
@@ -53,6 +53,8 @@ void display_manager_start (DisplayManager *manager);
 
 void display_manager_stop (DisplayManager *manager);
 
+gboolean display_manager_get_is_stopping (DisplayManager *manager);
+
 G_END_DECLS
 
 #endif /* DISPLAY_MANAGER_H_ */
@@ -70,6 +70,20 @@ display_server_real_get_can_share (DisplayServer *server)
     return FALSE;
 }
 
+/* TRUE if sessions can be connected to the display server while it is still starting */
+gboolean
+display_server_get_can_connect_early (DisplayServer *server)
+{
+    g_return_val_if_fail (server != NULL, FALSE);
+    return DISPLAY_SERVER_GET_CLASS (server)->get_can_connect_early (server);
+}
+
+static gboolean
+display_server_real_get_can_connect_early (DisplayServer *server)
+{
+    return FALSE;
+}
+
 gint
 display_server_get_vt (DisplayServer *server)
 {
@@ -83,6 +97,19 @@ display_server_real_get_vt (DisplayServer *server)
     return -1;
 }
 
+GPid
+display_server_get_pid (DisplayServer *server)
+{
+    g_return_val_if_fail (server != NULL, 0);
+    return DISPLAY_SERVER_GET_CLASS (server)->get_pid (server);
+}
+
+static GPid
+display_server_real_get_pid (DisplayServer *server)
+{
+    return 0;
+}
+
 gboolean
 display_server_start (DisplayServer *server)
 {
@@ -98,6 +125,28 @@ display_server_get_is_ready (DisplayServer *server)
     return priv->is_ready;
 }
 
+/* Reset a running display server so it can be used by new sessions, disconnecting
+ * all its clients. The ready signal is emitted again once it has reset */
+gboolean
+display_server_reset (DisplayServer *server)
+{
+    DisplayServerPrivate *priv = display_server_get_instance_private (server);
+
+    g_return_val_if_fail (server != NULL, FALSE);
+
+    if (!priv->is_ready || !DISPLAY_SERVER_GET_CLASS (server)->reset (server))
+        return FALSE;
+    priv->is_ready = FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+display_server_real_reset (DisplayServer *server)
+{
+    return FALSE;
+}
+
 static gboolean
 display_server_real_start (DisplayServer *server)
 {
@@ -167,8 +216,11 @@ display_server_class_init (DisplayServerClass *klass)
 {
     klass->get_parent = display_server_real_get_parent;  
     klass->get_can_share = display_server_real_get_can_share;
+    klass->get_can_connect_early = display_server_real_get_can_connect_early;
     klass->get_vt = display_server_real_get_vt;
+    klass->get_pid = display_server_real_get_pid;
     klass->start = display_server_real_start;
+    klass->reset = display_server_real_reset;
     klass->connect_session = display_server_real_connect_session;
     klass->disconnect_session = display_server_real_disconnect_session;
     klass->stop = display_server_real_stop;
@@ -44,8 +44,11 @@ typedef struct
     DisplayServer *(*get_parent)(DisplayServer *server);  
     const gchar *(*get_session_type)(DisplayServer *server);
     gboolean (*get_can_share)(DisplayServer *server);
+    gboolean (*get_can_connect_early)(DisplayServer *server);
     gint (*get_vt)(DisplayServer *server);
+    GPid (*get_pid)(DisplayServer *server);
     gboolean (*start)(DisplayServer *server);
+    gboolean (*reset)(DisplayServer *server);
     void (*connect_session)(DisplayServer *server, Session *session);
     void (*disconnect_session)(DisplayServer *server, Session *session);
     void (*stop)(DisplayServer *server);
@@ -59,12 +62,18 @@ DisplayServer *display_server_get_parent (DisplayServer *server);
 
 gboolean display_server_get_can_share (DisplayServer *server);
 
+gboolean display_server_get_can_connect_early (DisplayServer *server);
+
 gint display_server_get_vt (DisplayServer *server);
 
+GPid display_server_get_pid (DisplayServer *server);
+
 gboolean display_server_start (DisplayServer *server);
 
 gboolean display_server_get_is_ready (DisplayServer *server);
 
+gboolean display_server_reset (DisplayServer *server);
+
 void display_server_connect_session (DisplayServer *server, Session *session);
 
 void display_server_disconnect_session (DisplayServer *server, Session *session);
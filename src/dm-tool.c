@@ -12,12 +12,73 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gio/gio.h>
+#include <sys/wait.h>
+
+#include "flight-recorder.h"
+
+#define SEAT_INTERFACE "org.freedesktop.DisplayManager.Seat"
+#define SESSION_INTERFACE "org.freedesktop.DisplayManager.Session"
+
+/* The system bus only lets a connection wait for a limited number of replies */
+#define MAX_PENDING_REQUESTS 64
 
 static GBusType bus_type = G_BUS_TYPE_SYSTEM;
-static GDBusProxy *dm_proxy, *seat_proxy = NULL;
+static GDBusProxy *dm_proxy = NULL;
+
+typedef enum
+{
+    REPLY_NONE,
+    REPLY_OBJECT_PATH,
+    REPLY_SEATS,
+    REPLY_SEATS_JSON
+} ReplyFormat;
+
+/* A command that is a single call to the display manager */
+typedef struct
+{
+    /* Method to call */
+    const gchar *path;
+    const gchar *interface;
+    const gchar *method;
+    GVariant *parameters;
+    const GVariantType *reply_type;
+
+    /* How to show the reply */
+    ReplyFormat format;
+
+    /* Message to show if the call fails */
+    gchar *error_message;
+} Request;
+
+/* A command read in batch mode */
+typedef struct
+{
+    /* Line the command was read from */
+    gint line_number;
+
+    /* Call to make, or NULL if the command is not valid */
+    Request *request;
+
+    /* TRUE when the call has completed */
+    gboolean done;
+
+    /* What to print when finished */
+    GString *output;
+    gchar *error_text;
+} BatchEntry;
+
+/* Commands being run in batch mode */
+static GPtrArray *batch_entries = NULL;
+static guint batch_n_sent = 0;
+static guint batch_n_pending = 0;
+static guint batch_n_printed = 0;
+static gboolean batch_failed = FALSE;
+static GMainLoop *batch_loop = NULL;
 
 static gint xephyr_display_number;
 static GPid xephyr_pid;
@@ -67,34 +128,792 @@ xephyr_signal_cb (int signum)
     exit (EXIT_SUCCESS);
 }
 
-static GDBusProxy *
-get_seat_proxy (void)
+static const gchar *
+get_seat_path (void)
 {
-    if (seat_proxy)
-        return seat_proxy;
-
-    if (!g_getenv ("XDG_SEAT_PATH"))
+    const gchar *path = g_getenv ("XDG_SEAT_PATH");
+    if (!path)
     {
         g_printerr ("Not running inside a display manager, XDG_SEAT_PATH not defined\n");
         exit (EXIT_FAILURE);
     }
 
+    return path;
+}
+
+static const gchar *
+get_object_name (const gchar *path)
+{
+    if (g_str_has_prefix (path, "/org/freedesktop/DisplayManager/"))
+        return path + strlen ("/org/freedesktop/DisplayManager/");
+    else
+        return path;
+}
+
+static GVariant *
+get_object_properties (GVariant *objects, const gchar *path, const gchar *interface)
+{
+    g_autoptr(GVariant) interfaces = g_variant_lookup_value (objects, path, G_VARIANT_TYPE ("a{sa{sv}}"));
+    if (!interfaces)
+        return NULL;
+
+    return g_variant_lookup_value (interfaces, interface, G_VARIANT_TYPE_VARDICT);
+}
+
+static gint
+compare_paths (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*((const gchar **) a), *((const gchar **) b));
+}
+
+/* Paths of the seats in the result of GetManagedObjects, in order */
+static GPtrArray *
+get_seat_paths (GVariant *objects)
+{
+    GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+
+    GVariantIter iter;
+    g_variant_iter_init (&iter, objects);
+    const gchar *path;
+    GVariant *interfaces;
+    while (g_variant_iter_loop (&iter, "{&o@a{sa{sv}}}", &path, &interfaces))
+    {
+        g_autoptr(GVariant) properties = g_variant_lookup_value (interfaces, SEAT_INTERFACE, G_VARIANT_TYPE_VARDICT);
+        if (properties)
+            g_ptr_array_add (paths, g_strdup (path));
+    }
+    g_ptr_array_sort (paths, compare_paths);
+
+    return paths;
+}
+
+static void
+append_properties (GString *output, GVariant *properties, const gchar *indent, const gchar *skip_name)
+{
+    GVariantIter iter;
+    g_variant_iter_init (&iter, properties);
+    const gchar *name;
+    GVariant *value;
+    while (g_variant_iter_loop (&iter, "{&sv}", &name, &value))
+    {
+        if (strcmp (name, skip_name) == 0)
+            continue;
+
+        g_autofree gchar *text = g_variant_print (value, FALSE);
+        g_string_append_printf (output, "%s%s=%s\n", indent, name, text);
+    }
+}
+
+static void
+append_seats (GString *output, GVariant *objects)
+{
+    g_autoptr(GPtrArray) seat_paths = get_seat_paths (objects);
+    for (guint i = 0; i < seat_paths->len; i++)
+    {
+        const gchar *seat_path = g_ptr_array_index (seat_paths, i);
+        g_autoptr(GVariant) properties = get_object_properties (objects, seat_path, SEAT_INTERFACE);
+
+        g_string_append_printf (output, "%s\n", get_object_name (seat_path));
+        append_properties (output, properties, "  ", "Sessions");
+
+        g_autoptr(GVariant) sessions = g_variant_lookup_value (properties, "Sessions", G_VARIANT_TYPE_OBJECT_PATH_ARRAY);
+        if (!sessions)
+            continue;
+
+        GVariantIter session_iter;
+        g_variant_iter_init (&session_iter, sessions);
+        const gchar *session_path;
+        while (g_variant_iter_next (&session_iter, "&o", &session_path))
+        {
+            g_autoptr(GVariant) session_properties = get_object_properties (objects, session_path, SESSION_INTERFACE);
+            if (!session_properties)
+                continue;
+
+            g_string_append_printf (output, "  %s\n", get_object_name (session_path));
+            append_properties (output, session_properties, "    ", "Seat");
+        }
+    }
+}
+
+static void
+append_json_string (GString *output, const gchar *value)
+{
+    g_string_append_c (output, '"');
+    for (const gchar *c = value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            g_string_append_printf (output, "\\%c", *c);
+        else if ((guchar) *c < 0x20)
+            g_string_append_printf (output, "\\u%04x", *c);
+        else
+            g_string_append_c (output, *c);
+    }
+    g_string_append_c (output, '"');
+}
+
+static void
+append_json_value (GString *output, GVariant *value)
+{
+    switch (g_variant_classify (value))
+    {
+    case G_VARIANT_CLASS_BOOLEAN:
+        g_string_append (output, g_variant_get_boolean (value) ? "true" : "false");
+        break;
+    case G_VARIANT_CLASS_BYTE:
+        g_string_append_printf (output, "%u", g_variant_get_byte (value));
+        break;
+    case G_VARIANT_CLASS_STRING:
+    case G_VARIANT_CLASS_OBJECT_PATH:
+    case G_VARIANT_CLASS_SIGNATURE:
+        append_json_string (output, g_variant_get_string (value, NULL));
+        break;
+    case G_VARIANT_CLASS_VARIANT:
+    {
+        g_autoptr(GVariant) child = g_variant_get_variant (value);
+        append_json_value (output, child);
+        break;
+    }
+    case G_VARIANT_CLASS_MAYBE:
+    {
+        g_autoptr(GVariant) child = g_variant_get_maybe (value);
+        if (child)
+            append_json_value (output, child);
+        else
+            g_string_append (output, "null");
+        break;
+    }
+    case G_VARIANT_CLASS_ARRAY:
+    case G_VARIANT_CLASS_TUPLE:
+    {
+        /* Dictionaries become objects, everything else a list */
+        gboolean is_dict = g_variant_is_of_type (value, G_VARIANT_TYPE_DICTIONARY);
+        g_string_append_c (output, is_dict ? '{' : '[');
+        gsize n_children = g_variant_n_children (value);
+        for (gsize i = 0; i < n_children; i++)
+        {
+            g_autoptr(GVariant) child = g_variant_get_child_value (value, i);
+            if (i > 0)
+                g_string_append_c (output, ',');
+            if (is_dict)
+            {
+                g_autoptr(GVariant) key = g_variant_get_child_value (child, 0);
+                g_autoptr(GVariant) entry_value = g_variant_get_child_value (child, 1);
+                if (g_variant_is_of_type (key, G_VARIANT_TYPE_STRING) || g_variant_is_of_type (key, G_VARIANT_TYPE_OBJECT_PATH))
+                    append_json_string (output, g_variant_get_string (key, NULL));
+                else
+                {
+                    g_autofree gchar *key_text = g_variant_print (key, FALSE);
+                    append_json_string (output, key_text);
+                }
+                g_string_append_c (output, ':');
+                append_json_value (output, entry_value);
+            }
+            else
+                append_json_value (output, child);
+        }
+        g_string_append_c (output, is_dict ? '}' : ']');
+        break;
+    }
+    default:
+    {
+        g_autofree gchar *text = g_variant_print (value, FALSE);
+        g_string_append (output, text);
+        break;
+    }
+    }
+}
+
+/* Start a JSON object for a seat or session, the caller closes it */
+static void
+append_json_object (GString *output, const gchar *path, GVariant *properties, const gchar *skip_name)
+{
+    g_string_append (output, "{\"name\":");
+    append_json_string (output, get_object_name (path));
+    g_string_append (output, ",\"path\":");
+    append_json_string (output, path);
+    g_string_append (output, ",\"properties\":{");
+
+    GVariantIter iter;
+    g_variant_iter_init (&iter, properties);
+    const gchar *name;
+    GVariant *value;
+    gboolean first = TRUE;
+    while (g_variant_iter_loop (&iter, "{&sv}", &name, &value))
+    {
+        if (strcmp (name, skip_name) == 0)
+            continue;
+
+        if (!first)
+            g_string_append_c (output, ',');
+        first = FALSE;
+        append_json_string (output, name);
+        g_string_append_c (output, ':');
+        append_json_value (output, value);
+    }
+    g_string_append_c (output, '}');
+}
+
+static void
+append_seats_json (GString *output, GVariant *objects)
+{
+    g_string_append_c (output, '[');
+
+    g_autoptr(GPtrArray) seat_paths = get_seat_paths (objects);
+    for (guint i = 0; i < seat_paths->len; i++)
+    {
+        const gchar *seat_path = g_ptr_array_index (seat_paths, i);
+        g_autoptr(GVariant) properties = get_object_properties (objects, seat_path, SEAT_INTERFACE);
+
+        if (i > 0)
+            g_string_append_c (output, ',');
+        append_json_object (output, seat_path, properties, "Sessions");
+        g_string_append (output, ",\"sessions\":[");
+
+        g_autoptr(GVariant) sessions = g_variant_lookup_value (properties, "Sessions", G_VARIANT_TYPE_OBJECT_PATH_ARRAY);
+        if (sessions)
+        {
+            GVariantIter session_iter;
+            g_variant_iter_init (&session_iter, sessions);
+            const gchar *session_path;
+            gboolean first = TRUE;
+            while (g_variant_iter_next (&session_iter, "&o", &session_path))
+            {
+                g_autoptr(GVariant) session_properties = get_object_properties (objects, session_path, SESSION_INTERFACE);
+                if (!session_properties)
+                    continue;
+
+                if (!first)
+                    g_string_append_c (output, ',');
+                first = FALSE;
+                append_json_object (output, session_path, session_properties, "Seat");
+                g_string_append_c (output, '}');
+            }
+        }
+        g_string_append (output, "]}");
+    }
+
+    g_string_append (output, "]\n");
+}
+
+static Request *
+request_new (const gchar *path, const gchar *interface, const gchar *method, GVariant *parameters,
+             const GVariantType *reply_type, ReplyFormat format, gchar *error_message)
+{
+    Request *request = g_new0 (Request, 1);
+    request->path = path;
+    request->interface = interface;
+    request->method = method;
+    request->parameters = parameters ? g_variant_ref_sink (parameters) : NULL;
+    request->reply_type = reply_type;
+    request->format = format;
+    request->error_message = error_message;
+
+    return request;
+}
+
+static void
+request_free (Request *request)
+{
+    g_clear_pointer (&request->parameters, g_variant_unref);
+    g_free (request->error_message);
+    g_free (request);
+}
+
+/* Commands that are a single call to the display manager */
+static gboolean
+is_request_command (const gchar *command)
+{
+    const gchar *commands[] = { "switch-to-greeter", "switch-to-user", "switch-to-guest", "lock", "list-seats", "add-local-x-seat", "add-seat", NULL };
+    return g_strv_contains (commands, command);
+}
+
+/* Get the call to make for a command.  If the options are not valid NULL is returned and usage_text is set */
+static Request *
+parse_request (const gchar *command, gint n_options, gchar **options, gchar **usage_text)
+{
+    if (strcmp (command, "switch-to-greeter") == 0)
+    {
+        if (n_options != 0)
+        {
+            *usage_text = g_strdup ("Usage switch-to-greeter");
+            return NULL;
+        }
+
+        return request_new (get_seat_path (), SEAT_INTERFACE, "SwitchToGreeter", g_variant_new ("()"),
+                            NULL, REPLY_NONE, g_strdup ("Unable to switch to greeter"));
+    }
+    else if (strcmp (command, "switch-to-user") == 0)
+    {
+        if (n_options < 1 || n_options > 2)
+        {
+            *usage_text = g_strdup ("Usage switch-to-user USERNAME [SESSION]");
+            return NULL;
+        }
+
+        const gchar *username = options[0];
+        const gchar *session = "";
+        if (n_options == 2)
+            session = options[1];
+
+        return request_new (get_seat_path (), SEAT_INTERFACE, "SwitchToUser", g_variant_new ("(ss)", username, session),
+                            NULL, REPLY_NONE, g_strdup_printf ("Unable to switch to user %s", username));
+    }
+    else if (strcmp (command, "switch-to-guest") == 0)
+    {
+        if (n_options > 1)
+        {
+            *usage_text = g_strdup ("Usage switch-to-guest [SESSION]");
+            return NULL;
+        }
+
+        const gchar *session = "";
+        if (n_options == 1)
+            session = options[0];
+
+        return request_new (get_seat_path (), SEAT_INTERFACE, "SwitchToGuest", g_variant_new ("(s)", session),
+                            NULL, REPLY_NONE, g_strdup ("Unable to switch to guest"));
+    }
+    else if (strcmp (command, "lock") == 0)
+    {
+        if (n_options != 0)
+        {
+            *usage_text = g_strdup ("Usage lock");
+            return NULL;
+        }
+
+        return request_new (get_seat_path (), SEAT_INTERFACE, "Lock", g_variant_new ("()"),
+                            NULL, REPLY_NONE, g_strdup ("Unable to lock seat"));
+    }
+    else if (strcmp (command, "list-seats") == 0)
+    {
+        gboolean json = n_options == 1 && strcmp (options[0], "--json") == 0;
+        if (n_options != 0 && !json)
+        {
+            *usage_text = g_strdup ("Usage list-seats [--json]");
+            return NULL;
+        }
+
+        /* All the seats and sessions come back in one call */
+        return request_new ("/org/freedesktop/DisplayManager", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects", NULL,
+                            G_VARIANT_TYPE ("(a{oa{sa{sv}}})"), json ? REPLY_SEATS_JSON : REPLY_SEATS, g_strdup ("Unable to list seats"));
+    }
+    else if (strcmp (command, "add-local-x-seat") == 0)
+    {
+        if (n_options != 1)
+        {
+            *usage_text = g_strdup ("Usage add-local-x-seat DISPLAY_NUMBER");
+            return NULL;
+        }
+
+        gint display_number = atoi (options[0]);
+        return request_new ("/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "AddLocalXSeat", g_variant_new ("(i)", display_number),
+                            G_VARIANT_TYPE ("(o)"), REPLY_OBJECT_PATH, g_strdup ("Unable to add local X seat"));
+    }
+    else if (strcmp (command, "add-seat") == 0)
+    {
+        if (n_options < 1)
+        {
+            *usage_text = g_strdup ("Usage add-seat TYPE [NAME=VALUE...]");
+            return NULL;
+        }
+
+        const gchar *type = options[0];
+        g_autoptr(GVariantBuilder) properties = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
+
+        for (gint i = 1; i < n_options; i++)
+        {
+            g_autofree gchar *property = g_strdup (options[i]);
+            gchar *name = property;
+            gchar *value = strchr (property, '=');
+            if (value)
+            {
+                *value = '\0';
+                value++;
+            }
+            else
+               value = "";
+
+            g_variant_builder_add_value (properties, g_variant_new ("(ss)", name, value));
+        }
+
+        return request_new ("/org/freedesktop/DisplayManager", "org.freedesktop.DisplayManager", "AddSeat", g_variant_new ("(sa(ss))", type, properties),
+                            G_VARIANT_TYPE ("(o)"), REPLY_OBJECT_PATH, g_strdup ("Unable to add seat"));
+    }
+
+    *usage_text = g_strdup_printf ("Unknown command %s", command);
+    return NULL;
+}
+
+static void
+append_reply (GString *output, Request *request, GVariant *result)
+{
+    switch (request->format)
+    {
+    case REPLY_NONE:
+        break;
+    case REPLY_OBJECT_PATH:
+    {
+        const gchar *path;
+        g_variant_get (result, "(&o)", &path);
+        g_string_append_printf (output, "%s\n", path);
+        break;
+    }
+    case REPLY_SEATS:
+    case REPLY_SEATS_JSON:
+    {
+        g_autoptr(GVariant) objects = g_variant_get_child_value (result, 0);
+        if (request->format == REPLY_SEATS_JSON)
+            append_seats_json (output, objects);
+        else
+            append_seats (output, objects);
+        break;
+    }
+    }
+}
+
+static gboolean
+run_request (GDBusConnection *connection, Request *request)
+{
     g_autoptr(GError) error = NULL;
-    seat_proxy = g_dbus_proxy_new_for_bus_sync (bus_type,
-                                                G_DBUS_PROXY_FLAGS_NONE,
-                                                NULL,
-                                                "org.freedesktop.DisplayManager",
-                                                g_getenv ("XDG_SEAT_PATH"),
-                                                "org.freedesktop.DisplayManager.Seat",
-                                                NULL,
-                                                &error);
-    if (!seat_proxy)
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (connection,
+                                                              "org.freedesktop.DisplayManager",
+                                                              request->path,
+                                                              request->interface,
+                                                              request->method,
+                                                              request->parameters,
+                                                              request->reply_type,
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (!result)
     {
-        g_printerr ("Unable to contact display manager: %s\n", error->message);
-        exit (EXIT_FAILURE);
+        g_printerr ("%s: %s\n", request->error_message, error->message);
+        return FALSE;
+    }
+
+    g_autoptr(GString) output = g_string_new ("");
+    append_reply (output, request, result);
+    g_print ("%s", output->str);
+
+    return TRUE;
+}
+
+static void
+batch_entry_free (BatchEntry *entry)
+{
+    g_clear_pointer (&entry->request, request_free);
+    g_string_free (entry->output, TRUE);
+    g_free (entry->error_text);
+    g_free (entry);
+}
+
+/* Print the results of completed commands in the order they were given */
+static void
+batch_print_completed (void)
+{
+    while (batch_n_printed < batch_entries->len)
+    {
+        BatchEntry *entry = g_ptr_array_index (batch_entries, batch_n_printed);
+        if (!entry->done)
+            break;
+
+        g_print ("%s", entry->output->str);
+        if (entry->error_text)
+            g_printerr ("%s", entry->error_text);
+        batch_n_printed++;
+    }
+
+    if (batch_n_printed == batch_entries->len && batch_loop)
+        g_main_loop_quit (batch_loop);
+}
+
+static void batch_send (void);
+
+static void
+batch_call_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    BatchEntry *entry = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+    if (reply)
+        append_reply (entry->output, entry->request, reply);
+    else
+    {
+        entry->error_text = g_strdup_printf ("Line %d: %s: %s\n", entry->line_number, entry->request->error_message, error->message);
+        batch_failed = TRUE;
+    }
+    entry->done = TRUE;
+    batch_n_pending--;
+
+    batch_send ();
+}
+
+/* Make calls for the next commands, without waiting for the replies to the previous ones */
+static void
+batch_send (void)
+{
+    while (batch_n_sent < batch_entries->len && batch_n_pending < MAX_PENDING_REQUESTS)
+    {
+        BatchEntry *entry = g_ptr_array_index (batch_entries, batch_n_sent);
+        batch_n_sent++;
+
+        if (!entry->request)
+            continue;
+
+        g_dbus_connection_call (g_dbus_proxy_get_connection (dm_proxy),
+                                "org.freedesktop.DisplayManager",
+                                entry->request->path,
+                                entry->request->interface,
+                                entry->request->method,
+                                entry->request->parameters,
+                                entry->request->reply_type,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                NULL,
+                                batch_call_cb,
+                                entry);
+        batch_n_pending++;
+    }
+
+    batch_print_completed ();
+}
+
+static BatchEntry *
+parse_batch_line (gint line_number, const gchar *line)
+{
+    BatchEntry *entry = g_new0 (BatchEntry, 1);
+    entry->line_number = line_number;
+    entry->output = g_string_new ("");
+
+    g_auto(GStrv) argv = NULL;
+    g_autoptr(GError) error = NULL;
+    if (!g_shell_parse_argv (line, NULL, &argv, &error))
+        entry->error_text = g_strdup_printf ("Line %d: %s\n", line_number, error->message);
+    else if (!is_request_command (argv[0]))
+        entry->error_text = g_strdup_printf ("Line %d: Command %s can't be used in a batch\n", line_number, argv[0]);
+    else
+    {
+        g_autofree gchar *usage_text = NULL;
+        entry->request = parse_request (argv[0], g_strv_length (argv) - 1, argv + 1, &usage_text);
+        if (!entry->request)
+            entry->error_text = g_strdup_printf ("Line %d: %s\n", line_number, usage_text);
+    }
+
+    /* Commands that can't be run are complete already */
+    if (!entry->request)
+    {
+        entry->done = TRUE;
+        batch_failed = TRUE;
     }
 
-    return seat_proxy;
+    return entry;
+}
+
+/* Run commands read from stdin, sending them all over the one connection without waiting for each reply */
+static gboolean
+run_batch (void)
+{
+    batch_entries = g_ptr_array_new_with_free_func ((GDestroyNotify) batch_entry_free);
+
+    g_autoptr(GIOChannel) channel = g_io_channel_unix_new (STDIN_FILENO);
+    g_io_channel_set_encoding (channel, NULL, NULL);
+    gint line_number = 0;
+    while (TRUE)
+    {
+        g_autofree gchar *line = NULL;
+        g_autoptr(GError) error = NULL;
+        GIOStatus status = g_io_channel_read_line (channel, &line, NULL, NULL, &error);
+        if (status == G_IO_STATUS_EOF)
+            break;
+        if (status != G_IO_STATUS_NORMAL)
+        {
+            g_printerr ("Unable to read commands: %s\n", error ? error->message : "Unknown error");
+            return FALSE;
+        }
+        line_number++;
+
+        g_strstrip (line);
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        g_ptr_array_add (batch_entries, parse_batch_line (line_number, line));
+    }
+
+    batch_send ();
+    if (batch_n_printed < batch_entries->len)
+    {
+        batch_loop = g_main_loop_new (NULL, FALSE);
+        g_main_loop_run (batch_loop);
+    }
+
+    return !batch_failed;
+}
+
+static void
+print_event (GString *event)
+{
+    g_string_append (event, "}\n");
+    fputs (event->str, stdout);
+    fflush (stdout);
+}
+
+static GString *
+start_event (const gchar *name, const gchar *path)
+{
+    GString *event = g_string_new ("{\"event\":");
+    append_json_string (event, name);
+    g_string_append_printf (event, ",\"time\":%" G_GINT64_FORMAT ",\"path\":", g_get_real_time () / 1000);
+    append_json_string (event, path);
+    return event;
+}
+
+static void
+monitor_signal_cb (GDBusConnection *connection, const gchar *sender_name, const gchar *object_path,
+                   const gchar *interface_name, const gchar *signal_name, GVariant *parameters, gpointer user_data)
+{
+    g_autoptr(GString) event = start_event (signal_name, object_path);
+
+    if (strcmp (signal_name, "PropertiesChanged") == 0 && g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+    {
+        const gchar *changed_interface;
+        g_autoptr(GVariant) changed = NULL;
+        g_autoptr(GVariant) invalidated = NULL;
+        g_variant_get (parameters, "(&s@a{sv}@as)", &changed_interface, &changed, &invalidated);
+        g_string_append (event, ",\"interface\":");
+        append_json_string (event, changed_interface);
+        g_string_append (event, ",\"changed\":");
+        append_json_value (event, changed);
+        g_string_append (event, ",\"invalidated\":");
+        append_json_value (event, invalidated);
+    }
+    else if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(o)")))
+    {
+        const gchar *path;
+        g_variant_get (parameters, "(&o)", &path);
+        g_string_append (event, ",\"object\":");
+        append_json_string (event, path);
+    }
+    else
+        return;
+
+    print_event (event);
+}
+
+static void
+monitor_name_owner_cb (GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    GMainLoop *loop = user_data;
+    g_autofree gchar *owner = g_dbus_proxy_get_name_owner (dm_proxy);
+    if (owner)
+        return;
+
+    g_printerr ("Display manager has stopped\n");
+    g_main_loop_quit (loop);
+}
+
+/* Print seat and session changes as they happen, one JSON object per line */
+static gboolean
+run_monitor (void)
+{
+    GDBusConnection *connection = g_dbus_proxy_get_connection (dm_proxy);
+    g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+
+    /* Subscribe before getting the current state so no change is missed between the two */
+    guint subscription_id = g_dbus_connection_signal_subscribe (connection, "org.freedesktop.DisplayManager",
+                                                                NULL, NULL, NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                monitor_signal_cb, NULL, NULL);
+    g_signal_connect (dm_proxy, "notify::g-name-owner", G_CALLBACK (monitor_name_owner_cb), loop);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (connection,
+                                                              "org.freedesktop.DisplayManager",
+                                                              "/org/freedesktop/DisplayManager",
+                                                              "org.freedesktop.DBus.ObjectManager",
+                                                              "GetManagedObjects",
+                                                              NULL,
+                                                              G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (!result)
+    {
+        g_printerr ("Unable to list seats: %s\n", error->message);
+        g_dbus_connection_signal_unsubscribe (connection, subscription_id);
+        return FALSE;
+    }
+
+    g_autoptr(GVariant) objects = g_variant_get_child_value (result, 0);
+    g_autoptr(GString) event = start_event ("Seats", "/org/freedesktop/DisplayManager");
+    g_string_append (event, ",\"seats\":");
+    append_seats_json (event, objects);
+    g_string_truncate (event, event->len - 1); /* newline */
+    print_event (event);
+
+    g_main_loop_run (loop);
+    g_dbus_connection_signal_unsubscribe (connection, subscription_id);
+
+    return FALSE;
+}
+
+/* Print the events the daemon recorded, oldest first, with the time since the first one shown */
+static gboolean
+dump_events (const gchar *path)
+{
+    g_autofree gchar *data = NULL;
+    gsize length;
+    g_autoptr(GError) error = NULL;
+    if (!g_file_get_contents (path, &data, &length, &error))
+    {
+        g_printerr ("Unable to read events: %s\n", error->message);
+        return FALSE;
+    }
+
+    const FlightRecorderHeader *header = (const FlightRecorderHeader *) data;
+    if (length < sizeof (FlightRecorderHeader) ||
+        memcmp (header->magic, FLIGHT_RECORDER_MAGIC, sizeof (header->magic)) != 0 ||
+        header->event_size != sizeof (FlightRecorderEvent) ||
+        header->n_events == 0 ||
+        length < sizeof (FlightRecorderHeader) + (gsize) header->n_events * sizeof (FlightRecorderEvent))
+    {
+        g_printerr ("%s is not a LightDM events file\n", path);
+        return FALSE;
+    }
+
+    const FlightRecorderEvent *events = (const FlightRecorderEvent *) (header + 1);
+    guint32 n_written = header->n_written;
+    guint32 start = n_written > header->n_events ? n_written - header->n_events : 0;
+    gint64 first_time = 0, last_time = 0;
+    for (guint32 i = start; i != n_written; i++)
+    {
+        const FlightRecorderEvent *event = &events[i % header->n_events];
+        if (event->type == 0)
+            continue;
+        if (first_time == 0)
+            first_time = last_time = event->time;
+
+        g_autoptr(GString) line = g_string_new ("");
+        g_string_append_printf (line, "%11.6f %+10.6f %-22s", (event->time - first_time) / 1000000.0, (event->time - last_time) / 1000000.0, flight_recorder_get_event_name (event->type));
+        if (event->id != 0)
+            g_string_append_printf (line, " pid=%d", event->id);
+        if (event->type == FLIGHT_RECORDER_EVENT_PROCESS_EXIT && WIFEXITED (event->value))
+            g_string_append_printf (line, " status=%d", WEXITSTATUS (event->value));
+        else if (event->type == FLIGHT_RECORDER_EVENT_PROCESS_EXIT && WIFSIGNALED (event->value))
+            g_string_append_printf (line, " signal=%d", WTERMSIG (event->value));
+        else if (event->type == FLIGHT_RECORDER_EVENT_VT_ACTIVATE)
+            g_string_append_printf (line, " vt=%" G_GINT64_FORMAT, event->value);
+        if (event->subject[0] != '\0')
+            g_string_append_printf (line, " %.*s", (int) sizeof (event->subject), event->subject);
+        if (event->detail[0] != '\0')
+            g_string_append_printf (line, " %.*s", (int) sizeof (event->detail), event->detail);
+        g_print ("%s\n", line->str);
+
+        last_time = event->time;
+    }
+
+    return TRUE;
 }
 
 int
@@ -127,10 +946,14 @@ main (int argc, char **argv)
                         "  switch-to-user USERNAME [SESSION]                    Switch to a user session\n"
                         "  switch-to-guest [SESSION]                            Switch to a guest session\n"
                         "  lock                                                 Lock the current seat\n"
-                        "  list-seats                                           List the active seats\n"
+                        "  list-seats [--json]                                  List the active seats\n"
+                        "  stats                                                Show display manager statistics\n"
                         "  add-nested-seat [--fullscreen|--screen DIMENSIONS]   Start a nested display\n"
                         "  add-local-x-seat DISPLAY_NUMBER                      Add a local X seat\n"
-                        "  add-seat TYPE [NAME=VALUE...]                        Add a dynamic seat\n");
+                        "  add-seat TYPE [NAME=VALUE...]                        Add a dynamic seat\n"
+                        "  batch                                                Run commands read from standard input\n"
+                        "  monitor                                              Print seat and session changes as JSON lines\n"
+                        "  dump-events [FILE]                                   Print the events recorded by the display manager\n");
             return EXIT_SUCCESS;
         }
         else if (strcmp (arg, "-v") == 0 || strcmp (arg, "--version") == 0)
@@ -156,6 +979,19 @@ main (int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    /* Works from the file so it can be used when the display manager isn't responding */
+    if (strcmp (argv[arg_index], "dump-events") == 0)
+    {
+        if (argc - arg_index > 2)
+        {
+            g_printerr ("Usage dump-events [FILE]\n");
+            usage ();
+            return EXIT_FAILURE;
+        }
+
+        return dump_events (arg_index + 1 < argc ? argv[arg_index + 1] : RUN_DIR "/events") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     g_autoptr(GError) error = NULL;
     dm_proxy = g_dbus_proxy_new_for_bus_sync (bus_type,
                                               G_DBUS_PROXY_FLAGS_NONE,
@@ -175,186 +1011,155 @@ main (int argc, char **argv)
     arg_index++;
     gint n_options = argc - arg_index;
     gchar **options = argv + arg_index;
-    if (strcmp (command, "switch-to-greeter") == 0)
+    if (strcmp (command, "batch") == 0)
     {
         if (n_options != 0)
         {
-            g_printerr ("Usage switch-to-greeter\n");
+            g_printerr ("Usage batch\n");
             usage ();
             return EXIT_FAILURE;
         }
 
-        if (!g_dbus_proxy_call_sync (get_seat_proxy (),
-                                     "SwitchToGreeter",
-                                     g_variant_new ("()"),
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     NULL,
-                                     &error))
-        {
-            g_printerr ("Unable to switch to greeter: %s\n", error->message);
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
+        return run_batch () ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    else if (strcmp (command, "switch-to-user") == 0)
+    else if (strcmp (command, "monitor") == 0)
     {
-        if (n_options < 1 || n_options > 2)
+        if (n_options != 0)
         {
-            g_printerr ("Usage switch-to-user USERNAME [SESSION]\n");
+            g_printerr ("Usage monitor\n");
             usage ();
             return EXIT_FAILURE;
         }
 
-        const gchar *username = options[0];
-        const gchar *session = "";
-        if (n_options == 2)
-            session = options[1];
-
-        if (!g_dbus_proxy_call_sync (get_seat_proxy (),
-                                     "SwitchToUser",
-                                     g_variant_new ("(ss)", username, session),
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     NULL,
-                                     &error))
-        {
-            g_printerr ("Unable to switch to user %s: %s\n", username, error->message);
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
+        return run_monitor () ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    else if (strcmp (command, "switch-to-guest") == 0)
+    else if (is_request_command (command))
     {
-        if (n_options > 1)
+        g_autofree gchar *usage_text = NULL;
+        Request *request = parse_request (command, n_options, options, &usage_text);
+        if (!request)
         {
-            g_printerr ("Usage switch-to-guest [SESSION]\n");
+            g_printerr ("%s\n", usage_text);
             usage ();
             return EXIT_FAILURE;
         }
 
-        const gchar *session = "";
-        if (n_options == 1)
-            session = options[0];
-
-        if (!g_dbus_proxy_call_sync (get_seat_proxy (),
-                                     "SwitchToGuest",
-                                     g_variant_new ("(s)", session),
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     NULL,
-                                     &error))
-        {
-            g_printerr ("Unable to switch to guest: %s\n", error->message);
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
+        gboolean result = run_request (g_dbus_proxy_get_connection (dm_proxy), request);
+        request_free (request);
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    else if (strcmp (command, "lock") == 0)
+    else if (strcmp (command, "stats") == 0)
     {
         if (n_options != 0)
         {
-            g_printerr ("Usage lock\n");
+            g_printerr ("Usage stats\n");
             usage ();
             return EXIT_FAILURE;
         }
 
-        if (!g_dbus_proxy_call_sync (get_seat_proxy (),
-                                     "Lock",
-                                     g_variant_new ("()"),
-                                     G_DBUS_CALL_FLAGS_NONE,
-                                     -1,
-                                     NULL,
-                                     &error))
-        {
-            g_printerr ("Unable to lock seat: %s\n", error->message);
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
-    }
-    else if (strcmp (command, "list-seats") == 0)
-    {
-        if (!g_dbus_proxy_get_name_owner (dm_proxy))
+        g_autoptr(GVariant) result = g_dbus_connection_call_sync (g_dbus_proxy_get_connection (dm_proxy),
+                                                                  "org.freedesktop.DisplayManager",
+                                                                  "/org/freedesktop/DisplayManager",
+                                                                  "org.freedesktop.DisplayManager.Statistics",
+                                                                  "GetStatistics",
+                                                                  NULL,
+                                                                  G_VARIANT_TYPE ("(a{sv})"),
+                                                                  G_DBUS_CALL_FLAGS_NONE,
+                                                                  -1,
+                                                                  NULL,
+                                                                  &error);
+        if (!result)
         {
-            g_printerr ("Unable to contact display manager\n");
+            g_printerr ("Unable to get statistics: %s\n", error->message);
             return EXIT_FAILURE;
         }
-        g_autoptr(GVariant) seats = g_dbus_proxy_get_cached_property (dm_proxy, "Seats");
 
-        g_autoptr(GVariantIter) seat_iter = NULL;
-        g_variant_get (seats, "ao", &seat_iter);
-        gchar *seat_path;
-        while (g_variant_iter_loop (seat_iter, "&o", &seat_path))
-        {
-            gchar *seat_name;
-            g_autoptr(GDBusProxy) proxy = NULL;
+        g_autoptr(GVariant) statistics = g_variant_get_child_value (result, 0);
+        GVariantDict dict;
+        g_variant_dict_init (&dict, statistics);
 
-            if (g_str_has_prefix (seat_path, "/org/freedesktop/DisplayManager/"))
-                seat_name = seat_path + strlen ("/org/freedesktop/DisplayManager/");
-            else
-                seat_name = seat_path;
-
-            proxy = g_dbus_proxy_new_sync (g_dbus_proxy_get_connection (dm_proxy),
-                                           G_DBUS_PROXY_FLAGS_NONE,
-                                           NULL,
-                                           "org.freedesktop.DisplayManager",
-                                           seat_path,
-                                           "org.freedesktop.DisplayManager.Seat",
-                                           NULL,
-                                           NULL);
-            if (!proxy || !g_dbus_proxy_get_name_owner (proxy))
-                continue;
+        guint32 n_seats = 0, n_sessions = 0;
+        g_variant_dict_lookup (&dict, "seats", "u", &n_seats);
+        g_variant_dict_lookup (&dict, "sessions", "u", &n_sessions);
+        g_print ("Seats: %u\n", n_seats);
+        g_print ("Sessions: %u\n", n_sessions);
+
+        guint64 n_started = 0, n_succeeded = 0, n_failed = 0;
+        g_variant_dict_lookup (&dict, "authentications-started", "t", &n_started);
+        g_variant_dict_lookup (&dict, "authentications-succeeded", "t", &n_succeeded);
+        g_variant_dict_lookup (&dict, "authentications-failed", "t", &n_failed);
+        g_print ("Authentications: %" G_GUINT64_FORMAT " started, %" G_GUINT64_FORMAT " succeeded, %" G_GUINT64_FORMAT " failed\n", n_started, n_succeeded, n_failed);
 
-            g_print ("%s\n", seat_name);
-            g_auto(GStrv) property_names = g_dbus_proxy_get_cached_property_names (proxy);
-            for (int i = 0; property_names[i]; i++)
+        g_autoptr(GVariantIter) crashes = NULL;
+        if (g_variant_dict_lookup (&dict, "crashes", "a(sttb)", &crashes))
+        {
+            const gchar *name;
+            guint64 n_recent, n_total;
+            gboolean fallback;
+            while (g_variant_iter_loop (crashes, "(&sttb)", &name, &n_recent, &n_total, &fallback))
             {
-                if (strcmp (property_names[i], "Sessions") == 0)
-                    continue;
+                if (n_total > 0)
+                    g_print ("Crashes on %s: %" G_GUINT64_FORMAT " recent, %" G_GUINT64_FORMAT " total%s\n", name, n_recent, n_total, fallback ? ", using fallback configuration" : "");
+            }
+        }
 
-                g_autoptr(GVariant) value = g_dbus_proxy_get_cached_property (proxy, property_names[i]);
-                g_print ("  %s=%s\n", property_names[i], g_variant_print (value, FALSE));
+        g_autoptr(GVariant) latencies = g_variant_dict_lookup_value (&dict, "latencies", G_VARIANT_TYPE ("(ata(stttat))"));
+        if (latencies)
+        {
+            g_autoptr(GVariantIter) span_iter = NULL;
+            g_variant_get (latencies, "(@ata(stttat))", NULL, &span_iter);
+            g_print ("Latencies:\n");
+            const gchar *name;
+            guint64 count, total, max;
+            while (g_variant_iter_loop (span_iter, "(&stttat)", &name, &count, &total, &max, NULL))
+            {
+                if (count > 0)
+                    g_print ("  %s: %" G_GUINT64_FORMAT " times, %.3fms average, %.3fms max\n", name, count, total / (count * 1000.0), max / 1000.0);
             }
+        }
 
-            g_autoptr(GVariant) sessions = g_dbus_proxy_get_cached_property (proxy, "Sessions");
-            if (!sessions)
-                continue;
+        guint64 n_packets, n_invalid, n_rate_limited, n_accepted, n_declined;
+        if (g_variant_dict_lookup (&dict, "xdmcp", "(ttttt)", &n_packets, &n_invalid, &n_rate_limited, &n_accepted, &n_declined))
+            g_print ("XDMCP: %" G_GUINT64_FORMAT " packets (%" G_GUINT64_FORMAT " invalid, %" G_GUINT64_FORMAT " rate limited), %" G_GUINT64_FORMAT " sessions accepted, %" G_GUINT64_FORMAT " declined\n",
+                     n_packets, n_invalid, n_rate_limited, n_accepted, n_declined);
 
-            g_autoptr(GVariantIter) session_iter = NULL;
-            g_variant_get (sessions, "ao", &session_iter);
-            const gchar *session_path;
-            while (g_variant_iter_loop (session_iter, "&o", &session_path))
-            {
-                const gchar *session_name;
-                if (g_str_has_prefix (session_path, "/org/freedesktop/DisplayManager/"))
-                    session_name = session_path + strlen ("/org/freedesktop/DisplayManager/");
-                else
-                    session_name = session_path;
-
-                g_autoptr(GDBusProxy) session_proxy = g_dbus_proxy_new_sync (g_dbus_proxy_get_connection (dm_proxy),
-                                                                             G_DBUS_PROXY_FLAGS_NONE,
-                                                                             NULL,
-                                                                             "org.freedesktop.DisplayManager",
-                                                                             session_path,
-                                                                             "org.freedesktop.DisplayManager.Session",
-                                                                             NULL,
-                                                                             NULL);
-                if (!session_proxy || !g_dbus_proxy_get_name_owner (session_proxy))
-                    continue;
+        guint64 n_vnc_started, n_vnc_queued;
+        guint32 n_vnc_waiting, n_vnc_active;
+        if (g_variant_dict_lookup (&dict, "vnc", "(@a(stt)ttuu)", NULL, &n_vnc_started, &n_vnc_queued, &n_vnc_waiting, &n_vnc_active))
+            g_print ("VNC: %" G_GUINT64_FORMAT " connections started, %" G_GUINT64_FORMAT " queued, %u waiting, %u active\n",
+                     n_vnc_started, n_vnc_queued, n_vnc_waiting, n_vnc_active);
 
-                g_print ("  %s\n", session_name);
-                g_auto(GStrv) property_names = g_dbus_proxy_get_cached_property_names (session_proxy);
-                for (int i = 0; property_names[i]; i++)
-                {
-                    if (strcmp (property_names[i], "Seat") == 0)
-                        continue;
+        g_autoptr(GVariant) stall_counts = NULL;
+        guint64 stall_max;
+        if (g_variant_dict_lookup (&dict, "main-loop-stalls", "(@at@att)", NULL, &stall_counts, &stall_max))
+        {
+            guint64 n_stalls = 0;
+            GVariantIter iter;
+            g_variant_iter_init (&iter, stall_counts);
+            guint64 n;
+            while (g_variant_iter_next (&iter, "t", &n))
+                n_stalls += n;
+            g_print ("Main loop stalls: %" G_GUINT64_FORMAT ", %.3fs max\n", n_stalls, stall_max / 1000000.0);
+        }
 
-                    g_autoptr(GVariant) value = g_dbus_proxy_get_cached_property (session_proxy, property_names[i]);
-                    g_print ("    %s=%s\n", property_names[i], g_variant_print (value, FALSE));
-                }
-            }
+        g_autoptr(GVariantIter) memory_pools = NULL;
+        guint64 n_trims;
+        if (g_variant_dict_lookup (&dict, "memory", "(a(stt)t)", &memory_pools, &n_trims))
+        {
+            g_print ("Memory (current/peak):\n");
+            const gchar *name;
+            guint64 current, peak;
+            while (g_variant_iter_loop (memory_pools, "(&stt)", &name, &current, &peak))
+                g_print ("  %s: %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " bytes\n", name, current, peak);
+            g_print ("  Heap trims: %" G_GUINT64_FORMAT "\n", n_trims);
         }
 
+        gint64 user_cache_age;
+        if (g_variant_dict_lookup (&dict, "user-cache-age", "x", &user_cache_age) && user_cache_age >= 0)
+            g_print ("User information age: %" G_GINT64_FORMAT "s\n", user_cache_age);
+
+        g_variant_dict_clear (&dict);
+
         return EXIT_SUCCESS;
     }
     else if (strcmp (command, "add-nested-seat") == 0)
@@ -430,94 +1235,6 @@ main (int argc, char **argv)
         g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
         g_main_loop_run (loop);
     }
-    else if (strcmp (command, "add-local-x-seat") == 0)
-    {
-        if (n_options != 1)
-        {
-            g_printerr ("Usage add-seat DISPLAY_NUMBER\n");
-            usage ();
-            return EXIT_FAILURE;
-        }
-
-        gint display_number = atoi (options[0]);
-        g_autoptr(GVariant) result = g_dbus_proxy_call_sync (dm_proxy,
-                                                             "AddLocalXSeat",
-                                                             g_variant_new ("(i)", display_number),
-                                                             G_DBUS_CALL_FLAGS_NONE,
-                                                             -1,
-                                                             NULL,
-                                                             &error);
-        if (!result)
-        {
-            g_printerr ("Unable to add local X seat: %s\n", error->message);
-            return EXIT_FAILURE;
-        }
-
-        if (!g_variant_is_of_type (result, G_VARIANT_TYPE ("(o)")))
-        {
-            g_printerr ("Unexpected response to AddLocalXSeat: %s\n", g_variant_get_type_string (result));
-            return EXIT_FAILURE;
-        }
-
-        const gchar *path;
-        g_variant_get (result, "(&o)", &path);
-        g_print ("%s\n", path);
-
-        return EXIT_SUCCESS;
-    }
-    else if (strcmp (command, "add-seat") == 0)
-    {
-        if (n_options < 1)
-        {
-            g_printerr ("Usage add-seat TYPE [NAME=VALUE...]\n");
-            usage ();
-            return EXIT_FAILURE;
-        }
-
-        const gchar *type = options[0];
-        g_autoptr(GVariantBuilder) properties = g_variant_builder_new (G_VARIANT_TYPE ("a(ss)"));
-
-        for (gint i = 1; i < n_options; i++)
-        {
-            g_autofree gchar *property = g_strdup (options[i]);
-            gchar *name = property;
-            gchar *value = strchr (property, '=');
-            if (value)
-            {
-                *value = '\0';
-                value++;
-            }
-            else
-               value = "";
-
-            g_variant_builder_add_value (properties, g_variant_new ("(ss)", name, value));
-        }
-
-        g_autoptr(GVariant) result = g_dbus_proxy_call_sync (dm_proxy,
-                                                             "AddSeat",
-                                                             g_variant_new ("(sa(ss))", type, properties),
-                                                             G_DBUS_CALL_FLAGS_NONE,
-                                                             -1,
-                                                             NULL,
-                                                             &error);
-        if (!result)
-        {
-            g_printerr ("Unable to add seat: %s\n", error->message);
-            return EXIT_FAILURE;
-        }
-
-        if (!g_variant_is_of_type (result, G_VARIANT_TYPE ("(o)")))
-        {
-            g_printerr ("Unexpected response to AddSeat: %s\n", g_variant_get_type_string (result));
-            return EXIT_FAILURE;
-        }
-
-        const gchar *path;
-        g_variant_get (result, "(&o)", &path);
-        g_print ("%s\n", path);
-
-        return EXIT_SUCCESS;
-    }
 
     g_printerr ("Unknown command %s\n", command);
     usage ();
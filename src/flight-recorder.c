@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib/gstdio.h>
+
+#include "flight-recorder.h"
+
+/*
+ * Events are written into a ring buffer in a memory mapped file, so they
+ * survive the daemon crashing or being killed and can be read with
+ * dm-tool dump-events. Recording is a copy into the mapping, no system calls
+ * are made. The previous file is kept with a .old suffix when the daemon
+ * starts so the events leading up to a restart aren't lost.
+ */
+
+static FlightRecorderHeader *header = NULL;
+static FlightRecorderEvent *events = NULL;
+
+gboolean
+flight_recorder_start (const gchar *path, guint n_events)
+{
+    g_return_val_if_fail (header == NULL, FALSE);
+
+    if (n_events == 0)
+        return FALSE;
+
+    /* Whole number of ring positions for the 32 bit write counter */
+    guint32 size = 1;
+    while (size < n_events && size < (1u << 20))
+        size <<= 1;
+
+    g_autofree gchar *old_path = g_strdup_printf ("%s.old", path);
+    if (g_rename (path, old_path) < 0 && errno != ENOENT)
+        g_debug ("Failed to keep old events file %s: %s", path, strerror (errno));
+
+    int fd = g_open (path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        g_warning ("Failed to open events file %s: %s", path, strerror (errno));
+        return FALSE;
+    }
+
+    gsize length = sizeof (FlightRecorderHeader) + sizeof (FlightRecorderEvent) * size;
+    void *data = MAP_FAILED;
+    if (ftruncate (fd, length) == 0)
+        data = mmap (NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int map_errno = errno;
+    close (fd);
+    if (data == MAP_FAILED)
+    {
+        g_warning ("Failed to map events file %s: %s", path, strerror (map_errno));
+        return FALSE;
+    }
+
+    header = data;
+    memcpy (header->magic, FLIGHT_RECORDER_MAGIC, sizeof (header->magic));
+    header->event_size = sizeof (FlightRecorderEvent);
+    header->n_events = size;
+    header->n_written = 0;
+    events = (FlightRecorderEvent *) (header + 1);
+
+    return TRUE;
+}
+
+void
+flight_recorder_record (FlightRecorderEventType type, gint32 id, gint64 value, const gchar *subject, const gchar *detail)
+{
+    if (!header)
+        return;
+
+    /* Claim the slot atomically so events can be recorded from any thread */
+    guint32 index = (guint32) g_atomic_int_add ((gint *) &header->n_written, 1);
+    FlightRecorderEvent *event = &events[index & (header->n_events - 1)];
+
+    event->time = g_get_monotonic_time ();
+    event->type = type;
+    event->id = id;
+    event->value = value;
+    g_strlcpy (event->subject, subject ? subject : "", sizeof (event->subject));
+    g_strlcpy (event->detail, detail ? detail : "", sizeof (event->detail));
+}
+
+const gchar *
+flight_recorder_get_event_name (guint16 type)
+{
+    switch (type)
+    {
+    case FLIGHT_RECORDER_EVENT_SEAT_START:
+        return "seat-start";
+    case FLIGHT_RECORDER_EVENT_SEAT_STOP:
+        return "seat-stop";
+    case FLIGHT_RECORDER_EVENT_SEAT_STOPPED:
+        return "seat-stopped";
+    case FLIGHT_RECORDER_EVENT_SESSION_ADDED:
+        return "session-added";
+    case FLIGHT_RECORDER_EVENT_SESSION_RUN:
+        return "session-run";
+    case FLIGHT_RECORDER_EVENT_SESSION_STOPPED:
+        return "session-stopped";
+    case FLIGHT_RECORDER_EVENT_SESSION_ACTIVATE:
+        return "session-activate";
+    case FLIGHT_RECORDER_EVENT_GREETER_MESSAGE:
+        return "greeter-message";
+    case FLIGHT_RECORDER_EVENT_PROCESS_START:
+        return "process-start";
+    case FLIGHT_RECORDER_EVENT_PROCESS_EXIT:
+        return "process-exit";
+    case FLIGHT_RECORDER_EVENT_VT_ACTIVATE:
+        return "vt-activate";
+    case FLIGHT_RECORDER_EVENT_LOGIN1_ACTIVATE:
+        return "login1-activate";
+    case FLIGHT_RECORDER_EVENT_LOGIN1_ACTIVE_SESSION_CHANGED:
+        return "login1-active-session";
+    default:
+        return "unknown";
+    }
+}
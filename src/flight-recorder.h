@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define FLIGHT_RECORDER_MAGIC "LDMEVT1"
+
+typedef enum
+{
+    FLIGHT_RECORDER_EVENT_SEAT_START = 1,
+    FLIGHT_RECORDER_EVENT_SEAT_STOP,
+    FLIGHT_RECORDER_EVENT_SEAT_STOPPED,
+    FLIGHT_RECORDER_EVENT_SESSION_ADDED,
+    FLIGHT_RECORDER_EVENT_SESSION_RUN,
+    FLIGHT_RECORDER_EVENT_SESSION_STOPPED,
+    FLIGHT_RECORDER_EVENT_SESSION_ACTIVATE,
+    FLIGHT_RECORDER_EVENT_GREETER_MESSAGE,
+    FLIGHT_RECORDER_EVENT_PROCESS_START,
+    FLIGHT_RECORDER_EVENT_PROCESS_EXIT,
+    FLIGHT_RECORDER_EVENT_VT_ACTIVATE,
+    FLIGHT_RECORDER_EVENT_LOGIN1_ACTIVATE,
+    FLIGHT_RECORDER_EVENT_LOGIN1_ACTIVE_SESSION_CHANGED
+} FlightRecorderEventType;
+
+/* Start of the file, followed by n_events events */
+typedef struct
+{
+    gchar magic[8];
+    guint32 event_size;
+    guint32 n_events;
+    /* Number of events recorded, the next one goes at n_written % n_events */
+    guint32 n_written;
+    guint32 reserved;
+} FlightRecorderHeader;
+
+typedef struct
+{
+    /* Monotonic time in microseconds */
+    gint64 time;
+    guint16 type;
+    guint16 reserved;
+    /* Process ID where there is one */
+    gint32 id;
+    gint64 value;
+    gchar subject[16];
+    gchar detail[24];
+} FlightRecorderEvent;
+
+gboolean flight_recorder_start (const gchar *path, guint n_events);
+
+void flight_recorder_record (FlightRecorderEventType type, gint32 id, gint64 value, const gchar *subject, const gchar *detail);
+
+const gchar *flight_recorder_get_event_name (guint16 type);
+
+G_END_DECLS
+
+#endif /* FLIGHT_RECORDER_H_ */
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <glib-unix.h>
+
+#include "greeter-host.h"
+#include "configuration.h"
+#include "process.h"
+
+/*
+ * Seats without a display of their own (VNC and XDMCP) can share one greeter
+ * process instead of running a greeter session each. The daemon starts the
+ * command in shared-greeter-command once and sends it an OPEN message for each
+ * display to show a greeter on. Each greeter gets a channel: the daemon talks
+ * the normal greeter protocol over a pair of pipes, and the data is forwarded
+ * over the one host socket tagged with the channel it belongs to.
+ */
+
+/* Largest message accepted from the host */
+#define MAX_MESSAGE_LENGTH 65536
+
+typedef struct
+{
+    guint id;
+
+    /* Daemon end of the greeter protocol */
+    int to_greeter_output;
+    int from_greeter_input;
+    guint to_greeter_watch;
+
+    GreeterHostClosedFunc closed_func;
+    gpointer user_data;
+} Channel;
+
+/* Process running the shared greeter */
+static Process *host_process = NULL;
+
+/* Daemon end of the host socket */
+static int host_fd = -1;
+static guint host_watch = 0;
+
+/* Data read from the host that doesn't make a complete message yet */
+static GByteArray *host_buffer = NULL;
+
+/* Open channels by ID */
+static GHashTable *channels = NULL;
+static guint next_channel_id = 1;
+
+/* User to run the host as */
+static uid_t host_uid = 0;
+static gid_t host_gid = 0;
+
+gboolean
+greeter_host_get_is_configured (void)
+{
+    g_autofree gchar *command = config_get_string (config_get_instance (), "LightDM", "shared-greeter-command");
+    return command != NULL && command[0] != '\0';
+}
+
+static gboolean
+write_all (int fd, const guint8 *data, gsize length)
+{
+    while (length > 0)
+    {
+        ssize_t n_written = write (fd, data, length);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+            return FALSE;
+        data += n_written;
+        length -= n_written;
+    }
+
+    return TRUE;
+}
+
+static void
+send_message (guint channel, GreeterHostMessageType type, const guint8 *data, gsize length)
+{
+    if (host_fd < 0)
+        return;
+
+    GreeterHostHeader header = { channel, type, length };
+    if (!write_all (host_fd, (const guint8 *) &header, sizeof (header)) ||
+        !write_all (host_fd, data, length))
+        g_warning ("Failed to write to shared greeter: %s", strerror (errno));
+}
+
+static void
+channel_free (Channel *channel)
+{
+    g_clear_handle_id (&channel->to_greeter_watch, g_source_remove);
+    if (channel->to_greeter_output >= 0)
+        close (channel->to_greeter_output);
+    if (channel->from_greeter_input >= 0)
+        close (channel->from_greeter_input);
+    g_free (channel);
+}
+
+/* The channel has gone from the host side, let the owner know */
+static void
+channel_closed (Channel *channel)
+{
+    GreeterHostClosedFunc closed_func = channel->closed_func;
+    gpointer user_data = channel->user_data;
+
+    g_hash_table_remove (channels, GUINT_TO_POINTER (channel->id));
+    if (closed_func)
+        closed_func (user_data);
+}
+
+static gboolean
+to_greeter_cb (gint fd, GIOCondition condition, gpointer data)
+{
+    Channel *channel = data;
+
+    guint8 buffer[4096];
+    ssize_t n_read = read (fd, buffer, sizeof (buffer));
+    if (n_read < 0 && errno == EINTR)
+        return G_SOURCE_CONTINUE;
+    if (n_read > 0)
+    {
+        send_message (channel->id, GREETER_HOST_MESSAGE_DATA, buffer, n_read);
+        return G_SOURCE_CONTINUE;
+    }
+
+    /* Daemon end was closed, this happens when the greeter is stopped */
+    channel->to_greeter_watch = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static void
+stop_host (void)
+{
+    g_clear_handle_id (&host_watch, g_source_remove);
+    if (host_fd >= 0)
+        close (host_fd);
+    host_fd = -1;
+    g_clear_pointer (&host_buffer, g_byte_array_unref);
+
+    /* Every greeter went with the host */
+    if (channels)
+    {
+        g_autoptr(GList) ids = g_hash_table_get_keys (channels);
+        for (GList *link = ids; link; link = link->next)
+        {
+            Channel *channel = g_hash_table_lookup (channels, link->data);
+            if (channel)
+                channel_closed (channel);
+        }
+    }
+}
+
+static void
+handle_message (const GreeterHostHeader *header, const guint8 *data)
+{
+    Channel *channel = g_hash_table_lookup (channels, GUINT_TO_POINTER (header->channel));
+    if (!channel)
+        return;
+
+    switch (header->type)
+    {
+    case GREETER_HOST_MESSAGE_DATA:
+        if (!write_all (channel->from_greeter_input, data, header->length))
+            g_warning ("Failed to pass data from shared greeter: %s", strerror (errno));
+        break;
+    case GREETER_HOST_MESSAGE_CLOSE:
+        g_debug ("Shared greeter closed channel %u", channel->id);
+        channel_closed (channel);
+        break;
+    default:
+        g_debug ("Ignoring unknown message %u from shared greeter", header->type);
+        break;
+    }
+}
+
+static gboolean
+host_read_cb (gint fd, GIOCondition condition, gpointer data)
+{
+    guint8 buffer[4096];
+    ssize_t n_read = recv (fd, buffer, sizeof (buffer), MSG_DONTWAIT);
+    if (n_read < 0 && (errno == EINTR || errno == EAGAIN))
+        return G_SOURCE_CONTINUE;
+    if (n_read <= 0)
+    {
+        g_debug ("Shared greeter closed its socket");
+        host_watch = 0;
+        stop_host ();
+        return G_SOURCE_REMOVE;
+    }
+
+    g_byte_array_append (host_buffer, buffer, n_read);
+    while (host_buffer->len >= sizeof (GreeterHostHeader))
+    {
+        GreeterHostHeader header;
+        memcpy (&header, host_buffer->data, sizeof (header));
+        if (header.length > MAX_MESSAGE_LENGTH)
+        {
+            g_warning ("Shared greeter sent a message of %u bytes, disconnecting it", header.length);
+            host_watch = 0;
+            stop_host ();
+            return G_SOURCE_REMOVE;
+        }
+        if (host_buffer->len < sizeof (header) + header.length)
+            break;
+
+        handle_message (&header, host_buffer->data + sizeof (header));
+        if (!host_buffer)
+            return G_SOURCE_REMOVE;
+        g_byte_array_remove_range (host_buffer, 0, sizeof (header) + header.length);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+host_stopped_cb (Process *process)
+{
+    g_debug ("Shared greeter stopped");
+    stop_host ();
+    if (host_process == process)
+        g_clear_object (&host_process);
+}
+
+static void
+host_run (Process *process, gpointer user_data)
+{
+    /* Run as the greeter user, only async-signal-safe calls here */
+    if (getuid () == 0)
+    {
+        if (setgroups (1, &host_gid) != 0 || setgid (host_gid) != 0 || setuid (host_uid) != 0)
+            _exit (EXIT_FAILURE);
+    }
+}
+
+static gboolean
+start_host (void)
+{
+    if (host_fd >= 0)
+        return TRUE;
+
+    g_autofree gchar *command = config_get_string (config_get_instance (), "LightDM", "shared-greeter-command");
+    g_autofree gchar *username = config_get_string (config_get_instance (), "LightDM", "greeter-user");
+    struct passwd *entry = getpwnam (username);
+    if (!entry)
+    {
+        g_warning ("Can't run shared greeter, unknown greeter user %s", username);
+        return FALSE;
+    }
+    host_uid = entry->pw_uid;
+    host_gid = entry->pw_gid;
+
+    int fds[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        g_warning ("Failed to create shared greeter socket: %s", strerror (errno));
+        return FALSE;
+    }
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+
+    host_process = process_new (host_run, NULL);
+    process_set_clear_environment (host_process, TRUE);
+    process_set_command (host_process, command);
+    g_autofree gchar *fd_value = g_strdup_printf ("%d", fds[1]);
+    process_set_env (host_process, GREETER_HOST_FD_ENV, fd_value);
+    process_set_env (host_process, "PATH", "/usr/local/bin:/usr/bin:/bin");
+    process_set_env (host_process, "HOME", entry->pw_dir);
+    process_set_env (host_process, "USER", entry->pw_name);
+    g_autofree gchar *log_dir = config_get_string (config_get_instance (), "LightDM", "log-directory");
+    g_autofree gchar *log_file = g_build_filename (log_dir, "shared-greeter.log", NULL);
+    gboolean backup_logs = config_get_boolean (config_get_instance (), "LightDM", "backup-logs");
+    process_set_log_file (host_process, log_file, TRUE, log_file_get_mode (backup_logs));
+    process_set_priority (host_process, PROCESS_PRIORITY_INTERACTIVE);
+    g_signal_connect (host_process, PROCESS_SIGNAL_STOPPED, G_CALLBACK (host_stopped_cb), NULL);
+
+    g_debug ("Starting shared greeter: %s", command);
+    gboolean result = process_start (host_process, FALSE);
+    close (fds[1]);
+    if (!result)
+    {
+        close (fds[0]);
+        g_clear_object (&host_process);
+        return FALSE;
+    }
+
+    host_fd = fds[0];
+    host_buffer = g_byte_array_new ();
+    host_watch = g_unix_fd_add (host_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, host_read_cb, NULL);
+
+    return TRUE;
+}
+
+static void
+add_value (GString *data, const gchar *name, const gchar *value)
+{
+    g_string_append_printf (data, "%s=%s", name, value ? value : "");
+    g_string_append_c (data, '\0');
+}
+
+guint
+greeter_host_open (const gchar *seat_name, const gchar *display, XAuthority *authority,
+                   int *to_greeter_input, int *from_greeter_output,
+                   GreeterHostClosedFunc closed_func, gpointer user_data)
+{
+    g_return_val_if_fail (display != NULL, 0);
+
+    if (!start_host ())
+        return 0;
+
+    int to_greeter_pipe[2], from_greeter_pipe[2];
+    if (pipe (to_greeter_pipe) != 0)
+    {
+        g_warning ("Failed to create pipes: %s", strerror (errno));
+        return 0;
+    }
+    if (pipe (from_greeter_pipe) != 0)
+    {
+        g_warning ("Failed to create pipes: %s", strerror (errno));
+        close (to_greeter_pipe[0]);
+        close (to_greeter_pipe[1]);
+        return 0;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl (to_greeter_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl (from_greeter_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    if (!channels)
+        channels = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) channel_free);
+
+    Channel *channel = g_malloc0 (sizeof (Channel));
+    channel->id = next_channel_id++;
+    channel->to_greeter_output = to_greeter_pipe[0];
+    channel->from_greeter_input = from_greeter_pipe[1];
+    channel->closed_func = closed_func;
+    channel->user_data = user_data;
+    channel->to_greeter_watch = g_unix_fd_add (channel->to_greeter_output, G_IO_IN | G_IO_HUP, to_greeter_cb, channel);
+    g_hash_table_insert (channels, GUINT_TO_POINTER (channel->id), channel);
+
+    g_autoptr(GString) data = g_string_new ("");
+    add_value (data, "LIGHTDM_SEAT", seat_name);
+    add_value (data, "DISPLAY", display);
+    if (authority)
+    {
+        add_value (data, "XAUTH_NAME", x_authority_get_authorization_name (authority));
+        g_autoptr(GString) hex = g_string_new ("");
+        const guint8 *auth_data = x_authority_get_authorization_data (authority);
+        for (gsize i = 0; i < x_authority_get_authorization_data_length (authority); i++)
+            g_string_append_printf (hex, "%02x", auth_data[i]);
+        add_value (data, "XAUTH_DATA", hex->str);
+    }
+    g_debug ("Opening shared greeter channel %u on display %s", channel->id, display);
+    send_message (channel->id, GREETER_HOST_MESSAGE_OPEN, (const guint8 *) data->str, data->len);
+
+    *to_greeter_input = to_greeter_pipe[1];
+    *from_greeter_output = from_greeter_pipe[0];
+
+    return channel->id;
+}
+
+void
+greeter_host_close (guint channel)
+{
+    if (!channels || !g_hash_table_contains (channels, GUINT_TO_POINTER (channel)))
+        return;
+
+    g_debug ("Closing shared greeter channel %u", channel);
+    send_message (channel, GREETER_HOST_MESSAGE_CLOSE, NULL, 0);
+    g_hash_table_remove (channels, GUINT_TO_POINTER (channel));
+}
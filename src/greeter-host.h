@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef GREETER_HOST_H_
+#define GREETER_HOST_H_
+
+#include <glib.h>
+
+#include "x-authority.h"
+
+/* Environment variable with the file descriptor the greeter host talks to the daemon on */
+#define GREETER_HOST_FD_ENV "LIGHTDM_GREETER_HOST_FD"
+
+/* Messages on the greeter host socket start with this header, in host byte order */
+typedef struct
+{
+    guint32 channel;
+    guint32 type;
+    guint32 length;
+} GreeterHostHeader;
+
+typedef enum
+{
+    /* Daemon to host: show a greeter, data is NUL separated NAME=VALUE pairs
+     * for LIGHTDM_SEAT, DISPLAY, XAUTH_NAME and XAUTH_DATA (hex) */
+    GREETER_HOST_MESSAGE_OPEN,
+    /* Either way: greeter protocol data for this channel */
+    GREETER_HOST_MESSAGE_DATA,
+    /* Either way: the greeter on this channel has gone */
+    GREETER_HOST_MESSAGE_CLOSE
+} GreeterHostMessageType;
+
+typedef void (*GreeterHostClosedFunc)(gpointer user_data);
+
+gboolean greeter_host_get_is_configured (void);
+
+guint greeter_host_open (const gchar *seat_name, const gchar *display, XAuthority *authority,
+                         int *to_greeter_input, int *from_greeter_output,
+                         GreeterHostClosedFunc closed_func, gpointer user_data);
+
+void greeter_host_close (guint channel);
+
+#endif /* GREETER_HOST_H_ */
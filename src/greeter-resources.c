@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "greeter-resources.h"
+#include "configuration.h"
+#include "locale-index.h"
+#include "resource-bundle.h"
+#include "session-catalog.h"
+
+/*
+ * The configuration, session files and installed locales are the same for
+ * every greeter, so they are built once into a sealed bundle that each
+ * greeter maps read-only instead of loading them itself. The bundle is
+ * rebuilt for the next greeter when any of it changes.
+ */
+
+/* Configuration file the daemon was started with, or NULL for the standard locations */
+static gchar *config_path = NULL;
+
+/* Bundle to pass to greeters or -1 if it needs building */
+static int bundle_fd = -1;
+
+/* TRUE if the bundle couldn't be built, so greeters load everything themselves */
+static gboolean bundle_failed = FALSE;
+
+/* Installed locales and the modification times they were found at */
+static GVariant *locales = NULL;
+static gint64 locales_archive_mtime = 0;
+static gint64 locales_dir_mtime = 0;
+
+void
+greeter_resources_set_config_path (const gchar *path)
+{
+    g_free (config_path);
+    config_path = g_strdup (path);
+    greeter_resources_invalidate ();
+}
+
+/* Called when the configuration or session files change */
+void
+greeter_resources_invalidate (void)
+{
+    if (bundle_fd >= 0)
+        close (bundle_fd);
+    bundle_fd = -1;
+    bundle_failed = FALSE;
+}
+
+static void
+catalog_changed_cb (CommonSessionCatalog *catalog)
+{
+    greeter_resources_invalidate ();
+}
+
+static gint64
+get_mtime (const gchar *path)
+{
+    GStatBuf info;
+    if (g_stat (path, &info) < 0)
+        return 0;
+    return info.st_mtime;
+}
+
+static GVariant *
+get_locales (void)
+{
+    gint64 archive_mtime = get_mtime (LOCALE_ARCHIVE);
+    gint64 dir_mtime = get_mtime (SYSTEM_LOCALE_DIR);
+    if (!locales || archive_mtime != locales_archive_mtime || dir_mtime != locales_dir_mtime)
+    {
+        g_clear_pointer (&locales, g_variant_unref);
+        g_autoptr(GPtrArray) index = common_locale_index_scan ();
+        locales = g_variant_ref_sink (common_locale_index_to_variant (index));
+        locales_archive_mtime = archive_mtime;
+        locales_dir_mtime = dir_mtime;
+    }
+
+    return locales;
+}
+
+static void
+add_sessions (GVariantBuilder *sessions, const gchar *key)
+{
+    g_autofree gchar *sessions_dir = config_get_string (config_get_instance (), "LightDM", key);
+    if (!sessions_dir)
+        return;
+
+    CommonSessionCatalog *catalog = common_session_catalog_get_instance (sessions_dir);
+    if (!g_signal_handler_find (catalog, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, catalog_changed_cb, NULL))
+        g_signal_connect (catalog, SESSION_CATALOG_SIGNAL_CHANGED, G_CALLBACK (catalog_changed_cb), NULL);
+
+    g_variant_builder_add (sessions, "{s@" COMMON_SESSION_ENTRIES_TYPE "}", sessions_dir, common_session_catalog_to_variant (catalog));
+}
+
+/* Get the bundle to pass to a greeter, or -1 if not available */
+int
+greeter_resources_get_fd (void)
+{
+    if (bundle_fd >= 0 || bundle_failed)
+        return bundle_fd;
+
+    GVariantBuilder sessions;
+    g_variant_builder_init (&sessions, G_VARIANT_TYPE ("a{s" COMMON_SESSION_ENTRIES_TYPE "}"));
+    add_sessions (&sessions, "sessions-directory");
+    add_sessions (&sessions, "remote-sessions-directory");
+
+    GVariantBuilder contents;
+    g_variant_builder_init (&contents, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&contents, "{sv}", "config", config_get_snapshot (config_get_instance (), config_path));
+    g_variant_builder_add (&contents, "{sv}", "sessions", g_variant_builder_end (&sessions));
+    g_variant_builder_add (&contents, "{sv}", "locales", get_locales ());
+
+    g_autoptr(GError) error = NULL;
+    bundle_fd = common_resource_bundle_create (g_variant_builder_end (&contents), &error);
+    if (bundle_fd < 0)
+    {
+        g_debug ("Not sharing resources with greeters: %s", error->message);
+        bundle_failed = TRUE;
+    }
+
+    return bundle_fd;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef GREETER_RESOURCES_H_
+#define GREETER_RESOURCES_H_
+
+#include <glib.h>
+
+void greeter_resources_set_config_path (const gchar *config_path);
+
+int greeter_resources_get_fd (void);
+
+void greeter_resources_invalidate (void);
+
+#endif /* GREETER_RESOURCES_H_ */
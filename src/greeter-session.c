@@ -16,11 +16,21 @@
 #include <fcntl.h>
 
 #include "greeter-session.h"
+#include "greeter-host.h"
+#include "greeter-resources.h"
+#include "process.h"
+#include "resource-bundle.h"
 
 typedef struct
 {
     /* Greeter running inside this session */
     Greeter *greeter;
+
+    /* Seat to show a shared greeter for, or NULL if the greeter is run in this session */
+    gchar *shared_seat_name;
+
+    /* Channel the shared greeter is connected on */
+    guint host_channel;
 } GreeterSessionPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GreeterSession, greeter_session, SESSION_TYPE)
@@ -39,11 +49,27 @@ greeter_session_get_greeter (GreeterSession *session)
     return priv->greeter;
 }
 
+void
+greeter_session_set_shared (GreeterSession *session, const gchar *seat_name)
+{
+    GreeterSessionPrivate *priv = greeter_session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+
+    g_free (priv->shared_seat_name);
+    priv->shared_seat_name = g_strdup (seat_name);
+    session_set_external (SESSION (session), seat_name != NULL);
+}
+
 static gboolean
 greeter_session_start (Session *session)
 {
     GreeterSessionPrivate *priv = greeter_session_get_instance_private (GREETER_SESSION (session));
 
+    /* The shared greeter is connected when the session is run */
+    if (priv->shared_seat_name)
+        return SESSION_CLASS (greeter_session_parent_class)->start (session);
+
     /* Create a pipe to talk with the greeter */
     int to_greeter_pipe[2], from_greeter_pipe[2];
     if (pipe (to_greeter_pipe) != 0 || pipe (from_greeter_pipe) != 0)
@@ -68,20 +94,78 @@ greeter_session_start (Session *session)
     g_autofree gchar *from_server_value = g_strdup_printf ("%d", to_greeter_output);
     session_set_env (session, "LIGHTDM_FROM_SERVER_FD", from_server_value);
 
+    /* Pass the data shared by all greeters, the duplicate is inherited by the greeter */
+    int resources_fd = greeter_resources_get_fd ();
+    if (resources_fd >= 0)
+        resources_fd = dup (resources_fd);
+    if (resources_fd >= 0)
+    {
+        g_autofree gchar *resources_value = g_strdup_printf ("%d", resources_fd);
+        session_set_env (session, RESOURCE_BUNDLE_FD_ENV, resources_value);
+    }
+
     gboolean result = SESSION_CLASS (greeter_session_parent_class)->start (session);
 
+    /* The greeter is run by the session child, so it inherits this */
+    if (result)
+        process_apply_priority (PROCESS_PRIORITY_INTERACTIVE, session_get_pid (session));
+
     /* Close the session ends of the pipe */
     close (from_greeter_input);
     close (to_greeter_output);
+    if (resources_fd >= 0)
+        close (resources_fd);
 
     return result;
 }
 
+static void
+host_closed_cb (gpointer data)
+{
+    Session *session = data;
+    GreeterSessionPrivate *priv = greeter_session_get_instance_private (GREETER_SESSION (session));
+
+    priv->host_channel = 0;
+    session_stop (session);
+}
+
+static void
+greeter_session_run (Session *session)
+{
+    GreeterSessionPrivate *priv = greeter_session_get_instance_private (GREETER_SESSION (session));
+
+    SESSION_CLASS (greeter_session_parent_class)->run (session);
+
+    if (!priv->shared_seat_name)
+        return;
+
+    int to_greeter_input, from_greeter_output;
+    priv->host_channel = greeter_host_open (priv->shared_seat_name,
+                                            session_get_env (session, "DISPLAY"),
+                                            session_get_x_authority (session),
+                                            &to_greeter_input, &from_greeter_output,
+                                            host_closed_cb, session);
+    if (priv->host_channel == 0)
+    {
+        g_warning ("Failed to show shared greeter on seat %s", priv->shared_seat_name);
+        session_stop (session);
+        return;
+    }
+
+    greeter_set_file_descriptors (priv->greeter, to_greeter_input, from_greeter_output);
+}
+
 static void
 greeter_session_stop (Session *session)
 {
     GreeterSessionPrivate *priv = greeter_session_get_instance_private (GREETER_SESSION (session));
 
+    if (priv->host_channel != 0)
+    {
+        greeter_host_close (priv->host_channel);
+        priv->host_channel = 0;
+    }
+
     greeter_stop (priv->greeter);
 
     SESSION_CLASS (greeter_session_parent_class)->stop (session);
@@ -100,7 +184,10 @@ greeter_session_finalize (GObject *object)
     GreeterSession *self = GREETER_SESSION (object);
     GreeterSessionPrivate *priv = greeter_session_get_instance_private (self);
 
+    if (priv->host_channel != 0)
+        greeter_host_close (priv->host_channel);
     g_clear_object (&priv->greeter);
+    g_free (priv->shared_seat_name);
 
     G_OBJECT_CLASS (greeter_session_parent_class)->finalize (object);
 }
@@ -112,6 +199,7 @@ greeter_session_class_init (GreeterSessionClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
     session_class->start = greeter_session_start;
+    session_class->run = greeter_session_run;
     session_class->stop = greeter_session_stop;
     object_class->finalize = greeter_session_finalize;
 }
@@ -23,6 +23,16 @@ enum {
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Maximum number of greeters connected at once */
+#define MAX_GREETERS 8
+
+/* A greeter connected on this socket */
+typedef struct
+{
+    GSocket *socket;
+    Greeter *greeter;
+} GreeterClient;
+
 typedef struct
 {
     /* Path of socket to use */
@@ -34,11 +44,8 @@ typedef struct
     /* Source for listening for connections */
     GSource *source;
 
-    /* Socket to greeter */
-    GSocket *greeter_socket;
-
-    /* Greeter connected on this socket */
-    Greeter *greeter;
+    /* Greeters connected on this socket */
+    GList *clients;
 } GreeterSocketPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GreeterSocket, greeter_socket, G_TYPE_OBJECT)
@@ -54,42 +61,83 @@ greeter_socket_new (const gchar *path)
     return socket;
 }
 
+static void
+greeter_client_free (GreeterClient *client)
+{
+    g_clear_object (&client->greeter);
+    g_clear_object (&client->socket);
+    g_free (client);
+}
+
 static void
 greeter_disconnected_cb (Greeter *greeter, GreeterSocket *socket)
 {
     GreeterSocketPrivate *priv = greeter_socket_get_instance_private (socket);
 
-    if (greeter == priv->greeter)
+    for (GList *link = priv->clients; link; link = link->next)
     {
-        g_clear_object (&priv->greeter);
-        g_clear_object (&priv->greeter_socket);
+        GreeterClient *client = link->data;
+        if (client->greeter == greeter)
+        {
+            priv->clients = g_list_delete_link (priv->clients, link);
+            g_signal_handlers_disconnect_matched (greeter, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, socket);
+            greeter_client_free (client);
+            return;
+        }
     }
 }
 
+static void
+add_client (GreeterSocket *socket, GSocket *client_socket)
+{
+    GreeterSocketPrivate *priv = greeter_socket_get_instance_private (socket);
+
+    Greeter *greeter = NULL;
+    g_signal_emit (socket, signals[CREATE_GREETER], 0, &greeter);
+    if (!greeter)
+    {
+        g_socket_close (client_socket, NULL);
+        return;
+    }
+
+    /* Each greeter gets its own state, so an unlock greeter can run alongside the main one */
+    GreeterClient *client = g_new0 (GreeterClient, 1);
+    client->socket = g_object_ref (client_socket);
+    client->greeter = greeter;
+    priv->clients = g_list_append (priv->clients, client);
+    g_signal_connect (greeter, GREETER_SIGNAL_DISCONNECTED, G_CALLBACK (greeter_disconnected_cb), socket);
+    greeter_set_file_descriptors (greeter, g_socket_get_fd (client_socket), g_socket_get_fd (client_socket));
+}
+
 static gboolean
 greeter_connect_cb (GSocket *s, GIOCondition condition, GreeterSocket *socket)
 {
     GreeterSocketPrivate *priv = greeter_socket_get_instance_private (socket);
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GSocket) new_socket = g_socket_accept (priv->socket, NULL, &error);
-    if (error)
-        g_warning ("Failed to accept greeter connection: %s", error->message);
-    if (!new_socket)
-        return G_SOURCE_CONTINUE;
-
-    /* Greeter already connected */
-    if (priv->greeter)
+    /* Accept everything that is waiting, the listening socket is non-blocking */
+    while (TRUE)
     {
-        g_socket_close (new_socket, NULL);
-        return G_SOURCE_CONTINUE;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GSocket) new_socket = g_socket_accept (priv->socket, NULL, &error);
+        if (!new_socket)
+        {
+            if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+                g_warning ("Failed to accept greeter connection: %s", error->message);
+            break;
+        }
+
+        if (g_list_length (priv->clients) >= MAX_GREETERS)
+        {
+            g_debug ("Refusing greeter connection, %d greeters already connected", MAX_GREETERS);
+            g_socket_close (new_socket, NULL);
+            continue;
+        }
+
+        /* Connections are handled by Greeter with blocking I/O */
+        g_socket_set_blocking (new_socket, TRUE);
+        add_client (socket, new_socket);
     }
 
-    priv->greeter_socket = g_steal_pointer (&new_socket);
-    g_signal_emit (socket, signals[CREATE_GREETER], 0, &priv->greeter);
-    g_signal_connect (priv->greeter, GREETER_SIGNAL_DISCONNECTED, G_CALLBACK (greeter_disconnected_cb), socket);
-    greeter_set_file_descriptors (priv->greeter, g_socket_get_fd (priv->greeter_socket), g_socket_get_fd (priv->greeter_socket));
-
     return G_SOURCE_CONTINUE;
 }
 
@@ -112,6 +160,7 @@ greeter_socket_start (GreeterSocket *socket, GError **error)
         return FALSE;
     if (!g_socket_listen (priv->socket, error))
         return FALSE;
+    g_socket_set_blocking (priv->socket, FALSE);
 
     priv->source = g_socket_create_source (priv->socket, G_IO_IN, NULL);
     g_source_set_callback (priv->source, (GSourceFunc) greeter_connect_cb, socket, NULL);
@@ -148,8 +197,12 @@ greeter_socket_finalize (GObject *object)
     g_clear_pointer (&priv->path, g_free);
     g_clear_object (&priv->socket);
     g_clear_object (&priv->source);
-    g_clear_object (&priv->greeter_socket);
-    g_clear_object (&priv->greeter);
+    for (GList *link = priv->clients; link; link = link->next)
+    {
+        GreeterClient *client = link->data;
+        g_signal_handlers_disconnect_matched (client->greeter, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
+    }
+    g_list_free_full (priv->clients, (GDestroyNotify) greeter_client_free);
 
     G_OBJECT_CLASS (greeter_socket_parent_class)->finalize (object);
 }
@@ -12,11 +12,21 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <gcrypt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <glib-unix.h>
 
 #include "greeter.h"
 #include "configuration.h"
+#include "session-catalog.h"
 #include "shared-data-manager.h"
+#include "user-list.h"
+#include "logger.h"
+#include "flight-recorder.h"
+#include "memory-usage.h"
+#include "secure-memory.h"
+#include "greeter-protocol.h"
 
 enum {
     PROP_ACTIVE_USERNAME = 1,
@@ -31,6 +41,36 @@ enum {
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Upper bounds of the latency histogram buckets in microseconds, the last bucket has no bound */
+static const guint64 latency_bucket_bounds[] =
+{
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000, 10000000
+};
+#define N_LATENCY_BUCKETS (G_N_ELEMENTS (latency_bucket_bounds) + 1)
+
+typedef struct
+{
+    guint64 count;
+    guint64 total;
+    guint64 max;
+    guint64 buckets[N_LATENCY_BUCKETS];
+} LatencyStatistics;
+
+typedef struct
+{
+    /* Time taken to handle each message from the greeter */
+    LatencyStatistics handled[N_GREETER_MESSAGES];
+
+    /* Time from a greeter request until the daemon sent the reply */
+    LatencyStatistics replied[N_GREETER_MESSAGES];
+
+    /* Number of messages sent to the greeter */
+    guint64 sent[N_SERVER_MESSAGES];
+} GreeterStatistics;
+
+/* Statistics for all greeters since the daemon started */
+static GreeterStatistics statistics;
+
 typedef struct
 {
     /* PAM service to authenticate with */
@@ -39,9 +79,15 @@ typedef struct
 
     /* Buffer for data read from greeter */
     guint8 *read_buffer;
+    gsize read_buffer_size;
     gsize n_read;
     gboolean use_secure_memory;
 
+    /* Memory the secrets in a message are allocated from, wiped once the message is handled */
+    guint8 *secret_arena;
+    gsize secret_arena_size;
+    gsize secret_arena_used;
+
     /* Hints for the greeter */
     GHashTable *hints;
 
@@ -51,8 +97,9 @@ typedef struct
     /* Sequence number of current PAM session */
     guint32 authentication_sequence_number;
 
-    /* Remote session name */
+    /* Remote session name and the user asked to be authenticated for it */
     gchar *remote_session;
+    gchar *remote_username;
 
     /* Currently selected user */
     gchar *active_username;
@@ -60,6 +107,16 @@ typedef struct
     /* PAM session being constructed by the greeter */
     Session *authentication_session;
 
+    /* Authentication left by a greeter that stopped or started ahead of a retry, continued if the same user is authenticated */
+    Session *restored_session;
+
+    /* Remote session and user the restored authentication is for, the remote session is NULL for a local login */
+    gchar *restored_remote_session;
+    gchar *restored_username;
+
+    /* Authentications running alongside the current one, keyed by sequence number */
+    GHashTable *preauthentications;
+
     /* API version the client can speak */
     guint32 api_version;
 
@@ -69,6 +126,12 @@ typedef struct
     /* TRUE if a the greeter can handle a reset; else we will just kill it instead */
     gboolean resettable;
 
+    /* TRUE if the reply to the greeter connecting is held back until its display server is ready */
+    gboolean connect_held;
+
+    /* TRUE if the greeter has connected and is waiting for the reply */
+    gboolean connect_pending;
+
     /* TRUE if a user has been authenticated and the session requested to start */
     gboolean start_session;
 
@@ -89,44 +152,106 @@ typedef struct
     /* Communication channels to communicate with */
     int to_greeter_input;
     int from_greeter_output;
-    GIOChannel *to_greeter_channel;
     GIOChannel *from_greeter_channel;
     guint from_greeter_watch;
+
+    /* Messages waiting to be sent to the greeter */
+    GPtrArray *write_queue;
+
+    /* Number of octets of the first queued message already sent */
+    gsize write_offset;
+
+    /* Source to send queued messages */
+    guint write_idle;
+    guint to_greeter_watch;
+
+    /* User list changes are being sent to the greeter from */
+    CommonUserList *user_list;
+
+    /* Users shared data directories have been requested for, replied to in order */
+    GQueue shared_dir_requests;
+
+    /* Protocol statistics for this greeter, and when each request awaiting a reply was received */
+    GreeterStatistics statistics;
+    gint64 request_times[N_GREETER_MESSAGES];
+
+    /* Time the greeter was started or last sent a request, used to close idle remote seats */
+    gint64 last_activity_time;
 } GreeterPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (Greeter, greeter, G_TYPE_OBJECT)
 
-#define API_VERSION 1
-
-/* Messages from the greeter to the server */
-typedef enum
-{
-    GREETER_MESSAGE_CONNECT = 0,
-    GREETER_MESSAGE_AUTHENTICATE,
-    GREETER_MESSAGE_AUTHENTICATE_AS_GUEST,
-    GREETER_MESSAGE_CONTINUE_AUTHENTICATION,
-    GREETER_MESSAGE_START_SESSION,
-    GREETER_MESSAGE_CANCEL_AUTHENTICATION,
-    GREETER_MESSAGE_SET_LANGUAGE,
-    GREETER_MESSAGE_AUTHENTICATE_REMOTE,
-    GREETER_MESSAGE_ENSURE_SHARED_DIR,
-} GreeterMessage;
-
-/* Messages from the server to the greeter */
-typedef enum
-{
-    SERVER_MESSAGE_CONNECTED = 0,
-    SERVER_MESSAGE_PROMPT_AUTHENTICATION,
-    SERVER_MESSAGE_END_AUTHENTICATION,
-    SERVER_MESSAGE_SESSION_RESULT,
-    SERVER_MESSAGE_SHARED_DIR_RESULT,
-    SERVER_MESSAGE_IDLE,
-    SERVER_MESSAGE_RESET,
-    SERVER_MESSAGE_CONNECTED_V2,
-} ServerMessage;
+/* Maximum number of pre-authentications a greeter can have running */
+#define MAX_PREAUTHENTICATIONS 4
+
+/* An authentication started ahead of being needed */
+typedef struct
+{
+    Greeter *greeter;
+    Session *session;
+
+    /* TRUE if SERVER_MESSAGE_END_AUTHENTICATION has been sent for this session */
+    gboolean complete;
+} PreAuthentication;
 
 static gboolean read_cb (GIOChannel *source, GIOCondition condition, gpointer data);
 
+static void
+forget_restored_session (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (priv->restored_session)
+        g_signal_handlers_disconnect_matched (priv->restored_session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, greeter);
+    g_clear_object (&priv->restored_session);
+    g_clear_pointer (&priv->restored_remote_session, g_free);
+    g_clear_pointer (&priv->restored_username, g_free);
+}
+
+static void
+clear_restored_session (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (priv->restored_session)
+        session_stop (priv->restored_session);
+    forget_restored_session (greeter);
+}
+
+static void
+restored_session_stopped_cb (Session *session, Greeter *greeter)
+{
+    forget_restored_session (greeter);
+}
+
+static void
+set_restored_session (Greeter *greeter, Session *session, const gchar *remote_session, const gchar *username)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    clear_restored_session (greeter);
+    priv->restored_session = g_object_ref (session);
+    priv->restored_remote_session = g_strdup (remote_session);
+    priv->restored_username = g_strdup (username);
+    g_signal_connect (session, SESSION_SIGNAL_STOPPED, G_CALLBACK (restored_session_stopped_cb), greeter);
+}
+
+/* Get the restored authentication if it is for this login */
+static Session *
+take_restored_session (Greeter *greeter, const gchar *remote_session, const gchar *username)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (!priv->restored_session ||
+        g_strcmp0 (priv->restored_remote_session, remote_session) != 0 ||
+        g_strcmp0 (priv->restored_username, username) != 0)
+        return NULL;
+
+    Session *session = g_object_ref (priv->restored_session);
+    forget_restored_session (greeter);
+    return session;
+}
+
 Greeter *
 greeter_new (void)
 {
@@ -142,12 +267,11 @@ greeter_set_file_descriptors (Greeter *greeter, int to_greeter_fd, int from_gree
     g_return_if_fail (priv->to_greeter_input < 0);
     g_return_if_fail (priv->from_greeter_output < 0);
 
+    /* Messages are queued while the greeter isn't reading, so it can't hold up the daemon */
     priv->to_greeter_input = to_greeter_fd;
-    priv->to_greeter_channel = g_io_channel_unix_new (priv->to_greeter_input);
     g_autoptr(GError) to_error = NULL;
-    g_io_channel_set_encoding (priv->to_greeter_channel, NULL, &to_error);
-    if (to_error)
-        g_warning ("Failed to set encoding on to greeter channel to binary: %s\n", to_error->message);
+    if (!g_unix_set_fd_nonblocking (priv->to_greeter_input, TRUE, &to_error))
+        g_warning ("Failed to make to greeter pipe non-blocking: %s", to_error->message);
 
     priv->from_greeter_output = from_greeter_fd;
     priv->from_greeter_channel = g_io_channel_unix_new (priv->from_greeter_output);
@@ -168,6 +292,8 @@ greeter_stop (Greeter *greeter)
     /* Stop any events occurring after we've stopped */
     if (priv->authentication_session)
         g_signal_handlers_disconnect_matched (priv->authentication_session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, greeter);
+    g_hash_table_remove_all (priv->preauthentications);
+    clear_restored_session (greeter);
 }
 
 void
@@ -189,6 +315,33 @@ greeter_set_allow_guest (Greeter *greeter, gboolean allow_guest)
     priv->allow_guest = allow_guest;
 }
 
+static void send_connected (Greeter *greeter);
+
+/* Set if the greeter has been run before its display server is ready.
+ * The reply to it connecting is sent once this is cleared. */
+void
+greeter_set_hold_connect (Greeter *greeter, gboolean hold_connect)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    g_return_if_fail (greeter != NULL);
+
+    priv->connect_held = hold_connect;
+    if (!hold_connect && priv->connect_pending)
+    {
+        priv->connect_pending = FALSE;
+        send_connected (greeter);
+    }
+}
+
+gboolean
+greeter_get_hold_connect (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    g_return_val_if_fail (greeter != NULL, FALSE);
+    return priv->connect_held;
+}
+
 void
 greeter_clear_hints (Greeter *greeter)
 {
@@ -205,205 +358,520 @@ greeter_set_hint (Greeter *greeter, const gchar *name, const gchar *value)
     g_hash_table_insert (priv->hints, g_strdup (name), g_strdup (value));
 }
 
+/* Allocate memory for secrets; if lock-memory is set this is kept out of swap and core dumps */
 static void *
-secure_malloc (Greeter *greeter, size_t n)
+secure_malloc (Greeter *greeter, gsize n)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    if (priv->use_secure_memory)
-        return gcry_malloc_secure (n);
-    else
-        return g_malloc (n);
+    memory_usage_add (MEMORY_POOL_GREETER_BUFFERS, n);
+    return secure_memory_alloc (n, priv->use_secure_memory);
 }
 
-static void *
-secure_realloc (Greeter *greeter, void *ptr, size_t n)
+static void
+secure_free (Greeter *greeter, void *data, gsize n)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    if (priv->use_secure_memory)
-        return gcry_realloc (ptr, n);
-    else
-        return g_realloc (ptr, n);
+    memory_usage_remove (MEMORY_POOL_GREETER_BUFFERS, n);
+    secure_memory_free (data, n, priv->use_secure_memory);
 }
 
+/* Make sure the secret arena can hold n bytes, must be called before allocating secrets for a message */
 static void
-secure_free (Greeter *greeter, void *ptr)
+secret_arena_reserve (Greeter *greeter, gsize n)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    if (priv->use_secure_memory)
-        return gcry_free (ptr);
-    else
-        return g_free (ptr);
+
+    g_return_if_fail (priv->secret_arena_used == 0);
+
+    if (n <= priv->secret_arena_size)
+        return;
+
+    secure_free (greeter, priv->secret_arena, priv->secret_arena_size);
+    priv->secret_arena_size = secure_memory_round_size (n);
+    priv->secret_arena = secure_malloc (greeter, priv->secret_arena_size);
+}
+
+static gchar *
+secret_arena_alloc (Greeter *greeter, gsize n)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    g_assert (priv->secret_arena_used + n <= priv->secret_arena_size);
+    gchar *data = (gchar *) priv->secret_arena + priv->secret_arena_used;
+    priv->secret_arena_used += n;
+
+    return data;
 }
 
 static void
-secure_freev (Greeter *greeter, gchar **v)
+secret_arena_reset (Greeter *greeter)
 {
-    for (int i = 0; v[i]; i++)
-        secure_free (greeter, v[i]);
-    g_free (v);
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    secure_memory_wipe (priv->secret_arena, priv->secret_arena_used);
+    priv->secret_arena_used = 0;
 }
 
-static guint32
-int_length (void)
+static void
+free_secrets (Greeter *greeter, gchar **secrets)
 {
-    return 4;
+    secret_arena_reset (greeter);
+    g_free (secrets);
 }
 
-#define HEADER_SIZE (sizeof (guint32) * 2)
-#define MAX_MESSAGE_LENGTH 1024
+/* Initial size of buffer to read messages; grown if a larger message is received */
+#define READ_BUFFER_SIZE 1024
+
+/* Largest message accepted from a greeter, the length comes from the greeter so can't be trusted */
+#define MAX_MESSAGE_LENGTH (256 * 1024)
+
+/* Maximum number of messages to send in one write */
+#define MAX_WRITE_VECTORS 64
 
 static void
-write_message (Greeter *greeter, guint8 *message, gsize message_length)
+flush_messages (Greeter *greeter);
+
+static gboolean
+to_greeter_cb (gint fd, GIOCondition condition, gpointer data)
 {
+    Greeter *greeter = data;
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    gchar *data = (gchar *) message;
-    gsize data_length = message_length;
-    while (data_length > 0)
+    priv->to_greeter_watch = 0;
+    flush_messages (greeter);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+flush_messages (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    while (priv->write_queue->len > 0 && priv->to_greeter_input >= 0)
     {
-        GIOStatus status;
-        gsize n_written;
-
-        g_autoptr(GError) error = NULL;
-        status = g_io_channel_write_chars (priv->to_greeter_channel, data, data_length, &n_written, &error);
-        if (error)
-            g_warning ("Error writing to greeter: %s", error->message);
-        if (status != G_IO_STATUS_NORMAL)
+        struct iovec vectors[MAX_WRITE_VECTORS];
+        int n_vectors = 0;
+        for (guint i = 0; i < priv->write_queue->len && n_vectors < MAX_WRITE_VECTORS; i++)
+        {
+            GByteArray *message = g_ptr_array_index (priv->write_queue, i);
+            gsize offset = i == 0 ? priv->write_offset : 0;
+            vectors[n_vectors].iov_base = message->data + offset;
+            vectors[n_vectors].iov_len = message->len - offset;
+            n_vectors++;
+        }
+
+        ssize_t n_written = writev (priv->to_greeter_input, vectors, n_vectors);
+        if (n_written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            /* Wait until the greeter has read some of the data already sent */
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (priv->to_greeter_watch == 0)
+                    priv->to_greeter_watch = g_unix_fd_add (priv->to_greeter_input, G_IO_OUT, to_greeter_cb, greeter);
+                return;
+            }
+
+            g_warning ("Error writing to greeter: %s", strerror (errno));
+            g_ptr_array_set_size (priv->write_queue, 0);
+            priv->write_offset = 0;
             return;
-        data_length -= n_written;
-        data += n_written;
+        }
+
+        /* Drop the messages that have been completely sent */
+        gsize n_remaining = n_written;
+        while (n_remaining > 0)
+        {
+            GByteArray *message = g_ptr_array_index (priv->write_queue, 0);
+            gsize message_remaining = message->len - priv->write_offset;
+            if (n_remaining < message_remaining)
+            {
+                priv->write_offset += n_remaining;
+                break;
+            }
+            n_remaining -= message_remaining;
+            priv->write_offset = 0;
+            g_ptr_array_remove_index (priv->write_queue, 0);
+        }
     }
+}
 
-    g_autoptr(GError) error = NULL;
-    g_io_channel_flush (priv->to_greeter_channel, &error);
-    if (error)
-        g_warning ("Failed to flush data to greeter: %s", error->message);
+static gboolean
+write_idle_cb (gpointer data)
+{
+    Greeter *greeter = data;
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    priv->write_idle = 0;
+    if (priv->to_greeter_watch == 0)
+        flush_messages (greeter);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+add_latency (LatencyStatistics *latency, guint64 value)
+{
+    latency->count++;
+    latency->total += value;
+    latency->max = MAX (latency->max, value);
+
+    gsize bucket = 0;
+    while (bucket < G_N_ELEMENTS (latency_bucket_bounds) && value >= latency_bucket_bounds[bucket])
+        bucket++;
+    latency->buckets[bucket]++;
 }
 
 static void
-write_int (guint8 *buffer, gint buffer_length, guint32 value, gsize *offset)
+record_handled (Greeter *greeter, guint32 id, gint64 start_time)
 {
-    if (*offset + 4 >= buffer_length)
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (id >= N_GREETER_MESSAGES)
         return;
-    buffer[*offset] = value >> 24;
-    buffer[*offset+1] = (value >> 16) & 0xFF;
-    buffer[*offset+2] = (value >> 8) & 0xFF;
-    buffer[*offset+3] = value & 0xFF;
-    *offset += 4;
+
+    guint64 duration = g_get_monotonic_time () - start_time;
+    add_latency (&statistics.handled[id], duration);
+    add_latency (&priv->statistics.handled[id], duration);
 }
 
 static void
-write_string (guint8 *buffer, gint buffer_length, const gchar *value, gsize *offset)
+record_request (Greeter *greeter, guint32 id, gint64 time)
 {
-    gint length;
-    if (value)
-        length = strlen (value);
-    else
-        length = 0;
-    write_int (buffer, buffer_length, length, offset);
-    if (*offset + length >= buffer_length)
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    switch (id)
+    {
+    case GREETER_MESSAGE_CONNECT:
+    case GREETER_MESSAGE_AUTHENTICATE:
+    case GREETER_MESSAGE_AUTHENTICATE_AS_GUEST:
+    case GREETER_MESSAGE_AUTHENTICATE_REMOTE:
+    case GREETER_MESSAGE_CONTINUE_AUTHENTICATION:
+    case GREETER_MESSAGE_START_SESSION:
+    case GREETER_MESSAGE_ENSURE_SHARED_DIR:
+        priv->request_times[id] = time;
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+record_reply (Greeter *greeter, guint32 request_id)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (priv->request_times[request_id] == 0)
         return;
-    if (length > 0)
+
+    guint64 latency = g_get_monotonic_time () - priv->request_times[request_id];
+    priv->request_times[request_id] = 0;
+    add_latency (&statistics.replied[request_id], latency);
+    add_latency (&priv->statistics.replied[request_id], latency);
+}
+
+static void
+record_sent (Greeter *greeter, GByteArray *message)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    guint32 id = message->data[0] << 24 | message->data[1] << 16 | message->data[2] << 8 | message->data[3];
+    if (id >= N_SERVER_MESSAGES)
+        return;
+
+    statistics.sent[id]++;
+    priv->statistics.sent[id]++;
+
+    /* Match replies to the requests they complete */
+    switch (id)
+    {
+    case SERVER_MESSAGE_CONNECTED:
+    case SERVER_MESSAGE_CONNECTED_V2:
+        record_reply (greeter, GREETER_MESSAGE_CONNECT);
+        break;
+    case SERVER_MESSAGE_PROMPT_AUTHENTICATION:
+    case SERVER_MESSAGE_END_AUTHENTICATION:
+        record_reply (greeter, GREETER_MESSAGE_AUTHENTICATE);
+        record_reply (greeter, GREETER_MESSAGE_AUTHENTICATE_AS_GUEST);
+        record_reply (greeter, GREETER_MESSAGE_AUTHENTICATE_REMOTE);
+        record_reply (greeter, GREETER_MESSAGE_CONTINUE_AUTHENTICATION);
+        break;
+    case SERVER_MESSAGE_SESSION_RESULT:
+        record_reply (greeter, GREETER_MESSAGE_START_SESSION);
+        break;
+    case SERVER_MESSAGE_SHARED_DIR_RESULT:
+        record_reply (greeter, GREETER_MESSAGE_ENSURE_SHARED_DIR);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+log_statistics (GreeterStatistics *stats)
+{
+    for (int i = 0; i < N_GREETER_MESSAGES; i++)
+    {
+        LatencyStatistics *handled = &stats->handled[i];
+        LatencyStatistics *replied = &stats->replied[i];
+
+        if (handled->count == 0)
+            continue;
+
+        g_autoptr(GString) text = g_string_new ("");
+        g_string_append_printf (text, "%s: %" G_GUINT64_FORMAT " handled in %" G_GUINT64_FORMAT "us average, %" G_GUINT64_FORMAT "us max",
+                                common_greeter_protocol_get_greeter_message_name (i), handled->count, handled->total / handled->count, handled->max);
+        if (replied->count > 0)
+            g_string_append_printf (text, ", replied in %" G_GUINT64_FORMAT "us average, %" G_GUINT64_FORMAT "us max",
+                                    replied->total / replied->count, replied->max);
+        g_debug ("%s", text->str);
+    }
+}
+
+static GVariant *
+latency_to_variant (const gchar *kind, guint32 id, LatencyStatistics *latency)
+{
+    GVariantBuilder buckets;
+    g_variant_builder_init (&buckets, G_VARIANT_TYPE ("at"));
+    for (gsize i = 0; i < N_LATENCY_BUCKETS; i++)
+        g_variant_builder_add (&buckets, "t", latency->buckets[i]);
+
+    return g_variant_new ("(ssttt@at)", kind, common_greeter_protocol_get_greeter_message_name (id), latency->count, latency->total, latency->max, g_variant_builder_end (&buckets));
+}
+
+/* Get the protocol statistics for all greeters, as returned by the D-Bus Statistics interface */
+GVariant *
+greeter_get_statistics (void)
+{
+    GVariantBuilder bounds;
+    g_variant_builder_init (&bounds, G_VARIANT_TYPE ("at"));
+    for (gsize i = 0; i < G_N_ELEMENTS (latency_bucket_bounds); i++)
+        g_variant_builder_add (&bounds, "t", latency_bucket_bounds[i]);
+
+    GVariantBuilder entries;
+    g_variant_builder_init (&entries, G_VARIANT_TYPE ("a(sstttat)"));
+    for (guint32 i = 0; i < N_GREETER_MESSAGES; i++)
     {
-        memcpy (buffer + *offset, value, length);
-        *offset += length;
+        if (statistics.handled[i].count > 0)
+            g_variant_builder_add_value (&entries, latency_to_variant ("handled", i, &statistics.handled[i]));
+        if (statistics.replied[i].count > 0)
+            g_variant_builder_add_value (&entries, latency_to_variant ("replied", i, &statistics.replied[i]));
     }
+
+    return g_variant_new ("(@at@a(sstttat))", g_variant_builder_end (&bounds), g_variant_builder_end (&entries));
 }
 
 static void
-write_header (guint8 *buffer, gint buffer_length, guint32 id, guint32 length, gsize *offset)
+write_message (Greeter *greeter, GByteArray *message)
 {
-    write_int (buffer, buffer_length, id, offset);
-    write_int (buffer, buffer_length, length, offset);
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    record_sent (greeter, message);
+
+    /* Queue up the message and send everything queued in this main loop iteration in one write */
+    g_ptr_array_add (priv->write_queue, g_byte_array_ref (message));
+    if (priv->write_idle == 0)
+        priv->write_idle = g_idle_add_full (G_PRIORITY_HIGH, write_idle_cb, greeter, NULL);
 }
 
-static guint32
-string_length (const gchar *value)
+static void
+send_user_changed (Greeter *greeter, CommonUser *user)
 {
-    if (value == NULL)
-        return int_length ();
-    else
-        return int_length () + strlen (value);
+    g_autoptr(GBytes) data = common_user_serialize (user);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_USER_CHANGED, GREETER_PROTOCOL_STRING_SIZE (g_bytes_get_size (data)));
+    common_greeter_protocol_write_bytes (message, data);
+    write_message (greeter, message);
 }
 
 static void
-handle_connect (Greeter *greeter, const gchar *version, gboolean resettable, guint32 api_version)
+user_added_cb (CommonUserList *user_list, CommonUser *user, Greeter *greeter)
+{
+    send_user_changed (greeter, user);
+}
+
+static void
+user_changed_cb (CommonUserList *user_list, CommonUser *user, Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    g_debug ("Greeter connected version=%s api=%u resettable=%s", version, api_version, resettable ? "true" : "false");
+    if (MIN (priv->api_version, GREETER_PROTOCOL_API_VERSION) < GREETER_PROTOCOL_USER_CHANGES_API_VERSION)
+    {
+        send_user_changed (greeter, user);
+        return;
+    }
 
-    priv->api_version = api_version;
-    priv->resettable = resettable;
+    g_autoptr(GBytes) changes = common_user_get_changes (user);
+    if (!changes)
+        return;
+
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_USER_FIELDS_CHANGED, GREETER_PROTOCOL_STRING_SIZE (g_bytes_get_size (changes)));
+    common_greeter_protocol_write_bytes (message, changes);
+    write_message (greeter, message);
+}
+
+static void
+user_removed_cb (CommonUserList *user_list, CommonUser *user, Greeter *greeter)
+{
+    const gchar *username = common_user_get_name (user);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_USER_REMOVED, common_greeter_protocol_string_size (username));
+    common_greeter_protocol_write_string (message, username);
+    write_message (greeter, message);
+}
+
+/* Send the users we have so the greeter doesn't have to look them up itself */
+static void
+send_user_list (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (priv->user_list)
+        return;
+    priv->user_list = g_object_ref (common_user_list_get_instance ());
+
+    g_autoptr(GBytes) snapshot = common_user_list_get_snapshot (priv->user_list);
+    g_debug ("Sending user list of %d users (%zu octets)", common_user_list_get_length (priv->user_list), g_bytes_get_size (snapshot));
+    /* The users keep their part of the snapshot, so this is what the list is holding */
+    memory_usage_set (MEMORY_POOL_USER_LIST, g_bytes_get_size (snapshot));
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_USER_LIST, GREETER_PROTOCOL_STRING_SIZE (g_bytes_get_size (snapshot)));
+    common_greeter_protocol_write_bytes (message, snapshot);
+    write_message (greeter, message);
+
+    g_signal_connect (priv->user_list, USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (user_added_cb), greeter);
+    g_signal_connect (priv->user_list, USER_LIST_SIGNAL_USER_CHANGED, G_CALLBACK (user_changed_cb), greeter);
+    g_signal_connect (priv->user_list, USER_LIST_SIGNAL_USER_REMOVED, G_CALLBACK (user_removed_cb), greeter);
+}
+
+static void
+send_connected (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    guint32 api_version = priv->api_version;
+
+    /* Send the users first so they are available once the greeter is connected */
+    if (MIN (api_version, GREETER_PROTOCOL_API_VERSION) >= GREETER_PROTOCOL_USER_LIST_API_VERSION)
+        send_user_list (greeter);
 
     guint32 env_length = 0;
     GHashTableIter iter;
     g_hash_table_iter_init (&iter, priv->hints);
     gpointer key, value;
     while (g_hash_table_iter_next (&iter, &key, &value))
-        env_length += string_length (key) + string_length (value);
+        env_length += common_greeter_protocol_string_size (key) + common_greeter_protocol_string_size (value);
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
+    g_autoptr(GByteArray) message = NULL;
     if (api_version == 0)
     {
-        write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_CONNECTED, string_length (VERSION) + env_length, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, VERSION, &offset);
+        message = common_greeter_protocol_start_message (SERVER_MESSAGE_CONNECTED, common_greeter_protocol_string_size (VERSION) + env_length);
+        common_greeter_protocol_write_string (message, VERSION);
         g_hash_table_iter_init (&iter, priv->hints);
         while (g_hash_table_iter_next (&iter, &key, &value))
         {
-            write_string (message, MAX_MESSAGE_LENGTH, key, &offset);
-            write_string (message, MAX_MESSAGE_LENGTH, value, &offset);
+            common_greeter_protocol_write_string (message, key);
+            common_greeter_protocol_write_string (message, value);
         }
     }
     else
     {
-        write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_CONNECTED_V2, string_length (VERSION) + int_length () * 2 + env_length, &offset);
-        write_int (message, MAX_MESSAGE_LENGTH, api_version <= API_VERSION ? api_version : API_VERSION, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, VERSION, &offset);
-        write_int (message, MAX_MESSAGE_LENGTH, g_hash_table_size (priv->hints), &offset);
+        message = common_greeter_protocol_start_message (SERVER_MESSAGE_CONNECTED_V2, common_greeter_protocol_string_size (VERSION) + GREETER_PROTOCOL_INT_SIZE * 2 + env_length);
+        common_greeter_protocol_write_int (message, api_version <= GREETER_PROTOCOL_API_VERSION ? api_version : GREETER_PROTOCOL_API_VERSION);
+        common_greeter_protocol_write_string (message, VERSION);
+        common_greeter_protocol_write_int (message, g_hash_table_size (priv->hints));
         g_hash_table_iter_init (&iter, priv->hints);
         while (g_hash_table_iter_next (&iter, &key, &value))
         {
-            write_string (message, MAX_MESSAGE_LENGTH, key, &offset);
-            write_string (message, MAX_MESSAGE_LENGTH, value, &offset);
+            common_greeter_protocol_write_string (message, key);
+            common_greeter_protocol_write_string (message, value);
         }
     }
-    write_message (greeter, message, offset);
+    write_message (greeter, message);
 
     g_signal_emit (greeter, signals[CONNECTED], 0);
 }
 
 static void
-pam_messages_cb (Session *session, Greeter *greeter)
+handle_connect (Greeter *greeter, const gchar *version, gboolean resettable, guint32 api_version)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    g_debug ("Greeter connected version=%s api=%u resettable=%s", version, api_version, resettable ? "true" : "false");
+
+    priv->api_version = api_version;
+    priv->resettable = resettable;
+
+    /* The greeter waits for the reply, so it won't use the display until it is ready */
+    if (priv->connect_held)
+    {
+        g_debug ("Holding greeter connection until display server is ready");
+        priv->connect_pending = TRUE;
+        return;
+    }
+
+    send_connected (greeter);
+}
+
+static PreAuthentication *
+find_preauthentication (Greeter *greeter, Session *session, guint32 *sequence_number)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, priv->preauthentications);
+    gpointer key, value;
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+        PreAuthentication *preauthentication = value;
+        if (preauthentication->session == session)
+        {
+            if (sequence_number)
+                *sequence_number = GPOINTER_TO_UINT (key);
+            return preauthentication;
+        }
+    }
+
+    return NULL;
+}
+
+static guint32
+get_sequence_number (Greeter *greeter, Session *session)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
+    guint32 sequence_number = priv->authentication_sequence_number;
+    if (session != priv->authentication_session)
+        find_preauthentication (greeter, session, &sequence_number);
+
+    return sequence_number;
+}
+
+static void
+pam_messages_cb (Session *session, Greeter *greeter)
+{
     const struct pam_message *messages = session_get_messages (session);
     size_t messages_length = session_get_messages_length (session);
 
     /* Respond to d-bus query with messages */
     g_debug ("Prompt greeter with %zi message(s)", messages_length);
-    guint32 size = int_length () + string_length (session_get_username (session)) + int_length ();
+    guint32 size = GREETER_PROTOCOL_INT_SIZE + common_greeter_protocol_string_size (session_get_username (session)) + GREETER_PROTOCOL_INT_SIZE;
     for (int i = 0; i < messages_length; i++)
-        size += int_length () + string_length (messages[i].msg);
+        size += GREETER_PROTOCOL_INT_SIZE + common_greeter_protocol_string_size (messages[i].msg);
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_PROMPT_AUTHENTICATION, size, &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, priv->authentication_sequence_number, &offset);
-    write_string (message, MAX_MESSAGE_LENGTH, session_get_username (session), &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, messages_length, &offset);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_PROMPT_AUTHENTICATION, size);
+    common_greeter_protocol_write_int (message, get_sequence_number (greeter, session));
+    common_greeter_protocol_write_string (message, session_get_username (session));
+    common_greeter_protocol_write_int (message, messages_length);
     int n_prompts = 0;
     for (int i = 0; i < messages_length; i++)
     {
-        write_int (message, MAX_MESSAGE_LENGTH, messages[i].msg_style, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, messages[i].msg, &offset);
+        common_greeter_protocol_write_int (message, messages[i].msg_style);
+        common_greeter_protocol_write_string (message, messages[i].msg);
 
         if (messages[i].msg_style == PAM_PROMPT_ECHO_OFF || messages[i].msg_style == PAM_PROMPT_ECHO_ON)
             n_prompts++;
     }
-    write_message (greeter, message, offset);
+    write_message (greeter, message);
 
     /* Continue immediately if nothing to respond with */
     // FIXME: Should probably give the greeter a chance to ack the message
@@ -411,32 +879,34 @@ pam_messages_cb (Session *session, Greeter *greeter)
     {
         struct pam_response *response;
         response = calloc (messages_length, sizeof (struct pam_response));
-        session_respond (priv->authentication_session, response);
+        session_respond (session, response);
         free (response);
     }
 }
 
+static void
+write_end_authentication (Greeter *greeter, guint32 sequence_number, const gchar *username, int result)
+{
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_END_AUTHENTICATION, GREETER_PROTOCOL_INT_SIZE + common_greeter_protocol_string_size (username) + GREETER_PROTOCOL_INT_SIZE);
+    common_greeter_protocol_write_int (message, sequence_number);
+    common_greeter_protocol_write_string (message, username);
+    common_greeter_protocol_write_int (message, result);
+    write_message (greeter, message);
+}
+
 static void
 send_end_authentication (Greeter *greeter, guint32 sequence_number, const gchar *username, int result)
 {
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_END_AUTHENTICATION, int_length () + string_length (username) + int_length (), &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, sequence_number, &offset);
-    write_string (message, MAX_MESSAGE_LENGTH, username, &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, result, &offset);
-    write_message (greeter, message, offset);
+    write_end_authentication (greeter, sequence_number, username, result);
     priv->have_sent_end_authentication = TRUE;
 }
 
 void
 greeter_idle (Greeter *greeter)
 {
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_IDLE, 0, &offset);
-    write_message (greeter, message, offset);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_IDLE, 0);
+    write_message (greeter, message);
 }
 
 void
@@ -451,21 +921,20 @@ greeter_reset (Greeter *greeter)
     gpointer key, value;
     guint32 length = 0;
     while (g_hash_table_iter_next (&iter, &key, &value))
-        length += string_length (key) + string_length (value);
+        length += common_greeter_protocol_string_size (key) + common_greeter_protocol_string_size (value);
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_RESET, length, &offset);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_RESET, length);
     g_hash_table_iter_init (&iter, priv->hints);
     while (g_hash_table_iter_next (&iter, &key, &value))
     {
-        write_string (message, MAX_MESSAGE_LENGTH, key, &offset);
-        write_string (message, MAX_MESSAGE_LENGTH, value, &offset);
+        common_greeter_protocol_write_string (message, key);
+        common_greeter_protocol_write_string (message, value);
     }
-    write_message (greeter, message, offset);
+    write_message (greeter, message);
 }
 
 static void reset_session (Greeter *greeter);
+static void prepare_remote_retry (Greeter *greeter);
 
 static void
 authentication_complete_cb (Session *session, Greeter *greeter)
@@ -486,12 +955,25 @@ authentication_complete_cb (Session *session, Greeter *greeter)
         }
     }
 
+    /* Pre-authentications are reported but kept until the greeter selects them */
+    guint32 sequence_number;
+    PreAuthentication *preauthentication = find_preauthentication (greeter, session, &sequence_number);
+    if (preauthentication)
+    {
+        preauthentication->complete = TRUE;
+        write_end_authentication (greeter, sequence_number, session_get_username (session), result);
+        return;
+    }
+
     if (priv->cancelling)
         reset_session (greeter);
     else
         priv->cancelling = FALSE;
 
     send_end_authentication (greeter, priv->authentication_sequence_number, session_get_username (session), result);
+
+    if (priv->remote_session && !session_get_is_authenticated (session))
+        prepare_remote_retry (greeter);
 }
 
 static void
@@ -499,20 +981,71 @@ reset_session (Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    g_free (priv->remote_session);
-    priv->remote_session = NULL;
+    g_clear_pointer (&priv->remote_session, g_free);
+    g_clear_pointer (&priv->remote_username, g_free);
     if (priv->authentication_session)
     {
         g_signal_handlers_disconnect_matched (priv->authentication_session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, greeter);
         session_stop (priv->authentication_session);
         g_clear_object (&priv->authentication_session);
     }
+    clear_restored_session (greeter);
 
     priv->guest_account_authenticated = FALSE;
     priv->have_sent_end_authentication = FALSE;
     priv->cancelling = FALSE;
 }
 
+static void
+start_authentication (Greeter *greeter, Session *session, const gchar *username)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    g_signal_connect (G_OBJECT (session), SESSION_SIGNAL_GOT_MESSAGES, G_CALLBACK (pam_messages_cb), greeter);
+    g_signal_connect (G_OBJECT (session), SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), greeter);
+
+    /* Use non-interactive service for autologin user */
+    const gchar *autologin_username = g_hash_table_lookup (priv->hints, "autologin-user");
+    const gchar *service;
+    gboolean is_interactive;
+    if (autologin_username != NULL && g_strcmp0 (username, autologin_username) == 0)
+    {
+        service = priv->autologin_pam_service;
+        is_interactive = FALSE;
+    }
+    else
+    {
+        service = priv->pam_service;
+        is_interactive = TRUE;
+    }
+
+    /* Run the session process */
+    session_set_pam_service (session, service);
+    session_set_username (session, username);
+    session_set_do_authenticate (session, TRUE);
+    session_set_is_interactive (session, is_interactive);
+    session_start (session);
+}
+
+/* Continue an authentication from a previous greeter, repeating where it got to */
+static void
+resume_authentication (Greeter *greeter, Session *session)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    g_debug ("Continuing authentication for %s from previous greeter", session_get_username (session));
+
+    priv->authentication_session = session;
+    g_signal_connect (G_OBJECT (session), SESSION_SIGNAL_GOT_MESSAGES, G_CALLBACK (pam_messages_cb), greeter);
+    g_signal_connect (G_OBJECT (session), SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), greeter);
+
+    /* Otherwise PAM is still working and will send messages when done */
+    if (session_get_messages_length (session) > 0)
+        pam_messages_cb (session, greeter);
+    else if (session_get_is_authenticated (session))
+        authentication_complete_cb (session, greeter);
+}
+
 static void
 handle_authenticate (Greeter *greeter, guint32 sequence_number, const gchar *username)
 {
@@ -526,6 +1059,9 @@ handle_authenticate (Greeter *greeter, guint32 sequence_number, const gchar *use
     else
         g_debug ("Greeter start authentication for %s", username);
 
+    /* Keep an authentication of this user from a previous greeter, any other is finished with */
+    Session *restored_session = username ? take_restored_session (greeter, NULL, username) : NULL;
+
     reset_session (greeter);
 
     if (priv->active_username)
@@ -534,37 +1070,20 @@ handle_authenticate (Greeter *greeter, guint32 sequence_number, const gchar *use
     g_object_notify (G_OBJECT (greeter), GREETER_PROPERTY_ACTIVE_USERNAME);
 
     priv->authentication_sequence_number = sequence_number;
-    g_signal_emit (greeter, signals[CREATE_SESSION], 0, &priv->authentication_session);
-    if (!priv->authentication_session)
+    if (restored_session)
     {
-        send_end_authentication (greeter, sequence_number, "", PAM_USER_UNKNOWN);
+        resume_authentication (greeter, restored_session);
         return;
     }
 
-    g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_GOT_MESSAGES, G_CALLBACK (pam_messages_cb), greeter);
-    g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), greeter);
-
-    /* Use non-interactive service for autologin user */
-    const gchar *autologin_username = g_hash_table_lookup (priv->hints, "autologin-user");
-    const gchar *service;
-    gboolean is_interactive;
-    if (autologin_username != NULL && g_strcmp0 (username, autologin_username) == 0)
-    {
-        service = priv->autologin_pam_service;
-        is_interactive = FALSE;
-    }
-    else
+    g_signal_emit (greeter, signals[CREATE_SESSION], 0, &priv->authentication_session);
+    if (!priv->authentication_session)
     {
-        service = priv->pam_service;
-        is_interactive = TRUE;
+        send_end_authentication (greeter, sequence_number, "", PAM_USER_UNKNOWN);
+        return;
     }
 
-    /* Run the session process */
-    session_set_pam_service (priv->authentication_session, service);
-    session_set_username (priv->authentication_session, username);
-    session_set_do_authenticate (priv->authentication_session, TRUE);
-    session_set_is_interactive (priv->authentication_session, is_interactive);
-    session_start (priv->authentication_session);
+    start_authentication (greeter, priv->authentication_session, username);
 }
 
 static void
@@ -593,138 +1112,294 @@ get_remote_session_service (const gchar *session_name)
     /* Validate session name doesn't contain directory separators */
     for (const gchar *c = session_name; *c; c++)
     {
-        if (*c == '/')
-            return NULL;
+        if (*c == '/')
+            return NULL;
+    }
+
+    /* Use the session file already loaded by the catalog */
+    g_autofree gchar *remote_sessions_dir = config_get_string (config_get_instance (), "LightDM", "remote-sessions-directory");
+    CommonSessionCatalog *catalog = common_session_catalog_get_instance (remote_sessions_dir);
+    for (GList *link = common_session_catalog_get_entries (catalog); link; link = link->next)
+    {
+        CommonSessionEntry *entry = link->data;
+        if (strcmp (entry->key, session_name) == 0)
+            return g_key_file_get_string (entry->key_file, G_KEY_FILE_DESKTOP_GROUP, "X-LightDM-PAM-Service", NULL);
+    }
+
+    g_debug ("Failed to find remote session %s", session_name);
+    return NULL;
+}
+
+static void
+start_remote_authentication (Session *session, const gchar *service, const gchar *username)
+{
+    session_set_pam_service (session, service);
+    session_set_username (session, username);
+    session_set_do_authenticate (session, TRUE);
+    session_set_is_interactive (session, TRUE);
+    session_set_is_guest (session, TRUE);
+    session_start (session);
+}
+
+/* Remote logins are often retried, so have the next session child running and
+ * waiting for the user while they see the failure */
+static void
+prepare_remote_retry (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    g_autofree gchar *service = get_remote_session_service (priv->remote_session);
+    if (!service)
+        return;
+
+    g_autoptr(Session) session = NULL;
+    g_signal_emit (greeter, signals[CREATE_SESSION], 0, &session);
+    if (!session)
+        return;
+
+    set_restored_session (greeter, session, priv->remote_session, priv->remote_username);
+    start_remote_authentication (session, service, priv->remote_username);
+}
+
+static void
+handle_authenticate_remote (Greeter *greeter, const gchar *session_name, const gchar *username, guint32 sequence_number)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (username[0] == '\0')
+    {
+        g_debug ("Greeter start authentication for remote session %s", session_name);
+        username = NULL;
+    }
+    else
+        g_debug ("Greeter start authentication for remote session %s as user %s", session_name, username);
+
+    /* Carry on with the authentication started when the last attempt failed */
+    Session *restored_session = take_restored_session (greeter, session_name, username);
+
+    reset_session (greeter);
+
+    priv->authentication_sequence_number = sequence_number;
+    priv->remote_session = g_strdup (session_name);
+    priv->remote_username = g_strdup (username);
+    if (restored_session)
+    {
+        resume_authentication (greeter, restored_session);
+        return;
+    }
+
+    g_autofree gchar *service = get_remote_session_service (session_name);
+    if (!service)
+    {
+        send_end_authentication (greeter, sequence_number, "", PAM_SYSTEM_ERR);
+        return;
+    }
+
+    g_signal_emit (greeter, signals[CREATE_SESSION], 0, &priv->authentication_session);
+    if (!priv->authentication_session)
+    {
+        send_end_authentication (greeter, sequence_number, "", PAM_USER_UNKNOWN);
+        return;
+    }
+
+    g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_GOT_MESSAGES, G_CALLBACK (pam_messages_cb), greeter);
+    g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), greeter);
+    start_remote_authentication (priv->authentication_session, service, username);
+}
+
+static void
+respond_to_session (Greeter *greeter, Session *session, gchar **secrets)
+{
+    size_t messages_length = session_get_messages_length (session);
+    const struct pam_message *messages = session_get_messages (session);
+
+    /* Check correct number of responses */
+    int n_prompts = 0;
+    for (int i = 0; i < messages_length; i++)
+    {
+        int msg_style = messages[i].msg_style;
+        if (msg_style == PAM_PROMPT_ECHO_OFF || msg_style == PAM_PROMPT_ECHO_ON)
+            n_prompts++;
+    }
+    if (g_strv_length (secrets) != n_prompts)
+    {
+        session_respond_error (session, PAM_CONV_ERR);
+        return;
+    }
+
+    /* Build response, the secrets are only referenced as they are copied to the session */
+    struct pam_response *response = calloc (messages_length, sizeof (struct pam_response));
+    for (int i = 0, j = 0; i < messages_length; i++)
+    {
+        int msg_style = messages[i].msg_style;
+        if (msg_style == PAM_PROMPT_ECHO_OFF || msg_style == PAM_PROMPT_ECHO_ON)
+        {
+            response[i].resp = secrets[j]; // FIXME: Need to convert from UTF-8
+            j++;
+        }
+    }
+
+    session_respond (session, response);
+
+    free (response);
+}
+
+static void
+handle_continue_authentication (Greeter *greeter, gchar **secrets)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    /* Not in authentication */
+    if (priv->authentication_session == NULL)
+        return;
+
+    /* We may have already sent SERVER_MESSAGE_END_AUTHENTICATION, but the greeter may not have digested it yet. */
+    if (priv->have_sent_end_authentication) {
+        g_debug ("Ignoring continue authentication");
+        return;
+    }
+
+    g_debug ("Continue authentication");
+    respond_to_session (greeter, priv->authentication_session, secrets);
+}
+
+static void
+handle_cancel_authentication (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    /* Not in authentication */
+    if (priv->authentication_session == NULL)
+        return;
+
+    g_debug ("Cancel authentication");
+    priv->cancelling = TRUE;
+    session_stop (priv->authentication_session);
+}
+
+static PreAuthentication *
+preauthentication_new (Greeter *greeter, Session *session)
+{
+    PreAuthentication *preauthentication = g_malloc0 (sizeof (PreAuthentication));
+    preauthentication->greeter = greeter;
+    preauthentication->session = session;
+    return preauthentication;
+}
+
+static void
+preauthentication_free (PreAuthentication *preauthentication)
+{
+    if (preauthentication->session)
+    {
+        g_signal_handlers_disconnect_matched (preauthentication->session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, preauthentication->greeter);
+        session_stop (preauthentication->session);
+        g_object_unref (preauthentication->session);
     }
+    g_free (preauthentication);
+}
 
-    /* Load the session file */
-    g_autoptr(GKeyFile) session_desktop_file = g_key_file_new ();
-    g_autofree gchar *filename = g_strdup_printf ("%s.desktop", session_name);
-    g_autofree gchar *remote_sessions_dir = config_get_string (config_get_instance (), "LightDM", "remote-sessions-directory");
-    g_autofree gchar *path = g_build_filename (remote_sessions_dir, filename, NULL);
-    g_autoptr(GError) error = NULL;
-    gboolean result = g_key_file_load_from_file (session_desktop_file, path, G_KEY_FILE_NONE, &error);
-    if (error)
-        g_debug ("Failed to load session file %s: %s", path, error->message);
-    if (!result)
-        return NULL;
-
-    return g_key_file_get_string (session_desktop_file, G_KEY_FILE_DESKTOP_GROUP, "X-LightDM-PAM-Service", NULL);
+static gboolean
+get_supports_preauthentication (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    return MIN (priv->api_version, GREETER_PROTOCOL_API_VERSION) >= GREETER_PROTOCOL_PREAUTHENTICATION_API_VERSION;
 }
 
 static void
-handle_authenticate_remote (Greeter *greeter, const gchar *session_name, const gchar *username, guint32 sequence_number)
+handle_preauthenticate (Greeter *greeter, guint32 sequence_number, const gchar *username)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
     if (username[0] == '\0')
-    {
-        g_debug ("Greeter start authentication for remote session %s", session_name);
         username = NULL;
-    }
-    else
-        g_debug ("Greeter start authentication for remote session %s as user %s", session_name, username);
 
-    reset_session (greeter);
+    if (!get_supports_preauthentication (greeter))
+    {
+        g_debug ("Ignoring pre-authentication request, not supported by greeter API version %u", priv->api_version);
+        write_end_authentication (greeter, sequence_number, "", PAM_SYSTEM_ERR);
+        return;
+    }
 
-    g_autofree gchar *service = get_remote_session_service (session_name);
-    if (!service)
+    if ((priv->authentication_session && sequence_number == priv->authentication_sequence_number) ||
+        g_hash_table_contains (priv->preauthentications, GUINT_TO_POINTER (sequence_number)))
     {
-        send_end_authentication (greeter, sequence_number, "", PAM_SYSTEM_ERR);
+        g_debug ("Ignoring pre-authentication request with duplicate sequence number %u", sequence_number);
         return;
     }
 
-    priv->authentication_sequence_number = sequence_number;
-    priv->remote_session = g_strdup (session_name);
-    g_signal_emit (greeter, signals[CREATE_SESSION], 0, &priv->authentication_session);
-    if (priv->authentication_session)
+    if (g_hash_table_size (priv->preauthentications) >= MAX_PREAUTHENTICATIONS)
     {
-        g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_GOT_MESSAGES, G_CALLBACK (pam_messages_cb), greeter);
-        g_signal_connect (G_OBJECT (priv->authentication_session), SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), greeter);
-
-        /* Run the session process */
-        session_set_pam_service (priv->authentication_session, service);
-        session_set_username (priv->authentication_session, username);
-        session_set_do_authenticate (priv->authentication_session, TRUE);
-        session_set_is_interactive (priv->authentication_session, TRUE);
-        session_set_is_guest (priv->authentication_session, TRUE);
-        session_start (priv->authentication_session);
+        g_debug ("Ignoring pre-authentication request, too many pre-authentications running");
+        write_end_authentication (greeter, sequence_number, username ? username : "", PAM_MAXTRIES);
+        return;
     }
 
-    if (!priv->authentication_session)
+    g_debug ("Greeter start pre-authentication %u for %s", sequence_number, username);
+
+    Session *session = NULL;
+    g_signal_emit (greeter, signals[CREATE_SESSION], 0, &session);
+    if (!session)
     {
-        send_end_authentication (greeter, sequence_number, "", PAM_USER_UNKNOWN);
+        write_end_authentication (greeter, sequence_number, "", PAM_USER_UNKNOWN);
         return;
     }
+
+    g_hash_table_insert (priv->preauthentications, GUINT_TO_POINTER (sequence_number), preauthentication_new (greeter, session));
+    start_authentication (greeter, session, username);
 }
 
 static void
-handle_continue_authentication (Greeter *greeter, gchar **secrets)
+handle_continue_preauthentication (Greeter *greeter, guint32 sequence_number, gchar **secrets)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    /* Not in authentication */
-    if (priv->authentication_session == NULL)
-        return;
-
-    size_t messages_length = session_get_messages_length (priv->authentication_session);
-    const struct pam_message *messages = session_get_messages (priv->authentication_session);
-
-    /* We may have already sent SERVER_MESSAGE_END_AUTHENTICATION, but the greeter may not have digested it yet. */
-    if (priv->have_sent_end_authentication) {
-        g_debug ("Ignoring continue authentication");
-        return;
-    }
-
-    /* Check correct number of responses */
-    int n_prompts = 0;
-    for (int i = 0; i < messages_length; i++)
-    {
-        int msg_style = messages[i].msg_style;
-        if (msg_style == PAM_PROMPT_ECHO_OFF || msg_style == PAM_PROMPT_ECHO_ON)
-            n_prompts++;
-    }
-    if (g_strv_length (secrets) != n_prompts)
+    PreAuthentication *preauthentication = g_hash_table_lookup (priv->preauthentications, GUINT_TO_POINTER (sequence_number));
+    if (!preauthentication || preauthentication->complete)
     {
-        session_respond_error (priv->authentication_session, PAM_CONV_ERR);
+        g_debug ("Ignoring continue pre-authentication %u", sequence_number);
         return;
     }
 
-    g_debug ("Continue authentication");
-
-    /* Build response */
-    struct pam_response *response = calloc (messages_length, sizeof (struct pam_response));
-    for (int i = 0, j = 0; i < messages_length; i++)
-    {
-        int msg_style = messages[i].msg_style;
-        if (msg_style == PAM_PROMPT_ECHO_OFF || msg_style == PAM_PROMPT_ECHO_ON)
-        {
-            size_t secret_length = strlen (secrets[j]) + 1;
-            response[i].resp = secure_malloc (greeter, secret_length);
-            memcpy (response[i].resp, secrets[j], secret_length); // FIXME: Need to convert from UTF-8
-            j++;
-        }
-    }
+    g_debug ("Continue pre-authentication %u", sequence_number);
+    respond_to_session (greeter, preauthentication->session, secrets);
+}
 
-    session_respond (priv->authentication_session, response);
+static void
+handle_cancel_preauthentication (Greeter *greeter, guint32 sequence_number)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    for (int i = 0; i < messages_length; i++)
-        secure_free (greeter, response[i].resp);
-    free (response);
+    if (g_hash_table_remove (priv->preauthentications, GUINT_TO_POINTER (sequence_number)))
+        g_debug ("Cancel pre-authentication %u", sequence_number);
 }
 
 static void
-handle_cancel_authentication (Greeter *greeter)
+handle_select_preauthentication (Greeter *greeter, guint32 sequence_number)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    /* Not in authentication */
-    if (priv->authentication_session == NULL)
+    PreAuthentication *preauthentication = g_hash_table_lookup (priv->preauthentications, GUINT_TO_POINTER (sequence_number));
+    if (!preauthentication)
+    {
+        g_debug ("Ignoring select of unknown pre-authentication %u", sequence_number);
         return;
+    }
 
-    g_debug ("Cancel authentication");
-    priv->cancelling = TRUE;
-    session_stop (priv->authentication_session);
+    g_debug ("Greeter selects pre-authentication %u for %s", sequence_number, session_get_username (preauthentication->session));
+
+    /* Replace the current authentication with the pre-authenticated one */
+    gboolean complete = preauthentication->complete;
+    Session *session = g_steal_pointer (&preauthentication->session);
+    g_hash_table_remove (priv->preauthentications, GUINT_TO_POINTER (sequence_number));
+
+    reset_session (greeter);
+    priv->authentication_session = session;
+    priv->authentication_sequence_number = sequence_number;
+    priv->have_sent_end_authentication = complete;
+
+    g_free (priv->active_username);
+    priv->active_username = g_strdup (session_get_username (session));
+    g_object_notify (G_OBJECT (greeter), GREETER_PROPERTY_ACTIVE_USERNAME);
 }
 
 static void
@@ -759,11 +1434,9 @@ handle_start_session (Greeter *greeter, const gchar *session)
         result = FALSE;
     }
 
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_SESSION_RESULT, int_length (), &offset);
-    write_int (message, MAX_MESSAGE_LENGTH, result ? 0 : 1, &offset);
-    write_message (greeter, message, offset);
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_SESSION_RESULT, GREETER_PROTOCOL_INT_SIZE);
+    common_greeter_protocol_write_int (message, result ? 0 : 1);
+    write_message (greeter, message);
 }
 
 static void
@@ -789,205 +1462,164 @@ handle_set_language (Greeter *greeter, const gchar *language)
     user_set_language (user, language);
 }
 
+static void ensure_shared_dir_cb (GObject *object, GAsyncResult *result, gpointer data);
+
 static void
-handle_ensure_shared_dir (Greeter *greeter, const gchar *username)
+start_ensure_shared_dir (Greeter *greeter)
 {
-    g_debug ("Greeter requests data directory for user %s", username);
-
-    g_autofree gchar *dir = shared_data_manager_ensure_user_dir (shared_data_manager_get_instance (), username);
-
-    guint8 message[MAX_MESSAGE_LENGTH];
-    gsize offset = 0;
-    write_header (message, MAX_MESSAGE_LENGTH, SERVER_MESSAGE_SHARED_DIR_RESULT, string_length (dir), &offset);
-    write_string (message, MAX_MESSAGE_LENGTH, dir, &offset);
-    write_message (greeter, message, offset);
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    const gchar *username = g_queue_peek_head (&priv->shared_dir_requests);
+    shared_data_manager_ensure_user_dir_async (shared_data_manager_get_instance (), username, ensure_shared_dir_cb, g_object_ref (greeter));
 }
 
-static guint32
-read_int (Greeter *greeter, gsize *offset)
+static void
+ensure_shared_dir_cb (GObject *object, GAsyncResult *result, gpointer data)
 {
+    g_autoptr(Greeter) greeter = data;
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    if (priv->n_read - *offset < sizeof (guint32))
-    {
-        g_warning ("Not enough space for int, need %zu, got %zu", sizeof (guint32), priv->n_read - *offset);
-        return 0;
-    }
-    guint8 *buffer = priv->read_buffer + *offset;
-    guint32 value = buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
-    *offset += int_length ();
-    return value;
+    g_autofree gchar *dir = shared_data_manager_ensure_user_dir_finish (shared_data_manager_get_instance (), result);
+
+    g_autoptr(GByteArray) message = common_greeter_protocol_start_message (SERVER_MESSAGE_SHARED_DIR_RESULT, common_greeter_protocol_string_size (dir));
+    common_greeter_protocol_write_string (message, dir);
+    write_message (greeter, message);
+
+    g_free (g_queue_pop_head (&priv->shared_dir_requests));
+    if (!g_queue_is_empty (&priv->shared_dir_requests))
+        start_ensure_shared_dir (greeter);
 }
 
-static int
-get_message_length (Greeter *greeter)
+static void
+handle_ensure_shared_dir (Greeter *greeter, const gchar *username)
 {
-    gsize offset;
-    int payload_length;
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    offset = int_length ();
-    payload_length = read_int (greeter, &offset);
+    g_debug ("Greeter requests data directory for user %s", username);
 
-    if (HEADER_SIZE + payload_length < HEADER_SIZE)
-    {
-        g_warning ("Payload length of %u octets too long", payload_length);
-        return HEADER_SIZE;
-    }
+    /* Create the directory in a worker thread, the greeter expects the replies in the order it asked */
+    g_queue_push_tail (&priv->shared_dir_requests, g_strdup (username));
+    if (g_queue_get_length (&priv->shared_dir_requests) == 1)
+        start_ensure_shared_dir (greeter);
+}
 
-    return HEADER_SIZE + payload_length;
+static guint32
+read_int (const guint8 *message, gsize message_length, gsize *offset)
+{
+    guint32 value;
+    common_greeter_protocol_read_int (message, message_length, offset, &value);
+    return value;
 }
 
 static gchar *
-read_string_full (Greeter *greeter, gsize *offset, void* (*alloc_fn)(size_t n))
+read_string_full (const guint8 *message, gsize message_length, gsize *offset, void* (*alloc_fn)(size_t n))
 {
-    GreeterPrivate *priv = greeter_get_instance_private (greeter);
-
-    guint32 length = read_int (greeter, offset);
-    if (priv->n_read - *offset < length)
-    {
-        g_warning ("Not enough space for string, need %u, got %zu", length, priv->n_read - *offset);
+    guint32 length;
+    const gchar *data = common_greeter_protocol_read_string (message, message_length, offset, &length);
+    if (!data)
         return g_strdup ("");
-    }
 
     gchar *value = (*alloc_fn) (sizeof (gchar) * (length + 1));
-    memcpy (value, priv->read_buffer + *offset, length);
+    memcpy (value, data, length);
     value[length] = '\0';
-    *offset += length;
 
     return value;
 }
 
 static gchar *
-read_string (Greeter *greeter, gsize *offset)
+read_string (const guint8 *message, gsize message_length, gsize *offset)
 {
-    return read_string_full (greeter, offset, g_malloc);
+    return read_string_full (message, message_length, offset, g_malloc);
 }
 
 static gchar *
-read_secret (Greeter *greeter, gsize *offset)
+read_secret (Greeter *greeter, const guint8 *message, gsize message_length, gsize *offset)
 {
-    GreeterPrivate *priv = greeter_get_instance_private (greeter);
-    if (priv->use_secure_memory)
-        return read_string_full (greeter, offset, gcry_malloc_secure);
-    else
-        return read_string_full (greeter, offset, g_malloc);
+    guint32 length;
+    const gchar *data = common_greeter_protocol_read_string (message, message_length, offset, &length);
+
+    gchar *value = secret_arena_alloc (greeter, length + 1);
+    if (data)
+        memcpy (value, data, length);
+    value[length] = '\0';
+
+    return value;
 }
 
-static gboolean
-read_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+static gchar **
+read_secrets (Greeter *greeter, const guint8 *message, gsize message_length, gsize *offset)
 {
-    Greeter *greeter = data;
-    GreeterPrivate *priv = greeter_get_instance_private (greeter);
-
-    if (condition == G_IO_HUP)
+    guint32 n_secrets = read_int (message, message_length, offset);
+    guint32 max_secrets = (G_MAXUINT32 - 1) / sizeof (gchar *);
+    if (n_secrets > max_secrets || n_secrets > (message_length - *offset) / GREETER_PROTOCOL_INT_SIZE)
     {
-        g_debug ("Greeter closed communication channel");
-        priv->from_greeter_watch = 0;
-        g_signal_emit (greeter, signals[DISCONNECTED], 0);
-        return FALSE;
+        g_warning ("Array length of %u elements too long", n_secrets);
+        return NULL;
     }
 
-    gsize n_to_read = HEADER_SIZE;
-    if (priv->n_read >= HEADER_SIZE)
-    {
-        n_to_read = get_message_length (greeter);
-        if (n_to_read <= HEADER_SIZE)
-        {
-            priv->from_greeter_watch = 0;
-            return FALSE;
-        }
-    }
+    /* The secrets can't be longer than the rest of the message plus their terminators */
+    secret_arena_reserve (greeter, message_length - *offset + n_secrets);
 
-    gsize n_read;
-    g_autoptr(GError) error = NULL;
-    GIOStatus status = g_io_channel_read_chars (priv->from_greeter_channel,
-                                                (gchar *) priv->read_buffer + priv->n_read,
-                                                n_to_read - priv->n_read,
-                                                &n_read,
-                                                &error);
-    if (error)
-        g_warning ("Error reading from greeter: %s", error->message);
-    if (status == G_IO_STATUS_EOF)
-    {
-        g_debug ("Greeter closed communication channel");
-        priv->from_greeter_watch = 0;
-        g_signal_emit (greeter, signals[DISCONNECTED], 0);
-        return FALSE;
-    }
-    else if (status != G_IO_STATUS_NORMAL)
-        return TRUE;
+    gchar **secrets = g_malloc (sizeof (gchar *) * (n_secrets + 1));
+    guint32 i;
+    for (i = 0; i < n_secrets; i++)
+        secrets[i] = read_secret (greeter, message, message_length, offset);
+    secrets[i] = NULL;
 
-    priv->n_read += n_read;
-    if (priv->n_read != n_to_read)
-        return TRUE;
+    return secrets;
+}
 
-    /* If have header, rerun for content */
-    if (priv->n_read == HEADER_SIZE)
-    {
-        n_to_read = get_message_length (greeter);
-        if (n_to_read > HEADER_SIZE)
-        {
-            priv->read_buffer = secure_realloc (greeter, priv->read_buffer, n_to_read);
-            read_cb (source, condition, greeter);
-            return TRUE;
-        }
-    }
+static gboolean
+handle_message (Greeter *greeter, const guint8 *message, gsize message_length)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
     gsize offset = 0;
-    int id = read_int (greeter, &offset);
-    int length = HEADER_SIZE + read_int (greeter, &offset);
+    guint32 id = read_int (message, message_length, &offset);
+    read_int (message, message_length, &offset);
+    flight_recorder_record (FLIGHT_RECORDER_EVENT_GREETER_MESSAGE, 0, id, NULL, common_greeter_protocol_get_greeter_message_name (id));
+    priv->last_activity_time = g_get_monotonic_time ();
     switch (id)
     {
     case GREETER_MESSAGE_CONNECT:
         {
-            g_autofree gchar *version = read_string (greeter, &offset);
+            g_autofree gchar *version = read_string (message, message_length, &offset);
             gboolean resettable = FALSE;
-            if (offset < length)
-                resettable = read_int (greeter, &offset) != 0;
+            if (offset < message_length)
+                resettable = read_int (message, message_length, &offset) != 0;
             guint32 api_version = 0;
-            if (offset < length)
-                api_version = read_int (greeter, &offset);
+            if (offset < message_length)
+                api_version = read_int (message, message_length, &offset);
             handle_connect (greeter, version, resettable, api_version);
         }
         break;
     case GREETER_MESSAGE_AUTHENTICATE:
         {
-            guint32 sequence_number = read_int (greeter, &offset);
-            g_autofree gchar *username = read_string (greeter, &offset);
+            guint32 sequence_number = read_int (message, message_length, &offset);
+            g_autofree gchar *username = read_string (message, message_length, &offset);
             handle_authenticate (greeter, sequence_number, username);
         }
         break;
     case GREETER_MESSAGE_AUTHENTICATE_AS_GUEST:
         {
-            guint32 sequence_number = read_int (greeter, &offset);
+            guint32 sequence_number = read_int (message, message_length, &offset);
             handle_authenticate_as_guest (greeter, sequence_number);
         }
         break;
     case GREETER_MESSAGE_AUTHENTICATE_REMOTE:
         {
-            guint32 sequence_number = read_int (greeter, &offset);
-            g_autofree gchar *session_name = read_string (greeter, &offset);
-            g_autofree gchar *username = read_string (greeter, &offset);
+            guint32 sequence_number = read_int (message, message_length, &offset);
+            g_autofree gchar *session_name = read_string (message, message_length, &offset);
+            g_autofree gchar *username = read_string (message, message_length, &offset);
             handle_authenticate_remote (greeter, session_name, username, sequence_number);
         }
         break;
     case GREETER_MESSAGE_CONTINUE_AUTHENTICATION:
         {
-            guint32 n_secrets = read_int (greeter, &offset);
-            guint32 max_secrets = (G_MAXUINT32 - 1) / sizeof (gchar *);
-            if (n_secrets > max_secrets)
-            {
-                g_warning ("Array length of %u elements too long", n_secrets);
-                priv->from_greeter_watch = 0;
+            gchar **secrets = read_secrets (greeter, message, message_length, &offset);
+            if (!secrets)
                 return FALSE;
-            }
-            gchar **secrets = g_malloc (sizeof (gchar *) * (n_secrets + 1));
-            guint32 i;
-            for (i = 0; i < n_secrets; i++)
-                secrets[i] = read_secret (greeter, &offset);
-            secrets[i] = NULL;
             handle_continue_authentication (greeter, secrets);
-            secure_freev (greeter, secrets);
+            free_secrets (greeter, secrets);
         }
         break;
     case GREETER_MESSAGE_CANCEL_AUTHENTICATION:
@@ -995,32 +1627,156 @@ read_cb (GIOChannel *source, GIOCondition condition, gpointer data)
         break;
     case GREETER_MESSAGE_START_SESSION:
         {
-            g_autofree gchar *session_name = read_string (greeter, &offset);
+            g_autofree gchar *session_name = read_string (message, message_length, &offset);
             handle_start_session (greeter, session_name);
         }
         break;
     case GREETER_MESSAGE_SET_LANGUAGE:
         {
-            g_autofree gchar *language = read_string (greeter, &offset);
+            g_autofree gchar *language = read_string (message, message_length, &offset);
             handle_set_language (greeter, language);
         }
         break;
     case GREETER_MESSAGE_ENSURE_SHARED_DIR:
         {
-            g_autofree gchar *username = read_string (greeter, &offset);
+            g_autofree gchar *username = read_string (message, message_length, &offset);
             handle_ensure_shared_dir (greeter, username);
         }
         break;
+    case GREETER_MESSAGE_PREAUTHENTICATE:
+        {
+            guint32 sequence_number = read_int (message, message_length, &offset);
+            g_autofree gchar *username = read_string (message, message_length, &offset);
+            handle_preauthenticate (greeter, sequence_number, username);
+        }
+        break;
+    case GREETER_MESSAGE_CONTINUE_PREAUTHENTICATION:
+        {
+            guint32 sequence_number = read_int (message, message_length, &offset);
+            gchar **secrets = read_secrets (greeter, message, message_length, &offset);
+            if (!secrets)
+                return FALSE;
+            handle_continue_preauthentication (greeter, sequence_number, secrets);
+            free_secrets (greeter, secrets);
+        }
+        break;
+    case GREETER_MESSAGE_CANCEL_PREAUTHENTICATION:
+        {
+            guint32 sequence_number = read_int (message, message_length, &offset);
+            handle_cancel_preauthentication (greeter, sequence_number);
+        }
+        break;
+    case GREETER_MESSAGE_SELECT_PREAUTHENTICATION:
+        {
+            guint32 sequence_number = read_int (message, message_length, &offset);
+            handle_select_preauthentication (greeter, sequence_number);
+        }
+        break;
     default:
         g_warning ("Unknown message from greeter: %d", id);
         break;
     }
 
-    priv->n_read = 0;
-
     return TRUE;
 }
 
+static gsize
+get_message_length (const guint8 *buffer, gsize buffer_length)
+{
+    gsize offset = GREETER_PROTOCOL_INT_SIZE;
+    return GREETER_PROTOCOL_HEADER_SIZE + read_int (buffer, buffer_length, &offset);
+}
+
+static gboolean
+read_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    Greeter *greeter = data;
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+
+    if (condition == G_IO_HUP)
+    {
+        g_debug ("Greeter closed communication channel");
+        priv->from_greeter_watch = 0;
+        g_signal_emit (greeter, signals[DISCONNECTED], 0);
+        return FALSE;
+    }
+
+    /* Read as much as is available */
+    gsize n_read;
+    g_autoptr(GError) error = NULL;
+    GIOStatus status = g_io_channel_read_chars (priv->from_greeter_channel,
+                                                (gchar *) priv->read_buffer + priv->n_read,
+                                                priv->read_buffer_size - priv->n_read,
+                                                &n_read,
+                                                &error);
+    if (error)
+        g_warning ("Error reading from greeter: %s", error->message);
+    if (status == G_IO_STATUS_EOF)
+    {
+        g_debug ("Greeter closed communication channel");
+        priv->from_greeter_watch = 0;
+        g_signal_emit (greeter, signals[DISCONNECTED], 0);
+        return FALSE;
+    }
+    else if (status != G_IO_STATUS_NORMAL)
+        return TRUE;
+    priv->n_read += n_read;
+
+    /* Handling a message may cause the greeter to be dropped */
+    g_autoptr(Greeter) greeter_ref = g_object_ref (greeter);
+
+    /* Process all the complete messages we have */
+    gsize offset = 0;
+    gboolean result = TRUE;
+    while (result && priv->n_read - offset >= GREETER_PROTOCOL_HEADER_SIZE)
+    {
+        gsize message_length = get_message_length (priv->read_buffer + offset, priv->n_read - offset);
+        if (message_length < GREETER_PROTOCOL_HEADER_SIZE || message_length > MAX_MESSAGE_LENGTH)
+        {
+            g_warning ("Payload length of %zu octets too long", message_length);
+            result = FALSE;
+            break;
+        }
+
+        /* Grow the buffer if this message will never fit */
+        if (message_length > priv->read_buffer_size)
+        {
+            guint8 *read_buffer = secure_malloc (greeter, message_length);
+            memcpy (read_buffer, priv->read_buffer + offset, priv->n_read - offset);
+            secure_free (greeter, priv->read_buffer, priv->read_buffer_size);
+            priv->read_buffer = read_buffer;
+            priv->read_buffer_size = message_length;
+            priv->n_read -= offset;
+            offset = 0;
+        }
+
+        if (priv->n_read - offset < message_length)
+            break;
+
+        gsize id_offset = 0;
+        guint32 id = read_int (priv->read_buffer + offset, message_length, &id_offset);
+        gint64 start_time = g_get_monotonic_time ();
+        record_request (greeter, id, start_time);
+        result = handle_message (greeter, priv->read_buffer + offset, message_length);
+        record_handled (greeter, id, start_time);
+        offset += message_length;
+    }
+
+    /* Keep any partial message at the start of the buffer, and clear what has been handled */
+    if (offset > 0)
+    {
+        memmove (priv->read_buffer, priv->read_buffer + offset, priv->n_read - offset);
+        secure_memory_wipe (priv->read_buffer + priv->n_read - offset, offset);
+        priv->n_read -= offset;
+    }
+
+    if (!result)
+        priv->from_greeter_watch = 0;
+
+    return result;
+}
+
+
 gboolean
 greeter_get_guest_authenticated (Greeter *greeter)
 {
@@ -1044,6 +1800,14 @@ greeter_take_authentication_session (Greeter *greeter)
     return session;
 }
 
+void
+greeter_restore_authentication_session (Greeter *greeter, Session *session)
+{
+    g_return_if_fail (greeter != NULL);
+
+    set_restored_session (greeter, session, NULL, session_get_username (session));
+}
+
 gboolean
 greeter_get_resettable (Greeter *greeter)
 {
@@ -1068,6 +1832,14 @@ greeter_get_active_username (Greeter *greeter)
     return priv->active_username;
 }
 
+gint64
+greeter_get_last_activity_time (Greeter *greeter)
+{
+    GreeterPrivate *priv = greeter_get_instance_private (greeter);
+    g_return_val_if_fail (greeter != NULL, 0);
+    return priv->last_activity_time;
+}
+
 static Session *
 greeter_real_create_session (Greeter *greeter)
 {
@@ -1085,9 +1857,15 @@ greeter_init (Greeter *greeter)
 {
     GreeterPrivate *priv = greeter_get_instance_private (greeter);
 
-    priv->read_buffer = secure_malloc (greeter, HEADER_SIZE);
-    priv->hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
     priv->use_secure_memory = config_get_boolean (config_get_instance (), "LightDM", "lock-memory");
+    priv->read_buffer_size = READ_BUFFER_SIZE;
+    priv->read_buffer = secure_malloc (greeter, priv->read_buffer_size);
+    priv->secret_arena_size = secure_memory_round_size (READ_BUFFER_SIZE);
+    priv->secret_arena = secure_malloc (greeter, priv->secret_arena_size);
+    priv->hints = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->write_queue = g_ptr_array_new_with_free_func ((GDestroyNotify) g_byte_array_unref);
+    priv->preauthentications = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) preauthentication_free);
+    priv->last_activity_time = g_get_monotonic_time ();
     priv->to_greeter_input = -1;
     priv->from_greeter_output = -1;
     priv->cancelling = FALSE;
@@ -1099,21 +1877,45 @@ greeter_finalize (GObject *object)
     Greeter *self = GREETER (object);
     GreeterPrivate *priv = greeter_get_instance_private (self);
 
+    if (priv->statistics.handled[GREETER_MESSAGE_CONNECT].count > 0 && logger_get_debug_enabled ())
+    {
+        g_debug ("Greeter protocol statistics:");
+        log_statistics (&priv->statistics);
+    }
+
     g_clear_pointer (&priv->pam_service, g_free);
     g_clear_pointer (&priv->autologin_pam_service, g_free);
-    secure_free (self, priv->read_buffer);
+    secure_free (self, priv->read_buffer, priv->read_buffer_size);
+    secure_free (self, priv->secret_arena, priv->secret_arena_size);
     g_hash_table_unref (priv->hints);
     g_clear_pointer (&priv->remote_session, g_free);
+    g_clear_pointer (&priv->remote_username, g_free);
     g_clear_pointer (&priv->active_username, g_free);
     if (priv->authentication_session)
     {
         g_signal_handlers_disconnect_matched (priv->authentication_session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
         g_object_unref (priv->authentication_session);
     }
+    forget_restored_session (self);
+    g_hash_table_unref (priv->preauthentications);
+    g_queue_foreach (&priv->shared_dir_requests, (GFunc) g_free, NULL);
+    g_queue_clear (&priv->shared_dir_requests);
+    if (priv->user_list)
+    {
+        g_signal_handlers_disconnect_matched (priv->user_list, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
+        g_object_unref (priv->user_list);
+    }
+
+    /* Send anything still queued before closing the connection */
+    flush_messages (self);
+    g_ptr_array_unref (priv->write_queue);
+    if (priv->write_idle)
+        g_source_remove (priv->write_idle);
+    if (priv->to_greeter_watch)
+        g_source_remove (priv->to_greeter_watch);
+
     close (priv->to_greeter_input);
     close (priv->from_greeter_output);
-    if (priv->to_greeter_channel)
-        g_io_channel_unref (priv->to_greeter_channel);
     if (priv->from_greeter_channel)
         g_io_channel_unref (priv->from_greeter_channel);
     if (priv->from_greeter_watch)
@@ -60,6 +60,10 @@ void greeter_set_pam_services (Greeter *greeter, const gchar *pam_service, const
 
 void greeter_set_allow_guest (Greeter *greeter, gboolean allow_guest);
 
+void greeter_set_hold_connect (Greeter *greeter, gboolean hold_connect);
+
+gboolean greeter_get_hold_connect (Greeter *greeter);
+
 void greeter_clear_hints (Greeter *greeter);
 
 void greeter_set_hint (Greeter *greeter, const gchar *name, const gchar *value);
@@ -72,12 +76,18 @@ gboolean greeter_get_guest_authenticated (Greeter *greeter);
 
 Session *greeter_take_authentication_session (Greeter *greeter);
 
+void greeter_restore_authentication_session (Greeter *greeter, Session *session);
+
 gboolean greeter_get_start_session (Greeter *greeter);
 
 gboolean greeter_get_resettable (Greeter *greeter);
 
 const gchar *greeter_get_active_username (Greeter *greeter);
 
+gint64 greeter_get_last_activity_time (Greeter *greeter);
+
+GVariant *greeter_get_statistics (void);
+
 G_END_DECLS
 
 #endif /* GREETER_H_ */
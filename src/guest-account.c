@@ -11,25 +11,76 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include "guest-account.h"
 #include "configuration.h"
+#include "process.h"
+#include "worker.h"
 
-static gchar *
-get_setup_script (void)
-{
-    static gchar *setup_script = NULL;
+/* Accounts that have been created ahead of being used */
+static GQueue pool = G_QUEUE_INIT;
+
+/* Number of accounts being created for the pool */
+static guint n_filling = 0;
+
+/* TRUE if creating an account for the pool failed, so don't keep trying */
+static gboolean fill_failed = FALSE;
+
+/* Number of accounts being removed */
+static guint n_removing = 0;
 
-    if (setup_script)
-        return setup_script;
+/* Directory the writable layers of template guest homes are mounted under */
+static gchar *guest_homes_dir = NULL;
 
+static gpointer
+find_setup_script (gpointer data)
+{
     g_autofree gchar *script = config_get_string (config_get_instance (), "LightDM", "guest-account-script");
     if (!script)
         return NULL;
 
-    setup_script = g_find_program_in_path (script);
+    return g_find_program_in_path (script);
+}
 
-    return setup_script;
+/* Accounts are set up in worker threads, so these are only resolved once */
+static const gchar *
+get_setup_script (void)
+{
+    static GOnce once = G_ONCE_INIT;
+    return g_once (&once, find_setup_script, NULL);
+}
+
+static gpointer
+find_home_template (gpointer data)
+{
+    g_autofree gchar *dir = config_get_string (config_get_instance (), "LightDM", "guest-account-home-template");
+    if (!dir || strcmp (dir, "") == 0)
+        return NULL;
+
+    if (!g_file_test (dir, G_FILE_TEST_IS_DIR))
+    {
+        g_warning ("Guest account home template %s is not a directory, guest homes will be set up by the script", dir);
+        return NULL;
+    }
+
+    g_autofree gchar *run_dir = config_get_string (config_get_instance (), "LightDM", "run-directory");
+    guest_homes_dir = g_build_filename (run_dir, "guest-homes", NULL);
+
+    return g_steal_pointer (&dir);
+}
+
+/* Read-only directory to use as the guest home, or NULL to have the script populate it */
+static const gchar *
+get_home_template (void)
+{
+    static GOnce once = G_ONCE_INIT;
+    return g_once (&once, find_home_template, NULL);
 }
 
 gboolean
@@ -38,40 +89,161 @@ guest_account_is_installed (void)
     return get_setup_script () != NULL;
 }
 
+static void
+background_child_setup (gpointer user_data)
+{
+    process_apply_priority (PROCESS_PRIORITY_BACKGROUND, 0);
+}
+
 static gboolean
-run_script (const gchar *script, gchar **stdout_text, gint *exit_status, GError **error)
+run_script (const gchar *script, gboolean background, gchar **stdout_text, gint *exit_status, GError **error)
 {
     gint argc;
     g_auto(GStrv) argv = NULL;
     if (!g_shell_parse_argv (script, &argc, &argv, error))
         return FALSE;
 
-    gboolean result = g_spawn_sync (NULL, argv, NULL,
+    /* Tell the script the home directory will be provided, so it only has to create the account */
+    g_auto(GStrv) envp = g_get_environ ();
+    if (get_home_template ())
+        envp = g_environ_setenv (envp, "GUEST_HOME_TEMPLATE", get_home_template (), TRUE);
+
+    gboolean result = g_spawn_sync (NULL, argv, envp,
                                     G_SPAWN_SEARCH_PATH,
-                                    NULL, NULL,
+                                    background ? background_child_setup : NULL, NULL,
                                     stdout_text, NULL, exit_status, error);
 
     return result;
 }
 
-gchar *
-guest_account_setup (void)
+static gboolean
+get_home_directory (const gchar *username, gchar **home_directory, uid_t *uid, gid_t *gid)
+{
+    gsize buffer_size = 4096;
+    g_autofree gchar *buffer = NULL;
+    struct passwd entry, *result = NULL;
+    int errsv;
+    do
+    {
+        buffer = g_realloc (buffer, buffer_size);
+        errsv = getpwnam_r (username, &entry, buffer, buffer_size, &result);
+        buffer_size *= 2;
+    } while (errsv == ERANGE);
+    if (!result)
+        return FALSE;
+
+    *home_directory = g_strdup (entry.pw_dir);
+    if (uid)
+        *uid = entry.pw_uid;
+    if (gid)
+        *gid = entry.pw_gid;
+
+    return TRUE;
+}
+
+/* Mount the guest home as an overlay of the template with a tmpfs for the changes,
+ * so setting it up takes the same time however big the template is */
+static gboolean
+mount_home (const gchar *username)
+{
+    g_autofree gchar *home_directory = NULL;
+    uid_t uid;
+    gid_t gid;
+    if (!get_home_directory (username, &home_directory, &uid, &gid))
+    {
+        g_warning ("Failed to find home directory for guest account %s", username);
+        return FALSE;
+    }
+
+    g_autofree gchar *layer_dir = g_build_filename (guest_homes_dir, username, NULL);
+    if (g_mkdir_with_parents (layer_dir, S_IRWXU) < 0)
+    {
+        g_warning ("Failed to create guest home layer directory %s: %s", layer_dir, strerror (errno));
+        return FALSE;
+    }
+    g_autofree gchar *size = config_get_string (config_get_instance (), "LightDM", "guest-account-home-size");
+    g_autofree gchar *tmpfs_options = size && strcmp (size, "") != 0 ? g_strdup_printf ("mode=700,size=%s", size) : g_strdup ("mode=700");
+    if (mount ("tmpfs", layer_dir, "tmpfs", MS_NOSUID | MS_NODEV, tmpfs_options) < 0)
+    {
+        g_warning ("Failed to mount tmpfs on %s: %s", layer_dir, strerror (errno));
+        g_rmdir (layer_dir);
+        return FALSE;
+    }
+
+    g_autofree gchar *upper_dir = g_build_filename (layer_dir, "upper", NULL);
+    g_autofree gchar *work_dir = g_build_filename (layer_dir, "work", NULL);
+    if (g_mkdir (upper_dir, S_IRWXU) < 0 || chown (upper_dir, uid, gid) < 0 || g_mkdir (work_dir, S_IRWXU) < 0)
+    {
+        g_warning ("Failed to create guest home layers in %s: %s", layer_dir, strerror (errno));
+        umount (layer_dir);
+        g_rmdir (layer_dir);
+        return FALSE;
+    }
+
+    g_autofree gchar *options = g_strdup_printf ("lowerdir=%s,upperdir=%s,workdir=%s", get_home_template (), upper_dir, work_dir);
+    if (g_mkdir_with_parents (home_directory, S_IRWXU) < 0 ||
+        mount ("overlay", home_directory, "overlay", MS_NOSUID | MS_NODEV, options) < 0)
+    {
+        g_warning ("Failed to mount guest home %s: %s", home_directory, strerror (errno));
+        umount (layer_dir);
+        g_rmdir (layer_dir);
+        return FALSE;
+    }
+
+    /* Give the guest what the template has at the top level, so they can write in its directories */
+    g_autoptr(GDir) dir = g_dir_open (home_directory, 0, NULL);
+    const gchar *name;
+    while (dir && (name = g_dir_read_name (dir)))
+    {
+        g_autofree gchar *path = g_build_filename (home_directory, name, NULL);
+        if (lchown (path, uid, gid) < 0)
+            g_warning ("Failed to change ownership of %s: %s", path, strerror (errno));
+    }
+
+    g_debug ("Mounted guest home %s from template %s", home_directory, get_home_template ());
+
+    return TRUE;
+}
+
+static void
+unmount_home (const gchar *username)
+{
+    /* Detach so this works while the guest's processes are still being stopped */
+    g_autofree gchar *home_directory = NULL;
+    if (get_home_directory (username, &home_directory, NULL, NULL) &&
+        umount2 (home_directory, MNT_DETACH) < 0 && errno != EINVAL)
+        g_warning ("Failed to unmount guest home %s: %s", home_directory, strerror (errno));
+
+    g_autofree gchar *layer_dir = g_build_filename (guest_homes_dir, username, NULL);
+    if (umount2 (layer_dir, MNT_DETACH) < 0 && errno != EINVAL && errno != ENOENT)
+        g_warning ("Failed to unmount guest home layers %s: %s", layer_dir, strerror (errno));
+    g_rmdir (layer_dir);
+}
+
+static gboolean
+setup_thread (gpointer data, GCancellable *cancellable, GError **error)
 {
+    gchar **username_out = data;
+
+    /* Already have an account from the pool */
+    if (*username_out)
+        return TRUE;
+
     g_autofree gchar *command = g_strdup_printf ("%s add", get_setup_script ());
     g_debug ("Opening guest account with command '%s'", command);
     g_autofree gchar *stdout_text = NULL;
     gint exit_status;
-    g_autoptr(GError) error = NULL;
-    gboolean result = run_script (command, &stdout_text, &exit_status, &error);
-    if (error)
-        g_warning ("Error running guest account setup script '%s': %s", get_setup_script (), error->message);
+    g_autoptr(GError) e = NULL;
+    gboolean result = run_script (command, FALSE, &stdout_text, &exit_status, &e);
+    if (e)
+        g_warning ("Error running guest account setup script '%s': %s", get_setup_script (), e->message);
     if (!result)
-        return NULL;
+        return FALSE;
 
     if (exit_status != 0)
     {
         g_debug ("Guest account setup script returns %d: %s", exit_status, stdout_text);
-        return NULL;
+        return FALSE;
     }
 
     /* Use the last line and trim whitespace */
@@ -85,27 +257,142 @@ guest_account_setup (void)
     if (strcmp (username, "") == 0)
     {
         g_debug ("Guest account setup script didn't return a username");
-        return NULL;
+        return FALSE;
+    }
+
+    if (get_home_template () && !mount_home (username))
+    {
+        g_autofree gchar *remove_command = g_strdup_printf ("%s remove %s", get_setup_script (), username);
+        run_script (remove_command, TRUE, NULL, NULL, NULL);
+        return FALSE;
     }
 
     g_debug ("Guest account %s setup", username);
 
-    return g_steal_pointer (&username);
+    *username_out = g_steal_pointer (&username);
+    return TRUE;
+}
+
+static void
+free_username (gpointer data)
+{
+    gchar **username = data;
+    g_free (*username);
+    g_free (username);
+}
+
+static guint
+get_pool_size (void)
+{
+    return MAX (config_get_integer (config_get_instance (), "LightDM", "guest-account-pool-size"), 0);
+}
+
+static void
+pool_setup_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    n_filling--;
+
+    gchar *username = guest_account_setup_finish (result);
+    if (username)
+    {
+        g_debug ("Guest account %s added to pool", username);
+        g_queue_push_tail (&pool, username);
+    }
+    else
+        fill_failed = TRUE;
 }
 
 void
-guest_account_cleanup (const gchar *username)
+guest_account_fill_pool (void)
+{
+    if (!guest_account_is_installed ())
+        return;
+
+    while (!fill_failed && g_queue_get_length (&pool) + n_filling < get_pool_size ())
+    {
+        n_filling++;
+        worker_run (setup_thread, g_new0 (gchar *, 1), free_username, NULL, pool_setup_cb, NULL);
+    }
+}
+
+void
+guest_account_setup_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
 {
+    /* Use an account that is already set up if we have one */
+    gchar **username = g_new0 (gchar *, 1);
+    *username = g_queue_pop_head (&pool);
+    if (*username)
+        g_debug ("Using guest account %s from pool", *username);
+    worker_run (setup_thread, username, free_username, cancellable, callback, user_data);
+
+    /* Replace the account that was used */
+    fill_failed = FALSE;
+    guest_account_fill_pool ();
+}
+
+gchar *
+guest_account_setup_finish (GAsyncResult *result)
+{
+    if (!worker_run_finish (result, NULL))
+        return NULL;
+
+    gchar **username = worker_get_data (result);
+    return g_steal_pointer (username);
+}
+
+static gboolean
+cleanup_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    const gchar *username = data;
+
     g_autofree gchar *command = g_strdup_printf ("%s remove %s", get_setup_script (), username);
     g_debug ("Closing guest account %s with command '%s'", username, command);
 
+    if (get_home_template ())
+        unmount_home (username);
+
     gint exit_status;
-    g_autoptr(GError) error = NULL;
-    gboolean result = run_script (command, NULL, &exit_status, &error);
+    g_autoptr(GError) e = NULL;
+    gboolean result = run_script (command, TRUE, NULL, &exit_status, &e);
 
-    if (error)
-        g_warning ("Error running guest account cleanup script '%s': %s", get_setup_script (), error->message);
+    if (e)
+        g_warning ("Error running guest account cleanup script '%s': %s", get_setup_script (), e->message);
 
     if (result && exit_status != 0)
         g_debug ("Guest account cleanup script returns %d", exit_status);
+
+    return result;
+}
+
+static void
+cleanup_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    n_removing--;
+}
+
+void
+guest_account_cleanup (const gchar *username)
+{
+    n_removing++;
+    worker_run (cleanup_thread, g_strdup (username), g_free, NULL, cleanup_cb, NULL);
+}
+
+void
+guest_account_cleanup_pool (void)
+{
+    /* Stop accounts being created */
+    fill_failed = TRUE;
+    while (n_filling > 0)
+        g_main_context_iteration (NULL, TRUE);
+
+    gchar *username;
+    while ((username = g_queue_pop_head (&pool)))
+    {
+        guest_account_cleanup (username);
+        g_free (username);
+    }
+
+    /* Don't exit until all accounts have been removed */
+    while (n_removing > 0)
+        g_main_context_iteration (NULL, TRUE);
 }
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+/* Small helper that the daemon runs for each session. It only contains the
+ * PAM, utmp and X authority handling so the process that lives for the whole
+ * session doesn't carry the rest of the daemon. */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <glib.h>
+
+#include "session-child.h"
+#include "session-launcher.h"
+
+int
+main (int argc, char **argv)
+{
+    /* Ignore these as the daemon does, the session child handles the pipes closing */
+    struct sigaction action;
+    action.sa_handler = SIG_IGN;
+    sigemptyset (&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction (SIGPIPE, &action, NULL);
+    sigaction (SIGHUP, &action, NULL);
+
+    if (argc >= 2 && strcmp (argv[1], "--session-child") == 0)
+        return session_child_run (argc, argv);
+    if (argc >= 2 && strcmp (argv[1], "--session-launcher") == 0)
+        return session_launcher_run (argc, argv);
+
+    g_printerr ("Usage: %s --session-child INPUTFD OUTPUTFD\n"
+                "       %s --session-launcher FD\n", argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
@@ -21,6 +21,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 
+#include "boot-readahead.h"
 #include "configuration.h"
 #include "display-manager.h"
 #include "display-manager-service.h"
@@ -31,15 +32,23 @@
 #include "x-server.h"
 #include "process.h"
 #include "session-child.h"
+#include "session-launcher.h"
 #include "shared-data-manager.h"
 #include "user-list.h"
 #include "login1.h"
+#include "guest-account.h"
+#include "greeter-resources.h"
 #include "log-file.h"
+#include "log-writer.h"
+#include "logger.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "metrics.h"
+#include "flight-recorder.h"
 
 static gchar *config_path = NULL;
 static GMainLoop *loop = NULL;
 static GTimer *log_timer;
-static int log_fd = -1;
 static gboolean debug = FALSE;
 
 static DisplayManager *display_manager = NULL;
@@ -48,13 +57,25 @@ static XDMCPServer *xdmcp_server = NULL;
 static guint xdmcp_client_count = 0;
 static VNCServer *vnc_server = NULL;
 static guint vnc_client_count = 0;
+static GList *vnc_pool = NULL;
+/* TRUE once a VNC connection has been made, the pool isn't filled before */
+static gboolean vnc_pool_started = FALSE;
 static gint exit_code = EXIT_SUCCESS;
 
+/* TRUE while seat0 is still being brought up from logind, the display
+ * manager doesn't start until it has taken over the VT from Plymouth */
+static gboolean waiting_for_seat0 = FALSE;
+static gboolean display_manager_start_pending = FALSE;
+
 static gboolean update_login1_seat (Login1Seat *login1_seat);
+static void reload_config (void);
 
 static void
 log_cb (const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer data)
 {
+    if ((log_level & G_LOG_LEVEL_DEBUG) && !logger_get_debug_enabled ())
+        return;
+
     const gchar *prefix;
     switch (log_level & G_LOG_LEVEL_MASK)
     {
@@ -83,13 +104,10 @@ log_cb (const gchar *log_domain, GLogLevelFlags log_level, const gchar *message,
 
     g_autofree gchar *text = g_strdup_printf ("[%+.2fs] %s %s\n", g_timer_elapsed (log_timer, NULL), prefix, message);
 
-    /* Log everything to a file */
-    if (log_fd >= 0)
-    {
-        ssize_t n_written = write (log_fd, text, strlen (text));
-        if (n_written < 0)
-            ; /* Check result so compiler doesn't warn about it */
-    }
+    /* Log everything to a file, making sure fatal messages are written before we abort */
+    log_writer_write (text, strlen (text));
+    if (log_level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR))
+        log_writer_flush ();
 
     /* Log to stderr if requested */
     if (debug)
@@ -108,11 +126,27 @@ log_init (void)
     g_autofree gchar *path = g_build_filename (log_dir, "lightdm.log", NULL);
 
     gboolean backup_logs = config_get_boolean (config_get_instance (), "LightDM", "backup-logs");
-    log_fd = log_file_open (path, backup_logs ? LOG_MODE_BACKUP_AND_TRUNCATE : LOG_MODE_APPEND);
+    int log_fd = log_file_open (path, backup_logs ? LOG_MODE_BACKUP_AND_TRUNCATE : LOG_MODE_APPEND);
     fcntl (log_fd, F_SETFD, FD_CLOEXEC);
+    log_writer_start (log_fd);
+    logger_set_debug_enabled (debug || config_get_boolean (config_get_instance (), "LightDM", "log-debug"));
     g_log_set_default_handler (log_cb, NULL);
 
     g_debug ("Logging to %s", path);
+
+    /* Limits for session and X server logs */
+    LogLimits limits;
+    limits.max_size = (guint64) MAX (config_get_integer (config_get_instance (), "LightDM", "log-max-size"), 0) * 1024;
+    limits.n_files = MAX (config_get_integer (config_get_instance (), "LightDM", "log-max-files"), 0);
+    limits.compress = config_get_boolean (config_get_instance (), "LightDM", "log-compress");
+    log_file_set_limits (&limits);
+
+    /* Record timings of the startup and login phases */
+    if (config_get_boolean (config_get_instance (), "LightDM", "log-trace"))
+    {
+        g_autofree gchar *trace_path = g_build_filename (log_dir, "lightdm-trace.json", NULL);
+        trace_init (trace_path);
+    }
 }
 
 static GList*
@@ -138,6 +172,9 @@ get_config_sections (const gchar *seat_name)
 static void
 set_seat_properties (Seat *seat, const gchar *seat_name)
 {
+    /* Remember which sections apply so they can be reloaded */
+    g_object_set_data_full (G_OBJECT (seat), "config-seat-name", g_strdup (seat_name), g_free);
+
     GList *sections = get_config_sections (seat_name);
     for (GList *link = sections; link; link = link->next)
     {
@@ -156,6 +193,125 @@ set_seat_properties (Seat *seat, const gchar *seat_name)
     g_list_free_full (sections, g_free);
 }
 
+static void
+set_config_defaults (Configuration *config)
+{
+    if (!config_has_key (config, "LightDM", "start-default-seat"))
+        config_set_boolean (config, "LightDM", "start-default-seat", TRUE);
+    if (!config_has_key (config, "LightDM", "minimum-vt"))
+        config_set_integer (config, "LightDM", "minimum-vt", 7);
+    if (!config_has_key (config, "LightDM", "guest-account-script"))
+        config_set_string (config, "LightDM", "guest-account-script", "guest-account");
+    if (!config_has_key (config, "LightDM", "guest-account-pool-size"))
+        config_set_integer (config, "LightDM", "guest-account-pool-size", 0);
+    if (!config_has_key (config, "LightDM", "guest-account-home-size"))
+        config_set_string (config, "LightDM", "guest-account-home-size", "25%");
+    if (!config_has_key (config, "LightDM", "greeter-user"))
+        config_set_string (config, "LightDM", "greeter-user", GREETER_USER);
+    if (!config_has_key (config, "LightDM", "lock-memory"))
+        config_set_boolean (config, "LightDM", "lock-memory", TRUE);
+    if (!config_has_key (config, "LightDM", "backup-logs"))
+        config_set_boolean (config, "LightDM", "backup-logs", TRUE);
+    if (!config_has_key (config, "LightDM", "log-max-size"))
+        config_set_integer (config, "LightDM", "log-max-size", 0);
+    if (!config_has_key (config, "LightDM", "log-max-files"))
+        config_set_integer (config, "LightDM", "log-max-files", 5);
+    if (!config_has_key (config, "LightDM", "log-compress"))
+        config_set_boolean (config, "LightDM", "log-compress", TRUE);
+    if (!config_has_key (config, "LightDM", "log-debug"))
+        config_set_boolean (config, "LightDM", "log-debug", TRUE);
+    if (!config_has_key (config, "LightDM", "log-trace"))
+        config_set_boolean (config, "LightDM", "log-trace", FALSE);
+    if (!config_has_key (config, "LightDM", "stall-threshold"))
+        config_set_integer (config, "LightDM", "stall-threshold", 500);
+    if (!config_has_key (config, "LightDM", "event-buffer-size"))
+        config_set_integer (config, "LightDM", "event-buffer-size", 4096);
+    if (!config_has_key (config, "LightDM", "dbus-service"))
+        config_set_boolean (config, "LightDM", "dbus-service", TRUE);
+    if (!config_has_key (config, "Seat:*", "type"))
+        config_set_string (config, "Seat:*", "type", "local");
+    if (!config_has_key (config, "Seat:*", "pam-service"))
+        config_set_string (config, "Seat:*", "pam-service", "lightdm");
+    if (!config_has_key (config, "Seat:*", "pam-autologin-service"))
+        config_set_string (config, "Seat:*", "pam-autologin-service", "lightdm-autologin");
+    if (!config_has_key (config, "Seat:*", "pam-greeter-service"))
+        config_set_string (config, "Seat:*", "pam-greeter-service", "lightdm-greeter");
+    if (!config_has_key (config, "Seat:*", "xserver-command"))
+        config_set_string (config, "Seat:*", "xserver-command", "X");
+    if (!config_has_key (config, "Seat:*", "xmir-command"))
+        config_set_string (config, "Seat:*", "xmir-command", "Xmir");
+    if (!config_has_key (config, "Seat:*", "xserver-share"))
+        config_set_boolean (config, "Seat:*", "xserver-share", TRUE);
+    if (!config_has_key (config, "Seat:*", "xserver-connect-timeout"))
+        config_set_integer (config, "Seat:*", "xserver-connect-timeout", 10);
+    if (!config_has_key (config, "Seat:*", "start-session"))
+        config_set_boolean (config, "Seat:*", "start-session", TRUE);
+    if (!config_has_key (config, "Seat:*", "allow-user-switching"))
+        config_set_boolean (config, "Seat:*", "allow-user-switching", TRUE);
+    if (!config_has_key (config, "Seat:*", "allow-guest"))
+        config_set_boolean (config, "Seat:*", "allow-guest", TRUE);
+    if (!config_has_key (config, "Seat:*", "greeter-allow-guest"))
+        config_set_boolean (config, "Seat:*", "greeter-allow-guest", TRUE);
+    if (!config_has_key (config, "Seat:*", "greeter-show-remote-login"))
+        config_set_boolean (config, "Seat:*", "greeter-show-remote-login", TRUE);
+    if (!config_has_key (config, "Seat:*", "greeter-session"))
+        config_set_string (config, "Seat:*", "greeter-session", DEFAULT_GREETER_SESSION);
+    if (!config_has_key (config, "Seat:*", "greeter-stop-timeout"))
+        config_set_integer (config, "Seat:*", "greeter-stop-timeout", 5);
+    if (!config_has_key (config, "Seat:*", "greeter-idle-timeout"))
+        config_set_integer (config, "Seat:*", "greeter-idle-timeout", 0);
+    if (!config_has_key (config, "Seat:*", "background-session-limit"))
+        config_set_integer (config, "Seat:*", "background-session-limit", 4);
+    if (!config_has_key (config, "Seat:*", "crash-loop-limit"))
+        config_set_integer (config, "Seat:*", "crash-loop-limit", 5);
+    if (!config_has_key (config, "Seat:*", "user-session"))
+        config_set_string (config, "Seat:*", "user-session", DEFAULT_USER_SESSION);
+    if (!config_has_key (config, "Seat:*", "session-wrapper"))
+        config_set_string (config, "Seat:*", "session-wrapper", "lightdm-session");
+    if (!config_has_key (config, "LightDM", "sessions-directory"))
+        config_set_string (config, "LightDM", "sessions-directory", SESSIONS_DIR);
+    if (!config_has_key (config, "LightDM", "remote-sessions-directory"))
+        config_set_string (config, "LightDM", "remote-sessions-directory", REMOTE_SESSIONS_DIR);
+    if (!config_has_key (config, "LightDM", "greeters-directory"))
+    {
+        g_autoptr(GPtrArray) dirs = g_ptr_array_new_with_free_func (g_free);
+        const gchar * const *data_dirs = g_get_system_data_dirs ();
+        for (int i = 0; data_dirs[i]; i++)
+            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "lightdm/greeters", NULL));
+        for (int i = 0; data_dirs[i]; i++)
+            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "xgreeters", NULL));
+        g_ptr_array_add (dirs, NULL);
+        g_autofree gchar *value = g_strjoinv (":", (gchar **) dirs->pdata);
+        config_set_string (config, "LightDM", "greeters-directory", value);
+    }
+    if (!config_has_key (config, "XDMCPServer", "hostname"))
+        config_set_string (config, "XDMCPServer", "hostname", g_get_host_name ());
+    if (!config_has_key (config, "VNCServer", "pool-size"))
+        config_set_integer (config, "VNCServer", "pool-size", 0);
+    if (!config_has_key (config, "VNCServer", "listen-backlog"))
+        config_set_integer (config, "VNCServer", "listen-backlog", 0);
+    if (!config_has_key (config, "VNCServer", "max-seats"))
+        config_set_integer (config, "VNCServer", "max-seats", 0);
+    if (!config_has_key (config, "VNCServer", "max-starts-per-second"))
+        config_set_integer (config, "VNCServer", "max-starts-per-second", 0);
+    if (!config_has_key (config, "XDMCPServer", "worker-threads"))
+        config_set_integer (config, "XDMCPServer", "worker-threads", 0);
+    if (!config_has_key (config, "XDMCPServer", "report-load"))
+        config_set_boolean (config, "XDMCPServer", "report-load", FALSE);
+    if (!config_has_key (config, "XDMCPServer", "max-sessions"))
+        config_set_integer (config, "XDMCPServer", "max-sessions", 0);
+    if (!config_has_key (config, "XDMCPServer", "busy-delay"))
+        config_set_integer (config, "XDMCPServer", "busy-delay", 0);
+    if (!config_has_key (config, "XDMCPServer", "reattach-timeout"))
+        config_set_integer (config, "XDMCPServer", "reattach-timeout", 60);
+    if (!config_has_key (config, "XDMCPServer", "rate-limit"))
+        config_set_integer (config, "XDMCPServer", "rate-limit", 0);
+    if (!config_has_key (config, "XDMCPServer", "rate-limit-burst"))
+        config_set_integer (config, "XDMCPServer", "rate-limit-burst", 20);
+    if (!config_has_key (config, "LightDM", "logind-check-graphical"))
+        config_set_boolean (config, "LightDM", "logind-check-graphical", TRUE);
+}
+
 static void
 signal_cb (Process *process, int signum)
 {
@@ -167,9 +323,12 @@ signal_cb (Process *process, int signum)
         display_manager_stop (display_manager);
         // FIXME: Stop XDMCP server
         break;
+    case SIGHUP:
+        g_debug ("Caught %s signal, reloading configuration", g_strsignal (signum));
+        reload_config ();
+        break;
     case SIGUSR1:
     case SIGUSR2:
-    case SIGHUP:
         break;
     }
 }
@@ -265,6 +424,26 @@ display_manager_seat_removed_cb (DisplayManager *display_manager, Seat *seat)
 static gboolean
 xdmcp_session_cb (XDMCPServer *server, XDMCPSession *session)
 {
+    /* A display coming back to its session carries on with the seat if it
+     * still has it, otherwise the old seat is replaced */
+    for (GList *link = display_manager_get_seats (display_manager); link; link = link->next)
+    {
+        Seat *s = link->data;
+
+        if (!IS_SEAT_XDMCP_SESSION (s) || seat_xdmcp_session_get_session (SEAT_XDMCP_SESSION (s)) != session || seat_get_is_stopping (s))
+            continue;
+
+        if (seat_xdmcp_session_get_display_is_connected (SEAT_XDMCP_SESSION (s)))
+        {
+            l_debug (s, "XDMCP display reattached");
+            return TRUE;
+        }
+
+        l_debug (s, "XDMCP display reset, starting new seat");
+        seat_stop (s);
+        break;
+    }
+
     g_autoptr(SeatXDMCPSession) seat = seat_xdmcp_session_new (session);
 
     g_autofree gchar *name = g_strdup_printf ("xdmcp%d", xdmcp_client_count);
@@ -275,9 +454,73 @@ xdmcp_session_cb (XDMCPServer *server, XDMCPSession *session)
     return display_manager_add_seat (display_manager, SEAT (seat));
 }
 
+static void fill_vnc_pool (void);
+
+static void
+vnc_pool_seat_stopped_cb (Seat *seat)
+{
+    vnc_pool = g_list_remove (vnc_pool, seat);
+    g_signal_handlers_disconnect_by_func (seat, vnc_pool_seat_stopped_cb, NULL);
+    g_object_unref (seat);
+
+    fill_vnc_pool ();
+}
+
+/* Keep VNC seats with a greeter running ready for new connections */
+static void
+fill_vnc_pool (void)
+{
+    if (!vnc_pool_started)
+        return;
+
+    gint pool_size = config_get_integer (config_get_instance (), "VNCServer", "pool-size");
+
+    while ((gint) g_list_length (vnc_pool) < pool_size && !display_manager_get_is_stopping (display_manager))
+    {
+        g_autoptr(SeatXVNC) seat = seat_xvnc_new_pooled ();
+        if (!seat)
+            return;
+
+        g_autofree gchar *name = g_strdup_printf ("vnc%d", vnc_client_count);
+        vnc_client_count++;
+
+        seat_set_name (SEAT (seat), name);
+        set_seat_properties (SEAT (seat), NULL);
+        if (!display_manager_add_seat (display_manager, SEAT (seat)))
+            return;
+
+        vnc_pool = g_list_append (vnc_pool, g_object_ref (seat));
+        g_signal_connect (seat, SEAT_SIGNAL_STOPPED, G_CALLBACK (vnc_pool_seat_stopped_cb), NULL);
+    }
+}
+
+static void
+vnc_seat_stopped_cb (Seat *seat)
+{
+    g_signal_handlers_disconnect_by_func (seat, vnc_seat_stopped_cb, NULL);
+    if (vnc_server)
+        vnc_server_connection_closed (vnc_server);
+}
+
 static void
 vnc_connection_cb (VNCServer *server, GSocket *connection)
 {
+    /* Only start keeping seats ready once VNC is being used */
+    vnc_pool_started = TRUE;
+
+    /* Use a seat that is already running if available */
+    if (vnc_pool)
+    {
+        g_autoptr(SeatXVNC) seat = vnc_pool->data;
+        vnc_pool = g_list_delete_link (vnc_pool, vnc_pool);
+        g_signal_handlers_disconnect_by_func (seat, vnc_pool_seat_stopped_cb, NULL);
+
+        g_signal_connect (seat, SEAT_SIGNAL_STOPPED, G_CALLBACK (vnc_seat_stopped_cb), NULL);
+        seat_xvnc_set_connection (seat, connection);
+        fill_vnc_pool ();
+        return;
+    }
+
     g_autoptr(SeatXVNC) seat = seat_xvnc_new (connection);
 
     g_autofree gchar *name = g_strdup_printf ("vnc%d", vnc_client_count);
@@ -285,13 +528,46 @@ vnc_connection_cb (VNCServer *server, GSocket *connection)
 
     seat_set_name (SEAT (seat), name);
     set_seat_properties (SEAT (seat), NULL);
-    display_manager_add_seat (display_manager, SEAT (seat));
+    if (display_manager_add_seat (display_manager, SEAT (seat)))
+        g_signal_connect (seat, SEAT_SIGNAL_STOPPED, G_CALLBACK (vnc_seat_stopped_cb), NULL);
+    else
+        vnc_server_connection_closed (server);
+
+    fill_vnc_pool ();
+}
+
+/* Apply the XDMCP settings that can be changed while running */
+static void
+configure_xdmcp_server (void)
+{
+    g_autofree gchar *hostname = config_get_string (config_get_instance (), "XDMCPServer", "hostname");
+    xdmcp_server_set_hostname (xdmcp_server, hostname);
+    xdmcp_server_set_report_load (xdmcp_server, config_get_boolean (config_get_instance (), "XDMCPServer", "report-load"));
+    xdmcp_server_set_max_sessions (xdmcp_server, MAX (config_get_integer (config_get_instance (), "XDMCPServer", "max-sessions"), 0));
+    g_autofree gchar *max_load = config_get_string (config_get_instance (), "XDMCPServer", "max-load");
+    xdmcp_server_set_max_load (xdmcp_server, max_load ? g_ascii_strtod (max_load, NULL) : 0);
+    xdmcp_server_set_busy_delay (xdmcp_server, MAX (config_get_integer (config_get_instance (), "XDMCPServer", "busy-delay"), 0));
+    xdmcp_server_set_reattach_timeout (xdmcp_server, MAX (config_get_integer (config_get_instance (), "XDMCPServer", "reattach-timeout"), 0));
+    xdmcp_server_set_rate_limit (xdmcp_server,
+                                 MAX (config_get_integer (config_get_instance (), "XDMCPServer", "rate-limit"), 0),
+                                 MAX (config_get_integer (config_get_instance (), "XDMCPServer", "rate-limit-burst"), 0));
+}
+
+/* Apply the VNC settings that can be changed while running */
+static void
+configure_vnc_server (void)
+{
+    vnc_server_set_max_seats (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "max-seats"), 0));
+    vnc_server_set_start_rate (vnc_server, MAX (config_get_integer (config_get_instance (), "VNCServer", "max-starts-per-second"), 0));
 }
 
 static void
 start_display_manager (void)
 {
-    display_manager_start (display_manager);
+    if (waiting_for_seat0)
+        display_manager_start_pending = TRUE;
+    else
+        display_manager_start (display_manager);
 
     /* Start the XDMCP server */
     if (config_get_boolean (config_get_instance (), "XDMCPServer", "enabled"))
@@ -306,8 +582,10 @@ start_display_manager (void)
         }
         g_autofree gchar *listen_address = config_get_string (config_get_instance (), "XDMCPServer", "listen-address");
         xdmcp_server_set_listen_address (xdmcp_server, listen_address);
-        g_autofree gchar *hostname = config_get_string (config_get_instance (), "XDMCPServer", "hostname");
-        xdmcp_server_set_hostname (xdmcp_server, hostname);
+        gint n_workers = config_get_integer (config_get_instance (), "XDMCPServer", "worker-threads");
+        if (n_workers > 0)
+            xdmcp_server_set_worker_threads (xdmcp_server, n_workers);
+        configure_xdmcp_server ();
         g_signal_connect (xdmcp_server, XDMCP_SERVER_SIGNAL_NEW_SESSION, G_CALLBACK (xdmcp_session_cb), NULL);
 
         g_autofree gchar *key_name = config_get_string (config_get_instance (), "XDMCPServer", "key");
@@ -378,6 +656,10 @@ start_display_manager (void)
         }
         g_autofree gchar *listen_address = config_get_string (config_get_instance (), "VNCServer", "listen-address");
         vnc_server_set_listen_address (vnc_server, listen_address);
+        gint backlog = config_get_integer (config_get_instance (), "VNCServer", "listen-backlog");
+        if (backlog > 0)
+            vnc_server_set_listen_backlog (vnc_server, backlog);
+        configure_vnc_server ();
         g_signal_connect (vnc_server, VNC_SERVER_SIGNAL_NEW_CONNECTION, G_CALLBACK (vnc_connection_cb), NULL);
 
         g_debug ("Starting VNC server on TCP/IP port %d", vnc_server_get_port (vnc_server));
@@ -385,10 +667,149 @@ start_display_manager (void)
     }
 }
 
+/* Settings that are only read when starting */
+static gboolean
+is_startup_key (const gchar *section, const gchar *key)
+{
+    if (strcmp (section, "LightDM") == 0)
+        return strcmp (key, "stop-timeout") != 0 && !g_str_has_prefix (key, "interactive-") && !g_str_has_prefix (key, "background-");
+    if (strcmp (section, "XDMCPServer") == 0)
+        return strcmp (key, "enabled") == 0 || strcmp (key, "port") == 0 || strcmp (key, "listen-address") == 0 || strcmp (key, "worker-threads") == 0 || strcmp (key, "key") == 0;
+    if (strcmp (section, "VNCServer") == 0)
+        return strcmp (key, "enabled") == 0 || strcmp (key, "port") == 0 || strcmp (key, "listen-address") == 0 || strcmp (key, "listen-backlog") == 0;
+    return FALSE;
+}
+
 static void
-service_ready_cb (DisplayManagerService *service)
+add_sections (GHashTable *sections, Configuration *config)
 {
-    start_display_manager ();
+    g_auto(GStrv) groups = config_get_groups (config);
+    for (gchar **i = groups; *i; i++)
+        g_hash_table_add (sections, g_strdup (*i));
+}
+
+static void
+resize_vnc_pool (void)
+{
+    gint pool_size = config_get_integer (config_get_instance (), "VNCServer", "pool-size");
+
+    /* Stop unused seats, these only have a greeter running */
+    while ((gint) g_list_length (vnc_pool) > MAX (pool_size, 0))
+    {
+        GList *link = g_list_last (vnc_pool);
+        g_autoptr(Seat) seat = link->data;
+        vnc_pool = g_list_delete_link (vnc_pool, link);
+        g_signal_handlers_disconnect_by_func (seat, vnc_pool_seat_stopped_cb, NULL);
+        seat_stop (seat);
+    }
+
+    fill_vnc_pool ();
+}
+
+/* Load the configuration again and apply what has changed without affecting running sessions */
+static void
+reload_config (void)
+{
+    if (display_manager_get_is_stopping (display_manager))
+        return;
+
+    g_autoptr(Configuration) config = config_new ();
+    GList *messages = NULL;
+    gboolean result = config_load_from_standard_locations (config, config_path, &messages);
+    for (GList *link = messages; link; link = link->next)
+        g_debug ("%s", (gchar *) link->data);
+    g_list_free_full (messages, g_free);
+    if (!result)
+    {
+        g_warning ("Failed to reload configuration, keeping current configuration");
+        return;
+    }
+    set_config_defaults (config);
+
+    g_autoptr(GHashTable) sections = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    add_sections (sections, config_get_instance ());
+    add_sections (sections, config);
+
+    gboolean seats_changed = FALSE, xdmcp_changed = FALSE, vnc_changed = FALSE;
+    g_autoptr(GPtrArray) removed_seat_keys = g_ptr_array_new_with_free_func (g_free);
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init (&iter, sections);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        const gchar *section = key;
+
+        g_autoptr(GHashTable) keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        g_auto(GStrv) old_keys = config_get_keys (config_get_instance (), section);
+        for (gint i = 0; old_keys && old_keys[i]; i++)
+            g_hash_table_add (keys, g_strdup (old_keys[i]));
+        g_auto(GStrv) new_keys = config_get_keys (config, section);
+        for (gint i = 0; new_keys && new_keys[i]; i++)
+            g_hash_table_add (keys, g_strdup (new_keys[i]));
+
+        GHashTableIter key_iter;
+        gpointer name;
+        g_hash_table_iter_init (&key_iter, keys);
+        while (g_hash_table_iter_next (&key_iter, &name, NULL))
+        {
+            g_autofree gchar *old_value = config_get_string (config_get_instance (), section, name);
+            g_autofree gchar *new_value = config_get_string (config, section, name);
+            if (g_strcmp0 (old_value, new_value) == 0)
+                continue;
+
+            if (is_startup_key (section, name))
+            {
+                g_warning ("[%s] %s has changed, restart to apply this", section, (gchar *) name);
+                continue;
+            }
+
+            g_debug ("[%s] %s changed", section, (gchar *) name);
+            if (new_value)
+                config_set_string (config_get_instance (), section, name, new_value);
+            else
+                config_remove_key (config_get_instance (), section, name);
+
+            if (g_str_has_prefix (section, "Seat:"))
+            {
+                seats_changed = TRUE;
+                if (!new_value)
+                    g_ptr_array_add (removed_seat_keys, g_strdup (name));
+            }
+            else if (strcmp (section, "XDMCPServer") == 0)
+                xdmcp_changed = TRUE;
+            else if (strcmp (section, "VNCServer") == 0)
+                vnc_changed = TRUE;
+        }
+    }
+
+    /* New settings are used for greeters and sessions started from now on */
+    if (seats_changed)
+    {
+        for (GList *link = display_manager_get_seats (display_manager); link; link = link->next)
+        {
+            Seat *seat = link->data;
+
+            /* The type is fixed once running and may be holding fallback types */
+            g_autofree gchar *type = g_strdup (seat_get_string_property (seat, "type"));
+            for (guint i = 0; i < removed_seat_keys->len; i++)
+                seat_set_property (seat, removed_seat_keys->pdata[i], NULL);
+            set_seat_properties (seat, g_object_get_data (G_OBJECT (seat), "config-seat-name"));
+            seat_set_property (seat, "type", type);
+        }
+    }
+    if (xdmcp_changed && xdmcp_server)
+        configure_xdmcp_server ();
+    if (vnc_changed && vnc_server)
+    {
+        configure_vnc_server ();
+        resize_vnc_pool ();
+    }
+
+    /* Greeters started from now on get the new settings */
+    greeter_resources_invalidate ();
+
+    /* Processes started from now on get the new scheduling */
+    process_load_priorities ();
 }
 
 static void
@@ -397,6 +818,20 @@ service_name_lost_cb (DisplayManagerService *service)
     exit (EXIT_FAILURE);
 }
 
+static void
+seat0_ready (void)
+{
+    if (!waiting_for_seat0)
+        return;
+
+    waiting_for_seat0 = FALSE;
+    if (display_manager_start_pending)
+    {
+        display_manager_start_pending = FALSE;
+        display_manager_start (display_manager);
+    }
+}
+
 static gboolean
 add_login1_seat (Login1Seat *login1_seat)
 {
@@ -537,7 +972,18 @@ login1_service_seat_added_cb (Login1Service *service, Login1Seat *login1_seat)
     else
         g_debug ("Seat %s added from logind without graphical output", login1_seat_get_id (login1_seat));
 
-    login1_add_seat (login1_seat);
+    gboolean started = login1_add_seat (login1_seat);
+
+    if (strcmp (login1_seat_get_id (login1_seat), "seat0") == 0)
+    {
+        if (!started)
+        {
+            g_debug ("Required seat has failed to start");
+            exit_code = EXIT_FAILURE;
+            display_manager_stop (display_manager);
+        }
+        seat0_ready ();
+    }
 }
 
 static void
@@ -752,81 +1198,29 @@ main (int argc, char **argv)
     }
 
     /* Load config file(s) */
-    if (!config_load_from_standard_locations (config_get_instance (), config_path, &messages))
-        exit (EXIT_FAILURE);
-    g_free (config_path);
+    gint64 config_start_time = g_get_monotonic_time ();
+    g_autofree gchar *config_cache_path = g_build_filename (cache_dir ? cache_dir : default_cache_dir, "config.cache", NULL);
+    if (!config_load_from_cache (config_get_instance (), config_cache_path, config_path, &messages))
+    {
+        if (!config_load_from_standard_locations (config_get_instance (), config_path, &messages))
+            exit (EXIT_FAILURE);
+
+        /* Save the merged configuration so the next start (and greeters) don't have to parse it all again */
+        g_autoptr(GError) error = NULL;
+        if (!config_write_cache (config_get_instance (), config_cache_path, config_path, &error))
+            messages = g_list_append (messages, g_strdup_printf ("Failed to write configuration cache: %s", error->message));
+    }
+    gint64 config_end_time = g_get_monotonic_time ();
+    greeter_resources_set_config_path (config_path);
 
     /* Set default values */
-    if (!config_has_key (config_get_instance (), "LightDM", "start-default-seat"))
-        config_set_boolean (config_get_instance (), "LightDM", "start-default-seat", TRUE);
-    if (!config_has_key (config_get_instance (), "LightDM", "minimum-vt"))
-        config_set_integer (config_get_instance (), "LightDM", "minimum-vt", 7);
-    if (!config_has_key (config_get_instance (), "LightDM", "guest-account-script"))
-        config_set_string (config_get_instance (), "LightDM", "guest-account-script", "guest-account");
-    if (!config_has_key (config_get_instance (), "LightDM", "greeter-user"))
-        config_set_string (config_get_instance (), "LightDM", "greeter-user", GREETER_USER);
-    if (!config_has_key (config_get_instance (), "LightDM", "lock-memory"))
-        config_set_boolean (config_get_instance (), "LightDM", "lock-memory", TRUE);
-    if (!config_has_key (config_get_instance (), "LightDM", "backup-logs"))
-        config_set_boolean (config_get_instance (), "LightDM", "backup-logs", TRUE);
-    if (!config_has_key (config_get_instance (), "LightDM", "dbus-service"))
-        config_set_boolean (config_get_instance (), "LightDM", "dbus-service", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "type"))
-        config_set_string (config_get_instance (), "Seat:*", "type", "local");
-    if (!config_has_key (config_get_instance (), "Seat:*", "pam-service"))
-        config_set_string (config_get_instance (), "Seat:*", "pam-service", "lightdm");
-    if (!config_has_key (config_get_instance (), "Seat:*", "pam-autologin-service"))
-        config_set_string (config_get_instance (), "Seat:*", "pam-autologin-service", "lightdm-autologin");
-    if (!config_has_key (config_get_instance (), "Seat:*", "pam-greeter-service"))
-        config_set_string (config_get_instance (), "Seat:*", "pam-greeter-service", "lightdm-greeter");
-    if (!config_has_key (config_get_instance (), "Seat:*", "xserver-command"))
-        config_set_string (config_get_instance (), "Seat:*", "xserver-command", "X");
-    if (!config_has_key (config_get_instance (), "Seat:*", "xmir-command"))
-        config_set_string (config_get_instance (), "Seat:*", "xmir-command", "Xmir");
-    if (!config_has_key (config_get_instance (), "Seat:*", "xserver-share"))
-        config_set_boolean (config_get_instance (), "Seat:*", "xserver-share", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "start-session"))
-        config_set_boolean (config_get_instance (), "Seat:*", "start-session", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "allow-user-switching"))
-        config_set_boolean (config_get_instance (), "Seat:*", "allow-user-switching", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "allow-guest"))
-        config_set_boolean (config_get_instance (), "Seat:*", "allow-guest", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "greeter-allow-guest"))
-        config_set_boolean (config_get_instance (), "Seat:*", "greeter-allow-guest", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "greeter-show-remote-login"))
-        config_set_boolean (config_get_instance (), "Seat:*", "greeter-show-remote-login", TRUE);
-    if (!config_has_key (config_get_instance (), "Seat:*", "greeter-session"))
-        config_set_string (config_get_instance (), "Seat:*", "greeter-session", DEFAULT_GREETER_SESSION);
-    if (!config_has_key (config_get_instance (), "Seat:*", "user-session"))
-        config_set_string (config_get_instance (), "Seat:*", "user-session", DEFAULT_USER_SESSION);
-    if (!config_has_key (config_get_instance (), "Seat:*", "session-wrapper"))
-        config_set_string (config_get_instance (), "Seat:*", "session-wrapper", "lightdm-session");
+    set_config_defaults (config_get_instance ());
     if (!config_has_key (config_get_instance (), "LightDM", "log-directory"))
         config_set_string (config_get_instance (), "LightDM", "log-directory", default_log_dir);
     if (!config_has_key (config_get_instance (), "LightDM", "run-directory"))
         config_set_string (config_get_instance (), "LightDM", "run-directory", default_run_dir);
     if (!config_has_key (config_get_instance (), "LightDM", "cache-directory"))
         config_set_string (config_get_instance (), "LightDM", "cache-directory", default_cache_dir);
-    if (!config_has_key (config_get_instance (), "LightDM", "sessions-directory"))
-        config_set_string (config_get_instance (), "LightDM", "sessions-directory", SESSIONS_DIR);
-    if (!config_has_key (config_get_instance (), "LightDM", "remote-sessions-directory"))
-        config_set_string (config_get_instance (), "LightDM", "remote-sessions-directory", REMOTE_SESSIONS_DIR);
-    if (!config_has_key (config_get_instance (), "LightDM", "greeters-directory"))
-    {
-        g_autoptr(GPtrArray) dirs = g_ptr_array_new_with_free_func (g_free);
-        const gchar * const *data_dirs = g_get_system_data_dirs ();
-        for (int i = 0; data_dirs[i]; i++)
-            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "lightdm/greeters", NULL));
-        for (int i = 0; data_dirs[i]; i++)
-            g_ptr_array_add (dirs, g_build_filename (data_dirs[i], "xgreeters", NULL));
-        g_ptr_array_add (dirs, NULL);
-        g_autofree gchar *value = g_strjoinv (":", (gchar **) dirs->pdata);
-        config_set_string (config_get_instance (), "LightDM", "greeters-directory", value);
-    }
-    if (!config_has_key (config_get_instance (), "XDMCPServer", "hostname"))
-        config_set_string (config_get_instance (), "XDMCPServer", "hostname", g_get_host_name ());
-    if (!config_has_key (config_get_instance (), "LightDM", "logind-check-graphical"))
-        config_set_boolean (config_get_instance (), "LightDM", "logind-check-graphical", TRUE);
 
     /* Override defaults */
     if (log_dir)
@@ -851,6 +1245,24 @@ main (int argc, char **argv)
         g_warning ("Failed to make cache directory %s: %s", cache_dir_path, strerror (errno));
 
     log_init ();
+    trace_add ("config-load", config_start_time, config_end_time);
+
+    /* Fork the session launcher while nothing but the log is open, so sessions
+     * can't inherit descriptors that belong to other sessions */
+    session_launcher_start ();
+
+    /* Record what happens so it can be looked at with dm-tool dump-events after something goes wrong */
+    gint event_buffer_size = config_get_integer (config_get_instance (), "LightDM", "event-buffer-size");
+    if (event_buffer_size > 0)
+    {
+        g_autofree gchar *events_path = g_build_filename (run_dir_path, "events", NULL);
+        flight_recorder_start (events_path, event_buffer_size);
+    }
+
+    process_load_priorities ();
+
+    /* Get the files for the first greeter off the disk while the seats are being set up */
+    boot_readahead_start ();
 
     /* Show queued messages once logging is complete */
     for (GList *link = messages; link; link = link->next)
@@ -862,6 +1274,9 @@ main (int argc, char **argv)
     if (getenv ("DISPLAY"))
         g_debug ("Using Xephyr for X servers");
 
+    /* Load users in the background, greeters are sent users as they are loaded */
+    shared_data_manager_load_users (shared_data_manager_get_instance ());
+
     display_manager = display_manager_new ();
     g_signal_connect (display_manager, DISPLAY_MANAGER_SIGNAL_STOPPED, G_CALLBACK (display_manager_stopped_cb), NULL);
     g_signal_connect (display_manager, DISPLAY_MANAGER_SIGNAL_SEAT_REMOVED, G_CALLBACK (display_manager_seat_removed_cb), NULL);
@@ -870,12 +1285,9 @@ main (int argc, char **argv)
     {
         display_manager_service = display_manager_service_new (display_manager);
         g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_ADD_XLOCAL_SEAT, G_CALLBACK (service_add_xlocal_seat_cb), NULL);
-        g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_READY, G_CALLBACK (service_ready_cb), NULL);
         g_signal_connect (display_manager_service, DISPLAY_MANAGER_SERVICE_SIGNAL_NAME_LOST, G_CALLBACK (service_name_lost_cb), NULL);
         display_manager_service_start (display_manager_service);
     }
-    else
-        start_display_manager ();
 
     shared_data_manager_start (shared_data_manager_get_instance ());
 
@@ -890,12 +1302,9 @@ main (int argc, char **argv)
             g_signal_connect (login1_service_get_instance (), LOGIN1_SERVICE_SIGNAL_SEAT_ADDED, G_CALLBACK (login1_service_seat_added_cb), NULL);
             g_signal_connect (login1_service_get_instance (), LOGIN1_SERVICE_SIGNAL_SEAT_REMOVED, G_CALLBACK (login1_service_seat_removed_cb), NULL);
 
-            for (GList *link = login1_service_get_seats (login1_service_get_instance ()); link; link = link->next)
-            {
-                Login1Seat *login1_seat = link->data;
-                if (!login1_add_seat (login1_seat))
-                    return EXIT_FAILURE;
-            }
+            /* Seats are started as logind reports their properties; only
+             * seat0 needs to be up before Plymouth is stopped */
+            waiting_for_seat0 = login1_service_get_seat (login1_service_get_instance (), "seat0") != NULL;
         }
     }
     else
@@ -927,8 +1336,27 @@ main (int argc, char **argv)
         }
     }
 
+    /* Start once the seats are being brought up so seat0 can hold Plymouth
+     * back, the D-Bus objects for them are added when the bus name is acquired */
+    start_display_manager ();
+
+    /* Have guest accounts ready before anyone logs into one */
+    guest_account_fill_pool ();
+
+    /* Report when something blocks the main loop */
+    watchdog_start (config_get_integer (config_get_instance (), "LightDM", "stall-threshold"));
+
+    /* Export metrics for monitoring */
+    g_autofree gchar *metrics_socket = config_get_string (config_get_instance (), "LightDM", "metrics-socket");
+    gint metrics_port = config_get_integer (config_get_instance (), "LightDM", "metrics-port");
+    if ((metrics_socket && metrics_socket[0] != '\0') || metrics_port > 0)
+        metrics_start (display_manager, metrics_socket && metrics_socket[0] != '\0' ? metrics_socket : NULL, MAX (metrics_port, 0));
+
     g_main_loop_run (loop);
 
+    /* Stop exporting metrics */
+    metrics_stop ();
+
     /* Clean up shared data manager */
     shared_data_manager_cleanup ();
 
@@ -941,6 +1369,9 @@ main (int argc, char **argv)
     /* Clean up display manager */
     g_clear_object (&display_manager);
 
+    /* Remove guest accounts */
+    guest_account_cleanup_pool ();
+
     g_debug ("Exiting with return value %d", exit_code);
     return exit_code;
 }
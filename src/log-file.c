@@ -9,14 +9,81 @@
  * license.
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
 
 #include "log-file.h"
 
-int
-log_file_open (const gchar *log_filename, LogMode log_mode)
+/*
+ * In LOG_MODE_ROTATE the process writes into a pipe instead of the file. A
+ * sink reads the pipe and copies it into the file, and when the file grows
+ * past the size limit it is moved to .1 (older logs to .2, .3 ...) and a new
+ * one started. Rotated logs are compressed in another thread so the sink
+ * keeps reading. Output that can't be written is counted and noted in the
+ * log once writing works again.
+ *
+ * The data is moved from the pipe into the file with splice() so it doesn't
+ * pass through the daemon. That doesn't work on files opened for appending,
+ * so the sink writes at the end of the file itself, and it falls back to
+ * reading and writing if the kernel or filesystem can't splice.
+ */
+
+static LogLimits limits = { 0, 5, TRUE };
+
+typedef struct
+{
+    /* File being logged to */
+    gchar *path;
+
+    /* Pipe being read from */
+    int input_fd;
+
+    /* File being written to or -1 if it couldn't be opened */
+    int output_fd;
+
+    /* Number of bytes in the current file */
+    guint64 size;
+
+    /* Number of bytes that couldn't be written */
+    guint64 n_dropped;
+
+    /* TRUE if the pipe can be spliced into the file */
+    gboolean can_splice;
+
+    /* Thread compressing the last rotated log */
+    GThread *compress_thread;
+} LogSink;
+
+void
+log_file_set_limits (const LogLimits *new_limits)
+{
+    limits = *new_limits;
+}
+
+const LogLimits *
+log_file_get_limits (void)
+{
+    return &limits;
+}
+
+LogMode
+log_file_get_mode (gboolean backup_logs)
+{
+    if (limits.max_size > 0)
+        return LOG_MODE_ROTATE;
+    return backup_logs ? LOG_MODE_BACKUP_AND_TRUNCATE : LOG_MODE_APPEND;
+}
+
+static int
+open_file (const gchar *log_filename, LogMode log_mode)
 {
     int open_flags = O_WRONLY | O_CREAT;
     if (log_mode == LOG_MODE_BACKUP_AND_TRUNCATE)
@@ -29,7 +96,7 @@ log_file_open (const gchar *log_filename, LogMode log_mode)
 
         open_flags |= O_TRUNC;
     }
-    else if (log_mode == LOG_MODE_APPEND)
+    else if (log_mode == LOG_MODE_APPEND || log_mode == LOG_MODE_ROTATE)
     {
         /* Keep appending to it */
         open_flags |= O_APPEND;
@@ -48,3 +115,265 @@ log_file_open (const gchar *log_filename, LogMode log_mode)
 
     return log_fd;
 }
+
+static gboolean
+write_all (int fd, const gchar *data, gsize length)
+{
+    while (length > 0)
+    {
+        ssize_t n_written = write (fd, data, length);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+            return FALSE;
+        data += n_written;
+        length -= n_written;
+    }
+
+    return TRUE;
+}
+
+static gpointer
+compress_thread_cb (gpointer data)
+{
+    g_autofree gchar *path = data;
+    g_autofree gchar *compressed_path = g_strdup_printf ("%s.gz", path);
+
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    g_autoptr(GFileInputStream) input = g_file_read (file, NULL, NULL);
+    if (!input)
+        return NULL;
+    g_autoptr(GFile) compressed_file = g_file_new_for_path (compressed_path);
+    g_autoptr(GFileOutputStream) output = g_file_replace (compressed_file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, NULL);
+    if (!output)
+        return NULL;
+
+    g_autoptr(GZlibCompressor) compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    g_autoptr(GOutputStream) stream = g_converter_output_stream_new (G_OUTPUT_STREAM (output), G_CONVERTER (compressor));
+    if (g_output_stream_splice (stream, G_INPUT_STREAM (input), G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET, NULL, NULL) >= 0)
+        unlink (path);
+
+    return NULL;
+}
+
+static void
+rotate (LogSink *sink)
+{
+    /* The last rotated log has to be finished before it can be moved */
+    if (sink->compress_thread)
+        g_thread_join (sink->compress_thread);
+    sink->compress_thread = NULL;
+
+    if (limits.n_files == 0)
+    {
+        if (sink->output_fd >= 0 && ftruncate (sink->output_fd, 0) == 0 && lseek (sink->output_fd, 0, SEEK_SET) == 0)
+            sink->size = 0;
+        return;
+    }
+
+    const gchar *suffix = limits.compress ? ".gz" : "";
+    for (guint i = limits.n_files; i > 1; i--)
+    {
+        g_autofree gchar *from = g_strdup_printf ("%s.%u%s", sink->path, i - 1, suffix);
+        g_autofree gchar *to = g_strdup_printf ("%s.%u%s", sink->path, i, suffix);
+        rename (from, to);
+    }
+    g_autofree gchar *rotated_path = g_strdup_printf ("%s.1", sink->path);
+    rename (sink->path, rotated_path);
+
+    if (sink->output_fd >= 0)
+        close (sink->output_fd);
+    sink->output_fd = open (sink->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    sink->size = 0;
+
+    if (limits.compress)
+        sink->compress_thread = g_thread_new ("log-compress", compress_thread_cb, g_steal_pointer (&rotated_path));
+}
+
+static void
+sink_write (LogSink *sink, const gchar *data, gsize length)
+{
+    if (sink->output_fd >= 0 && sink->n_dropped > 0)
+    {
+        gchar text[64];
+        gsize text_length = g_snprintf (text, sizeof (text), "WARNING: Dropped %" G_GUINT64_FORMAT " bytes of log output\n", sink->n_dropped);
+        if (write_all (sink->output_fd, text, text_length))
+        {
+            sink->size += text_length;
+            sink->n_dropped = 0;
+        }
+    }
+
+    if (sink->output_fd >= 0 && write_all (sink->output_fd, data, length))
+        sink->size += length;
+    else
+        sink->n_dropped += length;
+}
+
+/* Move up to a pipe's worth of data into the file, returning the number of
+ * bytes moved, 0 at the end of the pipe or -1 if splicing doesn't work */
+static ssize_t
+sink_splice (LogSink *sink)
+{
+    gsize length = 65536;
+    if (limits.max_size > 0)
+    {
+        if (sink->size >= limits.max_size)
+        {
+            rotate (sink);
+            if (sink->output_fd < 0)
+                return -1;
+        }
+        length = MIN (length, limits.max_size - sink->size);
+    }
+
+    while (TRUE)
+    {
+        ssize_t n_moved = splice (sink->input_fd, NULL, sink->output_fd, NULL, length, SPLICE_F_MOVE);
+        if (n_moved < 0 && errno == EINTR)
+            continue;
+        if (n_moved > 0)
+            sink->size += n_moved;
+        return n_moved;
+    }
+}
+
+/* Copy from the pipe until everything writing to it has closed it */
+static void
+run_sink (LogSink *sink)
+{
+    gchar buffer[8192];
+    while (TRUE)
+    {
+        if (sink->can_splice && sink->output_fd >= 0 && sink->n_dropped == 0)
+        {
+            ssize_t n_moved = sink_splice (sink);
+            if (n_moved == 0)
+                break;
+            if (n_moved > 0)
+                continue;
+            sink->can_splice = FALSE;
+        }
+
+        ssize_t n_read = read (sink->input_fd, buffer, sizeof (buffer));
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        if (n_read <= 0)
+            break;
+
+        if (limits.max_size > 0 && sink->size > 0 && sink->size + n_read > limits.max_size)
+            rotate (sink);
+        sink_write (sink, buffer, n_read);
+    }
+
+    if (sink->compress_thread)
+        g_thread_join (sink->compress_thread);
+    close (sink->input_fd);
+    if (sink->output_fd >= 0)
+        close (sink->output_fd);
+    g_free (sink->path);
+    g_free (sink);
+}
+
+static gpointer
+sink_thread_cb (gpointer data)
+{
+    run_sink (data);
+    return NULL;
+}
+
+/* Open the log and a pipe to it, returning the end to write to */
+static LogSink *
+open_sink (const gchar *log_filename, int *write_fd)
+{
+    int output_fd = open_file (log_filename, LOG_MODE_ROTATE);
+    if (output_fd < 0)
+        return NULL;
+    fcntl (output_fd, F_SETFD, FD_CLOEXEC);
+
+    /* The sink is the only writer, so it can keep its own place at the end of the file */
+    gboolean can_splice = fcntl (output_fd, F_SETFL, fcntl (output_fd, F_GETFL) & ~O_APPEND) == 0 &&
+                          lseek (output_fd, 0, SEEK_END) >= 0;
+
+    /* Keep both ends out of other children, the one being logged gets its own copy */
+    int fds[2];
+    g_autoptr(GError) error = NULL;
+    if (!g_unix_open_pipe (fds, FD_CLOEXEC, &error))
+    {
+        g_warning ("Failed to open pipe to log file %s: %s", log_filename, error->message);
+        close (output_fd);
+        return NULL;
+    }
+
+    LogSink *sink = g_new0 (LogSink, 1);
+    sink->path = g_strdup (log_filename);
+    sink->input_fd = fds[0];
+    sink->output_fd = output_fd;
+    sink->can_splice = can_splice;
+    struct stat info;
+    if (fstat (output_fd, &info) == 0)
+        sink->size = info.st_size;
+    *write_fd = fds[1];
+
+    return sink;
+}
+
+int
+log_file_open (const gchar *log_filename, LogMode log_mode)
+{
+    if (log_mode != LOG_MODE_ROTATE)
+        return open_file (log_filename, log_mode);
+
+    int write_fd;
+    LogSink *sink = open_sink (log_filename, &write_fd);
+    if (!sink)
+        return -1;
+    g_thread_unref (g_thread_new ("log-sink", sink_thread_cb, sink));
+
+    return write_fd;
+}
+
+/* Same as log_file_open, but for a process that is about to exec, so the
+ * sink runs in its own process instead of a thread that would be lost */
+int
+log_file_open_detached (const gchar *log_filename, LogMode log_mode)
+{
+    if (log_mode != LOG_MODE_ROTATE)
+        return open_file (log_filename, log_mode);
+
+    int write_fd;
+    LogSink *sink = open_sink (log_filename, &write_fd);
+    if (!sink)
+        return -1;
+
+    /* Fork twice so the sink isn't left as a child of the program being run */
+    pid_t pid = fork ();
+    if (pid == 0)
+    {
+        if (fork () != 0)
+            _exit (EXIT_SUCCESS);
+
+        /* Only hold the pipe and the log open, so nothing else is kept alive by the sink */
+        long max_fd = MIN (sysconf (_SC_OPEN_MAX), 65536);
+        for (int fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+            if (fd != sink->input_fd && fd != sink->output_fd)
+                close (fd);
+
+        run_sink (sink);
+        _exit (EXIT_SUCCESS);
+    }
+
+    close (sink->input_fd);
+    if (sink->output_fd >= 0)
+        close (sink->output_fd);
+    g_free (sink->path);
+    g_free (sink);
+    if (pid < 0)
+    {
+        close (write_fd);
+        return -1;
+    }
+    waitpid (pid, NULL, 0);
+
+    return write_fd;
+}
@@ -18,9 +18,30 @@ typedef enum
 {
     LOG_MODE_INVALID = -1,
     LOG_MODE_BACKUP_AND_TRUNCATE,
-    LOG_MODE_APPEND
+    LOG_MODE_APPEND,
+    LOG_MODE_ROTATE
 } LogMode;
 
+typedef struct
+{
+    /* Size in bytes a log can grow to before it is rotated, 0 for no limit */
+    guint64 max_size;
+
+    /* Number of rotated logs to keep */
+    guint n_files;
+
+    /* TRUE if rotated logs are compressed */
+    gboolean compress;
+} LogLimits;
+
+void log_file_set_limits (const LogLimits *limits);
+
+const LogLimits *log_file_get_limits (void);
+
+LogMode log_file_get_mode (gboolean backup_logs);
+
 int log_file_open (const gchar *log_filename, LogMode log_mode);
 
+int log_file_open_detached (const gchar *log_filename, LogMode log_mode);
+
 #endif /* LOG_FILE_H_ */
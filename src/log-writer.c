@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "log-writer.h"
+
+/*
+ * Log messages are copied into a ring buffer and written out by a separate
+ * thread, so a slow disk doesn't stall the main loop. If the buffer fills up
+ * messages are dropped and a count of them is written once there is space.
+ * The lock is only held while copying into and out of the buffer indexes,
+ * the writes are done without it.
+ */
+
+#define BUFFER_SIZE (256 * 1024)
+
+/* File being logged to */
+static int log_fd = -1;
+
+/* Thread writing to the file */
+static GThread *writer_thread = NULL;
+
+/* Set in forked children, which don't have the writer thread */
+static gboolean is_child = FALSE;
+
+static GMutex lock;
+static GCond data_cond;
+static GCond written_cond;
+
+/* Ring buffer. Data is in [tail, head), both only ever increase */
+static gchar *buffer = NULL;
+static guint64 head = 0;
+static guint64 tail = 0;
+
+/* Number of messages dropped since the last write */
+static guint n_dropped = 0;
+
+/* TRUE when the writer thread should exit once the buffer is empty */
+static gboolean stopping = FALSE;
+
+static void
+write_all (const gchar *text, gsize text_length)
+{
+    while (text_length > 0)
+    {
+        ssize_t n_written = write (log_fd, text, text_length);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+            return;
+        text += n_written;
+        text_length -= n_written;
+    }
+}
+
+static gpointer
+writer_thread_cb (gpointer data)
+{
+    g_mutex_lock (&lock);
+    while (TRUE)
+    {
+        while (head == tail && n_dropped == 0 && !stopping)
+            g_cond_wait (&data_cond, &lock);
+        if (head == tail && n_dropped == 0 && stopping)
+            break;
+
+        guint64 start = tail, end = head;
+        guint dropped = n_dropped;
+        n_dropped = 0;
+        g_mutex_unlock (&lock);
+
+        /* Write everything available in one go, in two parts if it wraps around the buffer */
+        struct iovec iov[3];
+        int n_iov = 0;
+        gsize offset = start % BUFFER_SIZE, length = end - start;
+        gsize first_length = MIN (length, BUFFER_SIZE - offset);
+        if (first_length > 0)
+        {
+            iov[n_iov].iov_base = buffer + offset;
+            iov[n_iov].iov_len = first_length;
+            n_iov++;
+        }
+        if (length > first_length)
+        {
+            iov[n_iov].iov_base = buffer;
+            iov[n_iov].iov_len = length - first_length;
+            n_iov++;
+        }
+        gchar dropped_text[64];
+        if (dropped > 0)
+        {
+            iov[n_iov].iov_base = dropped_text;
+            iov[n_iov].iov_len = g_snprintf (dropped_text, sizeof (dropped_text), "WARNING: Dropped %u log messages\n", dropped);
+            n_iov++;
+        }
+
+        ssize_t n_written;
+        do
+            n_written = writev (log_fd, iov, n_iov);
+        while (n_written < 0 && errno == EINTR);
+        /* Rarely a write is short, finish it off piece by piece */
+        gsize total = 0;
+        for (int i = 0; i < n_iov; i++)
+            total += iov[i].iov_len;
+        if (n_written >= 0 && (gsize) n_written < total)
+        {
+            gsize skip = n_written;
+            for (int i = 0; i < n_iov; i++)
+            {
+                if (skip >= iov[i].iov_len)
+                {
+                    skip -= iov[i].iov_len;
+                    continue;
+                }
+                write_all ((const gchar *) iov[i].iov_base + skip, iov[i].iov_len - skip);
+                skip = 0;
+            }
+        }
+
+        g_mutex_lock (&lock);
+        tail = end;
+        g_cond_broadcast (&written_cond);
+    }
+    g_mutex_unlock (&lock);
+
+    return NULL;
+}
+
+static void
+atfork_child (void)
+{
+    /* Only this thread exists in the child, so write directly */
+    is_child = TRUE;
+}
+
+void
+log_writer_start (int fd)
+{
+    log_fd = fd;
+    if (log_fd < 0)
+        return;
+
+    buffer = g_malloc (BUFFER_SIZE);
+    pthread_atfork (NULL, NULL, atfork_child);
+    writer_thread = g_thread_new ("log-writer", writer_thread_cb, NULL);
+
+    /* Make sure everything is written out when exiting */
+    atexit (log_writer_stop);
+}
+
+void
+log_writer_write (const gchar *text, gsize text_length)
+{
+    if (log_fd < 0)
+        return;
+
+    if (!writer_thread || is_child)
+    {
+        write_all (text, text_length);
+        return;
+    }
+
+    g_mutex_lock (&lock);
+    if (text_length > BUFFER_SIZE - (head - tail))
+        n_dropped++;
+    else
+    {
+        gsize offset = head % BUFFER_SIZE;
+        gsize first_length = MIN (text_length, BUFFER_SIZE - offset);
+        memcpy (buffer + offset, text, first_length);
+        memcpy (buffer, text + first_length, text_length - first_length);
+        head += text_length;
+    }
+    g_cond_signal (&data_cond);
+    g_mutex_unlock (&lock);
+}
+
+void
+log_writer_flush (void)
+{
+    if (!writer_thread || is_child)
+        return;
+
+    g_mutex_lock (&lock);
+    guint64 end = head;
+    while (tail < end)
+        g_cond_wait (&written_cond, &lock);
+    g_mutex_unlock (&lock);
+}
+
+void
+log_writer_stop (void)
+{
+    if (!writer_thread || is_child)
+        return;
+
+    g_mutex_lock (&lock);
+    stopping = TRUE;
+    g_cond_signal (&data_cond);
+    g_mutex_unlock (&lock);
+
+    g_thread_join (writer_thread);
+    writer_thread = NULL;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef LOG_WRITER_H_
+#define LOG_WRITER_H_
+
+#include <glib.h>
+
+void log_writer_start (int fd);
+
+void log_writer_write (const gchar *text, gsize text_length);
+
+void log_writer_flush (void);
+
+void log_writer_stop (void);
+
+#endif /* LOG_WRITER_H_ */
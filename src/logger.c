@@ -2,6 +2,8 @@
 
 G_DEFINE_INTERFACE (Logger, logger, G_TYPE_INVALID)
 
+static gboolean debug_enabled = TRUE;
+
 static void
 logger_logv_default (Logger *self, GLogLevelFlags log_level, const gchar *format, va_list ap) __attribute__ ((format (printf, 3, 0)));
 
@@ -11,6 +13,18 @@ logger_default_init (LoggerInterface *iface)
     iface->logv = &logger_logv_default;
 }
 
+gboolean
+logger_get_debug_enabled (void)
+{
+    return debug_enabled;
+}
+
+void
+logger_set_debug_enabled (gboolean enabled)
+{
+    debug_enabled = enabled;
+}
+
 gint
 logger_logprefix (Logger *self, gchar *buf, gulong buflen)
 {
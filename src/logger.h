@@ -49,9 +49,23 @@ void logger_logv (Logger *self, GLogLevelFlags log_level, const gchar *format, v
 /*! \brief convenience wrapper around \c logger_logv() */
 void logger_log (Logger *self, GLogLevelFlags log_level, const gchar *format, ...) __attribute__ ((format (printf, 3, 4)));
 
-/* convenience wrappers around logger_log() */
+/*!
+ * \brief check if debug messages are being logged
+ *
+ * use this to skip building text that is only used in debug messages
+ */
+gboolean logger_get_debug_enabled (void);
+
+/*! \brief set if debug messages are logged, they are by default */
+void logger_set_debug_enabled (gboolean enabled);
+
+/* convenience wrappers around logger_log(), the arguments to l_debug() are
+ * only evaluated if debug messages are enabled */
 #define l_debug(self, ...) \
-    logger_log (LOGGER (self), G_LOG_LEVEL_DEBUG, __VA_ARGS__)
+    G_STMT_START { \
+        if (logger_get_debug_enabled ()) \
+            logger_log (LOGGER (self), G_LOG_LEVEL_DEBUG, __VA_ARGS__); \
+    } G_STMT_END
 #define l_warning(self, ...) \
     logger_log (LOGGER (self), G_LOG_LEVEL_WARNING, __VA_ARGS__)
 
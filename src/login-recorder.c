@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <utmp.h>
+
+#if HAVE_LIBAUDIT
+#include <libaudit.h>
+#include <gmodule.h>
+#endif
+
+#include "login-recorder.h"
+
+/*
+ * Writing to wtmp and btmp can take a long time when they are large and on
+ * slow storage, and the audit daemon can be backlogged. So the session child
+ * isn't held up authenticating or starting the session, records are written
+ * in order by a thread. The queue is bounded, adding a record waits if the
+ * thread is that far behind. All records are written before the process exits.
+ */
+
+/* Most records waiting to be written */
+#define MAX_QUEUED_RECORDS 32
+
+typedef enum
+{
+    RECORD_UTMP,
+    RECORD_AUDIT
+} RecordType;
+
+typedef struct
+{
+    RecordType type;
+
+    /* Login record and where to write it */
+    struct utmpx ut;
+    gboolean update_utmp;
+    gchar *wtmp_file;
+
+    /* Audit event */
+    int audit_type;
+    gchar *username;
+    uid_t uid;
+    gchar *remote_host_name;
+    gchar *tty;
+    gboolean success;
+} Record;
+
+static GMutex queue_mutex;
+static GCond queue_cond;
+static GQueue queue = G_QUEUE_INIT;
+
+/* TRUE while the thread is writing a record taken from the queue */
+static gboolean writing = FALSE;
+
+static GThread *thread = NULL;
+
+#if HAVE_LIBAUDIT
+/* libaudit is only loaded when the first event is written, most session children never send one */
+#define AUDIT_LIBRARY_NAME "libaudit.so.1"
+
+typedef int (*AuditOpenFunc) (void);
+typedef int (*AuditLogAcctMessageFunc) (int audit_fd, int type, const char *pgname, const char *op, const char *name, unsigned int id, const char *host, const char *addr, const char *tty, int result);
+
+static gboolean audit_loaded = FALSE;
+static AuditOpenFunc audit_open_func = NULL;
+static AuditLogAcctMessageFunc audit_log_acct_message_func = NULL;
+
+/* Connection to the audit system, kept open for all events */
+static int audit_fd = -1;
+#endif
+
+static void
+record_free (Record *record)
+{
+    g_free (record->wtmp_file);
+    g_free (record->username);
+    g_free (record->remote_host_name);
+    g_free (record->tty);
+    g_free (record);
+}
+
+/* GNU provides this but we can't rely on that so let's make our own version */
+static void
+updwtmpx (const gchar *wtmp_file, const struct utmpx *ut)
+{
+    struct utmp u;
+    memset (&u, 0, sizeof (u));
+    u.ut_type = ut->ut_type;
+    u.ut_pid = ut->ut_pid;
+    strncpy (u.ut_line, ut->ut_line, sizeof (u.ut_line));
+    strncpy (u.ut_id, ut->ut_id, sizeof (u.ut_id));
+    strncpy (u.ut_user, ut->ut_user, sizeof (u.ut_user));
+    strncpy (u.ut_host, ut->ut_host, sizeof (u.ut_host));
+    u.ut_tv.tv_sec = ut->ut_tv.tv_sec;
+    u.ut_tv.tv_usec = ut->ut_tv.tv_usec;
+
+    updwtmp (wtmp_file, &u);
+}
+
+static void
+write_utmp (Record *record)
+{
+    if (record->update_utmp)
+    {
+        setutxent ();
+        if (!pututxline (&record->ut))
+            g_printerr ("Failed to write utmpx: %s\n", strerror (errno));
+        endutxent ();
+    }
+    if (record->wtmp_file)
+        updwtmpx (record->wtmp_file, &record->ut);
+}
+
+static void
+write_audit (Record *record)
+{
+#if HAVE_LIBAUDIT
+    if (!audit_loaded)
+    {
+        audit_loaded = TRUE;
+
+        GModule *module = g_module_open (AUDIT_LIBRARY_NAME, G_MODULE_BIND_LAZY);
+        if (!module)
+            g_printerr ("Failed to load %s: %s\n", AUDIT_LIBRARY_NAME, g_module_error ());
+        else
+        {
+            g_module_make_resident (module);
+
+            /* Look the functions up in the global scope, so they can still be replaced with LD_PRELOAD */
+            GModule *global = g_module_open (NULL, G_MODULE_BIND_LAZY);
+            if (!g_module_symbol (global, "audit_open", (gpointer *) &audit_open_func) ||
+                !g_module_symbol (global, "audit_log_acct_message", (gpointer *) &audit_log_acct_message_func))
+            {
+                g_printerr ("Failed to find audit functions in %s: %s\n", AUDIT_LIBRARY_NAME, g_module_error ());
+                audit_open_func = NULL;
+                audit_log_acct_message_func = NULL;
+            }
+            g_module_close (global);
+        }
+    }
+    if (!audit_open_func)
+        return;
+
+    if (audit_fd < 0)
+    {
+        audit_fd = audit_open_func ();
+        if (audit_fd < 0)
+        {
+            g_printerr ("Error opening audit socket: %s\n", strerror (errno));
+            return;
+        }
+    }
+
+    const char *op = NULL;
+    if (record->audit_type == AUDIT_USER_LOGIN)
+        op = "login";
+    else if (record->audit_type == AUDIT_USER_LOGOUT)
+        op = "logout";
+    int result = record->success == TRUE ? 1 : 0;
+
+    if (audit_log_acct_message_func (audit_fd, record->audit_type, NULL, op, record->username, record->uid, record->remote_host_name, NULL, record->tty, result) <= 0)
+        g_printerr ("Error writing audit message: %s\n", strerror (errno));
+#endif
+}
+
+static gpointer
+recorder_thread (gpointer data)
+{
+    g_mutex_lock (&queue_mutex);
+    while (TRUE)
+    {
+        while (g_queue_is_empty (&queue))
+            g_cond_wait (&queue_cond, &queue_mutex);
+
+        Record *record = g_queue_pop_head (&queue);
+        writing = TRUE;
+        g_cond_broadcast (&queue_cond);
+        g_mutex_unlock (&queue_mutex);
+
+        if (record->type == RECORD_UTMP)
+            write_utmp (record);
+        else
+            write_audit (record);
+        record_free (record);
+
+        g_mutex_lock (&queue_mutex);
+        writing = FALSE;
+        g_cond_broadcast (&queue_cond);
+    }
+
+    return NULL;
+}
+
+static void
+add_record (Record *record)
+{
+    g_mutex_lock (&queue_mutex);
+
+    if (!thread)
+    {
+        thread = g_thread_new ("login-recorder", recorder_thread, NULL);
+        atexit (login_recorder_flush);
+    }
+
+    while (g_queue_get_length (&queue) >= MAX_QUEUED_RECORDS)
+        g_cond_wait (&queue_cond, &queue_mutex);
+    g_queue_push_tail (&queue, record);
+    g_cond_broadcast (&queue_cond);
+
+    g_mutex_unlock (&queue_mutex);
+}
+
+/* Add a login record to write to the utmp database and / or a wtmp format file */
+void
+login_recorder_add_utmp (const struct utmpx *ut, gboolean update_utmp, const gchar *wtmp_file)
+{
+    Record *record = g_new0 (Record, 1);
+    record->type = RECORD_UTMP;
+    record->ut = *ut;
+    record->update_utmp = update_utmp;
+    record->wtmp_file = g_strdup (wtmp_file);
+    add_record (record);
+}
+
+/* Add an event to send to the audit system, does nothing if built without audit support */
+void
+login_recorder_add_audit (int type, const gchar *username, uid_t uid, const gchar *remote_host_name, const gchar *tty, gboolean success)
+{
+#if HAVE_LIBAUDIT
+    Record *record = g_new0 (Record, 1);
+    record->type = RECORD_AUDIT;
+    record->audit_type = type;
+    record->username = g_strdup (username);
+    record->uid = uid;
+    record->remote_host_name = g_strdup (remote_host_name);
+    record->tty = g_strdup (tty);
+    record->success = success;
+    add_record (record);
+#endif
+}
+
+/* Wait until all records have been written */
+void
+login_recorder_flush (void)
+{
+    g_mutex_lock (&queue_mutex);
+    while (thread && (!g_queue_is_empty (&queue) || writing))
+        g_cond_wait (&queue_cond, &queue_mutex);
+    g_mutex_unlock (&queue_mutex);
+}
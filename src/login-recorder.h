@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef LOGIN_RECORDER_H_
+#define LOGIN_RECORDER_H_
+
+#include <glib.h>
+#include <sys/types.h>
+#include <utmpx.h>
+
+void login_recorder_add_utmp (const struct utmpx *ut, gboolean update_utmp, const gchar *wtmp_file);
+
+void login_recorder_add_audit (int type, const gchar *username, uid_t uid, const gchar *remote_host_name, const gchar *tty, gboolean success);
+
+void login_recorder_flush (void);
+
+#endif /* LOGIN_RECORDER_H_ */
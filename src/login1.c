@@ -14,11 +14,16 @@
 #include <gio/gio.h>
 
 #include "login1.h"
+#include "flight-recorder.h"
 
 #define LOGIN1_SERVICE_NAME "org.freedesktop.login1"
 #define LOGIN1_OBJECT_NAME "/org/freedesktop/login1"
 #define LOGIN1_MANAGER_INTERFACE_NAME "org.freedesktop.login1.Manager"
 
+#define SYSTEMD_SERVICE_NAME "org.freedesktop.systemd1"
+#define SYSTEMD_OBJECT_NAME "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER_INTERFACE_NAME "org.freedesktop.systemd1.Manager"
+
 enum {
     SEAT_ADDED,
     SEAT_REMOVED,
@@ -67,6 +72,15 @@ typedef struct
 
     /* TRUE if can do session switching */
     gboolean can_multi_session;
+
+    /* login1 session ID of the active session */
+    gchar *active_session;
+
+    /* TRUE if the seat properties have been loaded */
+    gboolean loaded;
+
+    /* Cancellable for property requests */
+    GCancellable *cancellable;
 } Login1SeatPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (Login1Service, login1_service, G_TYPE_OBJECT)
@@ -84,22 +98,71 @@ login1_service_get_instance (void)
     return singleton;
 }
 
-static void
-update_property (Login1Seat *seat, const gchar *name, GVariant *value)
+/* Update the cached value of a seat property, returns the signal to emit if the value was changed */
+static guint
+set_property (Login1Seat *seat, const gchar *name, GVariant *value)
 {
     Login1SeatPrivate *priv = login1_seat_get_instance_private (seat);
 
     if (strcmp (name, "CanGraphical") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
     {
         priv->can_graphical = g_variant_get_boolean (value);
-        g_signal_emit (seat, seat_signals[CAN_GRAPHICAL_CHANGED], 0);
+        return CAN_GRAPHICAL_CHANGED;
     }
+    else if (strcmp (name, "CanMultiSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+        priv->can_multi_session = g_variant_get_boolean (value);
     else if (strcmp (name, "ActiveSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE ("(so)")))
     {
         const gchar *login1_session_id;
         g_variant_get (value, "(&so)", &login1_session_id, NULL);
-        g_signal_emit (seat, seat_signals[ACTIVE_SESSION_CHANGED], 0, login1_session_id);
+        g_free (priv->active_session);
+        priv->active_session = g_strdup (login1_session_id);
+        return ACTIVE_SESSION_CHANGED;
+    }
+
+    return LAST_SEAT_SIGNAL;
+}
+
+static void
+update_property (Login1Seat *seat, const gchar *name, GVariant *value)
+{
+    Login1SeatPrivate *priv = login1_seat_get_instance_private (seat);
+
+    guint signal = set_property (seat, name, value);
+    if (signal == CAN_GRAPHICAL_CHANGED)
+        g_signal_emit (seat, seat_signals[CAN_GRAPHICAL_CHANGED], 0);
+    else if (signal == ACTIVE_SESSION_CHANGED)
+    {
+        flight_recorder_record (FLIGHT_RECORDER_EVENT_LOGIN1_ACTIVE_SESSION_CHANGED, 0, 0, priv->id, priv->active_session);
+        g_signal_emit (seat, seat_signals[ACTIVE_SESSION_CHANGED], 0, priv->active_session);
+    }
+}
+
+typedef struct
+{
+    Login1Seat *seat;
+    gchar *name;
+} PropertyRequest;
+
+static void
+get_property_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    PropertyRequest *request = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Error updating seat property %s: %s", request->name, error->message);
+    if (result)
+    {
+        g_autoptr(GVariant) v = NULL;
+        g_variant_get (result, "(v)", &v);
+        update_property (request->seat, request->name, v);
     }
+
+    g_object_unref (request->seat);
+    g_free (request->name);
+    g_free (request);
 }
 
 static void
@@ -125,29 +188,36 @@ seat_properties_changed_cb (GDBusConnection *connection,
 
     while (g_variant_iter_loop (invalidated_properties, "&s", &name))
     {
-        g_autoptr(GError) error = NULL;
-        g_autoptr(GVariant) result = g_dbus_connection_call_sync (connection,
-                                                                  LOGIN1_SERVICE_NAME,
-                                                                  priv->path,
-                                                                  "org.freedesktop.DBus.Properties",
-                                                                  "Get",
-                                                                  g_variant_new ("(ss)", "org.freedesktop.login1.Seat", name),
-                                                                  G_VARIANT_TYPE ("(v)"),
-                                                                  G_DBUS_CALL_FLAGS_NONE,
-                                                                  -1,
-                                                                  NULL,
-                                                                  &error);
-        if (error)
-            g_warning ("Error updating seat property %s: %s", name, error->message);
-        if (result)
-        {
-            g_autoptr(GVariant) v = NULL;
-            g_variant_get (result, "(v)", &v);
-            update_property (seat, name, v);
-        }
+        PropertyRequest *request = g_new0 (PropertyRequest, 1);
+        request->seat = g_object_ref (seat);
+        request->name = g_strdup (name);
+        g_dbus_connection_call (connection,
+                                LOGIN1_SERVICE_NAME,
+                                priv->path,
+                                "org.freedesktop.DBus.Properties",
+                                "Get",
+                                g_variant_new ("(ss)", "org.freedesktop.login1.Seat", name),
+                                G_VARIANT_TYPE ("(v)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                priv->cancellable,
+                                get_property_cb,
+                                request);
     }
 }
 
+static void
+set_properties (Login1Seat *seat, GVariant *result)
+{
+    g_autoptr(GVariantIter) properties = NULL;
+    g_variant_get (result, "(a{sv})", &properties);
+
+    const gchar *name;
+    GVariant *value;
+    while (g_variant_iter_loop (properties, "{&sv}", &name, &value))
+        set_property (seat, name, value);
+}
+
 static Login1Seat *
 add_seat (Login1Service *service, const gchar *id, const gchar *path)
 {
@@ -171,40 +241,57 @@ add_seat (Login1Service *service, const gchar *id, const gchar *path)
                                                             g_object_ref (seat),
                                                             g_object_unref);
 
-    /* Get properties for this seat */
+    priv->seats = g_list_append (priv->seats, seat);
+
+    return seat;
+}
+
+static void
+get_seat_properties (Login1Seat *seat, GAsyncReadyCallback callback, gpointer user_data)
+{
+    Login1SeatPrivate *priv = login1_seat_get_instance_private (seat);
+
+    g_dbus_connection_call (priv->connection,
+                            LOGIN1_SERVICE_NAME,
+                            priv->path,
+                            "org.freedesktop.DBus.Properties",
+                            "GetAll",
+                            g_variant_new ("(s)", "org.freedesktop.login1.Seat"),
+                            G_VARIANT_TYPE ("(a{sv})"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            priv->cancellable,
+                            callback,
+                            user_data);
+}
+
+/* Returns FALSE if the request was cancelled because the seat was removed */
+static gboolean
+get_seat_properties_finish (Login1Seat *seat, GAsyncResult *res)
+{
+    Login1SeatPrivate *priv = login1_seat_get_instance_private (seat);
+
     g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (s_priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              path,
-                                                              "org.freedesktop.DBus.Properties",
-                                                              "GetAll",
-                                                              g_variant_new ("(s)", "org.freedesktop.login1.Seat"),
-                                                              G_VARIANT_TYPE ("(a{sv})"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (priv->connection, res, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return FALSE;
     if (error)
         g_warning ("Failed to get seat properties: %s", error->message);
     if (result)
-    {
-        g_autoptr(GVariantIter) properties = NULL;
-        g_variant_get (result, "(a{sv})", &properties);
+        set_properties (seat, result);
+    priv->loaded = TRUE;
 
-        const gchar *name;
-        GVariant *value;
-        while (g_variant_iter_loop (properties, "{&sv}", &name, &value))
-        {
-            if (strcmp (name, "CanGraphical") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
-                s_priv->can_graphical = g_variant_get_boolean (value);
-            else if (strcmp (name, "CanMultiSession") == 0 && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
-                s_priv->can_multi_session = g_variant_get_boolean (value);
-        }
-    }
+    return TRUE;
+}
 
-    priv->seats = g_list_append (priv->seats, seat);
+static void
+new_seat_properties_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    g_autoptr(Login1Seat) seat = data;
 
-    return seat;
+    /* Only announce the seat once its properties are known */
+    if (get_seat_properties_finish (seat, res))
+        g_signal_emit (login1_service_get_instance (), service_signals[SEAT_ADDED], 0, seat);
 }
 
 static void
@@ -228,7 +315,7 @@ signal_cb (GDBusConnection *connection,
         if (!seat)
         {
             seat = add_seat (service, id, path);
-            g_signal_emit (service, service_signals[SEAT_ADDED], 0, seat);
+            get_seat_properties (seat, new_seat_properties_cb, g_object_ref (seat));
         }
     }
     else if (strcmp (signal_name, "SeatRemoved") == 0)
@@ -239,8 +326,12 @@ signal_cb (GDBusConnection *connection,
         g_autoptr(Login1Seat) seat = login1_service_get_seat (service, id);
         if (seat)
         {
+            Login1SeatPrivate *s_priv = login1_seat_get_instance_private (seat);
+
             priv->seats = g_list_remove (priv->seats, seat);
-            g_signal_emit (service, service_signals[SEAT_REMOVED], 0, seat);
+            g_cancellable_cancel (s_priv->cancellable);
+            if (s_priv->loaded)
+                g_signal_emit (service, service_signals[SEAT_REMOVED], 0, seat);
         }
     }
 }
@@ -296,6 +387,15 @@ login1_service_connect (Login1Service *service)
     while (g_variant_iter_loop (seat_iter, "(&s&o)", &id, &path))
         add_seat (service, id, path);
 
+    /* Request the properties for all the seats at once and announce each
+     * seat as its reply comes in, the same as a hotplugged seat, so one slow
+     * seat doesn't hold up the others */
+    for (GList *link = priv->seats; link; link = link->next)
+    {
+        Login1Seat *seat = link->data;
+        get_seat_properties (seat, new_seat_properties_cb, g_object_ref (seat));
+    }
+
     priv->connected = TRUE;
 
     return TRUE;
@@ -336,11 +436,40 @@ login1_service_get_seat (Login1Service *service, const gchar *id)
     return NULL;
 }
 
-void
-login1_service_lock_session (Login1Service *service, const gchar *session_id)
+static void
+session_call_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    g_autofree gchar *method = data;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
+    if (error)
+        g_warning ("Error calling login1 %s: %s", method, error->message);
+}
+
+/* Call a method on a session without waiting for logind to complete it */
+static void
+call_session_method (Login1Service *service, const gchar *method, const gchar *session_id)
 {
     Login1ServicePrivate *priv = login1_service_get_instance_private (service);
 
+    g_dbus_connection_call (priv->connection,
+                            LOGIN1_SERVICE_NAME,
+                            LOGIN1_OBJECT_NAME,
+                            LOGIN1_MANAGER_INTERFACE_NAME,
+                            method,
+                            g_variant_new ("(s)", session_id),
+                            G_VARIANT_TYPE ("()"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            session_call_cb,
+                            g_strdup (method));
+}
+
+void
+login1_service_lock_session (Login1Service *service, const gchar *session_id)
+{
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
@@ -349,27 +478,12 @@ login1_service_lock_session (Login1Service *service, const gchar *session_id)
     if (!session_id)
         return;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "LockSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error locking login1 session: %s", error->message);
+    call_session_method (service, "LockSession", session_id);
 }
 
 void
 login1_service_unlock_session (Login1Service *service, const gchar *session_id)
 {
-    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
-
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
@@ -378,56 +492,27 @@ login1_service_unlock_session (Login1Service *service, const gchar *session_id)
     if (!session_id)
         return;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "UnlockSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error unlocking login1 session: %s", error->message);
+    call_session_method (service, "UnlockSession", session_id);
 }
 
 void
 login1_service_activate_session (Login1Service *service, const gchar *session_id)
 {
-    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
-
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
     g_debug ("Activating login1 session %s", session_id);
+    flight_recorder_record (FLIGHT_RECORDER_EVENT_LOGIN1_ACTIVATE, 0, 0, NULL, session_id);
 
     if (!session_id)
         return;
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "ActivateSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
-    if (error)
-        g_warning ("Error activating login1 session: %s", error->message);
+    call_session_method (service, "ActivateSession", session_id);
 }
 
 void
 login1_service_terminate_session (Login1Service *service, const gchar *session_id)
 {
-    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
-
     g_return_if_fail (service != NULL);
     g_return_if_fail (session_id != NULL);
 
@@ -436,20 +521,47 @@ login1_service_terminate_session (Login1Service *service, const gchar *session_i
     if (!session_id)
         return;
 
+    call_session_method (service, "TerminateSession", session_id);
+}
+
+static void
+start_unit_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    g_autofree gchar *unit = data;
+
     g_autoptr(GError) error = NULL;
-    g_autoptr(GVariant) result = g_dbus_connection_call_sync (priv->connection,
-                                                              LOGIN1_SERVICE_NAME,
-                                                              LOGIN1_OBJECT_NAME,
-                                                              LOGIN1_MANAGER_INTERFACE_NAME,
-                                                              "TerminateSession",
-                                                              g_variant_new ("(s)", session_id),
-                                                              G_VARIANT_TYPE ("()"),
-                                                              G_DBUS_CALL_FLAGS_NONE,
-                                                              -1,
-                                                              NULL,
-                                                              &error);
+    g_autoptr(GVariant) result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), res, &error);
     if (error)
-        g_warning ("Error terminating login1 session: %s", error->message);
+        g_debug ("Failed to start %s: %s", unit, error->message);
+}
+
+/* Ask systemd to start the service manager for @uid ahead of pam_systemd
+ * doing so when the session opens, so it is already running by then */
+void
+login1_service_start_user_manager (Login1Service *service, uid_t uid)
+{
+    Login1ServicePrivate *priv = login1_service_get_instance_private (service);
+
+    g_return_if_fail (service != NULL);
+
+    if (!priv->connected)
+        return;
+
+    g_autofree gchar *unit = g_strdup_printf ("user@%u.service", (guint) uid);
+    g_debug ("Starting %s", unit);
+
+    g_dbus_connection_call (priv->connection,
+                            SYSTEMD_SERVICE_NAME,
+                            SYSTEMD_OBJECT_NAME,
+                            SYSTEMD_MANAGER_INTERFACE_NAME,
+                            "StartUnit",
+                            g_variant_new ("(ss)", unit, "replace"),
+                            G_VARIANT_TYPE ("(o)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            start_unit_cb,
+                            g_steal_pointer (&unit));
 }
 
 static void
@@ -519,9 +631,19 @@ login1_seat_get_can_multi_session (Login1Seat *seat)
     return priv->can_multi_session;
 }
 
+const gchar *
+login1_seat_get_active_session (Login1Seat *seat)
+{
+    Login1SeatPrivate *priv = login1_seat_get_instance_private (seat);
+    g_return_val_if_fail (seat != NULL, NULL);
+    return priv->active_session;
+}
+
 static void
 login1_seat_init (Login1Seat *seat)
 {
+    Login1SeatPrivate *priv = login1_seat_get_instance_private (seat);
+    priv->cancellable = g_cancellable_new ();
 }
 
 static void
@@ -532,6 +654,9 @@ login1_seat_finalize (GObject *object)
 
     g_clear_pointer (&priv->id, g_free);
     g_clear_pointer (&priv->path, g_free);
+    g_clear_pointer (&priv->active_session, g_free);
+    g_cancellable_cancel (priv->cancellable);
+    g_clear_object (&priv->cancellable);
     g_dbus_connection_signal_unsubscribe (priv->connection, priv->signal_id);
     g_clear_object (&priv->connection);
 
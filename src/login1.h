@@ -13,6 +13,7 @@
 #define _LOGIN1_H_
 
 #include <glib-object.h>
+#include <sys/types.h>
 
 G_BEGIN_DECLS
 
@@ -74,12 +75,16 @@ void login1_service_activate_session (Login1Service *service, const gchar *sessi
 
 void login1_service_terminate_session (Login1Service *service, const gchar *session_id);
 
+void login1_service_start_user_manager (Login1Service *service, uid_t uid);
+
 const gchar *login1_seat_get_id (Login1Seat *seat);
 
 gboolean login1_seat_get_can_graphical (Login1Seat *seat);
 
 gboolean login1_seat_get_can_multi_session (Login1Seat *seat);
 
+const gchar *login1_seat_get_active_session (Login1Seat *seat);
+
 G_END_DECLS
 
 #endif /* _LOGIN1_H_ */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
+
+#include "memory-usage.h"
+
+/*
+ * The subsystems that grow with load report how much memory they are holding
+ * so the high-water marks can be shown in the statistics. Freed memory stays
+ * in the heap after a storm of logins or XDMCP packets, so once the usage has
+ * dropped to less than half of its peak and stayed quiet for a while the heap
+ * is trimmed to hand it back to the system. Only used from the main thread.
+ */
+
+/* Seconds without any change in usage before trimming */
+#define TRIM_DELAY 30
+
+/* Usage below this isn't worth trimming for */
+#define TRIM_MINIMUM (1024 * 1024)
+
+static const gchar *pool_names[MEMORY_POOL_LAST] =
+{
+    "user-list",
+    "xdmcp-sessions",
+    "greeter-buffers",
+    "session-environments"
+};
+
+static gsize current[MEMORY_POOL_LAST];
+static gsize peak[MEMORY_POOL_LAST];
+
+/* Total usage at its highest since the heap was last trimmed */
+static gsize trim_peak = 0;
+
+static guint trim_timeout = 0;
+static guint64 n_trims = 0;
+
+static gsize
+get_total (void)
+{
+    gsize total = 0;
+    for (gsize i = 0; i < MEMORY_POOL_LAST; i++)
+        total += current[i];
+    return total;
+}
+
+static gboolean
+trim_cb (gpointer data)
+{
+    trim_timeout = 0;
+
+#ifdef HAVE_MALLOC_TRIM
+    g_debug ("Memory usage dropped from %zu to %zu bytes, trimming heap", trim_peak, get_total ());
+    malloc_trim (0);
+    n_trims++;
+#endif
+    trim_peak = get_total ();
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+usage_changed (MemoryPool pool)
+{
+    peak[pool] = MAX (peak[pool], current[pool]);
+
+    gsize total = get_total ();
+    trim_peak = MAX (trim_peak, total);
+
+    /* Wait for things to settle down before trimming */
+    g_clear_handle_id (&trim_timeout, g_source_remove);
+    if (trim_peak >= TRIM_MINIMUM && total < trim_peak / 2)
+        trim_timeout = g_timeout_add_seconds_full (G_PRIORITY_LOW, TRIM_DELAY, trim_cb, NULL, NULL);
+}
+
+void
+memory_usage_add (MemoryPool pool, gsize size)
+{
+    g_return_if_fail (pool < MEMORY_POOL_LAST);
+    current[pool] += size;
+    usage_changed (pool);
+}
+
+void
+memory_usage_remove (MemoryPool pool, gsize size)
+{
+    g_return_if_fail (pool < MEMORY_POOL_LAST);
+    current[pool] -= MIN (size, current[pool]);
+    usage_changed (pool);
+}
+
+void
+memory_usage_set (MemoryPool pool, gsize size)
+{
+    g_return_if_fail (pool < MEMORY_POOL_LAST);
+    current[pool] = size;
+    usage_changed (pool);
+}
+
+GVariant *
+memory_usage_get_statistics (void)
+{
+    GVariantBuilder pools;
+    g_variant_builder_init (&pools, G_VARIANT_TYPE ("a(stt)"));
+    for (gsize i = 0; i < MEMORY_POOL_LAST; i++)
+        g_variant_builder_add (&pools, "(stt)", pool_names[i], (guint64) current[i], (guint64) peak[i]);
+
+    return g_variant_new ("(@a(stt)t)", g_variant_builder_end (&pools), n_trims);
+}
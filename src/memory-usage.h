@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef MEMORY_USAGE_H_
+#define MEMORY_USAGE_H_
+
+#include <glib.h>
+
+typedef enum
+{
+    MEMORY_POOL_USER_LIST,
+    MEMORY_POOL_XDMCP_SESSIONS,
+    MEMORY_POOL_GREETER_BUFFERS,
+    MEMORY_POOL_SESSION_ENVIRONMENTS,
+    MEMORY_POOL_LAST
+} MemoryPool;
+
+void memory_usage_add (MemoryPool pool, gsize size);
+
+void memory_usage_remove (MemoryPool pool, gsize size);
+
+void memory_usage_set (MemoryPool pool, gsize size);
+
+GVariant *memory_usage_get_statistics (void);
+
+#endif /* MEMORY_USAGE_H_ */
@@ -0,0 +1,511 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "metrics.h"
+#include "greeter-session.h"
+#include "memory-usage.h"
+#include "process.h"
+#include "session.h"
+#include "trace.h"
+#include "vnc-server.h"
+#include "watchdog.h"
+#include "xdmcp-server.h"
+#include "user-list.h"
+
+/*
+ * Metrics are served as OpenMetrics text over HTTP. Everything is read from
+ * the statistics the other modules already keep, so serving a scrape costs
+ * nothing in the code paths being measured. Clients are handled with
+ * asynchronous I/O in the main context and disconnected if they don't send a
+ * request in time.
+ */
+
+/* Maximum number of scrapes being served at once */
+#define MAX_CLIENTS 8
+
+/* Seconds a client has to send its request */
+#define CLIENT_TIMEOUT 10
+
+typedef struct
+{
+    GSocketConnection *connection;
+
+    /* Cancelled when the client times out */
+    GCancellable *cancellable;
+    guint timeout;
+
+    /* Request read so far */
+    gchar request[1024];
+    gsize request_length;
+
+    /* Response being written */
+    gchar *response;
+} MetricsClient;
+
+/* Display manager to report seats for */
+static DisplayManager *display_manager = NULL;
+
+/* Service accepting connections and the path of the socket it listens on */
+static GSocketService *service = NULL;
+static gchar *socket_path = NULL;
+
+/* Number of clients being served */
+static guint n_clients = 0;
+
+static void
+client_free (MetricsClient *client)
+{
+    if (client->timeout != 0)
+        g_source_remove (client->timeout);
+    g_object_unref (client->connection);
+    g_object_unref (client->cancellable);
+    g_free (client->response);
+    g_free (client);
+    n_clients--;
+}
+
+static gboolean
+client_timeout_cb (gpointer data)
+{
+    MetricsClient *client = data;
+
+    client->timeout = 0;
+    g_cancellable_cancel (client->cancellable);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+append_escaped (GString *text, const gchar *value)
+{
+    for (const gchar *c = value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            g_string_append_c (text, '\\');
+        if (*c == '\n')
+            g_string_append (text, "\\n");
+        else
+            g_string_append_c (text, *c);
+    }
+}
+
+static void
+append_family (GString *text, const gchar *name, const gchar *type, const gchar *unit, const gchar *help)
+{
+    g_string_append_printf (text, "# TYPE %s %s\n", name, type);
+    if (unit)
+        g_string_append_printf (text, "# UNIT %s %s\n", name, unit);
+    g_string_append_printf (text, "# HELP %s %s\n", name, help);
+}
+
+static void
+append_seconds (GString *text, guint64 microseconds)
+{
+    gchar value[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append (text, g_ascii_dtostr (value, sizeof (value), microseconds / 1000000.0));
+}
+
+/* Write a histogram from the bucket bounds and counts used in the statistics */
+static void
+append_histogram (GString *text, const gchar *name, const gchar *label_name, const gchar *label_value, GVariant *bounds, GVariant *counts, guint64 sum, gboolean have_sum)
+{
+    g_autoptr(GString) labels = g_string_new ("");
+    if (label_name)
+    {
+        g_string_append_printf (labels, "%s=\"", label_name);
+        append_escaped (labels, label_value);
+        g_string_append (labels, "\",");
+    }
+
+    guint64 count = 0;
+    gsize n_bounds = g_variant_n_children (bounds);
+    for (gsize i = 0; i < g_variant_n_children (counts); i++)
+    {
+        guint64 n;
+        g_variant_get_child (counts, i, "t", &n);
+        count += n;
+
+        g_string_append_printf (text, "%s_bucket{%sle=\"", name, labels->str);
+        if (i < n_bounds)
+        {
+            guint64 bound;
+            g_variant_get_child (bounds, i, "t", &bound);
+            append_seconds (text, bound);
+        }
+        else
+            g_string_append (text, "+Inf");
+        g_string_append_printf (text, "\"} %" G_GUINT64_FORMAT "\n", count);
+    }
+
+    if (labels->len > 0)
+        g_string_truncate (labels, labels->len - 1);
+    g_string_append_printf (text, "%s_count{%s} %" G_GUINT64_FORMAT "\n", name, labels->str, count);
+    if (have_sum)
+    {
+        g_string_append_printf (text, "%s_sum{%s} ", name, labels->str);
+        append_seconds (text, sum);
+        g_string_append_c (text, '\n');
+    }
+}
+
+static void
+append_seats (GString *text)
+{
+    append_family (text, "lightdm_seat_sessions", "gauge", NULL, "Number of sessions on each seat.");
+    for (GList *link = display_manager ? display_manager_get_seats (display_manager) : NULL; link; link = link->next)
+    {
+        Seat *seat = link->data;
+
+        guint n_greeters = 0, n_users = 0;
+        for (GList *session_link = seat_get_sessions (seat); session_link; session_link = session_link->next)
+        {
+            if (IS_GREETER_SESSION (session_link->data))
+                n_greeters++;
+            else
+                n_users++;
+        }
+
+        g_autoptr(GString) name = g_string_new ("");
+        append_escaped (name, seat_get_name (seat));
+        g_string_append_printf (text, "lightdm_seat_sessions{seat=\"%s\",class=\"greeter\"} %u\n", name->str, n_greeters);
+        g_string_append_printf (text, "lightdm_seat_sessions{seat=\"%s\",class=\"user\"} %u\n", name->str, n_users);
+    }
+
+    /* Samples have to follow their own family so collect the second one separately */
+    append_family (text, "lightdm_seat_crashes", "counter", NULL, "Number of times the display server or greeter on each seat crashed.");
+    g_autoptr(GString) fallback_text = g_string_new ("");
+    for (GList *link = display_manager ? display_manager_get_seats (display_manager) : NULL; link; link = link->next)
+    {
+        Seat *seat = link->data;
+
+        guint64 n_total;
+        gboolean fallback;
+        g_variant_get (seat_get_crash_statistics (seat), "(ttb)", NULL, &n_total, &fallback);
+
+        g_autoptr(GString) name = g_string_new ("");
+        append_escaped (name, seat_get_name (seat));
+        g_string_append_printf (text, "lightdm_seat_crashes_total{seat=\"%s\"} %" G_GUINT64_FORMAT "\n", name->str, n_total);
+        g_string_append_printf (fallback_text, "lightdm_seat_crash_fallback{seat=\"%s\"} %d\n", name->str, fallback ? 1 : 0);
+    }
+    append_family (text, "lightdm_seat_crash_fallback", "gauge", NULL, "1 if the seat crashed repeatedly and is using its fallback configuration.");
+    g_string_append (text, fallback_text->str);
+
+    append_family (text, "lightdm_processes", "gauge", NULL, "Number of child processes running.");
+    g_string_append_printf (text, "lightdm_processes %u\n", process_get_count ());
+}
+
+static void
+append_authentications (GString *text)
+{
+    guint64 n_started, n_succeeded, n_failed;
+    g_variant_get (session_get_statistics (), "(ttt)", &n_started, &n_succeeded, &n_failed);
+
+    append_family (text, "lightdm_authentications_started", "counter", NULL, "Number of PAM authentications started.");
+    g_string_append_printf (text, "lightdm_authentications_started_total %" G_GUINT64_FORMAT "\n", n_started);
+    append_family (text, "lightdm_authentications_completed", "counter", NULL, "Number of PAM authentications completed.");
+    g_string_append_printf (text, "lightdm_authentications_completed_total{result=\"success\"} %" G_GUINT64_FORMAT "\n", n_succeeded);
+    g_string_append_printf (text, "lightdm_authentications_completed_total{result=\"failure\"} %" G_GUINT64_FORMAT "\n", n_failed);
+}
+
+static void
+append_latencies (GString *text)
+{
+    g_autoptr(GVariant) statistics = g_variant_ref_sink (trace_get_statistics ());
+    g_autoptr(GVariant) bounds = g_variant_get_child_value (statistics, 0);
+    g_autoptr(GVariant) spans = g_variant_get_child_value (statistics, 1);
+
+    append_family (text, "lightdm_duration_seconds", "histogram", "seconds", "Time taken for greeters to start, authentication and each PAM call, sessions to start, VT switches etc.");
+    for (gsize i = 0; i < g_variant_n_children (spans); i++)
+    {
+        const gchar *name;
+        guint64 count, total, max;
+        g_autoptr(GVariant) counts = NULL;
+        g_variant_get_child (spans, i, "(&sttt@at)", &name, &count, &total, &max, &counts);
+        append_histogram (text, "lightdm_duration_seconds", "operation", name, bounds, counts, total, TRUE);
+    }
+}
+
+static void
+append_xdmcp (GString *text)
+{
+    guint64 n_packets, n_invalid, n_rate_limited, n_accepted, n_declined;
+    g_variant_get (xdmcp_server_get_statistics (), "(ttttt)", &n_packets, &n_invalid, &n_rate_limited, &n_accepted, &n_declined);
+
+    append_family (text, "lightdm_xdmcp_packets_received", "counter", NULL, "Number of XDMCP packets received.");
+    g_string_append_printf (text, "lightdm_xdmcp_packets_received_total %" G_GUINT64_FORMAT "\n", n_packets);
+    append_family (text, "lightdm_xdmcp_packets_invalid", "counter", NULL, "Number of XDMCP packets that could not be decoded.");
+    g_string_append_printf (text, "lightdm_xdmcp_packets_invalid_total %" G_GUINT64_FORMAT "\n", n_invalid);
+    append_family (text, "lightdm_xdmcp_packets_rate_limited", "counter", NULL, "Number of XDMCP packets dropped for exceeding the rate limit of their source address.");
+    g_string_append_printf (text, "lightdm_xdmcp_packets_rate_limited_total %" G_GUINT64_FORMAT "\n", n_rate_limited);
+    append_family (text, "lightdm_xdmcp_requests", "counter", NULL, "Number of XDMCP session requests.");
+    g_string_append_printf (text, "lightdm_xdmcp_requests_total{result=\"accept\"} %" G_GUINT64_FORMAT "\n", n_accepted);
+    g_string_append_printf (text, "lightdm_xdmcp_requests_total{result=\"decline\"} %" G_GUINT64_FORMAT "\n", n_declined);
+}
+
+static void
+append_vnc (GString *text)
+{
+    g_autoptr(GVariantIter) listeners = NULL;
+    guint64 n_started, n_queued;
+    guint32 n_waiting, n_active;
+    g_variant_get (vnc_server_get_statistics (), "(a(stt)ttuu)", &listeners, &n_started, &n_queued, &n_waiting, &n_active);
+
+    const gchar *family;
+    guint64 n_accepted, n_errors;
+    g_autoptr(GString) accepted = g_string_new ("");
+    g_autoptr(GString) errors = g_string_new ("");
+    while (g_variant_iter_loop (listeners, "(&stt)", &family, &n_accepted, &n_errors))
+    {
+        g_string_append_printf (accepted, "lightdm_vnc_connections_accepted_total{family=\"%s\"} %" G_GUINT64_FORMAT "\n", family, n_accepted);
+        g_string_append_printf (errors, "lightdm_vnc_accept_errors_total{family=\"%s\"} %" G_GUINT64_FORMAT "\n", family, n_errors);
+    }
+    append_family (text, "lightdm_vnc_connections_accepted", "counter", NULL, "Number of VNC connections accepted.");
+    g_string_append (text, accepted->str);
+    append_family (text, "lightdm_vnc_accept_errors", "counter", NULL, "Number of errors accepting VNC connections.");
+    g_string_append (text, errors->str);
+
+    append_family (text, "lightdm_vnc_connections_started", "counter", NULL, "Number of VNC connections given a seat.");
+    g_string_append_printf (text, "lightdm_vnc_connections_started_total %" G_GUINT64_FORMAT "\n", n_started);
+    append_family (text, "lightdm_vnc_connections_queued", "counter", NULL, "Number of VNC connections that had to wait because of the seat limits.");
+    g_string_append_printf (text, "lightdm_vnc_connections_queued_total %" G_GUINT64_FORMAT "\n", n_queued);
+    append_family (text, "lightdm_vnc_connections", "gauge", NULL, "Number of VNC connections waiting for and using a seat.");
+    g_string_append_printf (text, "lightdm_vnc_connections{state=\"waiting\"} %u\n", n_waiting);
+    g_string_append_printf (text, "lightdm_vnc_connections{state=\"active\"} %u\n", n_active);
+}
+
+static void
+append_stalls (GString *text)
+{
+    g_autoptr(GVariant) statistics = g_variant_ref_sink (watchdog_get_statistics ());
+    g_autoptr(GVariant) bounds = g_variant_get_child_value (statistics, 0);
+    g_autoptr(GVariant) counts = g_variant_get_child_value (statistics, 1);
+    guint64 max;
+    g_variant_get_child (statistics, 2, "t", &max);
+
+    append_family (text, "lightdm_main_loop_stall_seconds", "histogram", "seconds", "Time the main loop was blocked for, when longer than the stall threshold.");
+    append_histogram (text, "lightdm_main_loop_stall_seconds", NULL, NULL, bounds, counts, 0, FALSE);
+    append_family (text, "lightdm_main_loop_stall_max_seconds", "gauge", "seconds", "Longest time the main loop was blocked for.");
+    g_string_append (text, "lightdm_main_loop_stall_max_seconds ");
+    append_seconds (text, max);
+    g_string_append_c (text, '\n');
+}
+
+static void
+append_memory (GString *text)
+{
+    g_autoptr(GVariantIter) pools = NULL;
+    guint64 n_trims;
+    g_variant_get (memory_usage_get_statistics (), "(a(stt)t)", &pools, &n_trims);
+
+    const gchar *name;
+    guint64 current, peak;
+    g_autoptr(GString) peaks = g_string_new ("");
+    append_family (text, "lightdm_memory_bytes", "gauge", "bytes", "Memory held by the subsystems that grow with load.");
+    while (g_variant_iter_loop (pools, "(&stt)", &name, &current, &peak))
+    {
+        g_string_append_printf (text, "lightdm_memory_bytes{pool=\"%s\"} %" G_GUINT64_FORMAT "\n", name, current);
+        g_string_append_printf (peaks, "lightdm_memory_peak_bytes{pool=\"%s\"} %" G_GUINT64_FORMAT "\n", name, peak);
+    }
+    append_family (text, "lightdm_memory_peak_bytes", "gauge", "bytes", "Most memory held by the subsystems that grow with load.");
+    g_string_append (text, peaks->str);
+    append_family (text, "lightdm_heap_trims", "counter", NULL, "Number of times freed memory was returned to the system.");
+    g_string_append_printf (text, "lightdm_heap_trims_total %" G_GUINT64_FORMAT "\n", n_trims);
+}
+
+static void
+append_user_information (GString *text)
+{
+    gint64 update_time = common_user_list_get_update_time (common_user_list_get_instance ());
+    if (update_time == 0)
+        return;
+
+    append_family (text, "lightdm_user_information_age_seconds", "gauge", "seconds", "Time since the user information was read.");
+    g_string_append (text, "lightdm_user_information_age_seconds ");
+    append_seconds (text, MAX (g_get_real_time () - update_time, 0));
+    g_string_append_c (text, '\n');
+}
+
+/* Get the current metrics in OpenMetrics text format */
+gchar *
+metrics_get_text (void)
+{
+    GString *text = g_string_sized_new (4096);
+
+    append_seats (text);
+    append_authentications (text);
+    append_latencies (text);
+    append_xdmcp (text);
+    append_vnc (text);
+    append_stalls (text);
+    append_memory (text);
+    append_user_information (text);
+    g_string_append (text, "# EOF\n");
+
+    return g_string_free (text, FALSE);
+}
+
+static void
+write_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    MetricsClient *client = data;
+
+    g_autoptr(GError) error = NULL;
+    if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (object), result, NULL, &error))
+        g_debug ("Failed to write metrics: %s", error->message);
+
+    client_free (client);
+}
+
+static void
+send_response (MetricsClient *client)
+{
+    if (strncmp (client->request, "GET ", 4) == 0)
+    {
+        g_autofree gchar *body = metrics_get_text ();
+        client->response = g_strdup_printf ("HTTP/1.0 200 OK\r\n"
+                                            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                            "Content-Length: %zu\r\n"
+                                            "Connection: close\r\n"
+                                            "\r\n"
+                                            "%s", strlen (body), body);
+    }
+    else
+        client->response = g_strdup ("HTTP/1.0 405 Method Not Allowed\r\n"
+                                     "Content-Length: 0\r\n"
+                                     "Connection: close\r\n"
+                                     "\r\n");
+
+    GOutputStream *stream = g_io_stream_get_output_stream (G_IO_STREAM (client->connection));
+    g_output_stream_write_all_async (stream, client->response, strlen (client->response), G_PRIORITY_DEFAULT, client->cancellable, write_cb, client);
+}
+
+static void read_request (MetricsClient *client);
+
+static void
+read_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    MetricsClient *client = data;
+
+    g_autoptr(GError) error = NULL;
+    gssize n_read = g_input_stream_read_finish (G_INPUT_STREAM (object), result, &error);
+    if (n_read <= 0)
+    {
+        if (error && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_debug ("Failed to read metrics request: %s", error->message);
+        client_free (client);
+        return;
+    }
+    client->request_length += n_read;
+    client->request[client->request_length] = '\0';
+
+    /* Only the request line matters, but wait for the headers so the client is ready for the reply */
+    if (strstr (client->request, "\r\n\r\n") || strstr (client->request, "\n\n") || client->request_length == sizeof (client->request) - 1)
+    {
+        if (client->timeout != 0)
+            g_source_remove (client->timeout);
+        client->timeout = 0;
+        send_response (client);
+    }
+    else
+        read_request (client);
+}
+
+static void
+read_request (MetricsClient *client)
+{
+    GInputStream *stream = g_io_stream_get_input_stream (G_IO_STREAM (client->connection));
+    g_input_stream_read_async (stream,
+                               client->request + client->request_length,
+                               sizeof (client->request) - client->request_length - 1,
+                               G_PRIORITY_DEFAULT,
+                               client->cancellable,
+                               read_cb,
+                               client);
+}
+
+static gboolean
+incoming_cb (GSocketService *service, GSocketConnection *connection, GObject *source_object, gpointer data)
+{
+    /* Refuse when busy, returning closes the connection */
+    if (n_clients >= MAX_CLIENTS)
+        return TRUE;
+
+    MetricsClient *client = g_new0 (MetricsClient, 1);
+    n_clients++;
+    client->connection = g_object_ref (connection);
+    client->cancellable = g_cancellable_new ();
+    client->timeout = g_timeout_add_seconds (CLIENT_TIMEOUT, client_timeout_cb, client);
+    read_request (client);
+
+    return TRUE;
+}
+
+gboolean
+metrics_start (DisplayManager *manager, const gchar *path, guint port)
+{
+    g_return_val_if_fail (service == NULL, FALSE);
+
+    display_manager = g_object_ref (manager);
+    service = g_socket_service_new ();
+
+    g_autoptr(GError) error = NULL;
+    if (path)
+    {
+        unlink (path);
+        g_autoptr(GSocketAddress) address = g_unix_socket_address_new (path);
+        if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error))
+        {
+            g_warning ("Failed to listen for metrics on %s: %s", path, error->message);
+            metrics_stop ();
+            return FALSE;
+        }
+        socket_path = g_strdup (path);
+        g_debug ("Serving metrics on %s", path);
+    }
+    if (port != 0)
+    {
+        /* Only serve locally, anything further should go through a proxy */
+        g_autoptr(GInetAddress) loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+        g_autoptr(GSocketAddress) address = g_inet_socket_address_new (loopback, port);
+        if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, NULL, &error))
+        {
+            g_warning ("Failed to listen for metrics on port %u: %s", port, error->message);
+            metrics_stop ();
+            return FALSE;
+        }
+        g_debug ("Serving metrics on 127.0.0.1:%u", port);
+    }
+
+    g_signal_connect (service, "incoming", G_CALLBACK (incoming_cb), NULL);
+    g_socket_service_start (service);
+
+    return TRUE;
+}
+
+void
+metrics_stop (void)
+{
+    if (service)
+    {
+        g_socket_service_stop (service);
+        g_socket_listener_close (G_SOCKET_LISTENER (service));
+    }
+    g_clear_object (&service);
+    if (socket_path)
+        unlink (socket_path);
+    g_clear_pointer (&socket_path, g_free);
+    g_clear_object (&display_manager);
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <glib.h>
+
+#include "display-manager.h"
+
+gboolean metrics_start (DisplayManager *manager, const gchar *socket_path, guint port);
+
+gchar *metrics_get_text (void);
+
+void metrics_stop (void);
+
+#endif /* METRICS_H_ */
@@ -9,11 +9,33 @@
  * license.
  */
 
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <glib-unix.h>
 
 #include "plymouth.h"
 
+/* Abstract socket plymouthd listens on */
+#define PLYMOUTH_SOCKET_PATH "/org/freedesktop/plymouthd"
+
+/* Requests and responses in the plymouthd protocol */
+#define REQUEST_PING          'P'
+#define REQUEST_HAS_ACTIVE_VT 'V'
+#define REQUEST_DEACTIVATE    'D'
+#define REQUEST_QUIT          'Q'
+#define REQUEST_ARGUMENT      '\002'
+#define RESPONSE_ACK          '\006'
+
+/* How long to wait for plymouthd to reply, in milliseconds */
+#define PLYMOUTH_TIMEOUT 5000
+
 static gboolean have_pinged = FALSE;
 static gboolean have_checked_active_vt = FALSE;
 
@@ -21,6 +43,12 @@ static gboolean is_running = FALSE;
 static gboolean is_active = FALSE;
 static gboolean has_active_vt = FALSE;
 
+/* Connection to plymouthd, or -1 if not connected */
+static int plymouth_fd = -1;
+
+/* TRUE if plymouthd can't be reached over the socket, so have to use the plymouth command */
+static gboolean use_command = FALSE;
+
 static gboolean
 plymouth_run_command (const gchar *command, gint *exit_status)
 {
@@ -43,13 +71,155 @@ plymouth_command_returns_true (gchar *command)
     return WIFEXITED (exit_status) && WEXITSTATUS (exit_status) == 0;
 }
 
+static gboolean
+plymouth_connect (void)
+{
+    if (plymouth_fd >= 0)
+        return TRUE;
+    if (use_command)
+        return FALSE;
+
+    int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        use_command = TRUE;
+        return FALSE;
+    }
+
+    /* Abstract socket, name starts with a nul byte */
+    struct sockaddr_un address;
+    memset (&address, 0, sizeof (address));
+    address.sun_family = AF_UNIX;
+    strncpy (address.sun_path + 1, PLYMOUTH_SOCKET_PATH, sizeof (address.sun_path) - 2);
+    socklen_t address_length = offsetof (struct sockaddr_un, sun_path) + 1 + strlen (PLYMOUTH_SOCKET_PATH);
+    if (connect (fd, (struct sockaddr *) &address, address_length) < 0)
+    {
+        g_debug ("Could not connect to plymouthd, using plymouth command: %s", strerror (errno));
+        close (fd);
+        use_command = TRUE;
+        return FALSE;
+    }
+
+    plymouth_fd = fd;
+    return TRUE;
+}
+
+static void
+plymouth_disconnect (void)
+{
+    if (plymouth_fd < 0)
+        return;
+    close (plymouth_fd);
+    plymouth_fd = -1;
+}
+
+/* Queue a request in the buffer; an argument is sent as a length prefixed nul terminated string */
+static void
+add_request (GByteArray *buffer, guint8 type, const gchar *argument, gsize argument_length)
+{
+    g_byte_array_append (buffer, &type, 1);
+    if (argument)
+    {
+        guint8 header[2] = { REQUEST_ARGUMENT, argument_length + 1 };
+        g_byte_array_append (buffer, header, 2);
+        g_byte_array_append (buffer, (const guint8 *) argument, argument_length);
+    }
+    g_byte_array_append (buffer, (const guint8 *) "", 1);
+}
+
+static gboolean
+send_requests (GByteArray *buffer)
+{
+    gsize offset = 0;
+    while (offset < buffer->len)
+    {
+        ssize_t n_written = send (plymouth_fd, buffer->data + offset, buffer->len - offset, MSG_NOSIGNAL);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written < 0)
+        {
+            g_debug ("Failed to write to plymouthd: %s", strerror (errno));
+            plymouth_disconnect ();
+            return FALSE;
+        }
+        offset += n_written;
+    }
+
+    return TRUE;
+}
+
+/* Read the reply to a request, returns TRUE if acknowledged */
+static gboolean
+read_response (void)
+{
+    if (plymouth_fd < 0)
+        return FALSE;
+
+    struct pollfd fds = { plymouth_fd, POLLIN, 0 };
+    int n_ready;
+    do
+        n_ready = poll (&fds, 1, PLYMOUTH_TIMEOUT);
+    while (n_ready < 0 && errno == EINTR);
+    if (n_ready <= 0)
+    {
+        g_debug ("Timed out waiting for plymouthd");
+        plymouth_disconnect ();
+        return FALSE;
+    }
+
+    guint8 response;
+    ssize_t n_read;
+    do
+        n_read = read (plymouth_fd, &response, 1);
+    while (n_read < 0 && errno == EINTR);
+    if (n_read <= 0)
+    {
+        plymouth_disconnect ();
+        return FALSE;
+    }
+
+    return response == RESPONSE_ACK;
+}
+
+static gboolean
+plymouth_request (guint8 type, const gchar *argument, gsize argument_length)
+{
+    g_autoptr(GByteArray) buffer = g_byte_array_new ();
+    add_request (buffer, type, argument, argument_length);
+    if (!send_requests (buffer))
+        return FALSE;
+    return read_response ();
+}
+
+static gboolean
+quit_response_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+    /* Plymouth exits after replying, so nothing more to send */
+    close (fd);
+    return G_SOURCE_REMOVE;
+}
+
 gboolean
 plymouth_get_is_running (void)
 {
     if (!have_pinged)
     {
         have_pinged = TRUE;
-        is_running = plymouth_command_returns_true ("--ping");
+        if (plymouth_connect ())
+        {
+            /* Ask if it has a VT at the same time, saving a round trip in plymouth_has_active_vt () */
+            g_autoptr(GByteArray) buffer = g_byte_array_new ();
+            add_request (buffer, REQUEST_PING, NULL, 0);
+            add_request (buffer, REQUEST_HAS_ACTIVE_VT, NULL, 0);
+            if (send_requests (buffer))
+            {
+                is_running = read_response ();
+                has_active_vt = read_response ();
+                have_checked_active_vt = TRUE;
+            }
+        }
+        else
+            is_running = plymouth_command_returns_true ("--ping");
         is_active = is_running;
     }
 
@@ -68,7 +238,10 @@ plymouth_has_active_vt (void)
     if (!have_checked_active_vt)
     {
         have_checked_active_vt = TRUE;
-        has_active_vt = plymouth_command_returns_true ("--has-active-vt");
+        if (plymouth_connect ())
+            has_active_vt = plymouth_request (REQUEST_HAS_ACTIVE_VT, NULL, 0);
+        else
+            has_active_vt = plymouth_command_returns_true ("--has-active-vt");
     }
 
     return has_active_vt;
@@ -79,7 +252,11 @@ plymouth_deactivate (void)
 {
     g_debug ("Deactivating Plymouth");
     is_active = FALSE;
-    plymouth_run_command ("deactivate", NULL);
+    /* Wait for the reply, plymouth has to release the VT before a display server can use it */
+    if (plymouth_connect ())
+        plymouth_request (REQUEST_DEACTIVATE, NULL, 0);
+    else
+        plymouth_run_command ("deactivate", NULL);
 }
 
 void
@@ -92,7 +269,20 @@ plymouth_quit (gboolean retain_splash)
 
     have_pinged = TRUE;
     is_running = FALSE;
-    if (retain_splash)
+    if (plymouth_connect ())
+    {
+        /* The argument is a boolean sent as a single character string */
+        gchar argument = retain_splash ? 1 : 0;
+        g_autoptr(GByteArray) buffer = g_byte_array_new ();
+        add_request (buffer, REQUEST_QUIT, &argument, argument != 0 ? 1 : 0);
+        if (send_requests (buffer))
+        {
+            /* Don't wait for plymouth to quit, just close the connection when it replies */
+            g_unix_fd_add (plymouth_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, quit_response_cb, NULL);
+            plymouth_fd = -1;
+        }
+    }
+    else if (retain_splash)
         plymouth_run_command ("quit --retain-splash", NULL);
     else
         plymouth_run_command ("quit", NULL);
@@ -14,13 +14,24 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <grp.h>
+#include <pthread.h>
 #include <config.h>
+#include <glib-unix.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#endif
 
+#include "configuration.h"
+#include "flight-recorder.h"
 #include "log-file.h"
 #include "process.h"
+#include "program-cache.h"
 
 enum {
     GOT_DATA,
@@ -32,7 +43,8 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 typedef struct
 {
-    /* Function to run inside subprocess before exec */
+    /* Function to run inside subprocess before exec.
+     * If not set the process is started with posix_spawn instead of fork */
     ProcessRunFunc run_func;
     gpointer run_func_data;
 
@@ -44,12 +56,21 @@ typedef struct
     /* Command to run */
     gchar *command;
 
+    /* Scheduling to run with */
+    ProcessPriority priority;
+
     /* TRUE to clear the environment in this process */
     gboolean clear_environment;
 
     /* Environment variables to set */
     GHashTable *env;
 
+    /* Arguments, environment and program path to launch with, built once and
+     * reused for each start until the command or environment changes */
+    gchar **launch_argv;
+    gchar **launch_envp;
+    gchar *launch_path;
+
     /* Process ID */
     GPid pid;
 
@@ -68,15 +89,48 @@ typedef struct
 
 G_DEFINE_TYPE_WITH_PRIVATE (Process, process, G_TYPE_OBJECT)
 
+typedef struct
+{
+    /* TRUE if the nice value is changed */
+    gboolean set_nice;
+    int nice;
+
+    /* Value to pass to ioprio_set or -1 to leave unchanged */
+    int io_priority;
+
+    /* cgroup.procs file of the cgroup to move into or NULL */
+    gchar *cgroup_procs;
+} PriorityPolicy;
+
+/* Scheduling for each priority, set in the parent so children can apply it after forking */
+static PriorityPolicy priority_policies[N_PROCESS_PRIORITIES] =
+{
+    { FALSE, 0, -1, NULL },
+    { FALSE, 0, -1, NULL },
+    { FALSE, 0, -1, NULL }
+};
+
 static Process *current_process = NULL;
 static GHashTable *processes = NULL;
 static pid_t signal_pid;
 static int signal_pipe[2];
 
-#ifndef HAVE_CLEARENV
-extern char **environ;
+/* Signals we catch */
+static const int caught_signals[] = { SIGTERM, SIGINT, SIGUSR1, SIGUSR2 };
+
+#ifdef __linux__
+/* Descriptor to read blocked signals from, or -1 if not supported */
+static int signal_fd = -1;
 #endif
 
+typedef struct
+{
+    GPid pid;
+    int pidfd;
+    GChildWatchFunc function;
+    gpointer data;
+} ChildWatch;
+
 Process *
 process_get_current (void)
 {
@@ -90,6 +144,12 @@ process_get_current (void)
     return current_process;
 }
 
+guint
+process_get_count (void)
+{
+    return processes ? g_hash_table_size (processes) : 0;
+}
+
 Process *
 process_new (ProcessRunFunc run_func, gpointer run_func_data)
 {
@@ -102,6 +162,15 @@ process_new (ProcessRunFunc run_func, gpointer run_func_data)
     return process;
 }
 
+/* Forget what to launch, so it is worked out again on the next start */
+static void
+clear_launch (ProcessPrivate *priv)
+{
+    g_clear_pointer (&priv->launch_argv, g_strfreev);
+    g_clear_pointer (&priv->launch_envp, g_strfreev);
+    g_clear_pointer (&priv->launch_path, g_free);
+}
+
 void
 process_set_log_file (Process *process, const gchar *path, gboolean log_stdout, LogMode log_mode)
 {
@@ -121,6 +190,7 @@ process_set_clear_environment (Process *process, gboolean clear_environment)
     ProcessPrivate *priv = process_get_instance_private (process);
     g_return_if_fail (process != NULL);
     priv->clear_environment = clear_environment;
+    clear_launch (priv);
 }
 
 gboolean
@@ -138,6 +208,7 @@ process_set_env (Process *process, const gchar *name, const gchar *value)
     g_return_if_fail (process != NULL);
     g_return_if_fail (name != NULL);
     g_hash_table_insert (priv->env, g_strdup (name), g_strdup (value));
+    clear_launch (priv);
 }
 
 const gchar *
@@ -149,6 +220,109 @@ process_get_env (Process *process, const gchar *name)
     return g_hash_table_lookup (priv->env, name);
 }
 
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+/* Parse an I/O priority of the form realtime:N, best-effort:N or idle */
+static int
+parse_io_priority (const gchar *value)
+{
+    g_auto(GStrv) tokens = g_strsplit (value, ":", 2);
+    int level = tokens[0] && tokens[1] ? atoi (tokens[1]) : 4;
+    if (level < 0 || level > 7)
+        level = 4;
+
+    if (g_strcmp0 (tokens[0], "realtime") == 0)
+        return IOPRIO_CLASS_RT << IOPRIO_CLASS_SHIFT | level;
+    else if (g_strcmp0 (tokens[0], "best-effort") == 0)
+        return IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | level;
+    else if (g_strcmp0 (tokens[0], "idle") == 0)
+        return IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+
+    g_warning ("Ignoring unknown I/O priority %s", value);
+    return -1;
+}
+
+static void
+load_priority_policy (PriorityPolicy *policy, const gchar *name)
+{
+    policy->set_nice = FALSE;
+    policy->io_priority = -1;
+    g_clear_pointer (&policy->cgroup_procs, g_free);
+
+    g_autofree gchar *nice_key = g_strdup_printf ("%s-nice", name);
+    if (config_has_key (config_get_instance (), "LightDM", nice_key))
+    {
+        policy->set_nice = TRUE;
+        policy->nice = CLAMP (config_get_integer (config_get_instance (), "LightDM", nice_key), -20, 19);
+    }
+
+    g_autofree gchar *io_priority_key = g_strdup_printf ("%s-io-priority", name);
+    g_autofree gchar *io_priority = config_get_string (config_get_instance (), "LightDM", io_priority_key);
+    if (io_priority && io_priority[0] != '\0')
+        policy->io_priority = parse_io_priority (io_priority);
+
+    g_autofree gchar *cgroup_key = g_strdup_printf ("%s-cgroup", name);
+    g_autofree gchar *cgroup = config_get_string (config_get_instance (), "LightDM", cgroup_key);
+    if (cgroup && cgroup[0] != '\0')
+        policy->cgroup_procs = g_build_filename (cgroup, "cgroup.procs", NULL);
+}
+
+/* Read the scheduling for each priority from the configuration */
+void
+process_load_priorities (void)
+{
+    load_priority_policy (&priority_policies[PROCESS_PRIORITY_INTERACTIVE], "interactive");
+    load_priority_policy (&priority_policies[PROCESS_PRIORITY_BACKGROUND], "background");
+}
+
+/* Apply the scheduling for a priority to a process, or this process if pid is 0.
+ * Only uses async-signal-safe calls so it can be used in a forked child */
+void
+process_apply_priority (ProcessPriority priority, GPid pid)
+{
+    const PriorityPolicy *policy = &priority_policies[priority];
+
+    if (policy->set_nice)
+        setpriority (PRIO_PROCESS, pid, policy->nice);
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    if (policy->io_priority >= 0)
+        syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, policy->io_priority);
+#endif
+
+    if (policy->cgroup_procs)
+    {
+        int fd = open (policy->cgroup_procs, O_WRONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            /* Writing 0 moves the writing process */
+            char text[16];
+            int offset = sizeof (text);
+            unsigned int value = pid;
+            do
+            {
+                text[--offset] = '0' + value % 10;
+                value /= 10;
+            } while (value > 0);
+            ssize_t n_written = write (fd, text + offset, sizeof (text) - offset);
+            (void) n_written;
+            close (fd);
+        }
+    }
+}
+
+void
+process_set_priority (Process *process, ProcessPriority priority)
+{
+    ProcessPrivate *priv = process_get_instance_private (process);
+    g_return_if_fail (process != NULL);
+    priv->priority = priority;
+}
+
 void
 process_set_command (Process *process, const gchar *command)
 {
@@ -156,6 +330,7 @@ process_set_command (Process *process, const gchar *command)
     g_return_if_fail (process != NULL);
     g_free (priv->command);
     priv->command = g_strdup (command);
+    clear_launch (priv);
 }
 
 const gchar *
@@ -166,6 +341,68 @@ process_get_command (Process *process)
     return priv->command;
 }
 
+#if defined(__linux__) && defined(SYS_pidfd_open)
+static gboolean
+pidfd_cb (gint fd, GIOCondition condition, gpointer data)
+{
+    ChildWatch *watch = data;
+
+    int status;
+    pid_t result;
+    do
+        result = waitpid (watch->pid, &status, WNOHANG);
+    while (result < 0 && errno == EINTR);
+
+    /* Not actually exited yet */
+    if (result == 0)
+        return G_SOURCE_CONTINUE;
+    if (result < 0)
+    {
+        g_warning ("Failed to get exit status of process %d: %s", watch->pid, strerror (errno));
+        status = 0;
+    }
+
+    watch->function (watch->pid, status, watch->data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+child_watch_free (gpointer data)
+{
+    ChildWatch *watch = data;
+    close (watch->pidfd);
+    g_free (watch);
+}
+#endif
+
+/* Call function when a child process exits. On Linux this polls a pidfd so the
+ * child is reaped as soon as it becomes readable, otherwise it uses a GLib child watch.
+ * The returned source can be removed with g_source_remove() */
+guint
+process_child_watch_add (GPid pid, GChildWatchFunc function, gpointer data)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    int pidfd = syscall (SYS_pidfd_open, pid, 0);
+    if (pidfd >= 0)
+    {
+        fcntl (pidfd, F_SETFD, FD_CLOEXEC);
+
+        ChildWatch *watch = g_malloc0 (sizeof (ChildWatch));
+        watch->pid = pid;
+        watch->pidfd = pidfd;
+        watch->function = function;
+        watch->data = data;
+
+        g_autoptr(GSource) source = g_unix_fd_source_new (pidfd, G_IO_IN);
+        g_source_set_callback (source, (GSourceFunc) pidfd_cb, watch, child_watch_free);
+        return g_source_attach (source, NULL);
+    }
+#endif
+
+    return g_child_watch_add (pid, function, data);
+}
+
 static void
 process_watch_cb (GPid pid, gint status, gpointer data)
 {
@@ -174,6 +411,7 @@ process_watch_cb (GPid pid, gint status, gpointer data)
 
     priv->watch = 0;
     priv->exit_status = status;
+    flight_recorder_record (FLIGHT_RECORDER_EVENT_PROCESS_EXIT, pid, status, NULL, NULL);
 
     if (WIFEXITED (status))
         g_debug ("Process %d exited with return value %d", pid, WEXITSTATUS (status));
@@ -189,6 +427,151 @@ process_watch_cb (GPid pid, gint status, gpointer data)
     g_signal_emit (process, signals[STOPPED], 0);
 }
 
+/* Get the environment the process will run with */
+static gchar **
+get_environment (ProcessPrivate *priv)
+{
+    gchar **envp = priv->clear_environment ? g_new0 (gchar *, 1) : g_get_environ ();
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init (&iter, priv->env);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+        if (value != NULL)
+            envp = g_environ_setenv (envp, key, value, TRUE);
+        else
+            envp = g_environ_unsetenv (envp, key);
+    }
+
+    return envp;
+}
+
+/* Find a program using the PATH the process will have, as execvp would after
+ * the environment is set up */
+static gchar *
+find_program (const gchar *name, gchar **envp)
+{
+    gchar *path = program_cache_find (name, g_environ_getenv (envp, "PATH"));
+    return path ? path : g_strdup (name);
+}
+
+/* Work out what to launch, so the child only has to call execve */
+static gboolean
+prepare_launch (ProcessPrivate *priv)
+{
+    if (priv->launch_argv)
+        return TRUE;
+
+    g_autoptr(GError) error = NULL;
+    if (!g_shell_parse_argv (priv->command, NULL, &priv->launch_argv, &error))
+    {
+        g_warning ("Error parsing command %s: %s", priv->command, error->message);
+        return FALSE;
+    }
+    priv->launch_envp = get_environment (priv);
+    priv->launch_path = find_program (priv->launch_argv[0], priv->launch_envp);
+
+    return TRUE;
+}
+
+/* Arguments to run a script without an interpreter line with the shell, as execvp does */
+static gchar **
+get_shell_argv (ProcessPrivate *priv)
+{
+    guint argc = g_strv_length (priv->launch_argv);
+    gchar **shell_argv = g_new0 (gchar *, argc + 2);
+    shell_argv[0] = "/bin/sh";
+    shell_argv[1] = priv->launch_path;
+    for (guint i = 1; i < argc; i++)
+        shell_argv[i + 1] = priv->launch_argv[i];
+
+    return shell_argv;
+}
+
+/* Start a process that needs no custom setup without copying the daemon's
+ * address space. Returns the process ID or -1 with errno set */
+static pid_t
+spawn_process (ProcessPrivate *priv, int log_fd)
+{
+    gchar **argv = priv->launch_argv, **envp = priv->launch_envp;
+    const gchar *path = priv->launch_path;
+
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init (&file_actions);
+
+    /* Redirect output to logfile */
+    if (log_fd >= 0)
+    {
+        if (priv->log_stdout)
+            posix_spawn_file_actions_adddup2 (&file_actions, log_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2 (&file_actions, log_fd, STDERR_FILENO);
+        posix_spawn_file_actions_addclose (&file_actions, log_fd);
+    }
+
+    /* Reset SIGPIPE handler so the child has default behaviour (we disabled it at LightDM start) */
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init (&attributes);
+    sigset_t default_signals;
+    sigemptyset (&default_signals);
+    sigaddset (&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault (&attributes, &default_signals);
+
+    /* Don't pass on the signals we read through signalfd as blocked */
+    sigset_t mask;
+    sigemptyset (&mask);
+    posix_spawnattr_setsigmask (&attributes, &mask);
+    posix_spawnattr_setflags (&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    int result = posix_spawn (&pid, path, &file_actions, &attributes, argv, envp);
+
+    if (result == ENOEXEC)
+    {
+        g_autofree gchar **shell_argv = get_shell_argv (priv);
+        result = posix_spawn (&pid, shell_argv[0], &file_actions, &attributes, shell_argv, envp);
+    }
+
+    posix_spawnattr_destroy (&attributes);
+    posix_spawn_file_actions_destroy (&file_actions);
+
+    if (result != 0)
+    {
+        errno = result;
+        return -1;
+    }
+
+    return pid;
+}
+
+static gboolean
+start_watch (Process *process, pid_t pid, gboolean block)
+{
+    ProcessPrivate *priv = process_get_instance_private (process);
+
+    g_debug ("Launching process %d: %s", pid, priv->command);
+    g_autofree gchar *program_path = g_strndup (priv->command, strcspn (priv->command, " "));
+    g_autofree gchar *program = g_path_get_basename (program_path);
+    flight_recorder_record (FLIGHT_RECORDER_EVENT_PROCESS_START, pid, 0, NULL, program);
+
+    priv->pid = pid;
+    process_apply_priority (priv->priority, pid);
+
+    if (block)
+    {
+        int exit_status;
+        waitpid (priv->pid, &exit_status, 0);
+        process_watch_cb (priv->pid, exit_status, process);
+    }
+    else
+    {
+        g_hash_table_insert (processes, GINT_TO_POINTER (priv->pid), g_object_ref (process));
+        priv->watch = process_child_watch_add (priv->pid, process_watch_cb, process);
+    }
+
+    return TRUE;
+}
+
 gboolean
 process_start (Process *process, gboolean block)
 {
@@ -198,31 +581,31 @@ process_start (Process *process, gboolean block)
     g_return_val_if_fail (priv->command != NULL, FALSE);
     g_return_val_if_fail (priv->pid == 0, FALSE);
 
-    gint argc;
-    g_auto(GStrv) argv = NULL;
-    g_autoptr(GError) error = NULL;
-    if (!g_shell_parse_argv (priv->command, &argc, &argv, &error))
-    {
-        g_warning ("Error parsing command %s: %s", priv->command, error->message);
+    if (!prepare_launch (priv))
         return FALSE;
-    }
 
     int log_fd = -1;
     if (priv->log_file)
         log_fd = log_file_open (priv->log_file, priv->log_mode);
 
-    /* Work out variables to set */
-    guint env_length = g_hash_table_size (priv->env);
-    g_autofree gchar **env_keys = g_malloc (sizeof (gchar *) * env_length);
-    g_autofree gchar **env_values = g_malloc (sizeof (gchar *) * env_length);
-    GList *keys = g_hash_table_get_keys (priv->env);
-    guint i = 0;
-    for (GList *link = keys; i < env_length; i++, link = link->next)
+    if (!priv->run_func)
     {
-        env_keys[i] = link->data;
-        env_values[i] = g_hash_table_lookup (priv->env, env_keys[i]);
+        pid_t pid = spawn_process (priv, log_fd);
+        close (log_fd);
+        if (pid < 0)
+        {
+            g_warning ("Failed to run %s: %s", priv->launch_argv[0], strerror (errno));
+            /* Look for the program again next time in case it has moved */
+            clear_launch (priv);
+            return FALSE;
+        }
+
+        return start_watch (process, pid, block);
     }
-    g_list_free (keys);
+
+    /* Everything the child needs is set up before forking, so it doesn't
+     * allocate or search PATH */
+    g_autofree gchar **shell_argv = get_shell_argv (priv);
 
     pid_t pid = fork ();
     if (pid == 0)
@@ -240,26 +623,12 @@ process_start (Process *process, gboolean block)
              close (log_fd);
         }
 
-        /* Set environment */
-        if (priv->clear_environment)
-#ifdef HAVE_CLEARENV
-            clearenv ();
-#else
-            environ = NULL;
-#endif
-        for (guint i = 0; i < env_length; i++)
-        {
-            const gchar *value = env_values[i];
-            if (value != NULL)
-                setenv (env_keys[i], value, TRUE);
-            else
-                unsetenv (env_keys[i]);
-        }
-
         /* Reset SIGPIPE handler so the child has default behaviour (we disabled it at LightDM start) */
         signal (SIGPIPE, SIG_DFL);
 
-        execvp (argv[0], argv);
+        execve (priv->launch_path, priv->launch_argv, priv->launch_envp);
+        if (errno == ENOEXEC)
+            execve (shell_argv[0], shell_argv, priv->launch_envp);
         _exit (EXIT_FAILURE);
     }
 
@@ -271,23 +640,7 @@ process_start (Process *process, gboolean block)
         return FALSE;
     }
 
-    g_debug ("Launching process %d: %s", pid, priv->command);
-
-    priv->pid = pid;
-
-    if (block)
-    {
-        int exit_status;
-        waitpid (priv->pid, &exit_status, 0);
-        process_watch_cb (priv->pid, exit_status, process);
-    }
-    else
-    {
-        g_hash_table_insert (processes, GINT_TO_POINTER (priv->pid), g_object_ref (process));
-        priv->watch = g_child_watch_add (priv->pid, process_watch_cb, process);
-    }
-
-    return TRUE;
+    return start_watch (process, pid, block);
 }
 
 gboolean
@@ -357,6 +710,20 @@ process_stop (Process *process)
     process_signal (process, SIGTERM);
 }
 
+/* Kill every running process, used when they haven't stopped in time */
+void
+process_kill_all (void)
+{
+    if (!processes)
+        return;
+
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, processes);
+    gpointer value;
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        process_signal (PROCESS (value), SIGKILL);
+}
+
 int
 process_get_exit_status (Process *process)
 {
@@ -389,6 +756,7 @@ process_finalize (GObject *object)
     g_clear_pointer (&priv->log_file, g_free);
     g_clear_pointer (&priv->command, g_free);
     g_hash_table_unref (priv->env);
+    clear_launch (priv);
     if (priv->quit_timeout)
         g_source_remove (priv->quit_timeout);
     if (priv->watch)
@@ -414,6 +782,18 @@ signal_cb (int signum, siginfo_t *info, void *data)
         close (signal_pipe[1]);
 }
 
+static void
+dispatch_signal (int signo, pid_t pid)
+{
+    g_debug ("Got signal %d from process %d", signo, pid);
+
+    Process *process = g_hash_table_lookup (processes, GINT_TO_POINTER (pid));
+    if (process == NULL)
+        process = process_get_current ();
+    if (process)
+        g_signal_emit (process, signals[GOT_SIGNAL], 0, signo);
+}
+
 static gboolean
 handle_signal (GIOChannel *source, GIOCondition condition, gpointer data)
 {
@@ -427,17 +807,68 @@ handle_signal (GIOChannel *source, GIOCondition condition, gpointer data)
         return FALSE;
     }
 
-    g_debug ("Got signal %d from process %d", signo, pid);
-
-    Process *process = g_hash_table_lookup (processes, GINT_TO_POINTER (pid));
-    if (process == NULL)
-        process = process_get_current ();
-    if (process)
-        g_signal_emit (process, signals[GOT_SIGNAL], 0, signo);
+    dispatch_signal (signo, pid);
 
     return TRUE;
 }
 
+#ifdef __linux__
+static gboolean
+handle_signal_fd (gint fd, GIOCondition condition, gpointer data)
+{
+    /* Handle a burst of signals in one wakeup */
+    struct signalfd_siginfo info[16];
+    ssize_t n_read = read (fd, info, sizeof (info));
+    if (n_read < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR)
+            return G_SOURCE_CONTINUE;
+        g_warning ("Error reading from signalfd: %s", strerror (errno));
+        return G_SOURCE_REMOVE;
+    }
+
+    for (gsize i = 0; i < n_read / sizeof (struct signalfd_siginfo); i++)
+        dispatch_signal (info[i].ssi_signo, info[i].ssi_pid);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+unblock_signals (void)
+{
+    sigset_t mask;
+    sigemptyset (&mask);
+    for (gsize i = 0; i < G_N_ELEMENTS (caught_signals); i++)
+        sigaddset (&mask, caught_signals[i]);
+    sigprocmask (SIG_UNBLOCK, &mask, NULL);
+}
+
+/* Block the signals we catch and read them from a signalfd instead.
+ * The pipe handler stays installed for any thread created before this that
+ * still has the signals unblocked */
+static void
+setup_signal_fd (void)
+{
+    sigset_t mask;
+    sigemptyset (&mask);
+    for (gsize i = 0; i < G_N_ELEMENTS (caught_signals); i++)
+        sigaddset (&mask, caught_signals[i]);
+
+    signal_fd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0)
+    {
+        g_debug ("Failed to create signalfd, using signal handler: %s", strerror (errno));
+        return;
+    }
+
+    /* Children must not inherit the blocked signals */
+    pthread_atfork (NULL, NULL, unblock_signals);
+    pthread_sigmask (SIG_BLOCK, &mask, NULL);
+
+    g_unix_fd_add (signal_fd, G_IO_IN, handle_signal_fd, NULL);
+}
+#endif
+
 static void
 process_class_init (ProcessClass *klass)
 {
@@ -483,8 +914,10 @@ process_class_init (ProcessClass *klass)
     action.sa_sigaction = signal_cb;
     sigemptyset (&action.sa_mask);
     action.sa_flags = SA_SIGINFO | SA_RESTART;
-    sigaction (SIGTERM, &action, NULL);
-    sigaction (SIGINT, &action, NULL);
-    sigaction (SIGUSR1, &action, NULL);
-    sigaction (SIGUSR2, &action, NULL);
+    for (gsize i = 0; i < G_N_ELEMENTS (caught_signals); i++)
+        sigaction (caught_signals[i], &action, NULL);
+
+#ifdef __linux__
+    setup_signal_fd ();
+#endif
 }
@@ -44,10 +44,25 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC (Process, g_object_unref)
 
 typedef void (*ProcessRunFunc)(Process *process, gpointer user_data);
 
+/* Scheduling applied to a process, configured in the LightDM section */
+typedef enum
+{
+    PROCESS_PRIORITY_DEFAULT,
+    /* Processes a user is waiting on, e.g. X servers and greeters */
+    PROCESS_PRIORITY_INTERACTIVE,
+    /* Processes nobody is waiting on, e.g. cleanup scripts */
+    PROCESS_PRIORITY_BACKGROUND,
+    N_PROCESS_PRIORITIES
+} ProcessPriority;
+
 GType process_get_type (void);
 
+guint process_child_watch_add (GPid pid, GChildWatchFunc function, gpointer data);
+
 Process *process_get_current (void);
 
+guint process_get_count (void);
+
 Process *process_new (ProcessRunFunc run_func, gpointer run_func_data);
 
 void process_set_log_file (Process *process, const gchar *path, gboolean log_stdout, LogMode log_mode);
@@ -60,6 +75,12 @@ void process_set_env (Process *process, const gchar *name, const gchar *value);
 
 const gchar *process_get_env (Process *process, const gchar *name);
 
+void process_load_priorities (void);
+
+void process_apply_priority (ProcessPriority priority, GPid pid);
+
+void process_set_priority (Process *process, ProcessPriority priority);
+
 void process_set_command (Process *process, const gchar *command);
 
 const gchar *process_get_command (Process *process);
@@ -74,6 +95,8 @@ void process_signal (Process *process, int signum);
 
 void process_stop (Process *process);
 
+void process_kill_all (void);
+
 int process_get_exit_status (Process *process);
 
 G_END_DECLS
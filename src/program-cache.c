@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "program-cache.h"
+
+/*
+ * Programs are looked up in PATH each time an X server, greeter or session
+ * starts. Each miss is a stat in every directory before the one that has the
+ * program, which is slow when those directories are on a network filesystem.
+ * A result is reused while none of the directories searched to find it have
+ * changed, as adding, removing or renaming a program updates the directory.
+ */
+
+/* Search path used when PATH is not set */
+#define DEFAULT_SEARCH_PATH "/bin:/usr/bin"
+
+typedef struct
+{
+    /* Device and inode, so a directory that is replaced or mounted over is noticed */
+    dev_t device;
+    ino_t inode;
+
+    /* Last modification time in nanoseconds or -1 if the directory doesn't exist */
+    gint64 mtime;
+} DirectoryState;
+
+typedef struct
+{
+    /* Absolute path to the program */
+    gchar *path;
+
+    /* State of each directory in the search path up to the one the program is in */
+    GArray *directories;
+} CachedProgram;
+
+/* Programs found, keyed by search path and name */
+static GHashTable *programs = NULL;
+
+static void
+cached_program_free (CachedProgram *program)
+{
+    g_free (program->path);
+    g_array_unref (program->directories);
+    g_free (program);
+}
+
+static DirectoryState
+get_directory_state (const gchar *dir)
+{
+    DirectoryState state = { 0, 0, -1 };
+
+    struct stat info;
+    if (stat (dir, &info) == 0)
+    {
+        state.device = info.st_dev;
+        state.inode = info.st_ino;
+        state.mtime = (gint64) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    }
+
+    return state;
+}
+
+static gboolean
+is_executable (const gchar *filename)
+{
+    return g_file_test (filename, G_FILE_TEST_IS_REGULAR) && access (filename, X_OK) == 0;
+}
+
+static gboolean
+is_current (CachedProgram *program, gchar **dirs)
+{
+    for (guint i = 0; i < program->directories->len; i++)
+    {
+        DirectoryState *old_state = &g_array_index (program->directories, DirectoryState, i);
+        DirectoryState state = get_directory_state (dirs[i]);
+        if (state.device != old_state->device || state.inode != old_state->inode || state.mtime != old_state->mtime)
+            return FALSE;
+    }
+
+    /* The program itself might have been made non-executable */
+    return is_executable (program->path);
+}
+
+/* Find a program in a colon separated list of directories, or PATH if that is
+ * %NULL. Returns the absolute path or %NULL if it is not found. */
+gchar *
+program_cache_find (const gchar *name, const gchar *search_path)
+{
+    g_return_val_if_fail (name != NULL, NULL);
+
+    /* Paths are used as is, the same as execvp */
+    if (strchr (name, '/'))
+        return is_executable (name) ? g_strdup (name) : NULL;
+
+    if (!search_path)
+        search_path = g_getenv ("PATH");
+    if (!search_path)
+        search_path = DEFAULT_SEARCH_PATH;
+
+    if (!programs)
+        programs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) cached_program_free);
+
+    /* Empty entries mean the current directory */
+    g_auto(GStrv) dirs = g_strsplit (search_path, ":", -1);
+    for (int i = 0; dirs[i]; i++)
+    {
+        if (dirs[i][0] == '\0')
+        {
+            g_free (dirs[i]);
+            dirs[i] = g_strdup (".");
+        }
+    }
+
+    g_autofree gchar *key = g_strdup_printf ("%s\n%s", search_path, name);
+    CachedProgram *program = g_hash_table_lookup (programs, key);
+    if (program && is_current (program, dirs))
+        return g_strdup (program->path);
+
+    g_autoptr(GArray) directories = g_array_new (FALSE, FALSE, sizeof (DirectoryState));
+    for (int i = 0; dirs[i]; i++)
+    {
+        /* Get the state first so a program added while searching isn't missed next time */
+        DirectoryState state = get_directory_state (dirs[i]);
+        g_array_append_val (directories, state);
+
+        g_autofree gchar *filename = g_build_filename (dirs[i], name, NULL);
+        if (!is_executable (filename))
+            continue;
+
+        /* The directory can only be made absolute once it is known to be used */
+        if (!g_path_is_absolute (filename))
+        {
+            g_autofree gchar *cwd = g_get_current_dir ();
+            g_autofree gchar *absolute_filename = g_build_filename (cwd, filename, NULL);
+            g_free (filename);
+            filename = g_steal_pointer (&absolute_filename);
+        }
+
+        program = g_new0 (CachedProgram, 1);
+        program->path = g_strdup (filename);
+        program->directories = g_steal_pointer (&directories);
+        g_hash_table_insert (programs, g_steal_pointer (&key), program);
+
+        return g_steal_pointer (&filename);
+    }
+
+    g_hash_table_remove (programs, key);
+
+    return NULL;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "resource-usage.h"
+
+/*
+ * Resources are read from /proc each time they are asked for, so there is no
+ * cost when nobody is looking. Anything that can't be read (the process has
+ * gone or /proc isn't mounted) is left out of the result.
+ */
+
+/* Fields in /proc/<pid>/stat after the command name, counting the state as 0 */
+#define STAT_UTIME 11
+#define STAT_STIME 12
+
+static gboolean
+get_cpu_time (GPid pid, guint64 *cpu_time)
+{
+    g_autofree gchar *path = g_strdup_printf ("/proc/%d/stat", pid);
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return FALSE;
+
+    /* The command name can contain spaces, so start after it */
+    const gchar *fields = strrchr (contents, ')');
+    if (!fields)
+        return FALSE;
+    g_auto(GStrv) tokens = g_strsplit (fields + 2, " ", STAT_STIME + 2);
+    if (g_strv_length (tokens) <= STAT_STIME)
+        return FALSE;
+
+    guint64 ticks = g_ascii_strtoull (tokens[STAT_UTIME], NULL, 10) + g_ascii_strtoull (tokens[STAT_STIME], NULL, 10);
+    *cpu_time = ticks * G_USEC_PER_SEC / sysconf (_SC_CLK_TCK);
+
+    return TRUE;
+}
+
+static gboolean
+get_rss (GPid pid, guint64 *rss)
+{
+    g_autofree gchar *path = g_strdup_printf ("/proc/%d/statm", pid);
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return FALSE;
+
+    /* Total size then resident size, in pages */
+    g_auto(GStrv) tokens = g_strsplit (contents, " ", 3);
+    if (g_strv_length (tokens) < 2)
+        return FALSE;
+    *rss = g_ascii_strtoull (tokens[1], NULL, 10) * sysconf (_SC_PAGESIZE);
+
+    return TRUE;
+}
+
+static gboolean
+get_n_fds (GPid pid, guint32 *n_fds)
+{
+    g_autofree gchar *path = g_strdup_printf ("/proc/%d/fd", pid);
+    GDir *dir = g_dir_open (path, 0, NULL);
+    if (!dir)
+        return FALSE;
+
+    *n_fds = 0;
+    while (g_dir_read_name (dir))
+        (*n_fds)++;
+    g_dir_close (dir);
+
+    return TRUE;
+}
+
+/* Get the cgroup v2 group the process is in, as that includes any processes it started */
+static gchar *
+get_cgroup (GPid pid)
+{
+    g_autofree gchar *path = g_strdup_printf ("/proc/%d/cgroup", pid);
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return NULL;
+
+    g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+    for (gchar **line = lines; *line; line++)
+        if (g_str_has_prefix (*line, "0::"))
+            return g_strdup (*line + strlen ("0::"));
+
+    return NULL;
+}
+
+static gboolean
+get_cgroup_memory (const gchar *cgroup, guint64 *memory)
+{
+    g_autofree gchar *path = g_build_filename ("/sys/fs/cgroup", cgroup, "memory.current", NULL);
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return FALSE;
+    *memory = g_ascii_strtoull (contents, NULL, 10);
+
+    return TRUE;
+}
+
+/* Get what a process is using: rss (bytes), cpu-time (microseconds), fds and
+ * if using cgroup v2 the cgroup and the memory it is using (bytes) */
+GVariant *
+resource_usage_get (GPid pid)
+{
+    GVariantDict usage;
+    g_variant_dict_init (&usage, NULL);
+
+    if (pid <= 0)
+        return g_variant_dict_end (&usage);
+
+    guint64 rss, cpu_time;
+    guint32 n_fds;
+    if (get_rss (pid, &rss))
+        g_variant_dict_insert (&usage, "rss", "t", rss);
+    if (get_cpu_time (pid, &cpu_time))
+        g_variant_dict_insert (&usage, "cpu-time", "t", cpu_time);
+    if (get_n_fds (pid, &n_fds))
+        g_variant_dict_insert (&usage, "fds", "u", n_fds);
+
+    g_autofree gchar *cgroup = get_cgroup (pid);
+    guint64 memory;
+    if (cgroup && get_cgroup_memory (cgroup, &memory))
+    {
+        g_variant_dict_insert (&usage, "cgroup", "s", cgroup);
+        g_variant_dict_insert (&usage, "cgroup-memory", "t", memory);
+    }
+
+    return g_variant_dict_end (&usage);
+}
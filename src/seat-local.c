@@ -17,6 +17,7 @@
 #include "wayland-session.h"
 #include "plymouth.h"
 #include "vt.h"
+#include "trace.h"
 
 typedef struct
 {
@@ -105,6 +106,7 @@ display_server_ready_cb (DisplayServer *display_server, Seat *seat)
 {
     /* Quit Plymouth */
     plymouth_quit (TRUE);
+    trace_end (seat, "plymouth-handoff");
 }
 
 static void
@@ -112,13 +114,17 @@ display_server_transition_plymouth_cb (DisplayServer *display_server, Seat *seat
 {
     /* Quit Plymouth if we didn't do the transition */
     if (plymouth_get_is_running ())
+    {
         plymouth_quit (FALSE);
+        trace_end (seat, "plymouth-handoff");
+    }
 
     g_signal_handlers_disconnect_matched (display_server, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, display_server_transition_plymouth_cb, NULL);
 }
 
+/* Plymouth is quit once the display server emits @ready_signal, so the boot splash stays up until it can draw */
 static gint
-get_vt (SeatLocal *seat, DisplayServer *display_server)
+get_vt (SeatLocal *seat, DisplayServer *display_server, const gchar *ready_signal)
 {
     if (strcmp (seat_get_name (SEAT (seat)), "seat0") != 0)
         return -1;
@@ -131,8 +137,9 @@ get_vt (SeatLocal *seat, DisplayServer *display_server)
         if (active_vt >= vt_get_min ())
         {
             vt = active_vt;
-            g_signal_connect (display_server, DISPLAY_SERVER_SIGNAL_READY, G_CALLBACK (display_server_ready_cb), seat);
+            g_signal_connect (display_server, ready_signal, G_CALLBACK (display_server_ready_cb), seat);
             g_signal_connect (display_server, DISPLAY_SERVER_SIGNAL_STOPPED, G_CALLBACK (display_server_transition_plymouth_cb), seat);
+            trace_begin (seat, "plymouth-handoff");
             plymouth_deactivate ();
         }
         else
@@ -151,7 +158,7 @@ create_x_server (SeatLocal *seat)
 {
     g_autoptr(XServerLocal) x_server = x_server_local_new ();
 
-    gint vt = get_vt (seat, DISPLAY_SERVER (x_server));
+    gint vt = get_vt (seat, DISPLAY_SERVER (x_server), DISPLAY_SERVER_SIGNAL_READY);
     if (vt >= 0)
         x_server_local_set_vt (x_server, vt);
 
@@ -169,6 +176,8 @@ create_x_server (SeatLocal *seat)
     if (command)
         x_server_local_set_command (x_server, command);
 
+    /* Must be set before anything asks for the display number */
+    x_server_local_set_use_displayfd (x_server, seat_get_boolean_property (SEAT (seat), "xserver-displayfd"));
     x_server_set_local_authority (X_SERVER (x_server));
 
     const gchar *layout = seat_get_string_property (SEAT (seat), "xserver-layout");
@@ -192,7 +201,8 @@ create_wayland_session (SeatLocal *seat)
 {
     g_autoptr(WaylandSession) session = wayland_session_new ();
 
-    gint vt = get_vt (seat, DISPLAY_SERVER (session));
+    /* There's nothing to start before the session, so hand over once the compositor is drawing */
+    gint vt = get_vt (seat, DISPLAY_SERVER (session), WAYLAND_SESSION_SIGNAL_COMPOSITOR_READY);
     if (vt >= 0)
         wayland_session_set_vt (session, vt);
 
@@ -240,14 +250,30 @@ seat_local_create_session (Seat *seat)
     return session;
 }
 
+static void
+vt_activated_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(Seat) seat = data;
+
+    trace_end (seat, "vt-switch");
+
+    g_autoptr(GError) error = NULL;
+    if (!vt_set_active_finish (result, &error))
+        l_warning (seat, "Failed to activate VT: %s", error->message);
+}
+
 static void
 seat_local_set_active_session (Seat *seat, Session *session)
 {
     DisplayServer *display_server = session_get_display_server (session);
 
+    /* Switch in the background so a slow VT switch doesn't block other seats */
     gint vt = display_server_get_vt (display_server);
     if (vt >= 0)
-        vt_set_active (vt);
+    {
+        trace_begin (seat, "vt-switch");
+        vt_set_active_async (vt, vt_activated_cb, g_object_ref (seat));
+    }
 
     SEAT_CLASS (seat_local_parent_class)->set_active_session (seat, session);
 }
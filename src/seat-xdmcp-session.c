@@ -13,6 +13,7 @@
 
 #include "seat-xdmcp-session.h"
 #include "x-server-remote.h"
+#include "greeter-host.h"
 
 typedef struct
 {
@@ -36,6 +37,23 @@ seat_xdmcp_session_new (XDMCPSession *session)
     return seat;
 }
 
+XDMCPSession *
+seat_xdmcp_session_get_session (SeatXDMCPSession *seat)
+{
+    SeatXDMCPSessionPrivate *priv = seat_xdmcp_session_get_instance_private (seat);
+    g_return_val_if_fail (seat != NULL, NULL);
+    return priv->session;
+}
+
+/* TRUE if the display is still showing this seat, e.g. it has come back after a network drop without resetting */
+gboolean
+seat_xdmcp_session_get_display_is_connected (SeatXDMCPSession *seat)
+{
+    SeatXDMCPSessionPrivate *priv = seat_xdmcp_session_get_instance_private (seat);
+    g_return_val_if_fail (seat != NULL, FALSE);
+    return priv->x_server && x_server_get_is_connected (X_SERVER (priv->x_server));
+}
+
 static DisplayServer *
 seat_xdmcp_session_create_display_server (Seat *seat, Session *session)
 {
@@ -52,13 +70,27 @@ seat_xdmcp_session_create_display_server (Seat *seat, Session *session)
     g_autofree gchar *host = g_inet_address_to_string (xdmcp_session_get_address (priv->session));
 
     priv->x_server = x_server_remote_new (host, xdmcp_session_get_display_number (priv->session), authority);
+    x_server_set_connect_timeout (X_SERVER (priv->x_server), MAX (seat_get_integer_property (seat, "xserver-connect-timeout"), 0));
 
     return g_object_ref (DISPLAY_SERVER (priv->x_server));
 }
 
+static GreeterSession *
+seat_xdmcp_session_create_greeter_session (Seat *seat)
+{
+    GreeterSession *greeter_session = SEAT_CLASS (seat_xdmcp_session_parent_class)->create_greeter_session (seat);
+
+    /* Nothing is shown on this machine, so the greeter can be shared with other seats */
+    if (seat_get_boolean_property (seat, "greeter-shared") && greeter_host_get_is_configured ())
+        greeter_session_set_shared (greeter_session, seat_get_name (seat));
+
+    return greeter_session;
+}
+
 static void
 seat_xdmcp_session_init (SeatXDMCPSession *seat)
 {
+    seat_set_close_when_idle (SEAT (seat), TRUE);
 }
 
 static void
@@ -80,5 +112,6 @@ seat_xdmcp_session_class_init (SeatXDMCPSessionClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
     seat_class->create_display_server = seat_xdmcp_session_create_display_server;
+    seat_class->create_greeter_session = seat_xdmcp_session_create_greeter_session;
     object_class->finalize = seat_xdmcp_session_finalize;
 }
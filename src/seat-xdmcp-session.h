@@ -19,6 +19,7 @@ G_BEGIN_DECLS
 
 #define SEAT_XDMCP_SESSION_TYPE (seat_xdmcp_session_get_type())
 #define SEAT_XDMCP_SESSION(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), SEAT_XDMCP_SESSION_TYPE, SeatXDMCPSession))
+#define IS_SEAT_XDMCP_SESSION(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), SEAT_XDMCP_SESSION_TYPE))
 
 typedef struct
 {
@@ -36,6 +37,10 @@ GType seat_xdmcp_session_get_type (void);
 
 SeatXDMCPSession *seat_xdmcp_session_new (XDMCPSession *session);
 
+XDMCPSession *seat_xdmcp_session_get_session (SeatXDMCPSession *seat);
+
+gboolean seat_xdmcp_session_get_display_is_connected (SeatXDMCPSession *seat);
+
 G_END_DECLS
 
 #endif /* SEAT_XDMCP_SESSION_H_ */
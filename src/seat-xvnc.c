@@ -13,13 +13,28 @@
 
 #include "seat-xvnc.h"
 #include "x-server-xvnc.h"
+#include "greeter-host.h"
 #include "configuration.h"
 
+/* Time to wait between attempts to connect to a starting X server, and how many attempts to make */
+#define CONNECT_RETRY_INTERVAL 100
+#define MAX_CONNECT_RETRIES 50
+
 typedef struct
 {
     /* VNC connection */
     GSocket *connection;
 
+    /* Loopback port the X server listens on when started before the connection, or 0 */
+    guint port;
+
+    /* Attempts made to connect to the X server and timer for the next one */
+    gint n_retries;
+    guint retry_timeout;
+
+    /* Cancellable for forwarding the connection to the X server */
+    GCancellable *cancellable;
+
     /* X server using VNC connection */
     XServerXVNC *x_server;
 } SeatXVNCPrivate;
@@ -32,10 +47,139 @@ SeatXVNC *seat_xvnc_new (GSocket *connection)
     SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
 
     priv->connection = g_object_ref (connection);
+    seat_set_close_when_idle (SEAT (seat), TRUE);
+
+    return seat;
+}
+
+/* Get an unused port on the loopback interface */
+static guint
+get_free_port (void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSocket) socket = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, &error);
+    if (!socket)
+    {
+        g_warning ("Failed to create socket: %s", error->message);
+        return 0;
+    }
+
+    g_autoptr(GInetAddress) loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+    g_autoptr(GSocketAddress) address = g_inet_socket_address_new (loopback, 0);
+    if (!g_socket_bind (socket, address, FALSE, &error))
+    {
+        g_warning ("Failed to find a free port: %s", error->message);
+        return 0;
+    }
+
+    g_autoptr(GSocketAddress) local_address = g_socket_get_local_address (socket, &error);
+    if (!local_address)
+    {
+        g_warning ("Failed to find a free port: %s", error->message);
+        return 0;
+    }
+
+    return g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (local_address));
+}
+
+SeatXVNC *seat_xvnc_new_pooled (void)
+{
+    guint port = get_free_port ();
+    if (port == 0)
+        return NULL;
+
+    SeatXVNC *seat = g_object_new (SEAT_XVNC_TYPE, NULL);
+    SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
+
+    priv->port = port;
 
     return seat;
 }
 
+static void
+splice_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    g_autoptr(SeatXVNC) seat = user_data;
+
+    g_autoptr(GError) error = NULL;
+    if (!g_io_stream_splice_finish (result, &error) && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        l_debug (seat, "VNC connection failed: %s", error->message);
+    else
+        l_debug (seat, "VNC connection closed");
+
+    /* As with an X server serving a single connection, the seat ends when the connection does */
+    seat_stop (SEAT (seat));
+}
+
+static void connect_to_x_server (SeatXVNC *seat);
+
+static gboolean
+retry_connect_cb (gpointer user_data)
+{
+    SeatXVNC *seat = user_data;
+    SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
+
+    priv->retry_timeout = 0;
+    connect_to_x_server (seat);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+x_server_connect_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    g_autoptr(SeatXVNC) seat = user_data;
+    SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSocketConnection) x_connection = g_socket_client_connect_finish (G_SOCKET_CLIENT (object), result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+    if (!x_connection)
+    {
+        /* The X server may not be listening yet */
+        if (priv->n_retries < MAX_CONNECT_RETRIES)
+        {
+            priv->n_retries++;
+            priv->retry_timeout = g_timeout_add (CONNECT_RETRY_INTERVAL, retry_connect_cb, seat);
+            return;
+        }
+
+        l_warning (seat, "Failed to connect to VNC server: %s", error->message);
+        seat_stop (SEAT (seat));
+        return;
+    }
+
+    l_debug (seat, "Forwarding VNC connection to X server on port %u", priv->port);
+    g_autoptr(GSocketConnection) client_connection = g_socket_connection_factory_create_connection (priv->connection);
+    g_io_stream_splice_async (G_IO_STREAM (client_connection), G_IO_STREAM (x_connection),
+                              G_IO_STREAM_SPLICE_CLOSE_STREAM1 | G_IO_STREAM_SPLICE_CLOSE_STREAM2,
+                              G_PRIORITY_DEFAULT, priv->cancellable, splice_cb, g_object_ref (seat));
+}
+
+static void
+connect_to_x_server (SeatXVNC *seat)
+{
+    SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
+
+    g_autoptr(GSocketClient) client = g_socket_client_new ();
+    g_socket_client_connect_to_host_async (client, "127.0.0.1", priv->port, priv->cancellable, x_server_connect_cb, g_object_ref (seat));
+}
+
+void
+seat_xvnc_set_connection (SeatXVNC *seat, GSocket *connection)
+{
+    SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
+
+    g_return_if_fail (seat != NULL);
+    g_return_if_fail (priv->port != 0);
+    g_return_if_fail (priv->connection == NULL);
+
+    priv->connection = g_object_ref (connection);
+    seat_set_close_when_idle (SEAT (seat), TRUE);
+    connect_to_x_server (seat);
+}
+
 static DisplayServer *
 seat_xvnc_create_display_server (Seat *seat, Session *session)
 {
@@ -50,8 +194,12 @@ seat_xvnc_create_display_server (Seat *seat, Session *session)
 
     g_autoptr(XServerXVNC) x_server = x_server_xvnc_new ();
     priv->x_server = g_object_ref (x_server);
+    x_server_local_set_use_displayfd (X_SERVER_LOCAL (x_server), seat_get_boolean_property (SEAT (seat), "xserver-displayfd"));
     x_server_set_local_authority (X_SERVER (x_server));
-    x_server_xvnc_set_socket (x_server, g_socket_get_fd (priv->connection));
+    if (priv->port != 0)
+        x_server_xvnc_set_port (x_server, priv->port);
+    else
+        x_server_xvnc_set_socket (x_server, g_socket_get_fd (priv->connection));
 
     const gchar *command = config_get_string (config_get_instance (), "VNCServer", "command");
     if (command)
@@ -83,21 +231,40 @@ seat_xvnc_run_script (Seat *seat, DisplayServer *display_server, Process *script
     SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (SEAT_XVNC (seat));
     XServerXVNC *x_server = X_SERVER_XVNC (display_server);
 
-    GInetSocketAddress *address = G_INET_SOCKET_ADDRESS (g_socket_get_remote_address (priv->connection, NULL));
-    g_autofree gchar *hostname = g_inet_address_to_string (g_inet_socket_address_get_address (address));
     const gchar *path = x_server_local_get_authority_file_path (X_SERVER_LOCAL (x_server));
 
-    process_set_env (script, "REMOTE_HOST", hostname);
+    /* Pooled seats don't have a connection until they are used */
+    if (priv->connection)
+    {
+        GInetSocketAddress *address = G_INET_SOCKET_ADDRESS (g_socket_get_remote_address (priv->connection, NULL));
+        g_autofree gchar *hostname = g_inet_address_to_string (g_inet_socket_address_get_address (address));
+        process_set_env (script, "REMOTE_HOST", hostname);
+    }
     process_set_env (script, "DISPLAY", x_server_get_address (X_SERVER (x_server)));
     process_set_env (script, "XAUTHORITY", path);
 
     SEAT_CLASS (seat_xvnc_parent_class)->run_script (seat, display_server, script);
 }
 
+static GreeterSession *
+seat_xvnc_create_greeter_session (Seat *seat)
+{
+    GreeterSession *greeter_session = SEAT_CLASS (seat_xvnc_parent_class)->create_greeter_session (seat);
+
+    /* Nothing is shown on this machine, so the greeter can be shared with other seats */
+    if (seat_get_boolean_property (seat, "greeter-shared") && greeter_host_get_is_configured ())
+        greeter_session_set_shared (greeter_session, seat_get_name (seat));
+
+    return greeter_session;
+}
+
 static void
 seat_xvnc_init (SeatXVNC *seat)
 {
+    SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (seat);
+
     seat_set_supports_multi_session (SEAT (seat), FALSE);
+    priv->cancellable = g_cancellable_new ();
 }
 
 static void
@@ -106,6 +273,10 @@ seat_xvnc_session_finalize (GObject *object)
     SeatXVNC *self = SEAT_XVNC (object);
     SeatXVNCPrivate *priv = seat_xvnc_get_instance_private (self);
 
+    g_cancellable_cancel (priv->cancellable);
+    g_clear_object (&priv->cancellable);
+    if (priv->retry_timeout != 0)
+        g_source_remove (priv->retry_timeout);
     g_clear_object (&priv->connection);
     g_clear_object (&priv->x_server);
 
@@ -119,6 +290,7 @@ seat_xvnc_class_init (SeatXVNCClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
     seat_class->create_display_server = seat_xvnc_create_display_server;
+    seat_class->create_greeter_session = seat_xvnc_create_greeter_session;
     seat_class->run_script = seat_xvnc_run_script;
     object_class->finalize = seat_xvnc_session_finalize;
 }
@@ -36,6 +36,10 @@ GType seat_xvnc_get_type (void);
 
 SeatXVNC *seat_xvnc_new (GSocket *connection);
 
+SeatXVNC *seat_xvnc_new_pooled (void);
+
+void seat_xvnc_set_connection (SeatXVNC *seat, GSocket *connection);
+
 G_END_DECLS
 
 #endif /* SEAT_XVNC_H_ */
@@ -14,26 +14,43 @@
 #include <sys/wait.h>
 
 #include "seat.h"
+#include "boot-readahead.h"
 #include "configuration.h"
+#include "flight-recorder.h"
 #include "guest-account.h"
 #include "greeter-session.h"
+#include "login1.h"
+#include "program-cache.h"
 #include "session-config.h"
+#include "session-catalog.h"
+#include "trace.h"
+#include "user-prefetch.h"
 
 enum {
     SESSION_ADDED,
     RUNNING_USER_SESSION,
     SESSION_REMOVED,
+    ACTIVE_SESSION_CHANGED,
     STOPPED,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* A configuration value with the typed forms it is read as */
+typedef struct
+{
+    gchar *value;
+    gboolean boolean_value;
+    gint integer_value;
+    gchar **list_value;
+} SeatProperty;
+
 typedef struct
 {
     /* XDG name for this seat */
     gchar *name;
 
-    /* Configuration for this seat */
+    /* Configuration for this seat, keyed by name */
     GHashTable *properties;
 
     /* TRUE if this seat can run multiple sessions at once */
@@ -48,6 +65,16 @@ typedef struct
     /* The sessions on this seat */
     GList *sessions;
 
+    /* Index entries for each session, the entries for each user sorted by when
+     * they were added, and the sessions by logind ID */
+    GHashTable *session_entries;
+    GHashTable *user_sessions;
+    GHashTable *login1_sessions;
+    guint64 next_session_serial;
+
+    /* Greeter sessions in the order they were added */
+    GList *greeter_sessions;
+
     /* The last session set to active */
     Session *active_session;
 
@@ -66,10 +93,75 @@ typedef struct
     /* TRUE if stopped */
     gboolean stopped;
 
+    /* Number of hook scripts running */
+    guint n_scripts;
+
     /* The greeter to be started to replace the current one */
     GreeterSession *replacement_greeter;
+
+    /* Session to run on the display server of a greeter being stopped */
+    Session *handover_session;
+
+    /* Time the current user switch was requested */
+    gint64 switch_start_time;
+
+    /* Greeter running in the background ready to lock the screen with */
+    GreeterSession *standby_greeter;
+    guint standby_greeter_idle;
+
+    /* Time a crashed greeter was last restarted */
+    gint64 greeter_restart_time;
+
+    /* Display server and greeter crashes, the number in a row is used to back
+     * off restarting them and to trip to the fallback configuration */
+    guint n_recent_crashes;
+    guint64 n_crashes;
+    gint64 last_crash_time;
+    guint crash_restart_timeout;
+
+    /* Number of times the crash limit has been reached */
+    guint n_crash_loops;
+
+    /* TRUE if the seat is closed when its greeter is left unused, the time
+     * that started and the timer to check the greeter is still being used */
+    gboolean close_when_idle;
+    gint64 close_when_idle_time;
+    guint idle_greeter_timeout;
+
+    /* Time this seat was started, and TRUE once we have logged a greeter being ready */
+    gint64 start_time;
+    gboolean logged_greeter_ready;
+
+    /* Users waiting to have a background session started, and the background
+     * sessions that are starting and not yet authenticated */
+    GQueue background_users;
+    GList *starting_background_sessions;
 } SeatPrivate;
 
+/* Where a session is in the seat's indexes */
+typedef struct
+{
+    Session *session;
+
+    /* Order this session was added in, so lookups find the same session a scan of all sessions would */
+    guint64 serial;
+
+    /* Name this session is indexed under or NULL */
+    gchar *username;
+} SessionIndexEntry;
+
+/* Time the first seat was started, used as the daemon start time */
+static gint64 first_start_time = 0;
+
+/* A greeter crashing again this soon after being restarted is left stopped (microseconds) */
+#define GREETER_RESTART_INTERVAL (10 * G_USEC_PER_SEC)
+
+/* Crashes further apart than this don't count as being in a row (microseconds) */
+#define CRASH_LOOP_INTERVAL (60 * G_USEC_PER_SEC)
+
+/* Longest time to wait before starting a greeter after the display server crashed (seconds) */
+#define MAX_CRASH_BACKOFF 64
+
 static void seat_logger_iface_init (LoggerInterface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (Seat, seat, G_TYPE_OBJECT,
@@ -89,6 +181,7 @@ static DisplayServer *create_display_server (Seat *seat, Session *session);
 static gboolean start_display_server (Seat *seat, DisplayServer *display_server);
 static GreeterSession *create_greeter_session (Seat *seat);
 static void start_session (Seat *seat, Session *session);
+static gboolean start_standby_greeter_cb (gpointer data);
 
 static void
 free_seat_module (gpointer data)
@@ -136,51 +229,75 @@ seat_set_name (Seat *seat, const gchar *name)
     priv->name = g_strdup (name);
 }
 
+static void
+seat_property_free (SeatProperty *property)
+{
+    g_free (property->value);
+    g_strfreev (property->list_value);
+    g_free (property);
+}
+
 void
 seat_set_property (Seat *seat, const gchar *name, const gchar *value)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
     g_return_if_fail (seat != NULL);
-    g_hash_table_insert (priv->properties, g_strdup (name), g_strdup (value));
+
+    /* Parse once here so lookups during login don't have to */
+    SeatProperty *property = g_new0 (SeatProperty, 1);
+    property->value = g_strdup (value);
+    if (value)
+    {
+        /* Count the number of non-whitespace characters */
+        gint length = 0;
+        for (gint i = 0; value[i]; i++)
+            if (!g_ascii_isspace (value[i]))
+                length = i + 1;
+        property->boolean_value = strncmp (value, "true", MAX (length, 4)) == 0;
+        property->integer_value = atoi (value);
+        property->list_value = g_strsplit (value, ";", 0);
+    }
+
+    g_hash_table_insert (priv->properties, g_strdup (name), property);
+}
+
+static SeatProperty *
+get_property (Seat *seat, const gchar *name)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    return g_hash_table_lookup (priv->properties, name);
 }
 
 const gchar *
 seat_get_string_property (Seat *seat, const gchar *name)
 {
-    SeatPrivate *priv = seat_get_instance_private (seat);
     g_return_val_if_fail (seat != NULL, NULL);
-    return g_hash_table_lookup (priv->properties, name);
+    SeatProperty *property = get_property (seat, name);
+    return property ? property->value : NULL;
 }
 
 gchar **
 seat_get_string_list_property (Seat *seat, const gchar *name)
 {
-    SeatPrivate *priv = seat_get_instance_private (seat);
     g_return_val_if_fail (seat != NULL, NULL);
-    return g_strsplit (g_hash_table_lookup (priv->properties, name), ";", 0);
+    SeatProperty *property = get_property (seat, name);
+    return property ? g_strdupv (property->list_value) : NULL;
 }
 
 gboolean
 seat_get_boolean_property (Seat *seat, const gchar *name)
 {
-    const gchar *value = seat_get_string_property (seat, name);
-    if (!value)
-        return FALSE;
-
-    /* Count the number of non-whitespace characters */
-    gint length = 0;
-    for (gint i = 0; value[i]; i++)
-        if (!g_ascii_isspace (value[i]))
-            length = i + 1;
-
-    return strncmp (value, "true", MAX (length, 4)) == 0;
+    g_return_val_if_fail (seat != NULL, FALSE);
+    SeatProperty *property = get_property (seat, name);
+    return property ? property->boolean_value : FALSE;
 }
 
 gint
 seat_get_integer_property (Seat *seat, const gchar *name)
 {
-    const gchar *value = seat_get_string_property (seat, name);
-    return value ? atoi (value) : 0;
+    g_return_val_if_fail (seat != NULL, 0);
+    SeatProperty *property = get_property (seat, name);
+    return property ? property->integer_value : 0;
 }
 
 const gchar *
@@ -199,6 +316,19 @@ seat_set_supports_multi_session (Seat *seat, gboolean supports_multi_session)
     priv->supports_multi_session = supports_multi_session;
 }
 
+static void schedule_idle_greeter_check (Seat *seat);
+
+/* Close the seat if the greeter goes greeter-idle-timeout seconds without being used, for seats nobody is sat at */
+void
+seat_set_close_when_idle (Seat *seat, gboolean close_when_idle)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    g_return_if_fail (seat != NULL);
+    priv->close_when_idle = close_when_idle;
+    priv->close_when_idle_time = g_get_monotonic_time ();
+    schedule_idle_greeter_check (seat);
+}
+
 void
 seat_set_share_display_server (Seat *seat, gboolean share_display_server)
 {
@@ -207,6 +337,14 @@ seat_set_share_display_server (Seat *seat, gboolean share_display_server)
     priv->share_display_server = share_display_server;
 }
 
+/* Record a session changing state, greeters are recorded without a username */
+static void
+record_session_event (Seat *seat, FlightRecorderEventType type, Session *session)
+{
+    const gchar *name = IS_GREETER_SESSION (session) ? "(greeter)" : session_get_username (session);
+    flight_recorder_record (type, session_get_pid (session), 0, seat_get_name (seat), name);
+}
+
 gboolean
 seat_start (Seat *seat)
 {
@@ -215,6 +353,11 @@ seat_start (Seat *seat)
     g_return_val_if_fail (seat != NULL, FALSE);
 
     l_debug (seat, "Starting");
+    flight_recorder_record (FLIGHT_RECORDER_EVENT_SEAT_START, 0, 0, seat_get_name (seat), NULL);
+
+    priv->start_time = g_get_monotonic_time ();
+    if (first_start_time == 0)
+        first_start_time = priv->start_time;
 
     priv->started = SEAT_GET_CLASS (seat)->start (seat);
 
@@ -236,6 +379,65 @@ set_greeter_idle (gpointer greeter)
     return FALSE;
 }
 
+/* Get how long until the active greeter has gone unused for too long, FALSE if it isn't being timed */
+static gboolean
+get_greeter_idle_remaining (Seat *seat, gint64 *remaining)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (!priv->close_when_idle || priv->stopping || !priv->active_session || !IS_GREETER_SESSION (priv->active_session))
+        return FALSE;
+    gint timeout = seat_get_integer_property (seat, "greeter-idle-timeout");
+    if (timeout <= 0)
+        return FALSE;
+
+    Greeter *greeter = greeter_session_get_greeter (GREETER_SESSION (priv->active_session));
+    gint64 last_activity_time = MAX (greeter_get_last_activity_time (greeter), priv->close_when_idle_time);
+    *remaining = last_activity_time + (gint64) timeout * G_USEC_PER_SEC - g_get_monotonic_time ();
+
+    return TRUE;
+}
+
+static gboolean
+idle_greeter_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->idle_greeter_timeout = 0;
+
+    gint64 remaining;
+    if (!get_greeter_idle_remaining (seat, &remaining))
+        return G_SOURCE_REMOVE;
+
+    /* The greeter was used since the timer was set */
+    if (remaining > 0)
+    {
+        schedule_idle_greeter_check (seat);
+        return G_SOURCE_REMOVE;
+    }
+
+    l_debug (seat, "Greeter unused for %ds, stopping seat", seat_get_integer_property (seat, "greeter-idle-timeout"));
+    seat_stop (seat);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Set a timer for when the active greeter will have gone unused for too long */
+static void
+schedule_idle_greeter_check (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    g_clear_handle_id (&priv->idle_greeter_timeout, g_source_remove);
+
+    gint64 remaining;
+    if (!get_greeter_idle_remaining (seat, &remaining))
+        return;
+
+    priv->idle_greeter_timeout = g_timeout_add_seconds (MAX ((remaining + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC, 1), idle_greeter_cb, seat);
+}
+
 void
 seat_set_active_session (Seat *seat, Session *session)
 {
@@ -243,15 +445,22 @@ seat_set_active_session (Seat *seat, Session *session)
 
     g_return_if_fail (seat != NULL);
 
+    record_session_event (seat, FLIGHT_RECORDER_EVENT_SESSION_ACTIVATE, session);
     SEAT_GET_CLASS (seat)->set_active_session (seat, session);
 
-    /* Stop any greeters */
+    /* The standby greeter is now in use */
+    if (priv->standby_greeter && session == SESSION (priv->standby_greeter))
+        g_clear_object (&priv->standby_greeter);
+
+    /* Stop any greeters (except the standby one which hasn't been shown yet) */
     for (GList *link = priv->sessions; link; link = link->next)
     {
         Session *s = link->data;
 
         if (s == session || session_get_is_stopping (s))
             continue;
+        if (priv->standby_greeter && s == SESSION (priv->standby_greeter))
+            continue;
 
         if (IS_GREETER_SESSION (s))
         {
@@ -283,6 +492,24 @@ seat_set_active_session (Seat *seat, Session *session)
     session_activate (session);
     g_clear_object (&priv->active_session);
     priv->active_session = g_object_ref (session);
+
+    /* Report how long the last user switch took */
+    if (priv->switch_start_time != 0)
+    {
+        gint64 now = g_get_monotonic_time ();
+        l_debug (seat, "Switched to %s in %.3fs", IS_GREETER_SESSION (session) ? "greeter" : "user session",
+                 (now - priv->switch_start_time) / 1000000.0);
+        trace_add ("user-switch", priv->switch_start_time, now);
+        priv->switch_start_time = 0;
+    }
+
+    /* Get a greeter ready in the background so locking doesn't have to wait for one to start */
+    if (!IS_GREETER_SESSION (session) && seat_get_boolean_property (seat, "greeter-standby") && priv->standby_greeter_idle == 0)
+        priv->standby_greeter_idle = g_idle_add (start_standby_greeter_cb, seat);
+
+    schedule_idle_greeter_check (seat);
+
+    g_signal_emit (seat, signals[ACTIVE_SESSION_CHANGED], 0, session);
 }
 
 Session *
@@ -332,6 +559,100 @@ seat_set_externally_activated_session (Seat *seat, Session *session)
     g_return_if_fail (seat != NULL);
     g_clear_object (&priv->active_session);
     priv->active_session = g_object_ref (session);
+
+    g_signal_emit (seat, signals[ACTIVE_SESSION_CHANGED], 0, session);
+}
+
+static gint
+compare_index_entries (gconstpointer a, gconstpointer b)
+{
+    const SessionIndexEntry *entry_a = a, *entry_b = b;
+    return entry_a->serial < entry_b->serial ? -1 : entry_a->serial > entry_b->serial ? 1 : 0;
+}
+
+static void
+unindex_username (Seat *seat, SessionIndexEntry *entry)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (!entry->username)
+        return;
+
+    GList *entries = g_list_remove (g_hash_table_lookup (priv->user_sessions, entry->username), entry);
+    if (entries)
+        g_hash_table_insert (priv->user_sessions, g_strdup (entry->username), entries);
+    else
+        g_hash_table_remove (priv->user_sessions, entry->username);
+    g_clear_pointer (&entry->username, g_free);
+}
+
+static void
+index_username (Seat *seat, SessionIndexEntry *entry)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    unindex_username (seat, entry);
+
+    const gchar *username = session_get_username (entry->session);
+    if (!username)
+        return;
+
+    entry->username = g_strdup (username);
+    GList *entries = g_list_insert_sorted (g_hash_table_lookup (priv->user_sessions, username), entry, compare_index_entries);
+    g_hash_table_insert (priv->user_sessions, g_strdup (username), entries);
+}
+
+static void
+session_username_changed_cb (Session *session, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    SessionIndexEntry *entry = g_hash_table_lookup (priv->session_entries, session);
+    if (entry)
+        index_username (seat, entry);
+}
+
+static void
+index_session (Seat *seat, Session *session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    SessionIndexEntry *entry = g_new0 (SessionIndexEntry, 1);
+    entry->session = session;
+    entry->serial = priv->next_session_serial++;
+    g_hash_table_insert (priv->session_entries, session, entry);
+    index_username (seat, entry);
+    if (IS_GREETER_SESSION (session))
+        priv->greeter_sessions = g_list_append (priv->greeter_sessions, session);
+    g_signal_connect (session, SESSION_SIGNAL_USERNAME_CHANGED, G_CALLBACK (session_username_changed_cb), seat);
+}
+
+/* The logind ID is known once the session is run */
+static void
+index_login1_session (Seat *seat, Session *session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    const gchar *login1_session_id = session_get_login1_session_id (session);
+    if (login1_session_id)
+        g_hash_table_insert (priv->login1_sessions, g_strdup (login1_session_id), session);
+}
+
+static void
+unindex_session (Seat *seat, Session *session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    SessionIndexEntry *entry = g_hash_table_lookup (priv->session_entries, session);
+    if (!entry)
+        return;
+
+    unindex_username (seat, entry);
+    priv->greeter_sessions = g_list_remove (priv->greeter_sessions, session);
+    const gchar *login1_session_id = session_get_login1_session_id (session);
+    if (login1_session_id && g_hash_table_lookup (priv->login1_sessions, login1_session_id) == session)
+        g_hash_table_remove (priv->login1_sessions, login1_session_id);
+    g_hash_table_remove (priv->session_entries, session);
 }
 
 Session *
@@ -339,14 +660,10 @@ seat_find_session_by_login1_id (Seat *seat, const gchar *login1_session_id)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    for (GList *session_link = priv->sessions; session_link; session_link = session_link->next)
-    {
-        Session *session = session_link->data;
-        if (g_strcmp0 (login1_session_id, session_get_login1_session_id (session)) == 0)
-            return session;
-    }
+    if (!login1_session_id)
+        return NULL;
 
-    return NULL;
+    return g_hash_table_lookup (priv->login1_sessions, login1_session_id);
 }
 
 gboolean
@@ -364,12 +681,13 @@ seat_get_allow_guest (Seat *seat)
     return seat_get_boolean_property (seat, "allow-guest") && guest_account_is_installed ();
 }
 
-static gboolean
-run_script (Seat *seat, DisplayServer *display_server, const gchar *script_name, User *user)
+static Process *
+create_script (Seat *seat, DisplayServer *display_server, const gchar *script_name, User *user, ProcessPriority priority)
 {
-    g_autoptr(Process) script = process_new (NULL, NULL);
+    Process *script = process_new (NULL, NULL);
 
     process_set_command (script, script_name);
+    process_set_priority (script, priority);
 
     /* Set POSIX variables */
     process_set_clear_environment (script, TRUE);
@@ -399,18 +717,150 @@ run_script (Seat *seat, DisplayServer *display_server, const gchar *script_name,
 
     SEAT_GET_CLASS (seat)->run_script (seat, display_server, script);
 
-    gboolean result = FALSE;
-    if (process_start (script, TRUE))
+    return script;
+}
+
+static gboolean
+get_script_result (Seat *seat, Process *script)
+{
+    int exit_status = process_get_exit_status (script);
+    if (!WIFEXITED (exit_status))
+        return FALSE;
+
+    l_debug (seat, "Exit status of %s: %d", process_get_command (script), WEXITSTATUS (exit_status));
+    return WEXITSTATUS (exit_status) == EXIT_SUCCESS;
+}
+
+typedef void (*ScriptCompleteFunc)(Seat *seat, gpointer data, gboolean success);
+
+typedef struct
+{
+    Seat *seat;
+
+    /* Object passed to the complete function */
+    GObject *data;
+
+    ScriptCompleteFunc complete_func;
+
+    /* Script being run */
+    Process *script;
+
+    /* Timeout to stop the script if it takes too long */
+    guint timeout;
+} ScriptRun;
+
+/* Maximum number of scripts to run at once across all seats, so stopping
+ * many sessions at once doesn't start hundreds of scripts together */
+#define MAX_RUNNING_SCRIPTS 16
+
+/* Scripts waiting to be run and the number running */
+static GQueue pending_scripts = G_QUEUE_INIT;
+static guint n_running_scripts = 0;
+
+static void check_stopped (Seat *seat);
+
+static void
+script_run_free (ScriptRun *run)
+{
+    if (run->timeout != 0)
+        g_source_remove (run->timeout);
+    g_object_unref (run->seat);
+    g_clear_object (&run->data);
+    g_free (run);
+}
+
+static void
+script_complete (ScriptRun *run, gboolean success)
+{
+    SeatPrivate *priv = seat_get_instance_private (run->seat);
+
+    priv->n_scripts--;
+    if (run->complete_func)
+        run->complete_func (run->seat, run->data, success);
+
+    /* Seat may have been waiting for this script to stop */
+    if (priv->stopping)
+        check_stopped (run->seat);
+
+    script_run_free (run);
+}
+
+static void start_pending_scripts (void);
+
+static void
+script_stopped_cb (Process *script, ScriptRun *run)
+{
+    g_signal_handlers_disconnect_matched (script, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, run);
+
+    gboolean result = get_script_result (run->seat, script);
+    n_running_scripts--;
+    script_complete (run, result);
+    g_object_unref (script);
+
+    start_pending_scripts ();
+}
+
+static gboolean
+script_timeout_cb (gpointer data)
+{
+    ScriptRun *run = data;
+
+    run->timeout = 0;
+    l_debug (run->seat, "Stopping %s, it has taken too long", process_get_command (run->script));
+    process_stop (run->script);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+start_script_run (ScriptRun *run)
+{
+    Process *script = run->script;
+
+    g_signal_connect (script, PROCESS_SIGNAL_STOPPED, G_CALLBACK (script_stopped_cb), run);
+    if (!process_start (script, FALSE))
     {
-        int exit_status = process_get_exit_status (script);
-        if (WIFEXITED (exit_status))
-        {
-            l_debug (seat, "Exit status of %s: %d", script_name, WEXITSTATUS (exit_status));
-            result = WEXITSTATUS (exit_status) == EXIT_SUCCESS;
-        }
+        g_signal_handlers_disconnect_matched (script, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, run);
+        script_complete (run, FALSE);
+        g_object_unref (script);
+        return;
     }
+    n_running_scripts++;
+
+    /* Stop scripts that hang, they would otherwise hold up the seat forever */
+    gint timeout = seat_get_integer_property (run->seat, "script-timeout");
+    if (timeout > 0)
+        run->timeout = g_timeout_add_seconds (timeout, script_timeout_cb, run);
+}
 
-    return result;
+static void
+start_pending_scripts (void)
+{
+    while (n_running_scripts < MAX_RUNNING_SCRIPTS && !g_queue_is_empty (&pending_scripts))
+        start_script_run (g_queue_pop_head (&pending_scripts));
+}
+
+/* Run a script without blocking the main loop, so other seats keep running while it does.
+ * Scripts nothing is waiting on are run with background priority */
+static void
+run_script_async (Seat *seat, DisplayServer *display_server, const gchar *script_name, User *user, ProcessPriority priority, GObject *data, ScriptCompleteFunc complete_func)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    ScriptRun *run = g_malloc0 (sizeof (ScriptRun));
+    run->seat = g_object_ref (seat);
+    run->data = data ? g_object_ref (data) : NULL;
+    run->complete_func = complete_func;
+    run->script = create_script (seat, display_server, script_name, user, priority);
+    priv->n_scripts++;
+
+    if (n_running_scripts >= MAX_RUNNING_SCRIPTS)
+    {
+        l_debug (seat, "Waiting to run %s, %u scripts already running", script_name, n_running_scripts);
+        g_queue_push_tail (&pending_scripts, run);
+        return;
+    }
+    start_script_run (run);
 }
 
 static void
@@ -439,33 +889,103 @@ check_stopped (Seat *seat)
     if (priv->stopping &&
         !priv->stopped &&
         g_list_length (priv->display_servers) == 0 &&
-        g_list_length (priv->sessions) == 0)
+        g_list_length (priv->sessions) == 0 &&
+        priv->n_scripts == 0)
     {
         priv->stopped = TRUE;
         l_debug (seat, "Stopped");
+        flight_recorder_record (FLIGHT_RECORDER_EVENT_SEAT_STOPPED, 0, 0, seat_get_name (seat), NULL);
         g_signal_emit (seat, signals[STOPPED], 0);
     }
 }
 
+/* Replace the configuration that keeps crashing with the fallback one, if there is one */
+static gboolean
+use_fallback_configuration (Seat *seat)
+{
+    const gchar *greeter_session = seat_get_string_property (seat, "fallback-greeter-session");
+    const gchar *xserver_command = seat_get_string_property (seat, "fallback-xserver-command");
+    if (!greeter_session && !xserver_command)
+        return FALSE;
+
+    if (greeter_session)
+        seat_set_property (seat, "greeter-session", greeter_session);
+    if (xserver_command)
+        seat_set_property (seat, "xserver-command", xserver_command);
+    seat_set_property (seat, "autologin-user", NULL);
+    seat_set_property (seat, "autologin-guest", "false");
+
+    return TRUE;
+}
+
+/* Count a display server or greeter stopping without being asked to */
 static void
-display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
+record_crash (Seat *seat, const gchar *what)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    l_debug (seat, "Display server stopped");
+    gint64 now = g_get_monotonic_time ();
+    if (now - priv->last_crash_time > CRASH_LOOP_INTERVAL)
+        priv->n_recent_crashes = 0;
+    priv->n_recent_crashes++;
+    priv->n_crashes++;
+    priv->last_crash_time = now;
+    l_debug (seat, "%s crashed, %u crashes in a row", what, priv->n_recent_crashes);
 
-    /* Run a script right after stopping the display server */
-    const gchar *script = seat_get_string_property (seat, "display-stopped-script");
-    if (script)
-        run_script (seat, NULL, script, NULL);
+    gint limit = seat_get_integer_property (seat, "crash-loop-limit");
+    if (limit <= 0 || priv->n_recent_crashes < (guint) limit || priv->stopping)
+        return;
 
-    g_signal_handlers_disconnect_matched (display_server, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
-    priv->display_servers = g_list_remove (priv->display_servers, display_server);
+    priv->n_recent_crashes = 0;
+    priv->n_crash_loops++;
+    if (priv->n_crash_loops == 1 && use_fallback_configuration (seat))
+        l_warning (seat, "Crashed %d times in a row, using fallback configuration", limit);
+    else
+    {
+        l_warning (seat, "Crashed %d times in a row, stopping seat", limit);
+        seat_stop (seat);
+    }
+}
+
+/* Time to wait before starting a greeter again, doubling with each crash in a row */
+static guint
+get_crash_backoff (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (priv->n_recent_crashes < 2)
+        return 0;
+
+    return MIN (1u << MIN (priv->n_recent_crashes - 2, 6), MAX_CRASH_BACKOFF);
+}
+
+static gboolean
+crash_restart_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->crash_restart_timeout = 0;
+    if (priv->stopping)
+        return G_SOURCE_REMOVE;
+
+    if (!seat_switch_to_greeter (seat))
+    {
+        l_debug (seat, "Stopping; failed to start a greeter");
+        seat_stop (seat);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+display_server_cleanup (Seat *seat, DisplayServer *display_server)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
 
     if (priv->stopping || !priv->started)
     {
         check_stopped (seat);
-        g_object_unref (display_server);
         return;
     }
 
@@ -480,7 +1000,10 @@ display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
         if (session_get_display_server (session) != display_server || session_get_is_stopping (session))
             continue;
 
-        gboolean is_failed_greeter = IS_GREETER_SESSION (session) && !session_get_is_started (session);
+        /* A greeter started early is still waiting for the display server */
+        gboolean is_failed_greeter = IS_GREETER_SESSION (session) &&
+                                     (!session_get_is_started (session) ||
+                                      greeter_get_hold_connect (greeter_session_get_greeter (GREETER_SESSION (session))));
 
         l_debug (seat, "Stopping session");
         session_stop (session);
@@ -499,7 +1022,15 @@ display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
     {
         /* If we were the active session, switch to a greeter */
         Session *active_session = seat_get_active_session (seat);
-        if (!active_session || session_get_display_server (active_session) == display_server)
+        guint backoff = display_server_get_is_stopping (display_server) ? 0 : get_crash_backoff (seat);
+        if ((!active_session || session_get_display_server (active_session) == display_server) && backoff > 0)
+        {
+            /* Don't restart as fast as we can fork if it keeps crashing */
+            l_debug (seat, "Active display server crashed, starting greeter in %us", backoff);
+            if (priv->crash_restart_timeout == 0)
+                priv->crash_restart_timeout = g_timeout_add_seconds (backoff, crash_restart_cb, seat);
+        }
+        else if (!active_session || session_get_display_server (active_session) == display_server)
         {
             l_debug (seat, "Active display server stopped, starting greeter");
             if (!seat_switch_to_greeter (seat))
@@ -509,6 +1040,33 @@ display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
             }
         }
     }
+}
+
+static void
+display_stopped_script_complete_cb (Seat *seat, gpointer data, gboolean success)
+{
+    display_server_cleanup (seat, data);
+}
+
+static void
+display_server_stopped_cb (DisplayServer *display_server, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    l_debug (seat, "Display server stopped");
+
+    g_signal_handlers_disconnect_matched (display_server, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
+    priv->display_servers = g_list_remove (priv->display_servers, display_server);
+
+    if (!display_server_get_is_stopping (display_server))
+        record_crash (seat, "Display server");
+
+    /* Run a script right after stopping the display server, the seat carries on when it completes */
+    const gchar *script = seat_get_string_property (seat, "display-stopped-script");
+    if (script)
+        run_script_async (seat, NULL, script, NULL, PROCESS_PRIORITY_BACKGROUND, G_OBJECT (display_server), display_stopped_script_complete_cb);
+    else
+        display_server_cleanup (seat, display_server);
 
     g_object_unref (display_server);
 }
@@ -525,10 +1083,10 @@ find_greeter_session (Seat *seat)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    for (GList *link = priv->sessions; link; link = link->next)
+    for (GList *link = priv->greeter_sessions; link; link = link->next)
     {
         Session *session = link->data;
-        if (!session_get_is_stopping (session) && IS_GREETER_SESSION (session))
+        if (!session_get_is_stopping (session))
             return GREETER_SESSION (session);
     }
 
@@ -540,10 +1098,10 @@ find_resettable_greeter (Seat *seat)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    for (GList *link = priv->sessions; link; link = link->next)
+    for (GList *link = priv->greeter_sessions; link; link = link->next)
     {
         Session *session = link->data;
-        if (!session_get_is_stopping (session) && IS_GREETER_SESSION (session) &&
+        if (!session_get_is_stopping (session) &&
             greeter_get_resettable (greeter_session_get_greeter (GREETER_SESSION (session))))
             return GREETER_SESSION (session);
     }
@@ -627,9 +1185,11 @@ start_session (Seat *seat, Session *session)
         g_autofree gchar *filename = g_strdup_printf ("%s-greeter.log", seat_get_name (seat));
         g_autofree gchar *log_filename = g_build_filename (log_dir, filename, NULL);
         gboolean backup_logs = config_get_boolean (config_get_instance (), "LightDM", "backup-logs");
-        session_set_log_file (session, log_filename, backup_logs ? LOG_MODE_BACKUP_AND_TRUNCATE : LOG_MODE_APPEND);
+        session_set_log_file (session, log_filename, log_file_get_mode (backup_logs));
     }
 
+    if (IS_GREETER_SESSION (session))
+        trace_begin (session, "greeter-start");
     if (session_start (session))
         return;
 
@@ -645,29 +1205,20 @@ start_session (Seat *seat, Session *session)
 }
 
 static void
-run_session (Seat *seat, Session *session)
+run_session_after_setup (Seat *seat, Session *session)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    const gchar *script;
-    if (IS_GREETER_SESSION (session))
-        script = seat_get_string_property (seat, "greeter-setup-script");
-    else
-        script = seat_get_string_property (seat, "session-setup-script");
-    if (script && !run_script (seat, session_get_display_server (session), script, session_get_user (session)))
-    {
-        l_debug (seat, "Switching to greeter due to failed setup script");
-        switch_to_greeter_from_failed_session (seat, session);
-        return;
-    }
-
     if (!IS_GREETER_SESSION (session))
     {
         g_signal_emit (seat, signals[RUNNING_USER_SESSION], 0, session);
         emit_upstart_signal ("desktop-session-start");
     }
 
+    record_session_event (seat, FLIGHT_RECORDER_EVENT_SESSION_RUN, session);
+
     session_run (session);
+    index_login1_session (seat, session);
 
     // FIXME: Wait until the session is ready
 
@@ -689,6 +1240,40 @@ run_session (Seat *seat, Session *session)
     }
 }
 
+static void
+setup_script_complete_cb (Seat *seat, gpointer data, gboolean success)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    Session *session = data;
+
+    /* Session or seat went away while the script was running */
+    if (priv->stopping || !g_list_find (priv->sessions, session) || session_get_is_stopping (session))
+        return;
+
+    if (!success)
+    {
+        l_debug (seat, "Switching to greeter due to failed setup script");
+        switch_to_greeter_from_failed_session (seat, session);
+        return;
+    }
+
+    run_session_after_setup (seat, session);
+}
+
+static void
+run_session (Seat *seat, Session *session)
+{
+    const gchar *script;
+    if (IS_GREETER_SESSION (session))
+        script = seat_get_string_property (seat, "greeter-setup-script");
+    else
+        script = seat_get_string_property (seat, "session-setup-script");
+    if (script)
+        run_script_async (seat, session_get_display_server (session), script, session_get_user (session), PROCESS_PRIORITY_DEFAULT, G_OBJECT (session), setup_script_complete_cb);
+    else
+        run_session_after_setup (seat, session);
+}
+
 static Session *
 find_user_session (Seat *seat, const gchar *username, Session *ignore_session)
 {
@@ -697,15 +1282,15 @@ find_user_session (Seat *seat, const gchar *username, Session *ignore_session)
     if (!username)
         return NULL;
 
-    for (GList *link = priv->sessions; link; link = link->next)
+    for (GList *link = g_hash_table_lookup (priv->user_sessions, username); link; link = link->next)
     {
-        Session *session = link->data;
+        SessionIndexEntry *entry = link->data;
 
-        if (session == ignore_session)
+        if (entry->session == ignore_session)
             continue;
 
-        if (!session_get_is_stopping (session) && g_strcmp0 (session_get_username (session), username) == 0)
-            return session;
+        if (!session_get_is_stopping (entry->session))
+            return entry->session;
     }
 
     return NULL;
@@ -715,12 +1300,17 @@ static void
 greeter_active_username_changed_cb (Greeter *greeter, GParamSpec *pspec, Seat *seat)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
-    Session *session = find_user_session (seat, greeter_get_active_username (greeter), priv->active_session);
+    const gchar *username = greeter_get_active_username (greeter);
+    Session *session = find_user_session (seat, username, priv->active_session);
 
     g_clear_object (&priv->next_session);
     priv->next_session = session ? g_object_ref (session) : NULL;
 
     SEAT_GET_CLASS (seat)->set_next_session (seat, session);
+
+    /* Get ready for this user to log in */
+    if (!session)
+        user_prefetch (username);
 }
 
 static void
@@ -735,6 +1325,17 @@ session_authentication_complete_cb (Session *session, Seat *seat)
             seat_set_active_session (seat, s);
             session_stop (session);
         }
+        else if (IS_GREETER_SESSION (session) && greeter_get_hold_connect (greeter_session_get_greeter (GREETER_SESSION (session))))
+        {
+            /* Loads while the display server starts, it waits to be told it is connected before using the display */
+            l_debug (seat, "Greeter authenticated, running it while display server starts");
+            run_session (seat, session);
+        }
+        else if (session_get_display_server (session) && !display_server_get_is_ready (session_get_display_server (session)))
+        {
+            /* Authenticated in parallel with the display server starting, run when it is ready */
+            l_debug (seat, "Session authenticated, waiting for display server");
+        }
         else
         {
             l_debug (seat, "Session authenticated, running command");
@@ -753,15 +1354,31 @@ session_authentication_complete_cb (Session *session, Seat *seat)
     }
 }
 
+static void session_cleanup (Seat *seat, Session *session);
+static void start_background_sessions (Seat *seat);
+
+static void
+cleanup_script_complete_cb (Seat *seat, gpointer data, gboolean success)
+{
+    session_cleanup (seat, data);
+}
+
 static void
 session_stopped_cb (Session *session, Seat *seat)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
     l_debug (seat, "Session stopped");
+    record_session_event (seat, FLIGHT_RECORDER_EVENT_SESSION_STOPPED, session);
+
+    /* A greeter that exits by itself without starting a session has crashed */
+    if (IS_GREETER_SESSION (session) && session_get_is_started (session) && !session_get_is_stopping (session) &&
+        !greeter_get_start_session (greeter_session_get_greeter (GREETER_SESSION (session))))
+        record_crash (seat, "Greeter");
 
     g_signal_handlers_disconnect_matched (session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, seat);
     priv->sessions = g_list_remove (priv->sessions, session);
+    unindex_session (seat, session);
     if (session == priv->active_session)
         g_clear_object (&priv->active_session);
     if (session == priv->next_session)
@@ -770,17 +1387,126 @@ session_stopped_cb (Session *session, Seat *seat)
     // FIXME: Start a greeter on this?
     if (session == priv->session_to_activate)
         g_clear_object (&priv->session_to_activate);
+    if (session == priv->handover_session)
+        g_clear_object (&priv->handover_session);
+    if (priv->standby_greeter && session == SESSION (priv->standby_greeter))
+        g_clear_object (&priv->standby_greeter);
+    if (g_list_find (priv->starting_background_sessions, session))
+    {
+        priv->starting_background_sessions = g_list_remove (priv->starting_background_sessions, session);
+        start_background_sessions (seat);
+    }
 
-    DisplayServer *display_server = session_get_display_server (session);
+    /* Cleanup, the seat carries on when it completes. Cleanup for other sessions runs at the same time */
+    const gchar *script = IS_GREETER_SESSION (session) ? NULL : seat_get_string_property (seat, "session-cleanup-script");
+    if (script)
+        run_script_async (seat, session_get_display_server (session), script, session_get_user (session), PROCESS_PRIORITY_BACKGROUND, G_OBJECT (session), cleanup_script_complete_cb);
+    else
+        session_cleanup (seat, session);
+}
 
-    /* Cleanup */
-    if (!IS_GREETER_SESSION (session))
+/* Start a new greeter on the display server of one that crashed, giving it
+ * any authentication that was in progress so the user carries on from there */
+static gboolean
+restart_crashed_greeter (Seat *seat, GreeterSession *crashed_greeter)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (!seat_get_boolean_property (seat, "greeter-restart-on-crash") ||
+        !session_get_is_started (SESSION (crashed_greeter)) ||
+        session_get_is_stopping (SESSION (crashed_greeter)) ||
+        greeter_get_start_session (greeter_session_get_greeter (crashed_greeter)))
+        return FALSE;
+
+    DisplayServer *display_server = session_get_display_server (SESSION (crashed_greeter));
+    if (!display_server || display_server_get_is_stopping (display_server))
+        return FALSE;
+
+    gint64 now = g_get_monotonic_time ();
+    if (priv->greeter_restart_time != 0 && now - priv->greeter_restart_time < GREETER_RESTART_INTERVAL)
+    {
+        l_debug (seat, "Greeter crashed again straight after restarting, not restarting it");
+        return FALSE;
+    }
+
+    GreeterSession *greeter_session = create_greeter_session (seat);
+    if (!greeter_session)
+        return FALSE;
+    Greeter *greeter = greeter_session_get_greeter (greeter_session);
+    priv->greeter_restart_time = now;
+
+    /* The authentication is only worth keeping if it is still waiting on the user */
+    g_autoptr(Session) authentication_session = greeter_take_authentication_session (greeter_session_get_greeter (crashed_greeter));
+    if (authentication_session && session_get_pid (authentication_session) > 0 && !session_get_is_stopping (authentication_session))
+    {
+        l_debug (seat, "Keeping authentication of %s for the restarted greeter", session_get_username (authentication_session));
+        greeter_set_hint (greeter, "select-user", session_get_username (authentication_session));
+        greeter_restore_authentication_session (greeter, authentication_session);
+    }
+    else if (authentication_session)
+        session_stop (authentication_session);
+
+    /* Show it unless another session has been switched to */
+    Session *active_session = seat_get_active_session (seat);
+    if (!active_session || active_session == SESSION (crashed_greeter) || session_get_display_server (active_session) == display_server)
+    {
+        g_clear_object (&priv->session_to_activate);
+        priv->session_to_activate = g_object_ref (SESSION (greeter_session));
+    }
+
+    session_set_display_server (SESSION (greeter_session), display_server);
+    start_session (seat, SESSION (greeter_session));
+
+    return TRUE;
+}
+
+/* Start a greeter on the display server of a session that has logged out,
+ * resetting it instead of starting a new one */
+static gboolean
+reuse_display_server_for_greeter (Seat *seat, DisplayServer *display_server)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    if (!seat_get_boolean_property (seat, "xserver-reuse-after-logout") ||
+        !display_server ||
+        display_server_get_is_stopping (display_server) ||
+        !can_share_display_server (seat, display_server) ||
+        find_greeter_session (seat))
+        return FALSE;
+
+    /* Can't reset it under other sessions */
+    for (GList *link = priv->sessions; link; link = link->next)
+    {
+        Session *s = link->data;
+        if (session_get_display_server (s) == display_server && !session_get_is_stopping (s))
+            return FALSE;
+    }
+
+    GreeterSession *greeter_session = create_greeter_session (seat);
+    if (!greeter_session)
+        return FALSE;
+    session_set_display_server (SESSION (greeter_session), display_server);
+
+    /* The greeter is started when the display server is ready again */
+    if (!display_server_reset (display_server))
     {
-        const gchar *script = seat_get_string_property (seat, "session-cleanup-script");
-        if (script)
-            run_script (seat, display_server, script, session_get_user (session));
+        session_stop (SESSION (greeter_session));
+        return FALSE;
     }
 
+    g_clear_object (&priv->session_to_activate);
+    priv->session_to_activate = g_object_ref (SESSION (greeter_session));
+
+    return TRUE;
+}
+
+static void
+session_cleanup (Seat *seat, Session *session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    DisplayServer *display_server = session_get_display_server (session);
+
     if (priv->stopping)
     {
         check_stopped (seat);
@@ -807,6 +1533,18 @@ session_stopped_cb (Session *session, Seat *seat)
 
         g_object_unref (replacement_greeter);
     }
+    /* If a switched to user was waiting for this display server, run their session on it */
+    else if (IS_GREETER_SESSION (session) && priv->handover_session &&
+             session_get_display_server (priv->handover_session) == display_server)
+    {
+        Session *handover_session = priv->handover_session;
+        priv->handover_session = NULL;
+
+        l_debug (seat, "Greeter stopped, running switched user session");
+        run_session (seat, handover_session);
+
+        g_object_unref (handover_session);
+    }
     /* If this is the greeter session then re-use this display server */
     else if (IS_GREETER_SESSION (session) &&
         can_share_display_server (seat, display_server) &&
@@ -833,6 +1571,9 @@ session_stopped_cb (Session *session, Seat *seat)
             break;
         }
     }
+    /* If the greeter crashed then start another one in its place */
+    else if (IS_GREETER_SESSION (session) && restart_crashed_greeter (seat, GREETER_SESSION (session)))
+        l_debug (seat, "Greeter crashed, restarted it on the same display server");
     /* If this is the greeter and nothing else is running then stop the seat */
     else if (IS_GREETER_SESSION (session) &&
         !greeter_get_start_session (greeter_session_get_greeter (GREETER_SESSION (session))) &&
@@ -846,7 +1587,9 @@ session_stopped_cb (Session *session, Seat *seat)
     else if (!IS_GREETER_SESSION (session) && session == seat_get_active_session (seat))
     {
         l_debug (seat, "Active session stopped, starting greeter");
-        if (!seat_switch_to_greeter (seat))
+        if (reuse_display_server_for_greeter (seat, display_server))
+            l_debug (seat, "Resetting display server for greeter");
+        else if (!seat_switch_to_greeter (seat))
         {
             l_debug (seat, "Stopping; failed to start a greeter");
             seat_stop (seat);
@@ -891,6 +1634,14 @@ set_session_env (Session *session)
         session_set_env (session, "LD_LIBRARY_PATH", g_getenv ("LD_LIBRARY_PATH"));
 }
 
+static void
+user_session_authentication_complete_cb (Session *session, Seat *seat)
+{
+    /* Opening the session waits for the user manager, so get it going while the session is set up */
+    if (session_get_is_authenticated (session) && session_get_user (session) && seat_get_boolean_property (seat, "start-user-manager"))
+        login1_service_start_user_manager (login1_service_get_instance (), user_get_uid (session_get_user (session)));
+}
+
 static Session *
 create_session (Seat *seat, gboolean autostart)
 {
@@ -898,12 +1649,15 @@ create_session (Seat *seat, gboolean autostart)
 
     Session *session = SEAT_GET_CLASS (seat)->create_session (seat);
     priv->sessions = g_list_append (priv->sessions, session);
+    index_session (seat, session);
+    g_signal_connect (session, SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (user_session_authentication_complete_cb), seat);
     if (autostart)
         g_signal_connect (session, SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (session_authentication_complete_cb), seat);
     g_signal_connect (session, SESSION_SIGNAL_STOPPED, G_CALLBACK (session_stopped_cb), seat);
 
     set_session_env (session);
 
+    record_session_event (seat, FLIGHT_RECORDER_EVENT_SESSION_ADDED, session);
     g_signal_emit (seat, signals[SESSION_ADDED], 0, session);
 
     return session;
@@ -916,7 +1670,7 @@ get_session_argv (Seat *seat, SessionConfig *session_config, const gchar *sessio
     if (session_wrapper)
     {
         gchar **argv = g_malloc (sizeof (gchar *) * 3);
-        g_autofree gchar *path = g_find_program_in_path (session_wrapper);
+        g_autofree gchar *path = program_cache_find (session_wrapper, NULL);
         argv[0] = path ? g_steal_pointer (&path) : g_strdup (session_wrapper);
         argv[1] = g_strdup (session_config_get_command (session_config));
         argv[2] = NULL;
@@ -932,7 +1686,7 @@ get_session_argv (Seat *seat, SessionConfig *session_config, const gchar *sessio
         l_debug (seat, "Invalid session command '%s': %s", session_config_get_command (session_config), error->message);
     if (!result)
         return NULL;
-    g_autofree gchar *path = g_find_program_in_path (argv[0]);
+    g_autofree gchar *path = program_cache_find (argv[0], NULL);
     if (path)
     {
         g_free (argv[0]);
@@ -948,19 +1702,26 @@ find_session_config (Seat *seat, const gchar *sessions_dir, const gchar *session
     g_return_val_if_fail (sessions_dir != NULL, NULL);
     g_return_val_if_fail (session_name != NULL, NULL);
 
-    g_auto(GStrv) dirs = g_strsplit (sessions_dir, ":", -1);
-    for (int i = 0; dirs[i]; i++)
+    /* Session files are loaded once and kept up to date, so nothing needs to be read here */
+    CommonSessionCatalog *catalog = common_session_catalog_get_instance (sessions_dir);
+    for (GList *link = common_session_catalog_get_entries (catalog); link; link = link->next)
     {
-        const gchar *default_session_type = "x";
-        if (dirs[i] != NULL && g_str_has_suffix (dirs[i], "/wayland-sessions") == TRUE)
-            default_session_type = "wayland";
+        CommonSessionEntry *entry = link->data;
+        if (strcmp (entry->key, session_name) != 0)
+            continue;
+
+        /* Keep the parsed configuration with the entry, it is dropped when the file changes */
+        if (!entry->data)
+        {
+            g_autoptr(GError) error = NULL;
+            SessionConfig *session_config = session_config_new_from_key_file (entry->key_file, entry->path, entry->default_type, &error);
+            if (!session_config)
+                continue;
+            entry->data = session_config;
+            entry->data_free = g_object_unref;
+        }
 
-        g_autofree gchar *filename = g_strdup_printf ("%s.desktop", session_name);
-        g_autofree gchar *path = g_build_filename (dirs[i], filename, NULL);
-        g_autoptr(GError) error = NULL;
-        SessionConfig *session_config = session_config_new_from_file (path, default_session_type, &error);
-        if (session_config)
-            return session_config;
+        return g_object_ref (entry->data);
     }
 
     l_debug (seat, "Failed to find session configuration %s", session_name);
@@ -1069,7 +1830,7 @@ create_guest_session (Seat *seat, const gchar *session_name)
     const gchar *guest_wrapper = seat_get_string_property (seat, "guest-wrapper");
     if (guest_wrapper)
     {
-        g_autofree gchar *path = g_find_program_in_path (guest_wrapper);
+        g_autofree gchar *path = program_cache_find (guest_wrapper, NULL);
         prepend_argv (&argv, path ? path : guest_wrapper);
     }
 
@@ -1159,7 +1920,11 @@ greeter_start_session_cb (Greeter *greeter, SessionType type, const gchar *sessi
         if (!session_name)
             session_name = seat_get_string_property (seat, "user-session");
         if (user)
+        {
+            /* Save along with any language the greeter set, without waiting on the home directory */
             user_set_xsession (session_get_user (session), session_name);
+            user_save_changes (session_get_user (session));
+        }
 
         g_autoptr(SessionConfig) session_config = find_session_config (seat, sessions_dir, session_name);
         if (!session_config)
@@ -1207,6 +1972,10 @@ greeter_start_session_cb (Greeter *greeter, SessionType type, const gchar *sessi
             /* Stop the greeter */
             session_stop (greeter_session);
 
+            /* Set up the user session while the greeter exits, only running the command waits for it */
+            if (session_get_is_authenticated (session) && !seat_get_string_property (seat, "session-setup-script"))
+                session_prepare (session);
+
             return TRUE;
         }
     }
@@ -1223,6 +1992,50 @@ greeter_start_session_cb (Greeter *greeter, SessionType type, const gchar *sessi
     return TRUE;
 }
 
+static void
+greeter_connected_cb (Greeter *greeter, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    Session *greeter_session = NULL;
+    for (GList *link = priv->sessions; link; link = link->next)
+    {
+        Session *session = link->data;
+        if (IS_GREETER_SESSION (session) && greeter_session_get_greeter (GREETER_SESSION (session)) == greeter)
+        {
+            trace_end (session, "greeter-start");
+            greeter_session = session;
+        }
+    }
+
+    if (priv->logged_greeter_ready)
+        return;
+    priv->logged_greeter_ready = TRUE;
+
+    /* Remember what it took to show this greeter so it can be read ahead next time */
+    if (greeter_session && session_get_display_server (greeter_session))
+    {
+        GPid pids[2] = { session_get_pid (greeter_session), display_server_get_pid (session_get_display_server (greeter_session)) };
+        g_autofree gchar *greeter_wrapper = NULL;
+        g_autofree gchar *session_wrapper = NULL;
+        if (seat_get_string_property (seat, "greeter-wrapper"))
+            greeter_wrapper = program_cache_find (seat_get_string_property (seat, "greeter-wrapper"), NULL);
+        if (seat_get_string_property (seat, "session-wrapper"))
+            session_wrapper = program_cache_find (seat_get_string_property (seat, "session-wrapper"), NULL);
+        const gchar *paths[3] = { NULL, NULL, NULL };
+        int n_paths = 0;
+        if (greeter_wrapper)
+            paths[n_paths++] = greeter_wrapper;
+        if (session_wrapper)
+            paths[n_paths++] = session_wrapper;
+        boot_readahead_record (pids, G_N_ELEMENTS (pids), paths);
+    }
+
+    gint64 now = g_get_monotonic_time ();
+    l_debug (seat, "Greeter ready %.3fs after startup (%.3fs after seat started)",
+             (now - first_start_time) / 1000000.0, (now - priv->start_time) / 1000000.0);
+}
+
 static GreeterSession *
 create_greeter_session (Seat *seat)
 {
@@ -1239,7 +2052,7 @@ create_greeter_session (Seat *seat)
     const gchar *greeter_wrapper = seat_get_string_property (seat, "greeter-wrapper");
     if (greeter_wrapper)
     {
-        g_autofree gchar *path = g_find_program_in_path (greeter_wrapper);
+        g_autofree gchar *path = program_cache_find (greeter_wrapper, NULL);
         prepend_argv (&argv, path ? path : greeter_wrapper);
     }
 
@@ -1247,6 +2060,7 @@ create_greeter_session (Seat *seat)
     Greeter *greeter = greeter_session_get_greeter (greeter_session);
     session_set_config (SESSION (greeter_session), session_config);
     priv->sessions = g_list_append (priv->sessions, SESSION (greeter_session));
+    index_session (seat, SESSION (greeter_session));
     g_signal_connect (greeter, GREETER_SIGNAL_ACTIVE_USERNAME_CHANGED, G_CALLBACK (greeter_active_username_changed_cb), seat);
     g_signal_connect (greeter_session, SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (session_authentication_complete_cb), seat);
     g_signal_connect (greeter_session, SESSION_SIGNAL_STOPPED, G_CALLBACK (session_stopped_cb), seat);
@@ -1266,12 +2080,14 @@ create_greeter_session (Seat *seat)
         session_set_username (SESSION (greeter_session), user_get_name (accounts_get_current_user ()));
     }
     session_set_argv (SESSION (greeter_session), argv);
+    session_set_stop_timeout (SESSION (greeter_session), MAX (seat_get_integer_property (seat, "greeter-stop-timeout"), 0));
 
     greeter_set_pam_services (greeter,
                               seat_get_string_property (seat, "pam-service"),
                               seat_get_string_property (seat, "pam-autologin-service"));
     g_signal_connect (greeter, GREETER_SIGNAL_CREATE_SESSION, G_CALLBACK (greeter_create_session_cb), seat);
     g_signal_connect (greeter, GREETER_SIGNAL_START_SESSION, G_CALLBACK (greeter_start_session_cb), seat);
+    g_signal_connect (greeter, GREETER_SIGNAL_CONNECTED, G_CALLBACK (greeter_connected_cb), seat);
 
     /* Set hints to greeter */
     greeter_set_allow_guest (greeter, seat_get_allow_guest (seat));
@@ -1319,20 +2135,61 @@ find_session_for_display_server (Seat *seat, DisplayServer *display_server)
     return NULL;
 }
 
+/* Start a greeter while its display server is still starting, so loading the greeter isn't delayed
+ * by the display server. It is only told it is connected once the display server is ready. */
 static void
-display_server_ready_cb (DisplayServer *display_server, Seat *seat)
+start_greeter_early (Seat *seat, Session *session)
 {
-    /* Run setup script */
-    const gchar *script = seat_get_string_property (seat, "display-setup-script");
-    if (script && !run_script (seat, display_server, script, NULL))
-    {
-        l_debug (seat, "Stopping display server due to failed setup script");
-        display_server_stop (display_server);
+    DisplayServer *display_server = session_get_display_server (session);
+
+    if (!seat_get_boolean_property (seat, "greeter-parallel-start") ||
+        seat_get_string_property (seat, "greeter-setup-script") ||
+        session_get_is_started (session) ||
+        display_server_get_is_ready (display_server) ||
+        !display_server_get_can_connect_early (display_server))
         return;
+
+    l_debug (seat, "Starting greeter while display server starts");
+    greeter_set_hold_connect (greeter_session_get_greeter (GREETER_SESSION (session)), TRUE);
+    start_session (seat, session);
+}
+
+/* Let greeters started early connect, returns TRUE if one of them is already running */
+static gboolean
+release_early_greeters (Seat *seat, DisplayServer *display_server)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    gboolean have_running_greeter = FALSE;
+    for (GList *link = priv->sessions; link; link = link->next)
+    {
+        Session *session = link->data;
+
+        if (!IS_GREETER_SESSION (session) ||
+            session_get_display_server (session) != display_server ||
+            session_get_is_stopping (session))
+            continue;
+
+        Greeter *greeter = greeter_session_get_greeter (GREETER_SESSION (session));
+        if (!greeter_get_hold_connect (greeter))
+            continue;
+
+        l_debug (seat, "Display server ready, letting greeter connect");
+        greeter_set_hold_connect (greeter, FALSE);
+        if (session_get_is_run (session))
+            have_running_greeter = TRUE;
     }
 
+    return have_running_greeter;
+}
+
+static void
+display_server_setup_complete (Seat *seat, DisplayServer *display_server)
+{
     emit_upstart_signal ("login-session-start");
 
+    gboolean have_running_greeter = release_early_greeters (seat, display_server);
+
     /* Start the session waiting for this display server */
     Session *session = find_session_for_display_server (seat, display_server);
     if (session)
@@ -1342,19 +2199,55 @@ display_server_ready_cb (DisplayServer *display_server, Seat *seat)
             l_debug (seat, "Display server ready, running session");
             run_session (seat, session);
         }
+        else if (session_get_is_started (session))
+            l_debug (seat, "Display server ready, waiting for session authentication");
         else
         {
             l_debug (seat, "Display server ready, starting session authentication");
             start_session (seat, session);
         }
     }
-    else
+    else if (!have_running_greeter)
     {
         l_debug (seat, "Stopping not required display server");
         display_server_stop (display_server);
     }
 }
 
+static void
+display_setup_script_complete_cb (Seat *seat, gpointer data, gboolean success)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+    DisplayServer *display_server = data;
+
+    /* Display server or seat went away while the script was running */
+    if (priv->stopping || !g_list_find (priv->display_servers, display_server) || display_server_get_is_stopping (display_server))
+        return;
+
+    if (!success)
+    {
+        l_debug (seat, "Stopping display server due to failed setup script");
+        display_server_stop (display_server);
+        return;
+    }
+
+    display_server_setup_complete (seat, display_server);
+}
+
+static void
+display_server_ready_cb (DisplayServer *display_server, Seat *seat)
+{
+    /* Run setup script */
+    const gchar *script = seat_get_string_property (seat, "display-setup-script");
+    if (script)
+    {
+        run_script_async (seat, display_server, script, NULL, PROCESS_PRIORITY_DEFAULT, G_OBJECT (display_server), display_setup_script_complete_cb);
+        return;
+    }
+
+    display_server_setup_complete (seat, display_server);
+}
+
 static DisplayServer *
 create_display_server (Seat *seat, Session *session)
 {
@@ -1395,6 +2288,45 @@ start_display_server (Seat *seat, DisplayServer *display_server)
     }
 }
 
+static gboolean
+start_standby_greeter_cb (gpointer data)
+{
+    Seat *seat = data;
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    priv->standby_greeter_idle = 0;
+
+    /* Not needed if there is already a greeter we can switch to */
+    if (priv->stopping || !seat_get_can_switch (seat) || find_greeter_session (seat))
+        return G_SOURCE_REMOVE;
+
+    l_debug (seat, "Starting standby greeter");
+
+    GreeterSession *greeter_session = create_greeter_session (seat);
+    if (!greeter_session)
+    {
+        l_debug (seat, "Failed to create standby greeter session");
+        return G_SOURCE_REMOVE;
+    }
+
+    DisplayServer *display_server = create_display_server (seat, SESSION (greeter_session));
+    if (!display_server)
+    {
+        l_debug (seat, "Failed to create a display server for the standby greeter");
+        session_stop (SESSION (greeter_session));
+        return G_SOURCE_REMOVE;
+    }
+    session_set_display_server (SESSION (greeter_session), display_server);
+
+    /* Started without being activated so it stays in the background */
+    g_clear_object (&priv->standby_greeter);
+    priv->standby_greeter = g_object_ref (greeter_session);
+    if (!start_display_server (seat, display_server))
+        l_warning (seat, "Failed to start display server for standby greeter");
+
+    return G_SOURCE_REMOVE;
+}
+
 gboolean
 seat_switch_to_greeter (Seat *seat)
 {
@@ -1438,6 +2370,34 @@ seat_switch_to_greeter (Seat *seat)
     return start_display_server (seat, display_server);
 }
 
+/* Find a greeter not in use whose display server can be given to session */
+static GreeterSession *
+find_handover_greeter (Seat *seat, Session *session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    for (GList *link = priv->sessions; link; link = link->next)
+    {
+        Session *s = link->data;
+
+        if (!IS_GREETER_SESSION (s) || session_get_is_stopping (s) || s == priv->active_session)
+            continue;
+
+        /* Resettable greeters are kept around to be reused */
+        Greeter *greeter = greeter_session_get_greeter (GREETER_SESSION (s));
+        if (greeter_get_resettable (greeter))
+            continue;
+
+        DisplayServer *display_server = session_get_display_server (s);
+        if (display_server &&
+            can_share_display_server (seat, display_server) &&
+            strcmp (display_server_get_session_type (display_server), session_get_session_type (session)) == 0)
+            return GREETER_SESSION (s);
+    }
+
+    return NULL;
+}
+
 static void
 switch_authentication_complete_cb (Session *session, Seat *seat)
 {
@@ -1456,9 +2416,22 @@ switch_authentication_complete_cb (Session *session, Seat *seat)
         }
         else
         {
-            l_debug (seat, "Session authenticated, starting display server");
             g_clear_object (&priv->session_to_activate);
             priv->session_to_activate = g_object_ref (session);
+
+            /* Take over the display server of a background greeter instead of starting a new one */
+            GreeterSession *greeter_session = find_handover_greeter (seat, session);
+            if (greeter_session)
+            {
+                l_debug (seat, "Session authenticated, stopping greeter; display server will be re-used for user session");
+                session_set_display_server (session, session_get_display_server (SESSION (greeter_session)));
+                g_clear_object (&priv->handover_session);
+                priv->handover_session = g_object_ref (session);
+                session_stop (SESSION (greeter_session));
+                return;
+            }
+
+            l_debug (seat, "Session authenticated, starting display server");
             DisplayServer *display_server = create_display_server (seat, session);
             session_set_display_server (session, display_server);
             start_display_server (seat, display_server);
@@ -1523,6 +2496,7 @@ seat_switch_to_user (Seat *seat, const gchar *username, const gchar *session_nam
         return TRUE;
 
     l_debug (seat, "Switching to user %s", username);
+    priv->switch_start_time = g_get_monotonic_time ();
 
     /* Attempt to authenticate them */
     session = create_user_session (seat, username, FALSE);
@@ -1667,10 +2641,28 @@ seat_stop (Seat *seat)
         return;
 
     l_debug (seat, "Stopping");
+    flight_recorder_record (FLIGHT_RECORDER_EVENT_SEAT_STOP, 0, 0, seat_get_name (seat), NULL);
     priv->stopping = TRUE;
+    if (priv->standby_greeter_idle != 0)
+        g_source_remove (priv->standby_greeter_idle);
+    priv->standby_greeter_idle = 0;
+    g_clear_handle_id (&priv->crash_restart_timeout, g_source_remove);
+    g_clear_handle_id (&priv->idle_greeter_timeout, g_source_remove);
     SEAT_GET_CLASS (seat)->stop (seat);
 }
 
+/* Get the crashes in a row, all crashes and if the fallback configuration is in use, as returned by the D-Bus Statistics interface */
+GVariant *
+seat_get_crash_statistics (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    g_return_val_if_fail (seat != NULL, NULL);
+
+    gboolean recent = g_get_monotonic_time () - priv->last_crash_time <= CRASH_LOOP_INTERVAL;
+    return g_variant_new ("(ttb)", (guint64) (recent ? priv->n_recent_crashes : 0), priv->n_crashes, priv->n_crash_loops > 0);
+}
+
 gboolean
 seat_get_is_stopping (Seat *seat)
 {
@@ -1679,6 +2671,64 @@ seat_get_is_stopping (Seat *seat)
     return priv->stopping;
 }
 
+static void
+background_session_authentication_complete_cb (Session *session, Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    g_signal_handlers_disconnect_by_func (session, background_session_authentication_complete_cb, seat);
+    priv->starting_background_sessions = g_list_remove (priv->starting_background_sessions, session);
+    start_background_sessions (seat);
+}
+
+/* Start a session in the background, it is counted as starting until it has authenticated */
+static void
+start_background_session (Seat *seat, Session *session)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    DisplayServer *display_server = create_display_server (seat, session);
+    session_set_display_server (session, display_server);
+    if (!display_server || !start_display_server (seat, display_server))
+    {
+        l_warning (seat, "Failed to start display server for background session");
+        session_stop (session);
+        if (display_server)
+            display_server_stop (display_server);
+        return;
+    }
+
+    priv->starting_background_sessions = g_list_append (priv->starting_background_sessions, session);
+    g_signal_connect (session, SESSION_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (background_session_authentication_complete_cb), seat);
+}
+
+/* Start queued background sessions, limited so a long list of users doesn't run PAM for all of them at once */
+static void
+start_background_sessions (Seat *seat)
+{
+    SeatPrivate *priv = seat_get_instance_private (seat);
+
+    gint limit = seat_get_integer_property (seat, "background-session-limit");
+    while (!priv->stopping && !g_queue_is_empty (&priv->background_users) &&
+           (limit <= 0 || g_list_length (priv->starting_background_sessions) < (guint) limit))
+    {
+        g_autofree gchar *username = g_queue_pop_head (&priv->background_users);
+
+        if (find_user_session (seat, username, NULL))
+        {
+            l_debug (seat, "Not starting background session for %s, already has a session", username);
+            continue;
+        }
+
+        l_debug (seat, "Starting background session for %s", username);
+        Session *session = create_user_session (seat, username, TRUE);
+        if (!session)
+            continue;
+        session_set_pam_service (session, seat_get_string_property (seat, "pam-autologin-service"));
+        start_background_session (seat, session);
+    }
+}
+
 static gboolean
 seat_real_start (Seat *seat)
 {
@@ -1726,6 +2776,12 @@ seat_real_start (Seat *seat)
                     display_server_stop (display_server);
                 session = NULL;
             }
+            else if (seat_get_boolean_property (seat, "autologin-parallel-start") && !session_get_is_started (session))
+            {
+                /* Run PAM while the display server starts, the session is run when both are done */
+                l_debug (seat, "Authenticating automatic login session while display server starts");
+                start_session (seat, session);
+            }
         }
     }
 
@@ -1753,6 +2809,8 @@ seat_real_start (Seat *seat)
                 display_server_stop (display_server);
             session = NULL;
         }
+        else
+            start_greeter_early (seat, session);
     }
 
     /* Fail if can't start a session */
@@ -1762,14 +2820,17 @@ seat_real_start (Seat *seat)
         return FALSE;
     }
 
-    /* Start background session */
+    /* Start background sessions, the greeter doesn't wait for any of them */
     if (background_session)
+        start_background_session (seat, background_session);
+    g_auto(GStrv) background_users = seat_get_string_list_property (seat, "background-users");
+    for (gint i = 0; background_users && background_users[i]; i++)
     {
-        DisplayServer *background_display_server = create_display_server (seat, background_session);
-        session_set_display_server (background_session, background_display_server);
-        if (!start_display_server (seat, background_display_server))
-            l_warning (seat, "Failed to start display server for background session");
+        g_strstrip (background_users[i]);
+        if (background_users[i][0] != '\0' && g_strcmp0 (background_users[i], autologin_username) != 0)
+            g_queue_push_tail (&priv->background_users, g_strdup (background_users[i]));
     }
+    start_background_sessions (seat);
 
     return TRUE;
 }
@@ -1899,7 +2960,10 @@ seat_init (Seat *seat)
 {
     SeatPrivate *priv = seat_get_instance_private (seat);
 
-    priv->properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) seat_property_free);
+    priv->session_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    priv->user_sessions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->login1_sessions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
     priv->share_display_server = TRUE;
 }
 
@@ -1923,10 +2987,28 @@ seat_finalize (GObject *object)
         g_signal_handlers_disconnect_matched (session, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
     }
     g_list_free_full (priv->sessions, g_object_unref);
+    /* The lists are replaced when their first entry changes, so they aren't freed by the table */
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, priv->user_sessions);
+    gpointer entries;
+    while (g_hash_table_iter_next (&iter, NULL, &entries))
+        g_list_free (entries);
+    g_hash_table_unref (priv->user_sessions);
+    g_hash_table_unref (priv->login1_sessions);
+    g_hash_table_unref (priv->session_entries);
+    g_list_free (priv->greeter_sessions);
+    g_list_free_full (priv->background_users.head, g_free);
+    g_list_free (priv->starting_background_sessions);
     g_clear_object (&priv->active_session);
     g_clear_object (&priv->next_session);
     g_clear_object (&priv->session_to_activate);
     g_clear_object (&priv->replacement_greeter);
+    g_clear_object (&priv->handover_session);
+    g_clear_object (&priv->standby_greeter);
+    if (priv->standby_greeter_idle != 0)
+        g_source_remove (priv->standby_greeter_idle);
+    g_clear_handle_id (&priv->crash_restart_timeout, g_source_remove);
+    g_clear_handle_id (&priv->idle_greeter_timeout, g_source_remove);
 
     G_OBJECT_CLASS (seat_parent_class)->finalize (object);
 }
@@ -1973,6 +3055,14 @@ seat_class_init (SeatClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 1, SESSION_TYPE);
+    signals[ACTIVE_SESSION_CHANGED] =
+        g_signal_new (SEAT_SIGNAL_ACTIVE_SESSION_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SeatClass, active_session_changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 1, SESSION_TYPE);
     signals[STOPPED] =
         g_signal_new (SEAT_SIGNAL_STOPPED,
                       G_TYPE_FROM_CLASS (klass),
@@ -29,6 +29,7 @@ G_BEGIN_DECLS
 #define SEAT_SIGNAL_SESSION_ADDED        "session-added"
 #define SEAT_SIGNAL_RUNNING_USER_SESSION "running-user-session"
 #define SEAT_SIGNAL_SESSION_REMOVED      "session-removed"
+#define SEAT_SIGNAL_ACTIVE_SESSION_CHANGED "active-session-changed"
 #define SEAT_SIGNAL_STOPPED              "stopped"
 
 typedef struct
@@ -54,6 +55,7 @@ typedef struct
     void (*session_added)(Seat *seat, Session *session);
     void (*running_user_session)(Seat *seat, Session *session);
     void (*session_removed)(Seat *seat, Session *session);
+    void (*active_session_changed)(Seat *seat, Session *session);
     void (*stopped)(Seat *seat);
 } SeatClass;
 
@@ -83,6 +85,8 @@ void seat_set_supports_multi_session (Seat *seat, gboolean supports_multi_sessio
 
 void seat_set_share_display_server (Seat *seat, gboolean share_display_server);
 
+void seat_set_close_when_idle (Seat *seat, gboolean close_when_idle);
+
 gboolean seat_start (Seat *seat);
 
 GList *seat_get_sessions (Seat *seat);
@@ -117,6 +121,8 @@ void seat_stop (Seat *seat);
 
 gboolean seat_get_is_stopping (Seat *seat);
 
+GVariant *seat_get_crash_statistics (Seat *seat);
+
 G_END_DECLS
 
 #endif /* SEAT_H_ */
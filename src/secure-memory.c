@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "secure-memory.h"
+
+/*
+ * Memory for passwords and other secrets. When locked it is mapped on its own
+ * so it can be kept out of swap and core dumps; otherwise it is an ordinary
+ * allocation. Either way it is wiped before being freed.
+ */
+
+void
+secure_memory_wipe (void *data, gsize n)
+{
+    /* Use a volatile pointer so the compiler can't drop the writes */
+    volatile guint8 *p = data;
+    while (n--)
+        *p++ = 0;
+}
+
+void *
+secure_memory_alloc (gsize n, gboolean lock)
+{
+    if (!lock)
+        return g_malloc0 (n);
+
+    void *data = mmap (NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        g_error ("Failed to allocate %zu bytes of secure memory: %s", n, strerror (errno));
+    if (mlock (data, n) < 0)
+        g_warning ("Failed to lock secure memory: %s", strerror (errno));
+#ifdef MADV_DONTDUMP
+    madvise (data, n, MADV_DONTDUMP);
+#endif
+
+    return data;
+}
+
+void
+secure_memory_free (void *data, gsize n, gboolean locked)
+{
+    if (!data)
+        return;
+
+    secure_memory_wipe (data, n);
+    if (locked)
+    {
+        munlock (data, n);
+        munmap (data, n);
+    }
+    else
+        g_free (data);
+}
+
+/* Size to allocate to use whole pages */
+gsize
+secure_memory_round_size (gsize n)
+{
+    gsize page_size = sysconf (_SC_PAGESIZE);
+    return (n + page_size - 1) / page_size * page_size;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SECURE_MEMORY_H_
+#define SECURE_MEMORY_H_
+
+#include <glib.h>
+
+void *secure_memory_alloc (gsize n, gboolean lock);
+
+void secure_memory_free (void *data, gsize n, gboolean locked);
+
+void secure_memory_wipe (void *data, gsize n);
+
+gsize secure_memory_round_size (gsize n);
+
+#endif /* SECURE_MEMORY_H_ */
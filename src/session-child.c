@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <pwd.h>
@@ -23,10 +24,10 @@
 
 #include "configuration.h"
 #include "session-child.h"
-#include "session.h"
+#include "accounts.h"
 #include "console-kit.h"
-#include "login1.h"
 #include "log-file.h"
+#include "login-recorder.h"
 #include "privileges.h"
 #include "x-authority.h"
 #include "configuration.h"
@@ -34,6 +35,9 @@
 /* Child process being run */
 static GPid child_pid = 0;
 
+/* Seconds the child has to exit after being asked to stop before it is killed, 0 to wait forever */
+static guint stop_timeout = 0;
+
 /* Pipe to communicate with daemon */
 static int from_daemon_output = 0;
 static int to_daemon_input = 0;
@@ -46,13 +50,119 @@ static pam_handle_t *pam_handle;
 /* Maximum length of a string to pass between daemon and session */
 #define MAX_STRING_LENGTH 65535
 
+/* First protocol version that sends each message as one length prefixed frame */
+#define FRAMED_PROTOCOL_VERSION 4
+
+/* Maximum length of a frame to pass between daemon and session */
+#define MAX_FRAME_LENGTH (16 * 1024 * 1024)
+
+/* First protocol version that reports how long each setup step took */
+#define TIMINGS_PROTOCOL_VERSION 6
+
+/* Maximum number of steps timed before being reported */
+#define MAX_STEP_TIMINGS 16
+
+/* PAM calls and other steps that may block, timed until they are reported to the daemon */
+typedef struct
+{
+    const gchar *name;
+    gint64 start_time;
+    gint64 end_time;
+} StepTiming;
+static StepTiming step_timings[MAX_STEP_TIMINGS];
+static guint n_step_timings = 0;
+static gint64 step_start_time = 0;
+
+/* TRUE if messages are framed, otherwise each field is read and written directly */
+static gboolean framed = FALSE;
+
+/* Message being built to send to the daemon, starting with space for the length */
+static GByteArray *write_buffer = NULL;
+
+/* Last frame received from the daemon and how much of it has been consumed */
+static GByteArray *read_buffer = NULL;
+static gsize read_offset = 0;
+
+static void
+wipe_buffer (GByteArray *buffer)
+{
+    /* Frames may contain passwords */
+    volatile guint8 *data = buffer->data;
+    for (guint i = 0; i < buffer->len; i++)
+        data[i] = 0;
+}
+
+static gboolean
+write_fully (const void *buf, size_t count)
+{
+    const guint8 *data = buf;
+    while (count > 0)
+    {
+        ssize_t n_written = write (to_daemon_input, data, count);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+        {
+            g_printerr ("Error writing to daemon: %s\n", strerror (errno));
+            return FALSE;
+        }
+        data += n_written;
+        count -= n_written;
+    }
+
+    return TRUE;
+}
+
+static ssize_t
+read_fully (void *buf, size_t count)
+{
+    guint8 *data = buf;
+    size_t n_total = 0;
+    while (n_total < count)
+    {
+        ssize_t n_read = read (from_daemon_output, data + n_total, count - n_total);
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        if (n_read < 0)
+        {
+            g_printerr ("Error reading from daemon: %s\n", strerror (errno));
+            return n_read;
+        }
+        if (n_read == 0)
+            break;
+        n_total += n_read;
+    }
+
+    return n_total;
+}
+
 static void
 write_data (const void *buf, size_t count)
 {
+    if (framed)
+    {
+        g_byte_array_append (write_buffer, buf, count);
+        return;
+    }
+
     if (write (to_daemon_input, buf, count) != count)
         g_printerr ("Error writing to daemon: %s\n", strerror (errno));
 }
 
+/* Send the message built up since the last flush as a single frame */
+static void
+flush_data (void)
+{
+    if (!framed || write_buffer->len == sizeof (guint32))
+        return;
+
+    guint32 length = write_buffer->len - sizeof (guint32);
+    memcpy (write_buffer->data, &length, sizeof (length));
+    write_fully (write_buffer->data, write_buffer->len);
+    wipe_buffer (write_buffer);
+    g_byte_array_set_size (write_buffer, sizeof (guint32));
+}
+
 static void
 write_string (const char *value)
 {
@@ -62,14 +172,93 @@ write_string (const char *value)
         write_data (value, sizeof (char) * length);
 }
 
+static void
+step_begin (void)
+{
+    step_start_time = g_get_monotonic_time ();
+}
+
+static void
+step_end (const gchar *name)
+{
+    if (n_step_timings >= MAX_STEP_TIMINGS)
+        return;
+
+    StepTiming *timing = &step_timings[n_step_timings++];
+    timing->name = name;
+    timing->start_time = step_start_time;
+    timing->end_time = g_get_monotonic_time ();
+}
+
+/* Report the steps timed since the last report, the monotonic clock is shared with the daemon */
+static void
+write_step_timings (void)
+{
+    write_data (&n_step_timings, sizeof (n_step_timings));
+    for (guint i = 0; i < n_step_timings; i++)
+    {
+        write_string (step_timings[i].name);
+        write_data (&step_timings[i].start_time, sizeof (step_timings[i].start_time));
+        write_data (&step_timings[i].end_time, sizeof (step_timings[i].end_time));
+    }
+    n_step_timings = 0;
+}
+
 static ssize_t
 read_data (void *buf, size_t count)
 {
-    ssize_t n_read = read (from_daemon_output, buf, count);
-    if (n_read < 0)
-        g_printerr ("Error reading from daemon: %s\n", strerror (errno));
+    if (!framed)
+    {
+        ssize_t n_read = read (from_daemon_output, buf, count);
+        if (n_read < 0)
+            g_printerr ("Error reading from daemon: %s\n", strerror (errno));
+
+        return n_read;
+    }
+
+    if (count == 0)
+        return 0;
 
-    return n_read;
+    /* The daemon only replies to complete messages */
+    flush_data ();
+
+    /* Get the next frame once the last one is used up */
+    if (read_offset >= read_buffer->len)
+    {
+        wipe_buffer (read_buffer);
+        g_byte_array_set_size (read_buffer, 0);
+        read_offset = 0;
+
+        guint32 length;
+        ssize_t n_read = read_fully (&length, sizeof (length));
+        if (n_read <= 0)
+            return n_read;
+        if (n_read != sizeof (length) || length > MAX_FRAME_LENGTH)
+        {
+            g_printerr ("Invalid frame from daemon\n");
+            return -1;
+        }
+
+        g_byte_array_set_size (read_buffer, length);
+        if (read_fully (read_buffer->data, length) != length)
+        {
+            g_printerr ("Short frame from daemon\n");
+            g_byte_array_set_size (read_buffer, 0);
+            return -1;
+        }
+    }
+
+    if (read_buffer->len - read_offset < count)
+    {
+        g_printerr ("Message from daemon is shorter than expected\n");
+        read_offset = read_buffer->len;
+        return -1;
+    }
+
+    memcpy (buf, read_buffer->data + read_offset, count);
+    read_offset += count;
+
+    return count;
 }
 
 static gchar *
@@ -138,6 +327,7 @@ pam_conv_cb (int msg_length, const struct pam_message **msg, struct pam_response
         write_data (&m->msg_style, sizeof (m->msg_style));
         write_string (m->msg);
     }
+    flush_data ();
 
     /* Get response */
     int error;
@@ -163,11 +353,57 @@ signal_cb (int signum)
 {
     /* Pass on signal to child, otherwise just quit */
     if (child_pid > 0)
+    {
         kill (child_pid, signum);
+        if (stop_timeout > 0)
+            alarm (stop_timeout);
+    }
     else
         exit (EXIT_SUCCESS);
 }
 
+static void
+stop_timeout_cb (int signum)
+{
+    /* The command runs in its own process group, kill everything it started too */
+    if (child_pid > 0)
+    {
+        kill (-child_pid, SIGKILL);
+        kill (child_pid, SIGKILL);
+    }
+}
+
+/* Filesystem magic numbers from linux/magic.h */
+#define NFS_SUPER_MAGIC  0x6969
+#define SMB_SUPER_MAGIC  0x517B
+#define CIFS_SUPER_MAGIC 0xFF534D42
+#define SMB2_SUPER_MAGIC 0xFE534D42
+#define CODA_SUPER_MAGIC 0x73757245
+#define AFS_SUPER_MAGIC  0x5346414F
+#define CEPH_SUPER_MAGIC 0x00C36400
+
+static gboolean
+is_network_filesystem (const gchar *path)
+{
+    struct statfs buf;
+    if (statfs (path, &buf) < 0)
+        return FALSE;
+
+    switch ((guint32) buf.f_type)
+    {
+    case NFS_SUPER_MAGIC:
+    case SMB_SUPER_MAGIC:
+    case CIFS_SUPER_MAGIC:
+    case SMB2_SUPER_MAGIC:
+    case CODA_SUPER_MAGIC:
+    case AFS_SUPER_MAGIC:
+    case CEPH_SUPER_MAGIC:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
 static XAuthority *
 read_xauth (void)
 {
@@ -193,52 +429,13 @@ read_xauth (void)
     return x_authority_new (x_authority_family, x_authority_address, x_authority_address_length, x_authority_number, x_authority_name, x_authority_data, x_authority_data_length);
 }
 
-/* GNU provides this but we can't rely on that so let's make our own version */
 static void
-updwtmpx (const gchar *wtmp_file, struct utmpx *ut)
+ck_open_session_cb (GObject *object, GAsyncResult *result, gpointer data)
 {
-    struct utmp u;
-    memset (&u, 0, sizeof (u));
-    u.ut_type = ut->ut_type;
-    u.ut_pid = ut->ut_pid;
-    if (ut->ut_line)
-        strncpy (u.ut_line, ut->ut_line, sizeof (u.ut_line));
-    if (ut->ut_id)
-        strncpy (u.ut_id, ut->ut_id, sizeof (u.ut_id));
-    if (ut->ut_user)
-        strncpy (u.ut_user, ut->ut_user, sizeof (u.ut_user));
-    if (ut->ut_host)
-        strncpy (u.ut_host, ut->ut_host, sizeof (u.ut_host));
-    u.ut_tv.tv_sec = ut->ut_tv.tv_sec;
-    u.ut_tv.tv_usec = ut->ut_tv.tv_usec;
-
-    updwtmp (wtmp_file, &u);
+    GAsyncResult **ck_result = data;
+    *ck_result = g_object_ref (result);
 }
 
-#if HAVE_LIBAUDIT
-static void
-audit_event (int type, const gchar *username, uid_t uid, const gchar *remote_host_name, const gchar *tty, gboolean success)
-{
-    int auditfd = audit_open ();
-    if (auditfd < 0) {
-        g_printerr ("Error opening audit socket: %s\n", strerror (errno));
-        return;
-    }
-
-    const char *op = NULL;
-    if (type == AUDIT_USER_LOGIN)
-        op = "login";
-    else if (type == AUDIT_USER_LOGOUT)
-        op = "logout";
-    int result = success == TRUE ? 1 : 0;
-
-    if (audit_log_acct_message (auditfd, type, NULL, op, username, uid, remote_host_name, NULL, tty, result) <= 0)
-        g_printerr ("Error writing audit message: %s\n", strerror (errno));
-
-    close (auditfd);
-}
-#endif
-
 int
 session_child_run (int argc, char **argv)
 {
@@ -284,6 +481,15 @@ session_child_run (int argc, char **argv)
     int version;
     read_data (&version, sizeof (version));
 
+    /* Everything after the version is framed in newer protocols */
+    if (version >= FRAMED_PROTOCOL_VERSION)
+    {
+        framed = TRUE;
+        write_buffer = g_byte_array_new ();
+        g_byte_array_set_size (write_buffer, sizeof (guint32));
+        read_buffer = g_byte_array_new ();
+    }
+
     g_autofree gchar *service = read_string ();
     g_autofree gchar *username = read_string ();
     read_data (&do_authenticate, sizeof (do_authenticate));
@@ -296,7 +502,9 @@ session_child_run (int argc, char **argv)
 
     /* Setup PAM */
     struct pam_conv conversation = { pam_conv_cb, NULL };
+    step_begin ();
     int result = pam_start (service, username, &conversation, &pam_handle);
+    step_end ("pam-start");
     if (result != PAM_SUCCESS)
     {
         g_printerr ("Failed to start PAM: %s", pam_strerror (NULL, result));
@@ -331,7 +539,9 @@ session_child_run (int argc, char **argv)
     {
         const gchar *new_username;
 
+        step_begin ();
         authentication_result = pam_authenticate (pam_handle, 0);
+        step_end ("pam-authenticate");
 
         /* See what user we ended up as */
         if (pam_get_item (pam_handle, PAM_USER, (const void **) &new_username) != PAM_SUCCESS)
@@ -364,18 +574,28 @@ session_child_run (int argc, char **argv)
             ut.ut_tv.tv_sec = tv.tv_sec;
             ut.ut_tv.tv_usec = tv.tv_usec;
 
-            updwtmpx ("/var/log/btmp", &ut);
+            step_begin ();
+            login_recorder_add_utmp (&ut, FALSE, "/var/log/btmp");
 
 #if HAVE_LIBAUDIT
-            audit_event (AUDIT_USER_LOGIN, username, -1, remote_host_name, tty, FALSE);
+            login_recorder_add_audit (AUDIT_USER_LOGIN, username, -1, remote_host_name, tty, FALSE);
 #endif
+            step_end ("login-records");
         }
 
         /* Check account is valid */
         if (authentication_result == PAM_SUCCESS)
+        {
+            step_begin ();
             authentication_result = pam_acct_mgmt (pam_handle, 0);
+            step_end ("pam-acct-mgmt");
+        }
         if (authentication_result == PAM_NEW_AUTHTOK_REQD)
+        {
+            step_begin ();
             authentication_result = pam_chauthtok (pam_handle, PAM_CHANGE_EXPIRED_AUTHTOK);
+            step_end ("pam-chauthtok");
+        }
     }
     else
         authentication_result = PAM_SUCCESS;
@@ -438,6 +658,9 @@ session_child_run (int argc, char **argv)
     write_data (&auth_complete, sizeof (auth_complete));
     write_data (&authentication_result, sizeof (authentication_result));
     write_string (authentication_result_string);
+    if (version >= TIMINGS_PROTOCOL_VERSION)
+        write_step_timings ();
+    flush_data ();
 
     /* Check we got a valid user */
     if (!username)
@@ -459,6 +682,12 @@ session_child_run (int argc, char **argv)
     LogMode log_mode = LOG_MODE_BACKUP_AND_TRUNCATE;
     if (version >= 3)
         read_data (&log_mode, sizeof (log_mode));
+    if (log_mode == LOG_MODE_ROTATE)
+    {
+        LogLimits limits;
+        read_data (&limits, sizeof (limits));
+        log_file_set_limits (&limits);
+    }
     if (version >= 1)
     {
         g_free (tty);
@@ -483,6 +712,12 @@ session_child_run (int argc, char **argv)
     for (i = 0; i < command_argc; i++)
         command_argv[i] = read_string ();
     command_argv[i] = NULL;
+    gboolean hold = FALSE;
+    if (version >= 5)
+    {
+        read_data (&hold, sizeof (hold));
+        read_data (&stop_timeout, sizeof (stop_timeout));
+    }
 
     /* If nothing to run just refresh credentials because we successfully authenticated */
     if (command_argc == 0)
@@ -513,15 +748,19 @@ session_child_run (int argc, char **argv)
     /* Set group membership - these can be overridden in pam_setcred */
     if (getuid () == 0)
     {
+        step_begin ();
         if (initgroups (username, user_get_gid (user)) < 0)
         {
             g_printerr ("Failed to initialize supplementary groups for %s: %s\n", username, strerror (errno));
             _exit (EXIT_FAILURE);
         }
+        step_end ("initgroups");
     }
 
     /* Set credentials */
+    step_begin ();
     result = pam_setcred (pam_handle, PAM_ESTABLISH_CRED);
+    step_end ("pam-setcred");
     if (result != PAM_SUCCESS)
     {
         g_printerr ("Failed to establish PAM credentials: %s\n", pam_strerror (pam_handle, result));
@@ -530,7 +769,9 @@ session_child_run (int argc, char **argv)
     }
 
     /* Open the session */
+    step_begin ();
     result = pam_open_session (pam_handle, 0);
+    step_end ("pam-open-session");
     if (result != PAM_SUCCESS)
     {
         g_printerr ("Failed to open PAM session: %s\n", pam_strerror (pam_handle, result));
@@ -552,11 +793,14 @@ session_child_run (int argc, char **argv)
     /* Check what logind session we are, or fallback to ConsoleKit */
     const gchar *login1_session_id = pam_getenv (pam_handle, "XDG_SESSION_ID");
     g_autofree gchar *console_kit_cookie = NULL;
+    g_autoptr(GMainContext) ck_context = NULL;
+    g_autoptr(GAsyncResult) ck_result = NULL;
     if (login1_session_id)
     {
         write_string (login1_session_id);
         if (version >= 2)
             write_string (NULL);
+        flush_data ();
     }
     else
     {
@@ -579,35 +823,45 @@ session_child_run (int argc, char **argv)
         }
         else
             g_variant_builder_add (&ck_parameters, "(sv)", "is-local", g_variant_new_boolean (TRUE));
-        console_kit_cookie = ck_open_session (&ck_parameters);
-        if (version >= 2)
-            write_string (NULL);
-        write_string (console_kit_cookie);
-        if (console_kit_cookie)
-        {
-            g_autofree gchar *value = NULL;
-            g_autofree gchar *runtime_dir = NULL;
-            value = g_strdup_printf ("XDG_SESSION_COOKIE=%s", console_kit_cookie);
-            pam_putenv (pam_handle, value);
 
-            runtime_dir = ck_get_xdg_runtime_dir (console_kit_cookie);
-            if (runtime_dir)
-            {
-                g_autofree gchar *v = g_strdup_printf ("XDG_RUNTIME_DIR=%s", runtime_dir);
-                pam_putenv (pam_handle, v);
-            }
+        /* Open the session while the X authority is being written */
+        ck_context = g_main_context_new ();
+        g_main_context_push_thread_default (ck_context);
+        ck_open_session_async (&ck_parameters, ck_open_session_cb, &ck_result);
+        g_main_context_pop_thread_default (ck_context);
+    }
+
+    /* Keep the X authority off network mounted home directories, writing it needs a locked round trip to the server */
+    if (x_authority)
+    {
+        const gchar *runtime_dir = pam_getenv (pam_handle, "XDG_RUNTIME_DIR");
+        g_autofree gchar *x_authority_dir = g_path_get_dirname (x_authority_filename);
+        if (runtime_dir &&
+            g_strcmp0 (x_authority_dir, user_get_home_directory (user)) == 0 &&
+            is_network_filesystem (x_authority_dir))
+        {
+            g_free (x_authority_filename);
+            x_authority_filename = g_build_filename (runtime_dir, "Xauthority", NULL);
         }
     }
 
     /* Write X authority */
     if (x_authority)
     {
+        /* Dropping privileges affects every thread, so the records must be written first */
         gboolean drop_privileges = geteuid () == 0;
         if (drop_privileges)
+        {
+            step_begin ();
+            login_recorder_flush ();
+            step_end ("login-records");
             privileges_drop (user_get_uid (user), user_get_gid (user));
+        }
 
+        step_begin ();
         g_autoptr(GError) error = NULL;
         gboolean result = x_authority_write (x_authority, XAUTH_WRITE_MODE_REPLACE, x_authority_filename, &error);
+        step_end ("xauth-write");
         if (drop_privileges)
             privileges_reclaim ();
 
@@ -623,15 +877,61 @@ session_child_run (int argc, char **argv)
         pam_putenv (pam_handle, value);
     }
 
+    /* Complete opening the ConsoleKit session */
+    if (ck_context)
+    {
+        step_begin ();
+        while (!ck_result)
+            g_main_context_iteration (ck_context, TRUE);
+        step_end ("console-kit-open");
+        console_kit_cookie = ck_open_session_finish (ck_result);
+        if (version >= 2)
+            write_string (NULL);
+        write_string (console_kit_cookie);
+        if (console_kit_cookie)
+        {
+            g_autofree gchar *value = NULL;
+            g_autofree gchar *runtime_dir = NULL;
+            value = g_strdup_printf ("XDG_SESSION_COOKIE=%s", console_kit_cookie);
+            pam_putenv (pam_handle, value);
+
+            runtime_dir = ck_get_xdg_runtime_dir (console_kit_cookie);
+            if (runtime_dir)
+            {
+                g_autofree gchar *v = g_strdup_printf ("XDG_RUNTIME_DIR=%s", runtime_dir);
+                pam_putenv (pam_handle, v);
+            }
+        }
+        flush_data ();
+    }
+
     /* Catch terminate signal and pass it to the child */
     signal (SIGTERM, signal_cb);
+    signal (SIGALRM, stop_timeout_cb);
+
+    /* Wait until the daemon lets the command run, the session was set up while the display was still in use */
+    gboolean run_command = TRUE;
+    if (hold)
+    {
+        gboolean release = FALSE;
+        if (read_data (&release, sizeof (release)) <= 0)
+            release = FALSE;
+        run_command = release;
+    }
+
+    /* Report how long the session took to set up */
+    if (run_command && version >= TIMINGS_PROTOCOL_VERSION)
+    {
+        write_step_timings ();
+        flush_data ();
+    }
 
     /* Run the command as the authenticated user */
     uid_t uid = user_get_uid (user);
     gid_t gid = user_get_gid (user);
     const gchar *home_directory = user_get_home_directory (user);
-    child_pid = fork ();
-    if (child_pid == 0)
+    child_pid = run_command ? fork () : 0;
+    if (run_command && child_pid == 0)
     {
         /* Make this process its own session */
         if (setsid () < 0)
@@ -656,7 +956,7 @@ session_child_run (int argc, char **argv)
 
         if (log_filename)
         {
-            int fd = log_file_open (log_filename, log_mode);
+            int fd = log_file_open_detached (log_filename, log_mode);
             if (fd >= 0)
             {
                 dup2 (fd, STDERR_FILENO);
@@ -705,14 +1005,10 @@ session_child_run (int argc, char **argv)
             ut.ut_tv.tv_usec = tv.tv_usec;
 
             /* Write records to utmp/wtmp databases */
-            setutxent ();
-            if (!pututxline (&ut))
-                g_printerr ("Failed to write utmpx: %s\n", strerror (errno));
-            endutxent ();
-            updwtmpx ("/var/log/wtmp", &ut);
+            login_recorder_add_utmp (&ut, TRUE, "/var/log/wtmp");
 
 #if HAVE_LIBAUDIT
-            audit_event (AUDIT_USER_LOGIN, username, uid, remote_host_name, tty, TRUE);
+            login_recorder_add_audit (AUDIT_USER_LOGIN, username, uid, remote_host_name, tty, TRUE);
 #endif
         }
 
@@ -746,14 +1042,10 @@ session_child_run (int argc, char **argv)
             ut.ut_tv.tv_usec = tv.tv_usec;
 
             /* Write records to utmp/wtmp databases */
-            setutxent ();
-            if (!pututxline (&ut))
-                g_printerr ("Failed to write utmpx: %s\n", strerror (errno));
-            endutxent ();
-            updwtmpx ("/var/log/wtmp", &ut);
+            login_recorder_add_utmp (&ut, TRUE, "/var/log/wtmp");
 
 #if HAVE_LIBAUDIT
-            audit_event (AUDIT_USER_LOGOUT, username, uid, remote_host_name, tty, TRUE);
+            login_recorder_add_audit (AUDIT_USER_LOGOUT, username, uid, remote_host_name, tty, TRUE);
 #endif
         }
     }
@@ -761,9 +1053,13 @@ session_child_run (int argc, char **argv)
     /* Remove X authority */
     if (x_authority)
     {
+        /* Dropping privileges affects every thread, so the records must be written first */
         gboolean drop_privileges = geteuid () == 0;
         if (drop_privileges)
+        {
+            login_recorder_flush ();
             privileges_drop (user_get_uid (user), user_get_gid (user));
+        }
 
         g_autoptr(GError) error = NULL;
         x_authority_write (x_authority, XAUTH_WRITE_MODE_REMOVE, x_authority_filename, &error);
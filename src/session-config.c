@@ -34,6 +34,12 @@ session_config_new_from_file (const gchar *filename, const gchar *default_sessio
     g_autoptr(GKeyFile) desktop_file = g_key_file_new ();
     if (!g_key_file_load_from_file (desktop_file, filename, G_KEY_FILE_NONE, error))
         return NULL;
+    return session_config_new_from_key_file (desktop_file, filename, default_session_type, error);
+}
+
+SessionConfig *
+session_config_new_from_key_file (GKeyFile *desktop_file, const gchar *filename, const gchar *default_session_type, GError **error)
+{
     g_autofree gchar *command = g_key_file_get_string (desktop_file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC, NULL);
     if (!command)
     {
@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "session-launcher.h"
+#include "session-child.h"
+
+/* The launcher is the session child binary started once with "--session-launcher".
+ * Session children are forked from it rather than forking the (large, threaded)
+ * daemon and executing the binary for every session. The daemon passes the
+ * pipes for each child over a socket and the launcher reports back the child
+ * process ID and when it terminates. */
+
+typedef enum
+{
+    LAUNCHER_MESSAGE_SPAWN = 0,
+    LAUNCHER_MESSAGE_STARTED,
+    LAUNCHER_MESSAGE_EXITED,
+} LauncherMessageType;
+
+typedef struct
+{
+    guint32 type;
+    gint32 pid;
+    /* errno for STARTED, wait status for EXITED */
+    gint32 status;
+} LauncherMessage;
+
+typedef struct
+{
+    guint id;
+    GPid pid;
+    GChildWatchFunc function;
+    gpointer data;
+} LauncherWatch;
+
+/* How long to wait for the launcher to reply to a spawn request */
+#define LAUNCHER_TIMEOUT_MS 5000
+
+/* Socket connected to the launcher or -1 if not running */
+static int launcher_fd = -1;
+
+/* Process ID of the launcher */
+static GPid launcher_pid = 0;
+
+/* Watch on the launcher socket */
+static guint launcher_watch = 0;
+
+/* Watch on the launcher process */
+static guint launcher_child_watch = 0;
+
+/* Children being watched */
+static GList *watches = NULL;
+static guint last_watch_id = 0;
+
+/* Exit messages received while waiting for a spawn reply */
+static GList *pending_exits = NULL;
+static guint pending_exits_idle = 0;
+
+static void
+handle_exited (GPid pid, gint status)
+{
+    for (GList *link = watches; link; link = link->next)
+    {
+        LauncherWatch *watch = link->data;
+
+        if (watch->pid != pid)
+            continue;
+
+        watches = g_list_delete_link (watches, link);
+        watch->function (pid, status, watch->data);
+        g_free (watch);
+        return;
+    }
+
+    g_debug ("Ignoring exit of unwatched session child %d", pid);
+}
+
+static gboolean
+pending_exits_cb (gpointer data)
+{
+    pending_exits_idle = 0;
+
+    while (pending_exits)
+    {
+        LauncherMessage *message = pending_exits->data;
+        pending_exits = g_list_delete_link (pending_exits, pending_exits);
+        handle_exited (message->pid, message->status);
+        g_free (message);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+stop_launcher (void)
+{
+    if (launcher_fd < 0)
+        return;
+
+    g_warning ("Lost connection to session launcher, falling back to running session children directly");
+
+    if (launcher_watch)
+        g_source_remove (launcher_watch);
+    launcher_watch = 0;
+    close (launcher_fd);
+    launcher_fd = -1;
+
+    /* We can no longer find out when the children exit, so stop them and
+     * report them as killed */
+    while (watches)
+    {
+        LauncherWatch *watch = watches->data;
+        kill (watch->pid, SIGKILL);
+        handle_exited (watch->pid, SIGKILL);
+    }
+}
+
+static gboolean
+read_message (LauncherMessage *message)
+{
+    ssize_t n_read;
+    do
+        n_read = recv (launcher_fd, message, sizeof (LauncherMessage), 0);
+    while (n_read < 0 && errno == EINTR);
+
+    if (n_read == sizeof (LauncherMessage))
+        return TRUE;
+
+    if (n_read < 0)
+        g_warning ("Error reading from session launcher: %s", strerror (errno));
+    else if (n_read > 0)
+        g_warning ("Short read from session launcher");
+    return FALSE;
+}
+
+static gboolean
+launcher_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    LauncherMessage message;
+    if (!read_message (&message))
+    {
+        launcher_watch = 0;
+        stop_launcher ();
+        return G_SOURCE_REMOVE;
+    }
+
+    if (message.type == LAUNCHER_MESSAGE_EXITED)
+        handle_exited (message.pid, message.status);
+    else
+        g_warning ("Unexpected message %d from session launcher", message.type);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+launcher_exited_cb (GPid pid, gint status, gpointer data)
+{
+    launcher_child_watch = 0;
+    launcher_pid = 0;
+
+    if (WIFEXITED (status))
+        g_debug ("Session launcher exited with return value %d", WEXITSTATUS (status));
+    else if (WIFSIGNALED (status))
+        g_debug ("Session launcher terminated with signal %d", WTERMSIG (status));
+
+    stop_launcher ();
+}
+
+static gboolean
+start_launcher (void)
+{
+    int fds[2];
+    if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+        g_warning ("Failed to create session launcher socket: %s", strerror (errno));
+        return FALSE;
+    }
+
+    g_autofree gchar *fd_arg = g_strdup_printf ("%d", fds[1]);
+    GPid pid = fork ();
+    if (pid == 0)
+    {
+        fcntl (fds[1], F_SETFD, 0);
+        session_launcher_exec ("--session-launcher", fd_arg, NULL);
+        _exit (EXIT_FAILURE);
+    }
+    close (fds[1]);
+
+    if (pid < 0)
+    {
+        g_warning ("Failed to fork session launcher: %s", strerror (errno));
+        close (fds[0]);
+        return FALSE;
+    }
+
+    g_debug ("Started session launcher with pid %d", pid);
+
+    launcher_fd = fds[0];
+    launcher_pid = pid;
+    g_autoptr(GIOChannel) channel = g_io_channel_unix_new (launcher_fd);
+    launcher_watch = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR, launcher_cb, NULL);
+    launcher_child_watch = g_child_watch_add (launcher_pid, launcher_exited_cb, NULL);
+
+    return TRUE;
+}
+
+/* Start the launcher. This has to be done before any session pipes are open,
+ * as the launcher keeps everything it inherits for its whole life */
+void
+session_launcher_start (void)
+{
+    if (launcher_fd < 0)
+        start_launcher ();
+}
+
+/* Replace the current process with the session child binary, looking in the
+ * path first so an uninstalled daemon runs its matching child */
+void
+session_launcher_exec (const gchar *mode, const gchar *arg0, const gchar *arg1)
+{
+    execlp ("lightdm-session-child",
+            "lightdm-session-child",
+            mode, arg0, arg1, NULL);
+    execl (SESSION_CHILD_PATH,
+           "lightdm-session-child",
+           mode, arg0, arg1, NULL);
+}
+
+/* Run a session child with the given pipes to the daemon.
+ * Returns the process ID or -1 if the launcher is not available, in which case
+ * the caller should run the child itself */
+GPid
+session_launcher_spawn (int input_fd, int output_fd)
+{
+    if (launcher_fd < 0)
+        return -1;
+
+    LauncherMessage request = { LAUNCHER_MESSAGE_SPAWN, 0, 0 };
+    struct iovec iov = { &request, sizeof (request) };
+    union
+    {
+        char buffer[CMSG_SPACE (sizeof (int) * 2)];
+        struct cmsghdr align;
+    } control;
+    memset (&control, 0, sizeof (control));
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof (control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int) * 2);
+    int fds[2] = { input_fd, output_fd };
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+    ssize_t n_written;
+    do
+        n_written = sendmsg (launcher_fd, &msg, MSG_NOSIGNAL);
+    while (n_written < 0 && errno == EINTR);
+    if (n_written != sizeof (request))
+    {
+        g_warning ("Failed to send request to session launcher: %s", strerror (errno));
+        stop_launcher ();
+        return -1;
+    }
+
+    /* The launcher replies as soon as it has forked, so block for it. Any
+     * children that exit in the meantime are reported once we are back in
+     * the main loop so the caller can set up its watch first */
+    while (TRUE)
+    {
+        struct pollfd poll_fd = { launcher_fd, POLLIN, 0 };
+        int n_ready = poll (&poll_fd, 1, LAUNCHER_TIMEOUT_MS);
+        if (n_ready < 0 && errno == EINTR)
+            continue;
+        if (n_ready <= 0)
+        {
+            g_warning ("Timed out waiting for session launcher");
+            stop_launcher ();
+            return -1;
+        }
+
+        LauncherMessage message;
+        if (!read_message (&message))
+        {
+            stop_launcher ();
+            return -1;
+        }
+
+        if (message.type == LAUNCHER_MESSAGE_EXITED)
+        {
+            LauncherMessage *pending = g_malloc (sizeof (LauncherMessage));
+            *pending = message;
+            pending_exits = g_list_append (pending_exits, pending);
+            if (!pending_exits_idle)
+                pending_exits_idle = g_idle_add (pending_exits_cb, NULL);
+            continue;
+        }
+
+        if (message.type != LAUNCHER_MESSAGE_STARTED)
+        {
+            g_warning ("Unexpected message %d from session launcher", message.type);
+            continue;
+        }
+
+        if (message.pid <= 0)
+        {
+            g_warning ("Session launcher failed to fork session child: %s", strerror (message.status));
+            return -1;
+        }
+
+        return message.pid;
+    }
+}
+
+guint
+session_launcher_watch_add (GPid pid, GChildWatchFunc function, gpointer data)
+{
+    LauncherWatch *watch = g_malloc0 (sizeof (LauncherWatch));
+    watch->id = ++last_watch_id;
+    watch->pid = pid;
+    watch->function = function;
+    watch->data = data;
+    watches = g_list_append (watches, watch);
+
+    return watch->id;
+}
+
+void
+session_launcher_watch_remove (guint id)
+{
+    for (GList *link = watches; link; link = link->next)
+    {
+        LauncherWatch *watch = link->data;
+
+        if (watch->id != id)
+            continue;
+
+        watches = g_list_delete_link (watches, link);
+        g_free (watch);
+        return;
+    }
+}
+
+/* Pipe written to from the SIGCHLD handler in the launcher */
+static int child_signal_pipe[2] = { -1, -1 };
+
+static void
+child_signal_cb (int signum)
+{
+    int errno_saved = errno;
+    char c = 0;
+    if (write (child_signal_pipe[1], &c, 1) < 0)
+    {
+        /* Pipe is full, the loop will already reap */
+    }
+    errno = errno_saved;
+}
+
+static void
+send_message (int fd, LauncherMessageType type, GPid pid, gint status)
+{
+    LauncherMessage message = { type, pid, status };
+    ssize_t n_written;
+    do
+        n_written = send (fd, &message, sizeof (message), MSG_NOSIGNAL);
+    while (n_written < 0 && errno == EINTR);
+}
+
+static void
+run_child (int control_fd, int input_fd, int output_fd)
+{
+    close (control_fd);
+    close (child_signal_pipe[0]);
+    close (child_signal_pipe[1]);
+    signal (SIGCHLD, SIG_DFL);
+
+    g_autofree gchar *input_arg = g_strdup_printf ("%d", input_fd);
+    g_autofree gchar *output_arg = g_strdup_printf ("%d", output_fd);
+    char *argv[] = { "lightdm-session-child", "--session-child", input_arg, output_arg, NULL };
+    exit (session_child_run (4, argv));
+}
+
+static gboolean
+handle_request (int control_fd)
+{
+    LauncherMessage request;
+    struct iovec iov = { &request, sizeof (request) };
+    union
+    {
+        char buffer[CMSG_SPACE (sizeof (int) * 2)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof (control.buffer);
+
+    ssize_t n_read = recvmsg (control_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n_read < 0 && errno == EINTR)
+        return TRUE;
+    if (n_read <= 0)
+        return FALSE;
+
+    int fds[2] = { -1, -1 };
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN (sizeof (fds)))
+            memcpy (fds, CMSG_DATA (cmsg), sizeof (fds));
+
+    if (n_read != sizeof (request) || request.type != LAUNCHER_MESSAGE_SPAWN || fds[0] < 0 || fds[1] < 0)
+    {
+        g_printerr ("Invalid request to session launcher\n");
+        if (fds[0] >= 0)
+            close (fds[0]);
+        if (fds[1] >= 0)
+            close (fds[1]);
+        send_message (control_fd, LAUNCHER_MESSAGE_STARTED, -1, EINVAL);
+        return TRUE;
+    }
+
+    /* The received descriptors are marked close-on-exec, the child uses them
+     * directly and closes them before running the session */
+    GPid pid = fork ();
+    if (pid == 0)
+        run_child (control_fd, fds[0], fds[1]);
+    int fork_errno = errno;
+
+    close (fds[0]);
+    close (fds[1]);
+    send_message (control_fd, LAUNCHER_MESSAGE_STARTED, pid, pid < 0 ? fork_errno : 0);
+
+    return TRUE;
+}
+
+int
+session_launcher_run (int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        g_printerr ("Usage: lightdm --session-launcher FD\n");
+        return EXIT_FAILURE;
+    }
+    int control_fd = atoi (argv[2]);
+    if (control_fd <= 0)
+    {
+        g_printerr ("Invalid file descriptor %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    fcntl (control_fd, F_SETFD, FD_CLOEXEC);
+
+    /* Only keep the socket to the daemon, anything else inherited would be
+     * passed on to every session child and session */
+    long max_fd = MIN (sysconf (_SC_OPEN_MAX), 65536);
+    for (int fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+        if (fd != control_fd)
+            close (fd);
+
+    /* Children get stdin/stdout from us, make sure they are not the daemon's */
+    int fd = open ("/dev/null", O_RDONLY);
+    dup2 (fd, STDIN_FILENO);
+    close (fd);
+    fd = open ("/dev/null", O_WRONLY);
+    dup2 (fd, STDOUT_FILENO);
+    close (fd);
+
+    if (pipe (child_signal_pipe) < 0)
+    {
+        g_printerr ("Failed to create pipe: %s\n", strerror (errno));
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl (child_signal_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl (child_signal_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+
+    struct sigaction action;
+    action.sa_handler = child_signal_cb;
+    sigemptyset (&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction (SIGCHLD, &action, NULL);
+
+    while (TRUE)
+    {
+        struct pollfd poll_fds[2] = { { control_fd, POLLIN, 0 }, { child_signal_pipe[0], POLLIN, 0 } };
+        if (poll (poll_fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            g_printerr ("Failed to poll: %s\n", strerror (errno));
+            break;
+        }
+
+        /* Handle requests first so a child is always reported as started
+         * before it is reported as exited */
+        if (poll_fds[0].revents != 0 && !handle_request (control_fd))
+            break;
+
+        if (poll_fds[1].revents != 0)
+        {
+            char buffer[64];
+            while (read (child_signal_pipe[0], buffer, sizeof (buffer)) > 0);
+
+            GPid pid;
+            int status;
+            while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+                send_message (control_fd, LAUNCHER_MESSAGE_EXITED, pid, status);
+        }
+    }
+
+    /* Daemon has gone, leave the children to finish on their own */
+    return EXIT_SUCCESS;
+}
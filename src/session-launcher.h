@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SESSION_LAUNCHER_H_
+#define SESSION_LAUNCHER_H_
+
+#include <glib.h>
+
+void session_launcher_start (void);
+
+void session_launcher_exec (const gchar *mode, const gchar *arg0, const gchar *arg1);
+
+GPid session_launcher_spawn (int input_fd, int output_fd);
+
+guint session_launcher_watch_add (GPid pid, GChildWatchFunc function, gpointer data);
+
+void session_launcher_watch_remove (guint id);
+
+int session_launcher_run (int argc, char **argv);
+
+#endif /* SESSION_LAUNCHER_H_ */
@@ -28,12 +28,18 @@
 #include "guest-account.h"
 #include "shared-data-manager.h"
 #include "greeter-socket.h"
+#include "session-launcher.h"
+#include "process.h"
+#include "memory-usage.h"
+#include "secure-memory.h"
+#include "trace.h"
 
 enum {
     CREATE_GREETER,
     GOT_MESSAGES,
     AUTHENTICATION_COMPLETE,
     STOPPED,
+    USERNAME_CHANGED,
     LAST_SIGNAL
 };
 static guint signals[LAST_SIGNAL] = { 0 };
@@ -56,12 +62,31 @@ typedef struct
     guint from_child_watch;
     guint child_watch;
 
+    /* TRUE if messages to and from the child are framed */
+    gboolean framed;
+
+    /* Message being built to send to the child, starting with space for the length */
+    GByteArray *to_child_buffer;
+
+    /* TRUE if frames with responses are kept out of swap and core dumps */
+    gboolean lock_memory;
+
+    /* Last frame received from the child and how much of it has been consumed */
+    GByteArray *from_child_buffer;
+    gsize from_child_offset;
+
+    /* TRUE if the child was started by the session launcher */
+    gboolean launched;
+
     /* User to authenticate as */
     gchar *username;
 
     /* TRUE if is a guest account */
     gboolean is_guest;
 
+    /* TRUE if waiting for the guest account to be created */
+    gboolean guest_setup_pending;
+
     /* User object that matches the current username */
     User *user;
 
@@ -108,8 +133,11 @@ typedef struct
     /* login1 session ID */
     gchar *login1_session_id;
 
-    /* Environment to set in child */
-    GList *env;
+    /* Environment to set in child as "NAME=VALUE" entries, in the order they were added */
+    GQueue env;
+
+    /* Links in env keyed by variable name */
+    GHashTable *env_links;
 
     /* Command to run in child */
     gchar **argv;
@@ -117,6 +145,17 @@ typedef struct
     /* True if have run command */
     gboolean command_run;
 
+    /* TRUE if the session has been set up and the child is waiting to be told to run the command */
+    gboolean held;
+
+    /* Seconds the command has to exit after being asked to stop before it is killed, 0 to wait forever */
+    guint stop_timeout;
+
+    /* TRUE if the session is run by another process, so there is no session child */
+    gboolean external;
+    gboolean external_started;
+    guint external_authenticate_timeout;
+
     /* TRUE if stopping this session */
     gboolean stopping;
 } SessionPrivate;
@@ -124,6 +163,25 @@ typedef struct
 /* Maximum length of a string to pass between daemon and session */
 #define MAX_STRING_LENGTH 65535
 
+/* Protocol version we use. From version 4 each message after the version is
+ * sent as one length prefixed frame so it takes a single write and read. From
+ * version 5 the command can be held until the daemon releases it and the
+ * child kills it if it doesn't stop in time. From version 6 the child reports
+ * how long each PAM call and other setup step took */
+#define PROTOCOL_VERSION 6
+#define FRAMED_PROTOCOL_VERSION 4
+
+/* Most setup steps the child can report at once */
+#define MAX_STEP_TIMINGS 16
+
+/* Maximum length of a frame to pass between daemon and session */
+#define MAX_FRAME_LENGTH (16 * 1024 * 1024)
+
+/* Number of authentications started and how they completed */
+static guint64 n_authentications_started = 0;
+static guint64 n_authentications_succeeded = 0;
+static guint64 n_authentications_failed = 0;
+
 static void session_logger_iface_init (LoggerInterface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (Session, session, G_TYPE_OBJECT,
@@ -173,13 +231,29 @@ session_set_pam_service (Session *session, const gchar *pam_service)
     priv->pam_service = g_strdup (pam_service);
 }
 
+/* Change the user, taking ownership of the name */
+static void
+change_username (Session *session, gchar *username)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    if (g_strcmp0 (username, priv->username) == 0)
+    {
+        g_free (username);
+        return;
+    }
+
+    g_free (priv->username);
+    priv->username = username;
+    g_clear_object (&priv->user);
+    g_signal_emit (G_OBJECT (session), signals[USERNAME_CHANGED], 0);
+}
+
 void
 session_set_username (Session *session, const gchar *username)
 {
-    SessionPrivate *priv = session_get_instance_private (session);
     g_return_if_fail (session != NULL);
-    g_free (priv->username);
-    priv->username = g_strdup (username);
+    change_username (session, g_strdup (username));
 }
 
 void
@@ -278,6 +352,14 @@ session_set_x_authority (Session *session, XAuthority *authority, gboolean use_s
     priv->x_authority_use_system_location = use_system_location;
 }
 
+XAuthority *
+session_get_x_authority (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, NULL);
+    return priv->x_authority;
+}
+
 void
 session_set_remote_host_name (Session *session, const gchar *remote_host_name)
 {
@@ -291,16 +373,7 @@ static GList *
 find_env_entry (Session *session, const gchar *name)
 {
     SessionPrivate *priv = session_get_instance_private (session);
-
-    for (GList *link = priv->env; link; link = link->next)
-    {
-        const gchar *entry = link->data;
-
-        if (g_str_has_prefix (entry, name) && entry[strlen (name)] == '=')
-            return link;
-    }
-
-    return NULL;
+    return g_hash_table_lookup (priv->env_links, name);
 }
 
 void
@@ -312,20 +385,27 @@ session_set_env (Session *session, const gchar *name, const gchar *value)
     g_return_if_fail (value != NULL);
 
     gchar *entry = g_strdup_printf ("%s=%s", name, value);
+    memory_usage_add (MEMORY_POOL_SESSION_ENVIRONMENTS, strlen (entry) + 1);
 
     GList *link = find_env_entry (session, name);
     if (link)
     {
+        memory_usage_remove (MEMORY_POOL_SESSION_ENVIRONMENTS, strlen (link->data) + 1);
         g_free (link->data);
         link->data = entry;
     }
     else
-        priv->env = g_list_append (priv->env, entry);
+    {
+        g_queue_push_tail (&priv->env, entry);
+        g_hash_table_insert (priv->env_links, g_strdup (name), priv->env.tail);
+    }
 }
 
 const gchar *
 session_get_env (Session *session, const gchar *name)
 {
+    g_return_val_if_fail (session != NULL, NULL);
+
     GList *link = find_env_entry (session, name);
     if (!link)
         return NULL;
@@ -346,8 +426,10 @@ session_unset_env (Session *session, const gchar *name)
     if (!link)
         return;
 
+    memory_usage_remove (MEMORY_POOL_SESSION_ENVIRONMENTS, strlen (link->data) + 1);
     g_free (link->data);
-    priv->env = g_list_delete_link (priv->env, link);
+    g_queue_delete_link (&priv->env, link);
+    g_hash_table_remove (priv->env_links, name);
 }
 
 void
@@ -358,6 +440,14 @@ session_set_argv (Session *session, gchar **argv)
     priv->argv = g_strdupv (argv);
 }
 
+void
+session_set_stop_timeout (Session *session, guint stop_timeout)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    priv->stop_timeout = stop_timeout;
+}
+
 User *
 session_get_user (Session *session)
 {
@@ -374,14 +464,67 @@ session_get_user (Session *session)
     return priv->user;
 }
 
+static void
+wipe_buffer (GByteArray *buffer)
+{
+    /* Frames may contain passwords */
+    volatile guint8 *data = buffer->data;
+    for (guint i = 0; i < buffer->len; i++)
+        data[i] = 0;
+}
+
 static void
 write_data (Session *session, const void *buf, size_t count)
 {
     SessionPrivate *priv = session_get_instance_private (session);
+
+    if (priv->framed)
+    {
+        g_byte_array_append (priv->to_child_buffer, buf, count);
+        return;
+    }
+
     if (write (priv->to_child_input, buf, count) != count)
         l_warning (session, "Error writing to session: %s", strerror (errno));
 }
 
+static void
+write_to_child (Session *session, const guint8 *data, gsize remaining)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    while (remaining > 0)
+    {
+        ssize_t n_written = write (priv->to_child_input, data, remaining);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written <= 0)
+        {
+            l_warning (session, "Error writing to session: %s", strerror (errno));
+            break;
+        }
+        data += n_written;
+        remaining -= n_written;
+    }
+}
+
+/* Send the message built up since the last flush as a single frame */
+static void
+flush_to_child (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    if (!priv->framed || priv->to_child_buffer->len == sizeof (guint32))
+        return;
+
+    guint32 length = priv->to_child_buffer->len - sizeof (guint32);
+    memcpy (priv->to_child_buffer->data, &length, sizeof (length));
+    write_to_child (session, priv->to_child_buffer->data, priv->to_child_buffer->len);
+
+    wipe_buffer (priv->to_child_buffer);
+    g_byte_array_set_size (priv->to_child_buffer, sizeof (guint32));
+}
+
 static void
 write_string (Session *session, const char *value)
 {
@@ -414,15 +557,87 @@ write_xauth (Session *session, XAuthority *x_authority)
     write_data (session, x_authority_get_authorization_data (priv->x_authority), length);
 }
 
+static ssize_t
+read_fully_from_child (Session *session, void *buf, size_t count)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    guint8 *data = buf;
+    size_t n_total = 0;
+    while (n_total < count)
+    {
+        ssize_t n_read = read (priv->from_child_output, data + n_total, count - n_total);
+        if (n_read < 0 && errno == EINTR)
+            continue;
+        if (n_read < 0)
+        {
+            l_warning (session, "Error reading from session: %s", strerror (errno));
+            return n_read;
+        }
+        if (n_read == 0)
+            break;
+        n_total += n_read;
+    }
+
+    return n_total;
+}
+
 static ssize_t
 read_from_child (Session *session, void *buf, size_t count)
 {
     SessionPrivate *priv = session_get_instance_private (session);
 
-    ssize_t n_read = read (priv->from_child_output, buf, count);
-    if (n_read < 0)
-        l_warning (session, "Error reading from session: %s", strerror (errno));
-    return n_read;
+    if (!priv->framed)
+    {
+        ssize_t n_read = read (priv->from_child_output, buf, count);
+        if (n_read < 0)
+            l_warning (session, "Error reading from session: %s", strerror (errno));
+        return n_read;
+    }
+
+    if (count == 0)
+        return 0;
+
+    /* The child only replies to complete messages */
+    flush_to_child (session);
+
+    /* Get the next frame once the last one is used up */
+    if (priv->from_child_offset >= priv->from_child_buffer->len)
+    {
+        wipe_buffer (priv->from_child_buffer);
+        g_byte_array_set_size (priv->from_child_buffer, 0);
+        priv->from_child_offset = 0;
+
+        guint32 length;
+        ssize_t n_read = read_fully_from_child (session, &length, sizeof (length));
+        if (n_read <= 0)
+            return n_read;
+        if (n_read != sizeof (length) || length > MAX_FRAME_LENGTH)
+        {
+            l_warning (session, "Invalid frame from session");
+            return -1;
+        }
+
+        g_byte_array_set_size (priv->from_child_buffer, length);
+        if (read_fully_from_child (session, priv->from_child_buffer->data, length) != length)
+        {
+            l_warning (session, "Short frame from session");
+            g_byte_array_set_size (priv->from_child_buffer, 0);
+            return -1;
+        }
+    }
+
+    if (priv->from_child_buffer->len - priv->from_child_offset < count)
+    {
+        l_warning (session, "Message from session is shorter than expected");
+        priv->from_child_offset = priv->from_child_buffer->len;
+        return -1;
+    }
+
+    memcpy (buf, priv->from_child_buffer->data + priv->from_child_offset, count);
+    priv->from_child_offset += count;
+
+    return count;
 }
 
 static gchar *
@@ -470,6 +685,8 @@ session_watch_cb (GPid pid, gint status, gpointer data)
         priv->authentication_result = PAM_CONV_ERR;
         g_free (priv->authentication_result_string);
         priv->authentication_result_string = g_strdup ("Authentication stopped before completion");
+        n_authentications_failed++;
+        trace_end (session, "authentication");
         g_signal_emit (G_OBJECT (session), signals[AUTHENTICATION_COMPLETE], 0);
     }
 
@@ -483,6 +700,46 @@ session_watch_cb (GPid pid, gint status, gpointer data)
     g_object_unref (session);
 }
 
+/* Read how long the child took for each PAM call and other setup step, and add them to the statistics */
+static void
+read_step_timings (Session *session, const gchar *phase)
+{
+    guint n_timings = 0;
+    if (read_from_child (session, &n_timings, sizeof (n_timings)) <= 0 || n_timings > MAX_STEP_TIMINGS)
+        return;
+
+    g_autoptr(GString) summary = g_string_new ("");
+    for (guint i = 0; i < n_timings; i++)
+    {
+        g_autofree gchar *name = read_string_from_child (session);
+        gint64 start_time = 0, end_time = 0;
+        read_from_child (session, &start_time, sizeof (start_time));
+        read_from_child (session, &end_time, sizeof (end_time));
+        if (!name || end_time < start_time)
+            continue;
+
+        trace_add (name, start_time, end_time);
+        g_string_append_printf (summary, "%s%s %.1fms", summary->len > 0 ? ", " : "", name, (end_time - start_time) / 1000.0);
+    }
+
+    if (summary->len > 0)
+        l_debug (session, "%s steps: %s", phase, summary->str);
+}
+
+/* Get the session setup timings the child sends just before running the command */
+static gboolean
+session_timings_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    Session *session = data;
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    priv->from_child_watch = 0;
+    if (condition & G_IO_IN)
+        read_step_timings (session, "Session");
+
+    return G_SOURCE_REMOVE;
+}
+
 static gboolean
 from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
 {
@@ -497,13 +754,7 @@ from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
     }
 
     /* Get the username currently being authenticated (may change during authentication) */
-    g_autofree gchar *username = read_string_from_child (session);
-    if (g_strcmp0 (username, priv->username) != 0)
-    {
-        g_free (priv->username);
-        priv->username = g_steal_pointer (&username);
-        g_clear_object (&priv->user);
-    }
+    change_username (session, read_string_from_child (session));
 
     /* Check if authentication completed */
     gboolean auth_complete;
@@ -522,12 +773,18 @@ from_child_cb (GIOChannel *source, GIOCondition condition, gpointer data)
         read_from_child (session, &priv->authentication_result, sizeof (priv->authentication_result));
         g_free (priv->authentication_result_string);
         priv->authentication_result_string = read_string_from_child (session);
+        read_step_timings (session, "Authentication");
 
         l_debug (session, "Authentication complete with return value %d: %s", priv->authentication_result, priv->authentication_result_string);
 
         /* No longer expect any more messages */
         priv->from_child_watch = 0;
 
+        if (priv->authentication_result == PAM_SUCCESS)
+            n_authentications_succeeded++;
+        else
+            n_authentications_failed++;
+        trace_end (session, "authentication");
         g_signal_emit (G_OBJECT (session), signals[AUTHENTICATION_COMPLETE], 0);
 
         return FALSE;
@@ -563,7 +820,15 @@ gboolean
 session_get_is_started (Session *session)
 {
     SessionPrivate *priv = session_get_instance_private (session);
-    return priv->pid != 0;
+    return priv->pid != 0 || priv->guest_setup_pending || priv->external_started;
+}
+
+GPid
+session_get_pid (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_val_if_fail (session != NULL, 0);
+    return priv->pid > 0 ? priv->pid : 0;
 }
 
 static Greeter *
@@ -574,12 +839,97 @@ create_greeter_cb (GreeterSocket *socket, Session *session)
     return greeter;
 }
 
+static gboolean start_child (Session *session);
+
+static void
+guest_setup_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(Session) session = data;
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    priv->guest_setup_pending = FALSE;
+    g_autofree gchar *username = guest_account_setup_finish (result);
+
+    /* Stopped while the account was being created */
+    if (priv->stopping)
+    {
+        if (username)
+            guest_account_cleanup (username);
+        return;
+    }
+
+    if (username)
+    {
+        change_username (session, g_steal_pointer (&username));
+        if (start_child (session))
+            return;
+    }
+
+    /* Report the same way as a session that fails authentication */
+    priv->authentication_complete = TRUE;
+    priv->authentication_result = PAM_SYSTEM_ERR;
+    g_free (priv->authentication_result_string);
+    priv->authentication_result_string = g_strdup ("Failed to create guest account");
+    g_signal_emit (G_OBJECT (session), signals[AUTHENTICATION_COMPLETE], 0);
+}
+
+void
+session_set_external (Session *session, gboolean external)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_return_if_fail (session != NULL);
+    g_return_if_fail (!session_get_is_started (session));
+    priv->external = external;
+}
+
+static gboolean
+external_authenticate_cb (gpointer data)
+{
+    Session *session = data;
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    priv->external_authenticate_timeout = 0;
+
+    /* Nothing to authenticate, whatever runs the session has done that */
+    priv->authentication_complete = TRUE;
+    priv->authentication_result = PAM_SUCCESS;
+    g_signal_emit (G_OBJECT (session), signals[AUTHENTICATION_COMPLETE], 0);
+
+    return G_SOURCE_REMOVE;
+}
+
 static gboolean
 session_real_start (Session *session)
 {
     SessionPrivate *priv = session_get_instance_private (session);
 
     g_return_val_if_fail (priv->pid == 0, FALSE);
+    g_return_val_if_fail (!priv->guest_setup_pending, FALSE);
+
+    /* Complete like a child would, after returning */
+    if (priv->external)
+    {
+        priv->external_started = TRUE;
+        priv->external_authenticate_timeout = g_idle_add (external_authenticate_cb, session);
+        return TRUE;
+    }
+
+    /* Create the guest account if it is one, the setup script can take a
+     * while so continue when it completes */
+    if (priv->is_guest && priv->username == NULL)
+    {
+        priv->guest_setup_pending = TRUE;
+        guest_account_setup_async (NULL, guest_setup_cb, g_object_ref (session));
+        return TRUE;
+    }
+
+    return start_child (session);
+}
+
+static gboolean
+start_child (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
 
     if (priv->display_server)
         display_server_connect_session (priv->display_server, session);
@@ -602,25 +952,16 @@ session_real_start (Session *session)
     fcntl (priv->to_child_input, F_SETFD, FD_CLOEXEC);
     fcntl (priv->from_child_output, F_SETFD, FD_CLOEXEC);
 
-    /* Create the guest account if it is one */
-    if (priv->is_guest && priv->username == NULL)
-    {
-        priv->username = guest_account_setup ();
-        if (!priv->username)
-            return FALSE;
-    }
-
     /* Run the child */
     g_autofree gchar *arg0 = g_strdup_printf ("%d", to_child_output);
     g_autofree gchar *arg1 = g_strdup_printf ("%d", from_child_input);
-    priv->pid = fork ();
+    priv->pid = session_launcher_spawn (to_child_output, from_child_input);
+    priv->launched = priv->pid > 0;
+    if (!priv->launched)
+        priv->pid = fork ();
     if (priv->pid == 0)
     {
-        /* Run us again in session child mode */
-        execlp ("lightdm",
-                "lightdm",
-                "--session-child",
-                arg0, arg1, NULL);
+        session_launcher_exec ("--session-child", arg0, arg1);
         _exit (EXIT_FAILURE);
     }
 
@@ -637,15 +978,21 @@ session_real_start (Session *session)
 
     /* Listen for session termination */
     priv->authentication_started = TRUE;
-    priv->child_watch = g_child_watch_add (priv->pid, session_watch_cb, session);
+    n_authentications_started++;
+    trace_begin (session, "authentication");
+    if (priv->launched)
+        priv->child_watch = session_launcher_watch_add (priv->pid, session_watch_cb, session);
+    else
+        priv->child_watch = process_child_watch_add (priv->pid, session_watch_cb, session);
 
     /* Close the ends of the pipes we don't need */
     close (to_child_output);
     close (from_child_input);
 
     /* Indicate what version of the protocol we are using */
-    int version = 3;
+    int version = PROTOCOL_VERSION;
     write_data (session, &version, sizeof (version));
+    priv->framed = version >= FRAMED_PROTOCOL_VERSION;
 
     /* Send configuration */
     write_string (session, priv->pam_service);
@@ -657,6 +1004,7 @@ session_real_start (Session *session)
     write_string (session, priv->remote_host_name);
     write_string (session, priv->xdisplay);
     write_xauth (session, priv->x_authority);
+    flush_to_child (session);
 
     l_debug (session, "Started with service '%s', username '%s'", priv->pam_service, priv->username);
 
@@ -687,6 +1035,44 @@ session_get_console_kit_cookie (Session *session)
     return priv->console_kit_cookie;
 }
 
+static guint8 *
+append_data (guint8 *frame, const void *buf, size_t count)
+{
+    memcpy (frame, buf, count);
+    return frame + count;
+}
+
+/* Send responses in a frame of their own sized up front, so the passwords
+ * are only ever in secure memory and not left behind by the buffer growing */
+static void
+write_responses (Session *session, struct pam_response *response)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    guint32 length = sizeof (int);
+    for (size_t i = 0; i < priv->messages_length; i++)
+        length += sizeof (int) + (response[i].resp ? strlen (response[i].resp) : 0) + sizeof (response[i].resp_retcode);
+
+    gsize frame_length = sizeof (length) + length;
+    guint8 *frame = secure_memory_alloc (frame_length, priv->lock_memory);
+    guint8 *p = append_data (frame, &length, sizeof (length));
+    int error = PAM_SUCCESS;
+    p = append_data (p, &error, sizeof (error));
+    for (size_t i = 0; i < priv->messages_length; i++)
+    {
+        int resp_length = response[i].resp ? strlen (response[i].resp) : -1;
+        p = append_data (p, &resp_length, sizeof (resp_length));
+        if (response[i].resp)
+            p = append_data (p, response[i].resp, resp_length);
+        p = append_data (p, &response[i].resp_retcode, sizeof (response[i].resp_retcode));
+    }
+
+    /* Anything queued goes first */
+    flush_to_child (session);
+    write_to_child (session, frame, frame_length);
+    secure_memory_free (frame, frame_length, priv->lock_memory);
+}
+
 void
 session_respond (Session *session, struct pam_response *response)
 {
@@ -694,12 +1080,17 @@ session_respond (Session *session, struct pam_response *response)
 
     g_return_if_fail (session != NULL);
 
-    int error = PAM_SUCCESS;
-    write_data (session, &error, sizeof (error));
-    for (size_t i = 0; i < priv->messages_length; i++)
+    if (priv->framed)
+        write_responses (session, response);
+    else
     {
-        write_string (session, response[i].resp);
-        write_data (session, &response[i].resp_retcode, sizeof (response[i].resp_retcode));
+        int error = PAM_SUCCESS;
+        write_data (session, &error, sizeof (error));
+        for (size_t i = 0; i < priv->messages_length; i++)
+        {
+            write_string (session, response[i].resp);
+            write_data (session, &response[i].resp_retcode, sizeof (response[i].resp_retcode));
+        }
     }
 
     /* Delete the old messages */
@@ -717,6 +1108,7 @@ session_respond_error (Session *session, int error)
     g_return_if_fail (error != PAM_SUCCESS);
 
     write_data (session, &error, sizeof (error));
+    flush_to_child (session);
 }
 
 size_t
@@ -776,23 +1168,20 @@ session_get_is_run (Session *session)
     return priv->command_run;
 }
 
+/* Send the child what it needs to set up the session and run the command,
+ * if hold is TRUE it waits for send_release () before running it */
 static void
-session_real_run (Session *session)
+send_run (Session *session, gboolean hold)
 {
     SessionPrivate *priv = session_get_instance_private (session);
 
-    g_return_if_fail (session != NULL);
-    g_return_if_fail (!priv->command_run);
-    g_return_if_fail (session_get_is_authenticated (session));
-    g_return_if_fail (priv->argv != NULL);
-    g_return_if_fail (priv->pid != 0);
+    trace_begin (session, "session-run");
 
-    display_server_connect_session (priv->display_server, session);
-
-    priv->command_run = TRUE;
-
-    g_autofree gchar *command = g_strjoinv (" ", priv->argv);
-    l_debug (session, "Running command %s", command);
+    if (logger_get_debug_enabled ())
+    {
+        g_autofree gchar *command = g_strjoinv (" ", priv->argv);
+        l_debug (session, "Running command %s", command);
+    }
 
     /* Create authority location */
     g_autofree gchar *x_authority_filename = NULL;
@@ -850,21 +1239,112 @@ session_real_run (Session *session)
         l_debug (session, "Logging to %s", priv->log_filename);
     write_string (session, priv->log_filename);
     write_data (session, &priv->log_mode, sizeof (priv->log_mode));
+    if (priv->log_mode == LOG_MODE_ROTATE)
+        write_data (session, log_file_get_limits (), sizeof (LogLimits));
     write_string (session, priv->tty);
     write_string (session, x_authority_filename);
     write_string (session, priv->xdisplay);
     write_xauth (session, priv->x_authority);
-    gsize argc = g_list_length (priv->env);
+    gsize argc = g_queue_get_length (&priv->env);
     write_data (session, &argc, sizeof (argc));
-    for (GList *link = priv->env; link; link = link->next)
+    for (GList *link = priv->env.head; link; link = link->next)
         write_string (session, (gchar *) link->data);
     argc = g_strv_length (priv->argv);
     write_data (session, &argc, sizeof (argc));
     for (gsize i = 0; i < argc; i++)
         write_string (session, priv->argv[i]);
+    write_data (session, &hold, sizeof (hold));
+    write_data (session, &priv->stop_timeout, sizeof (priv->stop_timeout));
+    flush_to_child (session);
+}
 
+static void
+send_release (Session *session, gboolean run_command)
+{
+    write_data (session, &run_command, sizeof (run_command));
+    flush_to_child (session);
+}
+
+static void
+read_session_ids (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    /* The child sends these once the session is registered, just before it runs the command */
     priv->login1_session_id = read_string_from_child (session);
     priv->console_kit_cookie = read_string_from_child (session);
+    trace_end (session, "session-run");
+
+    /* Then how long setting it up took, which may come after writing the X authority */
+    if (priv->from_child_channel && priv->from_child_watch == 0)
+        priv->from_child_watch = g_io_add_watch (priv->from_child_channel, G_IO_IN | G_IO_HUP, session_timings_cb, session);
+}
+
+static gboolean
+session_can_run (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_val_if_fail (!priv->command_run, FALSE);
+    g_return_val_if_fail (session_get_is_authenticated (session), FALSE);
+    g_return_val_if_fail (priv->argv != NULL, FALSE);
+    g_return_val_if_fail (priv->pid != 0 || priv->external, FALSE);
+
+    return TRUE;
+}
+
+void
+session_prepare (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+    g_return_if_fail (priv->display_server != NULL);
+    g_return_if_fail (!priv->held);
+
+    if (!session_can_run (session) || priv->external)
+        return;
+
+    l_debug (session, "Setting up session before running it");
+    display_server_connect_session (priv->display_server, session);
+    send_run (session, TRUE);
+    priv->held = TRUE;
+}
+
+static void
+session_real_run (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+
+    /* Already set up, just let the command run */
+    if (priv->held)
+    {
+        priv->held = FALSE;
+        priv->command_run = TRUE;
+        send_release (session, TRUE);
+        read_session_ids (session);
+        return;
+    }
+
+    if (!session_can_run (session))
+        return;
+
+    display_server_connect_session (priv->display_server, session);
+
+    priv->command_run = TRUE;
+    if (priv->external)
+        return;
+    send_run (session, FALSE);
+    read_session_ids (session);
+}
+
+/* Get the authentication counts for all sessions, as returned by the D-Bus Statistics interface */
+GVariant *
+session_get_statistics (void)
+{
+    return g_variant_new ("(ttt)", n_authentications_started, n_authentications_succeeded, n_authentications_failed);
 }
 
 void
@@ -931,8 +1411,17 @@ session_stop (Session *session)
     if (getuid () == 0 && priv->login1_session_id)
         login1_service_terminate_session (login1_service_get_instance (), priv->login1_session_id);
 
+    /* Set up but never run, let the child close the session */
+    if (priv->held)
+    {
+        priv->held = FALSE;
+        priv->command_run = TRUE;
+        send_release (session, FALSE);
+        return;
+    }
+
     /* If can cleanly stop then do that */
-    if (session_get_is_authenticated (session) && !priv->command_run)
+    if (session_get_is_authenticated (session) && !priv->command_run && !priv->external)
     {
         priv->command_run = TRUE;
         write_string (session, NULL); // log filename
@@ -945,6 +1434,11 @@ session_stop (Session *session)
         gsize n = 0;
         write_data (session, &n, sizeof (n)); // environment
         write_data (session, &n, sizeof (n)); // command
+        gboolean hold = FALSE;
+        write_data (session, &hold, sizeof (hold)); // hold
+        guint stop_timeout = 0;
+        write_data (session, &stop_timeout, sizeof (stop_timeout)); // stop timeout
+        flush_to_child (session);
         return;
     }
 
@@ -958,6 +1452,8 @@ session_real_stop (Session *session)
 
     g_return_if_fail (session != NULL);
 
+    g_clear_handle_id (&priv->external_authenticate_timeout, g_source_remove);
+
     if (priv->pid > 0)
     {
         l_debug (session, "Sending SIGTERM");
@@ -968,6 +1464,20 @@ session_real_stop (Session *session)
         g_signal_emit (G_OBJECT (session), signals[STOPPED], 0);
 }
 
+void
+session_kill (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    g_return_if_fail (session != NULL);
+
+    if (priv->pid > 0)
+    {
+        l_debug (session, "Sending SIGKILL");
+        kill (priv->pid, SIGKILL);
+    }
+}
+
 gboolean
 session_get_is_stopping (Session *session)
 {
@@ -982,9 +1492,15 @@ session_init (Session *session)
     SessionPrivate *priv = session_get_instance_private (session);
 
     priv->log_filename = g_strdup (".xsession-errors");
-    priv->log_mode = LOG_MODE_BACKUP_AND_TRUNCATE;
+    priv->log_mode = log_file_get_mode (TRUE);
     priv->to_child_input = -1;
     priv->from_child_output = -1;
+    priv->to_child_buffer = g_byte_array_new ();
+    g_byte_array_set_size (priv->to_child_buffer, sizeof (guint32));
+    priv->from_child_buffer = g_byte_array_new ();
+    priv->lock_memory = config_get_boolean (config_get_instance (), "LightDM", "lock-memory");
+    g_queue_init (&priv->env);
+    priv->env_links = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
@@ -995,15 +1511,25 @@ session_finalize (GObject *object)
 
     g_clear_object (&priv->config);
     g_clear_object (&priv->display_server);
+    g_clear_handle_id (&priv->external_authenticate_timeout, g_source_remove);
     if (priv->pid)
         kill (priv->pid, SIGKILL);
     close (priv->to_child_input);
     close (priv->from_child_output);
     g_clear_pointer (&priv->from_child_channel, g_io_channel_unref);
+    wipe_buffer (priv->to_child_buffer);
+    g_byte_array_unref (priv->to_child_buffer);
+    wipe_buffer (priv->from_child_buffer);
+    g_byte_array_unref (priv->from_child_buffer);
     if (priv->from_child_watch)
         g_source_remove (priv->from_child_watch);
     if (priv->child_watch)
-        g_source_remove (priv->child_watch);
+    {
+        if (priv->launched)
+            session_launcher_watch_remove (priv->child_watch);
+        else
+            g_source_remove (priv->child_watch);
+    }
     g_clear_pointer (&priv->username, g_free);
     g_clear_object (&priv->user);
     g_clear_pointer (&priv->pam_service, g_free);
@@ -1018,7 +1544,10 @@ session_finalize (GObject *object)
     g_clear_pointer (&priv->remote_host_name, g_free);
     g_clear_pointer (&priv->login1_session_id, g_free);
     g_clear_pointer (&priv->console_kit_cookie, g_free);
-    g_list_free_full (priv->env, g_free);
+    for (GList *link = priv->env.head; link; link = link->next)
+        memory_usage_remove (MEMORY_POOL_SESSION_ENVIRONMENTS, strlen (link->data) + 1);
+    g_list_free_full (priv->env.head, g_free);
+    g_hash_table_unref (priv->env_links);
     g_clear_pointer (&priv->argv, g_strfreev);
 
     G_OBJECT_CLASS (session_parent_class)->finalize (object);
@@ -1070,6 +1599,15 @@ session_class_init (SessionClass *klass)
                       NULL, NULL,
                       NULL,
                       G_TYPE_NONE, 0);
+
+    signals[USERNAME_CHANGED] =
+        g_signal_new (SESSION_SIGNAL_USERNAME_CHANGED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SessionClass, username_changed),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
 }
 
 static gint
@@ -43,6 +43,7 @@ G_BEGIN_DECLS
 #define SESSION_SIGNAL_GOT_MESSAGES            "got-messages"
 #define SESSION_SIGNAL_AUTHENTICATION_COMPLETE "authentication-complete"
 #define SESSION_SIGNAL_STOPPED                 "stopped"
+#define SESSION_SIGNAL_USERNAME_CHANGED        "username-changed"
 
 struct Session
 {
@@ -61,6 +62,7 @@ typedef struct
     void (*got_messages)(Session *session);
     void (*authentication_complete)(Session *session);
     void (*stopped)(Session *session);
+    void (*username_changed)(Session *session);
 } SessionClass;
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (Session, g_object_unref)
@@ -99,6 +101,8 @@ void session_set_xdisplay (Session *session, const gchar *xdisplay);
 
 void session_set_x_authority (Session *session, XAuthority *authority, gboolean use_system_location);
 
+XAuthority *session_get_x_authority (Session *session);
+
 void session_set_remote_host_name (Session *session, const gchar *remote_host_name);
 
 void session_set_env (Session *session, const gchar *name, const gchar *value);
@@ -109,13 +113,19 @@ void session_unset_env (Session *session, const gchar *name);
 
 void session_set_argv (Session *session, gchar **argv);
 
+void session_set_stop_timeout (Session *session, guint stop_timeout);
+
 // FIXME: Remove
 User *session_get_user (Session *session);
 
+void session_set_external (Session *session, gboolean external);
+
 gboolean session_start (Session *session);
 
 gboolean session_get_is_started (Session *session);
 
+GPid session_get_pid (Session *session);
+
 const gchar *session_get_username (Session *session);
 
 const gchar *session_get_login1_session_id (Session *session);
@@ -136,6 +146,8 @@ int session_get_authentication_result (Session *session);
 
 const gchar *session_get_authentication_result_string (Session *session);
 
+void session_prepare (Session *session);
+
 void session_run (Session *session);
 
 gboolean session_get_is_run (Session *session);
@@ -148,8 +160,12 @@ void session_activate (Session *session);
 
 void session_stop (Session *session);
 
+void session_kill (Session *session);
+
 gboolean session_get_is_stopping (Session *session);
 
+GVariant *session_get_statistics (void);
+
 G_END_DECLS
 
 #endif /* SESSION_H_ */
@@ -13,19 +13,38 @@
 #include <gio/gio.h>
 #include <pwd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
 
 #include "configuration.h"
 #include "shared-data-manager.h"
 #include "user-list.h"
+#include "worker.h"
 
 #define NUM_ENUMERATION_FILES 100
 
+/* File in USERS_DIR to cache users in, hidden so it isn't confused with a user's directory */
+#define USER_CACHE_FILE ".user-cache"
+
+/* Seconds to wait after a user change before saving the user cache */
+#define USER_CACHE_SAVE_DELAY 5
+
 typedef struct
 {
     gchar *greeter_user;
     guint32 greeter_gid;
     GHashTable *starting_dirs;
+
+    /* Directories known to exist with the right owner, keyed by path with the owning uid */
+    GHashTable *checked_dirs;
+
+    /* Timeout to save the user cache */
+    guint save_user_cache_timeout;
 } SharedDataManagerPrivate;
 
 struct OwnerInfo
@@ -52,35 +71,89 @@ shared_data_manager_cleanup (void)
     g_clear_object (&singleton);
 }
 
-static void
-delete_unused_user (gpointer key, gpointer value, gpointer user_data)
+/* Delete a directory tree without following symbolic links in it */
+static gboolean
+remove_recursive (int parent_fd, const gchar *name)
 {
-    const gchar *user = (const gchar *)key;
+    int fd = openat (parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        /* Not a directory (or a link to one), so just remove it */
+        if (errno == ENOTDIR || errno == ELOOP)
+            return unlinkat (parent_fd, name, 0) == 0 || errno == ENOENT;
+        return errno == ENOENT;
+    }
 
-    /* For this operation, we just need a fire and forget rm -rf.  Since
-       recursively deleting in GIO is a huge pain in the butt, we'll just drop
-       to shell for this. */
+    DIR *dir = fdopendir (fd);
+    if (!dir)
+    {
+        close (fd);
+        return FALSE;
+    }
 
-    g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
-    g_autofree gchar *quoted_path = g_shell_quote (path);
-    g_autofree gchar *cmd = g_strdup_printf ("/bin/rm -rf %s", quoted_path);
+    gboolean result = TRUE;
+    struct dirent *entry;
+    while ((entry = readdir (dir)))
+    {
+        if (strcmp (entry->d_name, ".") == 0 || strcmp (entry->d_name, "..") == 0)
+            continue;
+
+        if (entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN)
+            result = remove_recursive (dirfd (dir), entry->d_name) && result;
+        else if (unlinkat (dirfd (dir), entry->d_name, 0) < 0 && errno != ENOENT)
+            result = FALSE;
+    }
+    closedir (dir);
+
+    if (unlinkat (parent_fd, name, AT_REMOVEDIR) < 0 && errno != ENOENT)
+        return FALSE;
+
+    return result;
+}
+
+static gboolean
+delete_user_dir_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    const gchar *name = data;
+
+    if (!remove_recursive (AT_FDCWD, name))
+    {
+        int errsv = errno;
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv), "%s", g_strerror (errsv));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+delete_user_dir_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autofree gchar *path = data;
 
     g_autoptr(GError) error = NULL;
-    g_spawn_command_line_async (cmd, &error);
-    if (error)
-        g_warning ("Could not delete unused user data directory %s: %s", path, error->message);
+    if (!worker_run_finish (result, &error))
+        g_warning ("Could not delete unused user data directory %s: %s", path, error ? error->message : "unknown error");
 }
 
-gchar *
-shared_data_manager_ensure_user_dir (SharedDataManager *manager, const gchar *user)
+static void
+delete_unused_user (gpointer key, gpointer value, gpointer user_data)
 {
+    SharedDataManager *manager = user_data;
     SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
-
-    struct passwd *entry = getpwnam (user);
-    if (!entry)
-        return NULL;
+    const gchar *user = (const gchar *)key;
 
     g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
+    g_hash_table_remove (priv->checked_dirs, path);
+
+    /* Delete in a worker thread so large directories don't hold up the main loop */
+    g_debug ("Deleting unused user data directory %s", path);
+    worker_run (delete_user_dir_thread, g_strdup (path), g_free, NULL, delete_user_dir_cb, g_strdup (path));
+}
+
+static gboolean
+make_user_dir (const gchar *path, guint32 uid, guint32 gid)
+{
     g_autoptr(GFile) file = g_file_new_for_path (path);
 
     g_debug ("Creating shared data directory %s", path);
@@ -98,27 +171,150 @@ shared_data_manager_ensure_user_dir (SharedDataManager *manager, const gchar *us
             g_warning ("Could not create user data directory %s: %s", path, error->message);
     }
     if (!result)
-    {
-        g_clear_pointer (&path, g_free);
-        return NULL;
-    }
+        return FALSE;
 
     /* Even if the directory already exists, we want to re-affirm the owners
        because the greeter gid is configuration based and may change between
-       runs. */
+       runs. Leave it alone if it is already right. */
+    GStatBuf buf;
+    if (g_lstat (path, &buf) == 0 && S_ISDIR (buf.st_mode) && buf.st_uid == uid && buf.st_gid == gid && (buf.st_mode & 07777) == 0770)
+        return TRUE;
+
     g_autoptr(GFileInfo) info = g_file_info_new ();
-    g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID, entry->pw_uid);
-    g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID, priv->greeter_gid);
+    g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID, uid);
+    g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID, gid);
     g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE, 0770);
     result = g_file_set_attributes_from_info (file, info, G_FILE_QUERY_INFO_NONE, NULL, &error);
     if (error)
         g_warning ("Could not chown user data directory %s: %s", path, error->message);
-    if (!result)
+
+    return result;
+}
+
+static gboolean
+is_checked (SharedDataManager *manager, const gchar *path, guint32 uid)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    gpointer value;
+    return g_hash_table_lookup_extended (priv->checked_dirs, path, NULL, &value) && GPOINTER_TO_UINT (value) == uid;
+}
+
+gchar *
+shared_data_manager_ensure_user_dir (SharedDataManager *manager, const gchar *user)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    CommonUser *entry = common_user_list_get_user_by_name (common_user_list_get_instance (), user);
+    if (!entry)
         return NULL;
+    uid_t uid = common_user_get_uid (entry);
+    g_object_unref (entry);
+
+    g_autofree gchar *path = g_build_filename (USERS_DIR, user, NULL);
+    if (is_checked (manager, path, uid))
+        return g_steal_pointer (&path);
+    if (!make_user_dir (path, uid, priv->greeter_gid))
+        return NULL;
+    g_hash_table_insert (priv->checked_dirs, g_strdup (path), GUINT_TO_POINTER (uid));
 
     return g_steal_pointer (&path);
 }
 
+typedef struct
+{
+    gchar *path;
+    guint32 uid;
+    guint32 gid;
+
+    /* TRUE if already known to be set up */
+    gboolean checked;
+} EnsureUserDir;
+
+static void
+ensure_user_dir_free (EnsureUserDir *data)
+{
+    g_free (data->path);
+    g_free (data);
+}
+
+static gboolean
+ensure_user_dir_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    EnsureUserDir *d = data;
+
+    /* No such user */
+    if (!d->path)
+        return FALSE;
+
+    if (d->checked)
+        return TRUE;
+
+    return make_user_dir (d->path, d->uid, d->gid);
+}
+
+void
+shared_data_manager_ensure_user_dir_async (SharedDataManager *manager, const gchar *user, GAsyncReadyCallback callback, gpointer user_data)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    /* Look up the user here, the passwd functions aren't thread safe */
+    EnsureUserDir *data = g_new0 (EnsureUserDir, 1);
+    CommonUser *entry = common_user_list_get_user_by_name (common_user_list_get_instance (), user);
+    if (entry)
+    {
+        data->path = g_build_filename (USERS_DIR, user, NULL);
+        data->uid = common_user_get_uid (entry);
+        data->gid = priv->greeter_gid;
+        data->checked = is_checked (manager, data->path, data->uid);
+        g_object_unref (entry);
+    }
+
+    worker_run (ensure_user_dir_thread, data, (GDestroyNotify) ensure_user_dir_free, NULL, callback, user_data);
+}
+
+gchar *
+shared_data_manager_ensure_user_dir_finish (SharedDataManager *manager, GAsyncResult *result)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    if (!worker_run_finish (result, NULL))
+        return NULL;
+
+    /* Don't check again next time */
+    EnsureUserDir *data = worker_get_data (result);
+    g_hash_table_insert (priv->checked_dirs, g_strdup (data->path), GUINT_TO_POINTER (data->uid));
+
+    return g_steal_pointer (&data->path);
+}
+
+static void
+delete_unused_user_dirs (SharedDataManager *manager)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    // Iterate the current users and as we go, remove the users from the
+    // starting_dirs hash and thus see which users are obsolete.
+    GList *users = common_user_list_get_users (common_user_list_get_instance ());
+    for (GList *link = users; link; link = link->next)
+    {
+        CommonUser *user = link->data;
+        g_hash_table_remove (priv->starting_dirs, common_user_get_name (user));
+    }
+    g_hash_table_foreach (priv->starting_dirs, delete_unused_user, manager);
+    g_hash_table_destroy (priv->starting_dirs);
+    priv->starting_dirs = NULL;
+
+    g_object_unref (manager);
+}
+
+static void
+users_loaded_cb (CommonUserList *user_list, SharedDataManager *manager)
+{
+    g_signal_handlers_disconnect_by_func (user_list, users_loaded_cb, manager);
+    delete_unused_user_dirs (manager);
+}
+
 static void
 next_user_dirs_cb (GObject *object, GAsyncResult *res, gpointer user_data)
 {
@@ -138,7 +334,13 @@ next_user_dirs_cb (GObject *object, GAsyncResult *res, gpointer user_data)
     for (GList *link = files; link; link = link->next)
     {
         GFileInfo *info = link->data;
-        g_hash_table_insert (priv->starting_dirs, g_strdup (g_file_info_get_name (info)), NULL);
+        const gchar *name = g_file_info_get_name (info);
+
+        /* Skip our own files */
+        if (name[0] == '.')
+            continue;
+
+        g_hash_table_insert (priv->starting_dirs, g_strdup (name), NULL);
     }
 
     if (files != NULL)
@@ -148,20 +350,13 @@ next_user_dirs_cb (GObject *object, GAsyncResult *res, gpointer user_data)
     }
     else
     {
-        // We've finally assembled all the initial directories.  Now let's
-        // iterate the current users and as we go, remove the users from the
-        // starting_dirs hash and thus see which users are obsolete.
-        GList *users = common_user_list_get_users (common_user_list_get_instance ());
-        for (GList *link = users; link; link = link->next)
-        {
-            CommonUser *user = link->data;
-            g_hash_table_remove (priv->starting_dirs, common_user_get_name (user));
-        }
-        g_hash_table_foreach (priv->starting_dirs, delete_unused_user, manager);
-        g_hash_table_destroy (priv->starting_dirs);
-        priv->starting_dirs = NULL;
-
-        g_object_unref (manager);
+        // We've finally assembled all the initial directories.  Wait until
+        // all the users are known before working out which are obsolete.
+        CommonUserList *user_list = common_user_list_get_instance ();
+        if (common_user_list_get_is_loaded (user_list))
+            delete_unused_user_dirs (manager);
+        else
+            g_signal_connect (user_list, USER_LIST_SIGNAL_LOADED, G_CALLBACK (users_loaded_cb), manager);
     }
 }
 
@@ -191,6 +386,67 @@ user_removed_cb (CommonUserList *list, CommonUser *user, SharedDataManager *mana
     delete_unused_user ((gpointer) common_user_get_name (user), NULL, manager);
 }
 
+static gboolean
+save_user_cache_cb (gpointer data)
+{
+    SharedDataManager *manager = data;
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    priv->save_user_cache_timeout = 0;
+
+    g_autofree gchar *path = g_build_filename (USERS_DIR, USER_CACHE_FILE, NULL);
+    g_autoptr(GError) error = NULL;
+    if (common_user_list_save_cache (common_user_list_get_instance (), path, &error))
+        g_debug ("Saved user cache %s", path);
+    else
+        g_warning ("Failed to save user cache %s: %s", path, error->message);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_save_user_cache (SharedDataManager *manager)
+{
+    SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
+
+    /* Wait until all users are loaded, and group together changes made in quick succession */
+    if (!common_user_list_get_is_loaded (common_user_list_get_instance ()) || priv->save_user_cache_timeout != 0)
+        return;
+    priv->save_user_cache_timeout = g_timeout_add_seconds (USER_CACHE_SAVE_DELAY, save_user_cache_cb, manager);
+}
+
+static void
+user_list_loaded_cb (CommonUserList *list, SharedDataManager *manager)
+{
+    /* Read the .dmrc files now so they are cached for the greeters */
+    common_user_list_prefetch_dmrc (list);
+    schedule_save_user_cache (manager);
+}
+
+static void
+user_list_changed_cb (CommonUserList *list, CommonUser *user, SharedDataManager *manager)
+{
+    schedule_save_user_cache (manager);
+}
+
+void
+shared_data_manager_load_users (SharedDataManager *manager)
+{
+    CommonUserList *user_list = common_user_list_get_instance ();
+
+    /* Use the users from last time until they are loaded in the background */
+    g_autofree gchar *path = g_build_filename (USERS_DIR, USER_CACHE_FILE, NULL);
+    common_user_list_load_cache (user_list, path);
+
+    /* Keep the cache up to date */
+    g_signal_connect (user_list, USER_LIST_SIGNAL_LOADED, G_CALLBACK (user_list_loaded_cb), manager);
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (user_list_changed_cb), manager);
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USER_CHANGED, G_CALLBACK (user_list_changed_cb), manager);
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USER_REMOVED, G_CALLBACK (user_list_changed_cb), manager);
+
+    common_user_list_load_async (user_list);
+}
+
 void
 shared_data_manager_start (SharedDataManager *manager)
 {
@@ -210,6 +466,8 @@ shared_data_manager_init (SharedDataManager *manager)
 {
     SharedDataManagerPrivate *priv = shared_data_manager_get_instance_private (manager);
 
+    priv->checked_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
     /* Grab current greeter-user gid */
     priv->greeter_user = config_get_string (config_get_instance (), "LightDM", "greeter-user");
     struct passwd *greeter_entry = getpwnam (priv->greeter_user);
@@ -229,6 +487,9 @@ shared_data_manager_finalize (GObject *object)
 
     if (priv->starting_dirs)
         g_hash_table_destroy (priv->starting_dirs);
+    g_hash_table_destroy (priv->checked_dirs);
+    if (priv->save_user_cache_timeout)
+        g_source_remove (priv->save_user_cache_timeout);
 
     g_clear_pointer (&priv->greeter_user, g_free);
 
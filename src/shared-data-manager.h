@@ -12,7 +12,7 @@
 #ifndef SHARED_DATA_MANAGER_H_
 #define SHARED_DATA_MANAGER_H_
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 typedef struct SharedDataManager SharedDataManager;
 
@@ -39,12 +39,18 @@ GType shared_data_manager_get_type (void);
 
 SharedDataManager *shared_data_manager_get_instance (void);
 
+void shared_data_manager_load_users (SharedDataManager *manager);
+
 void shared_data_manager_start (SharedDataManager *manager);
 
 void shared_data_manager_cleanup (void);
 
 gchar *shared_data_manager_ensure_user_dir (SharedDataManager *manager, const gchar *user);
 
+void shared_data_manager_ensure_user_dir_async (SharedDataManager *manager, const gchar *user, GAsyncReadyCallback callback, gpointer user_data);
+
+gchar *shared_data_manager_ensure_user_dir_finish (SharedDataManager *manager, GAsyncResult *result);
+
 G_END_DECLS
 
 #endif /* SHARED_DATA_MANAGER_H_ */
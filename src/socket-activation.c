@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "socket-activation.h"
+
+/*
+ * systemd passes listening sockets starting at file descriptor 3, with
+ * LISTEN_FDS set to how many there are and LISTEN_PID to the process they are
+ * meant for. They are matched to the servers by family, type and port.
+ */
+
+#define LISTEN_FDS_START 3
+
+/* Sockets passed in and not yet taken */
+static GList *sockets = NULL;
+static gboolean loaded = FALSE;
+
+static void
+load_sockets (void)
+{
+    if (loaded)
+        return;
+    loaded = TRUE;
+
+    const gchar *pid_string = g_getenv ("LISTEN_PID");
+    const gchar *fds_string = g_getenv ("LISTEN_FDS");
+    if (!pid_string || !fds_string || atoi (pid_string) != getpid ())
+        return;
+    gint n_fds = atoi (fds_string);
+
+    /* Don't pass these on to the processes we run */
+    g_unsetenv ("LISTEN_PID");
+    g_unsetenv ("LISTEN_FDS");
+    g_unsetenv ("LISTEN_FDNAMES");
+
+    for (gint fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + n_fds; fd++)
+    {
+        fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+        g_autoptr(GError) error = NULL;
+        GSocket *socket = g_socket_new_from_fd (fd, &error);
+        if (!socket)
+        {
+            g_warning ("Ignoring passed file descriptor %d: %s", fd, error->message);
+            continue;
+        }
+
+        sockets = g_list_append (sockets, socket);
+    }
+
+    g_debug ("Using %u sockets from socket activation", g_list_length (sockets));
+}
+
+static gboolean
+socket_matches (GSocket *socket, GSocketFamily family, GSocketType type, guint port)
+{
+    if (g_socket_get_socket_type (socket) != type)
+        return FALSE;
+    if (family != G_SOCKET_FAMILY_INVALID && g_socket_get_family (socket) != family)
+        return FALSE;
+
+    g_autoptr(GSocketAddress) address = g_socket_get_local_address (socket, NULL);
+    return address && G_IS_INET_SOCKET_ADDRESS (address) &&
+           g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address)) == port;
+}
+
+/* TRUE if a socket of this type was passed in for this port, in which case the address is already decided */
+gboolean
+socket_activation_has_socket (GSocketType type, guint port)
+{
+    load_sockets ();
+
+    for (GList *link = sockets; link; link = link->next)
+        if (socket_matches (link->data, G_SOCKET_FAMILY_INVALID, type, port))
+            return TRUE;
+
+    return FALSE;
+}
+
+GSocket *
+socket_activation_take_socket (GSocketFamily family, GSocketType type, guint port)
+{
+    load_sockets ();
+
+    for (GList *link = sockets; link; link = link->next)
+    {
+        GSocket *socket = link->data;
+        if (socket_matches (socket, family, type, port))
+        {
+            sockets = g_list_delete_link (sockets, link);
+            return socket;
+        }
+    }
+
+    return NULL;
+}
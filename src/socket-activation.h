@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef SOCKET_ACTIVATION_H_
+#define SOCKET_ACTIVATION_H_
+
+#include <gio/gio.h>
+
+gboolean socket_activation_has_socket (GSocketType type, guint port);
+
+GSocket *socket_activation_take_socket (GSocketFamily family, GSocketType type, guint port);
+
+#endif /* SOCKET_ACTIVATION_H_ */
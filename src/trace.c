@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "trace.h"
+#include "logger.h"
+
+/*
+ * Spans are written in the Chrome trace event format, so the file can be
+ * loaded into chrome://tracing or Perfetto. Spans cross main loop callbacks so
+ * they are written as async events, matched on the object they are for.
+ * The closing ']' is optional in this format and is never written, so the
+ * file is valid even if we don't exit cleanly.
+ */
+
+/* File being traced to */
+static int trace_fd = -1;
+
+/* TRUE if an event has been written and the next needs a separator */
+static gboolean have_events = FALSE;
+
+/*
+ * Span durations are also collected into histograms, whether tracing to a
+ * file or not, so they can be reported by the D-Bus Statistics interface.
+ */
+
+/* Upper bounds of the span duration histogram buckets in microseconds, the last bucket has no bound */
+static const guint64 span_bucket_bounds[] =
+{
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000, 10000000
+};
+#define N_SPAN_BUCKETS (G_N_ELEMENTS (span_bucket_bounds) + 1)
+
+/* Maximum number of spans to keep waiting to end, spans that never end are dropped after this */
+#define MAX_OPEN_SPANS 1024
+
+typedef struct
+{
+    gchar *name;
+    guint64 count;
+    guint64 total;
+    guint64 max;
+    guint64 buckets[N_SPAN_BUCKETS];
+} SpanStatistics;
+
+/* Statistics for each span name, in the order they were first seen */
+static GPtrArray *span_statistics = NULL;
+
+/* Start times of spans that haven't ended, keyed by name and object */
+static GHashTable *open_spans = NULL;
+
+void
+trace_init (const gchar *filename)
+{
+    trace_fd = g_open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (trace_fd < 0)
+    {
+        g_warning ("Failed to open trace file %s: %s", filename, strerror (errno));
+        return;
+    }
+
+    if (write (trace_fd, "[\n", 2) < 0)
+        ; /* Check result so compiler doesn't warn about it */
+    g_debug ("Tracing to %s", filename);
+}
+
+static void
+append_escaped (GString *text, const gchar *value)
+{
+    for (const gchar *c = value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            g_string_append_c (text, '\\');
+        if ((guchar) *c < 0x20)
+            g_string_append_printf (text, "\\u%04x", *c);
+        else
+            g_string_append_c (text, *c);
+    }
+}
+
+static void
+write_event (const gchar *name, const gchar *phase, gpointer object, gint64 time, gint64 duration)
+{
+    g_autoptr(GString) text = g_string_new (have_events ? ",\n" : "");
+    have_events = TRUE;
+
+    g_string_append (text, "{\"name\":\"");
+    append_escaped (text, name);
+    g_string_append_printf (text, "\",\"cat\":\"lightdm\",\"ph\":\"%s\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":0", phase, time, getpid ());
+    if (duration >= 0)
+        g_string_append_printf (text, ",\"dur\":%" G_GINT64_FORMAT, duration);
+    else
+        g_string_append_printf (text, ",\"id\":\"0x%" G_GSIZE_MODIFIER "x\"", GPOINTER_TO_SIZE (object));
+
+    /* Tag with the same prefix the object uses in the log */
+    if (object && IS_LOGGER (object))
+    {
+        gint length = logger_logprefix (LOGGER (object), NULL, 0);
+        if (length > 0)
+        {
+            gchar prefix[length + 1];
+            logger_logprefix (LOGGER (object), prefix, sizeof (prefix));
+            g_strchomp (prefix);
+            if (g_str_has_suffix (prefix, ":"))
+                prefix[strlen (prefix) - 1] = '\0';
+
+            g_string_append (text, ",\"args\":{\"object\":\"");
+            append_escaped (text, prefix);
+            g_string_append (text, "\"}");
+        }
+    }
+    g_string_append (text, "}");
+
+    if (write (trace_fd, text->str, text->len) < 0)
+        ; /* Check result so compiler doesn't warn about it */
+}
+
+static void
+add_span (const gchar *name, gint64 duration)
+{
+    if (!span_statistics)
+        span_statistics = g_ptr_array_new ();
+
+    SpanStatistics *statistics = NULL;
+    for (guint i = 0; i < span_statistics->len && statistics == NULL; i++)
+    {
+        SpanStatistics *s = g_ptr_array_index (span_statistics, i);
+        if (strcmp (s->name, name) == 0)
+            statistics = s;
+    }
+    if (!statistics)
+    {
+        statistics = g_malloc0 (sizeof (SpanStatistics));
+        statistics->name = g_strdup (name);
+        g_ptr_array_add (span_statistics, statistics);
+    }
+
+    guint64 value = MAX (duration, 0);
+    statistics->count++;
+    statistics->total += value;
+    statistics->max = MAX (statistics->max, value);
+
+    gsize bucket = 0;
+    while (bucket < G_N_ELEMENTS (span_bucket_bounds) && value >= span_bucket_bounds[bucket])
+        bucket++;
+    statistics->buckets[bucket]++;
+}
+
+static gchar *
+get_span_key (gpointer object, const gchar *name)
+{
+    return g_strdup_printf ("%s %p", name, object);
+}
+
+void
+trace_begin (gpointer object, const gchar *name)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (!open_spans)
+        open_spans = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    if (g_hash_table_size (open_spans) >= MAX_OPEN_SPANS)
+        g_hash_table_remove_all (open_spans);
+    gint64 *start_time = g_new (gint64, 1);
+    *start_time = now;
+    g_hash_table_insert (open_spans, get_span_key (object, name), start_time);
+
+    if (trace_fd >= 0)
+        write_event (name, "b", object, now, -1);
+}
+
+void
+trace_end (gpointer object, const gchar *name)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    g_autofree gchar *key = get_span_key (object, name);
+    gint64 *start_time = open_spans ? g_hash_table_lookup (open_spans, key) : NULL;
+    if (start_time)
+    {
+        add_span (name, now - *start_time);
+        g_hash_table_remove (open_spans, key);
+    }
+
+    if (trace_fd >= 0)
+        write_event (name, "e", object, now, -1);
+}
+
+void
+trace_add (const gchar *name, gint64 start_time, gint64 end_time)
+{
+    add_span (name, end_time - start_time);
+
+    if (trace_fd >= 0)
+        write_event (name, "X", NULL, start_time, end_time - start_time);
+}
+
+/* Get the duration histograms of every span that has completed, as returned by the D-Bus Statistics interface */
+GVariant *
+trace_get_statistics (void)
+{
+    GVariantBuilder bounds;
+    g_variant_builder_init (&bounds, G_VARIANT_TYPE ("at"));
+    for (gsize i = 0; i < G_N_ELEMENTS (span_bucket_bounds); i++)
+        g_variant_builder_add (&bounds, "t", span_bucket_bounds[i]);
+
+    GVariantBuilder spans;
+    g_variant_builder_init (&spans, G_VARIANT_TYPE ("a(stttat)"));
+    for (guint i = 0; span_statistics && i < span_statistics->len; i++)
+    {
+        SpanStatistics *statistics = g_ptr_array_index (span_statistics, i);
+
+        GVariantBuilder buckets;
+        g_variant_builder_init (&buckets, G_VARIANT_TYPE ("at"));
+        for (gsize j = 0; j < N_SPAN_BUCKETS; j++)
+            g_variant_builder_add (&buckets, "t", statistics->buckets[j]);
+
+        g_variant_builder_add (&spans, "(stttat)", statistics->name, statistics->count, statistics->total, statistics->max, &buckets);
+    }
+
+    return g_variant_new ("(@at@a(stttat))", g_variant_builder_end (&bounds), g_variant_builder_end (&spans));
+}
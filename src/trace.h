@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <glib.h>
+
+void trace_init (const gchar *filename);
+
+void trace_begin (gpointer object, const gchar *name);
+
+void trace_end (gpointer object, const gchar *name);
+
+void trace_add (const gchar *name, gint64 start_time, gint64 end_time);
+
+GVariant *trace_get_statistics (void);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "user-prefetch.h"
+#include "shared-data-manager.h"
+#include "worker.h"
+
+/*
+ * When a greeter selects a user they are likely to log in next, so while they
+ * type their password the things starting their session will need are looked
+ * up in the background: their passwd and group entries (which may come from a
+ * network directory), their home directory (which may need to be mounted) and
+ * the files read from it while the session starts. Nothing is kept, this only
+ * gets the system caches ready.
+ */
+
+/* Don't prefetch the same user again within this many seconds */
+#define PREFETCH_INTERVAL 60
+
+/* Files read from the home directory while starting a session */
+static const gchar * const home_files[] = { ".dmrc", ".Xauthority", ".xprofile", ".profile", NULL };
+
+typedef struct
+{
+    gchar *username;
+    gchar *home_directory;
+    uid_t uid;
+    gid_t gid;
+} Prefetch;
+
+/* Users prefetched and when */
+static GHashTable *prefetch_times = NULL;
+
+static void
+prefetch_free (Prefetch *prefetch)
+{
+    g_free (prefetch->username);
+    g_free (prefetch->home_directory);
+    g_free (prefetch);
+}
+
+/* Look up the user the same way as logging in does */
+static gboolean
+lookup_user_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    Prefetch *prefetch = data;
+
+    gsize buffer_size = 4096;
+    g_autofree gchar *buffer = NULL;
+    struct passwd entry, *result = NULL;
+    int errsv;
+    do
+    {
+        buffer = g_realloc (buffer, buffer_size);
+        errsv = getpwnam_r (prefetch->username, &entry, buffer, buffer_size, &result);
+        buffer_size *= 2;
+    } while (errsv == ERANGE);
+    if (!result)
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No such user");
+        return FALSE;
+    }
+
+    prefetch->home_directory = g_strdup (entry.pw_dir);
+    prefetch->uid = entry.pw_uid;
+    prefetch->gid = entry.pw_gid;
+
+    /* Get the groups as initgroups () will */
+    int n_groups = 64;
+    g_autofree gid_t *groups = g_new (gid_t, n_groups);
+    if (getgrouplist (prefetch->username, prefetch->gid, groups, &n_groups) < 0)
+    {
+        groups = g_renew (gid_t, groups, n_groups);
+        getgrouplist (prefetch->username, prefetch->gid, groups, &n_groups);
+    }
+
+    return TRUE;
+}
+
+static void
+read_file (int dir_fd, const gchar *name)
+{
+    int fd = openat (dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return;
+
+    gchar buffer[4096];
+    while (read (fd, buffer, sizeof (buffer)) > 0);
+    close (fd);
+}
+
+/* Access the home directory as the user, this mounts it if necessary */
+static gboolean
+read_home_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    Prefetch *prefetch = data;
+
+    int dir_fd = open (prefetch->home_directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+        return TRUE;
+    for (int i = 0; home_files[i]; i++)
+        read_file (dir_fd, home_files[i]);
+    close (dir_fd);
+
+    return TRUE;
+}
+
+static void
+read_home_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    worker_run_finish (result, NULL);
+}
+
+static void
+lookup_user_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    if (!worker_run_finish (result, &error))
+    {
+        g_debug ("Not prefetching user: %s", error->message);
+        return;
+    }
+
+    Prefetch *done = worker_get_data (result);
+    Prefetch *prefetch = g_new0 (Prefetch, 1);
+    prefetch->username = g_strdup (done->username);
+    prefetch->home_directory = g_strdup (done->home_directory);
+    prefetch->uid = done->uid;
+    prefetch->gid = done->gid;
+    worker_run_as_user (prefetch->uid, prefetch->gid, read_home_thread, prefetch, (GDestroyNotify) prefetch_free, NULL, read_home_cb, NULL);
+}
+
+static void
+ensure_user_dir_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autofree gchar *path = shared_data_manager_ensure_user_dir_finish (shared_data_manager_get_instance (), result);
+}
+
+/* Start getting ready for @username to log in */
+void
+user_prefetch (const gchar *username)
+{
+    if (!username || username[0] == '\0')
+        return;
+
+    if (!prefetch_times)
+        prefetch_times = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    /* The greeter may move back and forth between users */
+    gint64 now = g_get_monotonic_time ();
+    gpointer last_time;
+    if (g_hash_table_lookup_extended (prefetch_times, username, NULL, &last_time) &&
+        now - GPOINTER_TO_SIZE (last_time) * G_USEC_PER_SEC < PREFETCH_INTERVAL * G_USEC_PER_SEC)
+        return;
+    g_hash_table_insert (prefetch_times, g_strdup (username), GSIZE_TO_POINTER (now / G_USEC_PER_SEC));
+
+    g_debug ("Prefetching user %s", username);
+
+    Prefetch *prefetch = g_new0 (Prefetch, 1);
+    prefetch->username = g_strdup (username);
+    worker_run (lookup_user_thread, prefetch, (GDestroyNotify) prefetch_free, NULL, lookup_user_cb, NULL);
+
+    shared_data_manager_ensure_user_dir_async (shared_data_manager_get_instance (), username, ensure_user_dir_cb, NULL);
+}
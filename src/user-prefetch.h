@@ -0,0 +1,19 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef USER_PREFETCH_H_
+#define USER_PREFETCH_H_
+
+#include <glib.h>
+
+void user_prefetch (const gchar *username);
+
+#endif /* USER_PREFETCH_H_ */
@@ -12,6 +12,7 @@
 #include <gio/gio.h>
 
 #include "vnc-server.h"
+#include "socket-activation.h"
 
 enum {
     NEW_CONNECTION,
@@ -29,10 +30,54 @@ typedef struct
 
     /* Listening sockets */
     GSocket *socket, *socket6;
+
+    /* Cancellable for resolving the listen address */
+    GCancellable *cancellable;
+
+    /* Length of the queue of connections waiting to be accepted, or 0 for the default */
+    gint listen_backlog;
+
+    /* Maximum number of connections being served, or 0 for no limit */
+    guint max_seats;
+
+    /* Maximum number of connections to start serving per second, or 0 for no limit */
+    guint start_rate;
+
+    /* Connections accepted but not yet passed on */
+    GQueue pending;
+
+    /* Number of connections being served */
+    guint n_seats;
+
+    /* Start tokens available and when they were last refilled */
+    gdouble tokens;
+    gint64 tokens_time;
+
+    /* Timer to pass on pending connections when tokens are available */
+    guint start_timeout;
 } VNCServerPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (VNCServer, vnc_server, G_TYPE_OBJECT)
 
+/* Maximum number of connections to accept in one wakeup */
+#define ACCEPT_BATCH_SIZE 16
+
+/* Statistics for each listening socket, reported over D-Bus */
+typedef struct
+{
+    const gchar *name;
+    guint64 n_accepted;
+    guint64 n_errors;
+} ListenerStatistics;
+static ListenerStatistics ipv4_statistics = { "ipv4", 0, 0 };
+static ListenerStatistics ipv6_statistics = { "ipv6", 0, 0 };
+
+/* Connections queued because of the limits, passed on and currently waiting and being served */
+static guint64 n_queued = 0;
+static guint64 n_started = 0;
+static guint n_pending = 0;
+static guint n_active = 0;
+
 VNCServer *
 vnc_server_new (void)
 {
@@ -74,60 +119,188 @@ vnc_server_get_listen_address (VNCServer *server)
     return priv->listen_address;
 }
 
+void
+vnc_server_set_listen_backlog (VNCServer *server, gint backlog)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->listen_backlog = backlog;
+}
+
+void
+vnc_server_set_max_seats (VNCServer *server, guint max_seats)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->max_seats = max_seats;
+}
+
+void
+vnc_server_set_start_rate (VNCServer *server, guint start_rate)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->start_rate = start_rate;
+    priv->tokens = start_rate;
+}
+
+static void start_pending (VNCServer *server);
+
+static gboolean
+start_timeout_cb (gpointer user_data)
+{
+    VNCServer *server = user_data;
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    priv->start_timeout = 0;
+    start_pending (server);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Pass on pending connections as far as the limits allow */
+static void
+start_pending (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    if (priv->start_rate > 0)
+    {
+        gint64 now = g_get_monotonic_time ();
+        priv->tokens = MIN (priv->start_rate, priv->tokens + (gdouble) (now - priv->tokens_time) * priv->start_rate / G_USEC_PER_SEC);
+        priv->tokens_time = now;
+    }
+
+    while (!g_queue_is_empty (&priv->pending))
+    {
+        if (priv->max_seats > 0 && priv->n_seats >= priv->max_seats)
+            return;
+
+        if (priv->start_rate > 0 && priv->tokens < 1)
+        {
+            if (priv->start_timeout == 0)
+            {
+                guint delay = (guint) ((1 - priv->tokens) * 1000 / priv->start_rate) + 1;
+                priv->start_timeout = g_timeout_add (delay, start_timeout_cb, server);
+            }
+            return;
+        }
+
+        g_autoptr(GSocket) client_socket = g_queue_pop_head (&priv->pending);
+        n_pending = priv->pending.length;
+        if (priv->start_rate > 0)
+            priv->tokens--;
+        priv->n_seats++;
+        n_active = priv->n_seats;
+        n_started++;
+
+        g_signal_emit (server, signals[NEW_CONNECTION], 0, client_socket);
+    }
+}
+
+void
+vnc_server_connection_closed (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+    g_return_if_fail (priv->n_seats > 0);
+
+    priv->n_seats--;
+    n_active = priv->n_seats;
+    start_pending (server);
+}
+
 static gboolean
 read_cb (GSocket *socket, GIOCondition condition, VNCServer *server)
 {
-    g_autoptr(GError) error = NULL;
-    g_autoptr(GSocket) client_socket = g_socket_accept (socket, NULL, &error);
-    if (error)
-        g_warning ("Failed to get connection from from VNC socket: %s", error->message);
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    ListenerStatistics *statistics = socket == priv->socket ? &ipv4_statistics : &ipv6_statistics;
 
-    if (client_socket)
+    /* Take everything waiting so a burst doesn't need a wakeup per connection */
+    guint n_accepted = 0;
+    for (int i = 0; i < ACCEPT_BATCH_SIZE; i++)
     {
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GSocket) client_socket = g_socket_accept (socket, NULL, &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            break;
+        if (error)
+        {
+            g_warning ("Failed to get connection from from VNC socket: %s", error->message);
+            statistics->n_errors++;
+        }
+        if (!client_socket)
+            break;
+
         GInetSocketAddress *address = G_INET_SOCKET_ADDRESS (g_socket_get_remote_address (client_socket, NULL));
         g_autofree gchar *hostname = g_inet_address_to_string (g_inet_socket_address_get_address (address));
         g_debug ("Got VNC connection from %s:%d", hostname, g_inet_socket_address_get_port (address));
+        statistics->n_accepted++;
 
-        g_signal_emit (server, signals[NEW_CONNECTION], 0, client_socket);
+        g_queue_push_tail (&priv->pending, g_steal_pointer (&client_socket));
+        n_accepted++;
     }
 
+    start_pending (server);
+
+    /* Count the new connections that have to wait for the limits */
+    n_queued += MIN (n_accepted, priv->pending.length);
+    n_pending = priv->pending.length;
+
     return TRUE;
 }
 
+GVariant *
+vnc_server_get_statistics (void)
+{
+    GVariantBuilder listeners;
+    g_variant_builder_init (&listeners, G_VARIANT_TYPE ("a(stt)"));
+    g_variant_builder_add (&listeners, "(stt)", ipv4_statistics.name, ipv4_statistics.n_accepted, ipv4_statistics.n_errors);
+    g_variant_builder_add (&listeners, "(stt)", ipv6_statistics.name, ipv6_statistics.n_accepted, ipv6_statistics.n_errors);
+
+    return g_variant_new ("(@a(stt)ttuu)", g_variant_builder_end (&listeners), n_started, n_queued, n_pending, n_active);
+}
+
 static GSocket *
-open_tcp_socket (GSocketFamily family, guint port, const gchar *listen_address, GError **error)
+open_tcp_socket (GSocketFamily family, guint port, GInetAddress *listen_address, gint backlog, GError **error)
 {
+    /* Use the socket systemd is listening on for us if there is one */
+    GSocket *activated_socket = socket_activation_take_socket (family, G_SOCKET_TYPE_STREAM, port);
+    if (activated_socket)
+    {
+        g_socket_set_blocking (activated_socket, FALSE);
+        return activated_socket;
+    }
+
     g_autoptr(GSocket) socket = g_socket_new (family, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, error);
     if (!socket)
         return NULL;
 
     g_autoptr(GSocketAddress) address = NULL;
     if (listen_address)
-    {
-        GList *addresses = g_resolver_lookup_by_name (g_resolver_get_default (), listen_address, NULL, error);
-        if (!addresses)
-            return NULL;
-        address = g_inet_socket_address_new (addresses->data, port);
-        g_resolver_free_addresses (addresses);
-    }
+        address = g_inet_socket_address_new (listen_address, port);
     else
         address = g_inet_socket_address_new (g_inet_address_new_any (family), port);
+    if (backlog > 0)
+        g_socket_set_listen_backlog (socket, backlog);
     if (!g_socket_bind (socket, address, TRUE, error) ||
         !g_socket_listen (socket, error))
         return NULL;
 
+    /* Connections are accepted until there are no more */
+    g_socket_set_blocking (socket, FALSE);
+
     return g_steal_pointer (&socket);
 }
 
-gboolean
-vnc_server_start (VNCServer *server)
+static void
+open_sockets (VNCServer *server, GInetAddress *listen_address)
 {
     VNCServerPrivate *priv = vnc_server_get_instance_private (server);
 
-    g_return_val_if_fail (server != NULL, FALSE);
-
     g_autoptr(GError) ipv4_error = NULL;
-    priv->socket = open_tcp_socket (G_SOCKET_FAMILY_IPV4, priv->port, priv->listen_address, &ipv4_error);
+    priv->socket = open_tcp_socket (G_SOCKET_FAMILY_IPV4, priv->port, listen_address, priv->listen_backlog, &ipv4_error);
     if (ipv4_error)
         g_warning ("Failed to create IPv4 VNC socket: %s", ipv4_error->message);
 
@@ -139,7 +312,7 @@ vnc_server_start (VNCServer *server)
     }
 
     g_autoptr(GError) ipv6_error = NULL;
-    priv->socket6 = open_tcp_socket (G_SOCKET_FAMILY_IPV6, priv->port, priv->listen_address, &ipv6_error);
+    priv->socket6 = open_tcp_socket (G_SOCKET_FAMILY_IPV6, priv->port, listen_address, priv->listen_backlog, &ipv6_error);
     if (ipv6_error)
         g_warning ("Failed to create IPv6 VNC socket: %s", ipv6_error->message);
 
@@ -151,9 +324,49 @@ vnc_server_start (VNCServer *server)
     }
 
     if (!priv->socket && !priv->socket6)
-        return FALSE;
+        g_warning ("Not listening for VNC connections");
+}
 
-    return TRUE;
+static void
+lookup_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    GList *addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (object), result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    VNCServer *server = data;
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+    if (!addresses)
+    {
+        g_warning ("Failed to resolve VNC listen address %s: %s", priv->listen_address, error->message);
+        return;
+    }
+
+    open_sockets (server, addresses->data);
+    g_resolver_free_addresses (addresses);
+}
+
+gboolean
+vnc_server_start (VNCServer *server)
+{
+    VNCServerPrivate *priv = vnc_server_get_instance_private (server);
+
+    g_return_val_if_fail (server != NULL, FALSE);
+
+    /* Resolve the listen address without holding up the rest of startup,
+     * there is no address to resolve if systemd is listening for us */
+    if (priv->listen_address && !socket_activation_has_socket (G_SOCKET_TYPE_STREAM, priv->port))
+    {
+        priv->cancellable = g_cancellable_new ();
+        g_autoptr(GResolver) resolver = g_resolver_get_default ();
+        g_resolver_lookup_by_name_async (resolver, priv->listen_address, priv->cancellable, lookup_cb, server);
+        return TRUE;
+    }
+
+    open_sockets (server, NULL);
+
+    return priv->socket || priv->socket6;
 }
 
 static void
@@ -169,7 +382,13 @@ vnc_server_finalize (GObject *object)
     VNCServer *self = VNC_SERVER (object);
     VNCServerPrivate *priv = vnc_server_get_instance_private (self);
 
+    g_cancellable_cancel (priv->cancellable);
+    g_clear_object (&priv->cancellable);
     g_clear_pointer (&priv->listen_address, g_free);
+    g_queue_foreach (&priv->pending, (GFunc) g_object_unref, NULL);
+    g_queue_clear (&priv->pending);
+    if (priv->start_timeout != 0)
+        g_source_remove (priv->start_timeout);
     g_clear_object (&priv->socket);
     g_clear_object (&priv->socket6);
 
@@ -45,8 +45,18 @@ void vnc_server_set_listen_address (VNCServer *server, const gchar *listen_addre
 
 const gchar *vnc_server_get_listen_address (VNCServer *server);
 
+void vnc_server_set_listen_backlog (VNCServer *server, gint backlog);
+
+void vnc_server_set_max_seats (VNCServer *server, guint max_seats);
+
+void vnc_server_set_start_rate (VNCServer *server, guint start_rate);
+
 gboolean vnc_server_start (VNCServer *server);
 
+void vnc_server_connection_closed (VNCServer *server);
+
+GVariant *vnc_server_get_statistics (void);
+
 G_END_DECLS
 
 #endif /* VNC_SERVER_H_ */
@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -21,9 +22,18 @@
 #endif
 
 #include "vt.h"
+#include "bitmap.h"
 #include "configuration.h"
+#include "flight-recorder.h"
 
-static GList *used_vts = NULL;
+/* VTs with at least one reference */
+static Bitmap used_vts = { NULL, 0, 0 };
+
+/* Number of references to each VT, a VT can be shared */
+static GArray *vt_refs = NULL;
+
+/* Requests to activate a VT, the head is in progress */
+static GQueue activate_requests = G_QUEUE_INIT;
 
 static gint
 open_tty (void)
@@ -70,58 +80,109 @@ vt_get_active (void)
 #endif
 }
 
-void
-vt_set_active (gint number)
-{
 #ifdef __linux__
-    g_debug ("Activating VT %d", number);
+static void
+activate_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    int n = GPOINTER_TO_INT (task_data);
 
-    /* Pretend always active */
-    if (getuid () != 0)
+    gint tty_fd = open_tty ();
+    if (tty_fd < 0)
+    {
+        g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errno), "Error opening /dev/tty0: %s", strerror (errno));
         return;
+    }
 
-    gint tty_fd = open_tty ();
-    if (tty_fd >= 0)
+    if (ioctl (tty_fd, VT_ACTIVATE, n) < 0)
+    {
+        int e = errno;
+        close (tty_fd);
+        g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (e), "Error using VT_ACTIVATE %d on /dev/tty0: %s", n, strerror (e));
+        return;
+    }
+
+    /* Wait for the VT to become active to avoid a suspected
+     * race condition somewhere between LightDM, X, ConsoleKit and the kernel.
+     * See https://bugs.launchpad.net/bugs/851612 */
+    /* This call sometimes get interrupted (not sure what signal is causing it), so retry if that is the case */
+    while (TRUE)
     {
-        int n = number;
-        if (ioctl (tty_fd, VT_ACTIVATE, n) < 0)
+        if (ioctl (tty_fd, VT_WAITACTIVE, n) < 0)
         {
-            g_warning ("Error using VT_ACTIVATE %d on /dev/tty0: %s", n, strerror (errno));
+            if (errno == EINTR)
+                continue;
+            int e = errno;
             close (tty_fd);
+            g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (e), "Error using VT_WAITACTIVE %d on /dev/tty0: %s", n, strerror (e));
             return;
         }
+        break;
+    }
 
-        /* Wait for the VT to become active to avoid a suspected
-         * race condition somewhere between LightDM, X, ConsoleKit and the kernel.
-         * See https://bugs.launchpad.net/bugs/851612 */
-        /* This call sometimes get interrupted (not sure what signal is causing it), so retry if that is the case */
-        while (TRUE)
-        {
-            if (ioctl (tty_fd, VT_WAITACTIVE, n) < 0) 
-            {
-                if (errno == EINTR)
-                    continue;
-                g_warning ("Error using VT_WAITACTIVE %d on /dev/tty0: %s", n, strerror (errno));
-            }
-            break;
-        }
+    close (tty_fd);
+    g_task_return_boolean (task, TRUE);
+}
 
-        close (tty_fd);
-    }
-#endif
+static void start_next_activate (void);
+
+static void
+activate_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GTask) request = g_queue_pop_head (&activate_requests);
+
+    g_autoptr(GError) error = NULL;
+    if (g_task_propagate_boolean (G_TASK (result), &error))
+        g_task_return_boolean (request, TRUE);
+    else
+        g_task_return_error (request, g_steal_pointer (&error));
+
+    start_next_activate ();
 }
 
-static gboolean
-vt_is_used (gint number)
+static void
+start_next_activate (void)
+{
+    GTask *request = g_queue_peek_head (&activate_requests);
+    if (!request)
+        return;
+
+    /* The ioctls can block for a long time if the switch is slow, so don't hold up the main loop */
+    g_autoptr(GTask) task = g_task_new (NULL, NULL, activate_cb, NULL);
+    g_task_set_task_data (task, g_task_get_task_data (request), NULL);
+    g_task_run_in_thread (task, activate_thread);
+}
+#endif
+
+void
+vt_set_active_async (gint number, GAsyncReadyCallback callback, gpointer user_data)
 {
-    for (GList *link = used_vts; link; link = link->next)
+    g_autoptr(GTask) request = g_task_new (NULL, NULL, callback, user_data);
+    g_task_set_task_data (request, GINT_TO_POINTER (number), NULL);
+
+#ifdef __linux__
+    g_debug ("Activating VT %d", number);
+    flight_recorder_record (FLIGHT_RECORDER_EVENT_VT_ACTIVATE, 0, number, NULL, NULL);
+
+    /* Pretend always active */
+    if (getuid () != 0)
     {
-        int n = GPOINTER_TO_INT (link->data);
-        if (n == number)
-            return TRUE;
+        g_task_return_boolean (request, TRUE);
+        return;
     }
 
-    return FALSE;
+    /* Activate one at a time so the last requested VT is the one that ends up active */
+    g_queue_push_tail (&activate_requests, g_steal_pointer (&request));
+    if (activate_requests.length == 1)
+        start_next_activate ();
+#else
+    g_task_return_boolean (request, TRUE);
+#endif
+}
+
+gboolean
+vt_set_active_finish (GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 gint
@@ -140,23 +201,31 @@ vt_get_unused (void)
     if (getuid () != 0)
         return -1;
 
-    gint number = vt_get_min ();
-    while (vt_is_used (number))
-        number++;
-
-    return number;
+    return bitmap_find_unset (&used_vts, vt_get_min ());
 }
 
 void
 vt_ref (gint number)
 {
     g_debug ("Using VT %d", number);
-    used_vts = g_list_append (used_vts, GINT_TO_POINTER (number));
+    if (number < 0)
+        return;
+
+    if (!vt_refs)
+        vt_refs = g_array_new (FALSE, TRUE, sizeof (guint));
+    if ((guint) number >= vt_refs->len)
+        g_array_set_size (vt_refs, number + 1);
+    if (g_array_index (vt_refs, guint, number)++ == 0)
+        bitmap_set (&used_vts, number);
 }
 
 void
 vt_unref (gint number)
 {
     g_debug ("Releasing VT %d", number);
-    used_vts = g_list_remove (used_vts, GINT_TO_POINTER (number));
+    if (number < 0 || !vt_refs || (guint) number >= vt_refs->len || g_array_index (vt_refs, guint, number) == 0)
+        return;
+
+    if (--g_array_index (vt_refs, guint, number) == 0)
+        bitmap_clear (&used_vts, number);
 }
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <unistd.h>
+
+#include "watchdog.h"
+
+/*
+ * The main loop is watched by replacing its poll function. Any time spent
+ * outside of poll is spent dispatching, and if that goes on for longer than
+ * the threshold a thread logs that the loop is stalled. Once the loop gets
+ * back to poll the length of the stall is recorded, along with the file
+ * descriptors that were ready, as they identify the sources that were run.
+ */
+
+/* Maximum number of ready file descriptors to report for a stall */
+#define MAX_READY_FDS 8
+
+static const guint64 stall_bucket_bounds[] =
+{
+    50000, 100000, 200000, 500000, 1000000, 2000000, 5000000, 10000000, 30000000
+};
+#define N_STALL_BUCKETS (G_N_ELEMENTS (stall_bucket_bounds) + 1)
+
+/* Stalls longer than this are reported (in microseconds) */
+static gint64 threshold = 0;
+
+/* Poll function we are wrapping */
+static GPollFunc default_poll = NULL;
+
+/* Protects the fields shared with the watchdog thread */
+static GMutex lock;
+
+/* TRUE while the main loop is waiting in poll */
+static gboolean in_poll = TRUE;
+
+/* Time poll last returned */
+static gint64 dispatch_start = 0;
+
+/* TRUE if the watchdog has already logged the current stall */
+static gboolean stall_reported = FALSE;
+
+/* File descriptors that were ready after the last poll */
+static gint ready_fds[MAX_READY_FDS];
+static guint n_ready_fds = 0;
+
+/* Histogram of stall durations */
+static guint64 stall_counts[N_STALL_BUCKETS];
+static guint64 stall_max = 0;
+
+static gchar *
+get_ready_fds_string (void)
+{
+    GString *text = g_string_new ("");
+    for (guint i = 0; i < n_ready_fds; i++)
+    {
+        if (i != 0)
+            g_string_append (text, ", ");
+        g_string_append_printf (text, "%d", ready_fds[i]);
+
+#ifdef __linux__
+        g_autofree gchar *path = g_strdup_printf ("/proc/self/fd/%d", ready_fds[i]);
+        g_autofree gchar *target = g_file_read_link (path, NULL);
+        if (target)
+            g_string_append_printf (text, " (%s)", target);
+#endif
+    }
+    if (n_ready_fds == 0)
+        g_string_append (text, "none");
+
+    return g_string_free (text, FALSE);
+}
+
+static void
+record_stall (gint64 duration)
+{
+    guint bucket = 0;
+    while (bucket < G_N_ELEMENTS (stall_bucket_bounds) && (guint64) duration >= stall_bucket_bounds[bucket])
+        bucket++;
+    stall_counts[bucket]++;
+    stall_max = MAX (stall_max, (guint64) duration);
+
+    g_autofree gchar *fds = get_ready_fds_string ();
+    g_warning ("Main loop was stalled for %.3fs, ready file descriptors: %s", duration / 1000000.0, fds);
+}
+
+static gint
+watchdog_poll (GPollFD *ufds, guint nfds, gint timeout)
+{
+    gint64 now = g_get_monotonic_time ();
+    g_mutex_lock (&lock);
+    gint64 duration = now - dispatch_start;
+    in_poll = TRUE;
+    g_mutex_unlock (&lock);
+
+    if (dispatch_start != 0 && duration >= threshold)
+        record_stall (duration);
+
+    gint result = default_poll (ufds, nfds, timeout);
+
+    n_ready_fds = 0;
+    for (guint i = 0; i < nfds && n_ready_fds < MAX_READY_FDS; i++)
+        if (ufds[i].revents != 0)
+            ready_fds[n_ready_fds++] = ufds[i].fd;
+
+    g_mutex_lock (&lock);
+    in_poll = FALSE;
+    dispatch_start = g_get_monotonic_time ();
+    stall_reported = FALSE;
+    g_mutex_unlock (&lock);
+
+    return result;
+}
+
+static gpointer
+watchdog_thread_cb (gpointer data)
+{
+    while (TRUE)
+    {
+        g_usleep (threshold / 2);
+
+        gint64 now = g_get_monotonic_time ();
+        gint64 duration = 0;
+        g_mutex_lock (&lock);
+        if (!in_poll && !stall_reported && dispatch_start != 0 && now - dispatch_start >= threshold)
+        {
+            stall_reported = TRUE;
+            duration = now - dispatch_start;
+        }
+        g_mutex_unlock (&lock);
+
+        if (duration > 0)
+            g_warning ("Main loop has not iterated for %.3fs", duration / 1000000.0);
+    }
+
+    return NULL;
+}
+
+void
+watchdog_start (guint threshold_ms)
+{
+    if (threshold_ms == 0 || default_poll)
+        return;
+
+    threshold = (gint64) threshold_ms * 1000;
+    default_poll = g_main_context_get_poll_func (NULL);
+    g_main_context_set_poll_func (NULL, watchdog_poll);
+    g_thread_unref (g_thread_new ("watchdog", watchdog_thread_cb, NULL));
+}
+
+GVariant *
+watchdog_get_statistics (void)
+{
+    GVariantBuilder bounds;
+    g_variant_builder_init (&bounds, G_VARIANT_TYPE ("at"));
+    for (gsize i = 0; i < G_N_ELEMENTS (stall_bucket_bounds); i++)
+        g_variant_builder_add (&bounds, "t", stall_bucket_bounds[i]);
+
+    GVariantBuilder counts;
+    g_variant_builder_init (&counts, G_VARIANT_TYPE ("at"));
+    for (gsize i = 0; i < N_STALL_BUCKETS; i++)
+        g_variant_builder_add (&counts, "t", stall_counts[i]);
+
+    return g_variant_new ("(@at@att)", g_variant_builder_end (&bounds), g_variant_builder_end (&counts), stall_max);
+}
@@ -9,18 +9,56 @@
  * license.
  */
 
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
 #include "wayland-session.h"
+#include "session.h"
+#include "trace.h"
 #include "vt.h"
 
+/*
+ * There is no display server to wait for before a Wayland session starts, so
+ * the session is run as soon as it is authenticated. The compositor can say
+ * when it has taken over the screen by sending READY=1 to $NOTIFY_SOCKET, as
+ * it would to systemd. This is used to hand over from the boot splash.
+ * Compositors that don't do this are assumed to be ready after a timeout.
+ */
+
+/* Seconds to wait for the compositor to report it is ready */
+#define COMPOSITOR_READY_TIMEOUT 10
+
+enum {
+    COMPOSITOR_READY,
+    LAST_SIGNAL
+};
+static guint signals[LAST_SIGNAL] = { 0 };
+
 typedef struct
 {
     /* VT to run on */
     gint vt;
     gboolean have_vt_ref;
+
+    /* Socket the compositor reports readiness on */
+    GSocket *notify_socket;
+    gchar *notify_socket_name;
+    GSource *notify_source;
+
+    /* Timeout for compositors that never report */
+    guint ready_timeout;
+
+    /* TRUE if the compositor has reported it is ready */
+    gboolean compositor_ready;
 } WaylandSessionPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (WaylandSession, wayland_session, DISPLAY_SERVER_TYPE)
 
+/* Unique number for each notify socket */
+static guint notify_socket_count = 0;
+
 WaylandSession *
 wayland_session_new (void)
 {
@@ -45,6 +83,116 @@ wayland_session_set_vt (WaylandSession *session, gint vt)
     }
 }
 
+static void
+close_notify_socket (WaylandSession *session)
+{
+    WaylandSessionPrivate *priv = wayland_session_get_instance_private (session);
+
+    if (priv->notify_source)
+        g_source_destroy (priv->notify_source);
+    g_clear_pointer (&priv->notify_source, g_source_unref);
+    g_clear_object (&priv->notify_socket);
+    g_clear_pointer (&priv->notify_socket_name, g_free);
+    if (priv->ready_timeout)
+        g_source_remove (priv->ready_timeout);
+    priv->ready_timeout = 0;
+}
+
+static void
+set_compositor_ready (WaylandSession *session)
+{
+    WaylandSessionPrivate *priv = wayland_session_get_instance_private (session);
+
+    close_notify_socket (session);
+    if (priv->compositor_ready)
+        return;
+
+    priv->compositor_ready = TRUE;
+    trace_end (session, "compositor-start");
+    g_signal_emit (session, signals[COMPOSITOR_READY], 0);
+}
+
+static gboolean
+notify_read_cb (GSocket *socket, GIOCondition condition, WaylandSession *session)
+{
+    gchar buffer[1024];
+    g_autoptr(GError) error = NULL;
+    gssize n_read = g_socket_receive (socket, buffer, sizeof (buffer) - 1, NULL, &error);
+    if (n_read < 0)
+    {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            return G_SOURCE_CONTINUE;
+        l_warning (session, "Failed to read compositor notification: %s", error->message);
+        set_compositor_ready (session);
+        return G_SOURCE_REMOVE;
+    }
+    buffer[n_read] = '\0';
+
+    /* Other variables like STATUS= may be sent, only readiness is used */
+    g_auto(GStrv) lines = g_strsplit (buffer, "\n", -1);
+    for (int i = 0; lines[i]; i++)
+    {
+        if (strcmp (lines[i], "READY=1") == 0)
+        {
+            l_debug (session, "Compositor reported it is ready");
+            set_compositor_ready (session);
+            return G_SOURCE_REMOVE;
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+ready_timeout_cb (gpointer data)
+{
+    WaylandSession *session = data;
+    WaylandSessionPrivate *priv = wayland_session_get_instance_private (session);
+
+    priv->ready_timeout = 0;
+    l_debug (session, "Compositor hasn't reported it is ready after %d seconds, assuming it is", COMPOSITOR_READY_TIMEOUT);
+    set_compositor_ready (session);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* A message from someone other than the compositor can only end the wait early,
+ * so the socket isn't protected beyond being named after this daemon */
+static gboolean
+open_notify_socket (WaylandSession *session)
+{
+    WaylandSessionPrivate *priv = wayland_session_get_instance_private (session);
+
+    if (priv->notify_socket || priv->compositor_ready)
+        return TRUE;
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSocket) socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_DEFAULT, &error);
+    if (!socket)
+    {
+        l_warning (session, "Failed to create compositor notify socket: %s", error->message);
+        return FALSE;
+    }
+
+    g_autofree gchar *name = g_strdup_printf ("lightdm/notify-%d-%u", getpid (), notify_socket_count++);
+    g_autoptr(GSocketAddress) address = g_unix_socket_address_new_with_type (name, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    if (!g_socket_bind (socket, address, FALSE, &error))
+    {
+        l_warning (session, "Failed to bind compositor notify socket: %s", error->message);
+        return FALSE;
+    }
+
+    priv->notify_socket = g_steal_pointer (&socket);
+    priv->notify_socket_name = g_strdup_printf ("@%s", name);
+    priv->notify_source = g_socket_create_source (priv->notify_socket, G_IO_IN, NULL);
+    g_source_set_callback (priv->notify_source, (GSourceFunc) notify_read_cb, session, NULL);
+    g_source_attach (priv->notify_source, NULL);
+    priv->ready_timeout = g_timeout_add_seconds (COMPOSITOR_READY_TIMEOUT, ready_timeout_cb, session);
+    trace_begin (session, "compositor-start");
+
+    return TRUE;
+}
+
 static gint
 wayland_session_get_vt (DisplayServer *server)
 {
@@ -66,6 +214,10 @@ wayland_session_connect_session (DisplayServer *display_server, Session *session
         g_autofree gchar *value = g_strdup_printf ("%d", priv->vt);
         session_set_env (session, "XDG_VTNR", value);
     }
+
+    /* Only wait for the compositor once it's being run, not while authenticating */
+    if (session_get_is_authenticated (session) && open_notify_socket (wayland_session) && priv->notify_socket_name)
+        session_set_env (session, "NOTIFY_SOCKET", priv->notify_socket_name);
 }
 
 static void
@@ -73,6 +225,12 @@ wayland_session_disconnect_session (DisplayServer *display_server, Session *sess
 {
     session_unset_env (session, "XDG_SESSION_TYPE");
     session_unset_env (session, "XDG_VTNR");
+    session_unset_env (session, "NOTIFY_SOCKET");
+
+    /* Let anything waiting on the compositor carry on */
+    WaylandSessionPrivate *priv = wayland_session_get_instance_private (WAYLAND_SESSION (display_server));
+    if (priv->notify_socket)
+        set_compositor_ready (WAYLAND_SESSION (display_server));
 }
 
 static void
@@ -90,6 +248,7 @@ wayland_session_finalize (GObject *object)
 
     if (priv->have_vt_ref)
         vt_unref (priv->vt);
+    close_notify_socket (self);
 
     G_OBJECT_CLASS (wayland_session_parent_class)->finalize (object);
 }
@@ -104,4 +263,13 @@ wayland_session_class_init (WaylandSessionClass *klass)
     display_server_class->connect_session = wayland_session_connect_session;
     display_server_class->disconnect_session = wayland_session_disconnect_session;
     object_class->finalize = wayland_session_finalize;
+
+    signals[COMPOSITOR_READY] =
+        g_signal_new (WAYLAND_SESSION_SIGNAL_COMPOSITOR_READY,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (WaylandSessionClass, compositor_ready),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
 }
@@ -21,6 +21,8 @@ G_BEGIN_DECLS
 #define WAYLAND_SESSION(obj)    (G_TYPE_CHECK_INSTANCE_CAST ((obj), WAYLAND_SESSION_TYPE, WaylandSession))
 #define IS_WAYLAND_SESSION(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WAYLAND_SESSION_TYPE))
 
+#define WAYLAND_SESSION_SIGNAL_COMPOSITOR_READY "compositor-ready"
+
 typedef struct
 {
     DisplayServer parent_instance;
@@ -29,6 +31,8 @@ typedef struct
 typedef struct
 {
     DisplayServerClass parent_class;
+
+    void (*compositor_ready)(WaylandSession *session);
 } WaylandSessionClass;
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (WaylandSession, g_object_unref)
@@ -41,6 +41,21 @@ typedef struct
 
 G_DEFINE_TYPE_WITH_PRIVATE (XAuthority, x_authority, G_TYPE_OBJECT)
 
+/* Contents of an Xauthority file as we last wrote it */
+typedef struct
+{
+    /* File the contents were written to, used to check it hasn't been changed since */
+    dev_t device;
+    ino_t inode;
+    time_t mtime;
+    off_t size;
+
+    GBytes *contents;
+} FileCache;
+
+/* Cached files, keyed by filename */
+static GHashTable *file_cache = NULL;
+
 XAuthority *
 x_authority_new (guint16 family, const guint8 *address, gsize address_length, const gchar *number, const gchar *name, const guint8 *data, gsize data_length)
 {
@@ -181,139 +196,160 @@ x_authority_get_authorization_data_length (XAuthority *auth)
     return priv->authorization_data_length;
 }
 
+/* A record in an Xauthority file, pointing into the file contents */
+typedef struct
+{
+    guint16 family;
+    const guint8 *address;
+    guint16 address_length;
+    const gchar *number;
+    guint16 number_length;
+
+    /* The record as it appears in the file */
+    const gchar *data;
+    gsize data_length;
+} XAuthRecord;
+
 static gboolean
-read_uint16 (gchar *data, gsize data_length, gsize *offset, guint16 *value)
+read_uint16 (const gchar *data, gsize data_length, gsize *offset, guint16 *value)
 {
     if (data_length - *offset < 2)
         return FALSE;
 
-    *value = data[*offset] << 8 | data[*offset + 1];
+    *value = (guint8) data[*offset] << 8 | (guint8) data[*offset + 1];
     *offset += 2;
 
     return TRUE;
 }
 
 static gboolean
-read_data (gchar *data, gsize data_length, gsize *offset, guint16 length, guint8 **value)
+read_data (const gchar *data, gsize data_length, gsize *offset, guint16 *length, const gchar **value)
 {
-    g_free (*value);
-    *value = NULL;
-
-    if (data_length - *offset < length)
+    if (!read_uint16 (data, data_length, offset, length) || data_length - *offset < *length)
         return FALSE;
 
-    *value = g_malloc0 (length + 1);
-    for (int i = 0; i < length; i++)
-        (*value)[i] = data[*offset + i];
-    *offset += length;
-    (*value)[length] = 0;
+    *value = data + *offset;
+    *offset += *length;
 
     return TRUE;
 }
 
 static gboolean
-read_string (gchar *data, gsize data_length, gsize *offset, gchar **value)
+read_record (const gchar *data, gsize data_length, gsize *offset, XAuthRecord *record)
 {
-    guint16 length;
-    if (!read_uint16 (data, data_length, offset, &length))
+    gsize start = *offset;
+    const gchar *name, *authorization_data;
+    guint16 name_length, authorization_data_length;
+    if (!read_uint16 (data, data_length, offset, &record->family) ||
+        !read_data (data, data_length, offset, &record->address_length, (const gchar **) &record->address) ||
+        !read_data (data, data_length, offset, &record->number_length, &record->number) ||
+        !read_data (data, data_length, offset, &name_length, &name) ||
+        !read_data (data, data_length, offset, &authorization_data_length, &authorization_data))
         return FALSE;
-    return read_data (data, data_length, offset, length, (guint8 **) value);
+
+    record->data = data + start;
+    record->data_length = *offset - start;
+
+    return TRUE;
 }
 
-static gboolean
-write_uint16 (int fd, guint16 value)
+static void
+append_uint16 (GByteArray *buffer, guint16 value)
 {
     guint8 v[2];
     v[0] = value >> 8;
     v[1] = value & 0xFF;
-    return write (fd, v, 2) == 2;
+    g_byte_array_append (buffer, v, 2);
 }
 
-static gboolean
-write_data (int fd, const guint8 *value, gsize value_length)
+static void
+append_data (GByteArray *buffer, const guint8 *value, gsize value_length)
 {
-    return write (fd, value, value_length) == value_length;
+    append_uint16 (buffer, value_length);
+    g_byte_array_append (buffer, value, value_length);
 }
 
-static gboolean
-write_string (int fd, const gchar *value)
+static void
+append_string (GByteArray *buffer, const gchar *value)
 {
-    size_t value_length = strlen (value);
-    return write_uint16 (fd, value_length) && write_data (fd, (guint8 *) value, value_length);
+    append_data (buffer, (const guint8 *) value, strlen (value));
 }
 
-gboolean
-x_authority_write (XAuthority *auth, XAuthWriteMode mode, const gchar *filename, GError **error)
+static void
+append_authority (GByteArray *buffer, XAuthority *auth)
 {
     XAuthorityPrivate *priv = x_authority_get_instance_private (auth);
 
-    g_return_val_if_fail (auth != NULL, FALSE);
-    g_return_val_if_fail (filename != NULL, FALSE);
+    append_uint16 (buffer, priv->family);
+    append_data (buffer, priv->address, priv->address_length);
+    append_string (buffer, priv->number);
+    append_string (buffer, priv->authorization_name);
+    append_data (buffer, priv->authorization_data, priv->authorization_data_length);
+}
 
-    /* Read out existing records */
-    g_autofree gchar *input = NULL;
-    gsize input_length = 0, input_offset = 0;
-    if (mode != XAUTH_WRITE_MODE_SET)
+static void
+file_cache_free (gpointer data)
+{
+    FileCache *cache = data;
+    g_bytes_unref (cache->contents);
+    g_free (cache);
+}
+
+/* Get the contents of a file we wrote earlier, as long as nothing else has modified it */
+static GBytes *
+get_cached_contents (const gchar *filename)
+{
+    if (!file_cache)
+        return NULL;
+
+    FileCache *cache = g_hash_table_lookup (file_cache, filename);
+    if (!cache)
+        return NULL;
+
+    GStatBuf info;
+    if (g_stat (filename, &info) != 0 ||
+        info.st_dev != cache->device ||
+        info.st_ino != cache->inode ||
+        info.st_mtime != cache->mtime ||
+        info.st_size != cache->size)
     {
-        g_autoptr(GError) read_error = NULL;
-        g_file_get_contents (filename, &input, &input_length, &read_error);
-        if (read_error && !g_error_matches (read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
-            g_warning ("Error reading existing Xauthority: %s", read_error->message);
+        g_hash_table_remove (file_cache, filename);
+        return NULL;
     }
-    GList *records = NULL;
-    gboolean matched = FALSE;
-    while (input_offset != input_length)
-    {
-        g_autoptr(XAuthority) a = g_object_new (X_AUTHORITY_TYPE, NULL);
-        XAuthorityPrivate *a_priv = x_authority_get_instance_private (a);
-
-        guint16 address_length = 0;
-        guint16 authorization_data_length = 0;
-        gboolean result = read_uint16 (input, input_length, &input_offset, &a_priv->family) &&
-                          read_uint16 (input, input_length, &input_offset, &address_length) &&
-                          read_data (input, input_length, &input_offset, address_length, &a_priv->address) &&
-                          read_string (input, input_length, &input_offset, &a_priv->number) &&
-                          read_string (input, input_length, &input_offset, &a_priv->authorization_name) &&
-                          read_uint16 (input, input_length, &input_offset, &authorization_data_length) &&
-                          read_data (input, input_length, &input_offset, authorization_data_length, &a_priv->authorization_data);
-        a_priv->address_length = address_length;
-        a_priv->authorization_data_length = authorization_data_length;
-
-        if (!result)
-            break;
 
-        gboolean address_matches = FALSE;
-        if (priv->address_length == a_priv->address_length)
-        {
-            guint16 i;
-            for (i = 0; i < priv->address_length && priv->address[i] == a_priv->address[i]; i++);
-            address_matches = i == priv->address_length;
-        }
+    return g_bytes_ref (cache->contents);
+}
 
-        /* If this record matches, then update or delete it */
-        if (!matched &&
-            priv->family == a_priv->family &&
-            address_matches &&
-            strcmp (priv->number, a_priv->number) == 0)
-        {
-            matched = TRUE;
-            if (mode == XAUTH_WRITE_MODE_REMOVE)
-                continue;
-            else
-                x_authority_set_authorization_data (a, priv->authorization_data, priv->authorization_data_length);
-        }
+static void
+set_cached_contents (const gchar *filename, GBytes *contents)
+{
+    if (!file_cache)
+        file_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, file_cache_free);
 
-        records = g_list_append (records, g_steal_pointer (&a));
+    GStatBuf info;
+    if (g_stat (filename, &info) != 0)
+    {
+        g_hash_table_remove (file_cache, filename);
+        return;
     }
 
-    /* If didn't exist, then add a new one */
-    if (!matched)
-        records = g_list_append (records, g_object_ref (auth));
+    FileCache *cache = g_new0 (FileCache, 1);
+    cache->device = info.st_dev;
+    cache->inode = info.st_ino;
+    cache->mtime = info.st_mtime;
+    cache->size = info.st_size;
+    cache->contents = g_bytes_ref (contents);
+    g_hash_table_insert (file_cache, g_strdup (filename), cache);
+}
 
-    /* Write records back */
+static gboolean
+write_file (const gchar *filename, const guint8 *data, gsize data_length, GError **error)
+{
+    /* Write to a temporary file and move it into place so the file is never seen truncated */
+    g_autofree gchar *temp_filename = g_strdup_printf ("%s.XXXXXX", filename);
     errno = 0;
-    int output_fd = g_open (filename, O_WRONLY | O_CREAT | O_TRUNC , S_IRUSR | S_IWUSR);
-    if (output_fd < 0)
+    int fd = g_mkstemp_full (temp_filename, O_WRONLY, S_IRUSR | S_IWUSR);
+    if (fd < 0)
     {
         g_set_error (error,
                      G_FILE_ERROR,
@@ -324,36 +360,106 @@ x_authority_write (XAuthority *auth, XAuthWriteMode mode, const gchar *filename,
         return FALSE;
     }
 
-    errno = 0;
-    gboolean result = TRUE;
-    for (GList *link = records; link && result; link = link->next)
+    gsize n_written = 0;
+    while (n_written < data_length)
     {
-        XAuthority *a = link->data;
-        XAuthorityPrivate *a_priv = x_authority_get_instance_private (a);
-
-        result = write_uint16 (output_fd, a_priv->family) &&
-                 write_uint16 (output_fd, a_priv->address_length) &&
-                 write_data (output_fd, a_priv->address, a_priv->address_length) &&
-                 write_string (output_fd, a_priv->number) &&
-                 write_string (output_fd, a_priv->authorization_name) &&
-                 write_uint16 (output_fd, a_priv->authorization_data_length) &&
-                 write_data (output_fd, a_priv->authorization_data, a_priv->authorization_data_length);
+        ssize_t n = write (fd, data + n_written, data_length - n_written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        n_written += n;
+    }
+    gboolean result = n_written == data_length && fsync (fd) == 0;
+    int e = errno;
+    if (close (fd) != 0 && result)
+    {
+        result = FALSE;
+        e = errno;
+    }
+    if (result && rename (temp_filename, filename) != 0)
+    {
+        result = FALSE;
+        e = errno;
     }
-    g_list_free_full (records, g_object_unref);
-
-    fsync (output_fd);
-    close (output_fd);
 
     if (!result)
     {
+        g_unlink (temp_filename);
         g_set_error (error,
                      G_FILE_ERROR,
-                     g_file_error_from_errno (errno),
+                     g_file_error_from_errno (e),
                      "Failed to write X authority %s: %s",
                      filename,
-                     g_strerror (errno));
+                     g_strerror (e));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+x_authority_write (XAuthority *auth, XAuthWriteMode mode, const gchar *filename, GError **error)
+{
+    XAuthorityPrivate *priv = x_authority_get_instance_private (auth);
+
+    g_return_val_if_fail (auth != NULL, FALSE);
+    g_return_val_if_fail (filename != NULL, FALSE);
+
+    /* Read out existing records, using what we last wrote if the file is unchanged */
+    g_autoptr(GBytes) cached_input = NULL;
+    g_autofree gchar *file_input = NULL;
+    const gchar *input = NULL;
+    gsize input_length = 0, input_offset = 0;
+    if (mode != XAUTH_WRITE_MODE_SET)
+        cached_input = get_cached_contents (filename);
+    if (cached_input)
+        input = g_bytes_get_data (cached_input, &input_length);
+    else if (mode != XAUTH_WRITE_MODE_SET)
+    {
+        g_autoptr(GError) read_error = NULL;
+        g_file_get_contents (filename, &file_input, &input_length, &read_error);
+        if (read_error && !g_error_matches (read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Error reading existing Xauthority: %s", read_error->message);
+        input = file_input;
+    }
+
+    /* Copy the records across, updating or removing the first one that matches */
+    g_autoptr(GByteArray) output = g_byte_array_sized_new (input_length + 64);
+    gboolean matched = FALSE;
+    XAuthRecord record;
+    while (input_offset != input_length && read_record (input, input_length, &input_offset, &record))
+    {
+        if (!matched &&
+            priv->family == record.family &&
+            priv->address_length == record.address_length &&
+            (record.address_length == 0 || memcmp (priv->address, record.address, record.address_length) == 0) &&
+            strlen (priv->number) == record.number_length &&
+            strncmp (priv->number, record.number, record.number_length) == 0)
+        {
+            matched = TRUE;
+            if (mode != XAUTH_WRITE_MODE_REMOVE)
+                append_authority (output, auth);
+            continue;
+        }
+
+        g_byte_array_append (output, (const guint8 *) record.data, record.data_length);
+    }
+
+    /* If didn't exist, then add a new one */
+    if (!matched)
+        append_authority (output, auth);
+
+    g_autoptr(GBytes) contents = g_byte_array_free_to_bytes (g_steal_pointer (&output));
+    gsize contents_length;
+    const guint8 *contents_data = g_bytes_get_data (contents, &contents_length);
+    if (!write_file (filename, contents_data, contents_length, error))
+    {
+        if (file_cache)
+            g_hash_table_remove (file_cache, filename);
         return FALSE;
     }
+    set_cached_contents (filename, contents);
 
     return TRUE;
 }
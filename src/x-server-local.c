@@ -11,16 +11,22 @@
 
 #include <config.h>
 #include <string.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
 #include <stdlib.h>
 
 #include "x-server-local.h"
+#include "bitmap.h"
 #include "configuration.h"
 #include "process.h"
+#include "program-cache.h"
 #include "vt.h"
+#include "trace.h"
 
 typedef struct
 {
@@ -32,6 +38,26 @@ typedef struct
 
     /* Display number to use */
     guint display_number;
+    gboolean have_display_number;
+
+    /* TRUE while the display number is marked as used */
+    gboolean display_number_in_use;
+
+    /* TRUE if the X server picks its own display number and reports it with -displayfd */
+    gboolean use_displayfd;
+
+    /* Pipe the X server reports its display number on */
+    int displayfd_write;
+    GIOChannel *displayfd_channel;
+    guint displayfd_watch;
+    GString *displayfd_data;
+
+    /* Number used to name files while the display number isn't known */
+    guint file_slot;
+    gboolean have_file_slot;
+
+    /* Run function for the class, saved so it can be called after forking */
+    ProcessRunFunc run_func;
 
     /* Config file to use */
     gchar *config_file;
@@ -60,6 +86,10 @@ typedef struct
     /* TRUE when received ready signal */
     gboolean got_signal;
 
+    /* TRUE while waiting for the X server to reset, and the timeout if it doesn't say it has */
+    gboolean resetting;
+    guint reset_timeout;
+
     /* VT to run on */
     gint vt;
     gboolean have_vt_ref;
@@ -76,10 +106,23 @@ G_DEFINE_TYPE_WITH_CODE (XServerLocal, x_server_local, X_SERVER_TYPE,
 
 static gchar *version = NULL;
 static guint version_major = 0, version_minor = 0;
-static GList *display_numbers = NULL;
+
+/* Display numbers used by our X servers */
+static Bitmap display_numbers = { NULL, 0, 0 };
+
+/* Log and authority file names in use by X servers that pick their own display number */
+static Bitmap file_slots = { NULL, 0, 0 };
+
+/* Display numbers used by X servers we don't manage */
+static Bitmap foreign_display_numbers = { NULL, 0, 0 };
+static gboolean have_foreign_display_numbers = FALSE;
+static GFileMonitor *x11_socket_monitor = NULL;
 
 #define XORG_VERSION_PREFIX "X.Org X Server "
 
+/* Group in the version cache file */
+#define VERSION_CACHE_GROUP "X Server"
+
 static gchar *
 find_version (const gchar *line)
 {
@@ -89,27 +132,149 @@ find_version (const gchar *line)
     return g_strdup (line + strlen (XORG_VERSION_PREFIX));
 }
 
+static void
+set_version (gchar *value)
+{
+    g_free (version);
+    version = value;
+
+    g_auto(GStrv) tokens = g_strsplit (version ? version : "", ".", 3);
+    guint n_tokens = g_strv_length (tokens);
+    version_major = n_tokens > 0 ? atoi (tokens[0]) : 0;
+    version_minor = n_tokens > 1 ? atoi (tokens[1]) : 0;
+}
+
+static gchar *
+parse_version_output (const gchar *stderr_text)
+{
+    gchar *value = NULL;
+    g_auto(GStrv) lines = g_strsplit (stderr_text, "\n", -1);
+    for (int i = 0; lines[i] && !value; i++)
+        value = find_version (lines[i]);
+
+    return value;
+}
+
+/* The version is cached in the run directory so later starts don't have to run
+ * the X server to find it. It is only valid while the binary is unchanged */
+static gchar *
+get_version_cache_path (void)
+{
+    g_autofree gchar *run_dir = config_get_string (config_get_instance (), "LightDM", "run-directory");
+    return g_build_filename (run_dir, "x-server-version", NULL);
+}
+
+static void
+save_version_cache (const gchar *binary)
+{
+    GStatBuf info;
+    if (!version || g_stat (binary, &info) != 0)
+        return;
+
+    g_autoptr(GKeyFile) cache = g_key_file_new ();
+    g_key_file_set_string (cache, VERSION_CACHE_GROUP, "path", binary);
+    g_key_file_set_uint64 (cache, VERSION_CACHE_GROUP, "inode", info.st_ino);
+    g_key_file_set_int64 (cache, VERSION_CACHE_GROUP, "mtime", info.st_mtime);
+    g_key_file_set_string (cache, VERSION_CACHE_GROUP, "version", version);
+
+    g_autofree gchar *path = get_version_cache_path ();
+    g_autoptr(GError) error = NULL;
+    if (!g_key_file_save_to_file (cache, path, &error))
+        g_debug ("Failed to write X server version cache: %s", error->message);
+}
+
+/* Load a cached version. Sets is_current to FALSE if the binary has changed
+ * since, in which case the version can be used but should be refreshed */
+static gboolean
+load_version_cache (const gchar *binary, gboolean *is_current)
+{
+    g_autoptr(GKeyFile) cache = g_key_file_new ();
+    g_autofree gchar *path = get_version_cache_path ();
+    if (!g_key_file_load_from_file (cache, path, G_KEY_FILE_NONE, NULL))
+        return FALSE;
+
+    g_autofree gchar *cached_binary = g_key_file_get_string (cache, VERSION_CACHE_GROUP, "path", NULL);
+    g_autofree gchar *cached_version = g_key_file_get_string (cache, VERSION_CACHE_GROUP, "version", NULL);
+    if (g_strcmp0 (cached_binary, binary) != 0 || !cached_version)
+        return FALSE;
+
+    GStatBuf info;
+    *is_current = g_stat (binary, &info) == 0 &&
+                  g_key_file_get_uint64 (cache, VERSION_CACHE_GROUP, "inode", NULL) == info.st_ino &&
+                  g_key_file_get_int64 (cache, VERSION_CACHE_GROUP, "mtime", NULL) == info.st_mtime;
+    set_version (g_steal_pointer (&cached_version));
+
+    return TRUE;
+}
+
+static void
+version_probe_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autofree gchar *binary = data;
+
+    g_autofree gchar *stderr_text = NULL;
+    g_autoptr(GError) error = NULL;
+    if (!g_subprocess_communicate_utf8_finish (G_SUBPROCESS (object), result, NULL, &stderr_text, &error))
+    {
+        g_debug ("Failed to get X server version: %s", error->message);
+        return;
+    }
+    if (!g_subprocess_get_if_exited (G_SUBPROCESS (object)) || g_subprocess_get_exit_status (G_SUBPROCESS (object)) != EXIT_SUCCESS)
+        return;
+
+    gchar *value = parse_version_output (stderr_text);
+    if (!value)
+        return;
+
+    g_debug ("X server version is now %s", value);
+    set_version (value);
+    save_version_cache (binary);
+}
+
+static void
+refresh_version (const gchar *binary)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSubprocess) p = g_subprocess_new (G_SUBPROCESS_FLAGS_STDOUT_SILENCE | G_SUBPROCESS_FLAGS_STDERR_PIPE, &error, binary, "-version", NULL);
+    if (!p)
+    {
+        g_debug ("Failed to run %s -version: %s", binary, error->message);
+        return;
+    }
+    g_subprocess_communicate_utf8_async (p, NULL, NULL, version_probe_cb, g_strdup (binary));
+}
+
 static const gchar *
 x_server_local_get_version (void)
 {
     if (version)
         return version;
 
+    g_autofree gchar *binary = program_cache_find ("X", NULL);
+    if (binary)
+    {
+        gboolean is_current = FALSE;
+        if (load_version_cache (binary, &is_current))
+        {
+            /* Use the old version for now rather than block the X server starting */
+            if (!is_current)
+            {
+                g_debug ("X server binary has changed, refreshing cached version %s", version);
+                refresh_version (binary);
+            }
+            return version;
+        }
+    }
+
     g_autofree gchar *stderr_text = NULL;
     gint exit_status;
     if (!g_spawn_command_line_sync ("X -version", NULL, &stderr_text, &exit_status, NULL))
         return NULL;
     if (exit_status == EXIT_SUCCESS)
-    {
-        g_auto(GStrv) lines = g_strsplit (stderr_text, "\n", -1);
-        for (int i = 0; lines[i] && !version; i++)
-            version = find_version (lines[i]);
-    }
+        set_version (parse_version_output (stderr_text));
 
-    g_auto(GStrv) tokens = g_strsplit (version, ".", 3);
-    guint n_tokens = g_strv_length (tokens);
-    version_major = n_tokens > 0 ? atoi (tokens[0]) : 0;
-    version_minor = n_tokens > 1 ? atoi (tokens[1]) : 0;
+    if (binary)
+        save_version_cache (binary);
 
     return version;
 }
@@ -125,21 +290,25 @@ x_server_local_version_compare (guint major, guint minor)
 }
 
 static gboolean
-display_number_in_use (guint display_number)
+parse_display_number (const gchar *text, const gchar *suffix, guint *display_number)
 {
-    /* See if we know we are managing a server with that number */
-    for (GList *link = display_numbers; link; link = link->next)
-    {
-        guint number = GPOINTER_TO_UINT (link->data);
-        if (number == display_number)
-            return TRUE;
-    }
+    gchar *end;
+    guint64 number = g_ascii_strtoull (text, &end, 10);
+    if (end == text || strcmp (end, suffix) != 0 || number > G_MAXINT)
+        return FALSE;
 
-    /* See if an X server that we don't know of has a lock on that number */
+    *display_number = number;
+    return TRUE;
+}
+
+/* See if an X server that we don't know of has a valid lock on that number,
+ * ignore it if the contents are invalid or the process doesn't exist */
+static gboolean
+display_number_locked (guint display_number)
+{
     g_autofree gchar *path = g_strdup_printf ("/tmp/.X%d-lock", display_number);
     gboolean in_use = g_file_test (path, G_FILE_TEST_EXISTS);
 
-    /* See if that lock file is valid, ignore it if the contents are invalid or the process doesn't exist */
     g_autofree gchar *data = NULL;
     if (in_use && g_file_get_contents (path, &data, NULL, NULL))
     {
@@ -153,30 +322,88 @@ display_number_in_use (guint display_number)
     return in_use;
 }
 
+static void
+x11_socket_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer data)
+{
+    g_autofree gchar *name = g_file_get_basename (file);
+    guint number;
+    if (!g_str_has_prefix (name, "X") || !parse_display_number (name + 1, "", &number))
+        return;
+
+    if (event_type == G_FILE_MONITOR_EVENT_CREATED && !bitmap_get (&display_numbers, number))
+        bitmap_set (&foreign_display_numbers, number);
+    else if (event_type == G_FILE_MONITOR_EVENT_DELETED)
+        bitmap_clear (&foreign_display_numbers, number);
+}
+
+/* Find the X servers we don't manage once, then track them from their sockets */
+static void
+load_foreign_display_numbers (void)
+{
+    if (have_foreign_display_numbers)
+        return;
+    have_foreign_display_numbers = TRUE;
+
+    g_autoptr(GFile) socket_dir = g_file_new_for_path ("/tmp/.X11-unix");
+    g_autoptr(GError) error = NULL;
+    x11_socket_monitor = g_file_monitor_directory (socket_dir, G_FILE_MONITOR_NONE, NULL, &error);
+    if (x11_socket_monitor)
+        g_signal_connect (x11_socket_monitor, G_FILE_MONITOR_SIGNAL_CHANGED, G_CALLBACK (x11_socket_changed_cb), NULL);
+    else
+        g_debug ("Failed to monitor X server sockets: %s", error->message);
+
+    g_autoptr(GDir) dir = g_dir_open ("/tmp", 0, NULL);
+    if (!dir)
+        return;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        guint number;
+        if (g_str_has_prefix (name, ".X") &&
+            parse_display_number (name + 2, "-lock", &number) &&
+            display_number_locked (number))
+            bitmap_set (&foreign_display_numbers, number);
+    }
+}
+
 static guint
 x_server_local_get_unused_display_number (void)
 {
+    load_foreign_display_numbers ();
+
     guint number = config_get_integer (config_get_instance (), "LightDM", "minimum-display-number");
-    while (display_number_in_use (number))
-        number++;
+    while (TRUE)
+    {
+        number = bitmap_find_unset (&display_numbers, number);
+        if (bitmap_get (&foreign_display_numbers, number))
+        {
+            number++;
+            continue;
+        }
+
+        /* Catch servers that started since we last looked */
+        if (!display_number_locked (number))
+            break;
+        bitmap_set (&foreign_display_numbers, number);
+    }
 
-    display_numbers = g_list_append (display_numbers, GUINT_TO_POINTER (number));
+    bitmap_set (&display_numbers, number);
 
     return number;
 }
 
 static void
-x_server_local_release_display_number (guint display_number)
+x_server_local_release_display_number (XServerLocal *server)
 {
-    for (GList *link = display_numbers; link; link = link->next)
-    {
-        guint number = GPOINTER_TO_UINT (link->data);
-        if (number == display_number)
-        {
-            display_numbers = g_list_delete_link (display_numbers, link);
-            return;
-        }
-    }
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    if (priv->display_number_in_use)
+        bitmap_clear (&display_numbers, priv->display_number);
+    priv->display_number_in_use = FALSE;
+    if (priv->have_file_slot)
+        bitmap_clear (&file_slots, priv->file_slot);
+    priv->have_file_slot = FALSE;
 }
 
 XServerLocal *
@@ -299,13 +526,54 @@ x_server_local_set_background (XServerLocal *server, const gchar *background)
     priv->background = g_strdup (background);
 }
 
+/* Set if the X server is to pick its own display number. This avoids racing
+ * other X servers for a number, but it isn't known until the X server is ready */
+void
+x_server_local_set_use_displayfd (XServerLocal *server, gboolean use_displayfd)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_return_if_fail (priv->x_server_process == NULL);
+    x_server_local_release_display_number (server);
+    priv->have_display_number = FALSE;
+    priv->use_displayfd = use_displayfd;
+}
+
 static guint
 x_server_local_get_display_number (XServer *server)
 {
     XServerLocalPrivate *priv = x_server_local_get_instance_private (X_SERVER_LOCAL (server));
+
+    /* Numbers are allocated when first needed, unless the X server is choosing one */
+    if (!priv->have_display_number && !priv->use_displayfd)
+    {
+        priv->display_number = x_server_local_get_unused_display_number ();
+        priv->have_display_number = TRUE;
+        priv->display_number_in_use = TRUE;
+    }
+
     return priv->display_number;
 }
 
+/* Get a name for the files for this X server, the display number if it is known */
+static gchar *
+get_file_name (XServerLocal *server, const gchar *format, const gchar *displayfd_format)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    if (!priv->use_displayfd)
+        return g_strdup_printf (format, x_server_get_display_number (X_SERVER (server)));
+
+    if (!priv->have_file_slot)
+    {
+        priv->file_slot = bitmap_find_unset (&file_slots, 0);
+        bitmap_set (&file_slots, priv->file_slot);
+        priv->have_file_slot = TRUE;
+    }
+
+    return g_strdup_printf (displayfd_format, priv->file_slot);
+}
+
 static gint
 x_server_local_get_vt (DisplayServer *server)
 {
@@ -313,6 +581,21 @@ x_server_local_get_vt (DisplayServer *server)
     return priv->vt;
 }
 
+static GPid
+x_server_local_get_pid (DisplayServer *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (X_SERVER_LOCAL (server));
+    return priv->x_server_process ? process_get_pid (priv->x_server_process) : 0;
+}
+
+/* The address and authority are known once started, unless the X server is picking the display number */
+static gboolean
+x_server_local_get_can_connect_early (DisplayServer *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (X_SERVER_LOCAL (server));
+    return priv->x_server_process != NULL && !priv->use_displayfd;
+}
+
 const gchar *
 x_server_local_get_authority_file_path (XServerLocal *server)
 {
@@ -325,7 +608,7 @@ static gchar *
 get_absolute_command (const gchar *command)
 {
     g_auto(GStrv) tokens = g_strsplit (command, " ", 2);
-    g_autofree gchar *absolute_binary = g_find_program_in_path (tokens[0]);
+    g_autofree gchar *absolute_binary = program_cache_find (tokens[0], NULL);
     gchar *absolute_command = NULL;
     if (absolute_binary)
     {
@@ -362,18 +645,185 @@ x_server_local_get_log_stdout (XServerLocal *server)
     return TRUE;
 }
 
+/* Runs in the child after forking */
+static void
+run_child (Process *process, gpointer user_data)
+{
+    XServerLocal *server = user_data;
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    /* Let the X server inherit the pipe to report the display number on */
+    if (priv->displayfd_write >= 0)
+        fcntl (priv->displayfd_write, F_SETFD, 0);
+
+    if (priv->run_func)
+        priv->run_func (process, user_data);
+}
+
+static void
+close_displayfd (XServerLocal *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    if (priv->displayfd_write >= 0)
+        close (priv->displayfd_write);
+    priv->displayfd_write = -1;
+    if (priv->displayfd_watch)
+        g_source_remove (priv->displayfd_watch);
+    priv->displayfd_watch = 0;
+    g_clear_pointer (&priv->displayfd_channel, g_io_channel_unref);
+    if (priv->displayfd_data)
+        g_string_free (priv->displayfd_data, TRUE);
+    priv->displayfd_data = NULL;
+}
+
+static void
+x_server_ready (XServerLocal *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    priv->got_signal = TRUE;
+    trace_end (server, "x-server-start");
+
+    // FIXME: Check return value
+    DISPLAY_SERVER_CLASS (x_server_local_parent_class)->start (DISPLAY_SERVER (server));
+}
+
+/* The X server writes its display number and a newline once it is accepting connections */
+static gboolean
+displayfd_read_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    XServerLocal *server = data;
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    gchar buffer[64];
+    gsize n_read = 0;
+    g_autoptr(GError) error = NULL;
+    GIOStatus status = g_io_channel_read_chars (channel, buffer, sizeof (buffer), &n_read, &error);
+    if (status == G_IO_STATUS_AGAIN)
+        return G_SOURCE_CONTINUE;
+    if (error)
+        l_warning (server, "Failed to read display number: %s", error->message);
+    g_string_append_len (priv->displayfd_data, buffer, n_read);
+
+    const gchar *end = strchr (priv->displayfd_data->str, '\n');
+    if (!end)
+    {
+        if (status == G_IO_STATUS_NORMAL && priv->displayfd_data->len < sizeof (buffer))
+            return G_SOURCE_CONTINUE;
+
+        /* If the X server fails it will stop and be cleaned up then */
+        l_debug (server, "X server closed display number pipe without reporting one");
+        priv->displayfd_watch = 0;
+        close_displayfd (server);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_autofree gchar *text = g_strndup (priv->displayfd_data->str, end - priv->displayfd_data->str);
+    guint number;
+    priv->displayfd_watch = 0;
+    close_displayfd (server);
+    if (!parse_display_number (text, "", &number))
+    {
+        l_warning (server, "X server reported invalid display number '%s'", text);
+        process_stop (priv->x_server_process);
+        return G_SOURCE_REMOVE;
+    }
+
+    priv->display_number = number;
+    priv->have_display_number = TRUE;
+    priv->display_number_in_use = TRUE;
+    bitmap_set (&display_numbers, number);
+    bitmap_clear (&foreign_display_numbers, number);
+    x_server_display_number_changed (X_SERVER (server));
+
+    /* The X server doesn't check the number in its authority, but sessions need the right one */
+    XAuthority *authority = x_server_get_authority (X_SERVER (server));
+    if (authority)
+    {
+        g_autofree gchar *number_string = g_strdup_printf ("%d", number);
+        x_authority_set_number (authority, number_string);
+    }
+
+    l_debug (server, "X server is ready on display :%d", number);
+    x_server_ready (server);
+
+    return G_SOURCE_REMOVE;
+}
+static void write_authority_file (XServerLocal *server);
+
+/* Time to wait for the X server to signal it has reset before connecting to it anyway */
+#define RESET_TIMEOUT 5
+
+static void
+reset_complete (XServerLocal *server)
+{
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    priv->resetting = FALSE;
+    if (priv->reset_timeout)
+        g_source_remove (priv->reset_timeout);
+    priv->reset_timeout = 0;
+
+    l_debug (server, "X server reset");
+    DISPLAY_SERVER_CLASS (x_server_local_parent_class)->start (DISPLAY_SERVER (server));
+}
+
+static gboolean
+reset_timeout_cb (gpointer data)
+{
+    XServerLocal *server = data;
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    priv->reset_timeout = 0;
+    l_debug (server, "X server didn't signal it has reset, connecting anyway");
+    reset_complete (server);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Use a new authority cookie and have the X server reset with SIGHUP. This disconnects
+ * all clients and rereads the authority file, but keeps the X server and its video mode */
+static gboolean
+x_server_local_reset (DisplayServer *display_server)
+{
+    XServerLocal *server = X_SERVER_LOCAL (display_server);
+    XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
+
+    /* XDMCP authority is given by the manager */
+    if (!priv->x_server_process || !priv->got_signal || priv->resetting || priv->xdmcp_server ||
+        !x_server_get_authority (X_SERVER (server)))
+        return FALSE;
+
+    l_debug (server, "Resetting X server");
+
+    x_server_set_local_authority (X_SERVER (server));
+    write_authority_file (server);
+
+    priv->resetting = TRUE;
+    priv->reset_timeout = g_timeout_add_seconds (RESET_TIMEOUT, reset_timeout_cb, server);
+    process_signal (priv->x_server_process, SIGHUP);
+
+    return TRUE;
+}
+
 static void
 got_signal_cb (Process *process, int signum, XServerLocal *server)
 {
     XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
 
-    if (signum == SIGUSR1 && !priv->got_signal)
+    /* The X server signals again when it has reset */
+    if (signum == SIGUSR1 && priv->resetting)
     {
-        priv->got_signal = TRUE;
-        l_debug (server, "Got signal from X server :%d", priv->display_number);
+        reset_complete (server);
+        return;
+    }
 
-        // FIXME: Check return value
-        DISPLAY_SERVER_CLASS (x_server_local_parent_class)->start (DISPLAY_SERVER (server));
+    /* With -displayfd the signal can arrive before the display number, so wait for that instead */
+    if (signum == SIGUSR1 && !priv->got_signal && !priv->use_displayfd)
+    {
+        l_debug (server, "Got signal from X server :%d", priv->display_number);
+        x_server_ready (server);
     }
 }
 
@@ -383,6 +833,14 @@ stopped_cb (Process *process, XServerLocal *server)
     XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
 
     l_debug (server, "X server stopped");
+    if (!priv->got_signal)
+        trace_end (server, "x-server-start");
+
+    close_displayfd (server);
+    priv->resetting = FALSE;
+    if (priv->reset_timeout)
+        g_source_remove (priv->reset_timeout);
+    priv->reset_timeout = 0;
 
     /* Release VT and display number for re-use */
     if (priv->have_vt_ref)
@@ -390,7 +848,7 @@ stopped_cb (Process *process, XServerLocal *server)
         vt_unref (priv->vt);
         priv->have_vt_ref = FALSE;
     }
-    x_server_local_release_display_number (priv->display_number);
+    x_server_local_release_display_number (server);
 
     if (x_server_get_authority (X_SERVER (server)) && priv->authority_file)
     {
@@ -425,7 +883,8 @@ write_authority_file (XServerLocal *server)
         if (g_mkdir_with_parents (dir, S_IRWXU) < 0)
             l_warning (server, "Failed to make authority directory %s: %s", dir, strerror (errno));
 
-        priv->authority_file = g_build_filename (dir, x_server_get_address (X_SERVER (server)), NULL);
+        g_autofree gchar *name = get_file_name (server, ":%d", "displayfd-%u");
+        priv->authority_file = g_build_filename (dir, name, NULL);
     }
 
     l_debug (server, "Writing X server authority to %s", priv->authority_file);
@@ -445,21 +904,23 @@ x_server_local_start (DisplayServer *display_server)
     g_return_val_if_fail (priv->x_server_process == NULL, FALSE);
 
     priv->got_signal = FALSE;
+    trace_begin (server, "x-server-start");
 
     g_return_val_if_fail (priv->command != NULL, FALSE);
 
-    ProcessRunFunc run_cb = X_SERVER_LOCAL_GET_CLASS (server)->get_run_function (server);
-    priv->x_server_process = process_new (run_cb, server);
+    priv->run_func = X_SERVER_LOCAL_GET_CLASS (server)->get_run_function (server);
+    priv->x_server_process = process_new (run_child, server);
     process_set_clear_environment (priv->x_server_process, TRUE);
+    process_set_priority (priv->x_server_process, PROCESS_PRIORITY_INTERACTIVE);
     g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_GOT_SIGNAL, G_CALLBACK (got_signal_cb), server);
     g_signal_connect (priv->x_server_process, PROCESS_SIGNAL_STOPPED, G_CALLBACK (stopped_cb), server);
 
     /* Setup logging */
-    g_autofree gchar *filename = g_strdup_printf ("x-%d.log", x_server_get_display_number (X_SERVER (server)));
+    g_autofree gchar *filename = get_file_name (server, "x-%d.log", "x-displayfd-%u.log");
     g_autofree gchar *dir = config_get_string (config_get_instance (), "LightDM", "log-directory");
     g_autofree gchar *log_file = g_build_filename (dir, filename, NULL);
     gboolean backup_logs = config_get_boolean (config_get_instance (), "LightDM", "backup-logs");
-    process_set_log_file (priv->x_server_process, log_file, X_SERVER_LOCAL_GET_CLASS (server)->get_log_stdout (server), backup_logs ? LOG_MODE_BACKUP_AND_TRUNCATE : LOG_MODE_APPEND);
+    process_set_log_file (priv->x_server_process, log_file, X_SERVER_LOCAL_GET_CLASS (server)->get_log_stdout (server), log_file_get_mode (backup_logs));
     l_debug (display_server, "Logging to %s", log_file);
 
     g_autofree gchar *absolute_command = get_absolute_command (priv->command);
@@ -477,7 +938,26 @@ x_server_local_start (DisplayServer *display_server)
 
     /* The display argument must be given first when the X server used
      * is Xvnc. */
-    g_string_append_printf (command, " :%d", priv->display_number);
+    if (priv->use_displayfd)
+    {
+        int fds[2];
+        if (!g_unix_open_pipe (fds, FD_CLOEXEC, NULL))
+        {
+            l_warning (display_server, "Failed to make pipe for display number: %s", strerror (errno));
+            stopped_cb (priv->x_server_process, X_SERVER_LOCAL (server));
+            return FALSE;
+        }
+        priv->displayfd_write = fds[1];
+        priv->displayfd_channel = g_io_channel_unix_new (fds[0]);
+        g_io_channel_set_close_on_unref (priv->displayfd_channel, TRUE);
+        g_io_channel_set_encoding (priv->displayfd_channel, NULL, NULL);
+        g_io_channel_set_flags (priv->displayfd_channel, G_IO_FLAG_NONBLOCK, NULL);
+        priv->displayfd_watch = g_io_add_watch (priv->displayfd_channel, G_IO_IN | G_IO_HUP, displayfd_read_cb, server);
+        priv->displayfd_data = g_string_new ("");
+        g_string_append_printf (command, " -displayfd %d", priv->displayfd_write);
+    }
+    else
+        g_string_append_printf (command, " :%d", x_server_get_display_number (X_SERVER (server)));
 
     if (priv->config_file)
         g_string_append_printf (command, " -config %s", priv->config_file);
@@ -555,10 +1035,18 @@ x_server_local_start (DisplayServer *display_server)
         process_set_env (priv->x_server_process, "LIGHTDM_TEST_ROOT", g_getenv ("LIGHTDM_TEST_ROOT"));
 
     gboolean result = process_start (priv->x_server_process, FALSE);
-    if (result)
-        l_debug (display_server, "Waiting for ready signal from X server :%d", priv->display_number);
-    else
+
+    /* Only the X server should have the write end, so we see it close if the X server fails */
+    if (priv->displayfd_write >= 0)
+        close (priv->displayfd_write);
+    priv->displayfd_write = -1;
+
+    if (!result)
         stopped_cb (priv->x_server_process, X_SERVER_LOCAL (server));
+    else if (priv->use_displayfd)
+        l_debug (display_server, "Waiting for X server to report its display number");
+    else
+        l_debug (display_server, "Waiting for ready signal from X server :%d", priv->display_number);
 
     return result;
 }
@@ -576,7 +1064,7 @@ x_server_local_init (XServerLocal *server)
     XServerLocalPrivate *priv = x_server_local_get_instance_private (server);
     priv->vt = -1;
     priv->command = g_strdup ("X");
-    priv->display_number = x_server_local_get_unused_display_number ();
+    priv->displayfd_write = -1;
 }
 
 static void
@@ -598,6 +1086,10 @@ x_server_local_finalize (GObject *object)
     if (priv->have_vt_ref)
         vt_unref (priv->vt);
     g_clear_pointer (&priv->background, g_free);
+    if (priv->reset_timeout)
+        g_source_remove (priv->reset_timeout);
+    close_displayfd (self);
+    x_server_local_release_display_number (self);
 
     G_OBJECT_CLASS (x_server_local_parent_class)->finalize (object);
 }
@@ -613,8 +1105,11 @@ x_server_local_class_init (XServerLocalClass *klass)
     klass->get_log_stdout = x_server_local_get_log_stdout;
     x_server_class->get_display_number = x_server_local_get_display_number;
     display_server_class->get_vt = x_server_local_get_vt;
+    display_server_class->get_pid = x_server_local_get_pid;
+    display_server_class->get_can_connect_early = x_server_local_get_can_connect_early;
     display_server_class->start = klass->start = x_server_local_start;
     display_server_class->stop = x_server_local_stop;
+    display_server_class->reset = x_server_local_reset;
     object_class->finalize = x_server_local_finalize;
 }
 
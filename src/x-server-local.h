@@ -55,6 +55,8 @@ void x_server_local_set_xdg_seat (XServerLocal *server, const gchar *xdg_seat);
 
 void x_server_local_set_allow_tcp (XServerLocal *server, gboolean allow_tcp);
 
+void x_server_local_set_use_displayfd (XServerLocal *server, gboolean use_displayfd);
+
 void x_server_local_set_xdmcp_server (XServerLocal *server, const gchar *hostname);
 
 const gchar *x_server_local_get_xdmcp_server (XServerLocal *server);
@@ -25,6 +25,9 @@ typedef struct
     /* File descriptor to use for standard input */
     gint socket_fd;
 
+    /* Port to listen for a VNC connection on the loopback interface, or 0 to use socket_fd */
+    guint port;
+
     /* Geometry and colour depth */
     gint width, height, depth;
 } XServerXVNCPrivate;
@@ -48,6 +51,14 @@ x_server_xvnc_set_socket (XServerXVNC *server, int fd)
     priv->socket_fd = fd;
 }
 
+void
+x_server_xvnc_set_port (XServerXVNC *server, guint port)
+{
+    XServerXVNCPrivate *priv = x_server_xvnc_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->port = port;
+}
+
 int
 x_server_xvnc_get_socket (XServerXVNC *server)
 {
@@ -80,9 +91,12 @@ x_server_xvnc_run (Process *process, gpointer user_data)
     XServerXVNCPrivate *priv = x_server_xvnc_get_instance_private (server);
 
     /* Connect input */
-    dup2 (priv->socket_fd, STDIN_FILENO);
-    dup2 (priv->socket_fd, STDOUT_FILENO);
-    close (priv->socket_fd);
+    if (priv->socket_fd >= 0)
+    {
+        dup2 (priv->socket_fd, STDIN_FILENO);
+        dup2 (priv->socket_fd, STDOUT_FILENO);
+        close (priv->socket_fd);
+    }
 
     /* Set SIGUSR1 to ignore so the X server can indicate it when it is ready */
     signal (SIGUSR1, SIG_IGN);
@@ -112,7 +126,10 @@ x_server_xvnc_add_args (XServerLocal *x_server, GString *command)
     XServerXVNC *server = X_SERVER_XVNC (x_server);
     XServerXVNCPrivate *priv = x_server_xvnc_get_instance_private (server);
 
-    g_string_append (command, " -inetd");
+    if (priv->port != 0)
+        g_string_append_printf (command, " -rfbport %u -localhost", priv->port);
+    else
+        g_string_append (command, " -inetd");
 
     if (priv->width > 0 && priv->height > 0)
         g_string_append_printf (command, " -geometry %dx%d", priv->width, priv->height);
@@ -125,6 +142,7 @@ static void
 x_server_xvnc_init (XServerXVNC *server)
 {
     XServerXVNCPrivate *priv = x_server_xvnc_get_instance_private (server);
+    priv->socket_fd = -1;
     priv->width = 1024;
     priv->height = 768;
     priv->depth = 24;
@@ -42,6 +42,8 @@ XServerXVNC *x_server_xvnc_new (void);
 
 void x_server_xvnc_set_socket (XServerXVNC *server, int fd);
 
+void x_server_xvnc_set_port (XServerXVNC *server, guint port);
+
 int x_server_xvnc_get_socket (XServerXVNC *server);
 
 void x_server_xvnc_set_geometry (XServerXVNC *server, gint width, gint height);
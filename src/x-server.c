@@ -11,10 +11,16 @@
 
 #include <config.h>
 #include <string.h>
-#include <xcb/xcb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <gio/gio.h>
 
 #include "x-server.h"
+#include "xcb-library.h"
 #include "configuration.h"
+#include "worker.h"
 
 typedef struct
 {
@@ -32,8 +38,26 @@ typedef struct
 
     /* Connection to this X server */
     xcb_connection_t *connection;
+
+    /* Seconds to wait for a remote X server to accept our connection (0 for no limit) */
+    guint connect_timeout;
+
+    /* Connection to a remote X server being made in a worker */
+    GCancellable *connect_cancellable;
+    guint connect_timeout_timer;
 } XServerPrivate;
 
+/* Connection to a remote X server, made in a worker thread */
+typedef struct
+{
+    gchar *hostname;
+    guint display_number;
+    guint timeout;
+    gchar *authorization_name;
+    GBytes *authorization_data;
+    xcb_connection_t *connection;
+} ConnectRequest;
+
 G_DEFINE_TYPE_WITH_PRIVATE (XServer, x_server, DISPLAY_SERVER_TYPE)
 
 void
@@ -49,6 +73,17 @@ x_server_set_hostname (XServer *server, const gchar *hostname)
     priv->address = NULL;
 }
 
+/* Called by sub-classes when the display number has changed */
+void
+x_server_display_number_changed (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    g_return_if_fail (server != NULL);
+
+    g_clear_pointer (&priv->address, g_free);
+}
+
 gchar *
 x_server_get_hostname (XServer *server)
 {
@@ -117,6 +152,36 @@ x_server_get_authority (XServer *server)
     return priv->authority;
 }
 
+/* Check if the connection to the X server is still up, without blocking */
+gboolean
+x_server_get_is_connected (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    g_return_val_if_fail (server != NULL, FALSE);
+
+    if (!priv->connection || xcb_library_get ()->connection_has_error (priv->connection))
+        return FALSE;
+
+    /* A server that has gone shows as the end of the stream or a reset */
+    struct pollfd fds = { xcb_library_get ()->get_file_descriptor (priv->connection), POLLIN, 0 };
+    if (poll (&fds, 1, 0) <= 0)
+        return TRUE;
+    if (fds.revents & (POLLERR | POLLHUP))
+        return FALSE;
+    guint8 data;
+    ssize_t n_read = recv (fds.fd, &data, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n_read > 0 || (n_read < 0 && (errno == EAGAIN || errno == EINTR));
+}
+
+void
+x_server_set_connect_timeout (XServer *server, guint timeout)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->connect_timeout = timeout;
+}
+
 static const gchar *
 x_server_get_session_type (DisplayServer *server)
 {
@@ -140,12 +205,155 @@ x_server_get_can_share (DisplayServer *server)
     return g_strcmp0 (actual_local_hostname, priv->local_hostname) == 0;
 }
 
+static void
+connect_request_free (ConnectRequest *request)
+{
+    g_free (request->hostname);
+    g_free (request->authorization_name);
+    g_clear_pointer (&request->authorization_data, g_bytes_unref);
+    if (request->connection)
+        xcb_library_get ()->disconnect (request->connection);
+    g_free (request);
+}
+
+static gboolean
+connect_thread (gpointer data, GCancellable *cancellable, GError **error)
+{
+    ConnectRequest *request = data;
+
+    /* Make the TCP connection ourselves so an unreachable host can't hold us for the system connect timeout */
+    g_autoptr(GSocketClient) client = g_socket_client_new ();
+    g_socket_client_set_timeout (client, request->timeout);
+    g_autoptr(GSocketConnectable) address = g_network_address_new (request->hostname, 6000 + request->display_number);
+    g_autoptr(GSocketConnection) connection = g_socket_client_connect (client, address, cancellable, error);
+    if (!connection)
+        return FALSE;
+
+    const XcbLibrary *xcb = xcb_library_get ();
+    if (!xcb)
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "XCB not available");
+        return FALSE;
+    }
+
+    xcb_auth_info_t *auth = NULL, a;
+    if (request->authorization_name)
+    {
+        gsize data_length;
+        a.namelen = strlen (request->authorization_name);
+        a.name = request->authorization_name;
+        a.data = (char *) g_bytes_get_data (request->authorization_data, &data_length);
+        a.datalen = data_length;
+        auth = &a;
+    }
+
+    /* XCB owns the descriptor, the socket connection closes its own */
+    int fd = dup (g_socket_get_fd (g_socket_connection_get_socket (connection)));
+    request->connection = xcb->connect_to_fd (fd, auth);
+    if (xcb->connection_has_error (request->connection))
+    {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED, "X server did not accept connection");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+connect_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(XServer) server = data;
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    g_autoptr(GError) error = NULL;
+    gboolean connected = worker_run_finish (result, &error);
+
+    /* Timed out or stopped, which has already been dealt with */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    g_clear_object (&priv->connect_cancellable);
+    g_clear_handle_id (&priv->connect_timeout_timer, g_source_remove);
+
+    if (!connected)
+    {
+        l_debug (server, "Error connecting to XServer %s: %s", x_server_get_address (server), error ? error->message : "");
+        display_server_stop (DISPLAY_SERVER (server));
+        return;
+    }
+
+    ConnectRequest *request = worker_get_data (result);
+    priv->connection = g_steal_pointer (&request->connection);
+
+    DISPLAY_SERVER_CLASS (x_server_parent_class)->start (DISPLAY_SERVER (server));
+}
+
+static gboolean
+connect_timeout_cb (gpointer data)
+{
+    XServer *server = data;
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    priv->connect_timeout_timer = 0;
+
+    l_debug (server, "Timed out connecting to XServer %s", x_server_get_address (server));
+    g_cancellable_cancel (priv->connect_cancellable);
+    g_clear_object (&priv->connect_cancellable);
+    display_server_stop (DISPLAY_SERVER (server));
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Connect to an X server over the network without blocking the main loop, ready is signalled once connected */
+static void
+start_remote_connect (XServer *server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (server);
+
+    ConnectRequest *request = g_new0 (ConnectRequest, 1);
+    request->hostname = g_strdup (priv->hostname);
+    request->display_number = x_server_get_display_number (server);
+    request->timeout = priv->connect_timeout;
+    if (priv->authority)
+    {
+        request->authorization_name = g_strdup (x_authority_get_authorization_name (priv->authority));
+        request->authorization_data = g_bytes_new (x_authority_get_authorization_data (priv->authority),
+                                                   x_authority_get_authorization_data_length (priv->authority));
+    }
+
+    priv->connect_cancellable = g_cancellable_new ();
+    worker_run (connect_thread, request, (GDestroyNotify) connect_request_free, priv->connect_cancellable, connect_cb, g_object_ref (server));
+
+    /* The handshake after the TCP connection can't be interrupted, so also give up on it from here */
+    if (priv->connect_timeout > 0)
+        priv->connect_timeout_timer = g_timeout_add_seconds (priv->connect_timeout, connect_timeout_cb, server);
+}
+
 static gboolean
 x_server_start (DisplayServer *display_server)
 {
     XServer *server = X_SERVER (display_server);
     XServerPrivate *priv = x_server_get_instance_private (server);
 
+    /* The previous connection is closed by the X server resetting */
+    if (priv->connection)
+        xcb_library_get ()->disconnect (priv->connection);
+    priv->connection = NULL;
+
+    if (priv->hostname)
+    {
+        l_debug (server, "Connecting to XServer %s", x_server_get_address (server));
+        start_remote_connect (server);
+        return TRUE;
+    }
+
+    const XcbLibrary *xcb = xcb_library_get ();
+    if (!xcb)
+    {
+        l_debug (server, "Can't connect to XServer %s without XCB", x_server_get_address (server));
+        return FALSE;
+    }
+
     xcb_auth_info_t *auth = NULL, a;
     if (priv->authority)
     {
@@ -158,8 +366,8 @@ x_server_start (DisplayServer *display_server)
 
     /* Open connection */
     l_debug (server, "Connecting to XServer %s", x_server_get_address (server));
-    priv->connection = xcb_connect_to_display_with_auth_info (x_server_get_address (server), auth, NULL);
-    if (xcb_connection_has_error (priv->connection))
+    priv->connection = xcb->connect_to_display_with_auth_info (x_server_get_address (server), auth, NULL);
+    if (xcb->connection_has_error (priv->connection))
     {
         l_debug (server, "Error connecting to XServer %s", x_server_get_address (server));
         return FALSE;
@@ -214,6 +422,19 @@ x_server_disconnect_session (DisplayServer *display_server, Session *session)
     session_set_x_authority (session, NULL, FALSE);
 }
 
+static void
+x_server_stop (DisplayServer *display_server)
+{
+    XServerPrivate *priv = x_server_get_instance_private (X_SERVER (display_server));
+
+    if (priv->connect_cancellable)
+        g_cancellable_cancel (priv->connect_cancellable);
+    g_clear_object (&priv->connect_cancellable);
+    g_clear_handle_id (&priv->connect_timeout_timer, g_source_remove);
+
+    DISPLAY_SERVER_CLASS (x_server_parent_class)->stop (display_server);
+}
+
 void
 x_server_init (XServer *server)
 {
@@ -229,8 +450,10 @@ x_server_finalize (GObject *object)
     g_clear_pointer (&priv->address, g_free);
     g_clear_object (&priv->authority);
     if (priv->connection)
-        xcb_disconnect (priv->connection);
+        xcb_library_get ()->disconnect (priv->connection);
     priv->connection = NULL;
+    g_clear_object (&priv->connect_cancellable);
+    g_clear_handle_id (&priv->connect_timeout_timer, g_source_remove);
 
     G_OBJECT_CLASS (x_server_parent_class)->finalize (object);
 }
@@ -244,6 +467,7 @@ x_server_class_init (XServerClass *klass)
     display_server_class->get_session_type = x_server_get_session_type;
     display_server_class->get_can_share = x_server_get_can_share;
     display_server_class->start = x_server_start;
+    display_server_class->stop = x_server_stop;
     display_server_class->connect_session = x_server_connect_session;
     display_server_class->disconnect_session = x_server_disconnect_session;
     object_class->finalize = x_server_finalize;
@@ -45,6 +45,8 @@ gchar *x_server_get_hostname (XServer *server);
 
 guint x_server_get_display_number (XServer *server);
 
+void x_server_display_number_changed (XServer *server);
+
 const gchar *x_server_get_address (XServer *server);
 
 const gchar *x_server_get_authentication_name (XServer *server);
@@ -59,6 +61,10 @@ void x_server_set_local_authority (XServer *server);
 
 XAuthority *x_server_get_authority (XServer *server);
 
+gboolean x_server_get_is_connected (XServer *server);
+
+void x_server_set_connect_timeout (XServer *server, guint timeout);
+
 G_END_DECLS
 
 #endif /* X_SERVER_H_ */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#include <gmodule.h>
+
+#include "xcb-library.h"
+
+/*
+ * XCB is only needed to watch X servers, so it is loaded the first time one
+ * is connected to rather than linked in. Daemons that only run Wayland
+ * sessions never load it.
+ */
+
+#define XCB_LIBRARY_NAME "libxcb.so.1"
+
+static gboolean
+get_symbol (GModule *module, const gchar *name, gpointer *symbol)
+{
+    if (g_module_symbol (module, name, symbol))
+        return TRUE;
+
+    g_warning ("Failed to find %s in %s: %s", name, XCB_LIBRARY_NAME, g_module_error ());
+    return FALSE;
+}
+
+static gpointer
+load_library (gpointer data)
+{
+    static XcbLibrary library;
+
+    GModule *module = g_module_open (XCB_LIBRARY_NAME, G_MODULE_BIND_LAZY);
+    if (!module)
+    {
+        g_warning ("Failed to load %s: %s", XCB_LIBRARY_NAME, g_module_error ());
+        return NULL;
+    }
+    g_module_make_resident (module);
+
+    /* Look the functions up in the global scope, so they can still be replaced with LD_PRELOAD */
+    GModule *global = g_module_open (NULL, G_MODULE_BIND_LAZY);
+    gboolean result = get_symbol (global, "xcb_connect_to_fd", (gpointer *) &library.connect_to_fd) &&
+                      get_symbol (global, "xcb_connect_to_display_with_auth_info", (gpointer *) &library.connect_to_display_with_auth_info) &&
+                      get_symbol (global, "xcb_connection_has_error", (gpointer *) &library.connection_has_error) &&
+                      get_symbol (global, "xcb_get_file_descriptor", (gpointer *) &library.get_file_descriptor) &&
+                      get_symbol (global, "xcb_disconnect", (gpointer *) &library.disconnect);
+    g_module_close (global);
+
+    return result ? &library : NULL;
+}
+
+/* Get the XCB functions, loading the library if not already loaded. Returns NULL if it can't be loaded */
+const XcbLibrary *
+xcb_library_get (void)
+{
+    static GOnce once = G_ONCE_INIT;
+    return g_once (&once, load_library, NULL);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2010-2011 Robert Ancell.
+ * Author: Robert Ancell <robert.ancell@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version. See http://www.gnu.org/copyleft/gpl.html the full text of the
+ * license.
+ */
+
+#ifndef XCB_LIBRARY_H_
+#define XCB_LIBRARY_H_
+
+#include <glib.h>
+#include <xcb/xcb.h>
+
+/* The XCB functions used to connect to X servers */
+typedef struct
+{
+    xcb_connection_t *(*connect_to_fd) (int fd, xcb_auth_info_t *auth_info);
+    xcb_connection_t *(*connect_to_display_with_auth_info) (const char *display, xcb_auth_info_t *auth, int *screen);
+    int (*connection_has_error) (xcb_connection_t *c);
+    int (*get_file_descriptor) (xcb_connection_t *c);
+    void (*disconnect) (xcb_connection_t *c);
+} XcbLibrary;
+
+const XcbLibrary *xcb_library_get (void);
+
+#endif /* XCB_LIBRARY_H_ */
@@ -20,8 +20,35 @@ typedef struct
     const guint8 *data;
     guint16 remaining;
     gboolean overflow;
+
+    /* Memory to decode strings and arrays into, or NULL to allocate them */
+    guint8 *arena;
+    gsize arena_remaining;
+    gboolean arena_overflow;
 } PacketReader;
 
+/* Allocate memory for a decoded field, from the arena if one is being used */
+static gpointer
+reader_alloc (PacketReader *reader, gsize size)
+{
+    if (!reader->arena)
+        return g_malloc (size);
+
+    /* Keep pointers aligned */
+    gsize padding = (sizeof (gpointer) - ((gsize) reader->arena % sizeof (gpointer))) % sizeof (gpointer);
+    if (reader->arena_remaining < padding + size)
+    {
+        reader->arena_overflow = TRUE;
+        return NULL;
+    }
+
+    gpointer value = reader->arena + padding;
+    reader->arena += padding + size;
+    reader->arena_remaining -= padding + size;
+
+    return value;
+}
+
 static guint8
 read_card8 (PacketReader *reader)
 {
@@ -54,6 +81,21 @@ static void
 read_data (PacketReader *reader, XDMCPData *data)
 {
     data->length = read_card16 (reader);
+
+    /* When decoding into an arena the data is used where it is in the packet */
+    if (reader->arena)
+    {
+        if (reader->remaining < data->length)
+        {
+            reader->overflow = TRUE;
+            data->length = 0;
+        }
+        data->data = (guchar *) reader->data;
+        reader->data += data->length;
+        reader->remaining -= data->length;
+        return;
+    }
+
     data->data = g_malloc (sizeof (guint8) * data->length);
     for (guint16 i = 0; i < data->length; i++)
         data->data[i] = read_card8 (reader);
@@ -62,8 +104,12 @@ read_data (PacketReader *reader, XDMCPData *data)
 static gchar *
 read_string (PacketReader *reader)
 {
+    static gchar empty[] = "";
+
     guint16 length = read_card16 (reader);
-    gchar *string = g_malloc (sizeof (gchar) * (length + 1));
+    gchar *string = reader_alloc (reader, sizeof (gchar) * (length + 1));
+    if (!string)
+        return empty;
     guint16 i;
     for (i = 0; i < length; i++)
         string[i] = (gchar) read_card8 (reader);
@@ -75,8 +121,12 @@ read_string (PacketReader *reader)
 static gchar **
 read_string_array (PacketReader *reader)
 {
+    static gchar *empty[] = { NULL };
+
     guint8 n_strings = read_card8 (reader);
-    gchar **strings = g_malloc (sizeof (gchar *) * (n_strings + 1));
+    gchar **strings = reader_alloc (reader, sizeof (gchar *) * (n_strings + 1));
+    if (!strings)
+        return empty;
     guint8 i;
     for (i = 0; i < n_strings; i++)
         strings[i] = read_string (reader);
@@ -155,106 +205,85 @@ xdmcp_packet_alloc (XDMCPOpcode opcode)
     return packet;
 }
 
-XDMCPPacket *
-xdmcp_packet_decode (const guint8 *data, gsize data_length)
+static gboolean
+decode (PacketReader *reader, XDMCPPacket *packet)
 {
-    PacketReader reader;
-    reader.data = data;
-    reader.remaining = data_length;
-    reader.overflow = FALSE;
-
-    guint16 version = read_card16 (&reader);
-    guint16 opcode = read_card16 (&reader);
-    guint16 length = read_card16 (&reader);
-
-    if (reader.overflow)
-    {
-        g_warning ("Ignoring short packet"); // FIXME: Use GError
-        return NULL;
-    }
-    if (version != XDMCP_VERSION)
-    {
-        g_warning ("Ignoring packet from unknown version %d", version);
-        return NULL;
-    }
-    if (length != reader.remaining)
-    {
-        g_warning ("Ignoring packet of wrong length. Opcode %d expected %d octets, got %d", opcode, length, reader.remaining);
-        return NULL;
-    }
-
-    XDMCPPacket *packet = xdmcp_packet_alloc (opcode);
     gboolean failed = FALSE;
     switch (packet->opcode)
     {
     case XDMCP_BroadcastQuery:
     case XDMCP_Query:
     case XDMCP_IndirectQuery:
-        packet->Query.authentication_names = read_string_array (&reader);
+        packet->Query.authentication_names = read_string_array (reader);
         break;
     case XDMCP_ForwardQuery:
-        read_data (&reader, &packet->ForwardQuery.client_address);
-        read_data (&reader, &packet->ForwardQuery.client_port);
-        packet->ForwardQuery.authentication_names = read_string_array (&reader);
+        read_data (reader, &packet->ForwardQuery.client_address);
+        read_data (reader, &packet->ForwardQuery.client_port);
+        packet->ForwardQuery.authentication_names = read_string_array (reader);
         break;
     case XDMCP_Willing:
-        packet->Willing.authentication_name = read_string (&reader);
-        packet->Willing.hostname = read_string (&reader);
-        packet->Willing.status = read_string (&reader);
+        packet->Willing.authentication_name = read_string (reader);
+        packet->Willing.hostname = read_string (reader);
+        packet->Willing.status = read_string (reader);
         break;
     case XDMCP_Unwilling:
-        packet->Unwilling.hostname = read_string (&reader);
-        packet->Unwilling.status = read_string (&reader);
+        packet->Unwilling.hostname = read_string (reader);
+        packet->Unwilling.status = read_string (reader);
         break;
     case XDMCP_Request:
-        packet->Request.display_number = read_card16 (&reader);
-        packet->Request.n_connections = read_card8 (&reader);
-        packet->Request.connections = g_malloc (sizeof (XDMCPConnection) * packet->Request.n_connections);
+        packet->Request.display_number = read_card16 (reader);
+        packet->Request.n_connections = read_card8 (reader);
+        packet->Request.connections = reader_alloc (reader, sizeof (XDMCPConnection) * packet->Request.n_connections);
+        if (reader->arena_overflow)
+        {
+            packet->Request.n_connections = 0;
+            break;
+        }
         for (int i = 0; i < packet->Request.n_connections; i++)
-            packet->Request.connections[i].type = read_card16 (&reader);
-        if (read_card8 (&reader) != packet->Request.n_connections)
+            packet->Request.connections[i].type = read_card16 (reader);
+        if (read_card8 (reader) != packet->Request.n_connections)
         {
             g_warning ("Number of connection types does not match number of connection addresses");
             failed = TRUE;
         }
         for (int i = 0; i < packet->Request.n_connections; i++)
-            read_data (&reader, &packet->Request.connections[i].address);
-        packet->Request.authentication_name = read_string (&reader);
-        read_data (&reader, &packet->Request.authentication_data);
-        packet->Request.authorization_names = read_string_array (&reader);
-        packet->Request.manufacturer_display_id = read_string (&reader);
+            read_data (reader, &packet->Request.connections[i].address);
+        packet->Request.authentication_name = read_string (reader);
+        read_data (reader, &packet->Request.authentication_data);
+        packet->Request.authorization_names = read_string_array (reader);
+        packet->Request.manufacturer_display_id = read_string (reader);
         break;
     case XDMCP_Accept:
-        packet->Accept.session_id = read_card32 (&reader);
-        packet->Accept.authentication_name = read_string (&reader);
-        read_data (&reader, &packet->Accept.authentication_data);
-        packet->Accept.authorization_name = read_string (&reader);
-        read_data (&reader, &packet->Accept.authorization_data);
+        packet->Accept.session_id = read_card32 (reader);
+        packet->Accept.authentication_name = read_string (reader);
+        read_data (reader, &packet->Accept.authentication_data);
+        packet->Accept.authorization_name = read_string (reader);
+        read_data (reader, &packet->Accept.authorization_data);
         break;
     case XDMCP_Decline:
-        packet->Decline.status = read_string (&reader);
-        packet->Decline.authentication_name = read_string (&reader);
-        read_data (&reader, &packet->Decline.authentication_data);
+        packet->Decline.status = read_string (reader);
+        packet->Decline.authentication_name = read_string (reader);
+        read_data (reader, &packet->Decline.authentication_data);
         break;
     case XDMCP_Manage:
-        packet->Manage.session_id = read_card32 (&reader);
-        packet->Manage.display_number = read_card16 (&reader);
-        packet->Manage.display_class = read_string (&reader);
+        packet->Manage.session_id = read_card32 (reader);
+        packet->Manage.display_number = read_card16 (reader);
+        packet->Manage.display_class = read_string (reader);
         break;
     case XDMCP_Refuse:
-        packet->Refuse.session_id = read_card32 (&reader);
+        packet->Refuse.session_id = read_card32 (reader);
         break;
     case XDMCP_Failed:
-        packet->Failed.session_id = read_card32 (&reader);
-        packet->Failed.status = read_string (&reader);
+        packet->Failed.session_id = read_card32 (reader);
+        packet->Failed.status = read_string (reader);
         break;
     case XDMCP_KeepAlive:
-        packet->KeepAlive.display_number = read_card16 (&reader);
-        packet->KeepAlive.session_id = read_card32 (&reader);
+        packet->KeepAlive.display_number = read_card16 (reader);
+        packet->KeepAlive.session_id = read_card32 (reader);
         break;
     case XDMCP_Alive:
-        packet->Alive.session_running = read_card8 (&reader) == 0 ? FALSE : TRUE;
-        packet->Alive.session_id = read_card32 (&reader);
+        packet->Alive.session_running = read_card8 (reader) == 0 ? FALSE : TRUE;
+        packet->Alive.session_id = read_card32 (reader);
         break;
     default:
         g_warning ("Unable to encode unknown opcode %d", packet->opcode);
@@ -264,18 +293,85 @@ xdmcp_packet_decode (const guint8 *data, gsize data_length)
 
     if (!failed)
     {
-        if (reader.overflow)
+        if (reader->arena_overflow)
+        {
+            g_warning ("Not enough space to decode packet");
+            failed = TRUE;
+        }
+        else if (reader->overflow)
         {
             g_warning ("Short packet received");
             failed = TRUE;
         }
-        else if (reader.remaining != 0)
+        else if (reader->remaining != 0)
         {
             g_warning ("Extra data on end of message");
             failed = TRUE;
         }
     }
-    if (failed)
+
+    return !failed;
+}
+
+/* Read the packet header, returns the opcode or 0 if the packet is not valid */
+static guint16
+read_header (PacketReader *reader, const guint8 *data, gsize data_length)
+{
+    reader->data = data;
+    reader->remaining = data_length;
+    reader->overflow = FALSE;
+
+    guint16 version = read_card16 (reader);
+    guint16 opcode = read_card16 (reader);
+    guint16 length = read_card16 (reader);
+
+    if (reader->overflow)
+    {
+        g_warning ("Ignoring short packet"); // FIXME: Use GError
+        return 0;
+    }
+    if (version != XDMCP_VERSION)
+    {
+        g_warning ("Ignoring packet from unknown version %d", version);
+        return 0;
+    }
+    if (length != reader->remaining)
+    {
+        g_warning ("Ignoring packet of wrong length. Opcode %d expected %d octets, got %d", opcode, length, reader->remaining);
+        return 0;
+    }
+
+    return opcode;
+}
+
+gboolean
+xdmcp_packet_decode_borrowed (const guchar *data, gsize length, guint8 *arena, gsize arena_length, XDMCPPacket *packet)
+{
+    PacketReader reader;
+    memset (&reader, 0, sizeof (reader));
+    reader.arena = arena;
+    reader.arena_remaining = arena_length;
+
+    memset (packet, 0, sizeof (XDMCPPacket));
+    packet->opcode = read_header (&reader, data, length);
+    if (packet->opcode == 0)
+        return FALSE;
+
+    return decode (&reader, packet);
+}
+
+XDMCPPacket *
+xdmcp_packet_decode (const guint8 *data, gsize data_length)
+{
+    PacketReader reader;
+    memset (&reader, 0, sizeof (reader));
+
+    guint16 opcode = read_header (&reader, data, data_length);
+    if (opcode == 0)
+        return NULL;
+
+    XDMCPPacket *packet = xdmcp_packet_alloc (opcode);
+    if (!decode (&reader, packet))
     {
         xdmcp_packet_free (packet);
         return NULL;
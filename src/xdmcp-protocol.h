@@ -140,6 +140,10 @@ XDMCPPacket *xdmcp_packet_alloc (XDMCPOpcode opcode);
 
 XDMCPPacket *xdmcp_packet_decode (const guchar *data, gsize length);
 
+/* Decode without allocating: data fields point into data and strings and arrays are placed in arena.
+ * The packet is only valid while data and arena are and must not be passed to xdmcp_packet_free */
+gboolean xdmcp_packet_decode_borrowed (const guchar *data, gsize length, guint8 *arena, gsize arena_length, XDMCPPacket *packet);
+
 gssize xdmcp_packet_encode (XDMCPPacket *packet, guchar *data, gsize length);
 
 gchar *xdmcp_packet_tostring (XDMCPPacket *packet);
@@ -9,8 +9,14 @@
  * license.
  */
 
+#define _GNU_SOURCE
+#include <config.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
 #include <X11/X.h>
 #define HASXDMAUTH
 #include <X11/Xdmcp.h>
@@ -19,6 +25,8 @@
 #include "xdmcp-server.h"
 #include "xdmcp-protocol.h"
 #include "x-authority.h"
+#include "logger.h"
+#include "socket-activation.h"
 
 enum {
     NEW_SESSION,
@@ -26,6 +34,86 @@ enum {
 };
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Largest XDMCP packet we handle */
+#define MAX_PACKET_SIZE 1024
+
+/* Number of packets to read from the socket at once */
+#define PACKET_BATCH_SIZE 32
+
+/* Space to decode the strings and arrays of a packet into */
+#define DECODE_ARENA_SIZE (MAX_PACKET_SIZE * 8)
+
+/* Size of the socket receive buffer, so a burst of queries isn't dropped */
+#define RECEIVE_BUFFER_SIZE (1024 * 1024)
+
+typedef struct
+{
+    guint8 data[PACKET_BATCH_SIZE][MAX_PACKET_SIZE];
+    struct sockaddr_storage addresses[PACKET_BATCH_SIZE];
+#ifdef HAVE_RECVMMSG
+    struct iovec vectors[PACKET_BATCH_SIZE];
+    struct mmsghdr messages[PACKET_BATCH_SIZE];
+#endif
+    /* Strings and arrays of the packet being handled, data fields point into data */
+    guint8 arena[DECODE_ARENA_SIZE];
+
+    /* Replies to queries waiting to be sent at the end of the batch */
+    GPtrArray *replies;
+} PacketBatch;
+
+/* Encoded reply waiting to be sent */
+typedef struct
+{
+    GSocketAddress *address;
+    guint8 data[MAX_PACKET_SIZE];
+    gsize length;
+} Reply;
+
+/* Number of one second slots in the wheel unmanaged sessions expire from */
+#define EXPIRY_WHEEL_SIZE 128
+
+/* Number of source addresses tracked for rate limiting, and how far to look for one */
+#define RATE_LIMIT_TABLE_SIZE 4096
+#define RATE_LIMIT_PROBE_LENGTH 8
+
+/* Token bucket for one source address, IPv4 addresses are stored IPv4-mapped */
+typedef struct
+{
+    guint8 address[16];
+    gfloat tokens;
+    /* Milliseconds the bucket was last filled, or 0 if the entry is unused */
+    guint32 fill_time;
+} RateLimitEntry;
+
+/* Reads packets from sockets, either in the main context or a worker thread */
+typedef struct
+{
+    XDMCPServer *server;
+
+    /* Buffers to receive a batch of packets into */
+    PacketBatch *batch;
+
+    /* Token buckets for the addresses this listener has had packets from,
+     * each listener has its own so workers don't share them */
+    RateLimitEntry *rate_limits;
+
+    /* Thread handling the sockets or NULL if in the main context */
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+
+    /* Worker sockets */
+    GSocket *socket, *socket6;
+} Listener;
+
+/* Encoded reply that is sent unchanged to many clients */
+typedef struct
+{
+    guint8 data[MAX_PACKET_SIZE];
+    gsize length;
+    gchar *description;
+} CachedReply;
+
 typedef struct
 {
     /* Port to listen on */
@@ -37,6 +125,9 @@ typedef struct
     /* Listening sockets */
     GSocket *socket, *socket6;
 
+    /* Cancellable for resolving the listen address */
+    GCancellable *cancellable;
+
     /* Hostname to report to client */
     gchar *hostname;
 
@@ -46,8 +137,73 @@ typedef struct
     /* XDM-AUTHENTICATION-1 key */
     gchar *key;
 
+    /* Key decoded into DES key bytes */
+    guint8 key_data[8];
+
+    /* TRUE if the Willing status reports the load on this host */
+    gboolean report_load;
+
+    /* Number of sessions / load average above which this host stops being willing, or 0 for no limit */
+    guint max_sessions;
+    gdouble max_load;
+
+    /* Milliseconds to delay Willing replies when busy, or 0 to not reply */
+    guint busy_delay;
+
+    /* Seconds since a managed session was last heard from that its display can come back to it, or 0 to always start again */
+    guint reattach_timeout;
+
+    /* Packets per second and burst allowed from each source address, or 0 for no limit */
+    guint rate_limit;
+    guint rate_limit_burst;
+
+    /* Last measured load average and free memory in bytes, and when it was measured */
+    gdouble load;
+    guint64 free_memory;
+    gint64 load_time;
+
     /* Known XDMCP sessions */
     GHashTable *sessions;
+
+    /* Unmanaged sessions by the hash of the Request that made them, so retransmissions reuse the chosen connection */
+    GHashTable *pending_requests;
+
+    /* Session IDs in use, one bit per ID */
+    guint32 session_ids[65536 / 32];
+
+    /* Last session ID allocated */
+    guint16 last_session_id;
+
+    /* Unmanaged sessions, by the second they expire in */
+    GQueue expiry_wheel[EXPIRY_WHEEL_SIZE];
+
+    /* Current slot in the expiry wheel */
+    guint expiry_position;
+
+    /* Number of sessions in the expiry wheel */
+    guint n_unmanaged;
+
+    /* Timer running the expiry wheel */
+    guint expiry_timeout;
+
+    /* Number of worker threads to handle packets in, or 0 to use the main context */
+    guint n_workers;
+
+    /* Listener for the main context */
+    Listener *listener;
+
+    /* Listeners running in worker threads */
+    GPtrArray *workers;
+
+    /* Context session packets from workers are handled in */
+    GMainContext *main_context;
+
+    /* Lock on the data workers access - hostname, status, key, replies and sessions */
+    GMutex lock;
+
+    /* Encoded replies to queries, cleared when the hostname, status or key changes */
+    CachedReply *willing_reply;
+    CachedReply *unwilling_reply;
 } XDMCPServerPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (XDMCPServer, xdmcp_server, G_TYPE_OBJECT)
@@ -55,12 +211,29 @@ G_DEFINE_TYPE_WITH_PRIVATE (XDMCPServer, xdmcp_server, G_TYPE_OBJECT)
 /* Maximum number of milliseconds client will resend manage requests before giving up */
 #define MANAGE_TIMEOUT 126000
 
-/* Address sort support structure */
-typedef struct
+/* Packet and session counts for all servers, packets can be counted from worker threads */
+static GMutex statistics_lock;
+static guint64 n_packets_received = 0;
+static guint64 n_packets_invalid = 0;
+static guint64 n_packets_rate_limited = 0;
+static guint64 n_sessions_accepted = 0;
+static guint64 n_sessions_declined = 0;
+
+
+static void
+cached_reply_free (CachedReply *reply)
 {
-    gsize index;
-    GInetAddress *address;
-} AddrSortItem;
+    g_free (reply->description);
+    g_free (reply);
+}
+
+static void
+clear_cached_replies (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_clear_pointer (&priv->willing_reply, cached_reply_free);
+    g_clear_pointer (&priv->unwilling_reply, cached_reply_free);
+}
 
 XDMCPServer *
 xdmcp_server_new (void)
@@ -101,13 +274,82 @@ xdmcp_server_get_listen_address (XDMCPServer *server)
     return priv->listen_address;
 }
 
+void
+xdmcp_server_set_worker_threads (XDMCPServer *server, guint n_workers)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->n_workers = n_workers;
+}
+
+void
+xdmcp_server_set_report_load (XDMCPServer *server, gboolean report_load)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
+    priv->report_load = report_load;
+    clear_cached_replies (server);
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_max_sessions (XDMCPServer *server, guint max_sessions)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
+    priv->max_sessions = max_sessions;
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_max_load (XDMCPServer *server, gdouble max_load)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
+    priv->max_load = max_load;
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_busy_delay (XDMCPServer *server, guint delay)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
+    priv->busy_delay = delay;
+    g_mutex_unlock (&priv->lock);
+}
+
+void
+xdmcp_server_set_reattach_timeout (XDMCPServer *server, guint timeout)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->reattach_timeout = timeout;
+}
+
+void
+xdmcp_server_set_rate_limit (XDMCPServer *server, guint rate, guint burst)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+    g_return_if_fail (server != NULL);
+    priv->rate_limit = rate;
+    priv->rate_limit_burst = MAX (burst, 1);
+}
+
 void
 xdmcp_server_set_hostname (XDMCPServer *server, const gchar *hostname)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
     g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
     g_free (priv->hostname);
     priv->hostname = g_strdup (hostname);
+    clear_cached_replies (server);
+    g_mutex_unlock (&priv->lock);
 }
 
 const gchar *
@@ -123,8 +365,11 @@ xdmcp_server_set_status (XDMCPServer *server, const gchar *status)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
     g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
     g_free (priv->status);
     priv->status = g_strdup (status);
+    clear_cached_replies (server);
+    g_mutex_unlock (&priv->lock);
 }
 
 const gchar *
@@ -135,62 +380,167 @@ xdmcp_server_get_status (XDMCPServer *server)
     return priv->status;
 }
 
+static void decode_key (const gchar *key, guint8 *data);
+
 void
 xdmcp_server_set_key (XDMCPServer *server, const gchar *key)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
     g_return_if_fail (server != NULL);
+    g_mutex_lock (&priv->lock);
     g_free (priv->key);
     priv->key = g_strdup (key);
+    if (key)
+        decode_key (key, priv->key_data);
+    else
+        memset (priv->key_data, 0, sizeof (priv->key_data));
+    clear_cached_replies (server);
+    g_mutex_unlock (&priv->lock);
 }
 
 typedef struct
 {
     XDMCPServer *server;
     XDMCPSession *session;
-    guint timeout_source;
+
+    /* Link in the expiry wheel while the session is not managed */
+    GList expiry_link;
+    guint8 expiry_slot;
+    gboolean unmanaged;
+
+    /* Monotonic time the display was last heard from, protected by the server lock */
+    gint64 last_seen;
+
+    /* TRUE if the display has requested this managed session again */
+    gboolean reattaching;
+
+    /* Request that made this session and the connection chosen from it, while unmanaged */
+    guint request_hash;
+    guint8 request_source[16];
+    gsize request_source_length;
+    guint16 connection_index;
 } SessionData;
 
+static void
+expire_session_cancel (SessionData *data)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (data->server);
+
+    if (!data->unmanaged)
+        return;
+
+    if (g_hash_table_lookup (priv->pending_requests, GUINT_TO_POINTER (data->request_hash)) == data)
+        g_hash_table_remove (priv->pending_requests, GUINT_TO_POINTER (data->request_hash));
+    g_queue_unlink (&priv->expiry_wheel[data->expiry_slot], &data->expiry_link);
+    data->unmanaged = FALSE;
+    priv->n_unmanaged--;
+    if (priv->n_unmanaged == 0 && priv->expiry_timeout != 0)
+    {
+        g_source_remove (priv->expiry_timeout);
+        priv->expiry_timeout = 0;
+    }
+}
+
 static void
 session_data_free (SessionData *data)
 {
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (data->server);
+    guint16 id = xdmcp_session_get_id (data->session);
+
+    expire_session_cancel (data);
+    priv->session_ids[id / 32] &= ~(1u << (id % 32));
     g_object_unref (data->session);
-    if (data->timeout_source != 0)
-        g_source_remove (data->timeout_source);
-    g_free (data);
+    g_slice_free (SessionData, data);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (SessionData, session_data_free)
-
 static gboolean
-session_timeout_cb (gpointer user_data)
+expiry_timeout_cb (gpointer user_data)
+{
+    XDMCPServer *server = user_data;
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    priv->expiry_position = (priv->expiry_position + 1) % EXPIRY_WHEEL_SIZE;
+    GQueue *slot = &priv->expiry_wheel[priv->expiry_position];
+
+    /* The last session removed stops the timer */
+    gboolean running = priv->n_unmanaged > slot->length;
+    if (!running)
+        priv->expiry_timeout = 0;
+
+    while (!g_queue_is_empty (slot))
+    {
+        SessionData *data = slot->head->data;
+        guint16 id = xdmcp_session_get_id (data->session);
+
+        g_debug ("Timing out unmanaged session %d", id);
+        g_mutex_lock (&priv->lock);
+        g_hash_table_remove (priv->sessions, GINT_TO_POINTER ((gint) id));
+        g_mutex_unlock (&priv->lock);
+    }
+
+    return running ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+/* Time out a session if it isn't managed */
+static void
+expire_session (SessionData *data)
 {
-    g_autoptr(SessionData) data = user_data;
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (data->server);
 
-    g_debug ("Timing out unmanaged session %d", xdmcp_session_get_id (data->session));
-    g_hash_table_remove (priv->sessions, GINT_TO_POINTER ((gint) xdmcp_session_get_id (data->session)));
-    return G_SOURCE_REMOVE;
+    data->expiry_link.data = data;
+    data->expiry_slot = (priv->expiry_position + MANAGE_TIMEOUT / 1000) % EXPIRY_WHEEL_SIZE;
+    data->unmanaged = TRUE;
+    g_queue_push_tail_link (&priv->expiry_wheel[data->expiry_slot], &data->expiry_link);
+    priv->n_unmanaged++;
+    if (priv->expiry_timeout == 0)
+        priv->expiry_timeout = g_timeout_add_seconds (1, expiry_timeout_cb, data->server);
 }
 
-static XDMCPSession *
+/* Get an unused session ID, starting after the last one allocated */
+static gboolean
+allocate_session_id (XDMCPServer *server, guint16 *id)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    guint16 candidate = priv->last_session_id;
+    for (guint i = 0; i < 65536; i++)
+    {
+        candidate++;
+
+        /* Zero means no session in Alive replies */
+        if (candidate == 0)
+            continue;
+
+        if ((priv->session_ids[candidate / 32] & (1u << (candidate % 32))) == 0)
+        {
+            priv->session_ids[candidate / 32] |= 1u << (candidate % 32);
+            priv->last_session_id = candidate;
+            *id = candidate;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static SessionData *
 add_session (XDMCPServer *server, GInetAddress *address, guint16 display_number, XAuthority *authority)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
     guint16 id;
-    do
-    {
-        id = g_random_int () & 0xFFFFFFFF;
-    } while (g_hash_table_lookup (priv->sessions, GINT_TO_POINTER ((gint) id)));
+    if (!allocate_session_id (server, &id))
+        return NULL;
 
-    SessionData *data = g_malloc0 (sizeof (SessionData));
+    SessionData *data = g_slice_new0 (SessionData);
     data->server = server;
     data->session = xdmcp_session_new (id, address, display_number, authority);
-    data->timeout_source = g_timeout_add (MANAGE_TIMEOUT, session_timeout_cb, data);
+    expire_session (data);
+    g_mutex_lock (&priv->lock);
     g_hash_table_insert (priv->sessions, GINT_TO_POINTER ((gint) id), data);
+    g_mutex_unlock (&priv->lock);
 
-    return data->session;
+    return data;
 }
 
 static SessionData *
@@ -200,6 +550,46 @@ get_session_data (XDMCPServer *server, guint16 id)
     return g_hash_table_lookup (priv->sessions, GINT_TO_POINTER ((gint) id));
 }
 
+/* Note the display has been heard from */
+static void
+touch_session (XDMCPServer *server, SessionData *data)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    g_mutex_lock (&priv->lock);
+    data->last_seen = g_get_monotonic_time ();
+    g_mutex_unlock (&priv->lock);
+}
+
+/* Find a managed session for a display that has come back after dropping off the network */
+static SessionData *
+find_returning_session (XDMCPServer *server, GInetAddress *address, guint16 display_number)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (priv->reattach_timeout == 0)
+        return NULL;
+
+    gint64 now = g_get_monotonic_time ();
+    SessionData *result = NULL;
+    g_mutex_lock (&priv->lock);
+    GHashTableIter iter;
+    g_hash_table_iter_init (&iter, priv->sessions);
+    gpointer value;
+    while (result == NULL && g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        SessionData *data = value;
+        if (!data->unmanaged &&
+            xdmcp_session_get_display_number (data->session) == display_number &&
+            g_inet_address_equal (xdmcp_session_get_address (data->session), address) &&
+            now - data->last_seen <= (gint64) priv->reattach_timeout * G_USEC_PER_SEC)
+            result = data;
+    }
+    g_mutex_unlock (&priv->lock);
+
+    return result;
+}
+
 static gchar *
 socket_address_to_string (GSocketAddress *address)
 {
@@ -207,17 +597,29 @@ socket_address_to_string (GSocketAddress *address)
     return g_strdup_printf ("%s:%d", inet_text, g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address)));
 }
 
-static void
-send_packet (GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
+static gssize
+encode_packet (GSocketAddress *address, XDMCPPacket *packet, guint8 *data)
 {
-    g_autofree gchar *address_string = socket_address_to_string (address);
-    g_debug ("Send %s to %s", xdmcp_packet_tostring (packet), address_string);
+    if (logger_get_debug_enabled ())
+    {
+        g_autofree gchar *packet_string = xdmcp_packet_tostring (packet);
+        g_autofree gchar *address_string = socket_address_to_string (address);
+        g_debug ("Send %s to %s", packet_string, address_string);
+    }
 
-    guint8 data[1024];
-    gssize n_written = xdmcp_packet_encode (packet, data, 1024);
+    gssize n_written = xdmcp_packet_encode (packet, data, MAX_PACKET_SIZE);
     if (n_written < 0)
         g_critical ("Failed to encode XDMCP packet");
-    else
+
+    return n_written;
+}
+
+static void
+send_packet (GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
+{
+    guint8 data[MAX_PACKET_SIZE];
+    gssize n_written = encode_packet (address, packet, data);
+    if (n_written >= 0)
     {
         g_autoptr(GError) error = NULL;
         g_socket_send_to (socket, address, (gchar *) data, n_written, NULL, &error);
@@ -226,6 +628,67 @@ send_packet (GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
     }
 }
 
+static void
+reply_free (Reply *reply)
+{
+    g_object_unref (reply->address);
+    g_free (reply);
+}
+
+/* Queue a reply to be sent with the others from this batch */
+static void
+queue_reply (PacketBatch *batch, GSocketAddress *address, CachedReply *cached_reply)
+{
+    if (logger_get_debug_enabled ())
+    {
+        g_autofree gchar *address_string = socket_address_to_string (address);
+        g_debug ("Send %s to %s", cached_reply->description, address_string);
+    }
+
+    Reply *reply = g_new0 (Reply, 1);
+    reply->address = g_object_ref (address);
+    memcpy (reply->data, cached_reply->data, cached_reply->length);
+    reply->length = cached_reply->length;
+    g_ptr_array_add (batch->replies, reply);
+}
+
+/* Send all queued replies in as few system calls as possible */
+static void
+flush_replies (PacketBatch *batch, GSocket *socket)
+{
+    guint n_replies = batch->replies->len;
+    if (n_replies == 0)
+        return;
+
+    g_autofree GOutputVector *vectors = g_new (GOutputVector, n_replies);
+    g_autofree GOutputMessage *messages = g_new0 (GOutputMessage, n_replies);
+    for (guint i = 0; i < n_replies; i++)
+    {
+        Reply *reply = g_ptr_array_index (batch->replies, i);
+        vectors[i].buffer = reply->data;
+        vectors[i].size = reply->length;
+        messages[i].address = reply->address;
+        messages[i].vectors = &vectors[i];
+        messages[i].num_vectors = 1;
+    }
+
+    guint offset = 0;
+    while (offset < n_replies)
+    {
+        g_autoptr(GError) error = NULL;
+        gint n_sent = g_socket_send_messages (socket, messages + offset, n_replies - offset, 0, NULL, &error);
+        if (n_sent <= 0)
+        {
+            if (error)
+                g_warning ("Error sending packet: %s", error->message);
+            break;
+        }
+        offset += n_sent;
+    }
+
+    g_ptr_array_set_size (batch->replies, 0);
+}
+
 static const gchar *
 get_authentication_name (XDMCPServer *server)
 {
@@ -236,11 +699,161 @@ get_authentication_name (XDMCPServer *server)
         return "";
 }
 
+static CachedReply *
+cache_reply (XDMCPPacket *packet)
+{
+    CachedReply *reply = g_new0 (CachedReply, 1);
+    gssize n_written = xdmcp_packet_encode (packet, reply->data, MAX_PACKET_SIZE);
+    if (n_written < 0)
+    {
+        g_critical ("Failed to encode XDMCP packet");
+        g_free (reply);
+        return NULL;
+    }
+    reply->length = n_written;
+    reply->description = xdmcp_packet_tostring (packet);
+
+    return reply;
+}
+
+static CachedReply *
+get_willing_reply (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (!priv->willing_reply)
+    {
+        XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Willing);
+        response->Willing.authentication_name = g_strdup (get_authentication_name (server));
+        response->Willing.hostname = g_strdup (priv->hostname);
+        if (priv->report_load)
+            response->Willing.status = g_strdup_printf ("%s%s%u sessions, load %.2f, %" G_GUINT64_FORMAT " MiB free",
+                                                        priv->status, priv->status[0] != '\0' ? ", " : "",
+                                                        g_hash_table_size (priv->sessions), priv->load, priv->free_memory / (1024 * 1024));
+        else
+            response->Willing.status = g_strdup (priv->status);
+        priv->willing_reply = cache_reply (response);
+        xdmcp_packet_free (response);
+    }
+
+    return priv->willing_reply;
+}
+
+static CachedReply *
+get_unwilling_reply (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (!priv->unwilling_reply)
+    {
+        XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Unwilling);
+        response->Unwilling.hostname = g_strdup (priv->hostname);
+        if (priv->key)
+            response->Unwilling.status = g_strdup_printf ("No matching authentication, server requires %s", get_authentication_name (server));
+        else
+            response->Unwilling.status = g_strdup ("No matching authentication");
+        priv->unwilling_reply = cache_reply (response);
+        xdmcp_packet_free (response);
+    }
+
+    return priv->unwilling_reply;
+}
+
+/* Measure the load on this host, at most once a second */
 static void
-handle_query (XDMCPServer *server, GSocket *socket, GSocketAddress *address, gchar **authentication_names)
+update_load (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (!priv->report_load && priv->max_load <= 0)
+        return;
+
+    gint64 now = g_get_monotonic_time ();
+    if (priv->load_time != 0 && now - priv->load_time < G_USEC_PER_SEC)
+        return;
+    priv->load_time = now;
+
+    if (getloadavg (&priv->load, 1) < 1)
+        priv->load = 0;
+    long pages = sysconf (_SC_AVPHYS_PAGES), page_size = sysconf (_SC_PAGESIZE);
+    priv->free_memory = pages > 0 && page_size > 0 ? (guint64) pages * page_size : 0;
+
+    /* Status has changed */
+    if (priv->report_load)
+        g_clear_pointer (&priv->willing_reply, cached_reply_free);
+}
+
+static gboolean
+is_busy (XDMCPServer *server)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
+    if (priv->max_sessions > 0 && g_hash_table_size (priv->sessions) >= priv->max_sessions)
+        return TRUE;
+    if (priv->max_load > 0 && priv->load >= priv->max_load)
+        return TRUE;
+
+    return FALSE;
+}
+
+/* Reply sent after a delay so less busy hosts answer first */
+typedef struct
+{
+    GSocket *socket;
+    GSocketAddress *address;
+    guint8 data[MAX_PACKET_SIZE];
+    gsize length;
+} DelayedReply;
+
+static void
+delayed_reply_free (DelayedReply *reply)
+{
+    g_object_unref (reply->socket);
+    g_object_unref (reply->address);
+    g_free (reply);
+}
+
+static gboolean
+delayed_reply_cb (gpointer user_data)
+{
+    DelayedReply *reply = user_data;
+
+    g_autoptr(GError) error = NULL;
+    g_socket_send_to (reply->socket, reply->address, (gchar *) reply->data, reply->length, NULL, &error);
+    if (error)
+        g_warning ("Error sending packet: %s", error->message);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+delay_reply (GSocket *socket, GSocketAddress *address, CachedReply *cached_reply, guint delay)
+{
+    if (logger_get_debug_enabled ())
+    {
+        g_autofree gchar *address_string = socket_address_to_string (address);
+        g_debug ("Send %s to %s in %ums", cached_reply->description, address_string, delay);
+    }
+
+    DelayedReply *reply = g_new0 (DelayedReply, 1);
+    reply->socket = g_object_ref (socket);
+    reply->address = g_object_ref (address);
+    memcpy (reply->data, cached_reply->data, cached_reply->length);
+    reply->length = cached_reply->length;
+
+    /* Run in the context of the thread handling this socket */
+    g_autoptr(GSource) source = g_timeout_source_new (delay);
+    g_source_set_callback (source, delayed_reply_cb, reply, (GDestroyNotify) delayed_reply_free);
+    g_source_attach (source, g_main_context_get_thread_default ());
+}
+
+static void
+handle_query (XDMCPServer *server, GSocket *socket, PacketBatch *batch, GSocketAddress *address, gchar **authentication_names)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    g_mutex_lock (&priv->lock);
+
     /* If no authentication requested and we are configured for none then allow */
     const gchar *authentication_name = NULL;
     if (authentication_names[0] == NULL && priv->key == NULL)
@@ -255,31 +868,30 @@ handle_query (XDMCPServer *server, GSocket *socket, GSocketAddress *address, gch
         }
     }
 
-    XDMCPPacket *response;
     if (authentication_name)
     {
-        response = xdmcp_packet_alloc (XDMCP_Willing);
-        response->Willing.authentication_name = g_strdup (authentication_name);
-        response->Willing.hostname = g_strdup (priv->hostname);
-        response->Willing.status = g_strdup (priv->status);
+        update_load (server);
+
+        CachedReply *reply = get_willing_reply (server);
+        if (reply && !is_busy (server))
+            queue_reply (batch, address, reply);
+        else if (reply && priv->busy_delay > 0)
+            delay_reply (socket, address, reply, priv->busy_delay);
+        else if (reply)
+            g_debug ("Not replying to query, host is busy");
     }
     else
     {
-        response = xdmcp_packet_alloc (XDMCP_Unwilling);
-        response->Unwilling.hostname = g_strdup (priv->hostname);
-        if (priv->key)
-            response->Unwilling.status = g_strdup_printf ("No matching authentication, server requires %s", get_authentication_name (server));
-        else
-            response->Unwilling.status = g_strdup ("No matching authentication");
+        CachedReply *reply = get_unwilling_reply (server);
+        if (reply)
+            queue_reply (batch, address, reply);
     }
 
-    send_packet (socket, address, response);
-
-    xdmcp_packet_free (response);
+    g_mutex_unlock (&priv->lock);
 }
 
 static void
-handle_forward_query (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
+handle_forward_query (XDMCPServer *server, GSocket *socket, PacketBatch *batch, GSocketAddress *address, XDMCPPacket *packet)
 {
     GSocketFamily family = g_socket_get_family (socket);
     switch (family)
@@ -310,7 +922,7 @@ handle_forward_query (XDMCPServer *server, GSocket *socket, GSocketAddress *addr
     g_autoptr(GInetAddress) client_inet_address = g_inet_address_new_from_bytes (packet->ForwardQuery.client_address.data, family);
     g_autoptr(GSocketAddress) client_address = g_inet_socket_address_new (client_inet_address, port);
 
-    handle_query (server, socket, client_address, packet->ForwardQuery.authentication_names);
+    handle_query (server, socket, batch, client_address, packet->ForwardQuery.authentication_names);
 }
 
 static guint8
@@ -368,82 +980,124 @@ connection_to_address (XDMCPConnection *connection)
     }
 }
 
-/* Sort function to order XDMCP addresses by which is best to connect to */
-static gint
-compare_addresses (gconstpointer a, gconstpointer b, gpointer user_data)
+/* Get the raw address of a connection, or NULL if not an IP address */
+static const guint8 *
+get_connection_address (XDMCPConnection *connection, GSocketFamily *family)
+{
+    if (connection->type == XAUTH_FAMILY_INTERNET && connection->address.length == 4)
+        *family = G_SOCKET_FAMILY_IPV4;
+    else if (connection->type == XAUTH_FAMILY_INTERNET6 && connection->address.length == 16)
+        *family = G_SOCKET_FAMILY_IPV6;
+    else
+        return NULL;
+
+    return connection->address.data;
+}
+
+static gboolean
+address_is_link_local (const guint8 *address, GSocketFamily family)
 {
-    const AddrSortItem *item_a = a;
-    const AddrSortItem *item_b = b;
-    GInetAddress *source_address = user_data;
+    if (family == G_SOCKET_FAMILY_IPV4)
+        return address[0] == 169 && address[1] == 254;
+    else
+        return address[0] == 0xfe && (address[1] & 0xc0) == 0x80;
+}
 
+/* Order XDMCP addresses by which is best to connect to, on the raw bytes so nothing is allocated */
+static gint
+compare_addresses (const guint8 *address_a, GSocketFamily family_a,
+                   const guint8 *address_b, GSocketFamily family_b,
+                   const guint8 *source_address, GSocketFamily source_family)
+{
     /* Prefer non link-local addresses */
-    gboolean is_link_local = g_inet_address_get_is_link_local (item_a->address);
-    if (is_link_local != g_inet_address_get_is_link_local (item_b->address))
+    gboolean is_link_local = address_is_link_local (address_a, family_a);
+    if (is_link_local != address_is_link_local (address_b, family_b))
         return is_link_local ? 1 : -1;
 
     /* Prefer the source address family */
-    GSocketFamily family_a = g_inet_address_get_family (item_a->address);
-    GSocketFamily family_b = g_inet_address_get_family (item_b->address);
     if (family_a != family_b)
     {
-        GSocketFamily family = g_inet_address_get_family (source_address);
-        if (family_a == family)
+        if (family_a == source_family)
             return -1;
-        if (family_b == family)
+        if (family_b == source_family)
             return 1;
         return family_a < family_b ? -1 : 1;
     }
 
     /* Check equality */
-    if (g_inet_address_equal (item_a->address, item_b->address))
+    gsize length = family_a == G_SOCKET_FAMILY_IPV4 ? 4 : 16;
+    if (memcmp (address_a, address_b, length) == 0)
         return 0;
 
     /* Prefer the source address */
-    if (g_inet_address_equal (source_address, item_a->address))
+    if (family_a == source_family && memcmp (source_address, address_a, length) == 0)
         return -1;
-    if (g_inet_address_equal (source_address, item_b->address))
+    if (family_b == source_family && memcmp (source_address, address_b, length) == 0)
         return 1;
 
     /* Addresses are not equal, but preferences are: order is undefined */
     return 0;
 }
 
+/* Pick the best connection, the first one wins if they are equally good */
 static XDMCPConnection *
 choose_connection (XDMCPPacket *packet, GInetAddress *source_address)
 {
-    gsize addresses_length = packet->Request.n_connections;
-    if (addresses_length == 0)
-        return NULL;
-
-    AddrSortItem addr;
-    GArray *addresses = g_array_sized_new (FALSE, FALSE, sizeof addr, addresses_length);
-    if (!addresses)
-        return NULL;
+    const guint8 *source_bytes = g_inet_address_to_bytes (source_address);
+    GSocketFamily source_family = g_inet_address_get_family (source_address);
 
-    for (gsize i = 0; i < addresses_length; i++)
+    XDMCPConnection *best = NULL;
+    const guint8 *best_address = NULL;
+    GSocketFamily best_family = G_SOCKET_FAMILY_INVALID;
+    for (guint16 i = 0; i < packet->Request.n_connections; i++)
     {
-        addr.address = connection_to_address (&packet->Request.connections[i]);
-        if (addr.address)
+        GSocketFamily family;
+        const guint8 *address = get_connection_address (&packet->Request.connections[i], &family);
+        if (!address)
+            continue;
+
+        if (!best || compare_addresses (address, family, best_address, best_family, source_bytes, source_family) < 0)
         {
-            addr.index = i;
-            g_array_append_val (addresses, addr);
+            best = &packet->Request.connections[i];
+            best_address = address;
+            best_family = family;
         }
     }
 
-    /* Sort the addresses according to our preferences */
-    g_array_sort_with_data (addresses, compare_addresses, source_address);
+    return best;
+}
+
+/* Hash the parts of a Request that the chosen connection depends on */
+static guint
+hash_request (XDMCPPacket *packet, const guint8 *source, gsize source_length)
+{
+    guint hash = 5381 + packet->Request.display_number;
+    for (gsize i = 0; i < source_length; i++)
+        hash = hash * 33 + source[i];
+    for (guint16 i = 0; i < packet->Request.n_connections; i++)
+    {
+        XDMCPConnection *connection = &packet->Request.connections[i];
+        hash = hash * 33 + connection->type;
+        for (guint16 j = 0; j < connection->address.length; j++)
+            hash = hash * 33 + connection->address.data[j];
+    }
+
+    return hash;
+}
 
-    /* Use the best address */
-    gssize index = -1;
-    if (addresses->len)
-        index = g_array_index (addresses, AddrSortItem, 0).index;
+/* Get the connection chosen for an earlier copy of this Request, if it is still pending */
+static XDMCPConnection *
+lookup_chosen_connection (XDMCPServer *server, XDMCPPacket *packet, guint hash, const guint8 *source, gsize source_length)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
-    /* Free the local sort array and items */
-    for (gsize i = 0; i < addresses->len; i++)
-        g_object_unref (g_array_index (addresses, AddrSortItem, i).address);
-    g_array_unref (addresses);
+    SessionData *data = g_hash_table_lookup (priv->pending_requests, GUINT_TO_POINTER (hash));
+    if (!data ||
+        data->request_source_length != source_length || memcmp (data->request_source, source, source_length) != 0 ||
+        data->connection_index >= packet->Request.n_connections)
+        return NULL;
 
-    return index >= 0 ? &packet->Request.connections[index] : NULL;
+    return &packet->Request.connections[data->connection_index];
 }
 
 static gboolean
@@ -481,21 +1135,18 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
     {
         if (packet->Request.authentication_data.length == 8)
         {
-            guint8 input[8], key[8];
+            guint8 input[8];
 
             memcpy (input, packet->Request.authentication_data.data, packet->Request.authentication_data.length);
 
-            /* Setup key */
-            decode_key (priv->key, key);
-
             /* Decode message from server */
             authentication_name = g_strdup ("XDM-AUTHENTICATION-1");
             authentication_data = g_malloc (sizeof (guint8) * 8);
             authentication_data_length = 8;
 
-            XdmcpUnwrap (input, key, rho.data, authentication_data_length);
+            XdmcpUnwrap (input, priv->key_data, rho.data, authentication_data_length);
             XdmcpIncrementKey (&rho);
-            XdmcpWrap (rho.data, key, authentication_data, authentication_data_length);
+            XdmcpWrap (rho.data, priv->key_data, authentication_data, authentication_data_length);
 
             if (!has_string (packet->Request.authorization_names, "XDM-AUTHORIZATION-1"))
                 decline_status = g_strdup ("No matching authorization, server requires XDM-AUTHORIZATION-1");
@@ -513,17 +1164,55 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
             decline_status = g_strdup ("No matching authentication, server only supports unauthenticated connections");
     }
 
-    /* Choose an address to connect back on */
-    XDMCPConnection *connection = choose_connection (packet, g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (address)));
+    /* Choose an address to connect back on, retransmitted requests use the same choice */
+    GInetAddress *source_address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (address));
+    const guint8 *source = g_inet_address_to_bytes (source_address);
+    gsize source_length = g_inet_address_get_native_size (source_address);
+    guint request_hash = hash_request (packet, source, source_length);
+    XDMCPConnection *connection = lookup_chosen_connection (server, packet, request_hash, source, source_length);
+    if (!connection)
+        connection = choose_connection (packet, source_address);
     if (!connection && !decline_status)
         decline_status = g_strdup ("No valid address found");
 
     if (!authentication_name)
         authentication_name = g_strdup ("");
 
+    /* A display coming back gets its session and cookie again, so the seat
+     * still using them can carry on. XDM-AUTHORIZATION-1 keys are made from
+     * each request so those sessions always start again */
+    if (!decline_status && !priv->key)
+    {
+        g_autoptr(GInetAddress) returning_address = connection_to_address (connection);
+        SessionData *data = find_returning_session (server, returning_address, packet->Request.display_number);
+        if (data)
+        {
+            XAuthority *authority = xdmcp_session_get_authority (data->session);
+
+            g_debug ("Display %d reattaching to session %d", packet->Request.display_number, xdmcp_session_get_id (data->session));
+            data->reattaching = TRUE;
+
+            g_mutex_lock (&statistics_lock);
+            n_sessions_accepted++;
+            g_mutex_unlock (&statistics_lock);
+            XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Accept);
+            response->Accept.session_id = xdmcp_session_get_id (data->session);
+            response->Accept.authentication_name = g_steal_pointer (&authentication_name);
+            response->Accept.authorization_name = g_strdup (x_authority_get_authorization_name (authority));
+            response->Accept.authorization_data.data = x_authority_copy_authorization_data (authority);
+            response->Accept.authorization_data.length = x_authority_get_authorization_data_length (authority);
+            send_packet (socket, address, response);
+            xdmcp_packet_free (response);
+            return;
+        }
+    }
+
     /* Decline if request was not valid */
     if (decline_status)
     {
+        g_mutex_lock (&statistics_lock);
+        n_sessions_declined++;
+        g_mutex_unlock (&statistics_lock);
         XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Decline);
         response->Decline.status = g_steal_pointer (&decline_status);
         response->Decline.authentication_name = g_steal_pointer (&authentication_name);
@@ -542,10 +1231,6 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
     gsize session_authorization_data_length = 0;
     if (priv->key)
     {
-        /* Setup key */
-        guint8 key[8];
-        decode_key (priv->key, key);
-
         /* Generate a private session key */
         // FIXME: Pick a good DES key?
         guint8 session_key[8];
@@ -556,7 +1241,7 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
         /* Encrypt the session key and send it to the server */
         authorization_data = g_malloc (8);
         authorization_data_length = 8;
-        XdmcpWrap (session_key, key, authorization_data, authorization_data_length);
+        XdmcpWrap (session_key, priv->key_data, authorization_data, authorization_data_length);
 
         /* Authorization data is the number received from the client followed by the private session key */
         authorization_name = g_strdup ("XDM-AUTHORIZATION-1");
@@ -605,10 +1290,33 @@ handle_request (XDMCPServer *server, GSocket *socket, GSocketAddress *address, X
                                      session_authorization_data,
                                      session_authorization_data_length);
 
-    XDMCPSession *session = add_session (server, session_address, packet->Request.display_number, authority);
+    SessionData *data = add_session (server, session_address, packet->Request.display_number, authority);
+    if (!data)
+    {
+        g_mutex_lock (&statistics_lock);
+        n_sessions_declined++;
+        g_mutex_unlock (&statistics_lock);
+        XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Decline);
+        response->Decline.status = g_strdup ("No free sessions");
+        response->Decline.authentication_name = g_steal_pointer (&authentication_name);
+        response->Decline.authentication_data.data = g_steal_pointer (&authentication_data);
+        response->Decline.authentication_data.length = authentication_data_length;
+        send_packet (socket, address, response);
+        xdmcp_packet_free (response);
+        return;
+    }
+
+    data->request_hash = request_hash;
+    memcpy (data->request_source, source, MIN (source_length, sizeof (data->request_source)));
+    data->request_source_length = MIN (source_length, sizeof (data->request_source));
+    data->connection_index = connection - packet->Request.connections;
+    g_hash_table_insert (priv->pending_requests, GUINT_TO_POINTER (request_hash), data);
 
+    g_mutex_lock (&statistics_lock);
+    n_sessions_accepted++;
+    g_mutex_unlock (&statistics_lock);
     XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Accept);
-    response->Accept.session_id = xdmcp_session_get_id (session);
+    response->Accept.session_id = xdmcp_session_get_id (data->session);
     response->Accept.authentication_name = g_steal_pointer (&authentication_name);
     response->Accept.authentication_data.data = g_steal_pointer (&authentication_data);
     response->Accept.authentication_data.length = authentication_data_length;
@@ -633,7 +1341,7 @@ handle_manage (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XD
     }
 
     /* Ignore duplicate requests */
-    if (data->timeout_source == 0)
+    if (!data->unmanaged && !data->reattaching)
     {
         if (xdmcp_session_get_display_number (data->session) != packet->Manage.display_number ||
             strcmp (xdmcp_session_get_display_class (data->session), packet->Manage.display_class) != 0)
@@ -655,14 +1363,15 @@ handle_manage (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XD
 
     xdmcp_session_set_display_class (data->session, packet->Manage.display_class);
 
+    data->reattaching = FALSE;
+    touch_session (server, data);
+
     gboolean result = FALSE;
     g_signal_emit (server, signals[NEW_SESSION], 0, data->session, &result);
     if (result)
     {
-        /* Cancel the inactive timer */
-        if (data->timeout_source != 0)
-            g_source_remove (data->timeout_source);
-        data->timeout_source = 0;
+        /* Stop the session from timing out */
+        expire_session_cancel (data);
     }
     else
     {
@@ -679,10 +1388,17 @@ handle_manage (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XD
 static void
 handle_keep_alive (XDMCPServer *server, GSocket *socket, GSocketAddress *address, XDMCPPacket *packet)
 {
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    g_mutex_lock (&priv->lock);
     SessionData *data = get_session_data (server, packet->KeepAlive.session_id);
     gboolean alive = FALSE;
     if (data)
+    {
         alive = TRUE; // FIXME: xdmcp_session_get_alive (session);
+        data->last_seen = g_get_monotonic_time ();
+    }
+    g_mutex_unlock (&priv->lock);
 
     XDMCPPacket *response = xdmcp_packet_alloc (XDMCP_Alive);
     response->Alive.session_running = alive;
@@ -691,123 +1407,472 @@ handle_keep_alive (XDMCPServer *server, GSocket *socket, GSocketAddress *address
     xdmcp_packet_free (response);
 }
 
-static gboolean
-read_cb (GSocket *socket, GIOCondition condition, XDMCPServer *server)
+/* Packet received by a worker that has to be handled in the main context */
+typedef struct
 {
+    XDMCPServer *server;
+    GSocket *socket;
     GSocketAddress *address;
-    gchar data[1024];
-    g_autoptr(GError) error = NULL;
-    gssize n_read;
+    guint8 data[MAX_PACKET_SIZE];
+    gsize length;
+} DeferredPacket;
 
-    n_read = g_socket_receive_from (socket, &address, data, 1024, NULL, &error);
-    if (error)
-        g_warning ("Failed to read from XDMCP socket: %s", error->message);
+static void handle_packet (Listener *listener, GSocket *socket, GSocketAddress *address, const guint8 *data, gsize length);
+static PacketBatch *listener_get_batch (Listener *listener);
+
+static void
+deferred_packet_free (DeferredPacket *deferred)
+{
+    g_object_unref (deferred->server);
+    g_object_unref (deferred->socket);
+    g_object_unref (deferred->address);
+    g_free (deferred);
+}
+
+static gboolean
+deferred_packet_cb (gpointer user_data)
+{
+    DeferredPacket *deferred = user_data;
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (deferred->server);
+
+    /* With workers the main listener never reads a packet itself, so this may be the first use of its buffers */
+    PacketBatch *batch = listener_get_batch (priv->listener);
+    handle_packet (priv->listener, deferred->socket, deferred->address, deferred->data, deferred->length);
+    flush_replies (batch, deferred->socket);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Pass a packet from a worker to the main context */
+static void
+defer_packet (Listener *listener, GSocket *socket, GSocketAddress *address, const guint8 *data, gsize length)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (listener->server);
+
+    DeferredPacket *deferred = g_new0 (DeferredPacket, 1);
+    deferred->server = g_object_ref (listener->server);
+    deferred->socket = g_object_ref (socket);
+    deferred->address = g_object_ref (address);
+    memcpy (deferred->data, data, length);
+    deferred->length = length;
+    g_main_context_invoke_full (priv->main_context, G_PRIORITY_DEFAULT, deferred_packet_cb, deferred, (GDestroyNotify) deferred_packet_free);
+}
+
+static void
+handle_packet (Listener *listener, GSocket *socket, GSocketAddress *address, const guint8 *data, gsize length)
+{
+    XDMCPServer *server = listener->server;
+
+    /* The packet is only valid until the next one is decoded - anything kept is copied by the handlers */
+    XDMCPPacket decoded;
+    gboolean valid = xdmcp_packet_decode_borrowed (data, length, listener->batch->arena, sizeof (listener->batch->arena), &decoded);
+    g_mutex_lock (&statistics_lock);
+    n_packets_received++;
+    if (!valid)
+        n_packets_invalid++;
+    g_mutex_unlock (&statistics_lock);
+    if (!valid)
+        return;
+    XDMCPPacket *packet = &decoded;
+
+    /* Sessions are only created and managed in the main context */
+    if (listener->thread && (packet->opcode == XDMCP_Request || packet->opcode == XDMCP_Manage))
+    {
+        defer_packet (listener, socket, address, data, length);
+        return;
+    }
+
+    if (logger_get_debug_enabled ())
+    {
+        g_autofree gchar *packet_string = xdmcp_packet_tostring (packet);
+        g_autofree gchar *address_string = socket_address_to_string (address);
+        g_debug ("Got %s from %s", packet_string, address_string);
+    }
+
+    switch (packet->opcode)
+    {
+    case XDMCP_BroadcastQuery:
+    case XDMCP_Query:
+    case XDMCP_IndirectQuery:
+        handle_query (server, socket, listener->batch, address, packet->Query.authentication_names);
+        break;
+    case XDMCP_ForwardQuery:
+        handle_forward_query (server, socket, listener->batch, address, packet);
+        break;
+    case XDMCP_Request:
+        handle_request (server, socket, address, packet);
+        break;
+    case XDMCP_Manage:
+        handle_manage (server, socket, address, packet);
+        break;
+    case XDMCP_KeepAlive:
+        handle_keep_alive (server, socket, address, packet);
+        break;
+    default:
+        g_warning ("Got unexpected XDMCP packet %d", packet->opcode);
+        break;
+    }
+}
 
-    if (n_read > 0)
+/* Get the raw address of a packet source, returns FALSE if not an IP address */
+static gboolean
+get_raw_address (const struct sockaddr_storage *address, guint8 *raw)
+{
+    if (address->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *address4 = (const struct sockaddr_in *) address;
+        memset (raw, 0, 10);
+        raw[10] = raw[11] = 0xFF;
+        memcpy (raw + 12, &address4->sin_addr, 4);
+        return TRUE;
+    }
+    else if (address->ss_family == AF_INET6)
     {
-        XDMCPPacket *packet;
+        const struct sockaddr_in6 *address6 = (const struct sockaddr_in6 *) address;
+        memcpy (raw, &address6->sin6_addr, 16);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Check if a packet from this address is within its rate, done before decoding
+ * so a flood costs as little as possible */
+static gboolean
+rate_limit_allow (Listener *listener, const struct sockaddr_storage *address, guint32 now)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (listener->server);
+
+    if (priv->rate_limit == 0)
+        return TRUE;
+
+    guint8 raw[16];
+    if (!get_raw_address (address, raw))
+        return TRUE;
 
-        packet = xdmcp_packet_decode ((guint8 *)data, n_read);
-        if (packet)
+    if (!listener->rate_limits)
+        listener->rate_limits = g_new0 (RateLimitEntry, RATE_LIMIT_TABLE_SIZE);
+
+    /* FNV-1a */
+    guint32 hash = 2166136261u;
+    for (gsize i = 0; i < sizeof (raw); i++)
+        hash = (hash ^ raw[i]) * 16777619u;
+
+    /* Look for this address, or the least recently used entry to replace */
+    RateLimitEntry *entry = NULL, *oldest = NULL;
+    for (guint i = 0; i < RATE_LIMIT_PROBE_LENGTH; i++)
+    {
+        RateLimitEntry *e = &listener->rate_limits[(hash + i) % RATE_LIMIT_TABLE_SIZE];
+        if (e->fill_time != 0 && memcmp (e->address, raw, sizeof (raw)) == 0)
         {
-            g_autofree gchar *packet_string = NULL;
-            g_autofree gchar *address_string = NULL;
-
-            packet_string = xdmcp_packet_tostring (packet);
-            address_string = socket_address_to_string (address);
-            g_debug ("Got %s from %s", packet_string, address_string);
-
-            switch (packet->opcode)
-            {
-            case XDMCP_BroadcastQuery:
-            case XDMCP_Query:
-            case XDMCP_IndirectQuery:
-                handle_query (server, socket, address, packet->Query.authentication_names);
-                break;
-            case XDMCP_ForwardQuery:
-                handle_forward_query (server, socket, address, packet);
-                break;
-            case XDMCP_Request:
-                handle_request (server, socket, address, packet);
-                break;
-            case XDMCP_Manage:
-                handle_manage (server, socket, address, packet);
-                break;
-            case XDMCP_KeepAlive:
-                handle_keep_alive (server, socket, address, packet);
-                break;
-            default:
-                g_warning ("Got unexpected XDMCP packet %d", packet->opcode);
-                break;
-            }
+            entry = e;
+            break;
+        }
+        if (!oldest || e->fill_time < oldest->fill_time)
+            oldest = e;
+    }
+    if (!entry)
+    {
+        entry = oldest;
+        memcpy (entry->address, raw, sizeof (raw));
+        entry->tokens = priv->rate_limit_burst;
+        entry->fill_time = now;
+    }
+
+    entry->tokens = MIN (entry->tokens + (gfloat) (now - entry->fill_time) * priv->rate_limit / 1000, priv->rate_limit_burst);
+    entry->fill_time = now;
+    if (entry->tokens < 1)
+        return FALSE;
+    entry->tokens -= 1;
+
+    return TRUE;
+}
+
+/* Milliseconds for the rate limits, never 0 as that marks unused entries */
+static guint32
+get_rate_limit_time (void)
+{
+    return (guint32) (g_get_monotonic_time () / 1000) | 1;
+}
+
+static void
+count_rate_limited (guint n_dropped)
+{
+    if (n_dropped == 0)
+        return;
+
+    g_mutex_lock (&statistics_lock);
+    n_packets_rate_limited += n_dropped;
+    g_mutex_unlock (&statistics_lock);
+}
 
-            xdmcp_packet_free (packet);
+/* Read up to a batch of packets, returns the number read */
+static gint
+receive_batch (Listener *listener, GSocket *socket)
+{
+    PacketBatch *batch = listener->batch;
+
+#ifdef HAVE_RECVMMSG
+    for (gint i = 0; i < PACKET_BATCH_SIZE; i++)
+    {
+        batch->vectors[i].iov_base = batch->data[i];
+        batch->vectors[i].iov_len = MAX_PACKET_SIZE;
+        memset (&batch->messages[i], 0, sizeof (batch->messages[i]));
+        batch->messages[i].msg_hdr.msg_name = &batch->addresses[i];
+        batch->messages[i].msg_hdr.msg_namelen = sizeof (batch->addresses[i]);
+        batch->messages[i].msg_hdr.msg_iov = &batch->vectors[i];
+        batch->messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n_read;
+    do
+        n_read = recvmmsg (g_socket_get_fd (socket), batch->messages, PACKET_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    while (n_read < 0 && errno == EINTR);
+    if (n_read < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            g_warning ("Failed to read from XDMCP socket: %s", strerror (errno));
+        return 0;
+    }
+
+    guint32 now = get_rate_limit_time ();
+    guint n_dropped = 0;
+    for (int i = 0; i < n_read; i++)
+    {
+        if (!rate_limit_allow (listener, &batch->addresses[i], now))
+        {
+            n_dropped++;
+            continue;
         }
+
+        g_autoptr(GSocketAddress) address = g_socket_address_new_from_native (&batch->addresses[i], batch->messages[i].msg_hdr.msg_namelen);
+        if (address)
+            handle_packet (listener, socket, address, batch->data[i], batch->messages[i].msg_len);
+    }
+    count_rate_limited (n_dropped);
+
+    return n_read;
+#else
+    guint32 now = get_rate_limit_time ();
+    guint n_dropped = 0;
+    gint n_read = 0;
+    while (n_read < PACKET_BATCH_SIZE)
+    {
+        g_autoptr(GSocketAddress) address = NULL;
+        g_autoptr(GError) error = NULL;
+        gssize length = g_socket_receive_from (socket, &address, (gchar *) batch->data[n_read], MAX_PACKET_SIZE, NULL, &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            break;
+        if (error)
+            g_warning ("Failed to read from XDMCP socket: %s", error->message);
+        if (length < 0)
+            break;
+
+        if (g_socket_address_to_native (address, &batch->addresses[n_read], sizeof (batch->addresses[n_read]), NULL) &&
+            !rate_limit_allow (listener, &batch->addresses[n_read], now))
+            n_dropped++;
+        else
+            handle_packet (listener, socket, address, batch->data[n_read], length);
+        n_read++;
+    }
+    count_rate_limited (n_dropped);
+
+    return n_read;
+#endif
+}
+
+/* Get the buffers for handling packets, these are only allocated once someone is using XDMCP */
+static PacketBatch *
+listener_get_batch (Listener *listener)
+{
+    if (!listener->batch)
+    {
+        listener->batch = g_new0 (PacketBatch, 1);
+        listener->batch->replies = g_ptr_array_new_with_free_func ((GDestroyNotify) reply_free);
     }
 
+    return listener->batch;
+}
+
+static gboolean
+read_cb (GSocket *socket, GIOCondition condition, Listener *listener)
+{
+    PacketBatch *batch = listener_get_batch (listener);
+
+    /* Drain the socket so a burst of packets is handled in one wakeup */
+    while (receive_batch (listener, socket) == PACKET_BATCH_SIZE)
+        flush_replies (batch, socket);
+    flush_replies (batch, socket);
+
     return TRUE;
 }
 
-static GSocket *
-open_udp_socket (GSocketFamily family, guint port, const gchar *listen_address, GError **error)
+static Listener *
+listener_new (XDMCPServer *server)
 {
-    g_autoptr(GSocket) socket = NULL;
-    g_autoptr(GSocketAddress) address = NULL;
-    gboolean result;
+    Listener *listener = g_new0 (Listener, 1);
+    listener->server = server;
 
-    socket = g_socket_new (family, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, error);
-    if (!socket)
-        return NULL;
+    return listener;
+}
+
+static void
+listener_free (Listener *listener)
+{
+    if (listener->thread)
+    {
+        g_main_loop_quit (listener->loop);
+        g_thread_join (listener->thread);
+    }
+    g_clear_pointer (&listener->loop, g_main_loop_unref);
+    g_clear_pointer (&listener->context, g_main_context_unref);
+    g_clear_object (&listener->socket);
+    g_clear_object (&listener->socket6);
+    if (listener->batch)
+        g_ptr_array_unref (listener->batch->replies);
+    g_free (listener->batch);
+    g_free (listener->rate_limits);
+    g_free (listener);
+}
+
+static void
+listen_on_socket (Listener *listener, GSocket *socket, GMainContext *context)
+{
+    GSource *source = g_socket_create_source (socket, G_IO_IN, NULL);
+    g_source_set_callback (source, (GSourceFunc) read_cb, listener, NULL);
+    g_source_attach (source, context);
+    g_source_unref (source);
+}
 
-    if (listen_address)
+static gpointer
+worker_thread_cb (gpointer user_data)
+{
+    Listener *listener = user_data;
+
+    g_main_context_push_thread_default (listener->context);
+    g_main_loop_run (listener->loop);
+    g_main_context_pop_thread_default (listener->context);
+
+    return NULL;
+}
+
+static GSocket *
+open_udp_socket (GSocketFamily family, guint port, GInetAddress *listen_address, gboolean reuse_port, GError **error)
+{
+    /* Use the socket systemd is listening on for us if there is one */
+    g_autoptr(GSocket) socket = socket_activation_take_socket (family, G_SOCKET_TYPE_DATAGRAM, port);
+    if (!socket)
     {
-        GList *addresses;
+        socket = g_socket_new (family, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, error);
+        if (!socket)
+            return NULL;
+
+        g_autoptr(GSocketAddress) address = NULL;
+        if (listen_address)
+            address = g_inet_socket_address_new (listen_address, port);
+        else
+            address = g_inet_socket_address_new (g_inet_address_new_any (family), port);
+
+#ifdef SO_REUSEPORT
+        /* Let each worker have its own socket, the kernel spreads the packets between them */
+        if (reuse_port && !g_socket_set_option (socket, SOL_SOCKET, SO_REUSEPORT, 1, error))
+            return NULL;
+#endif
 
-        addresses = g_resolver_lookup_by_name (g_resolver_get_default (), listen_address, NULL, error);
-        if (!addresses)
+        if (!g_socket_bind (socket, address, TRUE, error))
             return NULL;
-        address = g_inet_socket_address_new (addresses->data, port);
-        g_resolver_free_addresses (addresses);
     }
-    else
-        address = g_inet_socket_address_new (g_inet_address_new_any (family), port);
-    result = g_socket_bind (socket, address, TRUE, error);
-    if (!result)
-        return NULL;
+
+    /* Packets are read until there are no more, so never wait */
+    g_socket_set_blocking (socket, FALSE);
+
+    g_autoptr(GError) buffer_error = NULL;
+    if (!g_socket_set_option (socket, SOL_SOCKET, SO_RCVBUF, RECEIVE_BUFFER_SIZE, &buffer_error))
+        g_debug ("Failed to set XDMCP receive buffer size: %s", buffer_error->message);
 
     return g_steal_pointer (&socket);
 }
 
-gboolean
-xdmcp_server_start (XDMCPServer *server)
+/* Start worker threads each with their own sockets */
+static gboolean
+start_workers (XDMCPServer *server, GInetAddress *listen_address)
 {
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
 
-    g_return_val_if_fail (server != NULL, FALSE);
+    for (guint i = 0; i < priv->n_workers; i++)
+    {
+        Listener *worker = listener_new (server);
+
+        g_autoptr(GError) ipv4_error = NULL;
+        worker->socket = open_udp_socket (G_SOCKET_FAMILY_IPV4, priv->port, listen_address, TRUE, &ipv4_error);
+        if (ipv4_error)
+            g_warning ("Failed to create IPv4 XDMCP socket: %s", ipv4_error->message);
+
+        g_autoptr(GError) ipv6_error = NULL;
+        worker->socket6 = open_udp_socket (G_SOCKET_FAMILY_IPV6, priv->port, listen_address, TRUE, &ipv6_error);
+        if (ipv6_error)
+            g_warning ("Failed to create IPv6 XDMCP socket: %s", ipv6_error->message);
+
+        if (!worker->socket && !worker->socket6)
+        {
+            listener_free (worker);
+            break;
+        }
+
+        worker->context = g_main_context_new ();
+        worker->loop = g_main_loop_new (worker->context, FALSE);
+        if (worker->socket)
+            listen_on_socket (worker, worker->socket, worker->context);
+        if (worker->socket6)
+            listen_on_socket (worker, worker->socket6, worker->context);
+        g_ptr_array_add (priv->workers, worker);
+    }
+
+    for (guint i = 0; i < priv->workers->len; i++)
+    {
+        Listener *worker = g_ptr_array_index (priv->workers, i);
+        worker->thread = g_thread_new ("xdmcp-worker", worker_thread_cb, worker);
+    }
+
+    return priv->workers->len > 0;
+}
+
+static gboolean
+open_sockets (XDMCPServer *server, GInetAddress *listen_address, gboolean activated)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (priv->n_workers > 0)
+    {
+#ifdef SO_REUSEPORT
+        /* Each worker needs its own socket, systemd only passes one */
+        if (activated)
+            g_warning ("XDMCP worker threads not supported with socket activation, using the main thread");
+        else
+        {
+            g_debug ("Handling XDMCP packets in %u worker threads", priv->n_workers);
+            return start_workers (server, listen_address);
+        }
+#else
+        g_warning ("XDMCP worker threads not supported on this system, using the main thread");
+#endif
+    }
 
     g_autoptr(GError) ipv4_error = NULL;
-    priv->socket = open_udp_socket (G_SOCKET_FAMILY_IPV4, priv->port, priv->listen_address, &ipv4_error);
+    priv->socket = open_udp_socket (G_SOCKET_FAMILY_IPV4, priv->port, listen_address, FALSE, &ipv4_error);
     if (ipv4_error)
         g_warning ("Failed to create IPv4 XDMCP socket: %s", ipv4_error->message);
 
     if (priv->socket)
-    {
-        GSource *source = g_socket_create_source (priv->socket, G_IO_IN, NULL);
-        g_source_set_callback (source, (GSourceFunc) read_cb, server, NULL);
-        g_source_attach (source, NULL);
-    }
+        listen_on_socket (priv->listener, priv->socket, NULL);
 
     g_autoptr(GError) ipv6_error = NULL;
-    priv->socket6 = open_udp_socket (G_SOCKET_FAMILY_IPV6, priv->port, priv->listen_address, &ipv6_error);
+    priv->socket6 = open_udp_socket (G_SOCKET_FAMILY_IPV6, priv->port, listen_address, FALSE, &ipv6_error);
     if (ipv6_error)
         g_warning ("Failed to create IPv6 XDMCP socket: %s", ipv6_error->message);
 
     if (priv->socket6)
-    {
-        GSource *source = g_socket_create_source (priv->socket6, G_IO_IN, NULL);
-        g_source_set_callback (source, (GSourceFunc) read_cb, server, NULL);
-        g_source_attach (source, NULL);
-    }
+        listen_on_socket (priv->listener, priv->socket6, NULL);
 
     if (!priv->socket && !priv->socket6)
         return FALSE;
@@ -815,6 +1880,62 @@ xdmcp_server_start (XDMCPServer *server)
     return TRUE;
 }
 
+static void
+lookup_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    GList *addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (object), result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    XDMCPServer *server = data;
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    if (!addresses)
+    {
+        g_warning ("Failed to resolve XDMCP listen address %s: %s", priv->listen_address, error->message);
+        return;
+    }
+
+    if (!open_sockets (server, addresses->data, FALSE))
+        g_warning ("Not listening for XDMCP packets");
+    g_resolver_free_addresses (addresses);
+}
+
+gboolean
+xdmcp_server_start (XDMCPServer *server)
+{
+    XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (server);
+
+    g_return_val_if_fail (server != NULL, FALSE);
+
+    priv->main_context = g_main_context_ref_thread_default ();
+
+    /* Resolve the listen address without holding up the rest of startup,
+     * there is no address to resolve if systemd is listening for us */
+    gboolean activated = socket_activation_has_socket (G_SOCKET_TYPE_DATAGRAM, priv->port);
+    if (priv->listen_address && !activated)
+    {
+        priv->cancellable = g_cancellable_new ();
+        g_autoptr(GResolver) resolver = g_resolver_get_default ();
+        g_resolver_lookup_by_name_async (resolver, priv->listen_address, priv->cancellable, lookup_cb, server);
+        return TRUE;
+    }
+
+    return open_sockets (server, NULL, activated);
+}
+
+/* Get the packet and session counts for all servers, as returned by the D-Bus Statistics interface */
+GVariant *
+xdmcp_server_get_statistics (void)
+{
+    g_mutex_lock (&statistics_lock);
+    GVariant *statistics = g_variant_new ("(ttttt)", n_packets_received, n_packets_invalid, n_packets_rate_limited, n_sessions_accepted, n_sessions_declined);
+    g_mutex_unlock (&statistics_lock);
+
+    return statistics;
+}
+
 static void
 xdmcp_server_init (XDMCPServer *server)
 {
@@ -824,6 +1945,12 @@ xdmcp_server_init (XDMCPServer *server)
     priv->hostname = g_strdup ("");
     priv->status = g_strdup ("");
     priv->sessions = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) session_data_free);
+    priv->pending_requests = g_hash_table_new (g_direct_hash, g_direct_equal);
+    /* Start IDs at a random point so a restarted server doesn't reuse recent IDs */
+    priv->last_session_id = g_random_int () & 0xFFFF;
+    priv->listener = listener_new (server);
+    priv->workers = g_ptr_array_new_with_free_func ((GDestroyNotify) listener_free);
+    g_mutex_init (&priv->lock);
 }
 
 static void
@@ -832,6 +1959,11 @@ xdmcp_server_finalize (GObject *object)
     XDMCPServer *self = XDMCP_SERVER (object);
     XDMCPServerPrivate *priv = xdmcp_server_get_instance_private (self);
 
+    g_cancellable_cancel (priv->cancellable);
+    g_clear_object (&priv->cancellable);
+    g_clear_pointer (&priv->workers, g_ptr_array_unref);
+    g_clear_pointer (&priv->listener, listener_free);
+    g_clear_pointer (&priv->main_context, g_main_context_unref);
     g_clear_object (&priv->socket);
     g_clear_object (&priv->socket6);
     g_clear_pointer (&priv->listen_address, g_free);
@@ -839,6 +1971,10 @@ xdmcp_server_finalize (GObject *object)
     g_clear_pointer (&priv->status, g_free);
     g_clear_pointer (&priv->key, g_free);
     g_clear_pointer (&priv->sessions, g_hash_table_unref);
+    g_clear_pointer (&priv->pending_requests, g_hash_table_unref);
+    g_clear_pointer (&priv->willing_reply, cached_reply_free);
+    g_clear_pointer (&priv->unwilling_reply, cached_reply_free);
+    g_mutex_clear (&priv->lock);
 
     G_OBJECT_CLASS (xdmcp_server_parent_class)->finalize (object);
 }
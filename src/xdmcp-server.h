@@ -47,6 +47,20 @@ void xdmcp_server_set_listen_address (XDMCPServer *server, const gchar *listen_a
 
 const gchar *xdmcp_server_get_listen_address (XDMCPServer *server);
 
+void xdmcp_server_set_worker_threads (XDMCPServer *server, guint n_workers);
+
+void xdmcp_server_set_report_load (XDMCPServer *server, gboolean report_load);
+
+void xdmcp_server_set_max_sessions (XDMCPServer *server, guint max_sessions);
+
+void xdmcp_server_set_max_load (XDMCPServer *server, gdouble max_load);
+
+void xdmcp_server_set_busy_delay (XDMCPServer *server, guint delay);
+
+void xdmcp_server_set_reattach_timeout (XDMCPServer *server, guint timeout);
+
+void xdmcp_server_set_rate_limit (XDMCPServer *server, guint rate, guint burst);
+
 void xdmcp_server_set_hostname (XDMCPServer *server, const gchar *hostname);
 
 const gchar *xdmcp_server_get_hostname (XDMCPServer *server);
@@ -59,6 +73,8 @@ void xdmcp_server_set_key (XDMCPServer *server, const gchar *key);
 
 gboolean xdmcp_server_start (XDMCPServer *server);
 
+GVariant *xdmcp_server_get_statistics (void);
+
 G_END_DECLS
 
 #endif /* XDMCP_SERVER_H_ */
@@ -10,6 +10,7 @@
  */
 
 #include "xdmcp-session.h"
+#include "memory-usage.h"
 #include "x-authority.h"
 
 typedef struct
@@ -98,6 +99,7 @@ xdmcp_session_init (XDMCPSession *session)
     XDMCPSessionPrivate *priv = xdmcp_session_get_instance_private (session);
 
     priv->display_class = g_strdup ("");
+    memory_usage_add (MEMORY_POOL_XDMCP_SESSIONS, sizeof (XDMCPSession) + sizeof (XDMCPSessionPrivate));
 }
 
 static void
@@ -109,6 +111,7 @@ xdmcp_session_finalize (GObject *object)
     g_clear_object (&priv->address);
     g_clear_object (&priv->authority);
     g_clear_pointer (&priv->display_class, g_free);
+    memory_usage_remove (MEMORY_POOL_XDMCP_SESSIONS, sizeof (XDMCPSession) + sizeof (XDMCPSessionPrivate));
 
     G_OBJECT_CLASS (xdmcp_session_parent_class)->finalize (object);
 }
@@ -46,6 +46,9 @@ static gchar *id;
 /* Display number being served */
 static int display_number = 0;
 
+/* File descriptor to report the display number on when ready */
+static int display_fd = -1;
+
 /* VT being run on */
 static int vt_number = -1;
 
@@ -221,12 +224,21 @@ request_cb (const gchar *name, GHashTable *params)
     else if (strcmp (name, "INDICATE-READY") == 0)
     {
         void *handler = signal (SIGUSR1, SIG_IGN);
-        if (handler == SIG_IGN)
-        {
+        if (handler == SIG_IGN || display_fd >= 0)
             status_notify ("%s INDICATE-READY", id);
+        if (handler == SIG_IGN)
             kill (getppid (), SIGUSR1);
-        }
         signal (SIGUSR1, handler);
+
+        /* Report the display number as X.Org does */
+        if (display_fd >= 0)
+        {
+            g_autofree gchar *text = g_strdup_printf ("%d\n", display_number);
+            if (write (display_fd, text, strlen (text)) < 0)
+                g_warning ("Error writing display number: %s", strerror (errno));
+            close (display_fd);
+            display_fd = -1;
+        }
     }
 
     else if (strcmp (name, "SEND-QUERY") == 0)
@@ -373,6 +385,7 @@ main (int argc, char **argv)
     const gchar *xdmcp_host = NULL;
     const gchar *seat = NULL;
     const gchar *mir_id = NULL;
+    gboolean have_display_number = FALSE;
     for (int i = 1; i < argc; i++)
     {
         char *arg = argv[i];
@@ -380,6 +393,12 @@ main (int argc, char **argv)
         if (arg[0] == ':')
         {
             display_number = atoi (arg + 1);
+            have_display_number = TRUE;
+        }
+        else if (strcmp (arg, "-displayfd") == 0)
+        {
+            display_fd = atoi (argv[i+1]);
+            i++;
         }
         else if (strcmp (arg, "-config") == 0)
         {
@@ -486,6 +505,7 @@ main (int argc, char **argv)
                         "-broadcast             Broadcast for XDMCP\n"
                         "-port port-num         UDP port number to send messages to\n"
                         "-seat string           seat to run on\n"
+                        "-displayfd fd          file descriptor to write display number to when ready\n"
                         "-mir id                Mir ID to use\n"
                         "-mirSocket name        Mir socket to use\n"
                         "-version               show the server version\n"
@@ -495,6 +515,19 @@ main (int argc, char **argv)
         }
     }
 
+    /* Pick the first display number not in use, as X.Org does */
+    if (display_fd >= 0 && !have_display_number)
+    {
+        while (TRUE)
+        {
+            g_autofree gchar *lock_filename = g_strdup_printf (".X%d-lock", display_number);
+            g_autofree gchar *path = g_build_filename (g_getenv ("LIGHTDM_TEST_ROOT"), "tmp", lock_filename, NULL);
+            if (!g_file_test (path, G_FILE_TEST_EXISTS))
+                break;
+            display_number++;
+        }
+    }
+
     id = g_strdup_printf ("XSERVER-%d", display_number);
 
     status_connect (request_cb, id);
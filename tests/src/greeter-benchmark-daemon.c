@@ -0,0 +1,358 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "greeter-benchmark-daemon.h"
+#include "session.h"
+#include "greeter.h"
+
+/* The daemon side of the greeter benchmark: the real greeter protocol
+ * handling with a session that authenticates straight away instead of
+ * running PAM in a child process */
+
+#define BENCHMARK_PASSWORD "password"
+
+typedef struct
+{
+    /* Name of the user being authenticated */
+    gchar *username;
+
+    /* Prompts waiting for a response */
+    struct pam_message *messages;
+    size_t messages_length;
+
+    /* Result of authentication */
+    gboolean authenticated;
+    int result;
+
+    /* Pending signal emission */
+    guint emit_idle;
+} SessionPrivate;
+
+enum {
+    CREATE_GREETER,
+    GOT_MESSAGES,
+    AUTHENTICATION_COMPLETE,
+    STOPPED,
+    LAST_SIGNAL
+};
+static guint signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE_WITH_PRIVATE (Session, session, G_TYPE_OBJECT)
+
+static GMainLoop *loop;
+
+Session *
+session_new (void)
+{
+    return g_object_new (SESSION_TYPE, NULL);
+}
+
+void
+session_set_pam_service (Session *session, const gchar *pam_service)
+{
+}
+
+void
+session_set_username (Session *session, const gchar *username)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    g_free (priv->username);
+    priv->username = g_strdup (username);
+}
+
+void
+session_set_do_authenticate (Session *session, gboolean do_authenticate)
+{
+}
+
+void
+session_set_is_interactive (Session *session, gboolean is_interactive)
+{
+}
+
+void
+session_set_is_guest (Session *session, gboolean is_guest)
+{
+}
+
+User *
+session_get_user (Session *session)
+{
+    return NULL;
+}
+
+const gchar *
+session_get_username (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    return priv->username;
+}
+
+static void
+clear_messages (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    for (size_t i = 0; i < priv->messages_length; i++)
+        g_free ((char *) priv->messages[i].msg);
+    g_clear_pointer (&priv->messages, g_free);
+    priv->messages_length = 0;
+}
+
+/* Signals are emitted from the main loop, as they would be when the session child replies */
+static gboolean
+emit_idle_cb (gpointer data)
+{
+    Session *session = data;
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    priv->emit_idle = 0;
+    if (priv->messages_length > 0)
+        g_signal_emit (session, signals[GOT_MESSAGES], 0);
+    else
+        g_signal_emit (session, signals[AUTHENTICATION_COMPLETE], 0);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+emit_later (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    if (priv->emit_idle == 0)
+        priv->emit_idle = g_idle_add_full (G_PRIORITY_DEFAULT, emit_idle_cb, g_object_ref (session), g_object_unref);
+}
+
+gboolean
+session_start (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    clear_messages (session);
+    priv->messages = g_new0 (struct pam_message, 1);
+    priv->messages[0].msg_style = PAM_PROMPT_ECHO_OFF;
+    priv->messages[0].msg = g_strdup ("Password:");
+    priv->messages_length = 1;
+    emit_later (session);
+
+    return TRUE;
+}
+
+void
+session_respond (Session *session, struct pam_response *response)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    priv->authenticated = priv->messages_length == 1 && g_strcmp0 (response[0].resp, BENCHMARK_PASSWORD) == 0;
+    priv->result = priv->authenticated ? PAM_SUCCESS : PAM_AUTH_ERR;
+    clear_messages (session);
+    emit_later (session);
+}
+
+void
+session_respond_error (Session *session, int error)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    priv->authenticated = FALSE;
+    priv->result = error;
+    clear_messages (session);
+    emit_later (session);
+}
+
+size_t
+session_get_messages_length (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    return priv->messages_length;
+}
+
+const struct pam_message *
+session_get_messages (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    return priv->messages;
+}
+
+gboolean
+session_get_is_authenticated (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    return priv->authenticated;
+}
+
+int
+session_get_authentication_result (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    return priv->result;
+}
+
+const gchar *
+session_get_authentication_result_string (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    return pam_strerror (NULL, priv->result);
+}
+
+void
+session_stop (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+
+    if (priv->emit_idle)
+        g_source_remove (priv->emit_idle);
+    priv->emit_idle = 0;
+}
+
+static void
+session_init (Session *session)
+{
+    SessionPrivate *priv = session_get_instance_private (session);
+    priv->result = PAM_AUTH_ERR;
+}
+
+static void
+session_finalize (GObject *object)
+{
+    Session *self = SESSION (object);
+    SessionPrivate *priv = session_get_instance_private (self);
+
+    clear_messages (self);
+    g_clear_pointer (&priv->username, g_free);
+
+    G_OBJECT_CLASS (session_parent_class)->finalize (object);
+}
+
+static void
+session_class_init (SessionClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = session_finalize;
+
+    signals[CREATE_GREETER] =
+        g_signal_new (SESSION_SIGNAL_CREATE_GREETER,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SessionClass, create_greeter),
+                      g_signal_accumulator_first_wins,
+                      NULL,
+                      NULL,
+                      GREETER_TYPE, 0);
+    signals[GOT_MESSAGES] =
+        g_signal_new (SESSION_SIGNAL_GOT_MESSAGES,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SessionClass, got_messages),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+    signals[AUTHENTICATION_COMPLETE] =
+        g_signal_new (SESSION_SIGNAL_AUTHENTICATION_COMPLETE,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SessionClass, authentication_complete),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+    signals[STOPPED] =
+        g_signal_new (SESSION_SIGNAL_STOPPED,
+                      G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST,
+                      G_STRUCT_OFFSET (SessionClass, stopped),
+                      NULL, NULL,
+                      NULL,
+                      G_TYPE_NONE, 0);
+}
+
+static Session *
+create_session_cb (Greeter *greeter)
+{
+    return session_new ();
+}
+
+static gboolean
+start_session_cb (Greeter *greeter, SessionType type, const gchar *session_name)
+{
+    return TRUE;
+}
+
+static void
+disconnected_cb (Greeter *greeter)
+{
+    g_main_loop_quit (loop);
+}
+
+static gboolean
+read_io_counts (guint64 *n_reads, guint64 *n_writes)
+{
+    g_autofree gchar *data = NULL;
+    if (!g_file_get_contents ("/proc/self/io", &data, NULL, NULL))
+        return FALSE;
+
+    g_auto(GStrv) lines = g_strsplit (data, "\n", -1);
+    for (gint i = 0; lines[i]; i++)
+    {
+        if (g_str_has_prefix (lines[i], "syscr: "))
+            *n_reads = g_ascii_strtoull (lines[i] + strlen ("syscr: "), NULL, 10);
+        else if (g_str_has_prefix (lines[i], "syscw: "))
+            *n_writes = g_ascii_strtoull (lines[i] + strlen ("syscw: "), NULL, 10);
+    }
+
+    return TRUE;
+}
+
+/* Number of requests handled by all greeters */
+static guint64
+get_n_requests (void)
+{
+    g_autoptr(GVariant) statistics = greeter_get_statistics ();
+    g_autoptr(GVariant) entries = g_variant_get_child_value (statistics, 1);
+
+    guint64 n_requests = 0;
+    GVariantIter iter;
+    g_variant_iter_init (&iter, entries);
+    const gchar *kind;
+    guint64 count;
+    while (g_variant_iter_next (&iter, "(&s&sttt@at)", &kind, NULL, &count, NULL, NULL, NULL))
+    {
+        if (strcmp (kind, "handled") == 0)
+            n_requests += count;
+    }
+
+    return n_requests;
+}
+
+void
+greeter_benchmark_run_daemon (int fd)
+{
+    loop = g_main_loop_new (NULL, FALSE);
+
+    g_autoptr(Greeter) greeter = greeter_new ();
+    greeter_set_pam_services (greeter, "lightdm", "lightdm-autologin");
+    g_signal_connect (greeter, GREETER_SIGNAL_CREATE_SESSION, G_CALLBACK (create_session_cb), NULL);
+    g_signal_connect (greeter, GREETER_SIGNAL_START_SESSION, G_CALLBACK (start_session_cb), NULL);
+    g_signal_connect (greeter, GREETER_SIGNAL_DISCONNECTED, G_CALLBACK (disconnected_cb), NULL);
+
+    guint64 start_reads = 0, start_writes = 0;
+    gboolean have_io_counts = read_io_counts (&start_reads, &start_writes);
+
+    /* The greeter reads and writes the same socket */
+    greeter_set_file_descriptors (greeter, fd, dup (fd));
+    g_main_loop_run (loop);
+
+    guint64 end_reads = 0, end_writes = 0;
+    guint64 n_requests = get_n_requests ();
+    if (have_io_counts && read_io_counts (&end_reads, &end_writes) && n_requests > 0)
+        g_print ("Daemon syscalls: %.2f reads and %.2f writes per request (%" G_GUINT64_FORMAT " requests)\n",
+                 (end_reads - start_reads) / (gdouble) n_requests,
+                 (end_writes - start_writes) / (gdouble) n_requests,
+                 n_requests);
+    else
+        g_print ("Daemon syscalls: not available\n");
+}
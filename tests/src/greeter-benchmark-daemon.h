@@ -0,0 +1,6 @@
+#ifndef GREETER_BENCHMARK_DAEMON_H_
+#define GREETER_BENCHMARK_DAEMON_H_
+
+void greeter_benchmark_run_daemon (int fd);
+
+#endif /* GREETER_BENCHMARK_DAEMON_H_ */
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include <lightdm.h>
+
+#include "greeter-benchmark-daemon.h"
+
+/* Runs the daemon greeter protocol handling against the greeter library over
+ * a socket and reports how fast logins go through it */
+
+#define BENCHMARK_USERNAME "benchmark"
+#define BENCHMARK_PASSWORD "password"
+
+static gint n_cycles = 1000;
+
+static GMainLoop *loop;
+static LightDMGreeter *greeter;
+
+static gint n_completed = 0;
+static gint n_failed = 0;
+static gint64 send_time;
+
+/* Statistics */
+static gint n_messages = 0;
+static GArray *authenticate_times;
+static GArray *respond_times;
+static GArray *start_session_times;
+static GArray *round_trip_times;
+
+static void
+record_round_trip (GArray *times)
+{
+    gint64 latency = g_get_monotonic_time () - send_time;
+    g_array_append_val (times, latency);
+    g_array_append_val (round_trip_times, latency);
+
+    /* Request and reply */
+    n_messages += 2;
+}
+
+static gboolean
+start_cycle_cb (gpointer data)
+{
+    if (n_completed >= n_cycles)
+    {
+        g_main_loop_quit (loop);
+        return G_SOURCE_REMOVE;
+    }
+
+    send_time = g_get_monotonic_time ();
+    g_autoptr(GError) error = NULL;
+    if (!lightdm_greeter_authenticate (greeter, BENCHMARK_USERNAME, &error))
+    {
+        g_printerr ("Failed to authenticate: %s\n", error->message);
+        n_failed++;
+        g_main_loop_quit (loop);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+show_prompt_cb (LightDMGreeter *greeter, const gchar *text, LightDMPromptType type)
+{
+    record_round_trip (authenticate_times);
+
+    send_time = g_get_monotonic_time ();
+    g_autoptr(GError) error = NULL;
+    if (!lightdm_greeter_respond (greeter, BENCHMARK_PASSWORD, &error))
+    {
+        g_printerr ("Failed to respond: %s\n", error->message);
+        n_failed++;
+        g_main_loop_quit (loop);
+    }
+}
+
+static void
+authentication_complete_cb (LightDMGreeter *greeter)
+{
+    record_round_trip (respond_times);
+
+    if (!lightdm_greeter_get_is_authenticated (greeter))
+    {
+        n_failed++;
+        g_idle_add (start_cycle_cb, NULL);
+        return;
+    }
+
+    send_time = g_get_monotonic_time ();
+    g_autoptr(GError) error = NULL;
+    if (lightdm_greeter_start_session_sync (greeter, NULL, &error))
+        record_round_trip (start_session_times);
+    else
+    {
+        g_printerr ("Failed to start session: %s\n", error->message);
+        n_failed++;
+    }
+
+    n_completed++;
+    g_idle_add (start_cycle_cb, NULL);
+}
+
+static gint
+compare_times (gconstpointer a, gconstpointer b)
+{
+    gint64 time_a = *((const gint64 *) a), time_b = *((const gint64 *) b);
+    return time_a < time_b ? -1 : time_a > time_b ? 1 : 0;
+}
+
+static gdouble
+percentile (GArray *times, gdouble fraction)
+{
+    if (times->len == 0)
+        return 0;
+
+    guint index = (guint) (fraction * (times->len - 1) + 0.5);
+    return g_array_index (times, gint64, index) / 1000.0;
+}
+
+static void
+print_times (const gchar *name, GArray *times)
+{
+    g_array_sort (times, compare_times);
+    g_print ("%s (ms): p50 %.3f, p99 %.3f, max %.3f\n",
+             name,
+             percentile (times, 0.5),
+             percentile (times, 0.99),
+             percentile (times, 1.0));
+}
+
+static int
+run_greeter (int fd)
+{
+    g_autofree gchar *fd_string = g_strdup_printf ("%d", fd);
+    g_setenv ("LIGHTDM_TO_SERVER_FD", fd_string, TRUE);
+    g_setenv ("LIGHTDM_FROM_SERVER_FD", fd_string, TRUE);
+
+    loop = g_main_loop_new (NULL, FALSE);
+    authenticate_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    respond_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    start_session_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    round_trip_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+    greeter = lightdm_greeter_new ();
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_SHOW_PROMPT, G_CALLBACK (show_prompt_cb), NULL);
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), NULL);
+
+    gint64 start_time = g_get_monotonic_time ();
+    g_autoptr(GError) error = NULL;
+    if (!lightdm_greeter_connect_to_daemon_sync (greeter, &error))
+    {
+        g_printerr ("Failed to connect to daemon: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    gdouble connect_time = (g_get_monotonic_time () - start_time) / 1000.0;
+
+    gint64 cycles_start_time = g_get_monotonic_time ();
+    g_idle_add (start_cycle_cb, NULL);
+    g_main_loop_run (loop);
+    gdouble duration = (g_get_monotonic_time () - cycles_start_time) / (gdouble) G_USEC_PER_SEC;
+
+    g_print ("Cycles: %d, failed: %d, duration: %.3fs\n", n_completed, n_failed, duration);
+    g_print ("Throughput: %.1f messages/s\n", n_messages / duration);
+    g_print ("Connect (ms): %.3f\n", connect_time);
+    print_times ("Authenticate", authenticate_times);
+    print_times ("Continue authentication", respond_times);
+    print_times ("Start session", start_session_times);
+    print_times ("Round trip", round_trip_times);
+
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int
+main (int argc, char **argv)
+{
+    GOptionEntry options[] =
+    {
+        { "cycles", 'c', 0, G_OPTION_ARG_INT, &n_cycles, "Number of Authenticate/ContinueAuthentication/StartSession cycles to run", "N" },
+        { NULL }
+    };
+
+    g_autoptr(GOptionContext) option_context = g_option_context_new ("- benchmark the greeter protocol");
+    g_option_context_add_main_entries (option_context, options, NULL);
+    g_autoptr(GError) error = NULL;
+    if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    if (n_cycles < 1)
+    {
+        g_printerr ("Cycles must be greater than zero\n");
+        return EXIT_FAILURE;
+    }
+
+    int fds[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+        g_printerr ("Failed to make socket pair: %s\n", g_strerror (errno));
+        return EXIT_FAILURE;
+    }
+
+    /* The greeter runs in its own process, as the library blocks waiting for replies */
+    pid_t pid = fork ();
+    if (pid < 0)
+    {
+        g_printerr ("Failed to fork: %s\n", g_strerror (errno));
+        return EXIT_FAILURE;
+    }
+    if (pid == 0)
+    {
+        close (fds[0]);
+        return run_greeter (fds[1]);
+    }
+
+    close (fds[1]);
+    greeter_benchmark_run_daemon (fds[0]);
+
+    int status;
+    if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status))
+        return EXIT_FAILURE;
+
+    return WEXITSTATUS (status);
+}
@@ -24,6 +24,8 @@
 #include <utmpx.h>
 #ifdef __linux__
 #include <linux/vt.h>
+#include <sys/inotify.h>
+#include <sys/mount.h>
 #endif
 #include <glib.h>
 #include <xcb/xcb.h>
@@ -39,8 +41,9 @@
 
 static int tty_fd = -1;
 
-static GList *user_entries = NULL;
-static GList *getpwent_link = NULL;
+static GPtrArray *user_entries = NULL;
+static guint getpwent_index = 0;
+G_LOCK_DEFINE_STATIC (user_entries);
 
 static GList *group_entries = NULL;
 
@@ -312,6 +315,16 @@ unlinkat (int dirfd, const char *pathname, int flags)
     return _unlinkat (dirfd, new_path, flags);
 }
 
+int
+rename (const char *oldpath, const char *newpath)
+{
+    int (*_rename) (const char *oldpath, const char *newpath) = dlsym (RTLD_NEXT, "rename");
+
+    g_autofree gchar *new_oldpath = redirect_path (oldpath);
+    g_autofree gchar *new_newpath = redirect_path (newpath);
+    return _rename (new_oldpath, new_newpath);
+}
+
 int
 creat (const char *pathname, mode_t mode)
 {
@@ -429,6 +442,40 @@ chown (const char *pathname, uid_t owner, gid_t group)
     return 0;
 }
 
+int
+lchown (const char *pathname, uid_t owner, gid_t group)
+{
+    /* Just fake it - we're not root */
+    return 0;
+}
+
+#ifdef __linux__
+int
+mount (const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data)
+{
+    connect_status ();
+
+    /* Just report it - we're not root */
+    status_notify ("MOUNT TYPE=%s TARGET=%s OPTIONS=%s", filesystemtype, target, data ? (const char *) data : "");
+    return 0;
+}
+
+int
+umount (const char *target)
+{
+    return umount2 (target, 0);
+}
+
+int
+umount2 (const char *target, int flags)
+{
+    connect_status ();
+
+    status_notify ("UNMOUNT TARGET=%s", target);
+    return 0;
+}
+#endif
+
 int
 chmod (const char *path, mode_t mode)
 {
@@ -704,9 +751,10 @@ free_user (gpointer data)
 static void
 load_passwd_file (void)
 {
-    g_list_free_full (user_entries, free_user);
-    user_entries = NULL;
-    getpwent_link = NULL;
+    if (user_entries)
+        g_ptr_array_set_size (user_entries, 0);
+    else
+        user_entries = g_ptr_array_new_with_free_func (free_user);
 
     g_autofree gchar *path = g_build_filename (g_getenv ("LIGHTDM_TEST_ROOT"), "etc", "passwd", NULL);
     g_autofree gchar *data = NULL;
@@ -734,73 +782,148 @@ load_passwd_file (void)
             entry->pw_gecos = g_strdup (fields[4]);
             entry->pw_dir = g_strdup (fields[5]);
             entry->pw_shell = g_strdup (fields[6]);
-            user_entries = g_list_append (user_entries, entry);
+            g_ptr_array_add (user_entries, entry);
         }
     }
 }
 
+/* Entries are tracked by position so the list can be reloaded by other
+ * lookups (possibly from another thread) while it is being enumerated */
+static struct passwd *
+next_user_entry (void)
+{
+    if (getpwent_index == 0)
+        load_passwd_file ();
+
+    if (getpwent_index >= user_entries->len)
+        return NULL;
+
+    return g_ptr_array_index (user_entries, getpwent_index++);
+}
+
 struct passwd *
 getpwent (void)
 {
-    if (getpwent_link == NULL)
+    G_LOCK (user_entries);
+    struct passwd *entry = next_user_entry ();
+    G_UNLOCK (user_entries);
+
+    return entry;
+}
+
+static gboolean
+copy_string (char **dest, const char *value, char **buffer, size_t *buflen)
+{
+    size_t length = strlen (value) + 1;
+    if (length > *buflen)
+        return FALSE;
+
+    memcpy (*buffer, value, length);
+    *dest = *buffer;
+    *buffer += length;
+    *buflen -= length;
+
+    return TRUE;
+}
+
+int
+getpwent_r (struct passwd *pwbuf, char *buf, size_t buflen, struct passwd **pwbufp)
+{
+    *pwbufp = NULL;
+
+    G_LOCK (user_entries);
+    guint index = getpwent_index;
+    struct passwd *entry = next_user_entry ();
+    if (!entry)
     {
-        load_passwd_file ();
-        if (user_entries == NULL)
-            return NULL;
-        getpwent_link = user_entries;
+        G_UNLOCK (user_entries);
+        return ENOENT;
     }
-    else
+
+    *pwbuf = *entry;
+    if (!copy_string (&pwbuf->pw_name, entry->pw_name, &buf, &buflen) ||
+        !copy_string (&pwbuf->pw_passwd, entry->pw_passwd, &buf, &buflen) ||
+        !copy_string (&pwbuf->pw_gecos, entry->pw_gecos, &buf, &buflen) ||
+        !copy_string (&pwbuf->pw_dir, entry->pw_dir, &buf, &buflen) ||
+        !copy_string (&pwbuf->pw_shell, entry->pw_shell, &buf, &buflen))
     {
-        if (getpwent_link->next == NULL)
-            return NULL;
-        getpwent_link = getpwent_link->next;
+        /* Return the same entry again when called with a larger buffer */
+        getpwent_index = index;
+        G_UNLOCK (user_entries);
+        return ERANGE;
     }
+    G_UNLOCK (user_entries);
 
-    return getpwent_link->data;
+    *pwbufp = pwbuf;
+    return 0;
 }
 
 void
 setpwent (void)
 {
-    getpwent_link = NULL;
+    getpwent_index = 0;
 }
 
 void
 endpwent (void)
 {
-    getpwent_link = NULL;
+    getpwent_index = 0;
 }
 
 struct passwd *
 getpwnam (const char *name)
 {
+    G_LOCK (user_entries);
     load_passwd_file ();
 
-    for (GList *link = user_entries; link; link = link->next)
+    struct passwd *result = NULL;
+    for (guint i = 0; i < user_entries->len && !result; i++)
     {
-        struct passwd *entry = link->data;
+        struct passwd *entry = g_ptr_array_index (user_entries, i);
         if (strcmp (entry->pw_name, name) == 0)
-            return entry;
+            result = entry;
     }
+    G_UNLOCK (user_entries);
 
-    return NULL;
+    return result;
 }
 
 struct passwd *
 getpwuid (uid_t uid)
 {
+    G_LOCK (user_entries);
     load_passwd_file ();
 
-    for (GList *link = user_entries; link; link = link->next)
+    struct passwd *result = NULL;
+    for (guint i = 0; i < user_entries->len && !result; i++)
     {
-        struct passwd *entry = link->data;
+        struct passwd *entry = g_ptr_array_index (user_entries, i);
         if (entry->pw_uid == uid)
-            return entry;
+            result = entry;
     }
+    G_UNLOCK (user_entries);
 
-    return NULL;
+    return result;
 }
 
+#ifdef __linux__
+/* Changes to /etc/passwd are only seen when asked for (by the user list
+ * benchmark), the test scripts don't expect the daemon to react to them */
+int
+inotify_add_watch (int fd, const char *pathname, uint32_t mask)
+{
+    int (*_inotify_add_watch) (int fd, const char *pathname, uint32_t mask) = dlsym (RTLD_NEXT, "inotify_add_watch");
+
+    if (g_getenv ("LIGHTDM_TEST_WATCH_PASSWD") && strcmp (pathname, "/etc") == 0)
+    {
+        g_autofree gchar *new_path = g_build_filename (g_getenv ("LIGHTDM_TEST_ROOT"), "etc", NULL);
+        return _inotify_add_watch (fd, new_path, mask);
+    }
+
+    return _inotify_add_watch (fd, pathname, mask);
+}
+#endif
+
 static void
 free_group (gpointer data)
 {
@@ -1,5 +1,6 @@
 /* -*- Mode: C; indent-tabs-mode: nil; tab-width: 4 -*- */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include <lightdm.h>
 #include <glib-unix.h>
 #include <ctype.h>
+#include <fcntl.h>
 
 #include "status.h"
 
@@ -43,6 +45,24 @@ authentication_complete_cb (LightDMGreeter *greeter)
                        lightdm_greeter_get_is_authenticated (greeter) ? "TRUE" : "FALSE");
 }
 
+static void
+show_preauthentication_message_cb (LightDMGreeter *greeter, guint id, const gchar *text, LightDMMessageType type)
+{
+    status_notify ("%s SHOW-PREAUTHENTICATION-MESSAGE ID=%u TEXT=\"%s\"", greeter_id, id, text);
+}
+
+static void
+show_preauthentication_prompt_cb (LightDMGreeter *greeter, guint id, const gchar *text, LightDMPromptType type)
+{
+    status_notify ("%s SHOW-PREAUTHENTICATION-PROMPT ID=%u TEXT=\"%s\"", greeter_id, id, text);
+}
+
+static void
+preauthentication_complete_cb (LightDMGreeter *greeter, guint id, gboolean is_authenticated)
+{
+    status_notify ("%s PREAUTHENTICATION-COMPLETE ID=%u AUTHENTICATED=%s", greeter_id, id, is_authenticated ? "TRUE" : "FALSE");
+}
+
 static void
 autologin_timer_expired_cb (LightDMGreeter *greeter)
 {
@@ -166,12 +186,36 @@ read_shared_data_finished (GObject *object, GAsyncResult *result, gpointer data)
         status_notify ("%s READ-SHARED-DATA ERROR=%s", greeter_id, error->message);
 }
 
+static gint n_shared_data_dirs = 0;
+
+static void
+ensure_shared_data_dirs_finished (GObject *object, GAsyncResult *result, gpointer data)
+{
+    LightDMGreeter *greeter = LIGHTDM_GREETER (object);
+
+    g_autofree gchar *dir = lightdm_greeter_ensure_shared_data_dir_finish (greeter, result, NULL);
+    n_shared_data_dirs--;
+    if (n_shared_data_dirs == 0)
+        status_notify ("%s ENSURE-SHARED-DATA-DIRS COMPLETE", greeter_id);
+}
+
 static int
 compare_session (gconstpointer a, gconstpointer b)
 {
     return strcmp (lightdm_session_get_key (LIGHTDM_SESSION (a)), lightdm_session_get_key (LIGHTDM_SESSION (b)));
 }
 
+static void
+log_user_list (void)
+{
+    GList *users = lightdm_user_list_get_users (lightdm_user_list_get_instance ());
+    for (GList *link = users; link; link = link->next)
+    {
+        LightDMUser *user = link->data;
+        status_notify ("%s LOG-USER USERNAME=%s", greeter_id, lightdm_user_get_name (user));
+    }
+}
+
 static void
 request_cb (const gchar *name, GHashTable *params)
 {
@@ -226,6 +270,40 @@ request_cb (const gchar *name, GHashTable *params)
             status_notify ("%s FAIL-CANCEL-AUTHENTICATION ERROR=%s", greeter_id, error->message);
     }
 
+    else if (strcmp (name, "PREAUTHENTICATE") == 0)
+    {
+        g_autoptr(GError) error = NULL;
+        guint id = lightdm_greeter_preauthenticate (greeter, g_hash_table_lookup (params, "USERNAME"), &error);
+        if (id == 0)
+            status_notify ("%s FAIL-PREAUTHENTICATE ERROR=%s", greeter_id, error->message);
+        else
+            status_notify ("%s PREAUTHENTICATION-STARTED ID=%u", greeter_id, id);
+    }
+
+    else if (strcmp (name, "RESPOND-PREAUTHENTICATION") == 0)
+    {
+        g_autoptr(GError) error = NULL;
+        guint id = atoi (g_hash_table_lookup (params, "ID"));
+        if (!lightdm_greeter_respond_preauthentication (greeter, id, g_hash_table_lookup (params, "TEXT"), &error))
+            status_notify ("%s FAIL-RESPOND-PREAUTHENTICATION ERROR=%s", greeter_id, error->message);
+    }
+
+    else if (strcmp (name, "CANCEL-PREAUTHENTICATION") == 0)
+    {
+        g_autoptr(GError) error = NULL;
+        guint id = atoi (g_hash_table_lookup (params, "ID"));
+        if (!lightdm_greeter_cancel_preauthentication (greeter, id, &error))
+            status_notify ("%s FAIL-CANCEL-PREAUTHENTICATION ERROR=%s", greeter_id, error->message);
+    }
+
+    else if (strcmp (name, "SELECT-PREAUTHENTICATION") == 0)
+    {
+        g_autoptr(GError) error = NULL;
+        guint id = atoi (g_hash_table_lookup (params, "ID"));
+        if (!lightdm_greeter_select_preauthentication (greeter, id, &error))
+            status_notify ("%s FAIL-SELECT-PREAUTHENTICATION ERROR=%s", greeter_id, error->message);
+    }
+
     else if (strcmp (name, "START-SESSION") == 0)
         lightdm_greeter_start_session (greeter, g_hash_table_lookup (params, "SESSION"), NULL, start_session_finished, NULL);
 
@@ -244,6 +322,30 @@ request_cb (const gchar *name, GHashTable *params)
     else if (strcmp (name, "READ-SHARED-DATA") == 0)
         lightdm_greeter_ensure_shared_data_dir (greeter, g_hash_table_lookup (params, "USERNAME"), NULL, read_shared_data_finished, NULL);
 
+    else if (strcmp (name, "ENSURE-SHARED-DATA-DIRS") == 0)
+    {
+        gint count = atoi (g_hash_table_lookup (params, "COUNT"));
+        n_shared_data_dirs += count;
+        for (gint i = 0; i < count; i++)
+            lightdm_greeter_ensure_shared_data_dir (greeter, g_hash_table_lookup (params, "USERNAME"), NULL, ensure_shared_data_dirs_finished, NULL);
+    }
+
+    else if (strcmp (name, "STOP-READING") == 0)
+    {
+        /* Stop reading from the daemon, with as small a pipe as possible so it fills quickly */
+        lightdm_greeter_set_external_dispatch (greeter, TRUE);
+#ifdef F_SETPIPE_SZ
+        fcntl (lightdm_greeter_get_daemon_fd (greeter), F_SETPIPE_SZ, 4096);
+#endif
+        status_notify ("%s STOP-READING", greeter_id);
+    }
+
+    else if (strcmp (name, "START-READING") == 0)
+    {
+        lightdm_greeter_set_external_dispatch (greeter, FALSE);
+        status_notify ("%s START-READING", greeter_id);
+    }
+
     else if (strcmp (name, "WATCH-USER") == 0)
     {
         const gchar *username = g_hash_table_lookup (params, "USERNAME");
@@ -306,14 +408,7 @@ request_cb (const gchar *name, GHashTable *params)
     }
 
     else if (strcmp (name, "LOG-USER-LIST") == 0)
-    {
-        GList *users = lightdm_user_list_get_users (lightdm_user_list_get_instance ());
-        for (GList *link = users; link; link = link->next)
-        {
-            LightDMUser *user = link->data;
-            status_notify ("%s LOG-USER USERNAME=%s", greeter_id, lightdm_user_get_name (user));
-        }
-    }
+        log_user_list ();
 
     else if (strcmp (name, "LOG-SESSIONS") == 0)
     {
@@ -383,12 +478,16 @@ static void
 user_added_cb (LightDMUserList *user_list, LightDMUser *user)
 {
     status_notify ("%s USER-ADDED USERNAME=%s", greeter_id, lightdm_user_get_name (user));
+    if (g_key_file_get_boolean (config, "test-greeter-config", "log-user-list", NULL))
+        log_user_list ();
 }
 
 static void
 user_removed_cb (LightDMUserList *user_list, LightDMUser *user)
 {
     status_notify ("%s USER-REMOVED USERNAME=%s", greeter_id, lightdm_user_get_name (user));
+    if (g_key_file_get_boolean (config, "test-greeter-config", "log-user-list", NULL))
+        log_user_list ();
 }
 
 static void
@@ -405,6 +504,10 @@ connect_finished (GObject *object, GAsyncResult *result, gpointer data)
         return;
     }
 
+    /* Log the user list as received with the connection, before any other messages from the daemon */
+    if (g_key_file_get_boolean (config, "test-greeter-config", "log-user-list", NULL))
+        log_user_list ();
+
     status_notify ("%s CONNECTED-TO-DAEMON", greeter_id);
 
     notify_hints (greeter);
@@ -489,6 +592,9 @@ main (int argc, char **argv)
     g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_SHOW_MESSAGE, G_CALLBACK (show_message_cb), NULL);
     g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_SHOW_PROMPT, G_CALLBACK (show_prompt_cb), NULL);
     g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_AUTHENTICATION_COMPLETE, G_CALLBACK (authentication_complete_cb), NULL);
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_SHOW_PREAUTHENTICATION_MESSAGE, G_CALLBACK (show_preauthentication_message_cb), NULL);
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_SHOW_PREAUTHENTICATION_PROMPT, G_CALLBACK (show_preauthentication_prompt_cb), NULL);
+    g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_PREAUTHENTICATION_COMPLETE, G_CALLBACK (preauthentication_complete_cb), NULL);
     g_signal_connect (greeter, LIGHTDM_GREETER_SIGNAL_AUTOLOGIN_TIMER_EXPIRED, G_CALLBACK (autologin_timer_expired_cb), NULL);
     if (g_key_file_get_boolean (config, "test-greeter-config", "resettable", NULL))
     {
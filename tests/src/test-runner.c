@@ -82,6 +82,27 @@ typedef struct
  */
 static GList *script = NULL;
 static guint status_timeout = 0;
+
+/* TRUE while a WAIT command is running, the commands after it don't run until it is done */
+static gboolean waiting = FALSE;
+/*
+ * When LIGHTDM_TEST_TIMINGS is set, the time each script line is resolved is
+ * appended to the file it names once the script passes.  Each line has the
+ * position of the script line, the milliseconds since the script started and
+ * since the previous line was resolved, the CPU milliseconds and resident kB
+ * used by the daemon so far, the longest the daemon took to answer a D-Bus
+ * request since the previous line (in milliseconds), the number of session
+ * children running and their total resident kB, and the script line itself.
+ */
+static GString *timings = NULL;
+static gint64 script_start_time = 0;
+static gint64 last_line_time = 0;
+
+/* The daemon is asked for its seats this often to see how responsive its main loop is */
+#define PROBE_INTERVAL 100
+static gint64 probe_send_time = 0;
+static gint64 probe_max_latency = 0;
+
 static gchar *temp_dir = NULL;
 static int service_count;
 typedef struct
@@ -157,6 +178,7 @@ static GList *status_clients = NULL;
 
 static void ready (void);
 static void quit (int status);
+static void save_timings (void);
 static gboolean status_timeout_cb (gpointer data);
 static void check_status (const gchar *status);
 static AccountsUser *get_accounts_user_by_uid (guint uid);
@@ -278,6 +300,9 @@ quit (int status)
     if (status_socket_name)
         unlink (status_socket_name);
 
+    if (timings && status == EXIT_SUCCESS)
+        save_timings ();
+
     if (temp_dir && getenv ("DEBUG") == NULL)
     {
         g_autofree gchar *command = g_strdup_printf ("rm -rf %s", temp_dir);
@@ -288,6 +313,197 @@ quit (int status)
     exit (status);
 }
 
+static void
+get_daemon_usage (guint64 *cpu_time, guint64 *rss)
+{
+    *cpu_time = 0;
+    *rss = 0;
+
+    if (!lightdm_process)
+        return;
+
+    /* utime and stime are the 14th and 15th fields, after the command which may contain spaces */
+    g_autofree gchar *stat_path = g_strdup_printf ("/proc/%d/stat", lightdm_process->pid);
+    g_autofree gchar *stat_data = NULL;
+    if (g_file_get_contents (stat_path, &stat_data, NULL, NULL))
+    {
+        const gchar *fields = strrchr (stat_data, ')');
+        g_auto(GStrv) values = fields ? g_strsplit (fields + 2, " ", -1) : NULL;
+        if (values && g_strv_length (values) > 12)
+            *cpu_time = (g_ascii_strtoull (values[11], NULL, 10) + g_ascii_strtoull (values[12], NULL, 10)) * 1000 / sysconf (_SC_CLK_TCK);
+    }
+
+    g_autofree gchar *status_path = g_strdup_printf ("/proc/%d/status", lightdm_process->pid);
+    g_autofree gchar *status_data = NULL;
+    if (g_file_get_contents (status_path, &status_data, NULL, NULL))
+    {
+        const gchar *value = strstr (status_data, "VmRSS:");
+        if (value)
+            *rss = g_ascii_strtoull (value + strlen ("VmRSS:"), NULL, 10);
+    }
+}
+
+static gboolean
+read_process_stat (const gchar *pid, pid_t *ppid, gchar **command)
+{
+    g_autofree gchar *stat_path = g_strdup_printf ("/proc/%s/stat", pid);
+    g_autofree gchar *stat_data = NULL;
+    if (!g_file_get_contents (stat_path, &stat_data, NULL, NULL))
+        return FALSE;
+
+    /* The command is in brackets and may contain spaces, the parent is the second field after it */
+    gchar *start = strchr (stat_data, '(');
+    gchar *end = strrchr (stat_data, ')');
+    if (!start || !end || end < start || strlen (end) < 4)
+        return FALSE;
+    *command = g_strndup (start + 1, end - start - 1);
+    *ppid = atoi (end + 4);
+
+    return TRUE;
+}
+
+/* Session children are forked by a launcher the daemon starts, so look two levels down */
+static void
+get_session_child_usage (guint *n_children, guint64 *rss)
+{
+    *n_children = 0;
+    *rss = 0;
+
+    if (!lightdm_process)
+        return;
+
+    g_autoptr(GDir) dir = g_dir_open ("/proc", 0, NULL);
+    if (!dir)
+        return;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)))
+    {
+        if (!isdigit (name[0]))
+            continue;
+
+        pid_t ppid;
+        g_autofree gchar *command = NULL;
+        if (!read_process_stat (name, &ppid, &command) || !g_str_has_prefix (command, "lightdm-session"))
+            continue;
+
+        g_autofree gchar *cmdline_path = g_strdup_printf ("/proc/%s/cmdline", name);
+        g_autofree gchar *cmdline = NULL;
+        gsize cmdline_length;
+        if (!g_file_get_contents (cmdline_path, &cmdline, &cmdline_length, NULL) ||
+            strlen (cmdline) + 1 >= cmdline_length ||
+            strcmp (cmdline + strlen (cmdline) + 1, "--session-child") != 0)
+            continue;
+
+        if (ppid != lightdm_process->pid)
+        {
+            g_autofree gchar *parent = g_strdup_printf ("%d", ppid);
+            g_autofree gchar *parent_command = NULL;
+            pid_t grandparent;
+            if (!read_process_stat (parent, &grandparent, &parent_command) || grandparent != lightdm_process->pid)
+                continue;
+        }
+
+        g_autofree gchar *status_path = g_strdup_printf ("/proc/%s/status", name);
+        g_autofree gchar *status_data = NULL;
+        if (g_file_get_contents (status_path, &status_data, NULL, NULL))
+        {
+            const gchar *value = strstr (status_data, "VmRSS:");
+            if (value)
+                *rss += g_ascii_strtoull (value + strlen ("VmRSS:"), NULL, 10);
+        }
+        (*n_children)++;
+    }
+}
+
+static void
+record_timing (ScriptLine *line)
+{
+    if (!timings)
+        return;
+
+    gint64 now = g_get_monotonic_time ();
+    guint64 cpu_time, rss;
+    get_daemon_usage (&cpu_time, &rss);
+    guint n_children;
+    guint64 children_rss;
+    get_session_child_usage (&n_children, &children_rss);
+
+    /* Include a probe that hasn't been answered yet */
+    if (probe_send_time != 0)
+        probe_max_latency = MAX (probe_max_latency, now - probe_send_time);
+
+    g_string_append_printf (timings, "%d\t%.3f\t%.3f\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT "\t%.3f\t%u\t%" G_GUINT64_FORMAT "\t%s\n",
+                            g_list_index (script, line),
+                            (now - script_start_time) / 1000.0,
+                            (now - last_line_time) / 1000.0,
+                            cpu_time,
+                            rss,
+                            probe_max_latency / 1000.0,
+                            n_children,
+                            children_rss,
+                            line->text);
+    last_line_time = now;
+    probe_max_latency = 0;
+}
+
+static gboolean probe_timeout_cb (gpointer data);
+
+static void
+probe_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GVariant) reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, NULL);
+
+    /* Ignore failures, the daemon might not be running */
+    if (reply && probe_send_time != 0)
+        probe_max_latency = MAX (probe_max_latency, g_get_monotonic_time () - probe_send_time);
+    probe_send_time = 0;
+
+    if (!stop)
+        g_timeout_add (PROBE_INTERVAL, probe_timeout_cb, NULL);
+}
+
+static gboolean
+probe_timeout_cb (gpointer data)
+{
+    if (!lightdm_process)
+    {
+        if (!stop)
+            return G_SOURCE_CONTINUE;
+        return G_SOURCE_REMOVE;
+    }
+
+    probe_send_time = g_get_monotonic_time ();
+    g_dbus_connection_call (dbus_conn,
+                            "org.freedesktop.DisplayManager",
+                            "/org/freedesktop/DisplayManager",
+                            "org.freedesktop.DBus.Properties",
+                            "Get",
+                            g_variant_new ("(ss)", "org.freedesktop.DisplayManager", "Seats"),
+                            G_VARIANT_TYPE ("(v)"),
+                            G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                            -1,
+                            NULL,
+                            probe_cb,
+                            NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+save_timings (void)
+{
+    const gchar *path = g_getenv ("LIGHTDM_TEST_TIMINGS");
+    FILE *file = fopen (path, "a");
+    if (!file)
+    {
+        g_printerr ("Failed to open timings file %s: %s\n", path, strerror (errno));
+        return;
+    }
+    fputs (timings->str, file);
+    fclose (file);
+}
+
 /* WARNING: This function might return. */
 static void
 fail (const gchar *event, const gchar *expected)
@@ -509,13 +725,21 @@ handle_command (const gchar *command)
         status_timeout = 0;
 
         /* Use a main loop so that our DBus functions are still responsive */
+        waiting = TRUE;
         g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
         const gchar *v = g_hash_table_lookup (params, "DURATION");
-        int duration = v ? atoi (v) : 1;
-        if (duration < 1)
-            duration = 1;
-        g_timeout_add_seconds (duration, stop_loop, loop);
+        const gchar *ms = g_hash_table_lookup (params, "DURATION-MS");
+        if (ms)
+            g_timeout_add (MAX (atoi (ms), 1), stop_loop, loop);
+        else
+        {
+            int duration = v ? atoi (v) : 1;
+            if (duration < 1)
+                duration = 1;
+            g_timeout_add_seconds (duration, stop_loop, loop);
+        }
         g_main_loop_run (loop);
+        waiting = FALSE;
 
         /* Restart status timeout */
         status_timeout = g_timeout_add (status_timeout_ms, status_timeout_cb, NULL);
@@ -764,13 +988,15 @@ handle_command (const gchar *command)
     }
     else if (strcmp (name, "SWITCH-TO-GREETER") == 0)
     {
+        /* Optionally only get a reply once the greeter is active */
+        const gchar *wait = g_hash_table_lookup (params, "WAIT");
         g_dbus_connection_call (dbus_conn,
                                 "org.freedesktop.DisplayManager",
                                 "/org/freedesktop/DisplayManager/Seat0",
                                 "org.freedesktop.DisplayManager.Seat",
-                                "SwitchToGreeter",
-                                g_variant_new ("()"),
-                                G_VARIANT_TYPE ("()"),
+                                wait ? "SwitchToGreeterAndWait" : "SwitchToGreeter",
+                                wait ? g_variant_new ("(u)", atoi (wait)) : g_variant_new ("()"),
+                                wait ? G_VARIANT_TYPE ("(t)") : G_VARIANT_TYPE ("()"),
                                 G_DBUS_CALL_FLAGS_NONE,
                                 G_MAXINT,
                                 NULL,
@@ -1018,6 +1244,7 @@ run_commands (void)
 
         statuses = g_list_append (statuses, g_strdup (line->text));
         line->done = TRUE;
+        record_timing (line);
 
         if (getenv ("DEBUG"))
             g_print ("%s\n", line->text);
@@ -1067,8 +1294,11 @@ check_status (const gchar *status)
     }
 
     line->done = TRUE;
+    record_timing (line);
 
     /* Restart timeout */
+    if (waiting)
+        return;
     if (status_timeout)
         g_source_remove (status_timeout);
     status_timeout = g_timeout_add (status_timeout_ms, status_timeout_cb, NULL);
@@ -1988,6 +2218,82 @@ start_login1_daemon (void)
                                   NULL);
 }
 
+static void
+handle_systemd_call (GDBusConnection       *connection,
+                     const gchar           *sender,
+                     const gchar           *object_path,
+                     const gchar           *interface_name,
+                     const gchar           *method_name,
+                     GVariant              *parameters,
+                     GDBusMethodInvocation *invocation,
+                     gpointer               user_data)
+{
+    if (strcmp (method_name, "StartUnit") == 0)
+    {
+        const gchar *name, *mode;
+        g_variant_get (parameters, "(&s&s)", &name, &mode);
+
+        g_autofree gchar *status = g_strdup_printf ("SYSTEMD START-UNIT NAME=%s MODE=%s", name, mode);
+        check_status (status);
+
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", "/org/freedesktop/systemd1/job/1"));
+    }
+    else
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "No such method: %s", method_name);
+}
+
+static void
+systemd_name_acquired_cb (GDBusConnection *connection,
+                          const gchar     *name,
+                          gpointer         user_data)
+{
+    const gchar *systemd_interface =
+        "<node>"
+        "  <interface name='org.freedesktop.systemd1.Manager'>"
+        "    <method name='StartUnit'>"
+        "      <arg name='name' type='s' direction='in'/>"
+        "      <arg name='mode' type='s' direction='in'/>"
+        "      <arg name='job' type='o' direction='out'/>"
+        "    </method>"
+        "  </interface>"
+        "</node>";
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GDBusNodeInfo) systemd_info = g_dbus_node_info_new_for_xml (systemd_interface, &error);
+    if (!systemd_info)
+    {
+        g_warning ("Failed to parse systemd D-Bus interface: %s", error->message);
+        return;
+    }
+    static const GDBusInterfaceVTable systemd_vtable =
+    {
+        handle_systemd_call,
+    };
+    if (g_dbus_connection_register_object (connection,
+                                           "/org/freedesktop/systemd1",
+                                           systemd_info->interfaces[0],
+                                           &systemd_vtable,
+                                           NULL, NULL,
+                                           &error) == 0)
+        g_warning ("Failed to register systemd service: %s", error->message);
+
+    service_count--;
+    if (service_count == 0)
+        ready ();
+}
+
+static void
+start_systemd_daemon (void)
+{
+    service_count++;
+    g_bus_own_name_on_connection (dbus_conn,
+                                  "org.freedesktop.systemd1",
+                                  G_BUS_NAME_OWNER_FLAGS_NONE,
+                                  systemd_name_acquired_cb,
+                                  NULL,
+                                  NULL,
+                                  NULL);
+}
+
 static AccountsUser *
 get_accounts_user_by_uid (guint uid)
 {
@@ -2394,6 +2700,9 @@ start_accounts_service_daemon (void)
 static void
 ready (void)
 {
+    script_start_time = last_line_time = g_get_monotonic_time ();
+    if (timings)
+        g_timeout_add (PROBE_INTERVAL, probe_timeout_cb, NULL);
     run_commands ();
 }
 
@@ -2531,16 +2840,24 @@ main (int argc, char **argv)
 
     if (argc != 3)
     {
-        g_printerr ("Usage %s SCRIPT-NAME GREETER\n", argv[0]);
+        g_printerr ("Usage %s SCRIPT-NAME|SCRIPT-PATH GREETER\n", argv[0]);
         quit (EXIT_FAILURE);
     }
     const gchar *script_name = argv[1];
-    g_autofree gchar *config_file = g_strdup_printf ("%s.conf", script_name);
-    config_path = g_build_filename (SRCDIR, "tests", "scripts", config_file, NULL);
+    if (strchr (script_name, '/'))
+        config_path = g_strdup (script_name);
+    else
+    {
+        g_autofree gchar *config_file = g_strdup_printf ("%s.conf", script_name);
+        config_path = g_build_filename (SRCDIR, "tests", "scripts", config_file, NULL);
+    }
 
     config = g_key_file_new ();
     g_key_file_load_from_file (config, config_path, G_KEY_FILE_NONE, NULL);
 
+    if (g_getenv ("LIGHTDM_TEST_TIMINGS"))
+        timings = g_string_new ("");
+
     load_script (config_path);
 
     gchar cwd[1024];
@@ -2617,6 +2934,7 @@ main (int argc, char **argv)
     g_mkdir_with_parents (g_strdup_printf ("%s/usr/share/lightdm/sessions", temp_dir), 0755);
     g_mkdir_with_parents (g_strdup_printf ("%s/usr/share/lightdm/remote-sessions", temp_dir), 0755);
     g_mkdir_with_parents (g_strdup_printf ("%s/usr/share/lightdm/greeters", temp_dir), 0755);
+    g_mkdir_with_parents (g_strdup_printf ("%s/usr/share/lightdm/guest-home", temp_dir), 0755);
     g_mkdir_with_parents (g_strdup_printf ("%s/tmp", temp_dir), 0755);
     g_mkdir_with_parents (g_strdup_printf ("%s/var/lib/lightdm-data", temp_dir), 0755);
     g_mkdir_with_parents (g_strdup_printf ("%s/var/run", temp_dir), 0755);
@@ -2855,6 +3173,8 @@ main (int argc, char **argv)
         start_console_kit_daemon ();
     if (!g_key_file_get_boolean (config, "test-runner-config", "disable-login1", NULL))
         start_login1_daemon ();
+    if (g_key_file_get_boolean (config, "test-runner-config", "enable-systemd", NULL))
+        start_systemd_daemon ();
     if (!g_key_file_get_boolean (config, "test-runner-config", "disable-accounts-service", NULL))
         start_accounts_service_daemon ();
 
@@ -0,0 +1,530 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "user-list.h"
+
+/* Generates large password databases (or AccountsService user lists) and
+ * reports how fast the user list loads and reloads them, as JSON.  Each size
+ * runs in a fresh process so the peak memory use is for that size alone. */
+
+#define FIRST_UID 1000
+
+/* How long to wait for a change to be picked up before giving up */
+#define RECONCILE_TIMEOUT 10
+
+static gchar *user_counts = NULL;
+static gboolean use_accounts_service = FALSE;
+static gint run_users = 0;
+
+static GMainLoop *loop;
+
+/* Number of users the mock AccountsService has */
+static guint n_mock_users = 0;
+static GDBusConnection *mock_connection = NULL;
+
+/* Times in the measuring process */
+static gint64 load_start_time = 0;
+static gint64 first_user_time = 0;
+static gint64 loaded_time = 0;
+static gint64 reconcile_start_time = 0;
+static gint64 reconciled_time = 0;
+static gchar *new_user_name = NULL;
+
+/* Output of the last measuring process */
+static gchar *run_output = NULL;
+
+static const gchar *accounts_xml =
+    "<node>"
+    "  <interface name='org.freedesktop.Accounts'>"
+    "    <method name='ListCachedUsers'>"
+    "      <arg name='users' direction='out' type='ao'/>"
+    "    </method>"
+    "    <method name='CreateUser'>"
+    "      <arg name='name' direction='in' type='s'/>"
+    "      <arg name='fullname' direction='in' type='s'/>"
+    "      <arg name='accountType' direction='in' type='i'/>"
+    "      <arg name='user' direction='out' type='o'/>"
+    "    </method>"
+    "    <signal name='UserAdded'>"
+    "      <arg name='user' type='o'/>"
+    "    </signal>"
+    "    <signal name='UserDeleted'>"
+    "      <arg name='user' type='o'/>"
+    "    </signal>"
+    "  </interface>"
+    "</node>";
+
+static const gchar *user_xml =
+    "<node>"
+    "  <interface name='org.freedesktop.Accounts.User'>"
+    "    <property name='UserName' type='s' access='read'/>"
+    "    <property name='RealName' type='s' access='read'/>"
+    "    <property name='HomeDirectory' type='s' access='read'/>"
+    "    <property name='Shell' type='s' access='read'/>"
+    "    <property name='Uid' type='t' access='read'/>"
+    "    <property name='SystemAccount' type='b' access='read'/>"
+    "    <property name='Locked' type='b' access='read'/>"
+    "    <property name='Language' type='s' access='read'/>"
+    "    <property name='XSession' type='s' access='read'/>"
+    "    <property name='IconFile' type='s' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.freedesktop.DisplayManager.AccountsService'>"
+    "    <property name='BackgroundFile' type='s' access='read'/>"
+    "    <property name='HasMessages' type='b' access='read'/>"
+    "    <property name='KeyboardLayouts' type='as' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+static GDBusNodeInfo *accounts_info;
+static GDBusNodeInfo *user_info;
+
+static gchar *
+mock_user_path (guint index)
+{
+    return g_strdup_printf ("/org/freedesktop/Accounts/User%u", FIRST_UID + index);
+}
+
+static void
+handle_accounts_call (GDBusConnection       *connection,
+                      const gchar           *sender,
+                      const gchar           *object_path,
+                      const gchar           *interface_name,
+                      const gchar           *method_name,
+                      GVariant              *parameters,
+                      GDBusMethodInvocation *invocation,
+                      gpointer               user_data)
+{
+    if (strcmp (method_name, "ListCachedUsers") == 0)
+    {
+        g_autoptr(GVariantBuilder) builder = g_variant_builder_new (G_VARIANT_TYPE ("ao"));
+        for (guint i = 0; i < n_mock_users; i++)
+        {
+            g_autofree gchar *path = mock_user_path (i);
+            g_variant_builder_add (builder, "o", path);
+        }
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(ao)", builder));
+    }
+    else if (strcmp (method_name, "CreateUser") == 0)
+    {
+        g_autofree gchar *path = mock_user_path (n_mock_users);
+        n_mock_users++;
+        g_dbus_connection_emit_signal (connection, NULL, "/org/freedesktop/Accounts", "org.freedesktop.Accounts", "UserAdded",
+                                       g_variant_new ("(o)", path), NULL);
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", path));
+    }
+    else
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "No such method: %s", method_name);
+}
+
+static GVariant *
+handle_user_get_property (GDBusConnection *connection,
+                          const gchar     *sender,
+                          const gchar     *object_path,
+                          const gchar     *interface_name,
+                          const gchar     *property_name,
+                          GError         **error,
+                          gpointer         user_data)
+{
+    guint uid = GPOINTER_TO_UINT (user_data);
+
+    if (strcmp (property_name, "UserName") == 0)
+        return g_variant_new_take_string (g_strdup_printf ("user%u", uid));
+    else if (strcmp (property_name, "RealName") == 0)
+        return g_variant_new_take_string (g_strdup_printf ("User %u", uid));
+    else if (strcmp (property_name, "HomeDirectory") == 0)
+        return g_variant_new_take_string (g_strdup_printf ("/home/user%u", uid));
+    else if (strcmp (property_name, "Shell") == 0)
+        return g_variant_new_string ("/bin/bash");
+    else if (strcmp (property_name, "Uid") == 0)
+        return g_variant_new_uint64 (uid);
+    else if (strcmp (property_name, "SystemAccount") == 0 ||
+             strcmp (property_name, "Locked") == 0 ||
+             strcmp (property_name, "HasMessages") == 0)
+        return g_variant_new_boolean (FALSE);
+    else if (strcmp (property_name, "Language") == 0)
+        return g_variant_new_string ("en_US.UTF-8");
+    else if (strcmp (property_name, "XSession") == 0)
+        return g_variant_new_string ("default");
+    else if (strcmp (property_name, "IconFile") == 0 ||
+             strcmp (property_name, "BackgroundFile") == 0)
+        return g_variant_new_string ("");
+    else if (strcmp (property_name, "KeyboardLayouts") == 0)
+    {
+        const gchar *layouts[] = { "us", NULL };
+        return g_variant_new_strv (layouts, -1);
+    }
+
+    return NULL;
+}
+
+static gchar **
+mock_enumerate (GDBusConnection *connection, const gchar *sender, const gchar *object_path, gpointer user_data)
+{
+    /* Don't list every user, the nodes are dispatched without being enumerated */
+    return g_new0 (gchar *, 1);
+}
+
+static GDBusInterfaceInfo **
+mock_introspect (GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *node, gpointer user_data)
+{
+    GDBusNodeInfo *info = node ? user_info : accounts_info;
+
+    guint n_interfaces = 0;
+    while (info->interfaces[n_interfaces])
+        n_interfaces++;
+    GDBusInterfaceInfo **interfaces = g_new0 (GDBusInterfaceInfo *, n_interfaces + 1);
+    for (guint i = 0; i < n_interfaces; i++)
+        interfaces[i] = g_dbus_interface_info_ref (info->interfaces[i]);
+
+    return interfaces;
+}
+
+static const GDBusInterfaceVTable *
+mock_dispatch (GDBusConnection *connection,
+               const gchar     *sender,
+               const gchar     *object_path,
+               const gchar     *interface_name,
+               const gchar     *node,
+               gpointer        *out_user_data,
+               gpointer         user_data)
+{
+    static const GDBusInterfaceVTable accounts_vtable = { handle_accounts_call };
+    static const GDBusInterfaceVTable user_vtable = { NULL, handle_user_get_property };
+
+    if (!node)
+        return &accounts_vtable;
+
+    guint uid;
+    if (sscanf (node, "User%u", &uid) != 1 || uid < FIRST_UID || uid >= FIRST_UID + n_mock_users)
+        return NULL;
+    *out_user_data = GUINT_TO_POINTER (uid);
+
+    return &user_vtable;
+}
+
+static gboolean
+start_mock_accounts_service (const gchar *address)
+{
+    g_autoptr(GError) error = NULL;
+    mock_connection = g_dbus_connection_new_for_address_sync (address,
+                                                              G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                              NULL, NULL, &error);
+    if (!mock_connection)
+    {
+        g_printerr ("Failed to connect to D-Bus daemon: %s\n", error->message);
+        return FALSE;
+    }
+
+    accounts_info = g_dbus_node_info_new_for_xml (accounts_xml, NULL);
+    user_info = g_dbus_node_info_new_for_xml (user_xml, NULL);
+    static const GDBusSubtreeVTable subtree_vtable = { mock_enumerate, mock_introspect, mock_dispatch };
+    if (g_dbus_connection_register_subtree (mock_connection,
+                                            "/org/freedesktop/Accounts",
+                                            &subtree_vtable,
+                                            G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+                                            NULL, NULL,
+                                            &error) == 0)
+    {
+        g_printerr ("Failed to register mock AccountsService: %s\n", error->message);
+        return FALSE;
+    }
+
+    g_autoptr(GVariant) result = g_dbus_connection_call_sync (mock_connection,
+                                                              "org.freedesktop.DBus",
+                                                              "/org/freedesktop/DBus",
+                                                              "org.freedesktop.DBus",
+                                                              "RequestName",
+                                                              g_variant_new ("(su)", "org.freedesktop.Accounts", 0x4 /* DBUS_NAME_FLAG_DO_NOT_QUEUE */),
+                                                              G_VARIANT_TYPE ("(u)"),
+                                                              G_DBUS_CALL_FLAGS_NONE,
+                                                              -1,
+                                                              NULL,
+                                                              &error);
+    if (!result)
+    {
+        g_printerr ("Failed to own org.freedesktop.Accounts: %s\n", error->message);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+write_passwd_file (const gchar *root, guint n_users)
+{
+    g_autoptr(GString) data = g_string_new ("root:x:0:0:root:/root:/bin/bash\n");
+    for (guint i = 0; i < n_users; i++)
+    {
+        guint uid = FIRST_UID + i;
+        g_string_append_printf (data, "user%u:x:%u:%u:User %u:/home/user%u:/bin/bash\n", uid, uid, uid, uid, uid);
+    }
+
+    g_autofree gchar *path = g_build_filename (root, "etc", "passwd", NULL);
+    g_autoptr(GError) error = NULL;
+    if (!g_file_set_contents (path, data->str, data->len, &error))
+    {
+        g_printerr ("Failed to write %s: %s\n", path, error->message);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gdouble
+elapsed_ms (gint64 start, gint64 end)
+{
+    return (end - start) / 1000.0;
+}
+
+static gboolean
+reconcile_timeout_cb (gpointer data)
+{
+    g_main_loop_quit (loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+user_added_cb (CommonUserList *user_list, CommonUser *user)
+{
+    gint64 now = g_get_monotonic_time ();
+
+    if (first_user_time == 0)
+        first_user_time = now;
+
+    if (reconcile_start_time != 0 && reconciled_time == 0 && g_strcmp0 (common_user_get_name (user), new_user_name) == 0)
+    {
+        reconciled_time = now;
+        g_main_loop_quit (loop);
+    }
+}
+
+static void
+loaded_cb (CommonUserList *user_list)
+{
+    loaded_time = g_get_monotonic_time ();
+    g_main_loop_quit (loop);
+}
+
+/* Add one user the way an administrator would, so the user list has to notice and reconcile */
+static gboolean
+add_new_user (void)
+{
+    guint uid = FIRST_UID + run_users;
+    new_user_name = g_strdup_printf ("user%u", uid);
+
+    if (use_accounts_service)
+    {
+        g_autoptr(GDBusConnection) bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+        if (!bus)
+            return FALSE;
+
+        g_autoptr(GVariant) result = g_dbus_connection_call_sync (bus,
+                                                                  "org.freedesktop.Accounts",
+                                                                  "/org/freedesktop/Accounts",
+                                                                  "org.freedesktop.Accounts",
+                                                                  "CreateUser",
+                                                                  g_variant_new ("(ssi)", new_user_name, "", 0),
+                                                                  G_VARIANT_TYPE ("(o)"),
+                                                                  G_DBUS_CALL_FLAGS_NONE,
+                                                                  -1,
+                                                                  NULL,
+                                                                  NULL);
+        return result != NULL;
+    }
+
+    g_autofree gchar *path = g_build_filename (g_getenv ("LIGHTDM_TEST_ROOT"), "etc", "passwd", NULL);
+    FILE *file = fopen (path, "a");
+    if (!file)
+        return FALSE;
+    fprintf (file, "%s:x:%u:%u:User %u:/home/%s:/bin/bash\n", new_user_name, uid, uid, uid, new_user_name);
+    fclose (file);
+
+    return TRUE;
+}
+
+/* Measure one size, in a process of its own */
+static int
+run_benchmark (void)
+{
+    loop = g_main_loop_new (NULL, FALSE);
+
+    /* Blocking load, as done by the daemon */
+    gint64 start_time = g_get_monotonic_time ();
+    CommonUserList *user_list = common_user_list_get_instance ();
+    guint n_loaded = g_list_length (common_user_list_get_users (user_list));
+    gdouble cold_load_ms = elapsed_ms (start_time, g_get_monotonic_time ());
+    common_user_list_cleanup ();
+
+    /* Asynchronous load, as done by greeters */
+    load_start_time = g_get_monotonic_time ();
+    user_list = common_user_list_get_instance ();
+    g_signal_connect (user_list, USER_LIST_SIGNAL_USER_ADDED, G_CALLBACK (user_added_cb), NULL);
+    g_signal_connect (user_list, USER_LIST_SIGNAL_LOADED, G_CALLBACK (loaded_cb), NULL);
+    common_user_list_load_async (user_list);
+    if (loaded_time == 0)
+        g_main_loop_run (loop);
+
+    /* Change the users and wait for the list to catch up, for the password
+     * file this includes the delay to let the file settle before reloading */
+    reconcile_start_time = g_get_monotonic_time ();
+    if (add_new_user ())
+    {
+        guint timeout = g_timeout_add_seconds (RECONCILE_TIMEOUT, reconcile_timeout_cb, NULL);
+        if (reconciled_time == 0)
+            g_main_loop_run (loop);
+        if (reconciled_time != 0)
+            g_source_remove (timeout);
+    }
+
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+
+    g_autofree gchar *first_user_ms = first_user_time != 0 ? g_strdup_printf ("%.3f", elapsed_ms (load_start_time, first_user_time)) : g_strdup ("null");
+    g_autofree gchar *reconcile_ms = reconciled_time != 0 ? g_strdup_printf ("%.3f", elapsed_ms (reconcile_start_time, reconciled_time)) : g_strdup ("null");
+    g_print ("{\"users\": %d, \"loaded\": %u, \"cold_load_ms\": %.3f, \"first_user_ms\": %s, \"loaded_ms\": %.3f, \"reconcile_ms\": %s, \"peak_rss_kb\": %ld}\n",
+             run_users, n_loaded, cold_load_ms, first_user_ms, elapsed_ms (load_start_time, loaded_time), reconcile_ms, usage.ru_maxrss);
+
+    common_user_list_cleanup ();
+
+    return EXIT_SUCCESS;
+}
+
+static void
+run_done_cb (GObject *object, GAsyncResult *result, gpointer data)
+{
+    g_autoptr(GError) error = NULL;
+    if (!g_subprocess_communicate_utf8_finish (G_SUBPROCESS (object), result, &run_output, NULL, &error))
+        g_printerr ("Failed to run benchmark: %s\n", error->message);
+    g_main_loop_quit (loop);
+}
+
+static gchar *
+run_size (const gchar *root, const gchar *system_bus_address, gint n_users)
+{
+    g_autoptr(GSubprocessLauncher) launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE);
+    g_subprocess_launcher_setenv (launcher, "LIGHTDM_TEST_ROOT", root, TRUE);
+    g_subprocess_launcher_setenv (launcher, "DBUS_SYSTEM_BUS_ADDRESS", system_bus_address, TRUE);
+    if (!use_accounts_service)
+    {
+        /* Serve the password database from the generated file */
+        g_autofree gchar *ld_preload = g_build_filename (BUILDDIR, "tests", "src", ".libs", "libsystem.so", NULL);
+        g_subprocess_launcher_setenv (launcher, "LD_PRELOAD", ld_preload, TRUE);
+        g_subprocess_launcher_setenv (launcher, "LIGHTDM_TEST_WATCH_PASSWD", "1", TRUE);
+    }
+
+    g_autofree gchar *self = g_file_read_link ("/proc/self/exe", NULL);
+    g_autofree gchar *run_arg = g_strdup_printf ("--run=%d", n_users);
+    const gchar *argv[] = { self, run_arg, use_accounts_service ? "--accounts-service" : NULL, NULL };
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GSubprocess) process = g_subprocess_launcher_spawnv (launcher, argv, &error);
+    if (!process)
+    {
+        g_printerr ("Failed to run benchmark: %s\n", error->message);
+        return NULL;
+    }
+
+    /* Keep the main loop running to answer the mock AccountsService calls */
+    g_clear_pointer (&run_output, g_free);
+    g_subprocess_communicate_utf8_async (process, NULL, NULL, run_done_cb, NULL);
+    g_main_loop_run (loop);
+
+    return run_output ? g_strstrip (g_steal_pointer (&run_output)) : NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+    GOptionEntry options[] =
+    {
+        { "users", 'n', 0, G_OPTION_ARG_STRING, &user_counts, "Comma separated numbers of users to load (default 1000,10000,100000)", "N,..." },
+        { "accounts-service", 'a', 0, G_OPTION_ARG_NONE, &use_accounts_service, "Load users from a mock AccountsService instead of /etc/passwd", NULL },
+        { "run", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &run_users, "Measure one size in this process", "N" },
+        { NULL }
+    };
+
+    g_autoptr(GOptionContext) option_context = g_option_context_new ("- benchmark loading large user lists");
+    g_option_context_add_main_entries (option_context, options, NULL);
+    g_autoptr(GError) error = NULL;
+    if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    if (run_users > 0)
+        return run_benchmark ();
+
+    g_auto(GStrv) counts = g_strsplit (user_counts ? user_counts : "1000,10000,100000", ",", -1);
+    for (gint i = 0; counts[i]; i++)
+    {
+        if (atoi (counts[i]) < 1)
+        {
+            g_printerr ("Invalid number of users: %s\n", counts[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    g_autofree gchar *root = g_dir_make_tmp ("lightdm-user-list-XXXXXX", &error);
+    if (!root)
+    {
+        g_printerr ("Failed to make temporary directory: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_autofree gchar *etc_dir = g_build_filename (root, "etc", NULL);
+    g_mkdir (etc_dir, 0755);
+
+    loop = g_main_loop_new (NULL, FALSE);
+
+    /* Without AccountsService the user list falls back to the password database */
+    g_autoptr(GTestDBus) test_bus = NULL;
+    g_autofree gchar *system_bus_address = NULL;
+    if (use_accounts_service)
+    {
+        test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+        g_test_dbus_up (test_bus);
+        system_bus_address = g_strdup (g_test_dbus_get_bus_address (test_bus));
+        if (!start_mock_accounts_service (system_bus_address))
+            return EXIT_FAILURE;
+    }
+    else
+        system_bus_address = g_strdup_printf ("unix:path=%s/no-system-bus", root);
+
+    int status = EXIT_SUCCESS;
+    g_print ("{\n  \"backend\": \"%s\",\n  \"results\": [", use_accounts_service ? "accounts-service" : "passwd");
+    for (gint i = 0; counts[i]; i++)
+    {
+        gint n_users = atoi (counts[i]);
+
+        if (use_accounts_service)
+            n_mock_users = n_users;
+        else if (!write_passwd_file (root, n_users))
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        g_autofree gchar *result = run_size (root, system_bus_address, n_users);
+        if (!result)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+        g_print ("%s\n    %s", i > 0 ? "," : "", result);
+    }
+    g_print ("\n  ]\n}\n");
+
+    g_autofree gchar *passwd_path = g_build_filename (etc_dir, "passwd", NULL);
+    g_remove (passwd_path);
+    g_rmdir (etc_dir);
+    g_rmdir (root);
+    g_clear_object (&mock_connection);
+    if (test_bus)
+        g_test_dbus_down (test_bus);
+
+    return status;
+}
@@ -16,14 +16,21 @@ main (int argc, char **argv)
     g_type_init ();
 #endif
 
+    /* Clients are numbered when there is more than one */
+    g_autofree gchar *name = NULL;
+    if (argc > 2 && strcmp (argv[1], "--id") == 0)
+        name = g_strdup_printf ("VNC-CLIENT-%s", argv[2]);
+    else
+        name = g_strdup ("VNC-CLIENT");
+
     status_connect (NULL, NULL);
 
-    status_notify ("VNC-CLIENT START");
+    status_notify ("%s START", name);
 
     config = g_key_file_new ();
     g_key_file_load_from_file (config, g_build_filename (g_getenv ("LIGHTDM_TEST_ROOT"), "script", NULL), G_KEY_FILE_NONE, NULL);
 
-    status_notify ("VNC-CLIENT CONNECT");
+    status_notify ("%s CONNECT", name);
 
     g_autoptr(GError) error = NULL;
     g_autoptr(GSocket) socket = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, &error);
@@ -52,7 +59,7 @@ main (int argc, char **argv)
     buffer[n_read] = '\0';
     if (g_str_has_suffix (buffer, "\n"))
         buffer[n_read-1] = '\0';
-    status_notify ("VNC-CLIENT CONNECTED VERSION=\"%s\"", buffer);
+    status_notify ("%s CONNECTED VERSION=\"%s\"", name, buffer);
 
     snprintf (buffer, 1024, "RFB 003.003\n");
     gssize n_sent = g_socket_send (socket, buffer, strlen (buffer), NULL, &error);
@@ -73,7 +80,7 @@ main (int argc, char **argv)
 
         if (n_read == 0)
         {
-            status_notify ("VNC-CLIENT DISCONNECTED");
+            status_notify ("%s DISCONNECTED", name);
             return EXIT_SUCCESS;
         }
     }
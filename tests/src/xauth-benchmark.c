@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "src/x-authority.h"
+
+/* Writes Xauthority files holding many records and reports how long the
+ * daemon takes to update them, how many system calls and bytes that costs and
+ * if a reader running at the same time ever saw a partly written file, as
+ * JSON. */
+
+#define DEFAULT_RECORD_COUNTS "10,100,1000,10000"
+#define DEFAULT_ITERATIONS 100
+
+static gchar *record_counts = NULL;
+static gint iterations = DEFAULT_ITERATIONS;
+
+/* Reader checking the file while it is written */
+static const gchar *reader_filename = NULL;
+static gint reader_stop = 0;
+static guint reader_reads = 0;
+static guint reader_torn = 0;
+
+typedef struct
+{
+    guint64 syscalls;
+    guint64 bytes_written;
+} IOCounts;
+
+static void
+get_io_counts (IOCounts *counts)
+{
+    counts->syscalls = 0;
+    counts->bytes_written = 0;
+
+    g_autofree gchar *data = NULL;
+    if (!g_file_get_contents ("/proc/thread-self/io", &data, NULL, NULL))
+        return;
+
+    g_auto(GStrv) lines = g_strsplit (data, "\n", -1);
+    for (gint i = 0; lines[i]; i++)
+    {
+        if (g_str_has_prefix (lines[i], "syscr: ") || g_str_has_prefix (lines[i], "syscw: "))
+            counts->syscalls += g_ascii_strtoull (lines[i] + 7, NULL, 10);
+        else if (g_str_has_prefix (lines[i], "wchar: "))
+            counts->bytes_written = g_ascii_strtoull (lines[i] + 7, NULL, 10);
+    }
+}
+
+static XAuthority *
+make_authority (guint index)
+{
+    guint8 address[4] = { 10, (index >> 16) & 0xFF, (index >> 8) & 0xFF, index & 0xFF };
+    g_autofree gchar *number = g_strdup_printf ("%u", index % 64);
+    return x_authority_new_cookie (XAUTH_FAMILY_INTERNET, address, sizeof (address), number);
+}
+
+static void
+append_field (GByteArray *buffer, const guint8 *value, gsize value_length)
+{
+    guint8 length[2] = { value_length >> 8, value_length & 0xFF };
+    g_byte_array_append (buffer, length, sizeof (length));
+    g_byte_array_append (buffer, value, value_length);
+}
+
+/* Write the file directly, adding the records one at a time would take as long as the benchmark */
+static gboolean
+write_records (const gchar *filename, guint n_records)
+{
+    g_autoptr(GByteArray) buffer = g_byte_array_new ();
+    for (guint i = 0; i < n_records; i++)
+    {
+        g_autoptr(XAuthority) auth = make_authority (i);
+        guint8 family[2] = { x_authority_get_family (auth) >> 8, x_authority_get_family (auth) & 0xFF };
+        g_byte_array_append (buffer, family, sizeof (family));
+        append_field (buffer, x_authority_get_address (auth), x_authority_get_address_length (auth));
+        append_field (buffer, (const guint8 *) x_authority_get_number (auth), strlen (x_authority_get_number (auth)));
+        append_field (buffer, (const guint8 *) x_authority_get_authorization_name (auth), strlen (x_authority_get_authorization_name (auth)));
+        append_field (buffer, x_authority_get_authorization_data (auth), x_authority_get_authorization_data_length (auth));
+    }
+
+    g_autoptr(GError) error = NULL;
+    if (!g_file_set_contents (filename, (const gchar *) buffer->data, buffer->len, &error))
+    {
+        g_printerr ("Failed to write %s: %s\n", filename, error->message);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Change the file behind the daemon's back so it has to read it again */
+static void
+touch_file (const gchar *filename)
+{
+    g_autofree gchar *data = NULL;
+    gsize data_length;
+    if (g_file_get_contents (filename, &data, &data_length, NULL))
+        g_file_set_contents (filename, data, data_length, NULL);
+}
+
+static gboolean
+read_field (const guint8 *data, gsize length, gsize *offset)
+{
+    if (*offset + 2 > length)
+        return FALSE;
+    gsize field_length = data[*offset] << 8 | data[*offset + 1];
+    *offset += 2;
+    if (*offset + field_length > length)
+        return FALSE;
+    *offset += field_length;
+    return TRUE;
+}
+
+/* Check the file only contains whole records */
+static gboolean
+is_complete (const guint8 *data, gsize length)
+{
+    if (length == 0)
+        return FALSE;
+
+    gsize offset = 0;
+    while (offset < length)
+    {
+        /* Family then address, number, name and data */
+        offset += 2;
+        for (gint i = 0; i < 4; i++)
+            if (!read_field (data, length, &offset))
+                return FALSE;
+    }
+
+    return offset == length;
+}
+
+static gpointer
+reader_thread (gpointer data)
+{
+    while (!g_atomic_int_get (&reader_stop))
+    {
+        g_autofree gchar *contents = NULL;
+        gsize length;
+        if (!g_file_get_contents (reader_filename, &contents, &length, NULL))
+            continue;
+        reader_reads++;
+        if (!is_complete ((const guint8 *) contents, length))
+            reader_torn++;
+    }
+
+    return NULL;
+}
+
+typedef enum
+{
+    SETUP_NONE,
+    SETUP_TOUCH,
+    SETUP_REFILL
+} Setup;
+
+/* Run the write repeatedly and give the average cost of one */
+static gboolean
+measure (const gchar *filename, guint n_records, XAuthWriteMode mode, Setup setup, GString *output)
+{
+    gint64 total_time = 0;
+    guint64 total_syscalls = 0, total_bytes = 0;
+
+    for (gint i = 0; i < iterations; i++)
+    {
+        if (setup == SETUP_TOUCH)
+            touch_file (filename);
+        else if (setup == SETUP_REFILL && !write_records (filename, n_records))
+            return FALSE;
+
+        /* Update a record in the middle, or add it back after removing it */
+        g_autoptr(XAuthority) auth = make_authority (n_records / 2);
+        IOCounts start_io, end_io;
+        get_io_counts (&start_io);
+        gint64 start_time = g_get_monotonic_time ();
+        g_autoptr(GError) error = NULL;
+        gboolean result = x_authority_write (auth, mode, filename, &error);
+        if (result && mode == XAUTH_WRITE_MODE_REMOVE)
+            result = x_authority_write (auth, XAUTH_WRITE_MODE_REPLACE, filename, &error);
+        total_time += g_get_monotonic_time () - start_time;
+        get_io_counts (&end_io);
+        if (!result)
+        {
+            g_printerr ("Failed to write %s: %s\n", filename, error->message);
+            return FALSE;
+        }
+
+        total_syscalls += end_io.syscalls - start_io.syscalls;
+        total_bytes += end_io.bytes_written - start_io.bytes_written;
+    }
+
+    g_string_append_printf (output, "{\"ms\": %.3f, \"syscalls\": %.1f, \"bytes_written\": %.0f}",
+                            total_time / 1000.0 / iterations,
+                            (gdouble) total_syscalls / iterations,
+                            (gdouble) total_bytes / iterations);
+
+    return TRUE;
+}
+
+static gchar *
+run_size (const gchar *dir, guint n_records)
+{
+    g_autofree gchar *filename = g_build_filename (dir, "Xauthority", NULL);
+    if (!write_records (filename, n_records))
+        return NULL;
+
+    GStatBuf info;
+    g_stat (filename, &info);
+
+    reader_filename = filename;
+    reader_reads = 0;
+    reader_torn = 0;
+    g_atomic_int_set (&reader_stop, 0);
+    GThread *reader = g_thread_new ("reader", reader_thread, NULL);
+
+    g_autoptr(GString) output = g_string_new ("");
+    g_string_append_printf (output, "{\"records\": %u, \"file_bytes\": %" G_GINT64_FORMAT ", ", n_records, (gint64) info.st_size);
+    g_string_append (output, "\"replace\": ");
+    gboolean result = measure (filename, n_records, XAUTH_WRITE_MODE_REPLACE, SETUP_NONE, output);
+    if (result)
+    {
+        g_string_append (output, ", \"replace_uncached\": ");
+        result = measure (filename, n_records, XAUTH_WRITE_MODE_REPLACE, SETUP_TOUCH, output);
+    }
+    if (result)
+    {
+        g_string_append (output, ", \"remove_add\": ");
+        result = measure (filename, n_records, XAUTH_WRITE_MODE_REMOVE, SETUP_NONE, output);
+    }
+    if (result)
+    {
+        g_string_append (output, ", \"set\": ");
+        result = measure (filename, n_records, XAUTH_WRITE_MODE_SET, SETUP_REFILL, output);
+    }
+
+    g_atomic_int_set (&reader_stop, 1);
+    g_thread_join (reader);
+    g_unlink (filename);
+    if (!result)
+        return NULL;
+
+    g_string_append_printf (output, ", \"reads\": %u, \"torn_reads\": %u}", reader_reads, reader_torn);
+
+    return g_string_free (g_steal_pointer (&output), FALSE);
+}
+
+int
+main (int argc, char **argv)
+{
+    GOptionEntry options[] =
+    {
+        { "records", 'n', 0, G_OPTION_ARG_STRING, &record_counts, "Comma separated numbers of records in the file (default " DEFAULT_RECORD_COUNTS ")", "N,..." },
+        { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Number of times to repeat each write (default 100)", "N" },
+        { NULL }
+    };
+
+    g_autoptr(GOptionContext) option_context = g_option_context_new ("- benchmark writing large Xauthority files");
+    g_option_context_add_main_entries (option_context, options, NULL);
+    g_autoptr(GError) error = NULL;
+    if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    if (iterations < 1)
+    {
+        g_printerr ("Invalid number of iterations: %d\n", iterations);
+        return EXIT_FAILURE;
+    }
+
+    g_auto(GStrv) counts = g_strsplit (record_counts ? record_counts : DEFAULT_RECORD_COUNTS, ",", -1);
+    for (gint i = 0; counts[i]; i++)
+    {
+        if (atoi (counts[i]) < 1)
+        {
+            g_printerr ("Invalid number of records: %s\n", counts[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    g_autofree gchar *dir = g_dir_make_tmp ("lightdm-xauth-XXXXXX", &error);
+    if (!dir)
+    {
+        g_printerr ("Failed to make temporary directory: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    g_print ("{\n  \"iterations\": %d,\n  \"results\": [", iterations);
+    for (gint i = 0; counts[i]; i++)
+    {
+        g_autofree gchar *result = run_size (dir, atoi (counts[i]));
+        if (!result)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+        g_print ("%s\n    %s", i > 0 ? "," : "", result);
+    }
+    g_print ("\n  ]\n}\n");
+
+    g_rmdir (dir);
+
+    return status;
+}
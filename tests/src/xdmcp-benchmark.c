@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "xdmcp-client.h"
+
+/* Simulates X terminals connecting to an XDMCP server and reports how fast it answers */
+
+typedef enum
+{
+    STATE_QUERY,
+    STATE_REQUEST,
+    STATE_KEEP_ALIVE,
+    STATE_DONE
+} TerminalState;
+
+typedef struct
+{
+    XDMCPClient *client;
+
+    /* Display number requested */
+    guint16 display_number;
+
+    /* Step this terminal is waiting on a reply for */
+    TerminalState state;
+
+    /* Number of cycles completed */
+    gint n_cycles;
+
+    /* Session from the last Accept */
+    guint32 session_id;
+
+    /* Time the last packet was sent and the cycle started */
+    gint64 send_time;
+    gint64 cycle_start_time;
+
+    /* Timeout waiting for a reply */
+    guint timeout;
+} Terminal;
+
+static gchar *host = NULL;
+static gint port = XDMCP_PORT;
+static gint n_terminals = 10;
+static gint n_cycles = 10;
+static gint reply_timeout = 1000;
+static gboolean send_manage = FALSE;
+
+static GMainLoop *loop;
+static gint n_running = 0;
+
+/* Statistics */
+static gint n_sent = 0;
+static gint n_replies = 0;
+static gint n_dropped = 0;
+static gint n_rejected = 0;
+static GArray *reply_latencies;
+static GArray *setup_times;
+
+static void send_next (Terminal *terminal);
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+    Terminal *terminal = user_data;
+
+    terminal->timeout = 0;
+    n_dropped++;
+
+    /* Give up on this cycle and start the next one */
+    terminal->n_cycles++;
+    terminal->state = STATE_QUERY;
+    send_next (terminal);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+send_next (Terminal *terminal)
+{
+    if (terminal->timeout != 0)
+        g_source_remove (terminal->timeout);
+    terminal->timeout = 0;
+
+    if (terminal->state == STATE_QUERY)
+    {
+        if (terminal->n_cycles >= n_cycles)
+        {
+            terminal->state = STATE_DONE;
+            n_running--;
+            if (n_running == 0)
+                g_main_loop_quit (loop);
+            return;
+        }
+        terminal->cycle_start_time = g_get_monotonic_time ();
+    }
+
+    terminal->send_time = g_get_monotonic_time ();
+    n_sent++;
+
+    switch (terminal->state)
+    {
+    case STATE_QUERY:
+    {
+        gchar *authentication_names[] = { NULL };
+        xdmcp_client_send_broadcast_query (terminal->client, authentication_names);
+        break;
+    }
+    case STATE_REQUEST:
+    {
+        GInetAddress *addresses[] = { xdmcp_client_get_local_address (terminal->client), NULL };
+        gchar *authorization_names[] = { "MIT-MAGIC-COOKIE-1", NULL };
+        xdmcp_client_send_request (terminal->client, terminal->display_number, addresses, "", NULL, 0, authorization_names, "");
+        break;
+    }
+    case STATE_KEEP_ALIVE:
+        /* Manage has no reply when it succeeds so follow it with a KeepAlive */
+        if (send_manage)
+        {
+            xdmcp_client_send_manage (terminal->client, terminal->session_id, terminal->display_number, "benchmark");
+            n_sent++;
+        }
+        xdmcp_client_send_keep_alive (terminal->client, terminal->display_number, terminal->session_id);
+        break;
+    case STATE_DONE:
+        break;
+    }
+
+    terminal->timeout = g_timeout_add (reply_timeout, timeout_cb, terminal);
+}
+
+static void
+record_reply (Terminal *terminal)
+{
+    gint64 latency = g_get_monotonic_time () - terminal->send_time;
+    g_array_append_val (reply_latencies, latency);
+    n_replies++;
+}
+
+static void
+willing_cb (XDMCPClient *client, XDMCPWilling *message, Terminal *terminal)
+{
+    if (terminal->state != STATE_QUERY)
+        return;
+    record_reply (terminal);
+    terminal->state = STATE_REQUEST;
+    send_next (terminal);
+}
+
+static void
+unwilling_cb (XDMCPClient *client, XDMCPUnwilling *message, Terminal *terminal)
+{
+    if (terminal->state != STATE_QUERY)
+        return;
+    record_reply (terminal);
+    n_rejected++;
+    terminal->n_cycles++;
+    send_next (terminal);
+}
+
+static void
+accept_cb (XDMCPClient *client, XDMCPAccept *message, Terminal *terminal)
+{
+    if (terminal->state != STATE_REQUEST)
+        return;
+    record_reply (terminal);
+    terminal->session_id = message->session_id;
+    terminal->state = STATE_KEEP_ALIVE;
+    send_next (terminal);
+}
+
+static void
+decline_cb (XDMCPClient *client, XDMCPDecline *message, Terminal *terminal)
+{
+    if (terminal->state != STATE_REQUEST)
+        return;
+    record_reply (terminal);
+    n_rejected++;
+    terminal->n_cycles++;
+    terminal->state = STATE_QUERY;
+    send_next (terminal);
+}
+
+static void
+failed_cb (XDMCPClient *client, XDMCPFailed *message, Terminal *terminal)
+{
+    /* Expected when managing as there is no X server to connect to, the KeepAlive still completes the cycle */
+    n_replies++;
+}
+
+static void
+alive_cb (XDMCPClient *client, XDMCPAlive *message, Terminal *terminal)
+{
+    if (terminal->state != STATE_KEEP_ALIVE)
+        return;
+    record_reply (terminal);
+
+    gint64 setup_time = g_get_monotonic_time () - terminal->cycle_start_time;
+    g_array_append_val (setup_times, setup_time);
+
+    terminal->n_cycles++;
+    terminal->state = STATE_QUERY;
+    send_next (terminal);
+}
+
+static gint
+compare_times (gconstpointer a, gconstpointer b)
+{
+    gint64 time_a = *((const gint64 *) a), time_b = *((const gint64 *) b);
+    return time_a < time_b ? -1 : time_a > time_b ? 1 : 0;
+}
+
+static gdouble
+percentile (GArray *times, gdouble fraction)
+{
+    if (times->len == 0)
+        return 0;
+
+    guint index = (guint) (fraction * (times->len - 1) + 0.5);
+    return g_array_index (times, gint64, index) / 1000.0;
+}
+
+static void
+print_times (const gchar *name, GArray *times)
+{
+    g_array_sort (times, compare_times);
+    g_print ("%s (ms): p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+             name,
+             percentile (times, 0.5),
+             percentile (times, 0.9),
+             percentile (times, 0.99),
+             percentile (times, 1.0));
+}
+
+int
+main (int argc, char **argv)
+{
+    GOptionEntry options[] =
+    {
+        { "host", 0, 0, G_OPTION_ARG_STRING, &host, "Host running the XDMCP server (default localhost)", "HOST" },
+        { "port", 0, 0, G_OPTION_ARG_INT, &port, "UDP port of the XDMCP server", "PORT" },
+        { "terminals", 'n', 0, G_OPTION_ARG_INT, &n_terminals, "Number of terminals to simulate", "N" },
+        { "cycles", 'c', 0, G_OPTION_ARG_INT, &n_cycles, "Number of Query/Request/KeepAlive cycles each terminal makes", "N" },
+        { "timeout", 't', 0, G_OPTION_ARG_INT, &reply_timeout, "Milliseconds to wait for a reply before it is counted as dropped", "MS" },
+        { "manage", 'm', 0, G_OPTION_ARG_NONE, &send_manage, "Send Manage packets (the server will try to start sessions)", NULL },
+        { NULL }
+    };
+
+    g_autoptr(GOptionContext) option_context = g_option_context_new ("- benchmark an XDMCP server");
+    g_option_context_add_main_entries (option_context, options, NULL);
+    g_autoptr(GError) error = NULL;
+    if (!g_option_context_parse (option_context, &argc, &argv, &error))
+    {
+        g_printerr ("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    if (n_terminals < 1 || n_cycles < 1 || reply_timeout < 1)
+    {
+        g_printerr ("Terminals, cycles and timeout must be greater than zero\n");
+        return EXIT_FAILURE;
+    }
+
+    loop = g_main_loop_new (NULL, FALSE);
+    reply_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+    setup_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+    Terminal *terminals = g_new0 (Terminal, n_terminals);
+    for (gint i = 0; i < n_terminals; i++)
+    {
+        Terminal *terminal = &terminals[i];
+
+        terminal->client = xdmcp_client_new ();
+        xdmcp_client_set_hostname (terminal->client, host ? host : "localhost");
+        xdmcp_client_set_port (terminal->client, port);
+        g_signal_connect (terminal->client, XDMCP_CLIENT_SIGNAL_WILLING, G_CALLBACK (willing_cb), terminal);
+        g_signal_connect (terminal->client, XDMCP_CLIENT_SIGNAL_UNWILLING, G_CALLBACK (unwilling_cb), terminal);
+        g_signal_connect (terminal->client, XDMCP_CLIENT_SIGNAL_ACCEPT, G_CALLBACK (accept_cb), terminal);
+        g_signal_connect (terminal->client, XDMCP_CLIENT_SIGNAL_DECLINE, G_CALLBACK (decline_cb), terminal);
+        g_signal_connect (terminal->client, XDMCP_CLIENT_SIGNAL_FAILED, G_CALLBACK (failed_cb), terminal);
+        g_signal_connect (terminal->client, XDMCP_CLIENT_SIGNAL_ALIVE, G_CALLBACK (alive_cb), terminal);
+        if (!xdmcp_client_start (terminal->client))
+        {
+            g_printerr ("Failed to start XDMCP client\n");
+            return EXIT_FAILURE;
+        }
+        terminal->display_number = i + 1;
+        terminal->state = STATE_QUERY;
+    }
+
+    gint64 start_time = g_get_monotonic_time ();
+    n_running = n_terminals;
+    for (gint i = 0; i < n_terminals; i++)
+        send_next (&terminals[i]);
+
+    g_main_loop_run (loop);
+
+    gdouble duration = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+
+    g_print ("Terminals: %d, cycles per terminal: %d, duration: %.3fs\n", n_terminals, n_cycles, duration);
+    g_print ("Packets sent: %d, replies: %d, dropped: %d (%.1f%%), rejected: %d\n",
+             n_sent, n_replies, n_dropped, n_sent > 0 ? n_dropped * 100.0 / n_sent : 0.0, n_rejected);
+    g_print ("Throughput: %.1f packets/s sent, %.1f replies/s\n", n_sent / duration, n_replies / duration);
+    print_times ("Reply latency", reply_latencies);
+    print_times ("Session setup", setup_times);
+
+    return EXIT_SUCCESS;
+}